@@ -0,0 +1,185 @@
+// mtcssbench: cost of finding unused CSS across a whole site.
+//
+//   mtcssbench [--pages N] [--rules N]
+//
+// Generates N pages (2,000 by default) built from a shared set of
+// components, each using Zipf-distributed classes, and a stylesheet of N
+// rules (4,000 by default) whose selectors name one to three compounds,
+// half of them with classes no page uses. Times collecting each page's
+// names, building the bitset index and pruning the stylesheet. Every
+// selector's verdict is checked against a scan of the pages' name sets; the
+// bench exits non-zero if any differ.
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdint>
+#include <cstdlib>
+#include <exception>
+#include <set>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "gen/css_usage.h"
+#include "gen/selector.h"
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+constexpr std::size_t kClasses = 3000;  // used by pages
+constexpr std::size_t kElementsPerPage = 300;
+
+[[noreturn]] void usage() {
+  std::fprintf(stderr, "usage: mtcssbench [--pages N] [--rules N]\n");
+  std::exit(2);
+}
+
+struct Random {
+  std::uint64_t state = 0x9e3779b97f4a7c15;
+  std::uint64_t next() {
+    state ^= state << 13;
+    state ^= state >> 7;
+    state ^= state << 17;
+    return state;
+  }
+  double unit() { return static_cast<double>(next() >> 11) / 9007199254740992.0; }
+};
+
+// Rank in [0, n) with probability falling as 1/rank.
+std::size_t zipf(Random& rng, std::size_t n) {
+  return std::min(n - 1, static_cast<std::size_t>(std::exp(rng.unit() * std::log(static_cast<double>(n)))) - 1);
+}
+
+constexpr std::string_view kTags[] = {"div", "span", "a", "p", "li", "ul", "section", "h2", "img", "button"};
+
+std::string class_name(std::size_t i) { return "c" + std::to_string(i); }
+
+std::string make_page(Random& rng) {
+  std::string html = "<!DOCTYPE html><html><head><title>t</title></head><body>";
+  for (std::size_t e = 0; e < kElementsPerPage; ++e) {
+    auto tag = kTags[rng.next() % std::size(kTags)];
+    html += '<';
+    html += tag;
+    html += " class=\"";
+    auto classes = 1 + rng.next() % 3;
+    for (std::uint64_t k = 0; k < classes; ++k) html += class_name(zipf(rng, kClasses)) + " ";
+    html += "\">x</";
+    html += tag;
+    html += '>';
+  }
+  return html + "</body></html>";
+}
+
+// A compound selector with a tag, a class or both; half of the classes
+// come from names no page uses.
+std::string make_compound(Random& rng) {
+  std::string s;
+  auto kind = rng.next() % 3;
+  if (kind != 1) s += kTags[rng.next() % std::size(kTags)];
+  if (kind != 0) s += "." + class_name(rng.next() % 2 == 0 ? zipf(rng, kClasses) : kClasses + rng.next() % kClasses);
+  return s;
+}
+
+std::string make_stylesheet(Random& rng, std::size_t rules) {
+  constexpr std::string_view kCombinators[] = {" ", " > ", " + ", " ~ "};
+  std::string css;
+  for (std::size_t r = 0; r < rules; ++r) {
+    auto compounds = 1 + rng.next() % 3;
+    for (std::uint64_t k = 0; k < compounds; ++k) {
+      if (k > 0) css += kCombinators[rng.next() % std::size(kCombinators)];
+      css += make_compound(rng);
+    }
+    if (rng.next() % 4 == 0) css += ", " + make_compound(rng);
+    css += "{color:red}\n";
+  }
+  return css;
+}
+
+double ms(Clock::duration d) { return std::chrono::duration<double, std::milli>(d).count(); }
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  std::size_t n = 2000;
+  std::size_t rules = 4000;
+  for (int i = 1; i < argc; ++i) {
+    std::string_view arg = argv[i];
+    if (i + 1 >= argc) usage();
+    if (arg == "--pages") {
+      n = static_cast<std::size_t>(std::atoll(argv[++i]));
+    } else if (arg == "--rules") {
+      rules = static_cast<std::size_t>(std::atoll(argv[++i]));
+    } else {
+      usage();
+    }
+  }
+  if (n == 0 || rules == 0) usage();
+
+  try {
+    Random rng;
+    std::vector<std::string> pages;
+    for (std::size_t i = 0; i < n; ++i) pages.push_back(make_page(rng));
+    auto css = make_stylesheet(rng, rules);
+
+    auto start = Clock::now();
+    std::vector<std::vector<std::string>> names;
+    for (const auto& page : pages) names.push_back(mt::gen::page_names(page));
+    auto names_ms = ms(Clock::now() - start);
+
+    start = Clock::now();
+    mt::gen::CssUsage usage;
+    for (const auto& page : names) usage.add_page(page);
+    auto index_ms = ms(Clock::now() - start);
+
+    start = Clock::now();
+    auto pruned = mt::gen::prune_css(css, usage);
+    auto prune_ms = ms(Clock::now() - start);
+
+    // The reference: every page's names as a set, and each selector's
+    // names looked up in each page's set in turn.
+    std::vector<std::set<std::string, std::less<>>> sets;
+    for (const auto& page : names) sets.emplace_back(page.begin(), page.end());
+    std::size_t selectors = 0, live = 0, mismatches = 0;
+    start = Clock::now();
+    for (std::size_t at = 0; at < css.size();) {
+      auto brace = css.find('{', at);
+      auto list = std::string_view(css).substr(at, brace - at);
+      at = css.find('\n', brace) + 1;
+      for (std::size_t from = 0; from <= list.size();) {
+        auto comma = std::min(list.find(',', from), list.size());
+        auto parsed = mt::gen::parse_selectors(list.substr(from, comma - from));
+        from = comma + 1;
+        if (!parsed) continue;
+        for (const auto& sel : *parsed) {
+          std::vector<std::string> wanted;
+          for (const auto& c : sel.compounds) {
+            if (!c.tag.empty()) wanted.push_back(c.tag);
+            for (const auto& cls : c.classes) wanted.push_back("." + cls);
+          }
+          bool expected = std::any_of(sets.begin(), sets.end(), [&](const auto& set) {
+            return std::all_of(wanted.begin(), wanted.end(), [&](const auto& w) { return set.contains(w); });
+          });
+          ++selectors;
+          live += expected;
+          mismatches += expected != usage.may_match(sel);
+        }
+      }
+    }
+    auto reference_ms = ms(Clock::now() - start);
+
+    std::printf("pages:     %zu, %zu elements each\n", n, kElementsPerPage);
+    std::printf("names:     %.1f ms (%.1f us per page)\n", names_ms, 1000 * names_ms / static_cast<double>(n));
+    std::printf("index:     %.1f ms\n", index_ms);
+    std::printf("prune:     %.1f ms for %zu rules, %zu dropped, %zu -> %zu bytes\n", prune_ms, pruned.rules,
+                pruned.dropped, css.size(), pruned.css ? pruned.css->size() : css.size());
+    std::printf("reference: %.1f ms (set lookups per page)\n", reference_ms);
+    std::printf("check:     %zu selectors, %zu may match, %zu mismatches\n", selectors, live, mismatches);
+    return mismatches == 0 ? 0 : 1;
+  } catch (const std::exception& e) {
+    std::fprintf(stderr, "mtcssbench: %s\n", e.what());
+    return 1;
+  }
+}
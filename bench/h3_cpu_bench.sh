@@ -0,0 +1,57 @@
+#!/bin/sh
+# Compares the server CPU time each protocol spends per gigabit it sends:
+# HTTP/1.1, HTTP/2 and HTTP/3 with and without UDP GSO/GRO, all over
+# loopback. The CPU time is mtserve's user + system time from /proc.
+#
+#   bench/h3_cpu_bench.sh [BUILD_DIR] [mtload args...]
+#
+# MT_BENCH_PATH picks the file (default /index.html); MT_SERVE_ARGS is
+# passed to mtserve. Needs a build with OpenSSL; the certificate is a
+# throwaway one made with openssl(1).
+set -eu
+
+build=${1:-build}
+[ $# -gt 0 ] && shift
+root=$(cd "$(dirname "$0")/.." && pwd)
+port=${MT_BENCH_PORT:-18080}
+h3_port=${MT_BENCH_H3_PORT:-18443}
+path=${MT_BENCH_PATH:-/index.html}
+tmp=$(mktemp -d)
+server=
+trap '[ -n "$server" ] && kill $server 2>/dev/null; rm -rf "$tmp"' EXIT INT TERM
+
+openssl req -x509 -newkey ec -pkeyopt ec_paramgen_curve:P-256 -nodes -subj /CN=localhost -days 1 \
+  -keyout "$tmp/key.pem" -out "$tmp/cert.pem" 2>/dev/null
+
+# CPU seconds, user and system, process $1 has used.
+cpu() { awk -v hz="$(getconf CLK_TCK)" '{ printf "%.2f", ($14 + $15) / hz }' "/proc/$1/stat"; }
+
+# run NAME "MTSERVE ARGS" "MTLOAD ARGS" [mtload args...]
+run() {
+  name=$1 serve_args=$2 load_args=$3
+  shift 3
+  "$build/mtserve" --root "$root" --host 127.0.0.1 --port "$port" --h3-port "$h3_port" \
+    --tls-cert "$tmp/cert.pem" --tls-key "$tmp/key.pem" $serve_args ${MT_SERVE_ARGS:-} 2>/dev/null &
+  server=$!
+  sleep 0.3
+  before=$(cpu $server)
+  "$build/mtload" --path "$path" --connections 32 --pipeline 4 --duration 10 $load_args "$@" >"$tmp/out" || true
+  after=$(cpu $server)
+  kill $server
+  wait $server 2>/dev/null || true
+  server=
+  awk -v name="$name" -v cpu="$(echo "$after $before" | awk '{ print $1 - $2 }')" '
+    /^mtload:/ { for (i = 1; i <= NF; ++i) if ($i ~ /s$/ && $i + 0 > 0) { secs = $i + 0; break } }
+    /^transfer:/ { rate = $2 }
+    /^requests:/ { errors = $NF }
+    END {
+      gbit = rate * 1048576 * 8 * secs / 1e9
+      per = gbit > 0 ? cpu / gbit : 0
+      printf "%-14s %9.1f MiB/s  %6.2f CPU-s  %6.2f CPU-s/Gbit  errors %s\n", name, rate, cpu, per, errors
+    }' "$tmp/out"
+}
+
+run http/1.1 "" "--port $port" "$@"
+run h2 "" "--port $port --h2" "$@"
+run h3 "" "--port $h3_port --h3" "$@"
+run h3-no-offload "--no-udp-offload" "--port $h3_port --h3" "$@"
@@ -0,0 +1,184 @@
+// mthtmlbench: throughput of the build's HTML stage on one core.
+//
+//   mthtmlbench [--duration SECONDS] [DIR]
+//
+// Runs gen::HtmlChecker over every .html file under DIR, or over a
+// generated corpus of blog-like pages when no DIR is given. The check-only
+// pass and the check-and-minify pass are timed separately. Reports pages/s,
+// MiB/s and the minified size.
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <exception>
+#include <filesystem>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "gen/files.h"
+#include "gen/html.h"
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+[[noreturn]] void usage() {
+  std::fprintf(stderr, "usage: mthtmlbench [--duration SECONDS] [DIR]\n");
+  std::exit(2);
+}
+
+// A deterministic page of roughly `paragraphs` * 400 bytes with the usual
+// mix of head metadata, navigation, prose, inline markup, lists, code and
+// tables, indented the way templates emit it.
+std::string make_page(std::uint32_t seed, int paragraphs) {
+  static constexpr std::string_view kWords[] = {
+      "latency", "the",   "cache",  "of",    "kernel", "a",       "request", "and",  "thread", "to",
+      "socket",  "in",    "buffer", "is",    "core",   "with",    "page",    "for",  "queue",  "on",
+      "memory",  "that",  "batch",  "it",    "ring",   "as",      "vector",  "by",   "branch", "this",
+  };
+  auto next = [&seed] {
+    seed = seed * 1664525u + 1013904223u;
+    return seed >> 8;
+  };
+  auto sentence = [&](std::string& out) {
+    int words = 8 + static_cast<int>(next() % 12);
+    for (int w = 0; w < words; ++w) {
+      if (w) out += ' ';
+      auto word = kWords[next() % std::size(kWords)];
+      switch (next() % 16) {
+        case 0:
+          out += "<em>";
+          out += word;
+          out += "</em>";
+          break;
+        case 1:
+          out += "<a href=\"/posts/";
+          out += word;
+          out += ".html\">";
+          out += word;
+          out += "</a>";
+          break;
+        case 2:
+          out += "<code>";
+          out += word;
+          out += "&lt;T&gt;</code>";
+          break;
+        default:
+          out += word;
+      }
+    }
+    out += ". ";
+  };
+
+  std::string page =
+      "<!DOCTYPE html>\n<html lang=\"en\">\n  <head>\n    <meta charset=\"utf-8\">\n"
+      "    <meta name=\"viewport\" content=\"width=device-width, initial-scale=1\">\n"
+      "    <title>Post</title>\n    <link rel=\"stylesheet\" href=\"/css/site.css\">\n  </head>\n"
+      "  <body>\n    <header>\n      <nav>\n        <ul>\n"
+      "          <li><a href=\"/\">Home</a></li>\n          <li><a href=\"/posts/\">Posts</a></li>\n"
+      "          <li><a href=\"/about.html\">About</a></li>\n        </ul>\n      </nav>\n    </header>\n"
+      "    <main>\n      <article>\n        <h1>Notes</h1>\n";
+  for (int p = 0; p < paragraphs; ++p) {
+    page += "        <p>\n          ";
+    for (int s = 0; s < 3; ++s) sentence(page);
+    page += "\n        </p>\n";
+    switch (p % 6) {
+      case 2:
+        page += "        <ul>\n";
+        for (int i = 0; i < 4; ++i) {
+          page += "          <li>";
+          sentence(page);
+          page += "</li>\n";
+        }
+        page += "        </ul>\n";
+        break;
+      case 4:
+        page += "        <pre><code>for (auto&amp; c : conns) {\n  flush(c);\n}\n</code></pre>\n";
+        break;
+      case 5:
+        page += "        <table>\n          <tr><th>p50</th><th>p99</th></tr>\n"
+                "          <tr><td>41 us</td><td>180 us</td></tr>\n        </table>\n";
+        break;
+      default:
+        break;
+    }
+  }
+  page += "        <!-- end of post -->\n      </article>\n    </main>\n"
+          "    <footer><p>&copy; 2024</p></footer>\n  </body>\n</html>\n";
+  return page;
+}
+
+struct Result {
+  double pages_per_sec;
+  double mib_per_sec;
+  std::size_t output_bytes;
+};
+
+Result run(const std::vector<std::string>& pages, bool minify, double duration) {
+  mt::gen::HtmlChecker checker;
+  std::string out;
+  std::size_t input_bytes = 0, output_bytes = 0, done = 0;
+  auto start = Clock::now();
+  auto deadline = start + std::chrono::duration<double>(duration);
+  do {
+    for (const auto& page : pages) {
+      auto errors = checker.run(page, minify ? &out : nullptr);
+      if (!errors.empty()) throw std::runtime_error("benchmark page has errors: " + errors.front().message);
+      input_bytes += page.size();
+      output_bytes += minify ? out.size() : page.size();
+    }
+    done += pages.size();
+  } while (Clock::now() < deadline);
+  double secs = std::chrono::duration<double>(Clock::now() - start).count();
+  return {static_cast<double>(done) / secs, static_cast<double>(input_bytes) / secs / (1 << 20),
+          output_bytes / (done / pages.size())};
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  double duration = 3.0;
+  std::string dir;
+  for (int i = 1; i < argc; ++i) {
+    std::string_view arg = argv[i];
+    if (arg == "--duration" && i + 1 < argc) {
+      duration = std::atof(argv[++i]);
+    } else if (!arg.starts_with("-") && dir.empty()) {
+      dir = arg;
+    } else {
+      usage();
+    }
+  }
+
+  try {
+    std::vector<std::string> pages;
+    if (dir.empty()) {
+      for (std::uint32_t i = 0; i < 64; ++i) pages.push_back(make_page(i + 1, 24 + static_cast<int>(i % 16)));
+    } else {
+      for (const auto& entry : std::filesystem::recursive_directory_iterator(dir)) {
+        if (entry.is_regular_file() && entry.path().extension() == ".html") {
+          pages.push_back(mt::gen::read_file(entry.path()));
+        }
+      }
+      if (pages.empty()) throw std::runtime_error("no .html files under " + dir);
+    }
+    std::size_t total = 0;
+    for (const auto& p : pages) total += p.size();
+
+    std::printf("%zu pages, %zu bytes, %s kernel\n", pages.size(), total,
+                std::string(mt::gen::html_scan_kernel()).c_str());
+    for (bool minify : {false, true}) {
+      auto r = run(pages, minify, duration);
+      std::printf("%-15s %10.0f pages/s  %8.1f MiB/s", minify ? "check+minify" : "check", r.pages_per_sec,
+                  r.mib_per_sec);
+      if (minify) std::printf("  output %zu bytes (%.1f%%)", r.output_bytes, 100.0 * r.output_bytes / total);
+      std::printf("\n");
+    }
+  } catch (const std::exception& e) {
+    std::fprintf(stderr, "mthtmlbench: %s\n", e.what());
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,166 @@
+// mthttpbench: cost of parsing HTTP/1.1 request heads.
+//
+//   mthttpbench [--duration SECONDS] [--pipeline N]
+//
+// Parses three request heads: a bare `GET /` as curl sends it, a browser's
+// 660-byte GET with the usual headers, and a path with escapes and dot
+// segments to normalize. Each is repeated N times back to back (16 by
+// default), as a pipelining client sends them, and parsed the way mtserve
+// does, by calling parse_request again at each `consumed`. Reports the time
+// per request and the input rate for each scanner this CPU supports. The
+// parse rewrites paths in place, so every round first restores the buffer;
+// that copy is timed on its own and subtracted. Every scanner's results are
+// checked against the scalar one's, and the bench exits non-zero if any
+// differ.
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "http.h"
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+using mt::http::ParseStatus;
+using mt::http::Scanner;
+
+[[noreturn]] void usage() {
+  std::fprintf(stderr, "usage: mthttpbench [--duration SECONDS] [--pipeline N]\n");
+  std::exit(2);
+}
+
+struct Kind {
+  const char* name;
+  std::string_view head;
+};
+
+const Kind kKinds[] = {
+    {"curl", "GET / HTTP/1.1\r\nHost: localhost:8080\r\nUser-Agent: curl/8.5.0\r\nAccept: */*\r\n\r\n"},
+    {"browser",
+     "GET /index.html HTTP/1.1\r\n"
+     "Host: www.matthewtolman.com\r\n"
+     "Connection: keep-alive\r\n"
+     "sec-ch-ua: \"Chromium\";v=\"126\", \"Google Chrome\";v=\"126\", \"Not-A.Brand\";v=\"8\"\r\n"
+     "sec-ch-ua-mobile: ?0\r\n"
+     "sec-ch-ua-platform: \"Linux\"\r\n"
+     "Upgrade-Insecure-Requests: 1\r\n"
+     "User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/126.0.0.0 "
+     "Safari/537.36\r\n"
+     "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,image/avif,image/webp,image/apng,*/*;q=0.8\r\n"
+     "Sec-Fetch-Site: none\r\n"
+     "Sec-Fetch-Mode: navigate\r\n"
+     "Sec-Fetch-User: ?1\r\n"
+     "Sec-Fetch-Dest: document\r\n"
+     "Accept-Encoding: gzip, deflate, br, zstd\r\n"
+     "Accept-Language: en-US,en;q=0.9\r\n"
+     "If-None-Match: \"8f2c61d0a4b7e935\"\r\n"
+     "\r\n"},
+    {"normalize", "GET /posts/./2024/../2025//%63ache%2Dfriendly-servers.html?ref=feed HTTP/1.1\r\nHost: x\r\n\r\n"},
+};
+
+const char* scanner_name(Scanner s) {
+  switch (s) {
+    case Scanner::avx2:
+      return "avx2";
+    case Scanner::sse42:
+      return "sse4.2";
+    default:
+      return "scalar";
+  }
+}
+
+// Parses every request in `buf`. Returns how many parsed, or 0 if any did
+// not; `paths` gets their paths when given.
+std::size_t parse_all(std::string& buf, Scanner scanner, std::vector<std::string>* paths) {
+  std::size_t off = 0;
+  std::size_t count = 0;
+  while (off < buf.size()) {
+    mt::http::Request req;
+    std::size_t consumed = 0;
+    auto status = mt::http::parse_request(std::span<char>(buf.data() + off, buf.size() - off), req, consumed, scanner);
+    if (status != ParseStatus::complete) return 0;
+    if (paths != nullptr) paths->emplace_back(req.path);
+    off += consumed;
+    ++count;
+  }
+  return count;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  double duration = 3;
+  std::size_t pipeline = 16;
+  for (int i = 1; i < argc; ++i) {
+    std::string_view arg = argv[i];
+    if (i + 1 >= argc) usage();
+    if (arg == "--duration") {
+      duration = std::atof(argv[++i]);
+    } else if (arg == "--pipeline") {
+      pipeline = std::strtoull(argv[++i], nullptr, 10);
+    } else {
+      usage();
+    }
+  }
+  if (duration <= 0 || pipeline == 0) usage();
+
+  try {
+    std::vector<Scanner> scanners = {Scanner::scalar};
+    if (mt::http::best_scanner() >= Scanner::sse42) scanners.push_back(Scanner::sse42);
+    if (mt::http::best_scanner() >= Scanner::avx2) scanners.push_back(Scanner::avx2);
+    auto slice = std::chrono::duration<double>(duration / static_cast<double>(std::size(kKinds) * scanners.size()));
+
+    std::printf("mthttpbench: %zu requests per buffer\n", pipeline);
+    int failures = 0;
+    for (const auto& kind : kKinds) {
+      std::string pristine;
+      for (std::size_t i = 0; i < pipeline; ++i) pristine += kind.head;
+      std::string buf = pristine;
+      std::vector<std::string> expected;
+      parse_all(buf, Scanner::scalar, &expected);
+
+      // The per-round restore, to subtract.
+      std::size_t rounds = 0;
+      auto start = Clock::now();
+      do {
+        std::memcpy(buf.data(), pristine.data(), pristine.size());
+        asm volatile("" : : "r"(buf.data()) : "memory");
+        ++rounds;
+      } while (Clock::now() - start < slice / 4);
+      std::chrono::duration<double, std::nano> copy_ns = Clock::now() - start;
+      double copy_per_round = copy_ns.count() / static_cast<double>(rounds);
+
+      for (auto scanner : scanners) {
+        buf = pristine;
+        std::vector<std::string> paths;
+        if (parse_all(buf, scanner, &paths) != pipeline || paths != expected) {
+          std::printf("  %-9s %-6s  MISMATCH\n", kind.name, scanner_name(scanner));
+          ++failures;
+          continue;
+        }
+        rounds = 0;
+        std::size_t parsed = 0;
+        start = Clock::now();
+        do {
+          std::memcpy(buf.data(), pristine.data(), pristine.size());
+          parsed += parse_all(buf, scanner, nullptr);
+          ++rounds;
+        } while (Clock::now() - start < slice);
+        std::chrono::duration<double, std::nano> took = Clock::now() - start;
+        double ns = (took.count() - copy_per_round * static_cast<double>(rounds)) / static_cast<double>(parsed);
+        std::printf("  %-9s %-6s  %7.1f ns per request  %6.2f GB/s  (%zu-byte head)\n", kind.name,
+                    scanner_name(scanner), ns, static_cast<double>(kind.head.size()) / ns, kind.head.size());
+      }
+    }
+    return failures == 0 ? 0 : 1;
+  } catch (const std::exception& e) {
+    std::fprintf(stderr, "mthttpbench: %s\n", e.what());
+    return 1;
+  }
+}
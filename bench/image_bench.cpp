@@ -0,0 +1,125 @@
+// mtimagebench: resampling and encoding cost of the build's image stage.
+//
+//   mtimagebench [--width N] [--height N] [--rounds N]
+//
+// Generates a photo-like image (4000x3000 by default), resizes it to each
+// width the build publishes and reports the best of --rounds for each,
+// then times one encode per format this build can write at 1280 pixels
+// wide. Also resizes a flat gray image and exits non-zero if any output
+// pixel strays from it, which would mean the filter weights do not sum
+// to one.
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <exception>
+#include <string>
+#include <string_view>
+
+#include "gen/image.h"
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+constexpr std::array<std::uint32_t, 5> kWidths = {320, 640, 960, 1280, 1920};
+
+[[noreturn]] void usage() {
+  std::fprintf(stderr, "usage: mtimagebench [--width N] [--height N] [--rounds N]\n");
+  std::exit(2);
+}
+
+// Smooth gradients under fine texture, so both the filter and the
+// encoders have something to work on.
+mt::gen::Image make_image(std::uint32_t width, std::uint32_t height) {
+  mt::gen::Image image;
+  image.width = width;
+  image.height = height;
+  image.rgba.resize(std::size_t{width} * height * 4);
+  std::uint32_t seed = 1;
+  for (std::uint32_t y = 0; y < height; ++y) {
+    for (std::uint32_t x = 0; x < width; ++x) {
+      seed = seed * 1664525u + 1013904223u;
+      auto* p = &image.rgba[(std::size_t{y} * width + x) * 4];
+      auto noise = static_cast<int>(seed >> 28) - 8;
+      p[0] = static_cast<std::uint8_t>(std::clamp<int>(255 * x / width + noise, 0, 255));
+      p[1] = static_cast<std::uint8_t>(std::clamp<int>(255 * y / height + noise, 0, 255));
+      p[2] = static_cast<std::uint8_t>(128 + 100 * std::sin(x * 0.02) * std::cos(y * 0.015));
+      p[3] = 255;
+    }
+  }
+  return image;
+}
+
+double ms(Clock::duration d) { return std::chrono::duration<double, std::milli>(d).count(); }
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  std::uint32_t width = 4000, height = 3000;
+  int rounds = 3;
+  for (int i = 1; i < argc; ++i) {
+    std::string_view arg = argv[i];
+    if (i + 1 >= argc) usage();
+    if (arg == "--width") {
+      width = static_cast<std::uint32_t>(std::atoi(argv[++i]));
+    } else if (arg == "--height") {
+      height = static_cast<std::uint32_t>(std::atoi(argv[++i]));
+    } else if (arg == "--rounds") {
+      rounds = std::atoi(argv[++i]);
+    } else {
+      usage();
+    }
+  }
+  if (width == 0 || height == 0 || rounds <= 0) usage();
+
+  try {
+    auto image = make_image(width, height);
+    auto megapixels = static_cast<double>(width) * height / 1e6;
+    std::printf("%ux%u, %s kernel\n", width, height, std::string(mt::gen::image_resize_kernel()).c_str());
+    for (auto w : kWidths) {
+      if (w >= width) continue;
+      double best = 1e300;
+      mt::gen::Image out;
+      for (int r = 0; r < rounds; ++r) {
+        auto start = Clock::now();
+        out = mt::gen::resize_image(image, w);
+        best = std::min(best, ms(Clock::now() - start));
+      }
+      std::printf("resize %4u    %8.1f ms  %6.1f MP/s in\n", w, best, megapixels / best * 1000);
+    }
+
+    auto mid = mt::gen::resize_image(image, std::min<std::uint32_t>(1280, width));
+    for (auto f : {mt::gen::ImageFormat::jpeg, mt::gen::ImageFormat::png, mt::gen::ImageFormat::webp,
+                   mt::gen::ImageFormat::avif}) {
+      if (!mt::gen::image_encoder_available(f)) continue;
+      auto start = Clock::now();
+      auto bytes = mt::gen::encode_image(mid, f, 80);
+      std::printf("encode %-5s   %8.1f ms  %8zu bytes at %ux%u\n", std::string(mt::gen::image_extension(f)).c_str(),
+                  ms(Clock::now() - start), bytes.size(), mid.width, mid.height);
+    }
+
+    mt::gen::Image gray;
+    gray.width = 1000;
+    gray.height = 700;
+    gray.rgba.assign(std::size_t{gray.width} * gray.height * 4, 0);
+    for (std::size_t i = 0; i < gray.rgba.size(); ++i) gray.rgba[i] = i % 4 == 3 ? 255 : 119;
+    for (auto w : kWidths) {
+      auto out = mt::gen::resize_image(gray, std::min(w, gray.width - 1));
+      for (std::size_t i = 0; i < out.rgba.size(); ++i) {
+        if (out.rgba[i] != gray.rgba[i % 4]) {
+          std::fprintf(stderr, "mtimagebench: flat gray resized to %u has %d at byte %zu\n", out.width, out.rgba[i], i);
+          return 1;
+        }
+      }
+    }
+  } catch (const std::exception& e) {
+    std::fprintf(stderr, "mtimagebench: %s\n", e.what());
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,244 @@
+// mtmdbench: throughput of the Markdown compiler on one core.
+//
+//   mtmdbench [--duration SECONDS] [DIR]
+//   mtmdbench --spec spec.txt
+//
+// Compiles every .md file under DIR, or a generated corpus of blog-like
+// posts when no DIR is given, and reports documents/s and MiB/s of input.
+//
+// With --spec it instead runs the examples of a CommonMark spec.txt (the
+// spec's own source, where each example is a fenced "example" block with
+// the Markdown and the expected HTML split by a "." line). Like the spec's
+// runner it compares normalized HTML, which here only means &quot; and '"'
+// are the same. It prints each failing example and exits non-zero if any
+// failed.
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <exception>
+#include <filesystem>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "gen/files.h"
+#include "gen/markdown.h"
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+[[noreturn]] void usage() {
+  std::fprintf(stderr, "usage: mtmdbench [--duration SECONDS] [DIR]\n       mtmdbench --spec spec.txt\n");
+  std::exit(2);
+}
+
+// A deterministic post of roughly `sections` * 1.5 KiB: headings, prose with
+// emphasis, code spans and links, lists, quotes, code blocks and reference
+// definitions.
+std::string make_post(std::uint32_t seed, int sections) {
+  static constexpr std::string_view kWords[] = {
+      "latency", "the",   "cache",  "of",    "kernel", "a",       "request", "and",  "thread", "to",
+      "socket",  "in",    "buffer", "is",    "core",   "with",    "page",    "for",  "queue",  "on",
+      "memory",  "that",  "batch",  "it",    "ring",   "as",      "vector",  "by",   "branch", "this",
+  };
+  auto next = [&seed] {
+    seed = seed * 1664525u + 1013904223u;
+    return seed >> 8;
+  };
+  auto sentence = [&](std::string& out) {
+    int words = 8 + static_cast<int>(next() % 12);
+    for (int w = 0; w < words; ++w) {
+      if (w) out += ' ';
+      auto word = kWords[next() % std::size(kWords)];
+      switch (next() % 20) {
+        case 0:
+          out += '*';
+          out += word;
+          out += '*';
+          break;
+        case 1:
+          out += "**";
+          out += word;
+          out += "**";
+          break;
+        case 2:
+          out += '`';
+          out += word;
+          out += "<T>`";
+          break;
+        case 3:
+          out += '[';
+          out += word;
+          out += "](/posts/";
+          out += word;
+          out += ".html)";
+          break;
+        case 4:
+          out += '[';
+          out += word;
+          out += "][ref]";
+          break;
+        default:
+          out += word;
+      }
+    }
+    out += ". ";
+  };
+
+  std::string post = "# Notes on queues\n\n";
+  for (int s = 0; s < sections; ++s) {
+    post += "## Section ";
+    post += std::to_string(s + 1);
+    post += "\n\n";
+    for (int p = 0; p < 2; ++p) {
+      for (int i = 0; i < 3; ++i) {
+        sentence(post);
+        post += '\n';
+      }
+      post += '\n';
+    }
+    switch (s % 4) {
+      case 0:
+        for (int i = 0; i < 4; ++i) {
+          post += "- ";
+          sentence(post);
+          post += '\n';
+        }
+        break;
+      case 1:
+        post += "```cpp\nfor (auto& c : conns) {\n  if (c.ready() && c.bytes > 0) flush(c);\n}\n```\n";
+        break;
+      case 2:
+        post += "> ";
+        sentence(post);
+        post += "\n> ";
+        sentence(post);
+        post += '\n';
+        break;
+      default:
+        for (int i = 0; i < 3; ++i) {
+          post += std::to_string(i + 1);
+          post += ". ";
+          sentence(post);
+          post += '\n';
+        }
+        break;
+    }
+    post += '\n';
+  }
+  post += "[ref]: /posts/reference.html \"Reference\"\n";
+  return post;
+}
+
+int run_spec(const std::string& path) {
+  std::string spec = mt::gen::read_file(path);
+  static constexpr std::string_view kFence = "```````````````````````````````` example\n";
+  static constexpr std::string_view kEnd = "````````````````````````````````\n";
+  mt::gen::MarkdownCompiler compiler;
+  std::string html;
+  int passed = 0, failed = 0;
+  auto untab = [](std::string_view s) {
+    std::string r;
+    for (std::size_t i = 0; i < s.size(); ++i) {
+      if (s.substr(i, 3) == "\xe2\x86\x92") {
+        r += '\t';
+        i += 2;
+      } else {
+        r += s[i];
+      }
+    }
+    return r;
+  };
+  auto normalize = [](std::string s) {
+    for (std::size_t i; (i = s.find("&quot;")) != std::string::npos;) s.replace(i, 6, "\"");
+    return s;
+  };
+  std::size_t pos = 0;
+  int example = 0;
+  while ((pos = spec.find(kFence, pos)) != std::string::npos) {
+    pos += kFence.size();
+    auto dot = spec.find("\n.\n", pos - 1);
+    auto end = spec.find(kEnd, dot);
+    if (dot == std::string::npos || end == std::string::npos) throw std::runtime_error("malformed example");
+    ++example;
+    auto markdown = untab(std::string_view(spec).substr(pos, dot + 1 - pos));
+    auto expected = untab(std::string_view(spec).substr(dot + 3, end - dot - 3));
+    html.clear();
+    compiler.compile(markdown, html);
+    if (normalize(html) == normalize(expected)) {
+      ++passed;
+    } else {
+      ++failed;
+      std::printf("example %d failed\n--- markdown\n%s--- expected\n%s--- got\n%s\n", example, markdown.c_str(),
+                  expected.c_str(), html.c_str());
+    }
+    pos = end + kEnd.size();
+  }
+  std::printf("%d of %d examples passed\n", passed, passed + failed);
+  return failed ? 1 : 0;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  double duration = 3.0;
+  std::string dir, spec;
+  for (int i = 1; i < argc; ++i) {
+    std::string_view arg = argv[i];
+    if (arg == "--duration" && i + 1 < argc) {
+      duration = std::atof(argv[++i]);
+    } else if (arg == "--spec" && i + 1 < argc) {
+      spec = argv[++i];
+    } else if (!arg.starts_with("-") && dir.empty()) {
+      dir = arg;
+    } else {
+      usage();
+    }
+  }
+
+  try {
+    if (!spec.empty()) return run_spec(spec);
+
+    std::vector<std::string> docs;
+    if (dir.empty()) {
+      for (std::uint32_t i = 0; i < 64; ++i) docs.push_back(make_post(i + 1, 8 + static_cast<int>(i % 16)));
+    } else {
+      for (const auto& entry : std::filesystem::recursive_directory_iterator(dir)) {
+        if (entry.is_regular_file() && entry.path().extension() == ".md") {
+          docs.push_back(mt::gen::read_file(entry.path()));
+        }
+      }
+      if (docs.empty()) throw std::runtime_error("no .md files under " + dir);
+    }
+    std::size_t total = 0;
+    for (const auto& d : docs) total += d.size();
+
+    mt::gen::MarkdownCompiler compiler;
+    std::string html;
+    std::size_t input_bytes = 0, output_bytes = 0, done = 0;
+    auto start = Clock::now();
+    auto deadline = start + std::chrono::duration<double>(duration);
+    do {
+      for (const auto& doc : docs) {
+        html.clear();
+        compiler.compile(doc, html);
+        input_bytes += doc.size();
+        output_bytes += html.size();
+      }
+      done += docs.size();
+    } while (Clock::now() < deadline);
+    double secs = std::chrono::duration<double>(Clock::now() - start).count();
+
+    std::printf("%zu documents, %zu bytes\n", docs.size(), total);
+    std::printf("%10.0f docs/s  %8.1f MiB/s  output %zu bytes per pass\n", static_cast<double>(done) / secs,
+                static_cast<double>(input_bytes) / secs / (1 << 20), output_bytes / (done / docs.size()));
+  } catch (const std::exception& e) {
+    std::fprintf(stderr, "mtmdbench: %s\n", e.what());
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,138 @@
+// mtmetricsbench: cost and accuracy of mtserve's latency histograms.
+//
+//   mtmetricsbench [--samples N] [--threads N]
+//
+// Each of N threads (2 by default) records N log-normally distributed
+// latencies (5,000,000 by default, median 30us) into a worker's histogram
+// while another thread renders /metrics in a loop, as a scraper would.
+// Reports the time per recorded sample and per render. The merged
+// quantiles are checked against the exact ones from sorting every sample:
+// each must be at least the exact value and within 1/16 above it. The bench
+// exits non-zero if any is not.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <exception>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "metrics.h"
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+[[noreturn]] void usage() {
+  std::fprintf(stderr, "usage: mtmetricsbench [--samples N] [--threads N]\n");
+  std::exit(2);
+}
+
+struct Random {
+  std::uint64_t state = 0x9e3779b97f4a7c15;
+  std::uint64_t next() {
+    state ^= state << 13;
+    state ^= state >> 7;
+    state ^= state << 17;
+    return state;
+  }
+  double unit() { return (static_cast<double>(next() >> 11) + 0.5) / 9007199254740992.0; }
+};
+
+// Nanoseconds, log-normal around 30us with a long tail.
+std::vector<std::uint64_t> make_samples(std::size_t n, std::uint64_t seed) {
+  Random rng{seed};
+  std::vector<std::uint64_t> out(n);
+  for (auto& v : out) {
+    double normal = std::sqrt(-2 * std::log(rng.unit())) * std::cos(6.283185307179586 * rng.unit());
+    v = static_cast<std::uint64_t>(30000 * std::exp(0.8 * normal));
+  }
+  return out;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  std::size_t samples = 5000000;
+  std::size_t threads = 2;
+  for (int i = 1; i < argc; ++i) {
+    std::string_view arg = argv[i];
+    if (i + 1 >= argc) usage();
+    if (arg == "--samples") {
+      samples = std::strtoull(argv[++i], nullptr, 10);
+    } else if (arg == "--threads") {
+      threads = std::strtoull(argv[++i], nullptr, 10);
+    } else {
+      usage();
+    }
+  }
+  if (samples == 0 || threads == 0) usage();
+
+  try {
+    std::vector<std::vector<std::uint64_t>> inputs;
+    for (std::size_t t = 0; t < threads; ++t) inputs.push_back(make_samples(samples, 0x9e3779b97f4a7c15 + t));
+
+    mt::Metrics metrics;
+    std::vector<mt::WorkerMetrics*> workers;
+    for (std::size_t t = 0; t < threads; ++t) workers.push_back(&metrics.add_worker());
+
+    std::atomic<bool> done{false};
+    std::size_t renders = 0;
+    std::thread scraper([&] {
+      while (!done.load(std::memory_order_relaxed)) {
+        [[maybe_unused]] auto text = metrics.render();
+        ++renders;
+      }
+    });
+    std::vector<double> record_ns(threads);
+    std::vector<std::thread> recorders;
+    auto start = Clock::now();
+    for (std::size_t t = 0; t < threads; ++t) {
+      recorders.emplace_back([&, t] {
+        auto begin = Clock::now();
+        for (auto v : inputs[t]) workers[t]->latency.record(v);
+        std::chrono::duration<double, std::nano> took = Clock::now() - begin;
+        record_ns[t] = took.count() / static_cast<double>(samples);
+      });
+    }
+    for (auto& r : recorders) r.join();
+    std::chrono::duration<double> elapsed = Clock::now() - start;
+    done = true;
+    scraper.join();
+
+    mt::HistogramSnapshot merged;
+    for (auto* w : workers) merged.merge(w->latency);
+    std::vector<std::uint64_t> all;
+    for (auto& in : inputs) all.insert(all.end(), in.begin(), in.end());
+    std::sort(all.begin(), all.end());
+
+    std::printf("mtmetricsbench: %zu samples x %zu threads\n", samples, threads);
+    for (std::size_t t = 0; t < threads; ++t) std::printf("  thread %zu: %.2f ns per sample\n", t, record_ns[t]);
+    std::printf("  renders:  %zu while recording, %.1f us each\n", renders,
+                renders ? elapsed.count() * 1e6 / static_cast<double>(renders) : 0.0);
+
+    int failures = 0;
+    if (merged.total != all.size()) {
+      std::printf("  count %llu, expected %zu\n", static_cast<unsigned long long>(merged.total), all.size());
+      ++failures;
+    }
+    for (double q : {0.5, 0.9, 0.99, 0.999, 0.9999, 1.0}) {
+      auto rank = std::max<std::size_t>(1, static_cast<std::size_t>(std::ceil(q * static_cast<double>(all.size()))));
+      auto exact = all[rank - 1];
+      auto got = merged.quantile(q);
+      bool ok = got >= exact && got - exact <= exact / mt::Histogram::kSubBuckets;
+      std::printf("  p%-7g %10llu ns, exact %10llu ns%s\n", q * 100, static_cast<unsigned long long>(got),
+                  static_cast<unsigned long long>(exact), ok ? "" : "  MISMATCH");
+      failures += !ok;
+    }
+    return failures == 0 ? 0 : 1;
+  } catch (const std::exception& e) {
+    std::fprintf(stderr, "mtmetricsbench: %s\n", e.what());
+    return 1;
+  }
+}
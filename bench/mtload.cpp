@@ -0,0 +1,729 @@
+// mtload: closed-loop keep-alive HTTP/1.1, HTTP/2 and HTTP/3 load generator.
+//
+//   mtload [--host ADDR] [--port N] [--path /] [--connections N]
+//          [--threads N] [--duration SECONDS] [--pipeline N]
+//          [--tls] [--h2 | --h3 [--loss PERCENT]]
+//
+// Each connection keeps `pipeline` GET requests in flight and sends the next
+// batch as soon as the previous one is fully answered. Reports throughput and
+// batch round-trip latency percentiles.
+//
+// With --h2 each connection speaks HTTP/2 with prior knowledge and the
+// batch is `pipeline` concurrent streams, as h2load -m sends them. The
+// client opens its flow-control windows to the maximum, so the server sets
+// the pace. A response counts as an error unless its header block starts
+// with the static-table :status 200.
+//
+// With --h3 (builds with OpenSSL) each connection is QUIC over a UDP
+// socket of its own, and the batch is `pipeline` request streams. The
+// server's certificate is not verified. A response counts as an error
+// unless its field section starts with the static-table :status 200.
+// --loss drops that share of the datagrams sent and received, to compare
+// the protocols on a lossy link.
+//
+// With --tls (builds with OpenSSL) HTTP/1.1 and HTTP/2 connections speak
+// TLS 1.3, offering the protocol by ALPN; again the certificate is not
+// verified. Throughput counts the bytes decrypted.
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <charconv>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <random>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#ifdef MT_HAVE_OPENSSL
+#include "qpack.h"
+#include "quic.h"
+#include "tls.h"
+#endif
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+struct Options {
+  std::string host = "127.0.0.1";
+  std::uint16_t port = 8080;
+  std::string path = "/";
+  unsigned connections = 64;
+  unsigned threads = 0;
+  double duration = 10.0;
+  unsigned pipeline = 1;
+  bool h2 = false;
+  bool h3 = false;
+  bool tls = false;
+  double loss = 0;  // of datagrams, 0 to 1
+};
+
+struct Stats {
+  std::uint64_t responses = 0;
+  std::uint64_t bytes = 0;
+  std::uint64_t errors = 0;
+  std::vector<std::uint32_t> latency_us;
+};
+
+#ifdef MT_HAVE_OPENSSL
+std::uint64_t now_ns() {
+  return static_cast<std::uint64_t>(
+      std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now().time_since_epoch()).count());
+}
+
+// An HTTP/3 connection's QUIC state and its response streams.
+class H3 final : public mt::quic::Application {
+ public:
+  H3(const std::string& host, Stats& stats) : stats_(stats), quic(*this, host, "h3", limits(), now_ns()) {
+    // Our control stream: its type, then an empty SETTINGS frame.
+    quic.write(quic.open_uni(), std::string("\x00\x04\x00", 3));
+  }
+
+  void on_stream_data(std::uint64_t stream, std::string_view data, bool fin) override {
+    if (stream & 2) return;  // the server's control and QPACK streams
+    auto& head = heads_[stream];
+    if (head.size() < kHeadCheck) {
+      head.append(data.substr(0, kHeadCheck - head.size()));
+      // A HEADERS frame: type, a 1- or 2-byte length, then the section.
+      if (head.size() == kHeadCheck) {
+        std::size_t at = 1 + (static_cast<unsigned char>(head[1]) >> 6 == 0 ? 1 : 2);
+        if (head[0] != 0x1 || head.substr(at, 3) != std::string_view("\x00\x00\xd9", 3)) ++stats_.errors;
+      }
+    }
+    if (!fin) return;
+    if (head.size() < kHeadCheck) ++stats_.errors;
+    heads_.erase(stream);
+    ++stats_.responses;
+    ++completed;
+  }
+  void on_stream_reset(std::uint64_t stream) override {
+    if (stream & 2) return;
+    heads_.erase(stream);
+    ++stats_.errors;
+    ++completed;
+  }
+  void on_stream_acked(std::uint64_t) override {}
+
+ private:
+  static constexpr std::size_t kHeadCheck = 6;
+  // Windows large enough that the server's congestion control sets the
+  // pace.
+  static mt::quic::Limits limits() {
+    mt::quic::Limits l;
+    l.max_data = 64 << 20;
+    l.max_stream_data = 16 << 20;
+    return l;
+  }
+
+  Stats& stats_;
+  std::unordered_map<std::uint64_t, std::string> heads_;
+
+ public:
+  mt::quic::Connection quic;
+  unsigned completed = 0;  // responses of the batch
+};
+#endif
+
+struct Conn {
+  int fd = -1;
+  std::size_t sent = 0;       // bytes of the current batch already written
+  unsigned outstanding = 0;   // responses still expected for the batch
+  bool in_body = false;
+  std::size_t body_left = 0;
+  std::size_t rlen = 0;
+  std::vector<char> rbuf = std::vector<char>(64 * 1024);
+  Clock::time_point batch_start;
+  // HTTP/2: the next stream id, and DATA bytes not yet given back in a
+  // WINDOW_UPDATE.
+  std::uint32_t next_stream = 1;
+  std::uint64_t unacked = 0;
+#ifdef MT_HAVE_OPENSSL
+  std::unique_ptr<H3> h3;
+  // --tls: the session, and what it has decrypted that rbuf had no room
+  // for.
+  std::unique_ptr<mt::tls::Session> tls;
+  std::string plain;
+#endif
+};
+
+constexpr std::string_view kPreface = "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n";
+constexpr std::size_t kFrameHeaderSize = 9;
+constexpr std::uint32_t kMaxWindow = 0x7fffffff;
+
+void frame_header(std::string& out, std::size_t length, std::uint8_t type, std::uint8_t flags,
+                  std::uint32_t stream) {
+  out += static_cast<char>(length >> 16);
+  out += static_cast<char>(length >> 8);
+  out += static_cast<char>(length);
+  out += static_cast<char>(type);
+  out += static_cast<char>(flags);
+  for (int shift = 24; shift >= 0; shift -= 8) out += static_cast<char>(stream >> shift);
+}
+
+void put32(std::string& out, std::uint32_t v) {
+  for (int shift = 24; shift >= 0; shift -= 8) out += static_cast<char>(v >> shift);
+}
+
+// An HPACK string literal, not Huffman-coded. Values here are short.
+void literal(std::string& out, std::string_view s) {
+  out += static_cast<char>(s.size());
+  out += s;
+}
+
+[[noreturn]] void usage() {
+  std::fprintf(stderr,
+               "usage: mtload [--host ADDR] [--port N] [--path /] [--connections N] [--threads N]\n"
+               "              [--duration SECONDS] [--pipeline N] [--tls] [--h2 | --h3 [--loss PERCENT]]\n");
+  std::exit(2);
+}
+
+char lower(char c) { return (c >= 'A' && c <= 'Z') ? static_cast<char>(c | 0x20) : c; }
+
+// Returns the Content-Length of a response head, or 0 when absent.
+std::size_t content_length(std::string_view head) {
+  constexpr std::string_view kName = "\r\ncontent-length:";
+  for (std::size_t i = 0; i + kName.size() <= head.size(); ++i) {
+    std::size_t j = 0;
+    while (j < kName.size() && lower(head[i + j]) == kName[j]) ++j;
+    if (j != kName.size()) continue;
+    auto p = head.data() + i + j;
+    while (*p == ' ') ++p;
+    std::size_t n = 0;
+    std::from_chars(p, head.data() + head.size(), n);
+    return n;
+  }
+  return 0;
+}
+
+class Client {
+ public:
+  Client(const Options& o, const sockaddr_in& addr, unsigned conns, std::string batch)
+      : o_(o), addr_(addr), batch_(std::move(batch)), conns_(conns) {}
+
+  void run(Clock::time_point deadline);
+  Stats stats;
+
+ private:
+  bool connect(Conn& c);
+  ssize_t receive(Conn& c, char* buf, std::size_t size);
+  bool send_all(Conn& c, std::string_view data);
+  bool send_batch(Conn& c);
+  bool on_readable(Conn& c);
+  bool on_readable_h2(Conn& c);
+#ifdef MT_HAVE_OPENSSL
+  bool handshake(Conn& c);
+  bool send_tls(Conn& c);
+  bool connect_h3(Conn& c);
+  bool on_readable_h3(Conn& c);
+  bool flush_h3(Conn& c);
+  int run_timers_h3();
+#endif
+  void reset(Conn& c);
+
+  const Options& o_;
+  sockaddr_in addr_;
+  std::string batch_;
+  std::vector<Conn> conns_;
+  int epoll_fd_ = -1;
+  std::minstd_rand random_;
+  std::uniform_real_distribution<double> uniform_;
+};
+
+bool Client::connect(Conn& c) {
+  c = Conn{};
+#ifdef MT_HAVE_OPENSSL
+  if (o_.h3) return connect_h3(c);
+#endif
+  c.fd = ::socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (c.fd < 0) return false;
+  int one = 1;
+  ::setsockopt(c.fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof one);
+  if (::connect(c.fd, reinterpret_cast<const sockaddr*>(&addr_), sizeof addr_) != 0) {
+    ::close(c.fd);
+    c.fd = -1;
+    return false;
+  }
+  epoll_event ev{};
+  ev.events = EPOLLIN;
+  ev.data.ptr = &c;
+  ::epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, c.fd, &ev);
+#ifdef MT_HAVE_OPENSSL
+  if (o_.tls && !handshake(c)) return false;
+#endif
+  if (o_.h2) {
+    // The preface, then windows as large as they go.
+    std::string preface(kPreface);
+    frame_header(preface, 6, 0x4, 0, 0);
+    preface += '\0';
+    preface += '\x4';  // SETTINGS_INITIAL_WINDOW_SIZE
+    put32(preface, kMaxWindow);
+    frame_header(preface, 4, 0x8, 0, 0);
+    put32(preface, kMaxWindow - 65535);
+    if (!send_all(c, preface)) return false;
+  }
+  return send_batch(c);
+}
+
+#ifdef MT_HAVE_OPENSSL
+// Runs the TLS handshake to its end, blocking, as connect() does.
+bool Client::handshake(Conn& c) {
+  c.tls = std::make_unique<mt::tls::Session>(o_.host, o_.h2 ? "h2" : "http/1.1");
+  while (send_tls(c) && !c.tls->established()) {
+    ssize_t n = ::recv(c.fd, c.rbuf.data(), c.rbuf.size(), 0);
+    if (n <= 0 || !c.tls->receive(std::string_view(c.rbuf.data(), static_cast<std::size_t>(n)), c.plain)) {
+      return false;
+    }
+  }
+  return c.tls->established();
+}
+
+bool Client::send_tls(Conn& c) {
+  for (auto out = c.tls->pending(); !out.empty(); out = c.tls->pending()) {
+    ssize_t n = ::send(c.fd, out.data(), out.size(), MSG_NOSIGNAL);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      return false;
+    }
+    c.tls->sent(static_cast<std::size_t>(n));
+  }
+  return true;
+}
+#endif
+
+// Reads as recv does, through the TLS session if there is one.
+ssize_t Client::receive(Conn& c, char* buf, std::size_t size) {
+#ifdef MT_HAVE_OPENSSL
+  if (c.tls) {
+    while (c.plain.empty()) {
+      ssize_t n = ::recv(c.fd, buf, size, MSG_DONTWAIT);
+      if (n <= 0) return n;
+      if (!c.tls->receive(std::string_view(buf, static_cast<std::size_t>(n)), c.plain) || !send_tls(c)) return 0;
+    }
+    auto n = std::min(size, c.plain.size());
+    std::memcpy(buf, c.plain.data(), n);
+    c.plain.erase(0, n);
+    return static_cast<ssize_t>(n);
+  }
+#endif
+  return ::recv(c.fd, buf, size, MSG_DONTWAIT);
+}
+
+// Requests are a few dozen bytes, so a batch always fits in the socket
+// buffer of a fresh or drained connection; a blocking send is fine here.
+bool Client::send_all(Conn& c, std::string_view data) {
+#ifdef MT_HAVE_OPENSSL
+  if (c.tls) {
+    iovec iov{const_cast<char*>(data.data()), data.size()};
+    c.tls->write(&iov, 1, data.size());
+    return send_tls(c);
+  }
+#endif
+  c.sent = 0;
+  while (c.sent < data.size()) {
+    ssize_t n = ::send(c.fd, data.data() + c.sent, data.size() - c.sent, MSG_NOSIGNAL);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      return false;
+    }
+    c.sent += static_cast<std::size_t>(n);
+  }
+  return true;
+}
+
+bool Client::send_batch(Conn& c) {
+  c.batch_start = Clock::now();
+  c.outstanding = o_.pipeline;
+#ifdef MT_HAVE_OPENSSL
+  if (c.h3) {
+    c.h3->completed = 0;
+    for (unsigned i = 0; i < o_.pipeline; ++i) {
+      auto id = c.h3->quic.open_bidi();
+      if (id == UINT64_MAX) return false;
+      c.h3->quic.write(id, batch_);
+      c.h3->quic.finish(id);
+    }
+    return flush_h3(c);
+  }
+#endif
+  if (o_.h2) {
+    // A fresh connection before stream ids run out.
+    if (c.next_stream > kMaxWindow - 2 * o_.pipeline) return false;
+    // The batch is `pipeline` HEADERS frames of equal size; each gets the
+    // next stream id.
+    auto frame = batch_.size() / o_.pipeline;
+    for (std::size_t at = 5; at < batch_.size(); at += frame, c.next_stream += 2) {
+      for (int i = 0; i < 4; ++i) batch_[at + i] = static_cast<char>(c.next_stream >> (24 - 8 * i));
+    }
+  }
+  return send_all(c, batch_);
+}
+
+bool Client::on_readable(Conn& c) {
+#ifdef MT_HAVE_OPENSSL
+  if (c.h3) return on_readable_h3(c);
+#endif
+  if (o_.h2) return on_readable_h2(c);
+  ssize_t n = receive(c, c.rbuf.data() + c.rlen, c.rbuf.size() - c.rlen);
+  if (n <= 0) return n < 0 && (errno == EAGAIN || errno == EINTR);
+  c.rlen += static_cast<std::size_t>(n);
+  stats.bytes += static_cast<std::uint64_t>(n);
+
+  std::size_t pos = 0;
+  for (;;) {
+    if (c.in_body) {
+      auto take = std::min(c.body_left, c.rlen - pos);
+      pos += take;
+      c.body_left -= take;
+      if (c.body_left > 0) break;
+      c.in_body = false;
+      ++stats.responses;
+      if (--c.outstanding == 0) {
+        auto us = std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - c.batch_start);
+        stats.latency_us.push_back(static_cast<std::uint32_t>(us.count()));
+        if (pos != c.rlen || !send_batch(c)) return false;
+      }
+      continue;
+    }
+    std::string_view buf(c.rbuf.data() + pos, c.rlen - pos);
+    auto end = buf.find("\r\n\r\n");
+    if (end == std::string_view::npos) break;
+    auto head = buf.substr(0, end + 2);
+    if (head.size() < 12 || head.substr(9, 3) != "200") ++stats.errors;
+    c.body_left = content_length(head);
+    c.in_body = true;
+    pos += end + 4;
+  }
+  std::memmove(c.rbuf.data(), c.rbuf.data() + pos, c.rlen - pos);
+  c.rlen -= pos;
+  return c.rlen < c.rbuf.size();
+}
+
+bool Client::on_readable_h2(Conn& c) {
+  ssize_t n = receive(c, c.rbuf.data() + c.rlen, c.rbuf.size() - c.rlen);
+  if (n <= 0) return n < 0 && (errno == EAGAIN || errno == EINTR);
+  c.rlen += static_cast<std::size_t>(n);
+  stats.bytes += static_cast<std::uint64_t>(n);
+
+  std::string reply;
+  std::size_t pos = 0;
+  bool batch_done = false;
+  while (c.rlen - pos >= kFrameHeaderSize) {
+    auto p = reinterpret_cast<const unsigned char*>(c.rbuf.data() + pos);
+    std::size_t length = static_cast<std::size_t>(p[0]) << 16 | static_cast<std::size_t>(p[1]) << 8 | p[2];
+    if (c.rlen - pos < kFrameHeaderSize + length) break;
+    auto type = p[3];
+    auto flags = p[4];
+    const unsigned char* payload = p + kFrameHeaderSize;
+    pos += kFrameHeaderSize + length;
+    bool end_stream = false;
+    switch (type) {
+      case 0x0:  // DATA
+        c.unacked += length;
+        end_stream = flags & 0x1;
+        break;
+      case 0x1:  // HEADERS, unpadded and without priority from mtserve
+        if (length == 0 || payload[0] != 0x88) ++stats.errors;
+        end_stream = flags & 0x1;
+        break;
+      case 0x3:  // RST_STREAM
+        ++stats.errors;
+        end_stream = true;
+        break;
+      case 0x4:  // SETTINGS
+        if ((flags & 0x1) == 0) frame_header(reply, 0, 0x4, 0x1, 0);
+        break;
+      case 0x6:  // PING
+        if ((flags & 0x1) == 0 && length == 8) {
+          frame_header(reply, 8, 0x6, 0x1, 0);
+          reply.append(reinterpret_cast<const char*>(payload), 8);
+        }
+        break;
+      case 0x7:  // GOAWAY
+        return false;
+      default:
+        break;
+    }
+    if (!end_stream) continue;
+    ++stats.responses;
+    if (--c.outstanding == 0) {
+      auto us = std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - c.batch_start);
+      stats.latency_us.push_back(static_cast<std::uint32_t>(us.count()));
+      batch_done = true;
+    }
+  }
+  if (c.unacked >= kMaxWindow / 2) {
+    frame_header(reply, 4, 0x8, 0, 0);
+    put32(reply, static_cast<std::uint32_t>(c.unacked));
+    c.unacked = 0;
+  }
+  if (!reply.empty() && !send_all(c, reply)) return false;
+  std::memmove(c.rbuf.data(), c.rbuf.data() + pos, c.rlen - pos);
+  c.rlen -= pos;
+  if (batch_done && !send_batch(c)) return false;
+  return true;
+}
+
+#ifdef MT_HAVE_OPENSSL
+// The first batch goes once the handshake is done.
+bool Client::connect_h3(Conn& c) {
+  c.fd = ::socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (c.fd < 0) return false;
+  if (::connect(c.fd, reinterpret_cast<const sockaddr*>(&addr_), sizeof addr_) != 0) {
+    ::close(c.fd);
+    c.fd = -1;
+    return false;
+  }
+  epoll_event ev{};
+  ev.events = EPOLLIN;
+  ev.data.ptr = &c;
+  ::epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, c.fd, &ev);
+  c.h3 = std::make_unique<H3>(o_.host, stats);
+  return flush_h3(c);
+}
+
+bool Client::on_readable_h3(Conn& c) {
+  auto& quic = c.h3->quic;
+  for (;;) {
+    ssize_t n = ::recv(c.fd, c.rbuf.data(), c.rbuf.size(), MSG_DONTWAIT);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      if (errno == EAGAIN) break;
+      return false;
+    }
+    stats.bytes += static_cast<std::uint64_t>(n);
+    if (o_.loss > 0 && uniform_(random_) < o_.loss) continue;
+    quic.receive({reinterpret_cast<std::uint8_t*>(c.rbuf.data()), static_cast<std::size_t>(n)}, now_ns());
+  }
+  if (c.outstanding > 0 && c.h3->completed >= o_.pipeline) {
+    auto us = std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - c.batch_start);
+    stats.latency_us.push_back(static_cast<std::uint32_t>(us.count()));
+    c.outstanding = 0;
+  }
+  if (c.outstanding == 0 && quic.established()) return send_batch(c);
+  return flush_h3(c);
+}
+
+// Sends the connection's datagrams, dropping --loss of them. Returns false
+// once it is closed.
+bool Client::flush_h3(Conn& c) {
+  auto& quic = c.h3->quic;
+  std::uint8_t datagram[mt::quic::kMaxDatagramSize];
+  auto now = now_ns();
+  while (auto n = quic.send(datagram, now)) {
+    if (o_.loss > 0 && uniform_(random_) < o_.loss) continue;
+    ::send(c.fd, datagram, n, 0);
+  }
+  return !quic.closed();
+}
+
+// Fires the connections' due timers. Returns epoll_wait()'s timeout, in
+// ms, until the next.
+int Client::run_timers_h3() {
+  auto now = now_ns();
+  std::uint64_t next = UINT64_MAX;
+  for (auto& c : conns_) {
+    if (!c.h3) continue;
+    if (c.h3->quic.next_timeout() <= now) {
+      c.h3->quic.on_timeout(now);
+      if (!flush_h3(c)) {
+        reset(c);
+        if (!connect(c)) reset(c);
+        continue;
+      }
+    }
+    next = std::min(next, c.h3->quic.next_timeout());
+  }
+  if (next == UINT64_MAX) return 100;
+  return static_cast<int>(std::min<std::uint64_t>((next - std::min(next, now) + 999999) / 1000000, 100));
+}
+#endif
+
+void Client::reset(Conn& c) {
+  ++stats.errors;
+  if (c.fd >= 0) ::close(c.fd);
+  c.fd = -1;
+#ifdef MT_HAVE_OPENSSL
+  c.h3.reset();
+  c.tls.reset();
+#endif
+}
+
+void Client::run(Clock::time_point deadline) {
+  epoll_fd_ = ::epoll_create1(EPOLL_CLOEXEC);
+  for (auto& c : conns_) {
+    if (!connect(c)) reset(c);
+  }
+  std::vector<epoll_event> events(conns_.size() + 1);
+  while (Clock::now() < deadline) {
+    int timeout = 100;
+#ifdef MT_HAVE_OPENSSL
+    if (o_.h3) timeout = run_timers_h3();
+#endif
+    int n = ::epoll_wait(epoll_fd_, events.data(), static_cast<int>(events.size()), timeout);
+    for (int i = 0; i < n; ++i) {
+      auto& c = *static_cast<Conn*>(events[i].data.ptr);
+      bool ok = on_readable(c);
+#ifdef MT_HAVE_OPENSSL
+      // What the session decrypted beyond rbuf's room; the socket will not
+      // signal it again.
+      while (ok && c.tls && !c.plain.empty()) ok = on_readable(c);
+#endif
+      if (!ok) {
+        reset(c);
+        if (!connect(c)) reset(c);
+      }
+    }
+  }
+  for (auto& c : conns_) {
+    if (c.fd >= 0) ::close(c.fd);
+  }
+  ::close(epoll_fd_);
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  Options o;
+  for (int i = 1; i < argc; ++i) {
+    std::string_view arg = argv[i];
+    auto value = [&]() -> const char* {
+      if (i + 1 >= argc) usage();
+      return argv[++i];
+    };
+    if (arg == "--host") {
+      o.host = value();
+    } else if (arg == "--port") {
+      o.port = static_cast<std::uint16_t>(std::atoi(value()));
+    } else if (arg == "--path") {
+      o.path = value();
+    } else if (arg == "--connections") {
+      o.connections = static_cast<unsigned>(std::atoi(value()));
+    } else if (arg == "--threads") {
+      o.threads = static_cast<unsigned>(std::atoi(value()));
+    } else if (arg == "--duration") {
+      o.duration = std::atof(value());
+    } else if (arg == "--pipeline") {
+      o.pipeline = static_cast<unsigned>(std::atoi(value()));
+    } else if (arg == "--h2") {
+      o.h2 = true;
+    } else if (arg == "--tls") {
+      o.tls = true;
+    } else if (arg == "--h3") {
+      o.h3 = true;
+    } else if (arg == "--loss") {
+      o.loss = std::atof(value()) / 100;
+    } else {
+      usage();
+    }
+  }
+  if (o.threads == 0) o.threads = std::max(1u, std::thread::hardware_concurrency());
+  o.threads = std::min(o.threads, std::max(1u, o.connections));
+  o.pipeline = std::max(1u, o.pipeline);
+
+  sockaddr_in addr{};
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(o.port);
+  if (::inet_pton(AF_INET, o.host.c_str(), &addr.sin_addr) != 1) {
+    std::fprintf(stderr, "mtload: invalid address %s\n", o.host.c_str());
+    return 2;
+  }
+
+  std::string request = "GET " + o.path + " HTTP/1.1\r\nHost: " + o.host + "\r\nUser-Agent: mtload\r\n\r\n";
+  if (o.h2 && (o.path.size() > 126 || o.host.size() > 126)) {
+    std::fprintf(stderr, "mtload: --h2 takes paths and hosts of at most 126 bytes\n");
+    return 2;
+  }
+  if (o.h2) {
+    // :method GET, :scheme http or https, then :path, :authority and
+    // user-agent as literals with static name indexes.
+    std::string block = o.tls ? "\x82\x87" : "\x82\x86";
+    block += '\x04';
+    literal(block, o.path);
+    block += '\x01';
+    literal(block, o.host);
+    block += '\x0f';
+    block += '\x2b';  // user-agent, 58 = 15 + 43
+    literal(block, "mtload");
+    request.clear();
+    frame_header(request, block.size(), 0x1, 0x5, 0);  // END_STREAM | END_HEADERS
+    request += block;
+  }
+#ifndef MT_HAVE_OPENSSL
+  if (o.tls) {
+    std::fprintf(stderr, "mtload: --tls needs a build with OpenSSL\n");
+    return 2;
+  }
+#endif
+  if (o.h3) {
+#ifdef MT_HAVE_OPENSSL
+    // Every stream carries the same request: one HEADERS frame.
+    std::string section;
+    mt::qpack::begin_section(section);
+    mt::qpack::encode_field(section, ":method", "GET");
+    mt::qpack::encode_field(section, ":scheme", "https");
+    mt::qpack::encode_field(section, ":authority", o.host);
+    mt::qpack::encode_field(section, ":path", o.path);
+    mt::qpack::encode_field(section, "user-agent", "mtload");
+    request.clear();
+    mt::quic::put_varint(request, 0x1);
+    mt::quic::put_varint(request, section.size());
+    request += section;
+#else
+    std::fprintf(stderr, "mtload: --h3 needs a build with OpenSSL\n");
+    return 2;
+#endif
+  }
+  // HTTP/3 writes each stream of a batch on its own (see send_batch()).
+  std::string batch;
+  for (unsigned i = 0; i < (o.h3 ? 1 : o.pipeline); ++i) batch += request;
+
+  std::vector<std::unique_ptr<Client>> clients;
+  for (unsigned t = 0; t < o.threads; ++t) {
+    unsigned share = o.connections / o.threads + (t < o.connections % o.threads ? 1 : 0);
+    clients.push_back(std::make_unique<Client>(o, addr, share, batch));
+  }
+
+  auto start = Clock::now();
+  auto deadline = start + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(o.duration));
+  std::vector<std::thread> threads;
+  for (auto& c : clients) threads.emplace_back([&c, deadline] { c->run(deadline); });
+  for (auto& t : threads) t.join();
+  double secs = std::chrono::duration<double>(Clock::now() - start).count();
+
+  Stats total;
+  for (auto& c : clients) {
+    total.responses += c->stats.responses;
+    total.bytes += c->stats.bytes;
+    total.errors += c->stats.errors;
+    total.latency_us.insert(total.latency_us.end(), c->stats.latency_us.begin(), c->stats.latency_us.end());
+  }
+  std::sort(total.latency_us.begin(), total.latency_us.end());
+  auto pct = [&](double p) -> std::uint32_t {
+    if (total.latency_us.empty()) return 0;
+    auto idx = static_cast<std::size_t>(p * static_cast<double>(total.latency_us.size() - 1));
+    return total.latency_us[idx];
+  };
+
+  std::printf("mtload: %s:%u%s  %.2fs  %u connections  %u threads  %s %u\n", o.host.c_str(), o.port, o.path.c_str(),
+              secs, o.connections, o.threads, o.h3 ? "h3 streams" : o.h2 ? "h2 streams" : "pipeline", o.pipeline);
+  std::printf("requests: %llu  (%.0f req/s)  errors: %llu\n", static_cast<unsigned long long>(total.responses),
+              static_cast<double>(total.responses) / secs, static_cast<unsigned long long>(total.errors));
+  std::printf("transfer: %.1f MiB/s\n", static_cast<double>(total.bytes) / secs / (1024.0 * 1024.0));
+  std::printf("latency (per batch): p50 %uus  p90 %uus  p99 %uus  max %uus\n", pct(0.50), pct(0.90), pct(0.99),
+              pct(1.0));
+  return total.errors == 0 ? 0 : 1;
+}
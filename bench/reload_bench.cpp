@@ -0,0 +1,162 @@
+// mtreloadbench: edit-to-refreshed-page latency of `mtsite watch`.
+//
+//   mtreloadbench [--host ADDR] [--port N] [--edits N] FILE URL_PATH
+//
+// Subscribes to /_reload like an open browser tab, then repeatedly appends
+// a marker to FILE (a page source under the watched tree) and times how
+// long the reload event takes to arrive, and how long until URL_PATH has
+// been fetched again with the marker in it. FILE is restored afterwards.
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+// Edits further apart than this are separate changes to the watcher.
+constexpr auto kSettle = std::chrono::milliseconds(30);
+
+[[noreturn]] void usage() {
+  std::fprintf(stderr, "usage: mtreloadbench [--host ADDR] [--port N] [--edits N] FILE URL_PATH\n");
+  std::exit(2);
+}
+
+int connect_to(const std::string& host, std::uint16_t port) {
+  int fd = ::socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  sockaddr_in addr{};
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  if (fd < 0 || ::inet_pton(AF_INET, host.c_str(), &addr.sin_addr) != 1 ||
+      ::connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof addr) != 0) {
+    throw std::runtime_error("cannot connect to " + host + ":" + std::to_string(port));
+  }
+  int one = 1;
+  ::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof one);
+  return fd;
+}
+
+void send_all(int fd, std::string_view data) {
+  while (!data.empty()) {
+    auto n = ::send(fd, data.data(), data.size(), MSG_NOSIGNAL);
+    if (n <= 0) throw std::runtime_error("send failed");
+    data.remove_prefix(static_cast<std::size_t>(n));
+  }
+}
+
+// Reads from `fd` until `buf` contains `needle`.
+void read_until(int fd, std::string& buf, std::string_view needle) {
+  char chunk[16 * 1024];
+  while (buf.find(needle) == std::string::npos) {
+    auto n = ::recv(fd, chunk, sizeof chunk, 0);
+    if (n <= 0) throw std::runtime_error("connection closed");
+    buf.append(chunk, static_cast<std::size_t>(n));
+  }
+}
+
+std::string read_file(const std::string& path) {
+  std::ifstream in(path, std::ios::binary);
+  if (!in) throw std::runtime_error("cannot read " + path);
+  std::ostringstream s;
+  s << in.rdbuf();
+  return s.str();
+}
+
+void write_file(const std::string& path, std::string_view data) {
+  std::ofstream out(path, std::ios::binary | std::ios::trunc);
+  out.write(data.data(), static_cast<std::streamsize>(data.size()));
+  if (!out.flush()) throw std::runtime_error("cannot write " + path);
+}
+
+double ms(Clock::duration d) { return std::chrono::duration<double, std::milli>(d).count(); }
+
+void report(const char* what, std::vector<double> samples) {
+  std::sort(samples.begin(), samples.end());
+  auto at = [&](double q) { return samples[static_cast<std::size_t>(q * static_cast<double>(samples.size() - 1))]; };
+  std::printf("%-14s p50 %6.2f  p90 %6.2f  max %6.2f ms\n", what, at(0.5), at(0.9), samples.back());
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  std::string host = "127.0.0.1";
+  std::uint16_t port = 8080;
+  int edits = 50;
+  std::vector<std::string> positional;
+  for (int i = 1; i < argc; ++i) {
+    std::string_view arg = argv[i];
+    auto value = [&]() -> const char* {
+      if (i + 1 >= argc) usage();
+      return argv[++i];
+    };
+    if (arg == "--host") {
+      host = value();
+    } else if (arg == "--port") {
+      port = static_cast<std::uint16_t>(std::atoi(value()));
+    } else if (arg == "--edits") {
+      edits = std::atoi(value());
+    } else if (arg.starts_with("--")) {
+      usage();
+    } else {
+      positional.emplace_back(arg);
+    }
+  }
+  if (positional.size() != 2 || edits <= 0) usage();
+  const auto& file = positional[0];
+  const auto& path = positional[1];
+
+  std::string original;
+  try {
+    original = read_file(file);
+    int events = connect_to(host, port);
+    send_all(events, "GET /_reload HTTP/1.1\r\nHost: " + host + "\r\n\r\n");
+    std::string stream;
+    read_until(events, stream, "\r\n\r\n");
+    stream.clear();
+
+    std::vector<double> event_ms, page_ms;
+    for (int i = 0; i < edits; ++i) {
+      auto marker = "<span hidden>mtreloadbench " + std::to_string(i) + "</span>";
+      auto start = Clock::now();
+      write_file(file, original + "\n" + marker + "\n");
+      read_until(events, stream, "\n\n");
+      event_ms.push_back(ms(Clock::now() - start));
+      stream.erase(0, stream.find("\n\n") + 2);
+
+      // What the page's script does next: fetch the page again.
+      int page = connect_to(host, port);
+      send_all(page, "GET " + path + " HTTP/1.1\r\nHost: " + host + "\r\nConnection: close\r\n\r\n");
+      std::string response;
+      read_until(page, response, marker);
+      page_ms.push_back(ms(Clock::now() - start));
+      ::close(page);
+      std::this_thread::sleep_for(kSettle);
+    }
+    ::close(events);
+    write_file(file, original);
+
+    std::printf("%d edits of %s\n", edits, file.c_str());
+    report("reload event", event_ms);
+    report("page fetched", page_ms);
+  } catch (const std::exception& e) {
+    if (!original.empty()) write_file(file, original);
+    std::fprintf(stderr, "mtreloadbench: %s\n", e.what());
+    return 1;
+  }
+  return 0;
+}
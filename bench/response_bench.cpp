@@ -0,0 +1,409 @@
+// mtresponsebench: syscalls and server CPU time per static-file request.
+//
+//   mtresponsebench [--files N] [--size BYTES] [--requests N]
+//
+// Writes a site of N pages (32 by default) of BYTES each (4096) with an
+// ETag for each, and serves it from a forked single-worker server in four
+// modes: formatting every response head, and from the site's
+// pre-serialized responses file (see src/responses.h), each from the epoll
+// backend and from the io_uring one. A client on one keep-alive connection
+// fetches the pages in turn.
+//
+// Each mode runs twice. The first run traces the server with ptrace and
+// counts the system calls it makes while the requests run, by name. Each
+// request is sent once the server waits in epoll_wait or io_uring_enter
+// again, as it would on an idle connection; otherwise tracing slows the
+// server so much that the next request is always already there. The second
+// run is untraced and reads the server's CPU clock and each request's
+// latency, send to last byte. Every response must match the epoll
+// formatted mode's apart from its Date line; the bench exits non-zero if
+// one does not.
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <signal.h>
+#include <sys/ptrace.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <filesystem>
+#include <functional>
+#include <fstream>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "hash.h"
+#include "responses.h"
+#include "server.h"
+#include "site.h"
+
+namespace {
+
+namespace fs = std::filesystem;
+using Clock = std::chrono::steady_clock;
+
+constexpr std::size_t kWarmup = 1000;
+
+[[noreturn]] void usage() {
+  std::fprintf(stderr, "usage: mtresponsebench [--files N] [--size BYTES] [--requests N]\n");
+  std::exit(2);
+}
+
+void write_file(const fs::path& path, std::string_view data) {
+  std::ofstream out(path, std::ios::binary | std::ios::trunc);
+  out.write(data.data(), static_cast<std::streamsize>(data.size()));
+  if (!out.flush()) throw std::runtime_error("cannot write " + path.string());
+}
+
+// A loopback port nothing is listening on.
+std::uint16_t free_port() {
+  int fd = ::socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  sockaddr_in addr{};
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  socklen_t len = sizeof addr;
+  if (fd < 0 || ::bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof addr) != 0 ||
+      ::getsockname(fd, reinterpret_cast<sockaddr*>(&addr), &len) != 0) {
+    throw std::runtime_error("cannot find a free port");
+  }
+  ::close(fd);
+  return ntohs(addr.sin_port);
+}
+
+int connect_to(std::uint16_t port) {
+  int fd = ::socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  sockaddr_in addr{};
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  if (fd < 0 || ::connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof addr) != 0) {
+    throw std::runtime_error("cannot connect to port " + std::to_string(port));
+  }
+  int one = 1;
+  ::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof one);
+  return fd;
+}
+
+std::string_view syscall_name(long nr) {
+  switch (nr) {
+    case SYS_epoll_wait: return "epoll_wait";
+    case SYS_epoll_pwait: return "epoll_pwait";
+    case SYS_io_uring_enter: return "io_uring_enter";
+    case SYS_recvfrom: return "recv";
+    case SYS_sendto: return "send";
+    case SYS_sendmsg: return "sendmsg";
+    case SYS_sendfile: return "sendfile";
+    case SYS_read: return "read";
+    case SYS_write: return "write";
+    case SYS_writev: return "writev";
+    case SYS_accept4: return "accept4";
+    case SYS_clock_gettime: return "clock_gettime";
+    default: return {};
+  }
+}
+
+// One server process, and the client that measures it.
+class Run {
+ public:
+  Run(const fs::path& root, const std::vector<std::string>& paths, std::size_t requests, bool io_uring)
+      : root_(root), paths_(paths), requests_(requests), io_uring_(io_uring) {}
+
+  // Syscalls the server made per request, by name.
+  std::map<std::string, double> traced() {
+    start();
+    ::ptrace(PTRACE_SEIZE, child_, 0, PTRACE_O_TRACESYSGOOD | PTRACE_O_TRACECLONE | PTRACE_O_EXITKILL);
+    ::ptrace(PTRACE_INTERRUPT, child_, 0, 0);
+    int status = 0;
+    if (::waitpid(child_, &status, __WALL) != child_) throw std::runtime_error("cannot trace the server");
+    ::ptrace(PTRACE_SYSCALL, child_, 0, 0);
+
+    std::string error;
+    std::thread client([&] {
+      try {
+        serve_requests(nullptr, nullptr, nullptr, true);
+      } catch (const std::exception& e) {
+        error = e.what();
+      }
+      ::kill(child_, SIGKILL);
+    });
+    std::map<long, std::size_t> counts;
+    for (;;) {
+      pid_t tid = ::waitpid(-1, &status, __WALL);
+      if (tid < 0) {
+        if (errno == EINTR) continue;
+        break;  // every traced thread is gone
+      }
+      if (!WIFSTOPPED(status)) continue;
+      int sig = WSTOPSIG(status);
+      int deliver = 0;
+      if (sig == (SIGTRAP | 0x80)) {
+        __ptrace_syscall_info info{};
+        if (::ptrace(PTRACE_GET_SYSCALL_INFO, tid, sizeof info, &info) > 0 && info.op == PTRACE_SYSCALL_INFO_ENTRY) {
+          auto nr = static_cast<long>(info.entry.nr);
+          if (counting_) ++counts[nr];
+          // io_uring_enter waits only when asked for a completion.
+          if (nr == SYS_epoll_wait || nr == SYS_epoll_pwait || (nr == SYS_io_uring_enter && info.entry.args[2] > 0)) {
+            idle_ = true;
+          }
+        }
+      } else if (status >> 16 == 0) {
+        deliver = sig;  // a signal, not a ptrace event
+      }
+      ::ptrace(PTRACE_SYSCALL, tid, 0, deliver);
+    }
+    client.join();
+    if (!error.empty()) throw std::runtime_error(error);
+
+    std::map<std::string, double> per_request;
+    for (auto [nr, count] : counts) {
+      auto name = syscall_name(nr);
+      auto key = name.empty() ? "syscall " + std::to_string(nr) : std::string(name);
+      per_request[key] += static_cast<double>(count) / static_cast<double>(requests_);
+    }
+    return per_request;
+  }
+
+  struct Timing {
+    double cpu_us;  // server CPU time per request
+    double rate;    // requests per second
+    double p50_us, p99_us;
+  };
+
+  Timing timed() {
+    start();
+    clockid_t cpu{};
+    if (::clock_getcpuclockid(child_, &cpu) != 0) throw std::runtime_error("cannot read the server's CPU clock");
+    timespec before{}, after{};
+    std::vector<Clock::duration> latencies;
+    try {
+      serve_requests([&] { ::clock_gettime(cpu, &before); }, [&] { ::clock_gettime(cpu, &after); }, &latencies);
+    } catch (...) {
+      stop();
+      throw;
+    }
+    stop();
+    auto ns = (after.tv_sec - before.tv_sec) * 1e9 + static_cast<double>(after.tv_nsec - before.tv_nsec);
+    Clock::duration wall{};
+    for (auto latency : latencies) wall += latency;
+    std::sort(latencies.begin(), latencies.end());
+    auto percentile = [&](double p) {
+      auto i = std::min(latencies.size() - 1, static_cast<std::size_t>(p * static_cast<double>(latencies.size())));
+      return std::chrono::duration<double, std::micro>(latencies[i]).count();
+    };
+    return {ns / 1e3 / static_cast<double>(requests_),
+            static_cast<double>(requests_) / std::chrono::duration<double>(wall).count(), percentile(0.5),
+            percentile(0.99)};
+  }
+
+  // Whether the last run's server was on io_uring: asked to be, and the
+  // kernel has it.
+  bool served_io_uring() const { return served_io_uring_; }
+
+  // Each path's response with its Date line removed, from the last run.
+  const std::map<std::string, std::string>& responses() const { return responses_; }
+
+ private:
+  // Forks the server. It starts serving when the client writes to go_.
+  void start() {
+    port_ = free_port();
+    int go[2], ready[2];
+    if (::pipe(go) != 0 || ::pipe(ready) != 0) throw std::runtime_error("pipe failed");
+    child_ = ::fork();
+    if (child_ < 0) throw std::runtime_error("fork failed");
+    if (child_ == 0) {
+      char byte = 0;
+      if (::read(go[0], &byte, 1) != 1) ::_exit(1);
+      try {
+        auto site = mt::Site::load(root_);
+        mt::ServerOptions options;
+        options.host = "127.0.0.1";
+        options.port = port_;
+        options.threads = 1;
+        options.pin = false;
+        options.io_uring = io_uring_;
+        mt::Server server(site, options);
+        server.start();
+        [[maybe_unused]] auto n = ::write(ready[1], server.io_uring() ? "u" : "e", 1);
+        for (;;) ::pause();
+      } catch (const std::exception& e) {
+        std::fprintf(stderr, "mtresponsebench: server: %s\n", e.what());
+        ::_exit(1);
+      }
+    }
+    ::close(go[0]);
+    ::close(ready[1]);
+    go_ = go[1];
+    ready_ = ready[0];
+  }
+
+  void stop() {
+    ::kill(child_, SIGKILL);
+    int status = 0;
+    ::waitpid(child_, &status, 0);
+  }
+
+  // Starts the server, then sends the warm-up and measured requests,
+  // calling `begin` and `end` around the measured ones and adding their
+  // latencies to `latencies`. With `wait_idle`, each request waits for the
+  // tracer to see the server block.
+  void serve_requests(const std::function<void()>& begin, const std::function<void()>& end,
+                      std::vector<Clock::duration>* latencies, bool wait_idle = false) {
+    char byte = 0;
+    [[maybe_unused]] auto n = ::write(go_, "g", 1);
+    ::close(go_);
+    bool up = ::read(ready_, &byte, 1) == 1;
+    ::close(ready_);
+    if (!up) throw std::runtime_error("the server did not start");
+    served_io_uring_ = byte == 'u';
+
+    int fd = connect_to(port_);
+    std::string request, buf;
+    responses_.clear();
+    for (std::size_t i = 0; i < kWarmup + requests_; ++i) {
+      if (i == kWarmup) {
+        counting_ = true;
+        if (begin) begin();
+      }
+      auto started = Clock::now();
+      const auto& path = paths_[i % paths_.size()];
+      request = "GET " + path + " HTTP/1.1\r\nHost: bench\r\n\r\n";
+      while (wait_idle && !idle_.exchange(false)) std::this_thread::yield();
+      if (::send(fd, request.data(), request.size(), MSG_NOSIGNAL) != static_cast<ssize_t>(request.size())) {
+        throw std::runtime_error("send failed");
+      }
+      buf.clear();
+      std::size_t head_end = std::string::npos, total = 0;
+      char chunk[64 * 1024];
+      while (head_end == std::string::npos || buf.size() < total) {
+        auto got = ::recv(fd, chunk, sizeof chunk, 0);
+        if (got <= 0) throw std::runtime_error("connection closed");
+        buf.append(chunk, static_cast<std::size_t>(got));
+        if (head_end == std::string::npos && (head_end = buf.find("\r\n\r\n")) != std::string::npos) {
+          auto length = buf.find("Content-Length: ");
+          if (length == std::string::npos || length > head_end) throw std::runtime_error("no Content-Length");
+          total = head_end + 4 + std::strtoull(buf.c_str() + length + 16, nullptr, 10);
+        }
+      }
+      if (latencies != nullptr && i >= kWarmup) latencies->push_back(Clock::now() - started);
+      if (i < paths_.size()) {
+        auto date = buf.find("\r\nDate: ");
+        if (date != std::string::npos) buf.erase(date, buf.find("\r\n", date + 2) - date);
+        responses_[path] = buf;
+      }
+    }
+    counting_ = false;
+    if (end) end();
+    ::close(fd);
+  }
+
+  fs::path root_;
+  const std::vector<std::string>& paths_;
+  std::size_t requests_;
+  bool io_uring_;
+  bool served_io_uring_ = false;
+  std::uint16_t port_ = 0;
+  pid_t child_ = -1;
+  int go_ = -1, ready_ = -1;
+  std::atomic<bool> counting_ = false;
+  std::atomic<bool> idle_ = false;  // the traced server began to wait
+  std::map<std::string, std::string> responses_;
+};
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  std::size_t files = 32;
+  std::size_t size = 4096;
+  std::size_t requests = 20000;
+  for (int i = 1; i < argc; ++i) {
+    std::string_view arg = argv[i];
+    auto value = [&] {
+      if (i + 1 >= argc) usage();
+      return static_cast<std::size_t>(std::atoll(argv[++i]));
+    };
+    if (arg == "--files") {
+      files = value();
+    } else if (arg == "--size") {
+      size = value();
+    } else if (arg == "--requests") {
+      requests = value();
+    } else {
+      usage();
+    }
+  }
+  if (files == 0 || requests == 0) usage();
+  signal(SIGPIPE, SIG_IGN);
+
+  char dir_template[] = "/tmp/mtresponsebench.XXXXXX";
+  if (::mkdtemp(dir_template) == nullptr) {
+    std::perror("mtresponsebench: mkdtemp");
+    return 1;
+  }
+  fs::path root = dir_template;
+  int failures = 0;
+  try {
+    std::vector<std::string> paths;
+    std::string headers;
+    for (std::size_t i = 0; i < files; ++i) {
+      std::string page = "<!DOCTYPE html><title>page " + std::to_string(i) + "</title><p>";
+      while (page.size() < size) page += "lorem ipsum dolor sit amet " + std::to_string(page.size()) + " ";
+      page.resize(size);
+      auto name = "p" + std::to_string(i) + ".html";
+      write_file(root / name, page);
+      paths.push_back("/" + name);
+      headers += "/" + name + " ETag: \"" + mt::hex64(mt::xxh3_64(page)) + "\"\n";
+    }
+    write_file(root / ".mtsite-headers", headers);
+
+    std::printf("files:     %zu of %zu bytes, %zu requests per run\n", files, size, requests);
+    std::map<std::string, std::string> expected;
+    for (bool serialized : {false, true}) {
+      if (serialized) write_file(root / mt::kResponsesName, mt::serialize_responses(mt::Site::load(root)));
+      for (bool io_uring : {false, true}) {
+        Run run(root, paths, requests, io_uring);
+        auto calls = run.traced();
+        auto timing = run.timed();
+        if (!serialized && !io_uring) expected = run.responses();
+        auto mismatched = run.responses() != expected;
+        failures += mismatched;
+
+        double total = 0;
+        std::string breakdown;
+        for (const auto& [name, count] : calls) {
+          if (count < 0.01) continue;
+          total += count;
+          char part[64];
+          std::snprintf(part, sizeof part, "%s%s %.2f", breakdown.empty() ? "" : ", ", name.c_str(), count);
+          breakdown += part;
+        }
+        auto mode = std::string(serialized ? "prebuilt" : "formatted") + (io_uring ? ", io_uring:" : ", epoll:");
+        std::printf("%-20s %.2f syscalls/request (%s)%s\n", mode.c_str(), total, breakdown.c_str(),
+                    io_uring && !run.served_io_uring() ? " [no io_uring: epoll]" : "");
+        std::printf("%-20s %.2f us server CPU/request, %.0f requests/s, latency p50 %.1f us p99 %.1f us%s\n", "",
+                    timing.cpu_us, timing.rate, timing.p50_us, timing.p99_us, mismatched ? ", RESPONSES DIFFER" : "");
+      }
+    }
+  } catch (const std::exception& e) {
+    std::fprintf(stderr, "mtresponsebench: %s\n", e.what());
+    failures = 1;
+  }
+  std::error_code ec;
+  fs::remove_all(root, ec);
+  return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,119 @@
+// mtschedbench: scaling of the build's work-stealing scheduler.
+//
+//   mtschedbench [--jobs N] [--work MICROSECONDS] [--max-threads T]
+//
+// Runs N page-like jobs at 1, 2, 4 ... T threads (default: one per CPU).
+// Each job spins for about WORK microseconds (its render and minify), then
+// spawns four sub-jobs of half that each (its compression variants) and
+// waits for them. It reports wall time, speedup and parallel efficiency
+// against one thread, then the per-task overhead of empty jobs. Exits
+// non-zero if any job ran a wrong number of times.
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "gen/scheduler.h"
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+[[noreturn]] void usage() {
+  std::fprintf(stderr, "usage: mtschedbench [--jobs N] [--work MICROSECONDS] [--max-threads T]\n");
+  std::exit(2);
+}
+
+// CPU-bound work the optimizer cannot remove.
+std::uint64_t spin(std::uint64_t iterations) {
+  std::uint64_t x = 0x9e3779b97f4a7c15ull;
+  for (std::uint64_t i = 0; i < iterations; ++i) {
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+  }
+  return x;
+}
+
+std::uint64_t iterations_per_us() {
+  constexpr std::uint64_t kProbe = 50'000'000;
+  auto start = Clock::now();
+  volatile auto sink = spin(kProbe);
+  (void)sink;
+  auto us = std::chrono::duration<double, std::micro>(Clock::now() - start).count();
+  return static_cast<std::uint64_t>(static_cast<double>(kProbe) / us);
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  std::size_t jobs = 4096;
+  double work_us = 200;
+  unsigned max_threads = std::max(1u, std::thread::hardware_concurrency());
+  for (int i = 1; i < argc; ++i) {
+    std::string_view arg = argv[i];
+    if (i + 1 >= argc) usage();
+    if (arg == "--jobs") {
+      jobs = static_cast<std::size_t>(std::atoll(argv[++i]));
+    } else if (arg == "--work") {
+      work_us = std::atof(argv[++i]);
+    } else if (arg == "--max-threads") {
+      max_threads = static_cast<unsigned>(std::atoi(argv[++i]));
+    } else {
+      usage();
+    }
+  }
+  if (jobs == 0 || max_threads == 0) usage();
+
+  auto per_us = iterations_per_us();
+  auto page_work = static_cast<std::uint64_t>(work_us * static_cast<double>(per_us));
+  std::printf("%zu jobs of %.0f us + 4 x %.0f us sub-jobs\n", jobs, work_us, work_us / 2);
+  std::printf("%8s %10s %8s %10s\n", "threads", "ms", "speedup", "efficiency");
+
+  std::vector<std::atomic<int>> runs(jobs * 5);
+  std::atomic<std::uint64_t> sink{0};
+  double base_ms = 0;
+  bool ok = true;
+  for (unsigned threads = 1;; threads = std::min(threads * 2, max_threads)) {
+    for (auto& r : runs) r.store(0, std::memory_order_relaxed);
+    mt::gen::Scheduler scheduler(threads);
+    auto start = Clock::now();
+    scheduler.parallel_for(jobs, [&](std::size_t i) {
+      sink.fetch_add(spin(page_work), std::memory_order_relaxed);
+      runs[i * 5].fetch_add(1, std::memory_order_relaxed);
+      mt::gen::TaskGroup variants(scheduler);
+      for (std::size_t v = 1; v <= 4; ++v) {
+        variants.spawn([&, i, v] {
+          sink.fetch_add(spin(page_work / 2), std::memory_order_relaxed);
+          runs[i * 5 + v].fetch_add(1, std::memory_order_relaxed);
+        });
+      }
+      variants.wait();
+    });
+    double ms = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+    if (threads == 1) base_ms = ms;
+    for (const auto& r : runs) ok = ok && r.load(std::memory_order_relaxed) == 1;
+    std::printf("%8u %10.1f %8.2f %9.0f%%\n", threads, ms, base_ms / ms, 100 * base_ms / ms / threads);
+    if (threads == max_threads) break;
+  }
+
+  constexpr std::size_t kEmpty = 1'000'000;
+  mt::gen::Scheduler scheduler(max_threads);
+  std::atomic<std::size_t> done{0};
+  auto start = Clock::now();
+  scheduler.parallel_for(kEmpty, [&](std::size_t) { done.fetch_add(1, std::memory_order_relaxed); });
+  double ns = std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+  std::printf("empty jobs: %.0f ns each at %u threads\n", ns / kEmpty, max_threads);
+  ok = ok && done.load() == kEmpty;
+
+  if (!ok) {
+    std::fprintf(stderr, "mtschedbench: a job ran the wrong number of times\n");
+    return 1;
+  }
+  return 0;
+}
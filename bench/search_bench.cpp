@@ -0,0 +1,296 @@
+// mtsearchbench: size, open time and query latency of the search indexes.
+//
+//   mtsearchbench [--docs N] [--queries N] [--budget BYTES]
+//
+// Generates N pages (10,000 by default) of Zipf-distributed words. Writes
+// the server's index to a temporary file and maps it, then times queries of
+// one to three words. Then builds the client index (/search.fst) within the
+// budget, reports its size per 1,000 pages and times the same queries with
+// the last word cut to a prefix, as typed. Each query's hits are checked
+// against a brute-force search over the same pages; the bench exits
+// non-zero if any differ.
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdint>
+#include <cstdlib>
+#include <exception>
+#include <filesystem>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "client_search.h"
+#include "gen/client_index.h"
+#include "gen/files.h"
+#include "gen/search_index.h"
+#include "search.h"
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+constexpr std::size_t kVocabulary = 50000;
+constexpr std::size_t kLimit = 10;
+
+[[noreturn]] void usage() {
+  std::fprintf(stderr, "usage: mtsearchbench [--docs N] [--queries N] [--budget BYTES]\n");
+  std::exit(2);
+}
+
+struct Random {
+  std::uint64_t state = 0x9e3779b97f4a7c15;
+  std::uint64_t next() {
+    state ^= state << 13;
+    state ^= state >> 7;
+    state ^= state << 17;
+    return state;
+  }
+  double unit() { return static_cast<double>(next() >> 11) / 9007199254740992.0; }
+};
+
+// Word number `rank` as two or more syllables, so prefixes share like words do.
+std::string word(std::size_t rank) {
+  static constexpr std::string_view kConsonants = "bcdfghjklmnprstvz";
+  static constexpr std::string_view kVowels = "aeiou";
+  constexpr std::size_t kSyllables = 17 * 5;
+  std::string w;
+  for (rank += kSyllables; rank > 0; rank /= kSyllables) {
+    w += kConsonants[rank % kSyllables / 5];
+    w += kVowels[rank % 5];
+  }
+  return w;
+}
+
+// Zipf(1) rank in [0, kVocabulary) by inverting the harmonic CDF
+// approximately, which is close enough for a word distribution.
+std::size_t zipf(Random& rng) {
+  static const double harmonic = std::log(static_cast<double>(kVocabulary)) + 0.5772;
+  auto rank = static_cast<std::size_t>(std::exp(rng.unit() * harmonic - 0.5772));
+  return std::min(rank, kVocabulary - 1);
+}
+
+std::vector<mt::gen::SearchDocument> make_docs(std::size_t n) {
+  Random rng;
+  std::vector<mt::gen::SearchDocument> docs(n);
+  std::string text;
+  for (std::size_t i = 0; i < n; ++i) {
+    text = "<html><head><title>Post " + std::to_string(i) + "</title></head><body><p>";
+    auto words = 200 + rng.next() % 1800;
+    for (std::uint64_t k = 0; k < words; ++k) {
+      text += word(zipf(rng));
+      text += k % 40 == 39 ? "</p><p>" : " ";
+    }
+    text += "</p></body></html>";
+    docs[i] = mt::gen::search_document(text);
+    docs[i].url = "/posts/p" + std::to_string(i) + ".html";
+  }
+  std::sort(docs.begin(), docs.end(), [](const auto& a, const auto& b) { return a.url < b.url; });
+  return docs;
+}
+
+// The reference: BM25 over every document, as search() documents it.
+std::vector<std::pair<std::string_view, float>> brute_force(const std::vector<mt::gen::SearchDocument>& docs,
+                                                            const std::vector<std::string>& terms) {
+  double total = 0;
+  for (const auto& d : docs) total += d.length;
+  auto average = static_cast<float>(total / static_cast<double>(docs.size()));
+  std::vector<std::pair<std::string_view, float>> scored;
+  std::vector<float> idf;
+  for (const auto& t : terms) {
+    double df = 0;
+    for (const auto& d : docs) {
+      df += std::binary_search(d.terms.begin(), d.terms.end(), std::pair<std::string, std::uint32_t>(t, 0),
+                               [](const auto& a, const auto& b) { return a.first < b.first; });
+    }
+    auto n = static_cast<double>(docs.size());
+    idf.push_back(static_cast<float>(std::log(1 + (n - df + 0.5) / (df + 0.5))));
+  }
+  for (const auto& d : docs) {
+    float score = 0;
+    bool any = false;
+    auto norm = 1.2f * (1 - 0.75f + 0.75f * static_cast<float>(d.length) / average);
+    for (std::size_t i = 0; i < terms.size(); ++i) {
+      auto it = std::lower_bound(d.terms.begin(), d.terms.end(), terms[i],
+                                 [](const auto& a, const std::string& b) { return a.first < b; });
+      if (it == d.terms.end() || it->first != terms[i]) continue;
+      auto tf = static_cast<float>(it->second);
+      score += idf[i] * tf * 2.2f / (tf + norm);
+      any = true;
+    }
+    if (any) scored.emplace_back(d.url, score);
+  }
+  std::sort(scored.begin(), scored.end(), [](const auto& a, const auto& b) {
+    return a.second > b.second || (a.second == b.second && a.first < b.first);
+  });
+  if (scored.size() > kLimit) scored.resize(kLimit);
+  return scored;
+}
+
+bool has_term(const mt::gen::SearchDocument& d, const std::string& term) {
+  auto it = std::lower_bound(d.terms.begin(), d.terms.end(), term,
+                             [](const auto& a, const std::string& b) { return a.first < b; });
+  return it != d.terms.end() && it->first == term;
+}
+
+// The reference for ClientSearchIndex::search(): pages with every exact
+// term and any of the first kMaxPrefixTerms indexed terms starting with
+// `prefix`.
+std::vector<std::uint32_t> brute_force_client(const std::vector<mt::gen::SearchDocument>& docs,
+                                              const mt::ClientSearchIndex& index,
+                                              const std::vector<std::string>& exact, const std::string& prefix) {
+  std::vector<std::string> expansions;
+  for (const auto& d : docs) {
+    for (const auto& [term, count] : d.terms) {
+      if (term.starts_with(prefix)) expansions.push_back(term);
+    }
+  }
+  std::sort(expansions.begin(), expansions.end());
+  expansions.erase(std::unique(expansions.begin(), expansions.end()), expansions.end());
+  std::erase_if(expansions, [&](const std::string& t) { return !index.find(t); });
+  if (expansions.size() > mt::ClientSearchIndex::kMaxPrefixTerms) {
+    expansions.resize(mt::ClientSearchIndex::kMaxPrefixTerms);
+  }
+  for (const auto& t : exact) {
+    if (!index.find(t)) return {};
+  }
+  std::vector<std::uint32_t> pages;
+  for (std::uint32_t i = 0; i < docs.size(); ++i) {
+    bool all = std::all_of(exact.begin(), exact.end(), [&](const std::string& t) { return has_term(docs[i], t); });
+    bool any =
+        std::any_of(expansions.begin(), expansions.end(), [&](const std::string& t) { return has_term(docs[i], t); });
+    if (all && any) pages.push_back(static_cast<std::uint32_t>(i));
+  }
+  return pages;
+}
+
+double us(Clock::duration d) { return std::chrono::duration<double, std::micro>(d).count(); }
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  std::size_t n = 10000;
+  std::size_t queries = 2000;
+  std::size_t budget = 512 * 1024;
+  for (int i = 1; i < argc; ++i) {
+    std::string_view arg = argv[i];
+    if (i + 1 >= argc) usage();
+    if (arg == "--docs") {
+      n = static_cast<std::size_t>(std::atoll(argv[++i]));
+    } else if (arg == "--queries") {
+      queries = static_cast<std::size_t>(std::atoll(argv[++i]));
+    } else if (arg == "--budget") {
+      budget = static_cast<std::size_t>(std::atoll(argv[++i]));
+    } else {
+      usage();
+    }
+  }
+  if (n == 0 || queries == 0) usage();
+
+  auto path = std::filesystem::temp_directory_path() / ("mtsearchbench-" + std::to_string(::getpid()));
+  try {
+    auto docs = make_docs(n);
+    auto start = Clock::now();
+    auto bytes = mt::gen::search_index(docs);
+    auto build_ms = us(Clock::now() - start) / 1000;
+    mt::gen::write_file_atomic(path, bytes);
+
+    start = Clock::now();
+    auto index = mt::SearchIndex::open(path);
+    auto open_us = us(Clock::now() - start);
+
+    Random rng;
+    std::vector<std::vector<std::string>> query_terms;
+    std::vector<double> latency;
+    std::size_t mismatches = 0, checked = 0;
+    for (std::size_t q = 0; q < queries; ++q) {
+      auto& terms = query_terms.emplace_back();
+      auto words = 1 + rng.next() % 3;
+      for (std::uint64_t k = 0; k < words; ++k) terms.push_back(word(zipf(rng)));
+      std::sort(terms.begin(), terms.end());
+      terms.erase(std::unique(terms.begin(), terms.end()), terms.end());
+      std::string query;
+      for (const auto& t : terms) query += t + " ";
+
+      start = Clock::now();
+      auto hits = index.search(query, kLimit);
+      latency.push_back(us(Clock::now() - start));
+
+      if (q % 20 != 0) continue;  // the reference is slow
+      ++checked;
+      auto expected = brute_force(docs, terms);
+      bool same = hits.size() == expected.size();
+      for (std::size_t i = 0; same && i < hits.size(); ++i) {
+        same = hits[i].url == expected[i].first && std::abs(hits[i].score - expected[i].second) < 1e-3f;
+      }
+      mismatches += !same;
+    }
+    std::filesystem::remove(path);
+
+    std::sort(latency.begin(), latency.end());
+    auto at = [](const std::vector<double>& v, double p) {
+      return v[static_cast<std::size_t>(p * static_cast<double>(v.size() - 1))];
+    };
+    std::printf("%zu pages, index %.1f MiB, built in %.1f ms\n", n, static_cast<double>(bytes.size()) / (1 << 20),
+                build_ms);
+    std::printf("open           %9.1f us\n", open_us);
+    std::printf("query p50      %9.1f us\n", at(latency, 0.5));
+    std::printf("query p99      %9.1f us\n", at(latency, 0.99));
+    std::printf("query max      %9.1f us\n", latency.back());
+
+    start = Clock::now();
+    auto client = mt::gen::client_search_index(docs, budget);
+    build_ms = us(Clock::now() - start) / 1000;
+    start = Clock::now();
+    mt::ClientSearchIndex reader(client.bytes);
+    open_us = us(Clock::now() - start);
+
+    std::vector<double> client_latency;
+    std::size_t client_mismatches = 0, client_checked = 0;
+    for (std::size_t q = 0; q < queries; ++q) {
+      auto exact = query_terms[q];
+      auto prefix = exact.back();
+      exact.pop_back();
+      prefix.resize(2 + rng.next() % (prefix.size() - 1));
+      std::string query;
+      for (const auto& t : exact) query += t + " ";
+      query += prefix;
+
+      start = Clock::now();
+      auto pages = reader.search(query, SIZE_MAX);
+      client_latency.push_back(us(Clock::now() - start));
+
+      if (q % 20 != 0) continue;
+      ++client_checked;
+      client_mismatches += pages != brute_force_client(docs, reader, exact, prefix);
+    }
+    std::sort(client_latency.begin(), client_latency.end());
+    std::printf("client index %.1f KiB, %.1f KiB per 1k pages, %zu terms (%zu left out), built in %.1f ms\n",
+                static_cast<double>(client.bytes.size()) / 1024,
+                static_cast<double>(client.bytes.size()) / 1024 * 1000 / static_cast<double>(n), client.terms,
+                client.dropped, build_ms);
+    std::printf("load           %9.1f us\n", open_us);
+    std::printf("query p50      %9.1f us\n", at(client_latency, 0.5));
+    std::printf("query p99      %9.1f us\n", at(client_latency, 0.99));
+    std::printf("query max      %9.1f us\n", client_latency.back());
+
+    if (mismatches > 0) {
+      std::fprintf(stderr, "mtsearchbench: %zu of %zu queries differ from brute-force BM25\n", mismatches, checked);
+      return 1;
+    }
+    if (client_mismatches > 0) {
+      std::fprintf(stderr, "mtsearchbench: %zu of %zu client queries differ from brute force\n", client_mismatches,
+                   client_checked);
+      return 1;
+    }
+  } catch (const std::exception& e) {
+    std::filesystem::remove(path);
+    std::fprintf(stderr, "mtsearchbench: %s\n", e.what());
+    return 1;
+  }
+  return 0;
+}
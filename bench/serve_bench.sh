@@ -0,0 +1,20 @@
+#!/bin/sh
+# Starts mtserve on the repo root and drives GET / with mtload.
+#
+#   bench/serve_bench.sh [BUILD_DIR] [mtload args...]
+#
+# Leave a few cores for the load generator when comparing numbers; the
+# server and client share the box.
+set -eu
+
+build=${1:-build}
+[ $# -gt 0 ] && shift
+root=$(cd "$(dirname "$0")/.." && pwd)
+port=${MT_BENCH_PORT:-18080}
+
+"$build/mtserve" --root "$root" --host 127.0.0.1 --port "$port" ${MT_SERVE_ARGS:-} &
+server=$!
+trap 'kill $server 2>/dev/null; wait $server 2>/dev/null || true' EXIT INT TERM
+sleep 0.3
+
+"$build/mtload" --port "$port" --path / --connections 256 --duration 10 "$@"
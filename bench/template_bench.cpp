@@ -0,0 +1,177 @@
+// mttemplatebench: compiled layouts against an interpreted baseline.
+//
+//   mttemplatebench [--pages N] [--rounds N]
+//
+// Renders N pages (10,000 by default) into a layout with a head, a nav
+// partial and a footer partial, once with gen::Template and once with a
+// baseline that interprets the template text on every render: it scans for
+// tags, looks fields and partials up in hash maps by name and appends to an
+// unsized string. Reports the best of --rounds for each, and exits non-zero
+// if their outputs differ.
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <exception>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "gen/template.h"
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+constexpr std::string_view kLayout =
+    "<!DOCTYPE html>\n<html lang=\"en\"><head><meta charset=\"utf-8\">\n"
+    "<meta name=\"viewport\" content=\"width=device-width, initial-scale=1\">\n"
+    "<title>{{ title }} | matthewtolman.com</title>\n"
+    "<link rel=\"canonical\" href=\"https://matthewtolman.com{{ path }}\">\n"
+    "<link rel=\"stylesheet\" href=\"/css/site.css\"></head>\n<body>\n{{> nav }}\n"
+    "<main><article>\n{{ content }}</article></main>\n{{> footer }}\n</body></html>\n";
+constexpr std::string_view kNav =
+    "<header><nav><a href=\"/\">Home</a> <a href=\"/posts/\">Posts</a> <a href=\"/about.html\">About</a>"
+    "</nav></header>";
+constexpr std::string_view kFooter =
+    "<footer><p>&copy; Matthew Tolman. <a href=\"{{ path }}\">Permalink</a></p></footer>";
+constexpr std::array<std::string_view, 3> kFields = {"title", "content", "path"};
+
+[[noreturn]] void usage() {
+  std::fprintf(stderr, "usage: mttemplatebench [--pages N] [--rounds N]\n");
+  std::exit(2);
+}
+
+struct Page {
+  std::string title, content, path;
+};
+
+// Deterministic pages with 1-4 KiB of body each.
+std::vector<Page> make_pages(std::size_t n) {
+  std::vector<Page> pages(n);
+  std::uint32_t seed = 1;
+  for (std::size_t i = 0; i < n; ++i) {
+    seed = seed * 1664525u + 1013904223u;
+    auto& p = pages[i];
+    p.title = "Post number " + std::to_string(i);
+    p.path = "/posts/p" + std::to_string(i) + ".html";
+    p.content = "<h1>" + p.title + "</h1>\n";
+    auto paragraphs = 4 + (seed >> 8) % 12;
+    for (std::uint32_t k = 0; k < paragraphs; ++k) {
+      p.content += "<p>Paragraph " + std::to_string(k) +
+                   " of a generated post, long enough to look like prose about caches, queues and "
+                   "the <em>kernel</em>, with a <a href=\"/posts/\">link</a>.</p>\n";
+    }
+  }
+  return pages;
+}
+
+// The baseline: every render re-scans the template and resolves every name.
+void interpret(std::string_view text, const std::unordered_map<std::string, std::string>& partials,
+               const std::unordered_map<std::string, std::string_view>& values, std::string& out) {
+  while (!text.empty()) {
+    auto open = text.find("{{");
+    out.append(text.substr(0, open));
+    if (open == std::string_view::npos) return;
+    text.remove_prefix(open + 2);
+    auto close = text.find("}}");
+    if (close == std::string_view::npos) throw std::runtime_error("unterminated {{");
+    std::string tag(text.substr(0, close));
+    text.remove_prefix(close + 2);
+    tag.erase(0, tag.find_first_not_of(' '));
+    tag.erase(tag.find_last_not_of(' ') + 1);
+    if (tag.starts_with('>')) {
+      tag.erase(0, tag.find_first_not_of(" >"));
+      interpret(partials.at(tag), partials, values, out);
+    } else {
+      out.append(values.at(tag));
+    }
+  }
+}
+
+template <class Fn>
+double best_ms(int rounds, Fn&& fn) {
+  double best = 1e300;
+  for (int r = 0; r < rounds; ++r) {
+    auto start = Clock::now();
+    fn();
+    best = std::min(best, std::chrono::duration<double, std::milli>(Clock::now() - start).count());
+  }
+  return best;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  std::size_t n = 10000;
+  int rounds = 5;
+  for (int i = 1; i < argc; ++i) {
+    std::string_view arg = argv[i];
+    if (i + 1 >= argc) usage();
+    if (arg == "--pages") {
+      n = static_cast<std::size_t>(std::atoll(argv[++i]));
+    } else if (arg == "--rounds") {
+      rounds = std::atoi(argv[++i]);
+    } else {
+      usage();
+    }
+  }
+  if (n == 0 || rounds <= 0) usage();
+
+  try {
+    auto pages = make_pages(n);
+    std::unordered_map<std::string, std::string> partials{{"nav", std::string(kNav)},
+                                                          {"footer", std::string(kFooter)}};
+    auto load = [&](std::string_view name) {
+      return mt::gen::Template::Partial{std::string(name), partials.at(std::string(name))};
+    };
+
+    std::vector<std::string> compiled_out(n), interpreted_out(n);
+    mt::gen::Template layout;
+    double compile_ms =
+        best_ms(rounds, [&] { layout = mt::gen::Template::compile("layout", kLayout, kFields, load); });
+    double compiled_ms = best_ms(rounds, [&] {
+      for (std::size_t i = 0; i < n; ++i) {
+        auto& out = compiled_out[i];
+        out.clear();
+        out.shrink_to_fit();  // every round starts from empty strings
+        std::array<std::string_view, 3> values{pages[i].title, pages[i].content, pages[i].path};
+        layout.render(values, out);
+      }
+    });
+    double interpreted_ms = best_ms(rounds, [&] {
+      for (std::size_t i = 0; i < n; ++i) {
+        auto& out = interpreted_out[i];
+        out.clear();
+        out.shrink_to_fit();
+        std::unordered_map<std::string, std::string_view> values{
+            {"title", pages[i].title}, {"content", pages[i].content}, {"path", pages[i].path}};
+        interpret(kLayout, partials, values, out);
+      }
+    });
+
+    std::size_t bytes = 0;
+    for (const auto& out : compiled_out) bytes += out.size();
+    if (compiled_out != interpreted_out) {
+      std::fprintf(stderr, "mttemplatebench: compiled and interpreted output differ\n");
+      return 1;
+    }
+    auto mib = static_cast<double>(bytes) / (1024.0 * 1024.0);
+    std::printf("%zu pages, %.1f MiB of HTML, best of %d\n", n, mib, rounds);
+    std::printf("compile once   %9.3f ms\n", compile_ms);
+    std::printf("compiled       %9.2f ms  %7.0f ns/page  %7.0f MiB/s\n", compiled_ms,
+                compiled_ms * 1e6 / static_cast<double>(n), mib / (compiled_ms / 1000));
+    std::printf("interpreted    %9.2f ms  %7.0f ns/page  %7.0f MiB/s\n", interpreted_ms,
+                interpreted_ms * 1e6 / static_cast<double>(n), mib / (interpreted_ms / 1000));
+    std::printf("speedup        %9.2fx\n", interpreted_ms / compiled_ms);
+  } catch (const std::exception& e) {
+    std::fprintf(stderr, "mttemplatebench: %s\n", e.what());
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,62 @@
+#!/bin/sh
+# Compares HTTPS with TLS handed to the kernel (kTLS) against TLS kept in
+# userspace, and both against plain HTTP, all over loopback. For each file
+# it reports the throughput mtload sees and mtserve's CPU time, user and
+# system, per gigabit.
+#
+#   bench/tls_bench.sh [BUILD_DIR] [mtload args...]
+#
+# MT_BENCH_PATHS picks the files (default /LICENSE and /index.html);
+# MT_SERVE_ARGS is passed to mtserve. Needs a build with OpenSSL; the
+# certificate is a throwaway one made with openssl(1). Where the kernel has
+# no kTLS, mtserve says so and the kTLS rows measure the fallback.
+set -eu
+
+build=${1:-build}
+[ $# -gt 0 ] && shift
+root=$(cd "$(dirname "$0")/.." && pwd)
+port=${MT_BENCH_PORT:-18080}
+tls_port=${MT_BENCH_TLS_PORT:-18443}
+paths=${MT_BENCH_PATHS:-/LICENSE /index.html}
+tmp=$(mktemp -d)
+server=
+trap '[ -n "$server" ] && kill $server 2>/dev/null; rm -rf "$tmp"' EXIT INT TERM
+
+openssl req -x509 -newkey ec -pkeyopt ec_paramgen_curve:P-256 -nodes -subj /CN=localhost -days 1 \
+  -keyout "$tmp/key.pem" -out "$tmp/cert.pem" 2>/dev/null
+
+# CPU seconds, user and system, process $1 has used.
+cpu() { awk -v hz="$(getconf CLK_TCK)" '{ printf "%.2f", ($14 + $15) / hz }' "/proc/$1/stat"; }
+
+# run NAME "MTSERVE ARGS" "MTLOAD ARGS" [mtload args...]
+run() {
+  name=$1 serve_args=$2 load_args=$3
+  shift 3
+  "$build/mtserve" --root "$root" --host 127.0.0.1 --port "$port" --tls-port "$tls_port" \
+    --tls-cert "$tmp/cert.pem" --tls-key "$tmp/key.pem" $serve_args ${MT_SERVE_ARGS:-} 2>"$tmp/serve" &
+  server=$!
+  sleep 0.3
+  before=$(cpu $server)
+  "$build/mtload" --path "$path" --connections 32 --pipeline 4 --duration 10 $load_args "$@" >"$tmp/out" || true
+  after=$(cpu $server)
+  kill $server
+  wait $server 2>/dev/null || true
+  server=
+  awk -v name="$name" -v cpu="$(echo "$after $before" | awk '{ print $1 - $2 }')" '
+    /^mtload:/ { for (i = 1; i <= NF; ++i) if ($i ~ /s$/ && $i + 0 > 0) { secs = $i + 0; break } }
+    /^requests:/ { rps = substr($3, 2); errors = $NF }
+    /^transfer:/ { rate = $2 }
+    END {
+      gbit = rate * 1048576 * 8 * secs / 1e9
+      per = gbit > 0 ? cpu / gbit : 0
+      printf "  %-10s %9.1f MiB/s  %8d req/s  %6.3f CPU-s/Gbit  errors %s\n", name, rate, rps, per, errors
+    }' "$tmp/out"
+}
+
+for path in $paths; do
+  echo "$path"
+  run http "" "--port $port" "$@"
+  run ktls "" "--port $tls_port --tls" "$@"
+  grep -o '(.*)' "$tmp/serve" | sed 's/^/    mtserve: /'
+  run userspace "--no-ktls" "--port $tls_port --tls" "$@"
+done
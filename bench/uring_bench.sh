@@ -0,0 +1,58 @@
+#!/bin/sh
+# Compares mtserve's io_uring backend with its epoll one over loopback. For
+# each file and load it reports the requests per second and p99 batch
+# latency mtload sees, and mtserve's CPU time, user and system, per
+# request.
+#
+#   bench/uring_bench.sh [BUILD_DIR] [mtload args...]
+#
+# MT_BENCH_PATHS picks the files (default /index.html and /LICENSE) and
+# MT_BENCH_LOADS the mtload arguments each is driven with, separated by
+# commas; MT_SERVE_ARGS is passed to mtserve. Where the kernel has no
+# io_uring, mtserve says so and the io_uring rows measure epoll.
+set -eu
+
+build=${1:-build}
+[ $# -gt 0 ] && shift
+root=$(cd "$(dirname "$0")/.." && pwd)
+port=${MT_BENCH_PORT:-18080}
+paths=${MT_BENCH_PATHS:-/index.html /LICENSE}
+loads=${MT_BENCH_LOADS:---connections 1,--connections 32 --pipeline 4,--connections 256}
+tmp=$(mktemp -d)
+server=
+trap '[ -n "$server" ] && kill $server 2>/dev/null; rm -rf "$tmp"' EXIT INT TERM
+
+# CPU seconds, user and system, process $1 has used.
+cpu() { awk -v hz="$(getconf CLK_TCK)" '{ printf "%.2f", ($14 + $15) / hz }' "/proc/$1/stat"; }
+
+# run NAME "MTSERVE ARGS" "MTLOAD ARGS" [mtload args...]
+run() {
+  name=$1 serve_args=$2 load_args=$3
+  shift 3
+  "$build/mtserve" --root "$root" --host 127.0.0.1 --port "$port" $serve_args ${MT_SERVE_ARGS:-} 2>"$tmp/serve" &
+  server=$!
+  sleep 0.3
+  before=$(cpu $server)
+  "$build/mtload" --port "$port" --path "$path" --duration 10 $load_args "$@" >"$tmp/out" || true
+  after=$(cpu $server)
+  kill $server
+  wait $server 2>/dev/null || true
+  server=
+  awk -v name="$name" -v cpu="$(echo "$after $before" | awk '{ print $1 - $2 }')" '
+    /^requests:/ { n = $2; rps = substr($3, 2); errors = $NF }
+    /^latency/ { for (i = 1; i < NF; ++i) if ($i == "p99") p99 = $(i + 1) }
+    END {
+      per = n > 0 ? cpu * 1e6 / n : 0
+      printf "    %-9s %8d req/s  p99 %9s  %6.2f us CPU/request  errors %s\n", name, rps, p99, per, errors
+    }' "$tmp/out"
+}
+
+for path in $paths; do
+  echo "$path"
+  echo "$loads" | tr ',' '\n' | while read -r load; do
+    echo "  $load"
+    run epoll "" "$load" "$@"
+    run io_uring "--io-uring" "$load" "$@"
+    grep -o 'the kernel has no io_uring.*' "$tmp/serve" | sed 's/^/      mtserve: /' || true
+  done
+done
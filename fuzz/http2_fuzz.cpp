@@ -0,0 +1,125 @@
+// mthttp2fuzz: libFuzzer target for the HTTP/2 session and HPACK.
+//
+//   mthttp2fuzz fuzz/_corpus/http2                 (built with Clang: fuzzes)
+//   mthttp2fuzz fuzz/_corpus/http2/* more/inputs   (other compilers: replays)
+//
+// Each input is the client's side of a connection after the preface. It is
+// fed to a Session split at every 7th byte, so frames arrive in pieces, and
+// each request is answered with a body that is partly open. The output is
+// drained after every piece. A request handed to the handler must have a
+// normalized path. The input is also decoded as a lone header block and
+// must survive a Huffman round trip. A violation aborts.
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "hpack.h"
+#include "http2.h"
+
+namespace {
+
+[[noreturn]] void fail(const char* what, std::string_view input) {
+  std::fprintf(stderr, "mthttp2fuzz: %s on a %zu-byte input\n", what, input.size());
+  std::abort();
+}
+
+void check_path(std::string_view path, std::string_view input) {
+  if (path.empty() || path.front() != '/') fail("path not absolute", input);
+  for (std::string_view bad : {"//", "/./", "/../"}) {
+    if (path.find(bad) != std::string_view::npos) fail("path not normalized", input);
+  }
+  if (path.ends_with("/.") || path.ends_with("/..")) fail("path not normalized", input);
+  if (path.find('\0') != std::string_view::npos) fail("NUL in path", input);
+}
+
+// Sends everything the session has, touching every byte so the sanitizers
+// see a dangling span.
+void drain(mt::http2::Session& session, std::string_view input) {
+  for (int rounds = 0;; ++rounds) {
+    if (rounds > 100000) fail("output never ends", input);
+    auto iov = session.pending();
+    if (iov.empty()) return;
+    std::size_t n = 0;
+    unsigned sum = 0;
+    for (const auto& v : iov) {
+      if (v.iov_len == 0) fail("empty span", input);
+      auto* p = static_cast<const unsigned char*>(v.iov_base);
+      for (std::size_t i = 0; i < v.iov_len; ++i) sum += p[i];
+      n += v.iov_len;
+    }
+    (void)sum;
+    session.sent(n);
+  }
+}
+
+}  // namespace
+
+extern "C" int LLVMFuzzerTestOneInput(const std::uint8_t* data, std::size_t size) {
+  static const std::string kMemory(40000, 'm');
+  static const std::string kTrailer = "trailer";
+  std::string_view input(reinterpret_cast<const char*>(data), size);
+
+  mt::http2::Session* current = nullptr;
+  mt::http2::Session session([&](std::uint32_t stream, const mt::http::Request* req) {
+    std::string head;
+    mt::hpack::encode_status(head, req != nullptr ? 200 : 400);
+    mt::http2::Body body;
+    if (req != nullptr) {
+      check_path(req->path, input);
+      body.memory = kMemory;
+      body.trailer = kTrailer;
+      body.generated.assign(req->path);
+      body.open = stream % 4 == 3;
+    }
+    current->respond(stream, std::move(head), std::move(body), stream);
+  });
+  current = &session;
+
+  for (std::size_t at = 0; at < size; at += 7) {
+    bool ok = session.receive(input.substr(at, 7));
+    drain(session, input);
+    if (!ok) break;
+    if (session.active() && at % 3 == 0) session.push(3, "pushed");
+  }
+  drain(session, input);
+  session.finished().clear();
+
+  mt::hpack::Decoder decoder;
+  std::vector<mt::hpack::Field> fields;
+  decoder.decode(input, fields);
+
+  std::string coded;
+  mt::hpack::huffman_encode(coded, input);
+  if (coded.size() != mt::hpack::huffman_size(input)) fail("Huffman size wrong", input);
+  std::string decoded;
+  if (!mt::hpack::huffman_decode(coded, decoded) || decoded != input) fail("Huffman round trip", input);
+  return 0;
+}
+
+#ifdef MT_FUZZ_MAIN
+
+// Replays files, as libFuzzer does when given them, for builds without it.
+int main(int argc, char** argv) {
+  std::size_t inputs = 0;
+  for (int i = 1; i < argc; ++i) {
+    std::FILE* f = std::fopen(argv[i], "rb");
+    if (f == nullptr) {
+      std::fprintf(stderr, "mthttp2fuzz: cannot open %s\n", argv[i]);
+      return 1;
+    }
+    std::string data;
+    char chunk[4096];
+    for (std::size_t n; (n = std::fread(chunk, 1, sizeof chunk, f)) > 0;) data.append(chunk, n);
+    std::fclose(f);
+    LLVMFuzzerTestOneInput(reinterpret_cast<const std::uint8_t*>(data.data()), data.size());
+    ++inputs;
+  }
+  std::printf("mthttp2fuzz: %zu inputs passed\n", inputs);
+  return 0;
+}
+
+#endif
@@ -0,0 +1,122 @@
+// mthttpfuzz: libFuzzer target for the HTTP/1.1 request parser.
+//
+//   mthttpfuzz fuzz/_corpus/http                 (built with Clang: fuzzes)
+//   mthttpfuzz fuzz/_corpus/http/* more/inputs   (other compilers: replays)
+//
+// Each input is parsed with every scanner the CPU has, and must give the
+// same result with each. A complete parse must leave a normalized path
+// with no way above the root, and parsing any shorter prefix of the input
+// must report the same head or ask for more. A violation aborts.
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "http.h"
+
+namespace {
+
+using mt::http::ParseStatus;
+using mt::http::Request;
+using mt::http::Scanner;
+
+struct Result {
+  ParseStatus status = ParseStatus::incomplete;
+  std::size_t consumed = 0;
+  Request req;
+  std::string buf;  // the parsed copy, which req points into
+};
+
+[[noreturn]] void fail(const char* what, std::string_view input) {
+  std::fprintf(stderr, "mthttpfuzz: %s on a %zu-byte input\n", what, input.size());
+  std::abort();
+}
+
+Result parse(std::string_view input, Scanner scanner) {
+  Result r;
+  r.buf.assign(input);
+  r.status = mt::http::parse_request(std::span<char>(r.buf.data(), r.buf.size()), r.req, r.consumed, scanner);
+  return r;
+}
+
+bool same(const Result& a, const Result& b) {
+  if (a.status != b.status) return false;
+  if (a.status != ParseStatus::complete) return true;
+  const auto& x = a.req;
+  const auto& y = b.req;
+  return a.consumed == b.consumed && x.method == y.method && x.path == y.path && x.query == y.query &&
+         x.minor_version == y.minor_version && x.keep_alive == y.keep_alive && x.has_body == y.has_body &&
+         x.accept_encoding == y.accept_encoding && x.available_dictionary == y.available_dictionary &&
+         x.if_none_match == y.if_none_match;
+}
+
+void check_path(std::string_view path, std::string_view input) {
+  if (path.empty() || path.front() != '/') fail("path not absolute", input);
+  for (std::string_view bad : {"//", "/./", "/../"}) {
+    if (path.find(bad) != std::string_view::npos) fail("path not normalized", input);
+  }
+  if (path.ends_with("/.") || path.ends_with("/..")) fail("path not normalized", input);
+  if (path.find('\0') != std::string_view::npos) fail("NUL in path", input);
+}
+
+std::vector<Scanner> scanners() {
+  std::vector<Scanner> out = {Scanner::scalar};
+  auto best = mt::http::best_scanner();
+  if (best >= Scanner::sse42) out.push_back(Scanner::sse42);
+  if (best >= Scanner::avx2) out.push_back(Scanner::avx2);
+  return out;
+}
+
+}  // namespace
+
+extern "C" int LLVMFuzzerTestOneInput(const std::uint8_t* data, std::size_t size) {
+  static const auto kScanners = scanners();
+  std::string_view input(reinterpret_cast<const char*>(data), size);
+
+  auto full = parse(input, Scanner::scalar);
+  for (auto scanner : kScanners) {
+    if (!same(parse(input, scanner), full)) fail("scanners disagree", input);
+  }
+  if (full.status == ParseStatus::complete) {
+    if (full.consumed > size) fail("consumed past the end", input);
+    check_path(full.req.path, input);
+  }
+
+  // A prefix holds less of the same head: it is incomplete, or (once it
+  // reaches the end of a complete head) the same.
+  for (std::size_t n = 0; n < size; ++n) {
+    auto prefix = parse(input.substr(0, n), kScanners.back());
+    if (prefix.status == ParseStatus::incomplete) continue;
+    if (full.status == ParseStatus::complete && n < full.consumed) fail("prefix of a head parsed", input);
+    if (!same(prefix, full)) fail("prefix parsed differently", input);
+  }
+  return 0;
+}
+
+#ifdef MT_FUZZ_MAIN
+
+// Replays files, as libFuzzer does when given them, for builds without it.
+int main(int argc, char** argv) {
+  std::size_t inputs = 0;
+  for (int i = 1; i < argc; ++i) {
+    std::FILE* f = std::fopen(argv[i], "rb");
+    if (f == nullptr) {
+      std::fprintf(stderr, "mthttpfuzz: cannot open %s\n", argv[i]);
+      return 1;
+    }
+    std::string data;
+    char chunk[4096];
+    for (std::size_t n; (n = std::fread(chunk, 1, sizeof chunk, f)) > 0;) data.append(chunk, n);
+    std::fclose(f);
+    LLVMFuzzerTestOneInput(reinterpret_cast<const std::uint8_t*>(data.data()), data.size());
+    ++inputs;
+  }
+  std::printf("mthttpfuzz: %zu inputs passed\n", inputs);
+  return 0;
+}
+
+#endif
@@ -0,0 +1,85 @@
+// mtqpackfuzz: libFuzzer target for QPACK and HTTP/3 request checks.
+//
+//   mtqpackfuzz fuzz/_corpus/qpack                 (built with Clang: fuzzes)
+//   mtqpackfuzz fuzz/_corpus/qpack/* more/inputs   (other compilers: replays)
+//
+// Each input is a field section, as a client's HEADERS frame carries it.
+// A section that decodes is read as a request, whose path, if valid, must
+// be normalized. Its fields are then encoded again, and must decode to the
+// same list. A violation aborts.
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "http2.h"
+#include "qpack.h"
+
+namespace {
+
+[[noreturn]] void fail(const char* what, std::string_view input) {
+  std::fprintf(stderr, "mtqpackfuzz: %s on a %zu-byte input\n", what, input.size());
+  std::abort();
+}
+
+void check_path(std::string_view path, std::string_view input) {
+  if (path.front() != '/') fail("path not absolute", input);
+  for (std::string_view bad : {"//", "/./", "/../"}) {
+    if (path.find(bad) != std::string_view::npos) fail("path not normalized", input);
+  }
+  if (path.ends_with("/.") || path.ends_with("/..")) fail("path not normalized", input);
+  if (path.find('\0') != std::string_view::npos) fail("NUL in path", input);
+}
+
+}  // namespace
+
+extern "C" int LLVMFuzzerTestOneInput(const std::uint8_t* data, std::size_t size) {
+  std::string_view input(reinterpret_cast<const char*>(data), size);
+  mt::qpack::Decoder decoder;
+  std::vector<mt::hpack::Field> fields;
+  if (!decoder.decode(input, fields)) return 0;
+
+  std::string path;
+  mt::http::Request req;
+  mt::http2::Priority priority;
+  if (mt::http2::parse_request(fields, path, req, priority) && !req.path.empty()) check_path(req.path, input);
+
+  std::string section;
+  mt::qpack::begin_section(section);
+  for (const auto& f : fields) mt::qpack::encode_field(section, f.name, f.value);
+  mt::qpack::Decoder again(1 << 20);
+  std::vector<mt::hpack::Field> decoded;
+  if (!again.decode(section, decoded)) fail("re-encoded section does not decode", input);
+  if (decoded.size() != fields.size()) fail("round trip changed the field count", input);
+  for (std::size_t i = 0; i < fields.size(); ++i) {
+    if (decoded[i].name != fields[i].name || decoded[i].value != fields[i].value) fail("round trip", input);
+  }
+  return 0;
+}
+
+#ifdef MT_FUZZ_MAIN
+
+// Replays files, as libFuzzer does when given them, for builds without it.
+int main(int argc, char** argv) {
+  std::size_t inputs = 0;
+  for (int i = 1; i < argc; ++i) {
+    std::FILE* f = std::fopen(argv[i], "rb");
+    if (f == nullptr) {
+      std::fprintf(stderr, "mtqpackfuzz: cannot open %s\n", argv[i]);
+      return 1;
+    }
+    std::string data;
+    char chunk[4096];
+    for (std::size_t n; (n = std::fread(chunk, 1, sizeof chunk, f)) > 0;) data.append(chunk, n);
+    std::fclose(f);
+    LLVMFuzzerTestOneInput(reinterpret_cast<const std::uint8_t*>(data.data()), data.size());
+    ++inputs;
+  }
+  std::printf("mtqpackfuzz: %zu inputs passed\n", inputs);
+  return 0;
+}
+
+#endif
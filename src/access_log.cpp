@@ -0,0 +1,345 @@
+#include "access_log.h"
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include <algorithm>
+#include <bit>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+#ifdef MT_HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+#include "encoding.h"
+#include "http.h"
+
+namespace mt {
+
+namespace fs = std::filesystem;
+using Clock = std::chrono::steady_clock;
+
+namespace {
+
+// How often the writer looks at the rings, and the longest a record waits
+// before its frame is written.
+constexpr auto kDrainInterval = std::chrono::milliseconds(10);
+constexpr auto kFrameInterval = std::chrono::seconds(1);
+
+// The decoded start of every segment: kAccessLogMagic, then the record
+// size, so a reader can tell a layout it does not know.
+struct SegmentHeader {
+  char magic[8];
+  std::uint32_t record_size;
+  std::uint32_t reserved;
+};
+
+#ifdef MT_HAVE_ZSTD
+constexpr std::string_view kSuffix = ".mtlog.zst";
+
+// Speed matters more than ratio here: the writer must keep up with every
+// worker. Level 3 is zstd's default.
+std::string compress_frame(std::string_view data) {
+  std::string out(ZSTD_compressBound(data.size()), '\0');
+  auto size = ZSTD_compress(out.data(), out.size(), data.data(), data.size(), 3);
+  if (ZSTD_isError(size)) throw std::runtime_error(std::string("ZSTD_compress: ") + ZSTD_getErrorName(size));
+  out.resize(size);
+  return out;
+}
+#else
+constexpr std::string_view kSuffix = ".mtlog.gz";
+
+// One gzip member per frame; gzip readers decode the concatenation.
+std::string compress_frame(std::string_view data) {
+  z_stream zs{};
+  if (deflateInit2(&zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+    throw std::runtime_error("deflateInit2 failed");
+  }
+  std::string out(deflateBound(&zs, data.size()) + 32, '\0');
+  zs.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data.data()));
+  zs.avail_in = static_cast<uInt>(data.size());
+  zs.next_out = reinterpret_cast<Bytef*>(out.data());
+  zs.avail_out = static_cast<uInt>(out.size());
+  int rc = deflate(&zs, Z_FINISH);
+  out.resize(zs.total_out);
+  deflateEnd(&zs);
+  if (rc != Z_STREAM_END) throw std::runtime_error("deflate failed");
+  return out;
+}
+#endif
+
+// Decodes concatenated gzip members, stopping quietly at a truncated one.
+std::string gunzip(std::string_view data) {
+  std::string out;
+  z_stream zs{};
+  if (inflateInit2(&zs, 15 + 16) != Z_OK) throw std::runtime_error("inflateInit2 failed");
+  zs.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data.data()));
+  zs.avail_in = static_cast<uInt>(data.size());
+  char chunk[64 * 1024];
+  for (;;) {
+    zs.next_out = reinterpret_cast<Bytef*>(chunk);
+    zs.avail_out = sizeof chunk;
+    int rc = inflate(&zs, Z_NO_FLUSH);
+    out.append(chunk, sizeof chunk - zs.avail_out);
+    if (rc == Z_STREAM_END) {
+      if (zs.avail_in == 0) break;
+      inflateReset(&zs);
+    } else if (rc != Z_OK) {
+      if (rc == Z_BUF_ERROR && zs.avail_in == 0) break;  // the writer is mid-frame
+      inflateEnd(&zs);
+      throw std::runtime_error("corrupt gzip data");
+    }
+  }
+  inflateEnd(&zs);
+  return out;
+}
+
+#ifdef MT_HAVE_ZSTD
+std::string unzstd(std::string_view data) {
+  std::string out;
+  auto* dctx = ZSTD_createDCtx();
+  if (dctx == nullptr) throw std::runtime_error("ZSTD_createDCtx failed");
+  ZSTD_inBuffer in{data.data(), data.size(), 0};
+  char chunk[64 * 1024];
+  // A truncated last frame, one the writer is still writing, yields what
+  // it can and then stops asking for input.
+  std::size_t produced = sizeof chunk;
+  while (in.pos < in.size || produced == sizeof chunk) {
+    ZSTD_outBuffer o{chunk, sizeof chunk, 0};
+    auto rc = ZSTD_decompressStream(dctx, &o, &in);
+    if (ZSTD_isError(rc)) {
+      ZSTD_freeDCtx(dctx);
+      throw std::runtime_error(std::string("corrupt zstd data: ") + ZSTD_getErrorName(rc));
+    }
+    out.append(chunk, o.pos);
+    produced = o.pos;
+  }
+  ZSTD_freeDCtx(dctx);
+  return out;
+}
+#endif
+
+std::string_view method_name(std::uint8_t method) {
+  switch (static_cast<http::Method>(method)) {
+    case http::Method::get:
+      return "GET";
+    case http::Method::head:
+      return "HEAD";
+    default:
+      return "-";
+  }
+}
+
+}  // namespace
+
+AccessRing::AccessRing(std::size_t capacity)
+    : slots_(std::make_unique<AccessRecord[]>(std::bit_ceil(std::max<std::size_t>(capacity, 2)))),
+      mask_(std::bit_ceil(std::max<std::size_t>(capacity, 2)) - 1) {}
+
+std::size_t AccessRing::drain(std::string& out) {
+  auto tail = tail_.load(std::memory_order_relaxed);
+  auto head = head_.load(std::memory_order_acquire);
+  for (auto i = tail; i != head; ++i) {
+    out.append(reinterpret_cast<const char*>(&slots_[i & mask_]), sizeof(AccessRecord));
+  }
+  tail_.store(head, std::memory_order_release);
+  return head - tail;
+}
+
+AccessLog::AccessLog(AccessLogOptions options) : options_(std::move(options)) {
+  std::error_code ec;
+  fs::create_directories(options_.dir, ec);
+  if (ec) throw std::runtime_error("cannot create " + options_.dir.string() + ": " + ec.message());
+  writer_ = std::thread([this] { run(); });
+}
+
+AccessLog::~AccessLog() {
+  {
+    std::lock_guard lock(mu_);
+    stopping_ = true;
+  }
+  wake_.notify_one();
+  writer_.join();
+}
+
+AccessRing& AccessLog::add_ring() {
+  std::lock_guard lock(mu_);
+  rings_.push_back(std::make_unique<AccessRing>(options_.ring_capacity));
+  reported_drops_.push_back(0);
+  return *rings_.back();
+}
+
+std::string_view AccessLog::suffix() { return kSuffix; }
+
+void AccessLog::run() {
+  for (;;) {
+    bool stopping = false;
+    {
+      std::unique_lock lock(mu_);
+      wake_.wait_for(lock, kDrainInterval, [this] { return stopping_; });
+      stopping = stopping_;
+    }
+    collect();
+    auto now = Clock::now();
+    bool due = pending_.size() >= options_.frame_bytes || now - pending_since_ >= kFrameInterval;
+    if (!pending_.empty() && (due || stopping)) write_frame();
+    if (fd_ >= 0 && (segment_size_ >= options_.segment_bytes || now - segment_opened_ >= options_.segment_age)) {
+      close_segment();
+    }
+    if (stopping) break;
+  }
+  close_segment();
+}
+
+void AccessLog::collect() {
+  bool was_empty = pending_.empty();
+  std::lock_guard lock(mu_);
+  for (std::size_t i = 0; i < rings_.size(); ++i) {
+    rings_[i]->drain(pending_);
+    auto dropped = rings_[i]->dropped();
+    if (dropped == reported_drops_[i]) continue;
+    AccessRecord record;
+    timespec ts{};
+    ::clock_gettime(CLOCK_REALTIME, &ts);
+    record.time = static_cast<std::uint64_t>(ts.tv_sec) * 1000000000 + static_cast<std::uint64_t>(ts.tv_nsec);
+    record.method = kAccessDropped;
+    record.bytes = dropped - reported_drops_[i];
+    record.worker = static_cast<std::uint16_t>(i);
+    pending_.append(reinterpret_cast<const char*>(&record), sizeof record);
+    reported_drops_[i] = dropped;
+  }
+  if (was_empty && !pending_.empty()) pending_since_ = Clock::now();
+}
+
+void AccessLog::write_frame() {
+  // A failed write loses these records; the server keeps running.
+  try {
+    std::string raw;
+    if (fd_ < 0) {
+      open_segment();
+      SegmentHeader header{};
+      std::memcpy(header.magic, kAccessLogMagic, sizeof kAccessLogMagic);
+      header.record_size = sizeof(AccessRecord);
+      raw.assign(reinterpret_cast<const char*>(&header), sizeof header);
+    }
+    raw += pending_;
+    auto frame = compress_frame(raw);
+    std::string_view left = frame;
+    while (!left.empty()) {
+      auto n = ::write(fd_, left.data(), left.size());
+      if (n < 0 && errno == EINTR) continue;
+      if (n <= 0) throw std::runtime_error(std::string("write failed: ") + std::strerror(errno));
+      left.remove_prefix(static_cast<std::size_t>(n));
+    }
+    segment_size_ += frame.size();
+  } catch (const std::exception& e) {
+    std::fprintf(stderr, "access log: %s\n", e.what());
+    close_segment();
+  }
+  pending_.clear();
+}
+
+void AccessLog::open_segment() {
+  timespec ts{};
+  ::clock_gettime(CLOCK_REALTIME, &ts);
+  std::tm tm{};
+  ::gmtime_r(&ts.tv_sec, &tm);
+  char stamp[32];
+  std::strftime(stamp, sizeof stamp, "%Y%m%dT%H%M%SZ", &tm);
+  // A restart within the same second finds its predecessor's names taken.
+  for (;;) {
+    auto name = "access-" + std::string(stamp) + "-" + std::to_string(segments_++) + std::string(kSuffix);
+    auto path = options_.dir / name;
+    fd_ = ::open(path.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_APPEND | O_CLOEXEC, 0644);
+    if (fd_ >= 0) break;
+    if (errno != EEXIST) throw std::runtime_error("cannot create " + path.string() + ": " + std::strerror(errno));
+  }
+  segment_size_ = 0;
+  segment_opened_ = Clock::now();
+}
+
+void AccessLog::close_segment() {
+  if (fd_ >= 0) ::close(fd_);
+  fd_ = -1;
+}
+
+void read_access_log(const fs::path& path, const std::function<void(const AccessRecord&)>& record) {
+  std::ifstream in(path, std::ios::binary);
+  if (!in) throw std::runtime_error("cannot read " + path.string());
+  std::ostringstream s;
+  s << in.rdbuf();
+  auto data = s.str();
+
+  std::string decoded;
+  if (data.starts_with("\x1f\x8b")) {
+    decoded = gunzip(data);
+  } else if (data.starts_with("\x28\xb5\x2f\xfd")) {
+#ifdef MT_HAVE_ZSTD
+    decoded = unzstd(data);
+#else
+    throw std::runtime_error(path.string() + " is zstd-compressed, and this build has no zstd");
+#endif
+  } else if (!data.empty()) {
+    throw std::runtime_error("not an access log segment: " + path.string());
+  }
+  if (decoded.empty()) return;  // created, no frame written yet
+
+  SegmentHeader header{};
+  if (decoded.size() < sizeof header) throw std::runtime_error("truncated access log segment: " + path.string());
+  std::memcpy(&header, decoded.data(), sizeof header);
+  if (std::memcmp(header.magic, kAccessLogMagic, sizeof kAccessLogMagic) != 0 ||
+      header.record_size != sizeof(AccessRecord)) {
+    throw std::runtime_error("unknown access log layout: " + path.string());
+  }
+  AccessRecord r;
+  for (auto at = sizeof header; at + sizeof r <= decoded.size(); at += sizeof r) {
+    std::memcpy(&r, decoded.data() + at, sizeof r);
+    record(r);
+  }
+}
+
+std::string format_access_record(const AccessRecord& r) {
+  auto seconds = static_cast<std::time_t>(r.time / 1000000000);
+  std::tm tm{};
+  ::gmtime_r(&seconds, &tm);
+  char line[128];
+  auto n = std::strftime(line, sizeof line, "%Y-%m-%dT%H:%M:%S", &tm);
+  std::snprintf(line + n, sizeof line - n, ".%03uZ", static_cast<unsigned>(r.time / 1000000 % 1000));
+  std::string out = line;
+  if (r.method == kAccessDropped) {
+    out += " dropped ";
+    out += std::to_string(r.bytes);
+    out += " records (worker ";
+    out += std::to_string(r.worker);
+    out += ')';
+    return out;
+  }
+  char peer[INET_ADDRSTRLEN] = "-";
+  ::inet_ntop(AF_INET, &r.peer, peer, sizeof peer);
+  out += ' ';
+  out += peer;
+  out += ' ';
+  out += method_name(r.method);
+  out += ' ';
+  out.append(r.path, std::min<std::size_t>(r.path_size, kAccessPathBytes));
+  if (r.path_size > kAccessPathBytes) out += "...";
+  if (r.path_size == 0) out += '-';
+  out += ' ';
+  out += std::to_string(r.status);
+  out += ' ';
+  auto encoding = static_cast<Encoding>(r.encoding < kEncodingCount ? r.encoding : 0);
+  out += encoding == Encoding::identity ? std::string_view("-") : encoding_token(encoding);
+  out += ' ';
+  out += std::to_string(r.bytes);
+  return out;
+}
+
+}  // namespace mt
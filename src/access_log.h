@@ -0,0 +1,155 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+namespace mt {
+
+// One request, as mtserve logs it: a fixed 64 bytes, so queuing one is a
+// copy into a ring slot.
+struct AccessRecord {
+  std::uint64_t time = 0;   // nanoseconds since the epoch, to the worker's last wakeup
+  std::uint64_t bytes = 0;  // body bytes sent; for kAccessDropped, records lost
+  std::uint32_t peer = 0;   // IPv4 address, network byte order
+  std::uint16_t status = 0;
+  std::uint8_t method = 0;    // an http::Method, or kAccessDropped
+  std::uint8_t encoding = 0;  // an Encoding
+  std::uint16_t path_size = 0;  // of the whole path; at most kAccessPathBytes are kept
+  // Widened from a byte and the zero byte after it, so (little-endian)
+  // logs written before read the same.
+  std::uint16_t worker = 0;
+  char path[36] = {};
+};
+static_assert(sizeof(AccessRecord) == 64);
+
+inline constexpr std::size_t kAccessPathBytes = sizeof(AccessRecord::path);
+// AccessRecord::method of a record standing for `bytes` records a full ring
+// turned away.
+inline constexpr std::uint8_t kAccessDropped = 0xff;
+
+// A single-producer, single-consumer queue of records: one worker pushes,
+// the log's writer thread pops. Neither side locks or allocates.
+class AccessRing {
+ public:
+  // `capacity` is rounded up to a power of two.
+  explicit AccessRing(std::size_t capacity);
+
+  // Producer side. Returns false, and counts the record as dropped, when
+  // the ring is full.
+  bool push(const AccessRecord& record) {
+    auto head = head_.load(std::memory_order_relaxed);
+    if (head - cached_tail_ > mask_) {
+      cached_tail_ = tail_.load(std::memory_order_acquire);
+      if (head - cached_tail_ > mask_) {
+        dropped_.store(dropped_.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        return false;
+      }
+    }
+    slots_[head & mask_] = record;
+    head_.store(head + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Consumer side: appends every queued record to `out`, then frees their
+  // slots. Returns how many there were.
+  std::size_t drain(std::string& out);
+
+  // Records turned away so far.
+  std::uint64_t dropped() const { return dropped_.load(std::memory_order_relaxed); }
+
+ private:
+  std::unique_ptr<AccessRecord[]> slots_;
+  std::size_t mask_;
+  // Each index on its own cache line, so the two threads do not share one.
+  alignas(64) std::atomic<std::size_t> head_{0};  // written by the producer
+  std::size_t cached_tail_ = 0;                   // the producer's last look at tail_
+  std::atomic<std::uint64_t> dropped_{0};
+  alignas(64) std::atomic<std::size_t> tail_{0};  // written by the consumer
+};
+
+struct AccessLogOptions {
+  std::filesystem::path dir;             // segments are written here
+  std::size_t ring_capacity = 64 * 1024;  // records per worker
+  // A segment is closed and a new one started once it holds this many
+  // compressed bytes, or has been open this long.
+  std::size_t segment_bytes = 64 << 20;
+  std::chrono::seconds segment_age{3600};
+  // Queued records are compressed into a frame and written once this many
+  // bytes of them have collected, or a second after the oldest arrived.
+  std::size_t frame_bytes = 1 << 20;
+};
+
+// The binary access log. Workers push records into rings of their own; a
+// writer thread drains them every few milliseconds and appends compressed
+// frames to the current segment file, "access-<UTC time>-<n>.mtlog" plus
+// ".zst" (or ".gz" in builds without zstd). A segment decodes to a
+// kAccessLogMagic header and then records, oldest first per worker.
+// Records a full ring turned away are counted in kAccessDropped records.
+class AccessLog {
+ public:
+  // Creates `options.dir` if needed and starts the writer thread. Throws
+  // std::runtime_error.
+  explicit AccessLog(AccessLogOptions options);
+  // Stops the writer after it has written out every queued record.
+  ~AccessLog();
+  AccessLog(const AccessLog&) = delete;
+  AccessLog& operator=(const AccessLog&) = delete;
+
+  // A new ring for one worker, owned by the log. Call before the worker
+  // starts pushing; safe while the writer runs.
+  AccessRing& add_ring();
+
+  // The segment suffix this build writes: ".mtlog.zst" or ".mtlog.gz".
+  static std::string_view suffix();
+
+ private:
+  void run();
+  // Drains every ring into pending_, plus a kAccessDropped record for each
+  // ring that has turned records away since the last call.
+  void collect();
+  // Compresses pending_ into one frame of the current segment, opening a
+  // segment first if none is open.
+  void write_frame();
+  void open_segment();
+  void close_segment();
+
+  AccessLogOptions options_;
+  std::mutex mu_;  // guards rings_ and stopping_; never taken by workers
+  std::condition_variable wake_;
+  bool stopping_ = false;
+  std::vector<std::unique_ptr<AccessRing>> rings_;
+  std::vector<std::uint64_t> reported_drops_;  // per ring, already logged
+
+  // Writer thread state.
+  std::string pending_;  // records not yet compressed
+  std::chrono::steady_clock::time_point pending_since_{};
+  int fd_ = -1;
+  std::size_t segment_size_ = 0;
+  std::chrono::steady_clock::time_point segment_opened_{};
+  std::uint64_t segments_ = 0;
+  std::thread writer_;
+};
+
+inline constexpr char kAccessLogMagic[8] = {'M', 'T', 'A', 'L', 'O', 'G', '\0', '\1'};
+
+// Decodes the segment at `path`, zstd or gzip by its first bytes, and calls `record` for
+// each record in it. A segment still being written decodes up to its last
+// complete frame. Throws std::runtime_error.
+void read_access_log(const std::filesystem::path& path, const std::function<void(const AccessRecord&)>& record);
+
+// One record as a line of text, without the newline:
+// "2026-10-16T00:58:04.123Z 203.0.113.9 GET /index.html 200 gzip 17769".
+std::string format_access_record(const AccessRecord& record);
+
+}  // namespace mt
@@ -0,0 +1,11 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+
+namespace mt {
+
+// RFC 4648 base64 with padding, as used by structured-field byte sequences.
+std::string base64_encode(std::string_view data);
+
+}  // namespace mt
@@ -0,0 +1,147 @@
+// mtembed: compiles a site directory into a C++ source file.
+//
+//   mtembed SITE_DIR OUTPUT.cpp
+//
+// Emits every servable file and its precompressed variants (same rules as
+// mtserve --root), and the site's search index, as constexpr byte arrays
+// plus a compile-time perfect-hash route table, implementing the interface
+// in embedded_site.h. The output is rewritten only when its content changes
+// so an unchanged site does not trigger a recompile.
+
+#include <unistd.h>
+
+#include <cstdio>
+#include <exception>
+#include <fstream>
+#include <iterator>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "site.h"
+
+namespace {
+
+std::string read_all(const mt::Representation& rep, const std::string& path) {
+  std::string data(rep.size, '\0');
+  std::size_t off = 0;
+  while (off < data.size()) {
+    ssize_t n = ::pread(rep.fd, data.data() + off, data.size() - off, static_cast<off_t>(off));
+    if (n <= 0) throw std::runtime_error("short read: " + path);
+    off += static_cast<std::size_t>(n);
+  }
+  return data;
+}
+
+// C++ string literal for a path, content type or header block; all are
+// ASCII, and header blocks carry CRLFs.
+std::string literal(std::string_view s) {
+  std::string out = "\"";
+  for (char c : s) {
+    if (c == '\r') {
+      out += "\\r";
+    } else if (c == '\n') {
+      out += "\\n";
+    } else {
+      if (c == '"' || c == '\\') out += '\\';
+      out += c;
+    }
+  }
+  return out + "\"";
+}
+
+std::string generate(const mt::Site& site, const std::string& source) {
+  std::ostringstream out;
+  out << "// Generated by mtembed from " << source << ". Do not edit.\n\n"
+      << "#include <iterator>\n\n"
+      << "#include \"embedded_site.h\"\n"
+      << "#include \"perfect_hash.h\"\n\n"
+      << "namespace mt::embedded {\n\nnamespace {\n\n";
+
+  const auto& resources = site.resources();
+  for (std::size_t i = 0; i < resources.size(); ++i) {
+    for (std::size_t e = 0; e < mt::kEncodingCount; ++e) {
+      const auto& rep = resources[i].reps[e];
+      if (rep.size == 0) continue;
+      auto data = read_all(rep, resources[i].path);
+      out << "// " << resources[i].path << mt::encoding_suffix(static_cast<mt::Encoding>(e))
+          << "\nalignas(64) constexpr unsigned char kData" << i << "_" << e << "[] = {";
+      for (std::size_t j = 0; j < data.size(); ++j) {
+        out << (j % 24 == 0 ? "\n    " : " ") << static_cast<unsigned>(static_cast<unsigned char>(data[j])) << ",";
+      }
+      out << "\n};\n\n";
+    }
+  }
+
+  auto index = site.search().bytes();
+  if (!index.empty()) {
+    out << "// " << mt::kSearchIndexName << "\nalignas(64) constexpr unsigned char kSearchIndex[] = {";
+    for (std::size_t j = 0; j < index.size(); ++j) {
+      out << (j % 24 == 0 ? "\n    " : " ") << static_cast<unsigned>(static_cast<unsigned char>(index[j])) << ",";
+    }
+    out << "\n};\n\n";
+  }
+
+  out << "constexpr File kFiles[] = {\n";
+  for (std::size_t i = 0; i < resources.size(); ++i) {
+    const auto& r = resources[i];
+    out << "    {" << literal(r.path) << ", " << literal(r.content_type) << ", {{";
+    for (std::size_t e = 0; e < mt::kEncodingCount; ++e) {
+      out << (e ? ", " : "");
+      if (r.reps[e].size == 0) {
+        out << "{nullptr, 0}";
+      } else {
+        out << "{kData" << i << "_" << e << ", sizeof kData" << i << "_" << e << "}";
+      }
+    }
+    out << "}}, " << literal(r.headers) << ", " << literal(r.etags[0]) << "},\n";
+  }
+  out << "};\n\n";
+
+  std::vector<std::pair<std::string, std::size_t>> routes;
+  for (std::size_t i = 0; i < resources.size(); ++i) {
+    routes.emplace_back(resources[i].path, i);
+    if (auto alias = mt::index_alias(resources[i].path); !alias.empty()) routes.emplace_back(alias, i);
+  }
+  out << "constexpr std::string_view kRoutes[] = {\n";
+  for (const auto& [path, file] : routes) out << "    " << literal(path) << ",\n";
+  out << "};\n\nconstexpr int kRouteFiles[] = {";
+  for (const auto& [path, file] : routes) out << file << ", ";
+  out << "};\n\n"
+      << "constexpr auto kTable = PerfectHash<std::size(kRoutes)>::build(kRoutes);\n\n"
+      << "}  // namespace\n\n"
+      << "std::span<const File> files() { return kFiles; }\n\n"
+      << "int find(std::string_view path) {\n"
+      << "  int i = kTable.find(path, kRoutes);\n"
+      << "  return i < 0 ? -1 : kRouteFiles[i];\n"
+      << "}\n\n"
+      << (index.empty() ? "Blob search_index() { return {nullptr, 0}; }\n\n"
+                        : "Blob search_index() { return {kSearchIndex, sizeof kSearchIndex}; }\n\n")
+      << "}  // namespace mt::embedded\n";
+  return out.str();
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  if (argc != 3) {
+    std::fprintf(stderr, "usage: mtembed SITE_DIR OUTPUT.cpp\n");
+    return 2;
+  }
+  try {
+    auto site = mt::Site::load(argv[1]);
+    if (site.resources().empty()) throw std::runtime_error("no servable files in " + std::string(argv[1]));
+    auto text = generate(site, argv[1]);
+
+    std::ifstream existing(argv[2], std::ios::binary);
+    if (existing && std::string(std::istreambuf_iterator<char>(existing), {}) == text) return 0;
+    std::ofstream out(argv[2], std::ios::binary | std::ios::trunc);
+    out << text;
+    if (!out.flush()) throw std::runtime_error(std::string("cannot write ") + argv[2]);
+  } catch (const std::exception& e) {
+    std::fprintf(stderr, "mtembed: %s\n", e.what());
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,41 @@
+// mtlog: prints mtserve access log segments as text.
+//
+//   mtlog SEGMENT...
+//
+// One line per record, in the order of the segments given and, within a
+// segment, as the writer drained it. A segment still being written prints
+// up to its last complete frame.
+
+#include <cstdio>
+#include <cstdlib>
+#include <exception>
+#include <string>
+
+#include "access_log.h"
+
+namespace {
+
+[[noreturn]] void usage() {
+  std::fprintf(stderr, "usage: mtlog SEGMENT...\n");
+  std::exit(2);
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  if (argc < 2) usage();
+  try {
+    std::string line;
+    for (int i = 1; i < argc; ++i) {
+      mt::read_access_log(argv[i], [&](const mt::AccessRecord& record) {
+        line = mt::format_access_record(record);
+        line += '\n';
+        std::fwrite(line.data(), 1, line.size(), stdout);
+      });
+    }
+  } catch (const std::exception& e) {
+    std::fprintf(stderr, "mtlog: %s\n", e.what());
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,146 @@
+// mtserve: serves the site root over HTTP/1.1 and HTTP/2, HTTPS with
+// --tls-port and HTTP/3 with --h3-port.
+//
+//   mtserve [--root DIR] [--host ADDR] [--port N] [--threads N] [--no-pin]
+//           [--access-log DIR [--log-segment-bytes N] [--log-segment-seconds N]]
+//           [--metrics-port N]
+//           [--tls-port N] [--h3-port N] [--tls-cert PEM --tls-key PEM]
+//           [--no-ktls] [--no-udp-offload] [--io-uring]
+//
+// MT_EMBED_SITE builds serve the compiled-in site unless --root is given.
+// --access-log writes a binary record of every response to compressed
+// segments in DIR; mtlog prints them. --metrics-port serves Prometheus
+// metrics at /metrics on a port of their own. --tls-port serves HTTPS on
+// a second TCP port, with TLS handed to the kernel after each handshake
+// unless --no-ktls is given. --h3-port serves HTTP/3 on a UDP port;
+// --no-udp-offload turns off UDP GSO and GRO. --io-uring serves plain
+// HTTP from io_uring rather than epoll, where the kernel allows it.
+
+#include <signal.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <exception>
+#include <memory>
+#include <string>
+#include <string_view>
+
+#include "access_log.h"
+#include "server.h"
+#include "site.h"
+#ifdef MT_HAVE_OPENSSL
+#include "tls.h"
+#endif
+
+namespace {
+
+[[noreturn]] void usage() {
+  std::fprintf(stderr,
+               "usage: mtserve [--root DIR] [--host ADDR] [--port N] [--threads N] [--no-pin]\n"
+               "               [--access-log DIR [--log-segment-bytes N] [--log-segment-seconds N]]\n"
+               "               [--metrics-port N]\n"
+               "               [--tls-port N] [--h3-port N] [--tls-cert PEM --tls-key PEM]\n"
+               "               [--no-ktls] [--no-udp-offload] [--io-uring]\n");
+  std::exit(2);
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  std::string root;
+  mt::ServerOptions options;
+  mt::AccessLogOptions log_options;
+  for (int i = 1; i < argc; ++i) {
+    std::string_view arg = argv[i];
+    auto value = [&]() -> const char* {
+      if (i + 1 >= argc) usage();
+      return argv[++i];
+    };
+    if (arg == "--root") {
+      root = value();
+    } else if (arg == "--host") {
+      options.host = value();
+    } else if (arg == "--port") {
+      options.port = static_cast<std::uint16_t>(std::atoi(value()));
+    } else if (arg == "--threads") {
+      options.threads = static_cast<unsigned>(std::atoi(value()));
+    } else if (arg == "--no-pin") {
+      options.pin = false;
+    } else if (arg == "--access-log") {
+      log_options.dir = value();
+    } else if (arg == "--log-segment-bytes") {
+      log_options.segment_bytes = std::strtoull(value(), nullptr, 10);
+    } else if (arg == "--log-segment-seconds") {
+      log_options.segment_age = std::chrono::seconds(std::atol(value()));
+    } else if (arg == "--metrics-port") {
+      options.metrics_port = static_cast<std::uint16_t>(std::atoi(value()));
+    } else if (arg == "--tls-port") {
+      options.tls_port = static_cast<std::uint16_t>(std::atoi(value()));
+    } else if (arg == "--no-ktls") {
+      options.ktls = false;
+    } else if (arg == "--h3-port") {
+      options.h3_port = static_cast<std::uint16_t>(std::atoi(value()));
+    } else if (arg == "--tls-cert") {
+      options.tls_cert = value();
+    } else if (arg == "--tls-key") {
+      options.tls_key = value();
+    } else if (arg == "--no-udp-offload") {
+      options.udp_offload = false;
+    } else if (arg == "--io-uring") {
+      options.io_uring = true;
+    } else {
+      usage();
+    }
+  }
+
+  // Block the shutdown signals before any worker exists so they are only
+  // ever delivered to the sigwait below.
+  sigset_t signals;
+  sigemptyset(&signals);
+  sigaddset(&signals, SIGINT);
+  sigaddset(&signals, SIGTERM);
+  pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+  signal(SIGPIPE, SIG_IGN);
+
+  try {
+#ifdef MT_EMBED_SITE
+    auto site = root.empty() ? mt::Site::embedded() : mt::Site::load(root);
+    const char* source = root.empty() ? "<embedded>" : root.c_str();
+#else
+    auto site = mt::Site::load(root.empty() ? "." : root);
+    const char* source = root.empty() ? "." : root.c_str();
+#endif
+    // Declared before the server so it outlives the workers and writes out
+    // what they queued last.
+    std::unique_ptr<mt::AccessLog> access_log;
+    if (!log_options.dir.empty()) {
+      access_log = std::make_unique<mt::AccessLog>(log_options);
+      options.access_log = access_log.get();
+    }
+    mt::Server server(site, options);
+    server.start();
+    std::fprintf(stderr, "mtserve: %zu files from %s on %s:%u, %u workers\n", site.resources().size(), source,
+                 options.host.c_str(), options.port, server.threads());
+    if (options.io_uring) {
+      std::fprintf(stderr, "mtserve: %s\n",
+                   server.io_uring() ? "serving HTTP from io_uring" : "the kernel has no io_uring, serving from epoll");
+    }
+#ifdef MT_HAVE_OPENSSL
+    if (options.tls_port != 0) {
+      const char* mode = !options.ktls                  ? "userspace TLS"
+                         : mt::tls::kernel_tls_available() ? "kTLS"
+                                                           : "userspace TLS, the kernel has no kTLS";
+      std::fprintf(stderr, "mtserve: HTTPS on tcp %u (%s)\n", options.tls_port, mode);
+    }
+#endif
+    if (options.h3_port != 0) std::fprintf(stderr, "mtserve: HTTP/3 on udp %u\n", options.h3_port);
+    int sig = 0;
+    sigwait(&signals, &sig);
+    server.stop();
+  } catch (const std::exception& e) {
+    std::fprintf(stderr, "mtserve: %s\n", e.what());
+    return 1;
+  }
+  return 0;
+}
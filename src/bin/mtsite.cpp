@@ -0,0 +1,170 @@
+// mtsite: builds the site into a directory mtserve can serve.
+//
+//   mtsite build [--src DIR] [--out DIR] [--jobs N] [--cache DIR] [--no-minify]
+//                [--search-budget BYTES] [--keep-unused-css] [--no-critical-css]
+//                [--first-flight BYTES]
+//   mtsite watch [build options] [--host ADDR] [--port N]
+//
+// `watch` builds, serves the output on ADDR:N (127.0.0.1:8080) with live
+// reload, and rebuilds whenever a source changes. Its builds skip the
+// compressed variants; run `build` before deploying. See gen/build.h for
+// what a build produces.
+
+#include <signal.h>
+#include <sys/signalfd.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <filesystem>
+#include <memory>
+#include <string>
+#include <string_view>
+
+#include "gen/build.h"
+#include "gen/watch.h"
+#include "server.h"
+#include "site.h"
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+[[noreturn]] void usage() {
+  std::fprintf(stderr,
+               "usage: mtsite build [--src DIR] [--out DIR] [--jobs N] [--cache DIR] [--no-minify]\n"
+               "                   [--search-budget BYTES] [--keep-unused-css] [--no-critical-css]\n"
+               "                   [--first-flight BYTES]\n"
+               "       mtsite watch [build options] [--host ADDR] [--port N]\n");
+  std::exit(2);
+}
+
+double ms_since(Clock::time_point start) {
+  return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+mt::gen::BuildStats build(const mt::gen::BuildOptions& opts) {
+  auto start = Clock::now();
+  auto stats = mt::gen::build_site(opts, stderr);
+  std::fprintf(stderr, "mtsite: %zu files, %zu rebuilt, %zu removed in %.1f ms\n", stats.files, stats.rebuilt,
+               stats.removed, ms_since(start));
+  std::fprintf(stderr, "mtsite:");
+  for (const auto& [stage, stage_ms] : stats.stage_ms) {
+    std::fprintf(stderr, " %s %.1f", std::string(stage).c_str(), stage_ms);
+  }
+  std::fprintf(stderr, " ms\n");
+  return stats;
+}
+
+// Runs until SIGINT or SIGTERM. A failed rebuild is reported and the last
+// good output stays up until the next change.
+void watch(mt::gen::BuildOptions opts, const mt::ServerOptions& server_options) {
+  opts.precompress = false;
+
+  // Block the shutdown signals before any thread exists, so they are only
+  // ever read from signal_fd.
+  sigset_t signals;
+  sigemptyset(&signals);
+  sigaddset(&signals, SIGINT);
+  sigaddset(&signals, SIGTERM);
+  pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+  signal(SIGPIPE, SIG_IGN);
+  int signal_fd = ::signalfd(-1, &signals, SFD_CLOEXEC);
+  if (signal_fd < 0) throw std::runtime_error(std::string("signalfd: ") + std::strerror(errno));
+
+  // Watching starts first so that no edit made during the build is missed.
+  mt::gen::Watcher watcher(opts.src, {opts.out, opts.cache.empty() ? opts.out : opts.cache},
+                           {std::string(mt::gen::kLayoutDir)});
+  try {
+    build(opts);
+  } catch (const std::exception& e) {
+    std::fprintf(stderr, "mtsite: %s\n", e.what());
+  }
+  std::filesystem::create_directories(opts.out);
+  auto site = mt::Site::load(opts.out);
+  mt::Server server(site, server_options);
+  server.start();
+  std::fprintf(stderr, "mtsite: serving %s on http://%s:%u/ with live reload\n", opts.out.c_str(),
+               server_options.host.c_str(), server_options.port);
+
+  while (auto changes = watcher.wait(signal_fd)) {
+    if (changes->paths.size() == 1) {
+      std::fprintf(stderr, "mtsite: %s changed\n", changes->paths[0].c_str());
+    } else {
+      std::fprintf(stderr, "mtsite: %zu paths changed\n", changes->paths.size());
+    }
+    try {
+      auto stats = build(opts);
+      if (stats.rebuilt + stats.removed == 0) continue;
+      server.reload(std::make_shared<const mt::Site>(mt::Site::load(opts.out)));
+      std::fprintf(stderr, "mtsite: reload sent %.1f ms after the change\n", ms_since(changes->first));
+    } catch (const std::exception& e) {
+      std::fprintf(stderr, "mtsite: %s\n", e.what());
+    }
+  }
+  server.stop();
+  ::close(signal_fd);
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  if (argc < 2) usage();
+  std::string_view command = argv[1];
+  if (command != "build" && command != "watch") usage();
+  bool watching = command == "watch";
+  mt::gen::BuildOptions opts;
+  mt::ServerOptions server_options;
+  server_options.host = "127.0.0.1";
+  server_options.threads = 1;  // one browser; the cores are for rebuilding
+  server_options.pin = false;
+  server_options.live_reload = true;
+  for (int i = 2; i < argc; ++i) {
+    std::string_view arg = argv[i];
+    auto value = [&]() -> const char* {
+      if (i + 1 >= argc) usage();
+      return argv[++i];
+    };
+    if (arg == "--src") {
+      opts.src = value();
+    } else if (arg == "--out") {
+      opts.out = value();
+    } else if (arg == "--jobs") {
+      opts.jobs = static_cast<unsigned>(std::atoi(value()));
+    } else if (arg == "--cache") {
+      opts.cache = value();
+    } else if (arg == "--no-minify") {
+      opts.minify = false;
+    } else if (arg == "--search-budget") {
+      opts.search_budget = static_cast<std::size_t>(std::atoll(value()));
+    } else if (arg == "--keep-unused-css") {
+      opts.prune_css = false;
+    } else if (arg == "--no-critical-css") {
+      opts.critical_css = false;
+    } else if (arg == "--first-flight") {
+      opts.first_flight = static_cast<std::size_t>(std::atoll(value()));
+    } else if (watching && arg == "--host") {
+      server_options.host = value();
+    } else if (watching && arg == "--port") {
+      server_options.port = static_cast<std::uint16_t>(std::atoi(value()));
+    } else {
+      usage();
+    }
+  }
+
+  try {
+    if (watching) {
+      watch(opts, server_options);
+    } else {
+      build(opts);
+    }
+  } catch (const std::exception& e) {
+    std::fprintf(stderr, "mtsite: %s\n", e.what());
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,225 @@
+#include "client_search.h"
+
+#include <algorithm>
+#include <bit>
+#include <cstring>
+#include <iterator>
+#include <stdexcept>
+
+#include "search.h"
+
+namespace mt {
+
+namespace {
+
+std::runtime_error corrupt() { return std::runtime_error("not a valid client search index"); }
+
+std::uint32_t read_u32(std::string_view data, std::size_t at) {
+  std::uint32_t v = 0;
+  std::memcpy(&v, data.data() + at, sizeof v);
+  return v;
+}
+
+std::uint32_t read_varint(std::string_view data, std::size_t& at) {
+  std::uint32_t v = 0;
+  for (unsigned shift = 0; shift < 35; shift += 7) {
+    if (at >= data.size()) throw corrupt();
+    auto byte = static_cast<unsigned char>(data[at++]);
+    v |= static_cast<std::uint32_t>(byte & 0x7f) << shift;
+    if ((byte & 0x80) == 0) return v;
+  }
+  throw corrupt();
+}
+
+// The `width`-bit field starting `bit` bits into data[at...].
+std::uint32_t read_bits(std::string_view data, std::size_t at, std::uint64_t bit, unsigned width) {
+  std::uint64_t v = 0;
+  for (unsigned done = 0; done < width;) {
+    auto byte = at + (bit + done) / 8;
+    if (byte >= data.size()) throw corrupt();
+    auto shift = static_cast<unsigned>((bit + done) % 8);
+    auto take = std::min(8 - shift, width - done);
+    v |= static_cast<std::uint64_t>((static_cast<unsigned char>(data[byte]) >> shift) & ((1u << take) - 1)) << done;
+    done += take;
+  }
+  return static_cast<std::uint32_t>(v);
+}
+
+std::string_view read_string(std::string_view data, std::size_t& at, std::size_t size) {
+  if (size > data.size() - at) throw corrupt();
+  auto s = data.substr(at, size);
+  at += size;
+  return s;
+}
+
+}  // namespace
+
+ClientSearchIndex::ClientSearchIndex(std::string_view data) : data_(data) {
+  if (data.size() < kClientSearchHeaderSize || std::memcmp(data.data(), kClientSearchMagic, 8) != 0) throw corrupt();
+  doc_count_ = read_u32(data, 8);
+  term_count_ = read_u32(data, 12);
+  auto docs = read_u32(data, 16);
+  fst_ = read_u32(data, 20);
+  root_ = read_u32(data, 24);
+  offsets_ = read_u32(data, 28);
+  postings_ = read_u32(data, 32);
+  offset_width_ = static_cast<unsigned char>(data[40]);
+  bool ordered = kClientSearchHeaderSize <= docs && docs <= fst_ && fst_ <= offsets_ && offsets_ <= postings_ &&
+                 postings_ <= data.size() && std::size_t{fst_} + root_ < offsets_;
+  if (read_u32(data, 36) != data.size() || !ordered || offset_width_ > 32) throw corrupt();
+
+  std::size_t at = docs;
+  auto table = data.substr(0, fst_);
+  pages_.resize(doc_count_);
+  for (std::uint32_t i = 0; i < doc_count_; ++i) {
+    auto& page = pages_[i];
+    auto shared = read_varint(table, at);
+    if (i == 0 ? shared != 0 : shared > pages_[i - 1].url.size()) throw corrupt();
+    if (i > 0) page.url.assign(pages_[i - 1].url, 0, shared);
+    page.url += read_string(table, at, read_varint(table, at));
+    page.title = read_string(table, at, read_varint(table, at));
+  }
+}
+
+ClientSearchIndex::State ClientSearchIndex::state(std::uint32_t at) const {
+  std::size_t p = std::size_t{fst_} + at;
+  if (p >= offsets_) throw corrupt();
+  auto head = read_varint(data_.substr(0, offsets_), p);
+  return State{(head & 1) != 0, head >> 1, p};
+}
+
+ClientSearchIndex::Arc ClientSearchIndex::arc(std::size_t& at) const {
+  auto fst = data_.substr(0, offsets_);
+  if (at >= fst.size()) throw corrupt();
+  Arc a;
+  a.label = static_cast<unsigned char>(fst[at++]);
+  a.output = read_varint(fst, at);
+  a.back = read_varint(fst, at);
+  return a;
+}
+
+bool ClientSearchIndex::walk(std::string_view prefix, std::uint32_t& at, std::uint32_t& output) const {
+  at = root_;
+  output = 0;
+  for (char ch : prefix) {
+    auto c = static_cast<unsigned char>(ch);
+    auto s = state(at);
+    std::size_t p = s.next;
+    bool found = false;
+    for (std::uint32_t i = 0; i < s.arcs; ++i) {
+      auto a = arc(p);
+      if (a.label < c) continue;
+      if (a.label == c) {
+        if (a.back == 0 || a.back > at) throw corrupt();
+        output += a.output;
+        at -= a.back;
+        found = true;
+      }
+      break;
+    }
+    if (!found) return false;
+  }
+  return true;
+}
+
+std::optional<std::uint32_t> ClientSearchIndex::find(std::string_view term) const {
+  std::uint32_t at = 0, output = 0;
+  if (!walk(term, at, output) || !state(at).final) return std::nullopt;
+  return output;
+}
+
+std::vector<std::uint32_t> ClientSearchIndex::find_prefix(std::string_view prefix, std::size_t limit) const {
+  std::vector<std::uint32_t> found;
+  std::uint32_t at = 0, output = 0;
+  if (limit == 0 || !walk(prefix, at, output)) return found;
+  // Depth-first in label order visits terms in rank order.
+  struct Frame {
+    std::size_t next;
+    std::uint32_t arcs_left;
+    std::uint32_t at;
+    std::uint32_t output;
+  };
+  std::vector<Frame> stack;
+  auto enter = [&](std::uint32_t state_at, std::uint32_t out) {
+    auto s = state(state_at);
+    if (s.final) found.push_back(out);
+    if (stack.size() > kMaxSearchTerm) throw corrupt();
+    stack.push_back({s.next, s.arcs, state_at, out});
+  };
+  enter(at, output);
+  while (!stack.empty() && found.size() < limit) {
+    auto& f = stack.back();
+    if (f.arcs_left == 0) {
+      stack.pop_back();
+      continue;
+    }
+    --f.arcs_left;
+    auto a = arc(f.next);
+    if (a.back == 0 || a.back > f.at) throw corrupt();
+    enter(f.at - a.back, f.output + a.output);
+  }
+  if (found.size() > limit) found.resize(limit);
+  return found;
+}
+
+std::vector<std::uint32_t> ClientSearchIndex::postings(std::uint32_t term) const {
+  if (term >= term_count_) return {};
+  auto offset = read_bits(data_, offsets_, std::uint64_t{term} * offset_width_, offset_width_);
+  std::size_t at = std::size_t{postings_} + offset;
+  auto n = read_varint(data_, at);
+  if (n == 0 || n > doc_count_) throw corrupt();
+  unsigned l = static_cast<unsigned>(std::bit_width(doc_count_ / n)) - 1;
+  auto high = at + (std::uint64_t{n} * l + 7) / 8;
+  auto high_bits = std::uint64_t{n} + (doc_count_ >> l);
+  if (high + (high_bits + 7) / 8 > data_.size()) throw corrupt();
+
+  std::vector<std::uint32_t> docs;
+  docs.reserve(n);
+  std::uint64_t bit = 0;
+  for (std::uint32_t i = 0; i < n; ++i) {
+    while (bit < high_bits && ((static_cast<unsigned char>(data_[high + bit / 8]) >> (bit % 8)) & 1) == 0) ++bit;
+    if (bit == high_bits) throw corrupt();
+    auto doc = static_cast<std::uint32_t>(bit - i) << l | read_bits(data_, at, std::uint64_t{i} * l, l);
+    if (doc >= doc_count_ || (!docs.empty() && doc <= docs.back())) throw corrupt();
+    docs.push_back(doc);
+    ++bit;
+  }
+  return docs;
+}
+
+std::vector<std::uint32_t> ClientSearchIndex::search(std::string_view query, std::size_t limit) const {
+  std::vector<std::string> terms;
+  std::string term;
+  while (next_search_term(query, term)) terms.push_back(term);
+  if (terms.empty()) return {};
+
+  std::vector<std::uint32_t> result;
+  bool first = true;
+  auto intersect = [&](std::vector<std::uint32_t> docs) {
+    if (first) {
+      result = std::move(docs);
+      first = false;
+      return;
+    }
+    std::vector<std::uint32_t> both;
+    std::set_intersection(result.begin(), result.end(), docs.begin(), docs.end(), std::back_inserter(both));
+    result = std::move(both);
+  };
+  for (std::size_t i = 0; i + 1 < terms.size(); ++i) {
+    auto t = find(terms[i]);
+    if (!t) return {};
+    intersect(postings(*t));
+  }
+  std::vector<std::uint32_t> any;
+  for (auto t : find_prefix(terms.back(), kMaxPrefixTerms)) {
+    auto docs = postings(t);
+    std::vector<std::uint32_t> merged;
+    std::set_union(any.begin(), any.end(), docs.begin(), docs.end(), std::back_inserter(merged));
+    any = std::move(merged);
+  }
+  intersect(std::move(any));
+  if (result.size() > limit) result.resize(limit);
+  return result;
+}
+
+}  // namespace mt
@@ -0,0 +1,102 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace mt {
+
+// The search index `mtsite build` publishes as /search.fst for pages to
+// query without a round-trip, and a reference reader for it. Where
+// ".mtsite-search" (search.h) is laid out for the server to map, this one
+// is laid out to be small: no frequencies, so no ranking, just which pages
+// contain each term.
+//
+// Byte format. Integers are little-endian; "varint" is LEB128 (7 bits per
+// byte, low group first, high bit set on all but the last byte).
+//
+//   header, 48 bytes:
+//     magic "MTFST\0\0\1", then u32 doc_count, term_count, and the u32
+//     offsets from the start of the file of: the page table, the FST, the
+//     FST's root state, the term offsets, the postings; then the u32 file
+//     size, a u8 offset width and 7 zero bytes.
+//
+//   page table, one entry per page in URL order: varint bytes shared with
+//   the previous URL, varint suffix length, suffix, varint title length,
+//   title (plain text). A page's number is its position.
+//
+//   FST: a minimal acyclic transducer over term bytes (see
+//   next_search_term()), states children-first. A state is varint
+//   (arc count << 1 | final), then per arc, by ascending label: u8 label,
+//   varint output, varint (this state's offset - target state's offset).
+//   The sum of the outputs along a term's path is the term's number, its
+//   rank in byte order; a state's arc output counts the terms that sort
+//   before that arc's within the state.
+//
+//   term offsets: term_count fields of `offset width` bits, packed from the
+//   low bit of each byte up, giving each term's offset into the postings.
+//
+//   postings, per term: varint n, then the n page numbers Elias-Fano coded
+//   with l = floor(log2(doc_count / n)) low bits, integer division: the n
+//   low parts as l-bit fields packed like the term offsets, padded to a
+//   byte, then the high parts in unary, n + (doc_count >> l) bits in which
+//   the i-th set bit, at position p, means a high part of p - i, also
+//   padded to a byte.
+inline constexpr char kClientSearchMagic[8] = {'M', 'T', 'F', 'S', 'T', '\0', '\0', '\1'};
+inline constexpr std::size_t kClientSearchHeaderSize = 48;
+
+// Reads a client search index held in memory. Throws std::runtime_error
+// from the constructor, or from a lookup that runs off the end, if the
+// bytes are not a valid index.
+class ClientSearchIndex {
+ public:
+  struct Page {
+    std::string url;
+    std::string title;
+  };
+
+  // Keeps a view of `data` and decodes the page table.
+  explicit ClientSearchIndex(std::string_view data);
+
+  const std::vector<Page>& pages() const { return pages_; }
+  std::size_t terms() const { return term_count_; }
+
+  // The number of `term`, or nullopt if it is not in the index.
+  std::optional<std::uint32_t> find(std::string_view term) const;
+  // The numbers of up to `limit` terms starting with `prefix`, ascending.
+  std::vector<std::uint32_t> find_prefix(std::string_view prefix, std::size_t limit) const;
+  // The pages containing term number `term`, ascending.
+  std::vector<std::uint32_t> postings(std::uint32_t term) const;
+
+  // Pages containing every term of `query`, the last of them as a prefix
+  // (so search works as the visitor types), in page order, at most `limit`.
+  static constexpr std::size_t kMaxPrefixTerms = 32;
+  std::vector<std::uint32_t> search(std::string_view query, std::size_t limit) const;
+
+ private:
+  struct Arc {
+    unsigned char label = 0;
+    std::uint32_t output = 0;
+    std::uint32_t back = 0;  // the state's offset minus its target's
+  };
+  struct State {
+    bool final = false;
+    std::uint32_t arcs = 0;
+    std::size_t next = 0;  // where the first arc is
+  };
+  State state(std::uint32_t at) const;
+  Arc arc(std::size_t& at) const;
+  // Walks `prefix` from the root; false if it leaves the FST.
+  bool walk(std::string_view prefix, std::uint32_t& at, std::uint32_t& output) const;
+
+  std::string_view data_;
+  std::uint32_t doc_count_ = 0, term_count_ = 0;
+  std::uint32_t fst_ = 0, root_ = 0, offsets_ = 0, postings_ = 0;
+  unsigned offset_width_ = 0;
+  std::vector<Page> pages_;
+};
+
+}  // namespace mt
@@ -0,0 +1,29 @@
+#include "embedded_site.h"
+
+#include "site.h"
+
+namespace mt {
+
+Site Site::embedded() {
+  Site site;
+  for (const auto& f : embedded::files()) {
+    Resource r;
+    r.path = f.path;
+    r.content_type = f.content_type;
+    for (std::size_t e = 0; e < kEncodingCount; ++e) {
+      r.reps[e] = Representation{-1, reinterpret_cast<const char*>(f.reps[e].data), f.reps[e].size, {}, {}, {}};
+    }
+    r.headers = f.headers;
+    r.etags[0] = f.etag;
+    read_dictionary_id(r);
+    derive_etags(r);
+    encode_stream_heads(r);
+    site.resources_.push_back(std::move(r));
+  }
+  site.lookup_ = &embedded::find;
+  auto index = embedded::search_index();
+  site.search_ = SearchIndex::view({reinterpret_cast<const char*>(index.data), index.size});
+  return site;
+}
+
+}  // namespace mt
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <span>
+#include <string_view>
+
+#include "encoding.h"
+
+// Interface to the site compiled into the binary by mtembed. The definitions
+// live in the generated embedded_site_data.cpp, so this header is only usable
+// in MT_EMBED_SITE builds.
+namespace mt::embedded {
+
+struct Blob {
+  const unsigned char* data;
+  std::size_t size;
+};
+
+struct File {
+  std::string_view path;
+  std::string_view content_type;
+  std::array<Blob, kEncodingCount> reps;  // indexed by Encoding, like Resource::reps
+  std::string_view headers;               // like Resource::headers
+  std::string_view etag;                  // Resource::etags[0]
+};
+
+// Every embedded file, sorted by path.
+std::span<const File> files();
+
+// Index into files() for a URL path ("/" and "/dir/" included), or -1.
+// Resolved through a perfect-hash table built at compile time.
+int find(std::string_view path);
+
+// The site's search index (see SearchIndex), 8-byte aligned, or an empty
+// blob if the site directory had none.
+Blob search_index();
+
+}  // namespace mt::embedded
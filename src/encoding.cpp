@@ -0,0 +1,121 @@
+#include "encoding.h"
+
+#include "http.h"
+
+namespace mt {
+
+namespace {
+
+std::string_view trim(std::string_view s) {
+  while (!s.empty() && (s.front() == ' ' || s.front() == '\t')) s.remove_prefix(1);
+  while (!s.empty() && (s.back() == ' ' || s.back() == '\t')) s.remove_suffix(1);
+  return s;
+}
+
+// True for "q=0", "q=0.", "q=0.000" and the like.
+bool zero_qvalue(std::string_view params) {
+  while (!params.empty()) {
+    auto semi = params.find(';');
+    auto p = trim(params.substr(0, semi));
+    if (p.size() >= 2 && (p[0] == 'q' || p[0] == 'Q') && p[1] == '=') {
+      p.remove_prefix(2);
+      if (p.empty() || p[0] != '0') return false;
+      for (char c : p.substr(1)) {
+        if (c != '.' && c != '0') return false;
+      }
+      return true;
+    }
+    if (semi == std::string_view::npos) break;
+    params.remove_prefix(semi + 1);
+  }
+  return false;
+}
+
+}  // namespace
+
+std::string_view encoding_token(Encoding e) {
+  switch (e) {
+    case Encoding::gzip:
+      return "gzip";
+    case Encoding::br:
+      return "br";
+    case Encoding::zstd:
+      return "zstd";
+    case Encoding::dcb:
+      return "dcb";
+    case Encoding::dcz:
+      return "dcz";
+    case Encoding::identity:
+      break;
+  }
+  return {};
+}
+
+std::string_view encoding_suffix(Encoding e) {
+  switch (e) {
+    case Encoding::gzip:
+      return ".gz";
+    case Encoding::br:
+      return ".br";
+    case Encoding::zstd:
+      return ".zst";
+    case Encoding::dcb:
+      return ".dcb";
+    case Encoding::dcz:
+      return ".dcz";
+    case Encoding::identity:
+      break;
+  }
+  return {};
+}
+
+std::string_view dictionary_magic(Encoding e) {
+  using namespace std::string_view_literals;
+  switch (e) {
+    case Encoding::dcb:
+      return "\xff\x44\x43\x42"sv;
+    case Encoding::dcz:
+      return "\x5e\x2a\x4d\x18\x20\x00\x00\x00"sv;  // zstd skippable frame, 32-byte payload
+    default:
+      break;
+  }
+  return {};
+}
+
+unsigned parse_accept_encoding(std::string_view value) {
+  unsigned accepted = 0;
+  unsigned refused = 0;  // explicit q=0 overrides a "*" anywhere in the list
+  while (!value.empty()) {
+    auto comma = value.find(',');
+    auto item = value.substr(0, comma);
+    auto semi = item.find(';');
+    auto token = trim(item.substr(0, semi));
+    bool zero = semi != std::string_view::npos && zero_qvalue(item.substr(semi + 1));
+
+    unsigned bits = 0;
+    if (token == "*") {
+      bits = encoding_bit(Encoding::gzip) | encoding_bit(Encoding::br) | encoding_bit(Encoding::zstd) |
+             kDictionaryEncodings;
+    } else if (http::iequals(token, "gzip") || http::iequals(token, "x-gzip")) {
+      bits = encoding_bit(Encoding::gzip);
+    } else if (http::iequals(token, "br")) {
+      bits = encoding_bit(Encoding::br);
+    } else if (http::iequals(token, "zstd")) {
+      bits = encoding_bit(Encoding::zstd);
+    } else if (http::iequals(token, "dcb")) {
+      bits = encoding_bit(Encoding::dcb);
+    } else if (http::iequals(token, "dcz")) {
+      bits = encoding_bit(Encoding::dcz);
+    }
+    if (zero) {
+      if (token != "*") refused |= bits;
+    } else {
+      accepted |= bits;
+    }
+    if (comma == std::string_view::npos) break;
+    value.remove_prefix(comma + 1);
+  }
+  return (accepted & ~refused) | encoding_bit(Encoding::identity);
+}
+
+}  // namespace mt
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+namespace mt {
+
+// Content codings the site is precompressed into. The build writes each
+// variant next to its source as "<file><suffix>". dcb and dcz are brotli and
+// zstd against a shared dictionary (RFC 9842) and are only usable by clients
+// that advertise that dictionary in Available-Dictionary.
+enum class Encoding : std::uint8_t { identity, gzip, br, zstd, dcb, dcz };
+
+inline constexpr std::size_t kEncodingCount = 6;
+
+constexpr unsigned encoding_bit(Encoding e) { return 1u << static_cast<unsigned>(e); }
+
+constexpr unsigned kDictionaryEncodings = encoding_bit(Encoding::dcb) | encoding_bit(Encoding::dcz);
+
+// Content-Encoding token ("gzip", "br", ...); empty for identity.
+std::string_view encoding_token(Encoding e);
+
+// File-name suffix of a variant (".gz", ".br", ...); empty for identity.
+std::string_view encoding_suffix(Encoding e);
+
+// dcb and dcz bodies open with this magic followed by the 32-byte SHA-256
+// of the dictionary they were compressed against.
+std::string_view dictionary_magic(Encoding e);
+
+// Bitmask of encoding_bit() for every coding the Accept-Encoding value
+// allows with a non-zero qvalue. Identity is always included.
+unsigned parse_accept_encoding(std::string_view value);
+
+}  // namespace mt
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace mt::gen {
+
+// Bump allocator for short-lived, trivially destructible nodes. reset()
+// rewinds to the first block without freeing anything, so a long-lived
+// arena stops allocating once it has seen its largest input.
+class Arena {
+ public:
+  explicit Arena(std::size_t block_size = 16 * 1024) : block_size_(block_size) {}
+
+  template <class T, class... Args>
+  T* make(Args&&... args) {
+    static_assert(std::is_trivially_destructible_v<T>, "arena nodes are never destroyed");
+    return new (allocate(sizeof(T), alignof(T))) T{std::forward<Args>(args)...};
+  }
+
+  void reset() {
+    block_ = 0;
+    used_ = 0;
+  }
+
+ private:
+  void* allocate(std::size_t size, std::size_t align) {
+    for (;;) {
+      if (block_ < blocks_.size()) {
+        auto offset = (used_ + align - 1) & ~(align - 1);
+        if (offset + size <= block_size_) {
+          used_ = offset + size;
+          return blocks_[block_].get() + offset;
+        }
+        if (used_ == 0) break;  // larger than a whole block
+        ++block_;
+        used_ = 0;
+        continue;
+      }
+      blocks_.push_back(std::make_unique<std::byte[]>(block_size_));
+    }
+    throw std::bad_alloc();
+  }
+
+  std::size_t block_size_;
+  std::vector<std::unique_ptr<std::byte[]>> blocks_;
+  std::size_t block_ = 0;  // block currently being filled
+  std::size_t used_ = 0;   // bytes used in that block
+};
+
+}  // namespace mt::gen
@@ -0,0 +1,1144 @@
+#include "gen/build.h"
+
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <ctime>
+#include <iterator>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <set>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "encoding.h"
+#include "gen/cache.h"
+#include "gen/client_index.h"
+#include "gen/compress.h"
+#include "gen/critical.h"
+#include "gen/css_usage.h"
+#include "gen/dictionary.h"
+#include "gen/files.h"
+#include "gen/fingerprint.h"
+#include "gen/html.h"
+#include "gen/image.h"
+#include "gen/manifest.h"
+#include "gen/markdown.h"
+#include "gen/responsive.h"
+#include "gen/scheduler.h"
+#include "gen/search_index.h"
+#include "gen/template.h"
+#include "hash.h"
+#include "mime.h"
+#include "responses.h"
+#include "search.h"
+#include "sha256.h"
+#include "site.h"
+
+namespace mt::gen {
+
+namespace fs = std::filesystem;
+
+namespace {
+
+// Default BuildOptions::cache, inside the output directory. The leading dot
+// keeps it out of what mtserve serves.
+constexpr std::string_view kCacheDirName = ".mtsite-cache";
+
+constexpr std::array kDictionaryCodecs = {Encoding::dcb, Encoding::dcz};
+
+// The shared dictionary trained from every HTML page. Pages link to it so
+// browsers fetch it once; its Use-As-Dictionary header then makes them offer
+// it on every later navigation.
+constexpr std::string_view kDictionaryRel = "html.dict";
+constexpr std::string_view kDictionaryLink = R"(<link rel="compression-dictionary" href="/html.dict">)";
+constexpr std::size_t kDictionaryMaxSize = 32 * 1024;
+
+// The client search index (see client_search.h), next to the home page.
+constexpr std::string_view kClientSearchRel = "search.fst";
+
+// The dictionary is retrained once more than 1/kRetrainFraction of the pages
+// it was trained on changed, were added or were removed. Retraining changes
+// every page's dcb/dcz variants, so one edited page should not trigger it.
+constexpr std::size_t kRetrainFraction = 8;
+
+// Fingerprinted URLs change whenever their bytes do, so clients may keep
+// them for a year without ever revalidating.
+constexpr std::string_view kImmutableCacheControl = "Cache-Control: public, max-age=31536000, immutable";
+
+// Widths of the resized variants of each JPEG and PNG image, covering
+// phone to desktop layouts at 1x and 2x. Widths at or above an image's own
+// are skipped.
+constexpr std::array<std::uint32_t, 5> kImageWidths = {320, 640, 960, 1280, 1920};
+
+// Part of the cache keys of image sizes and variants; changed when decoding
+// or encoding does, so caches from older builds are not trusted.
+constexpr std::string_view kImageCodecRevision = "oriented, with ICC profile";
+
+// The layout when the source tree has no kLayoutDir/page.html.
+constexpr std::string_view kDefaultLayout =
+    "<!DOCTYPE html>\n<html><head><meta charset=\"utf-8\"><title>{{title}}</title></head><body>\n"
+    "{{content}}</body></html>\n";
+// title: the first heading, or the file name; content: the compiled
+// Markdown; path: the page's URL path. All are HTML.
+constexpr std::array<std::string_view, 3> kLayoutFields = {"title", "content", "path"};
+
+struct Layout {
+  Template page;
+  std::uint64_t hash = 0;  // of every file compiled into `page`; part of each page's key
+};
+
+constexpr unsigned kAllEncodings = (1u << kEncodingCount) - 1;
+constexpr unsigned kDictionaryVariants = (1u << static_cast<unsigned>(Encoding::dcb)) |
+                                         (1u << static_cast<unsigned>(Encoding::dcz));
+
+// One published file. Its bytes are only read or produced when something
+// downstream needs them; an unchanged file is known by its keys alone.
+struct Source {
+  std::string path;  // source path relative to opts.src; empty if generated
+  std::string rel;   // published path relative to the site root
+  struct stat st {};
+  std::string input;  // source bytes, once read
+  std::string body;   // pages: the checked page before URL rewriting, once loaded
+  std::string data;   // bytes to publish, once produced
+  bool read = false, loaded = false, produced = false;
+  std::uint64_t source_hash = 0;  // xxh3_64 of the source file
+  std::uint64_t page_key = 0;     // pages: key of `body`
+  std::uint64_t key = 0;          // every input of the published bytes
+  std::uint64_t hash = 0;         // xxh3_64 of the published bytes
+  std::string_view content_type;
+  bool html = false;
+  bool markdown = false;
+  const Layout* layout = nullptr;                   // Markdown pages: what they render into
+  bool fingerprinted = false;                       // rel carries a content hash
+  std::uint64_t object = 0;                         // image variants: the cache object holding `data`
+  std::uint32_t variant_width = 0;                  // image variants: the width `path` is resized to
+  ImageFormat variant_format = ImageFormat::jpeg;   // image variants: what it is encoded as
+  std::vector<std::string> refs;                    // site paths a page or stylesheet references
+  Renames renames;                                  // stylesheets: the renames applied to them
+  unsigned writes = 0;                              // mask of encodings to write
+  std::array<std::size_t, kEncodingCount> sizes{};  // 0 = variant omitted
+  std::size_t critical_css = 0;                     // pages: bytes of CSS inlined, when produced
+  std::size_t first_flight = 0;                     // pages: see CriticalCss, when produced
+  std::size_t css_rules = 0, css_dropped = 0;       // stylesheets: see PrunedCss, when produced
+};
+
+void remove_outputs(const fs::path& out, const std::string& rel) {
+  std::error_code ec;
+  fs::remove(out / rel, ec);
+  for (std::size_t e = 1; e < kEncodingCount; ++e) {
+    fs::remove(out / (rel + std::string(encoding_suffix(static_cast<Encoding>(e)))), ec);
+  }
+}
+
+bool dictionary_codecs_available() {
+  for (auto e : kDictionaryCodecs) {
+    if (codec_available(e)) return true;
+  }
+  return false;
+}
+
+// JPEG, PNG, GIF, WebP and AVIF are compressed already: gzip or brotli
+// rarely saves a byte on them, and brotli at level 11 would spend most of
+// the write stage on images.
+bool compressible(std::string_view content_type) {
+  return !content_type.starts_with("image/") || content_type == "image/svg+xml" || content_type == "image/x-icon";
+}
+
+int image_quality(ImageFormat f) {
+  switch (f) {
+    case ImageFormat::jpeg: return 82;
+    case ImageFormat::webp: return 80;
+    case ImageFormat::avif: return 60;
+    case ImageFormat::png: break;
+  }
+  return 100;  // lossless
+}
+
+void insert_dictionary_link(std::string& html) {
+  auto head_end = html.find("</head>");
+  if (head_end != std::string::npos) html.insert(head_end, kDictionaryLink);
+}
+
+// IMF-fixdate, the format of Last-Modified.
+std::string http_date(std::int64_t unix_seconds) {
+  auto t = static_cast<std::time_t>(unix_seconds);
+  std::tm tm{};
+  ::gmtime_r(&t, &tm);
+  char buf[40];
+  return std::string(buf, std::strftime(buf, sizeof buf, "%a, %d %b %Y %H:%M:%S GMT", &tm));
+}
+
+void read_input(Source& src, const BuildOptions& opts) {
+  if (src.read) return;
+  src.input = read_file(opts.src / src.path);
+  src.read = true;
+}
+
+// Text made safe for both element content and quoted attribute values.
+std::string escape_html(std::string_view text) {
+  std::string out;
+  for (char c : text) {
+    if (c == '&') {
+      out += "&amp;";
+    } else if (c == '<') {
+      out += "&lt;";
+    } else if (c == '>') {
+      out += "&gt;";
+    } else if (c == '"') {
+      out += "&quot;";
+    } else {
+      out += c;
+    }
+  }
+  return out;
+}
+
+Layout load_layout(const BuildOptions& opts) {
+  Layout layout;
+  auto dir = opts.src / kLayoutDir;
+  if (!fs::exists(dir / "page.html")) {
+    auto none = [](std::string_view name) -> Template::Partial {
+      throw std::runtime_error(std::string("no partial ").append(name));
+    };
+    layout.page = Template::compile("default layout", kDefaultLayout, kLayoutFields, none);
+    return layout;
+  }
+  CacheKey key("layout");
+  auto load = [&](std::string_view name) {
+    Template::Partial p{std::string(kLayoutDir).append("/").append(name).append(".html"), {}};
+    p.text = read_file(opts.src / p.file);
+    key.add(name).add(p.text);
+    return p;
+  };
+  auto page = load("page");
+  layout.page = Template::compile(page.file, page.text, kLayoutFields, load);
+  layout.hash = key.hash();
+  return layout;
+}
+
+// A compiled Markdown document in its layout. The title is its first
+// heading, or the file name if it has none.
+std::string markdown_page(std::string_view markdown, const std::string& rel, const Layout& layout) {
+  thread_local MarkdownCompiler compiler;
+  std::string body;
+  compiler.compile(markdown, body);
+  auto title = compiler.title().empty() ? escape_html(fs::path(rel).stem().string()) : std::string(compiler.title());
+  auto path = escape_html(std::string("/").append(rel));
+  std::array<std::string_view, kLayoutFields.size()> values{title, body, path};
+  std::string page;
+  layout.page.render(values, page);
+  return page;
+}
+
+// Compiles a page's Markdown, if it is Markdown, then checks it and, if
+// asked, minifies it into `body`.
+std::vector<HtmlError> compile_page(Source& src, const BuildOptions& opts) {
+  thread_local HtmlChecker checker;
+  read_input(src, opts);
+  std::string page = src.markdown ? markdown_page(src.input, src.rel, *src.layout) : std::string();
+  std::string_view html = src.markdown ? std::string_view(page) : std::string_view(src.input);
+  std::string minified;
+  auto errors = checker.run(html, opts.minify ? &minified : nullptr);
+  src.body = opts.minify ? std::move(minified) : std::string(html);
+  src.loaded = true;
+  return errors;
+}
+
+std::string error_report(const std::vector<Source*>& pages, const std::vector<std::vector<HtmlError>>& errors) {
+  std::string report;
+  for (std::size_t i = 0; i < pages.size(); ++i) {
+    for (const auto& e : errors[i]) {
+      report += "\n  " + pages[i]->rel + ":" + std::to_string(e.line) + ":" + std::to_string(e.column) + ": " +
+                e.message;
+    }
+  }
+  return report;
+}
+
+// Publishes every Markdown source as an .html page of the same name.
+void rename_markdown(std::vector<Source>& sources) {
+  std::set<std::string> published;
+  for (const auto& src : sources) published.insert(src.rel);
+  for (auto& src : sources) {
+    if (!src.markdown) continue;
+    auto html = src.rel.substr(0, src.rel.size() - 3) + ".html";
+    if (published.contains(html)) throw std::runtime_error(src.rel + " and " + html + " both publish /" + html);
+    src.rel = std::move(html);
+    src.content_type = content_type_for(src.rel);
+  }
+}
+
+// Compiles and checks every page the cache has not seen, storing the
+// results in it. Throws one error listing every problem in every page.
+void check_pages(std::vector<Source>& sources, BuildCache& cache, Scheduler& scheduler,
+                 const BuildOptions& opts) {
+  std::vector<Source*> pages;
+  for (auto& src : sources) {
+    if (!src.html) continue;
+    src.page_key = CacheKey("page")
+                       .add(src.source_hash)
+                       .add(src.path)
+                       .add(src.rel)
+                       .add(std::uint64_t{opts.minify})
+                       .add(src.layout != nullptr ? src.layout->hash : 0)
+                       .hash();
+    if (const auto* refs = cache.references(src.page_key)) {
+      src.refs = *refs;
+    } else {
+      pages.push_back(&src);
+    }
+  }
+  std::vector<std::vector<HtmlError>> errors(pages.size());
+  scheduler.parallel_for(pages.size(), [&](std::size_t i) {
+    auto& src = *pages[i];
+    errors[i] = compile_page(src, opts);
+    if (!errors[i].empty()) return;
+    src.refs = html_references(src.body, src.rel);
+    cache.put_object(src.page_key, src.body);
+  });
+  if (auto report = error_report(pages, errors); !report.empty()) throw std::runtime_error("invalid HTML" + report);
+  for (auto* src : pages) cache.set_references(src->page_key, src->refs);
+}
+
+void load_body(Source& src, const BuildCache& cache, const BuildOptions& opts) {
+  if (src.loaded || cache.object(src.page_key, src.body)) {
+    src.loaded = true;
+    return;
+  }
+  // The object went missing; it was valid when it was stored.
+  auto errors = compile_page(src, opts);
+  if (!errors.empty()) throw std::runtime_error("invalid HTML" + error_report({&src}, {errors}));
+}
+
+// The stylesheets pages may inline rules from (see gen/critical.h), by
+// published path. Each is read and parsed the first time a page links it,
+// from any thread; the Sources are only read from.
+class CriticalStylesheets {
+ public:
+  CriticalStylesheets(const std::vector<Source>& sources, const BuildOptions& opts) : opts_(opts) {
+    if (!opts.critical_css) return;
+    for (const auto& src : sources) {
+      if (src.content_type.starts_with("text/css")) sheets_.try_emplace(src.rel, &src);
+    }
+  }
+
+  const CriticalStylesheet* find(std::string_view rel) const {
+    auto it = sheets_.find(rel);
+    if (it == sheets_.end()) return nullptr;
+    auto& sheet = it->second;
+    std::call_once(sheet.once, [&] {
+      sheet.parsed = std::make_unique<CriticalStylesheet>(css(*sheet.src), [&](std::string_view url) {
+        auto imported = url.starts_with('/') ? sheets_.find(url.substr(1)) : sheets_.end();
+        return imported == sheets_.end() ? std::nullopt : std::optional(css(*imported->second.src));
+      });
+    });
+    return sheet.parsed.get();
+  }
+
+ private:
+  std::string css(const Source& src) const {
+    return rebase_css(read_file(opts_.src / src.path), src.path, src.renames);
+  }
+
+  struct Sheet {
+    explicit Sheet(const Source* s) : src(s) {}
+    const Source* src;
+    mutable std::once_flag once;
+    mutable std::unique_ptr<CriticalStylesheet> parsed;
+  };
+  const BuildOptions& opts_;
+  std::map<std::string, Sheet, std::less<>> sheets_;
+};
+
+// Which tags, classes and ids appear on which pages (see gen/css_usage.h),
+// for pruning the stylesheets pages link to. The index is built the first
+// time a stylesheet is produced, from names cached per page, so only pages
+// without them are loaded; that is not thread-safe, so build() must be
+// called before producing stylesheets in parallel.
+class SiteCssUsage {
+ public:
+  SiteCssUsage(std::vector<Source>& sources, const BuildCache& cache, Scheduler& scheduler, const BuildOptions& opts)
+      : sources_(sources), cache_(cache), scheduler_(scheduler), opts_(opts) {
+    if (!opts.prune_css) return;
+    CacheKey key("css usage");
+    for (const auto& src : sources) {
+      if (src.html) key.add(src.rel).add(src.page_key);
+      if (src.content_type.starts_with("text/javascript")) key.add(src.path).add(src.source_hash);
+    }
+    key_ = key.hash();
+  }
+
+  // Every input of the index; part of the key of each stylesheet it prunes.
+  std::uint64_t key() const { return key_; }
+
+  // Whether `css` is pruned: some page links it, or imports it through
+  // other stylesheets. Needs the stylesheets' refs.
+  bool prunes(const Source& css) const {
+    if (!opts_.prune_css) return false;
+    std::call_once(linked_once_, [&] {
+      std::map<std::string_view, const Source*> stylesheets;
+      for (const auto& src : sources_) {
+        if (src.content_type.starts_with("text/css")) stylesheets.emplace(src.path, &src);
+      }
+      std::vector<std::string_view> pending;
+      for (const auto& src : sources_) {
+        if (src.html) pending.insert(pending.end(), src.refs.begin(), src.refs.end());
+      }
+      while (!pending.empty()) {
+        auto path = pending.back();
+        pending.pop_back();
+        auto found = stylesheets.find(path);
+        if (found == stylesheets.end() || !linked_.emplace(path).second) continue;
+        pending.insert(pending.end(), found->second->refs.begin(), found->second->refs.end());
+      }
+    });
+    return linked_.contains(css.path);
+  }
+
+  const CssUsage& build() {
+    if (built_) return usage_;
+    std::vector<Source*> pages;
+    for (auto& src : sources_) {
+      if (src.html) pages.push_back(&src);
+    }
+    std::vector<std::vector<std::string>> names(pages.size());
+    scheduler_.parallel_for(pages.size(), [&](std::size_t i) {
+      auto& page = *pages[i];
+      auto key = CacheKey("css names").add(page.page_key).hash();
+      std::string cached;
+      if (cache_.object(key, cached)) {
+        for (std::size_t at = 0; at < cached.size();) {
+          auto end = std::min(cached.find('\n', at), cached.size());
+          names[i].push_back(cached.substr(at, end - at));
+          at = end + 1;
+        }
+        return;
+      }
+      load_body(page, cache_, opts_);
+      names[i] = page_names(page.body);
+      for (const auto& name : names[i]) cached.append(name).append("\n");
+      cache_.put_object(key, cached);
+    });
+    for (const auto& page : names) usage_.add_page(page);
+    // Markup the build adds itself: <picture> and <source> around resized
+    // images (see gen/responsive.h).
+    usage_.add_everywhere("picture");
+    usage_.add_everywhere("source");
+    for (auto& src : sources_) {
+      if (!src.content_type.starts_with("text/javascript")) continue;
+      std::vector<std::string> script;
+      script_names(read_file(opts_.src / src.path), script);
+      for (const auto& name : script) usage_.add_everywhere(name);
+    }
+    built_ = true;
+    return usage_;
+  }
+
+ private:
+  std::vector<Source>& sources_;
+  const BuildCache& cache_;
+  Scheduler& scheduler_;
+  const BuildOptions& opts_;
+  std::uint64_t key_ = 0;
+  mutable std::once_flag linked_once_;
+  mutable std::set<std::string, std::less<>> linked_;  // source paths of stylesheets pages use
+  CssUsage usage_;
+  bool built_ = false;
+};
+
+// Fills in `data`, the bytes to publish.
+void produce(Source& src, const BuildCache& cache, const BuildOptions& opts, const Renames& renames,
+             const ResponsiveImages& images, const CriticalStylesheets* stylesheets, SiteCssUsage* usage,
+             bool link) {
+  if (src.produced) return;
+  if (src.html) {
+    load_body(src, cache, opts);
+    src.data = rewrite_html(rewrite_images(src.body, src.rel, images), src.rel, renames);
+    if (stylesheets != nullptr && opts.critical_css) {
+      auto critical = inline_critical_css(
+          src.data, src.rel, [&](std::string_view rel) { return stylesheets->find(rel); }, opts.fold,
+          opts.first_flight);
+      if (!critical.html.empty()) src.data = std::move(critical.html);
+      src.critical_css = critical.css;
+      src.first_flight = critical.first_flight;
+    }
+    if (link) insert_dictionary_link(src.data);
+  } else if (src.object != 0) {
+    if (!cache.object(src.object, src.data)) {  // went missing; the encoders are deterministic
+      read_input(src, opts);
+      auto image = resize_image(decode_image(src.input), src.variant_width);
+      src.data = encode_image(image, src.variant_format, image_quality(src.variant_format));
+    }
+  } else {
+    read_input(src, opts);
+    src.data = src.renames.empty() ? src.input : rewrite_css(src.input, src.path, src.renames);
+    if (usage != nullptr && usage->prunes(src)) {
+      auto pruned = prune_css(src.data, usage->build());
+      if (pruned.css) src.data = std::move(*pruned.css);
+      src.css_rules = pruned.rules;
+      src.css_dropped = pruned.dropped;
+    }
+  }
+  src.produced = true;
+}
+
+// Appends each reference and what it was renamed to; part of the key of any
+// output those renames were applied to.
+void add_renames(CacheKey& key, const std::vector<std::string>& refs, const Renames& renames) {
+  for (const auto& ref : refs) {
+    auto found = renames.find(ref);
+    key.add(ref).add(found == renames.end() ? std::string_view() : std::string_view(found->second));
+  }
+}
+
+// Renames every asset fingerprinted_type() selects to fingerprint_name() and
+// records the new names. Stylesheets are rewritten before they are hashed,
+// and each one after the stylesheets it imports, so a changed image also
+// renames the CSS that points at it. HTML pages keep their names and are
+// rewritten when produced.
+Renames fingerprint_assets(std::vector<Source>& sources, BuildCache& cache, const BuildOptions& opts,
+                           SiteCssUsage& usage) {
+  Renames renames;
+  std::vector<Source*> stylesheets;
+  for (auto& src : sources) {
+    if (!fingerprinted_type(src.content_type)) continue;
+    if (src.content_type.starts_with("text/css")) {
+      stylesheets.push_back(&src);
+      continue;
+    }
+    auto name = fingerprint_name(src.rel, src.source_hash);
+    renames.emplace(src.rel, name);
+    src.rel = std::move(name);
+    src.fingerprinted = true;
+  }
+
+  auto rename = [&](Source& css) {
+    CacheKey key("stylesheet");
+    key.add(css.source_hash).add(css.path);
+    add_renames(key, css.refs, css.renames);
+    key.add(usage.prunes(css) ? usage.key() : 0);
+    css.key = key.hash();
+    if (auto hash = cache.output_hash(css.key)) {
+      css.hash = *hash;
+    } else {
+      produce(css, cache, opts, renames, ResponsiveImages{}, nullptr, &usage, false);
+      css.hash = xxh3_64(css.data);
+      cache.set_output_hash(css.key, css.hash);
+    }
+    auto name = fingerprint_name(css.rel, css.hash);
+    renames.emplace(css.rel, name);
+    css.rel = std::move(name);
+    css.fingerprinted = true;
+  };
+
+  std::map<std::string, Source*, std::less<>> pending;
+  for (auto* css : stylesheets) {
+    auto refs_key = CacheKey("stylesheet refs").add(css->source_hash).add(css->path).hash();
+    if (const auto* refs = cache.references(refs_key)) {
+      css->refs = *refs;
+    } else {
+      read_input(*css, opts);
+      css->refs = css_references(css->input, css->path);
+      cache.set_references(refs_key, css->refs);
+    }
+    pending.emplace(css->rel, css);
+  }
+  while (!pending.empty()) {
+    bool progress = false;
+    for (auto it = pending.begin(); it != pending.end();) {
+      bool ready = true;
+      for (const auto& ref : it->second->refs) ready = ready && (ref == it->first || !pending.contains(ref));
+      if (!ready) {
+        ++it;
+        continue;
+      }
+      auto& css = *it->second;
+      for (const auto& ref : css.refs) {
+        if (auto found = renames.find(ref); found != renames.end()) css.renames.insert(*found);
+      }
+      rename(css);
+      it = pending.erase(it);
+      progress = true;
+    }
+    if (!progress) {  // an @import cycle: break it at the first stylesheet, unrewritten
+      rename(*pending.begin()->second);
+      pending.erase(pending.begin());
+    }
+  }
+  return renames;
+}
+
+// "img/photo.jpg", 640, webp -> "img/photo-640w.webp", before fingerprinting.
+std::string variant_name(std::string_view rel, std::uint32_t width, ImageFormat f) {
+  auto slash = rel.rfind('/');
+  auto dot = rel.rfind('.');
+  if (dot == std::string_view::npos || (slash != std::string_view::npos && dot < slash)) dot = rel.size();
+  return std::string(rel.substr(0, dot)).append("-").append(std::to_string(width)).append("w.").append(
+      image_extension(f));
+}
+
+// Resizes every JPEG and PNG image to each of kImageWidths narrower than
+// itself and encodes each size in its own format, and each size plus the
+// original's in AVIF and WebP when this build can write them. Jobs run in
+// parallel, one per image, each spawning one task per width and, under
+// it, one per format. Results are cached under the source's content hash,
+// so only new or changed images are decoded. A variant no smaller than
+// its original is left out. Returns the variants to publish and fills in
+// `images` for rewrite_images(). An image that does not decode is
+// published as is, with a note in the log.
+std::vector<Source> responsive_images(std::vector<Source>& sources, BuildCache& cache, Scheduler& scheduler,
+                                      const BuildOptions& opts, ResponsiveImages& images, std::FILE* log) {
+  struct Variant {
+    std::uint32_t width = 0;
+    ImageFormat format = ImageFormat::jpeg;
+    std::uint64_t key = 0;
+    std::uint64_t hash = 0;  // of the encoded bytes; 0 if left out
+    bool encode = false;
+  };
+  struct Job {
+    Source* src = nullptr;
+    ImageFormat format = ImageFormat::jpeg;
+    std::uint64_t size_key = 0;
+    std::optional<std::uint64_t> size;  // width << 32 | height, 0 if it does not decode
+    std::vector<Variant> variants;
+    std::string error;
+  };
+  auto plan = [](Job& job) {
+    auto width = static_cast<std::uint32_t>(*job.size >> 32);
+    if (width == 0) return;
+    std::vector<std::uint32_t> widths;
+    for (auto w : kImageWidths) {
+      if (w < width) widths.push_back(w);
+    }
+    for (auto f : {ImageFormat::avif, ImageFormat::webp, job.format}) {
+      if (!image_encoder_available(f)) continue;
+      bool original = f == job.format;
+      for (auto w : widths) job.variants.push_back({w, f});
+      if (!original) job.variants.push_back({width, f});
+    }
+    for (auto& v : job.variants) {
+      v.key = CacheKey("image variant")
+                  .add(kImageCodecRevision)
+                  .add(job.src->source_hash)
+                  .add(std::uint64_t{v.width})
+                  .add(image_extension(v.format))
+                  .add(std::uint64_t(image_quality(v.format)))
+                  .hash();
+    }
+  };
+
+  std::vector<Job> jobs;
+  std::vector<Job*> pending;
+  for (auto& src : sources) {
+    std::optional<ImageFormat> format;
+    if (src.content_type == "image/jpeg") format = ImageFormat::jpeg;
+    if (src.content_type == "image/png") format = ImageFormat::png;
+    if (!format || !image_decoder_available(*format)) continue;
+    auto& job = jobs.emplace_back();
+    job.src = &src;
+    job.format = *format;
+    job.size_key = CacheKey("image size").add(kImageCodecRevision).add(src.source_hash).hash();
+    job.size = cache.output_hash(job.size_key);
+  }
+  for (auto& job : jobs) {
+    bool encode = !job.size;
+    if (job.size) {
+      plan(job);
+      for (auto& v : job.variants) {
+        auto hash = cache.output_hash(v.key);
+        v.hash = hash.value_or(0);
+        v.encode = !hash;
+        encode = encode || v.encode;
+      }
+    }
+    if (encode) pending.push_back(&job);
+  }
+
+  scheduler.parallel_for(pending.size(), [&](std::size_t i) {
+    auto& job = *pending[i];
+    read_input(*job.src, opts);
+    Image image;
+    try {
+      image = decode_image(job.src->input);
+    } catch (const std::runtime_error& e) {
+      job.error = e.what();
+      job.size = 0;
+      return;
+    }
+    if (!job.size) {
+      job.size = std::uint64_t{image.width} << 32 | image.height;
+      plan(job);
+      for (auto& v : job.variants) v.encode = true;
+    }
+    TaskGroup widths(scheduler);
+    for (std::size_t first = 0; first < job.variants.size(); ++first) {
+      auto width = job.variants[first].width;
+      bool seen = false;
+      for (std::size_t k = 0; k < first; ++k) seen = seen || job.variants[k].width == width;
+      if (seen) continue;
+      widths.spawn([&, width] {
+        auto resized = resize_image(image, width);
+        TaskGroup formats(scheduler);
+        for (auto& v : job.variants) {
+          if (v.width != width || !v.encode) continue;
+          formats.spawn([&, variant = &v] {
+            auto bytes = encode_image(resized, variant->format, image_quality(variant->format));
+            if (bytes.size() >= job.src->input.size()) return;  // no saving; left out
+            variant->hash = xxh3_64(bytes);
+            cache.put_object(variant->key, bytes);
+          });
+        }
+        formats.wait();
+      });
+    }
+    widths.wait();
+  });
+
+  std::size_t encoded = 0, left_out = 0;
+  std::vector<Source> published;
+  for (auto& job : jobs) {
+    if (!job.error.empty() && log != nullptr) {
+      std::fprintf(log, "  /%s: %s; published without resized variants\n", job.src->path.c_str(), job.error.c_str());
+    }
+    cache.set_output_hash(job.size_key, *job.size);
+    if (*job.size == 0) continue;
+    auto& image = images[job.src->path];
+    image.width = static_cast<std::uint32_t>(*job.size >> 32);
+    image.height = static_cast<std::uint32_t>(*job.size);
+    CacheKey key("responsive image");
+    key.add(*job.size);
+    for (const auto& v : job.variants) {
+      if (v.encode) {
+        cache.set_output_hash(v.key, v.hash);
+        ++encoded;
+        left_out += v.hash == 0;
+      }
+      if (v.hash == 0) continue;
+      cache.keep_object(v.key);
+      auto& src = published.emplace_back();
+      src.path = job.src->path;  // read again only if the cached object goes missing
+      src.rel = fingerprint_name(variant_name(job.src->path, v.width, v.format), v.hash);
+      src.content_type = image_type(v.format);
+      src.fingerprinted = true;
+      src.object = v.key;
+      src.variant_width = v.width;
+      src.variant_format = v.format;
+      src.key = v.key;
+      src.hash = v.hash;
+      key.add(src.rel);
+
+      ResponsiveImage::Candidate candidate{src.rel, v.width};
+      if (v.format == job.format) {
+        image.fallback.push_back(std::move(candidate));
+        continue;
+      }
+      if (image.sources.empty() || image.sources.back().type != src.content_type) {
+        image.sources.push_back({src.content_type, {}});
+      }
+      image.sources.back().candidates.push_back(std::move(candidate));
+    }
+    image.key = key.hash();
+  }
+  if (encoded > 0 && log != nullptr) {
+    std::fprintf(log, "  images: %zu variants of %zu images encoded, %zu left out as no smaller\n", encoded,
+                 pending.size(), left_out);
+  }
+  return published;
+}
+
+// Writes the server's search index of every page to kSearchIndexName in the
+// output and returns the client index to publish, or nothing when
+// opts.search_budget turns it off. Each page's terms are cached under its
+// page key, so after an edit only that page is read again; both indexes are
+// rebuilt whenever any page changed, appeared or went away.
+std::optional<std::string> search_indexes(const std::vector<Source*>& pages, BuildCache& cache,
+                                          Scheduler& scheduler, const BuildOptions& opts, std::FILE* log) {
+  CacheKey index_key("search index");
+  std::vector<std::uint64_t> keys(pages.size());
+  for (std::size_t i = 0; i < pages.size(); ++i) {
+    keys[i] = CacheKey("search").add(pages[i]->page_key).hash();
+    index_key.add(pages[i]->rel).add(keys[i]);
+    cache.keep_object(keys[i]);
+  }
+  auto key = index_key.hash();
+  auto client_key = CacheKey("client search").add(key).add(std::uint64_t{opts.search_budget}).hash();
+  auto path = opts.out / kSearchIndexName;
+  bool server_current = cache.output_hash(key) && fs::exists(path);
+  std::optional<std::string> client;
+  if (opts.search_budget > 0) {
+    cache.keep_object(client_key);
+    if (std::string bytes; cache.object(client_key, bytes)) client = std::move(bytes);
+  }
+  if (server_current && (client || opts.search_budget == 0)) return client;
+
+  std::vector<SearchDocument> docs(pages.size());
+  scheduler.parallel_for(pages.size(), [&](std::size_t i) {
+    auto& doc = docs[i];
+    std::string blob;
+    if (!cache.object(keys[i], blob) || !parse_search_document(blob, doc)) {
+      load_body(*pages[i], cache, opts);
+      doc = search_document(pages[i]->body);
+      cache.put_object(keys[i], serialize_search_document(doc));
+    }
+    doc.url = std::string("/").append(pages[i]->rel);
+    if (auto alias = index_alias(doc.url); !alias.empty()) doc.url.resize(alias.size());
+  });
+  std::sort(docs.begin(), docs.end(), [](const SearchDocument& a, const SearchDocument& b) { return a.url < b.url; });
+  if (!server_current) {
+    auto index = search_index(docs);
+    write_file_atomic(path, index);
+    cache.set_output_hash(key, xxh3_64(index));
+  }
+  if (opts.search_budget > 0 && !client) {
+    auto built = client_search_index(docs, opts.search_budget);
+    cache.put_object(client_key, built.bytes);
+    if (log != nullptr) {
+      std::fprintf(log, "  search /%s: %zu bytes for %zu pages", std::string(kClientSearchRel).c_str(),
+                   built.bytes.size(), docs.size());
+      // Scaling a handful of pages up to 1000 says nothing about a real site.
+      if (docs.size() >= 1000) {
+        std::fprintf(log, " (%.0f per 1k pages)",
+                     1000.0 * static_cast<double>(built.bytes.size()) / static_cast<double>(docs.size()));
+      }
+      std::fprintf(log, ", %zu terms", built.terms);
+      if (built.dropped > 0) std::fprintf(log, ", %zu left out to fit %zu", built.dropped, opts.search_budget);
+      std::fputc('\n', log);
+    }
+    client = std::move(built.bytes);
+  }
+  return client;
+}
+
+}  // namespace
+
+BuildStats build_site(const BuildOptions& opts, std::FILE* log) {
+  using Clock = std::chrono::steady_clock;
+  BuildStats stats;
+  auto lap_start = Clock::now();
+  auto lap = [&](std::string_view stage) {
+    auto t = Clock::now();
+    stats.stage_ms.emplace_back(stage, std::chrono::duration<double, std::milli>(t - lap_start).count());
+    lap_start = t;
+  };
+  Scheduler scheduler(opts.jobs);
+
+  auto files = list_site(opts.src);
+  auto layout = load_layout(opts);
+  std::sort(files.begin(), files.end(), [](const SiteFile& a, const SiteFile& b) { return a.rel < b.rel; });
+  auto old_manifest = Manifest::load(opts.out);
+  auto cache = BuildCache::load(opts.cache.empty() ? opts.out / kCacheDirName : opts.cache);
+  Manifest manifest;
+  auto now = static_cast<std::int64_t>(std::time(nullptr));
+
+  // Sources whose size, inode and timestamps match the cache are not read.
+  std::vector<Source> sources;
+  sources.reserve(files.size() + 2);  // plus the client search index and the dictionary
+  std::vector<Source*> unread;
+  auto root = (opts.src / "").native();
+  for (auto& file : files) {
+    auto& src = sources.emplace_back();
+    src.path = std::move(file.rel);
+    src.rel = src.path;
+    src.content_type = file.content_type;
+    src.markdown = src.path.ends_with(".md");
+    if (src.markdown) src.layout = &layout;
+    src.html = src.markdown || src.content_type.starts_with("text/html");
+    if (::stat((root + src.path).c_str(), &src.st) != 0) {
+      throw std::runtime_error("cannot stat " + src.path + ": " + std::strerror(errno));
+    }
+    if (auto hash = cache.file_hash(src.path, src.st)) {
+      src.source_hash = *hash;
+    } else {
+      unread.push_back(&src);
+    }
+  }
+  scheduler.parallel_for(unread.size(), [&](std::size_t i) {
+    read_input(*unread[i], opts);
+    unread[i]->source_hash = xxh3_64(unread[i]->input);
+  });
+  for (auto* src : unread) {
+    // A file written within the timestamp granularity of this read could
+    // change again without its mtime moving, so it is hashed again next time.
+    if (src->st.st_mtime < now - 1) cache.set_file_hash(src->path, src->st, src->source_hash);
+  }
+
+  lap("scan");
+
+  rename_markdown(sources);
+  check_pages(sources, cache, scheduler, opts);
+  lap("pages");
+  SiteCssUsage usage(sources, cache, scheduler, opts);
+  auto renames = fingerprint_assets(sources, cache, opts, usage);
+  lap("assets");
+  ResponsiveImages images;
+  auto variants = responsive_images(sources, cache, scheduler, opts, images, log);
+  // Nothing points into `sources` yet, so it can still grow.
+  sources.reserve(sources.size() + variants.size() + 2);  // plus the client search index and the dictionary
+  std::move(variants.begin(), variants.end(), std::back_inserter(sources));
+  lap("images");
+
+  CriticalStylesheets stylesheets(sources, opts);
+  std::vector<Source*> pages;
+  for (auto& src : sources) {
+    if (!src.html) continue;
+    CacheKey key("html");
+    key.add(src.page_key);
+    key.add(std::uint64_t{opts.critical_css}).add(std::uint64_t{opts.fold}).add(std::uint64_t{opts.first_flight});
+    add_renames(key, src.refs, renames);
+    for (const auto& ref : src.refs) {
+      if (auto found = images.find(ref); found != images.end()) key.add(found->second.key);
+    }
+    src.key = key.hash();
+    pages.push_back(&src);
+  }
+
+  // The dictionary is reused until enough of the pages change; see
+  // kRetrainFraction.
+  std::string dictionary;
+  bool link = false;
+  if (dictionary_codecs_available()) {
+    const auto& previous = cache.dictionary();
+    bool retrain = !previous;
+    if (previous) {
+      std::size_t same = 0;
+      for (const auto* page : pages) {
+        auto it = previous->pages.find(page->rel);
+        same += it != previous->pages.end() && it->second == page->key;
+      }
+      std::size_t changed = pages.size() - same + previous->pages.size() - same;
+      retrain = changed * kRetrainFraction > pages.size() ||
+                (previous->object != 0 && !cache.object(previous->object, dictionary));
+    }
+    if (retrain) {
+      std::vector<std::string_view> samples(pages.size());
+      scheduler.parallel_for(pages.size(), [&](std::size_t i) {
+        produce(*pages[i], cache, opts, renames, images, &stylesheets, &usage, true);
+        samples[i] = pages[i]->data;
+      });
+      dictionary = train_dictionary(samples, kDictionaryMaxSize);
+      if (dictionary.empty()) {
+        for (auto* page : pages) {  // nothing to link to after all
+          if (auto at = page->data.find(kDictionaryLink); at != std::string::npos) {
+            page->data.erase(at, kDictionaryLink.size());
+          }
+        }
+      }
+      BuildCache::Dictionary trained;
+      if (!dictionary.empty()) {
+        trained.object = xxh3_64(dictionary);
+        cache.put_object(trained.object, dictionary);
+      }
+      for (const auto* page : pages) trained.pages.emplace(page->rel, page->key);
+      cache.set_dictionary(std::move(trained));
+    }
+    link = !dictionary.empty();
+  }
+
+  lap("dictionary");
+
+  // Hash what is published, dictionary link included, since the hash is
+  // also the file's ETag. Unchanged outputs take theirs from the cache.
+  std::vector<Source*> unhashed;
+  for (auto* page : pages) {
+    page->key = CacheKey("published").add(page->key).add(std::uint64_t{link}).hash();
+    if (auto hash = cache.output_hash(page->key)) {
+      page->hash = *hash;
+    } else {
+      unhashed.push_back(page);
+    }
+  }
+  scheduler.parallel_for(unhashed.size(), [&](std::size_t i) {
+    produce(*unhashed[i], cache, opts, renames, images, &stylesheets, &usage, link);
+    unhashed[i]->hash = xxh3_64(unhashed[i]->data);
+  });
+  for (auto* page : unhashed) cache.set_output_hash(page->key, page->hash);
+  for (auto& src : sources) {
+    if (!src.html && src.key == 0) src.key = src.hash = src.source_hash;  // published as read
+  }
+
+  lap("hash");
+
+  if (auto client = search_indexes(pages, cache, scheduler, opts, log)) {
+    for (const auto& src : sources) {
+      if (src.rel == kClientSearchRel) throw std::runtime_error(src.path + " would replace the generated /search.fst");
+    }
+    auto& src = sources.emplace_back();
+    src.rel = kClientSearchRel;
+    src.data = std::move(*client);
+    src.produced = true;
+    src.key = src.hash = xxh3_64(src.data);
+  }
+  lap("search");
+
+  Sha256Digest dictionary_hash{};
+  if (!dictionary.empty()) {
+    dictionary_hash = sha256(dictionary);
+    auto& src = sources.emplace_back();
+    src.rel = kDictionaryRel;
+    src.data = dictionary;
+    src.produced = true;
+    src.key = src.hash = xxh3_64(src.data);
+  }
+
+  // A new dictionary invalidates every page's dcb/dcz variants.
+  const auto* old_dict = old_manifest.find(std::string(kDictionaryRel));
+  bool dictionary_changed =
+      dictionary.empty() ? old_dict != nullptr : !old_dict || old_dict->hash != sources.back().hash;
+
+  // Outputs in a directory that has not changed since the last build are
+  // known to exist without a stat each.
+  std::map<std::string, bool, std::less<>> directories;  // output directory -> unchanged
+  std::vector<Source*> dirty;
+  std::string headers;
+  std::unordered_map<std::int64_t, std::string> dates;  // most files share a few Last-Modified dates
+  auto add_header = [&headers](std::string_view rel, std::string_view field) {
+    headers += '/';
+    headers += rel;
+    headers += ' ';
+    headers += field;
+    headers += '\n';
+  };
+  for (auto& src : sources) {
+    ++stats.files;
+    const auto* previous = old_manifest.find(src.rel);
+    bool same = previous != nullptr && previous->hash == src.hash;
+    Manifest::Entry entry{src.hash, same ? previous->modified : now, opts.precompress};
+    auto [dir, fresh] = directories.try_emplace((opts.out / src.rel).parent_path().native());
+    if (fresh) dir->second = cache.directory_unchanged(dir->first);
+    if (!same || (!dir->second && !fs::exists(opts.out / src.rel))) {
+      src.writes = kAllEncodings;
+    } else if (opts.precompress && !previous->variants) {
+      src.writes = kAllEncodings & ~encoding_bit(Encoding::identity);
+    } else if (src.html && dictionary_changed) {
+      src.writes = kDictionaryVariants;
+    } else {
+      entry.variants = previous->variants;
+    }
+    manifest.set(src.rel, entry);
+    if (src.writes != 0) dirty.push_back(&src);
+
+    auto& date = dates[entry.modified];
+    if (date.empty()) date = http_date(entry.modified);
+    add_header(src.rel, "ETag: \"" + hex64(entry.hash) + "\"");
+    add_header(src.rel, "Last-Modified: " + date);
+    if (src.fingerprinted) add_header(src.rel, kImmutableCacheControl);
+  }
+
+  auto write_variant = [&](Source& src, Encoding e) {
+    if (e == Encoding::identity) {
+      write_file_atomic(opts.out / src.rel, src.data);
+      return;
+    }
+    auto path = opts.out / (src.rel + std::string(encoding_suffix(e)));
+    bool dictionary_coded = e == Encoding::dcb || e == Encoding::dcz;
+    std::string packed;
+    if (!opts.precompress || !codec_available(e) || !compressible(src.content_type)) {
+      // leave `packed` empty
+    } else if (!dictionary_coded) {
+      packed = compress(e, src.data);
+    } else if (src.html && !dictionary.empty()) {
+      packed = compress_with_dictionary(e, src.data, dictionary, dictionary_hash);
+    }
+    if (!packed.empty() && packed.size() < src.data.size()) {
+      write_file_atomic(path, packed);
+      src.sizes[static_cast<std::size_t>(e)] = packed.size();
+    } else {
+      std::error_code ec;
+      fs::remove(path, ec);
+    }
+  };
+  // One job per dirty file, which spawns one sub-job per variant so a single
+  // large file's brotli pass does not serialize the rest of its variants.
+  auto prunable = [&](const Source* src) { return !src->produced && usage.prunes(*src); };
+  if (std::any_of(dirty.begin(), dirty.end(), prunable)) {
+    usage.build();
+  }
+  scheduler.parallel_for(dirty.size(), [&](std::size_t i) {
+    auto& src = *dirty[i];
+    produce(src, cache, opts, renames, images, &stylesheets, &usage, link);
+    src.sizes[0] = src.data.size();
+    TaskGroup variants(scheduler);
+    for (std::size_t e = 0; e < kEncodingCount; ++e) {
+      if (src.writes & (1u << e)) variants.spawn([&, e] { write_variant(src, static_cast<Encoding>(e)); });
+    }
+    variants.wait();
+  });
+  stats.rebuilt = dirty.size();
+  lap("write");
+
+  for (const auto& [rel, entry] : old_manifest.entries()) {
+    if (manifest.find(rel) != nullptr) continue;
+    remove_outputs(opts.out, rel);
+    ++stats.removed;
+    if (log != nullptr) std::fprintf(log, "  removed /%s\n", rel.c_str());
+  }
+
+  if (!dictionary.empty()) {
+    add_header(kDictionaryRel, R"(Use-As-Dictionary: match="/*", match-dest=("document"))");
+    add_header(kDictionaryRel, "Cache-Control: public, max-age=604800");
+  }
+  bool unchanged = dirty.empty() && stats.removed == 0 && manifest.entries() == old_manifest.entries() &&
+                   fs::exists(opts.out / ".mtsite-headers") &&
+                   fs::exists(opts.out / kResponsesName) == opts.precompress;
+  if (!unchanged) {
+    write_file_atomic(opts.out / ".mtsite-headers", headers);
+    manifest.save(opts.out);
+  }
+  for (const auto& [dir, same] : directories) cache.record_directory(dir, now);
+  cache.save();
+  lap("finish");
+
+  // The responses are serialized from the site as mtserve would load it, so
+  // the two cannot disagree. Watch builds skip them like the compressed
+  // variants, and drop the old ones rather than have most go stale.
+  std::size_t responses_size = 0;
+  if (!unchanged && opts.precompress) {
+    auto responses = serialize_responses(Site::load(opts.out));
+    write_file_atomic(opts.out / kResponsesName, responses);
+    responses_size = responses.size();
+  } else if (!unchanged) {
+    std::error_code ec;
+    fs::remove(opts.out / kResponsesName, ec);
+  }
+  lap("responses");
+
+  if (log != nullptr) {
+    if (!dictionary.empty() && dictionary_changed) {
+      std::fprintf(log, "  dictionary /%s: %zu bytes\n", std::string(kDictionaryRel).c_str(), dictionary.size());
+    }
+    if (responses_size > 0) std::fprintf(log, "  responses: %zu bytes\n", responses_size);
+    for (const auto* src : dirty) {
+      std::fprintf(log, "  /%s  %zu", src->rel.c_str(), src->sizes[0]);
+      auto br = src->sizes[static_cast<std::size_t>(Encoding::br)];
+      for (std::size_t e = 1; e < kEncodingCount; ++e) {
+        auto size = src->sizes[e];
+        if (size == 0) continue;
+        std::fprintf(log, "  %s %zu", std::string(encoding_token(static_cast<Encoding>(e))).c_str(), size);
+        bool dictionary_coded =
+            e == static_cast<std::size_t>(Encoding::dcb) || e == static_cast<std::size_t>(Encoding::dcz);
+        if (dictionary_coded && br > 0) {
+          std::fprintf(log, " (%+.0f%% vs br)", 100.0 * (static_cast<double>(size) - br) / static_cast<double>(br));
+        }
+      }
+      if (src->css_dropped > 0) std::fprintf(log, "  %zu of %zu rules unused", src->css_dropped, src->css_rules);
+      if (src->critical_css > 0) {
+        std::fprintf(log, "  critical css %zu, first flight %zu", src->critical_css, src->first_flight);
+      } else if (src->first_flight > opts.first_flight) {
+        std::fprintf(log, "  first flight %zu > %zu, css not inlined", src->first_flight, opts.first_flight);
+      }
+      std::fputc('\n', log);
+    }
+  }
+  return stats;
+}
+
+}  // namespace mt::gen
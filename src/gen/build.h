@@ -0,0 +1,78 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace mt::gen {
+
+// Markdown pages render into the template (see gen/template.h) in
+// "<src>/_layouts/page.html", if there is one, with the fields {{title}},
+// {{content}} and {{path}}. {{> name}} inlines "_layouts/name.html". Like
+// everything starting with '_', the directory is not published.
+inline constexpr std::string_view kLayoutDir = "_layouts";
+
+struct BuildOptions {
+  std::filesystem::path src = ".";
+  std::filesystem::path out = "_site";
+  unsigned jobs = 0;    // worker threads, 0 = one per CPU (see gen/scheduler.h)
+  bool minify = true;  // minify HTML (it is checked either way)
+  // Write the compressed variants. Without them a rebuild costs little more
+  // than the files it rewrites, which `mtsite watch` relies on; the next
+  // build with them on compresses whatever was skipped.
+  bool precompress = true;
+  // Largest size of the client search index published as /search.fst (see
+  // client_search.h); terms are left out to fit. 0 publishes none.
+  std::size_t search_budget = 512 * 1024;
+  // Drop the CSS rules no page can match from the stylesheets pages use
+  // (see gen/css_usage.h).
+  bool prune_css = true;
+  // Inline the CSS each page's first screen needs and defer loading its
+  // stylesheets (see gen/critical.h). The first screen is taken to be
+  // `fold` CSS pixels tall, and the page up to it should gzip to at most
+  // `first_flight` bytes.
+  bool critical_css = true;
+  std::uint32_t fold = 900;
+  std::size_t first_flight = 14 * 1024;
+  // Where intermediate results persist between builds (see gen/cache.h);
+  // empty means ".mtsite-cache" in `out`.
+  std::filesystem::path cache;
+};
+
+struct BuildStats {
+  std::size_t files = 0;
+  std::size_t rebuilt = 0;
+  std::size_t removed = 0;
+  std::vector<std::pair<std::string_view, double>> stage_ms;  // wall time of each stage, in order
+};
+
+// Builds the site in `opts.src` into `opts.out`: every servable file (same
+// rules as mtserve --root) is copied and, with `precompress`, compressed
+// into a gzip, brotli and zstd variant next to it, using every codec this
+// build links. Variants that would not be smaller than the source are
+// omitted, and raster images, compressed already, get none. Markdown files
+// are compiled to .html pages (see gen/markdown.h). HTML is checked for
+// structural errors, which fail the build, and minified (see gen/html.h).
+// Stylesheets, scripts, fonts and images are published under content-hashed
+// names with an immutable Cache-Control, and HTML/CSS references to them
+// are rewritten (see gen/fingerprint.h). JPEG and PNG images get resized
+// variants, and <img> tags pointing at them get srcset, <picture> and size
+// attributes (see gen/responsive.h). Rules no page can match are dropped
+// from stylesheets (see gen/css_usage.h). Pages inline the rules their first
+// screen needs from the stylesheets they link, which then load without
+// blocking rendering (see gen/critical.h). Every intermediate result is
+// cached under a key hashing its inputs, so a rebuild reads only the
+// sources whose metadata changed and redoes only the work that depends on
+// them. Only outputs whose content hash differs from the output manifest
+// are rewritten, and outputs whose source disappeared are removed. A
+// full-text index of every page is written to ".mtsite-search" (see
+// search.h) for the server, and a compact one is published as /search.fst
+// for pages to search themselves. Progress goes to `log` if non-null.
+// Throws std::runtime_error.
+BuildStats build_site(const BuildOptions& opts, std::FILE* log);
+
+}  // namespace mt::gen
@@ -0,0 +1,54 @@
+#include "gen/byteset.h"
+
+#include <bit>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+namespace mt::gen {
+
+namespace {
+
+#if defined(__x86_64__)
+
+[[gnu::target("avx2")]] inline unsigned match_avx2(__m256i lo_table, __m256i hi_table, const char* p) {
+  const auto nibble = _mm256_set1_epi8(0x0f);
+  auto v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+  auto l = _mm256_shuffle_epi8(lo_table, _mm256_and_si256(v, nibble));
+  auto h = _mm256_shuffle_epi8(hi_table, _mm256_and_si256(_mm256_srli_epi16(v, 4), nibble));
+  auto miss = _mm256_cmpeq_epi8(_mm256_and_si256(l, h), _mm256_setzero_si256());
+  return ~static_cast<unsigned>(_mm256_movemask_epi8(miss));
+}
+
+// Needs end - p >= 32. The last partial vector is an overlapping load that
+// ends at `end`, so there is no scalar tail.
+[[gnu::target("avx2")]] const char* find_avx2(const std::uint8_t* lo, const std::uint8_t* hi, const char* p,
+                                              const char* end) {
+  const auto lo_table = _mm256_broadcastsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i*>(lo)));
+  const auto hi_table = _mm256_broadcastsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i*>(hi)));
+  for (; end - p >= 32; p += 32) {
+    if (auto bits = match_avx2(lo_table, hi_table, p)) return p + std::countr_zero(bits);
+  }
+  if (p == end) return end;
+  if (auto bits = match_avx2(lo_table, hi_table, end - 32) >> (32 - (end - p))) return p + std::countr_zero(bits);
+  return end;
+}
+
+const bool kHaveAvx2 = __builtin_cpu_supports("avx2");
+
+#endif
+
+}  // namespace
+
+const char* ByteSet::find_wide(const char* p, const char* end) const {
+#if defined(__x86_64__)
+  if (kHaveAvx2) return find_avx2(lo_.data(), hi_.data(), p, end);
+#endif
+  for (; p < end; ++p) {
+    if (contains(*p)) return p;
+  }
+  return end;
+}
+
+}  // namespace mt::gen
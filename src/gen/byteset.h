@@ -0,0 +1,57 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <stdexcept>
+#include <string_view>
+
+namespace mt::gen {
+
+// A set of ASCII bytes that can be searched for 32 bytes at a time. Each
+// byte is split into nibbles, and x is in the set iff
+// lo[x & 15] & hi[x >> 4] is non-zero. That is two PSHUFB lookups and an
+// AND per vector, whatever the set's size. The only limit is at most eight
+// distinct high nibbles.
+class ByteSet {
+ public:
+  consteval explicit ByteSet(std::string_view chars) {
+    unsigned char nibbles[8] = {};
+    int used = 0;
+    for (char ch : chars) {
+      auto c = static_cast<unsigned char>(ch);
+      if (c >= 0x80) throw std::logic_error("ByteSet holds ASCII only");
+      int bit = 0;
+      while (bit < used && nibbles[bit] != (c >> 4)) ++bit;
+      if (bit == used) {
+        if (used == 8) throw std::logic_error("ByteSet: more than eight high nibbles");
+        nibbles[used++] = static_cast<unsigned char>(c >> 4);
+      }
+      lo_[c & 15] |= static_cast<std::uint8_t>(1u << bit);
+      hi_[c >> 4] |= static_cast<std::uint8_t>(1u << bit);
+    }
+  }
+
+  constexpr bool contains(char ch) const {
+    auto c = static_cast<unsigned char>(ch);
+    return (lo_[c & 15] & hi_[c >> 4]) != 0;
+  }
+
+  // First byte of [p, end) in the set, or `end`. Spans shorter than a
+  // vector, which is most of them between Markdown's special characters,
+  // never leave the caller.
+  const char* find(const char* p, const char* end) const {
+    if (end - p >= 32) return find_wide(p, end);
+    for (; p < end; ++p) {
+      if (contains(*p)) return p;
+    }
+    return end;
+  }
+
+ private:
+  const char* find_wide(const char* p, const char* end) const;
+
+  std::array<std::uint8_t, 16> lo_{};
+  std::array<std::uint8_t, 16> hi_{};  // zero for 0x8-0xf, so no byte >= 0x80 matches
+};
+
+}  // namespace mt::gen
@@ -0,0 +1,281 @@
+#include "gen/cache.h"
+
+#include <charconv>
+#include <system_error>
+
+#include "gen/files.h"
+#include "hash.h"
+
+namespace mt::gen {
+
+namespace fs = std::filesystem;
+
+namespace {
+
+constexpr std::string_view kMagic = "mtsite-cache ";
+
+std::int64_t nanoseconds(const struct timespec& ts) {
+  return static_cast<std::int64_t>(ts.tv_sec) * 1'000'000'000 + ts.tv_nsec;
+}
+
+// Paths are stored tab-separated, one record per line.
+bool storable(std::string_view s) { return s.find_first_of("\t\n") == std::string_view::npos; }
+
+// Removes and returns the text up to the next tab, or all of it.
+std::string_view next_field(std::string_view& line) {
+  auto tab = line.find('\t');
+  auto field = line.substr(0, tab);
+  line.remove_prefix(tab == std::string_view::npos ? line.size() : tab + 1);
+  return field;
+}
+
+template <class T>
+bool parse(std::string_view s, T& v, int base = 10) {
+  auto r = std::from_chars(s.data(), s.data() + s.size(), v, base);
+  return r.ec == std::errc{} && r.ptr == s.data() + s.size();
+}
+
+std::uint64_t executable_hash() {
+  try {
+    return xxh3_64(read_file("/proc/self/exe"));
+  } catch (const std::exception&) {
+    return 0;
+  }
+}
+
+}  // namespace
+
+CacheKey& CacheKey::add(std::string_view s) {
+  add(static_cast<std::uint64_t>(s.size()));
+  bytes_ += s;
+  return *this;
+}
+
+CacheKey& CacheKey::add(std::uint64_t v) {
+  bytes_.append(reinterpret_cast<const char*>(&v), sizeof v);
+  return *this;
+}
+
+std::uint64_t CacheKey::hash() const { return xxh3_64(bytes_); }
+
+// The index is text: a "mtsite-cache <executable hash>" line, then one
+// tab-separated record per line, tagged by its first field:
+//   f <hash> <size> <inode> <mtime ns> <ctime ns> <path>
+//   r <key> <path>...
+//   o <key> <hash>
+//   d <object key>
+//   t <key> <page>
+//   m <mtime ns> <directory>
+// Malformed records are skipped, which only costs the work they would have
+// saved.
+BuildCache BuildCache::load(fs::path dir) {
+  BuildCache c;
+  c.dir_ = std::move(dir);
+  c.executable_ = executable_hash();
+  std::string text;
+  try {
+    text = read_file(c.dir_ / kIndexName);
+  } catch (const std::exception&) {
+    return c;
+  }
+  std::string_view rest = text;
+  auto next_line = [&rest] {
+    auto nl = rest.find('\n');
+    auto line = rest.substr(0, nl);
+    rest.remove_prefix(nl == std::string_view::npos ? rest.size() : nl + 1);
+    return line;
+  };
+  auto header = next_line();
+  std::uint64_t executable = 0;
+  if (!header.starts_with(kMagic) || !parse(header.substr(kMagic.size()), executable, 16) ||
+      executable != c.executable_ || c.executable_ == 0) {
+    return c;
+  }
+
+  while (!rest.empty()) {
+    auto line = next_line();
+    auto tag = next_field(line);
+    std::uint64_t key = 0;
+    if (tag.size() != 1 || !parse(next_field(line), key, 16)) continue;
+    switch (tag[0]) {
+      case 'f': {
+        FileEntry e{key};
+        if (parse(next_field(line), e.size) && parse(next_field(line), e.inode) &&
+            parse(next_field(line), e.mtime_ns) && parse(next_field(line), e.ctime_ns) && !line.empty()) {
+          c.files_.emplace(line, e);
+        }
+        break;
+      }
+      case 'r': {
+        auto& refs = c.references_[key].value;
+        while (!line.empty()) refs.emplace_back(next_field(line));
+        break;
+      }
+      case 'o':
+        if (std::uint64_t hash = 0; parse(line, hash, 16)) c.outputs_[key].value = hash;
+        break;
+      case 'd':
+        if (!c.dictionary_) c.dictionary_.emplace();
+        c.dictionary_->object = key;
+        break;
+      case 't':
+        if (c.dictionary_ && !line.empty()) c.dictionary_->pages.emplace(line, key);
+        break;
+      case 'm':
+        if (!line.empty()) c.directories_[std::string(line)].value = static_cast<std::int64_t>(key);
+        break;
+    }
+  }
+  return c;
+}
+
+void BuildCache::save() {
+  for (const auto& [rel, e] : files_) dirty_ = dirty_ || !e.used;
+  for (const auto& [key, e] : references_) dirty_ = dirty_ || !e.used;
+  for (const auto& [key, e] : outputs_) dirty_ = dirty_ || !e.used;
+  for (const auto& [dir, e] : directories_) dirty_ = dirty_ || !e.used;
+  if (!dirty_) return;
+
+  std::string text(kMagic);
+  text += hex64(executable_);
+  text += '\n';
+  for (const auto& [rel, e] : files_) {
+    if (!e.used) continue;
+    text += "f\t" + hex64(e.hash);
+    for (auto v : {e.size, e.inode, e.mtime_ns, e.ctime_ns}) {
+      text += '\t';
+      text += std::to_string(v);
+    }
+    text += '\t';
+    text += rel;
+    text += '\n';
+  }
+  for (const auto& [key, e] : references_) {
+    if (!e.used) continue;
+    text += "r\t" + hex64(key);
+    for (const auto& ref : e.value) {
+      text += '\t';
+      text += ref;
+    }
+    text += '\n';
+  }
+  for (const auto& [key, e] : outputs_) {
+    if (e.used) text += "o\t" + hex64(key) + "\t" + hex64(e.value) + "\n";
+  }
+  for (const auto& [dir, e] : directories_) {
+    if (!e.used) continue;
+    text += "m\t" + hex64(static_cast<std::uint64_t>(e.value));
+    text += '\t';
+    text += dir;
+    text += '\n';
+  }
+  if (dictionary_) {
+    text += "d\t" + hex64(dictionary_->object) + "\n";
+    for (const auto& [page, key] : dictionary_->pages) {
+      if (!storable(page)) continue;
+      text += "t\t" + hex64(key);
+      text += '\t';
+      text += page;
+      text += '\n';
+    }
+  }
+  write_file_atomic(dir_ / kIndexName, text);
+
+  // An object lives as long as the references recorded under the same key,
+  // or as long as it is the dictionary or kept.
+  std::error_code ec;
+  for (const auto& entry : fs::directory_iterator(dir_ / "objects", ec)) {
+    std::uint64_t key = 0;
+    if (parse(entry.path().filename().string(), key, 16)) {
+      if (dictionary_ && dictionary_->object == key) continue;
+      if (kept_.contains(key)) continue;
+      if (auto it = references_.find(key); it != references_.end() && it->second.used) continue;
+    }
+    fs::remove(entry.path(), ec);
+  }
+  dirty_ = false;
+}
+
+std::optional<std::uint64_t> BuildCache::file_hash(const std::string& rel, const struct stat& st) {
+  auto it = files_.find(rel);
+  if (it == files_.end()) return std::nullopt;
+  auto& e = it->second;
+  if (e.size != st.st_size || e.inode != static_cast<std::int64_t>(st.st_ino) ||
+      e.mtime_ns != nanoseconds(st.st_mtim) || e.ctime_ns != nanoseconds(st.st_ctim)) {
+    return std::nullopt;
+  }
+  e.used = true;
+  return e.hash;
+}
+
+void BuildCache::set_file_hash(const std::string& rel, const struct stat& st, std::uint64_t hash) {
+  if (!storable(rel)) return;
+  files_[rel] = FileEntry{hash, st.st_size, static_cast<std::int64_t>(st.st_ino), nanoseconds(st.st_mtim),
+                          nanoseconds(st.st_ctim), true};
+  dirty_ = true;
+}
+
+const std::vector<std::string>* BuildCache::references(std::uint64_t key) {
+  auto it = references_.find(key);
+  if (it == references_.end()) return nullptr;
+  it->second.used = true;
+  return &it->second.value;
+}
+
+void BuildCache::set_references(std::uint64_t key, std::vector<std::string> refs) {
+  for (const auto& ref : refs) {
+    if (!storable(ref)) return;
+  }
+  references_[key] = {std::move(refs), true};
+  dirty_ = true;
+}
+
+std::optional<std::uint64_t> BuildCache::output_hash(std::uint64_t key) {
+  auto it = outputs_.find(key);
+  if (it == outputs_.end()) return std::nullopt;
+  it->second.used = true;
+  return it->second.value;
+}
+
+void BuildCache::set_output_hash(std::uint64_t key, std::uint64_t hash) {
+  outputs_[key] = {hash, true};
+  dirty_ = true;
+}
+
+bool BuildCache::directory_unchanged(const std::string& dir) {
+  auto it = directories_.find(dir);
+  struct stat st {};
+  if (it == directories_.end() || ::stat(dir.c_str(), &st) != 0 || nanoseconds(st.st_mtim) != it->second.value) {
+    return false;
+  }
+  it->second.used = true;
+  return true;
+}
+
+void BuildCache::record_directory(const std::string& dir, std::int64_t now) {
+  struct stat st {};
+  if (!storable(dir) || ::stat(dir.c_str(), &st) != 0 || st.st_mtime >= now - 1) return;
+  auto& e = directories_[dir];
+  dirty_ = dirty_ || e.value != nanoseconds(st.st_mtim) || !e.used;
+  e = {nanoseconds(st.st_mtim), true};
+}
+
+fs::path BuildCache::object_path(std::uint64_t key) const { return dir_ / "objects" / hex64(key); }
+
+bool BuildCache::object(std::uint64_t key, std::string& data) const {
+  std::error_code ec;
+  if (!fs::exists(object_path(key), ec)) return false;
+  data = read_file(object_path(key));
+  return true;
+}
+
+void BuildCache::put_object(std::uint64_t key, std::string_view data) const {
+  write_file_atomic(object_path(key), data);
+}
+
+void BuildCache::set_dictionary(Dictionary d) {
+  dictionary_ = std::move(d);
+  dirty_ = true;
+}
+
+}  // namespace mt::gen
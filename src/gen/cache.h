@@ -0,0 +1,116 @@
+#pragma once
+
+#include <sys/stat.h>
+
+#include <cstdint>
+#include <filesystem>
+#include <map>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+namespace mt::gen {
+
+// Hash of everything a derived result depends on. Each input is length- or
+// width-prefixed, so ("ab", "c") and ("a", "bc") give different keys.
+class CacheKey {
+ public:
+  explicit CacheKey(std::string_view stage) { add(stage); }
+  CacheKey& add(std::string_view s);
+  CacheKey& add(std::uint64_t v);
+  std::uint64_t hash() const;
+
+ private:
+  std::string bytes_;
+};
+
+// What earlier builds learned, so that a build redoes only the work whose
+// inputs changed. Every result is filed under a key that hashes all of its
+// inputs (see CacheKey):
+//  - each source file's content hash, under its path, size, inode, mtime and
+//    ctime, so unchanged files are not even read;
+//  - the site paths a page or stylesheet references, so the key of its
+//    rewritten form can be computed without reading it;
+//  - the content hash of each published file, and each image's size;
+//  - checked and minified pages, each page's search terms, encoded image
+//    variants and the shared dictionary, as blobs in objects/;
+//  - the mtime of each output directory, so outputs need not be stat'ed to
+//    know they are still there.
+// Entries the last build did not use are dropped when it saves. The whole
+// cache is discarded when the running executable changes, since its code
+// is an input to every result.
+//
+// Lookups and setters are not thread-safe; object() and put_object() are.
+class BuildCache {
+ public:
+  static constexpr const char* kIndexName = "index";
+
+  // A missing, unreadable or stale cache loads as empty.
+  static BuildCache load(std::filesystem::path dir);
+  // Writes the index and deletes unused objects, if anything changed.
+  // Throws std::runtime_error.
+  void save();
+
+  // Content hash recorded for `rel` when its metadata matches `st`.
+  std::optional<std::uint64_t> file_hash(const std::string& rel, const struct stat& st);
+  void set_file_hash(const std::string& rel, const struct stat& st, std::uint64_t hash);
+
+  const std::vector<std::string>* references(std::uint64_t key);
+  void set_references(std::uint64_t key, std::vector<std::string> refs);
+
+  std::optional<std::uint64_t> output_hash(std::uint64_t key);
+  void set_output_hash(std::uint64_t key, std::uint64_t hash);
+
+  // Whether `dir` is as record_directory() last saw it. Creating, removing
+  // or renaming a file in a directory moves its mtime, so while it is
+  // unchanged every file written there is still there.
+  bool directory_unchanged(const std::string& dir);
+  // Records the current mtime of `dir`, unless it is too recent to rule out
+  // another change within the same timestamp tick.
+  void record_directory(const std::string& dir, std::int64_t now);
+
+  // Blob stored under `key`. Returns false if there is none.
+  bool object(std::uint64_t key, std::string& data) const;
+  void put_object(std::uint64_t key, std::string_view data) const;
+  // Keeps the object under `key` through the next save(), like references
+  // recorded under the same key do for theirs.
+  void keep_object(std::uint64_t key) { kept_.insert(key); }
+
+  // The shared dictionary from the last build, which is retrained only once
+  // enough of the pages it was trained on have changed.
+  struct Dictionary {
+    std::uint64_t object = 0;  // key of its bytes; 0 when training found nothing
+    std::map<std::string, std::uint64_t, std::less<>> pages;  // page -> key it was trained on
+  };
+  const std::optional<Dictionary>& dictionary() const { return dictionary_; }
+  void set_dictionary(Dictionary d);
+
+ private:
+  struct FileEntry {
+    std::uint64_t hash = 0;
+    std::int64_t size = 0, inode = 0, mtime_ns = 0, ctime_ns = 0;
+    bool used = false;
+  };
+  template <class T>
+  struct Entry {
+    T value;
+    bool used = false;
+  };
+
+  std::filesystem::path object_path(std::uint64_t key) const;
+
+  std::filesystem::path dir_;
+  std::uint64_t executable_ = 0;
+  bool dirty_ = false;
+  std::unordered_map<std::string, FileEntry> files_;
+  std::unordered_map<std::uint64_t, Entry<std::vector<std::string>>> references_;
+  std::unordered_map<std::uint64_t, Entry<std::uint64_t>> outputs_;
+  std::unordered_map<std::string, Entry<std::int64_t>> directories_;  // mtime in ns
+  std::optional<Dictionary> dictionary_;
+  std::unordered_set<std::uint64_t> kept_;
+};
+
+}  // namespace mt::gen
@@ -0,0 +1,241 @@
+#include "gen/client_index.h"
+
+#include <algorithm>
+#include <bit>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string_view>
+#include <unordered_map>
+
+#include "client_search.h"
+
+namespace mt::gen {
+
+namespace {
+
+struct Term {
+  std::string_view text;
+  std::vector<std::uint32_t> docs;
+};
+
+void put_varint(std::string& out, std::uint32_t v) {
+  while (v >= 0x80) {
+    out += static_cast<char>(v | 0x80);
+    v >>= 7;
+  }
+  out += static_cast<char>(v);
+}
+
+std::size_t varint_size(std::uint32_t v) { return v < (1u << 7) ? 1 : v < (1u << 14) ? 2 : v < (1u << 21) ? 3 : 4; }
+
+void put_u32(std::string& out, std::size_t at, std::uint32_t v) { std::memcpy(out.data() + at, &v, sizeof v); }
+
+// Sets the `width`-bit field `bit` bits into out[at...], which is zero.
+void put_bits(std::string& out, std::size_t at, std::uint64_t bit, unsigned width, std::uint32_t v) {
+  for (unsigned done = 0; done < width; ++done) {
+    auto b = bit + done;
+    if ((v >> done) & 1) out[at + b / 8] = static_cast<char>(out[at + b / 8] | (1 << (b % 8)));
+  }
+}
+
+unsigned low_bits(std::uint32_t n, std::uint32_t doc_count) {
+  return static_cast<unsigned>(std::bit_width(doc_count / n)) - 1;
+}
+
+std::size_t postings_size(std::uint32_t n, std::uint32_t doc_count) {
+  auto l = low_bits(n, doc_count);
+  return varint_size(n) + (std::size_t{n} * l + 7) / 8 + (std::size_t{n} + (doc_count >> l) + 7) / 8;
+}
+
+void put_postings(std::string& out, const std::vector<std::uint32_t>& docs, std::uint32_t doc_count) {
+  auto n = static_cast<std::uint32_t>(docs.size());
+  auto l = low_bits(n, doc_count);
+  put_varint(out, n);
+  auto low = out.size();
+  out.resize(low + (std::size_t{n} * l + 7) / 8);
+  auto high = out.size();
+  out.resize(high + (std::size_t{n} + (doc_count >> l) + 7) / 8);
+  for (std::uint32_t i = 0; i < n; ++i) {
+    put_bits(out, low, std::uint64_t{i} * l, l, docs[i] & ((1u << l) - 1));
+    put_bits(out, high, (docs[i] >> l) + std::uint64_t{i}, 1, 1);
+  }
+}
+
+// A minimal acyclic FST built from sorted terms in one pass (Daciuk et al.,
+// 2000). The states on the path of the last term stay open; when the next
+// term diverges, the open states below the divergence are frozen, each one
+// replaced by an identical frozen state if there is one. Frozen states are
+// numbered children-first.
+class FstBuilder {
+ public:
+  void add(std::string_view term) {
+    std::size_t common = 0;
+    while (common < last_.size() && common < term.size() && last_[common] == term[common]) ++common;
+    close(common);
+    path_.resize(term.size() + 1);
+    for (auto d = common + 1; d <= term.size(); ++d) {
+      path_[d] = Node{};
+      path_[d - 1].arcs.push_back({static_cast<unsigned char>(term[d - 1]), 0});
+    }
+    path_[term.size()].final = true;
+    last_ = term;
+  }
+
+  // Writes the FST (see client_search.h) and returns the root's offset.
+  std::uint32_t finish(std::string& out) {
+    close(0);
+    auto root = freeze(path_[0]);
+    std::vector<std::uint32_t> counts(states_.size()), offsets(states_.size());
+    auto base = out.size();
+    for (std::uint32_t id = 0; id < states_.size(); ++id) {
+      const auto& s = states_[id];
+      std::uint32_t below = s.final;
+      offsets[id] = static_cast<std::uint32_t>(out.size() - base);
+      put_varint(out, static_cast<std::uint32_t>(s.arcs.size() << 1 | s.final));
+      for (auto [label, target] : s.arcs) {
+        out += static_cast<char>(label);
+        put_varint(out, below);
+        put_varint(out, offsets[id] - offsets[target]);
+        below += counts[target];
+      }
+      counts[id] = below;
+    }
+    return offsets[root];
+  }
+
+ private:
+  struct Node {
+    bool final = false;
+    std::vector<std::pair<unsigned char, std::uint32_t>> arcs;
+  };
+
+  // Freezes the open states deeper than `depth`.
+  void close(std::size_t depth) {
+    for (auto d = last_.size(); d > depth; --d) path_[d - 1].arcs.back().second = freeze(path_[d]);
+  }
+
+  std::uint32_t freeze(Node& n) {
+    std::string key(1, static_cast<char>(n.final));
+    for (auto [label, target] : n.arcs) {
+      key += static_cast<char>(label);
+      key.append(reinterpret_cast<const char*>(&target), sizeof target);
+    }
+    auto [it, fresh] = register_.try_emplace(std::move(key), static_cast<std::uint32_t>(states_.size()));
+    if (fresh) states_.push_back(std::move(n));
+    return it->second;
+  }
+
+  std::vector<Node> states_;
+  std::unordered_map<std::string, std::uint32_t> register_;  // frozen state signature -> number
+  std::vector<Node> path_{1};
+  std::string_view last_;
+};
+
+// The whole index, with the terms whose `kept` flag is set.
+std::string encode(const std::vector<SearchDocument>& docs, const std::vector<Term>& terms,
+                   const std::vector<bool>& kept) {
+  auto doc_count = static_cast<std::uint32_t>(docs.size());
+  std::string out(kClientSearchHeaderSize, '\0');
+  std::memcpy(out.data(), kClientSearchMagic, sizeof kClientSearchMagic);
+
+  auto page_table = out.size();
+  std::string_view previous;
+  for (const auto& d : docs) {
+    std::size_t shared = 0;
+    while (shared < previous.size() && shared < d.url.size() && previous[shared] == d.url[shared]) ++shared;
+    put_varint(out, static_cast<std::uint32_t>(shared));
+    put_varint(out, static_cast<std::uint32_t>(d.url.size() - shared));
+    out.append(d.url, shared);
+    put_varint(out, static_cast<std::uint32_t>(d.title.size()));
+    out += d.title;
+    previous = d.url;
+  }
+
+  auto fst = out.size();
+  FstBuilder builder;
+  std::string postings;
+  std::vector<std::uint32_t> offsets;
+  for (std::size_t i = 0; i < terms.size(); ++i) {
+    if (!kept[i]) continue;
+    builder.add(terms[i].text);
+    offsets.push_back(static_cast<std::uint32_t>(postings.size()));
+    put_postings(postings, terms[i].docs, doc_count);
+  }
+  auto root = builder.finish(out);
+
+  auto offset_table = out.size();
+  unsigned width = offsets.empty() ? 0 : static_cast<unsigned>(std::bit_width(offsets.back()));
+  out.resize(offset_table + (offsets.size() * width + 7) / 8);
+  for (std::size_t i = 0; i < offsets.size(); ++i) {
+    put_bits(out, offset_table, std::uint64_t{i} * width, width, offsets[i]);
+  }
+
+  auto postings_at = out.size();
+  out += postings;
+  if (out.size() > UINT32_MAX) throw std::runtime_error("client search index too large");
+
+  put_u32(out, 8, doc_count);
+  put_u32(out, 12, static_cast<std::uint32_t>(offsets.size()));
+  put_u32(out, 16, static_cast<std::uint32_t>(page_table));
+  put_u32(out, 20, static_cast<std::uint32_t>(fst));
+  put_u32(out, 24, root);
+  put_u32(out, 28, static_cast<std::uint32_t>(offset_table));
+  put_u32(out, 32, static_cast<std::uint32_t>(postings_at));
+  put_u32(out, 36, static_cast<std::uint32_t>(out.size()));
+  out[40] = static_cast<char>(width);
+  return out;
+}
+
+}  // namespace
+
+ClientSearch client_search_index(const std::vector<SearchDocument>& docs, std::size_t budget) {
+  auto doc_count = static_cast<std::uint32_t>(docs.size());
+  std::unordered_map<std::string_view, std::vector<std::uint32_t>> lists;
+  for (std::uint32_t d = 0; d < doc_count; ++d) {
+    for (const auto& [term, count] : docs[d].terms) lists[term].push_back(d);
+  }
+  std::vector<Term> terms;
+  terms.reserve(lists.size());
+  for (auto& [text, list] : lists) terms.push_back({text, std::move(list)});
+  std::sort(terms.begin(), terms.end(), [](const Term& a, const Term& b) { return a.text < b.text; });
+
+  // Indices into `terms` in the order they are left out; see the header.
+  std::vector<std::size_t> order(terms.size());
+  for (std::size_t i = 0; i < order.size(); ++i) order[i] = i;
+  auto common = [&](const Term& t) { return t.docs.size() * 2 > doc_count; };
+  std::sort(order.begin(), order.end(), [&](std::size_t a, std::size_t b) {
+    const auto &x = terms[a], &y = terms[b];
+    if (common(x) != common(y)) return common(x);
+    if (x.docs.size() != y.docs.size()) {
+      return common(x) ? x.docs.size() > y.docs.size() : x.docs.size() < y.docs.size();
+    }
+    if (x.text.size() != y.text.size()) return x.text.size() > y.text.size();
+    return x.text < y.text;
+  });
+
+  ClientSearch result;
+  std::vector<bool> kept(terms.size(), true);
+  std::size_t next = 0;
+  for (;;) {
+    result.bytes = encode(docs, terms, kept);
+    if (result.bytes.size() <= budget) break;
+    if (next == order.size()) {
+      throw std::runtime_error("the client search index needs " + std::to_string(result.bytes.size()) +
+                               " bytes for its page table alone, over the budget of " + std::to_string(budget));
+    }
+    // Leave out about as much as the overshoot: each term costs its bytes,
+    // a few for its FST arcs and offset, and its postings.
+    std::size_t over = result.bytes.size() - budget, freed = 0;
+    while (freed < over && next < order.size()) {
+      const auto& t = terms[order[next]];
+      freed += t.text.size() + 4 + postings_size(static_cast<std::uint32_t>(t.docs.size()), doc_count);
+      kept[order[next++]] = false;
+    }
+  }
+  result.dropped = next;
+  result.terms = terms.size() - next;
+  return result;
+}
+
+}  // namespace mt::gen
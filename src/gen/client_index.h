@@ -0,0 +1,25 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#include "gen/search_index.h"
+
+namespace mt::gen {
+
+struct ClientSearch {
+  std::string bytes;        // the index (see client_search.h)
+  std::size_t terms = 0;    // terms in it
+  std::size_t dropped = 0;  // terms left out to fit the budget
+};
+
+// The client search index of `docs`, which must be in URL order, in at
+// most `budget` bytes. Terms are left out until it fits: first those on
+// more than half the pages, most common first, since they cannot narrow a
+// search; then those on the fewest pages, longest first, which are mostly
+// numbers, identifiers and typos. Throws std::runtime_error if the page
+// table alone does not fit.
+ClientSearch client_search_index(const std::vector<SearchDocument>& docs, std::size_t budget);
+
+}  // namespace mt::gen
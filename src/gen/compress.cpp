@@ -0,0 +1,174 @@
+#include "gen/compress.h"
+
+#include <zlib.h>
+
+#include <cstdint>
+#include <stdexcept>
+
+#ifdef MT_HAVE_BROTLI
+#include <brotli/encode.h>
+#endif
+#ifdef MT_HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+namespace mt::gen {
+
+namespace {
+
+std::string gzip(std::string_view data) {
+  z_stream zs{};
+  // windowBits 15 + 16 selects the gzip wrapper; memLevel 9 is the maximum.
+  if (deflateInit2(&zs, Z_BEST_COMPRESSION, Z_DEFLATED, 15 + 16, 9, Z_DEFAULT_STRATEGY) != Z_OK) {
+    throw std::runtime_error("deflateInit2 failed");
+  }
+  std::string out(deflateBound(&zs, data.size()) + 32, '\0');
+  zs.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data.data()));
+  zs.avail_in = static_cast<uInt>(data.size());
+  zs.next_out = reinterpret_cast<Bytef*>(out.data());
+  zs.avail_out = static_cast<uInt>(out.size());
+  int rc = deflate(&zs, Z_FINISH);
+  out.resize(zs.total_out);
+  deflateEnd(&zs);
+  if (rc != Z_STREAM_END) throw std::runtime_error("deflate failed");
+  return out;
+}
+
+#ifdef MT_HAVE_BROTLI
+std::string brotli(std::string_view data) {
+  std::string out(BrotliEncoderMaxCompressedSize(data.size()), '\0');
+  std::size_t size = out.size();
+  if (!BrotliEncoderCompress(BROTLI_MAX_QUALITY, BROTLI_MAX_WINDOW_BITS, BROTLI_MODE_GENERIC, data.size(),
+                             reinterpret_cast<const std::uint8_t*>(data.data()), &size,
+                             reinterpret_cast<std::uint8_t*>(out.data()))) {
+    throw std::runtime_error("BrotliEncoderCompress failed");
+  }
+  out.resize(size);
+  return out;
+}
+#endif
+
+#ifdef MT_HAVE_ZSTD
+std::string zstd(std::string_view data) {
+  std::string out(ZSTD_compressBound(data.size()), '\0');
+  auto size = ZSTD_compress(out.data(), out.size(), data.data(), data.size(), ZSTD_maxCLevel());
+  if (ZSTD_isError(size)) throw std::runtime_error(std::string("ZSTD_compress: ") + ZSTD_getErrorName(size));
+  out.resize(size);
+  return out;
+}
+
+// Appends a zstd frame of `data` to `out`, using `dictionary` as raw content
+// (it carries no zstd dictionary header, so auto-detection loads it raw).
+void zstd_with_dictionary(std::string& out, std::string_view data, std::string_view dictionary) {
+  auto* cctx = ZSTD_createCCtx();
+  if (cctx == nullptr) throw std::runtime_error("ZSTD_createCCtx failed");
+  auto header = out.size();
+  out.resize(header + ZSTD_compressBound(data.size()));
+  ZSTD_CCtx_setParameter(cctx, ZSTD_c_compressionLevel, ZSTD_maxCLevel());
+  auto rc = ZSTD_CCtx_loadDictionary(cctx, dictionary.data(), dictionary.size());
+  if (!ZSTD_isError(rc)) rc = ZSTD_compress2(cctx, out.data() + header, out.size() - header, data.data(), data.size());
+  ZSTD_freeCCtx(cctx);
+  if (ZSTD_isError(rc)) throw std::runtime_error(std::string("ZSTD_compress2: ") + ZSTD_getErrorName(rc));
+  out.resize(header + rc);
+}
+#endif
+
+#ifdef MT_HAVE_BROTLI_DICT
+void brotli_with_dictionary(std::string& out, std::string_view data, std::string_view dictionary) {
+  auto* prepared = BrotliEncoderPrepareDictionary(BROTLI_SHARED_DICTIONARY_RAW, dictionary.size(),
+                                                  reinterpret_cast<const std::uint8_t*>(dictionary.data()),
+                                                  BROTLI_MAX_QUALITY, nullptr, nullptr, nullptr);
+  auto* state = BrotliEncoderCreateInstance(nullptr, nullptr, nullptr);
+  bool ok = prepared != nullptr && state != nullptr;
+  ok = ok && BrotliEncoderSetParameter(state, BROTLI_PARAM_QUALITY, BROTLI_MAX_QUALITY);
+  ok = ok && BrotliEncoderSetParameter(state, BROTLI_PARAM_LGWIN, BROTLI_MAX_WINDOW_BITS);
+  ok = ok && BrotliEncoderAttachPreparedDictionary(state, prepared);
+
+  auto header = out.size();
+  out.resize(header + BrotliEncoderMaxCompressedSize(data.size()) + 64);
+  std::size_t avail_in = data.size();
+  auto next_in = reinterpret_cast<const std::uint8_t*>(data.data());
+  std::size_t avail_out = out.size() - header;
+  auto next_out = reinterpret_cast<std::uint8_t*>(out.data() + header);
+  ok = ok && BrotliEncoderCompressStream(state, BROTLI_OPERATION_FINISH, &avail_in, &next_in, &avail_out,
+                                         &next_out, nullptr);
+  ok = ok && BrotliEncoderIsFinished(state);
+  if (state != nullptr) BrotliEncoderDestroyInstance(state);
+  if (prepared != nullptr) BrotliEncoderDestroyPreparedDictionary(prepared);
+  if (!ok) throw std::runtime_error("brotli compression with dictionary failed");
+  out.resize(out.size() - avail_out);
+}
+#endif
+
+}  // namespace
+
+bool codec_available(Encoding e) {
+  switch (e) {
+    case Encoding::gzip:
+      return true;
+    case Encoding::br:
+#ifdef MT_HAVE_BROTLI
+      return true;
+#else
+      return false;
+#endif
+    case Encoding::zstd:
+    case Encoding::dcz:
+#ifdef MT_HAVE_ZSTD
+      return true;
+#else
+      return false;
+#endif
+    case Encoding::dcb:
+#ifdef MT_HAVE_BROTLI_DICT
+      return true;
+#else
+      return false;
+#endif
+    case Encoding::identity:
+      break;
+  }
+  return false;
+}
+
+std::string compress(Encoding e, std::string_view data) {
+  switch (e) {
+    case Encoding::gzip:
+      return gzip(data);
+#ifdef MT_HAVE_BROTLI
+    case Encoding::br:
+      return brotli(data);
+#endif
+#ifdef MT_HAVE_ZSTD
+    case Encoding::zstd:
+      return zstd(data);
+#endif
+    default:
+      break;
+  }
+  throw std::runtime_error("codec not available: " + std::string(encoding_token(e)));
+}
+
+std::string compress_with_dictionary(Encoding e, [[maybe_unused]] std::string_view data,
+                                     [[maybe_unused]] std::string_view dictionary,
+                                     const Sha256Digest& dictionary_hash) {
+  std::string out(dictionary_magic(e));
+  out.append(reinterpret_cast<const char*>(dictionary_hash.data()), dictionary_hash.size());
+  switch (e) {
+#ifdef MT_HAVE_BROTLI_DICT
+    case Encoding::dcb:
+      brotli_with_dictionary(out, data, dictionary);
+      return out;
+#endif
+#ifdef MT_HAVE_ZSTD
+    case Encoding::dcz:
+      zstd_with_dictionary(out, data, dictionary);
+      return out;
+#endif
+    default:
+      break;
+  }
+  throw std::runtime_error("codec not available: " + std::string(encoding_token(e)));
+}
+
+}  // namespace mt::gen
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+
+#include "encoding.h"
+#include "sha256.h"
+
+namespace mt::gen {
+
+// True when this build links the codec for `e`. gzip is always available;
+// brotli and zstd depend on what CMake found, and dcb additionally needs a
+// brotli new enough to accept custom dictionaries (1.1+).
+bool codec_available(Encoding e);
+
+// Compresses `data` at the codec's maximum level. These outputs are built
+// once per deploy and served many times, so ratio matters more than speed.
+// Throws std::runtime_error if the codec fails or is unavailable.
+std::string compress(Encoding e, std::string_view data);
+
+// dcb/dcz: compresses `data` against a raw shared dictionary and prefixes the
+// RFC 9842 header (dictionary_magic() then `dictionary_hash`).
+std::string compress_with_dictionary(Encoding e, std::string_view data, std::string_view dictionary,
+                                     const Sha256Digest& dictionary_hash);
+
+}  // namespace mt::gen
@@ -0,0 +1,295 @@
+#include "gen/critical.h"
+
+#include <algorithm>
+#include <iterator>
+#include <unordered_set>
+
+#include "gen/compress.h"
+#include "gen/fingerprint.h"
+#include "gen/text.h"
+#include "http.h"
+
+namespace mt::gen {
+
+namespace {
+
+// Folds tried per page: `fold`, then half and a quarter of it.
+constexpr int kFoldSteps = 3;
+
+constexpr std::string_view kDeferredMedia = R"( media="print" onload="this.media='all'")";
+
+// Whether the space-separated list `value` contains `token` (case-insensitive).
+bool has_token(std::string_view value, std::string_view token) {
+  std::size_t i = 0;
+  while (i < value.size()) {
+    while (i < value.size() && space(value[i])) ++i;
+    auto start = i;
+    while (i < value.size() && !space(value[i])) ++i;
+    if (i > start && http::iequals(value.substr(start, i - start), token)) return true;
+  }
+  return false;
+}
+
+// The elements of a page above its fold, and their names, ids and classes,
+// so most selectors are ruled out by their last compound without walking
+// the tree.
+struct AboveFold {
+  std::vector<std::size_t> elements;
+  std::unordered_set<std::string_view> tags, ids, classes;
+
+  AboveFold(const Document& doc, std::uint32_t fold) {
+    for (std::size_t i = 0; i < doc.elements.size(); ++i) {
+      const auto& e = doc.elements[i];
+      if (e.top >= fold) continue;  // kHidden included
+      elements.push_back(i);
+      tags.insert(e.tag);
+      if (!e.id.empty()) ids.insert(e.id);
+      for (const auto& c : e.classes) classes.insert(c);
+    }
+  }
+
+  bool matched(const Selector& sel, const Document& doc) const {
+    const auto& last = sel.compounds.back();
+    if (!last.tag.empty() && !tags.contains(last.tag)) return false;
+    if (!last.id.empty() && !ids.contains(last.id)) return false;
+    for (const auto& c : last.classes) {
+      if (!classes.contains(c)) return false;
+    }
+    return std::any_of(elements.begin(), elements.end(), [&](std::size_t e) { return matches(sel, doc, e); });
+  }
+};
+
+// Picks rules in two passes over the same depth-first order: style rules
+// first, then the at-rules that depend on what the style rules use.
+class Chooser {
+ public:
+  Chooser(const std::vector<std::optional<std::vector<Selector>>>& selectors, const Document& doc,
+          const AboveFold& above)
+      : selectors_(selectors), doc_(doc), above_(above) {}
+
+  std::string run(const std::vector<CssRule>& rules) {
+    choose(rules, false);
+    next_ = 0;
+    std::string out;
+    write(rules, out);
+    return out;
+  }
+
+ private:
+  static bool print_only(const CssRule& rule) {
+    return at_rule_name(rule) == "media" && trim(std::string_view(rule.prelude).substr(6)) == "print";
+  }
+
+  void choose(const std::vector<CssRule>& rules, bool skip) {
+    for (const auto& rule : rules) {
+      if (rule.kind == CssRule::Kind::group) {
+        choose(rule.rules, skip || print_only(rule));
+      } else if (rule.kind == CssRule::Kind::style) {
+        const auto& selectors = selectors_[chosen_.size()];
+        bool chosen = !skip && (!selectors || std::any_of(selectors->begin(), selectors->end(), [&](const Selector& s) {
+                                  return above_.matched(s, doc_);
+                                }));
+        chosen_.push_back(chosen);
+        if (chosen) declarations_ += rule.body;
+      }
+    }
+  }
+
+  bool keep_at_rule(const CssRule& rule) const {
+    auto name = at_rule_name(rule);
+    if (name == "import" || name == "charset" || name == "page") return false;
+    if (name == "font-face") {
+      auto family = font_face_family(rule);
+      return !family.empty() && declarations_.find(family) != std::string::npos;
+    }
+    if (name.ends_with("keyframes")) {
+      auto animation = keyframes_name(rule);
+      return !animation.empty() && declarations_.find(animation) != std::string::npos;
+    }
+    return true;
+  }
+
+  void write(const std::vector<CssRule>& rules, std::string& out) {
+    for (const auto& rule : rules) {
+      switch (rule.kind) {
+        case CssRule::Kind::style:
+          if (chosen_[next_++]) {
+            out += rule.prelude;
+            out += '{';
+            out += rule.body;
+            out += '}';
+          }
+          break;
+        case CssRule::Kind::group: {
+          std::string inner;
+          write(rule.rules, inner);
+          if (inner.empty()) break;
+          out += rule.prelude;
+          out += '{';
+          out += inner;
+          out += '}';
+          break;
+        }
+        case CssRule::Kind::at_rule:
+          if (keep_at_rule(rule)) write_css({rule}, out);
+          break;
+      }
+    }
+  }
+
+  const std::vector<std::optional<std::vector<Selector>>>& selectors_;
+  const Document& doc_;
+  const AboveFold& above_;
+  std::vector<bool> chosen_;  // per style rule, depth first
+  std::size_t next_ = 0;
+  std::string declarations_;  // of the chosen style rules
+};
+
+void collect_selectors(const std::vector<CssRule>& rules, std::vector<std::optional<std::vector<Selector>>>& out) {
+  for (const auto& rule : rules) {
+    if (rule.kind == CssRule::Kind::group) {
+      collect_selectors(rule.rules, out);
+    } else if (rule.kind == CssRule::Kind::style) {
+      out.push_back(parse_selectors(rule.prelude));
+    }
+  }
+}
+
+// Imports nest at most this deep, which also ends import cycles.
+constexpr int kMaxImportDepth = 8;
+
+// The URL of an "@import url(...)" or "@import '...'" with nothing after
+// it, or empty.
+std::string_view import_url(std::string_view prelude) {
+  auto rest = trim(prelude.substr(7));
+  std::string_view url;
+  if (rest.size() > 4 && http::iequals(rest.substr(0, 4), "url(")) {
+    auto close = rest.find(')');
+    if (close == std::string_view::npos) return {};
+    url = unquote(rest.substr(4, close - 4));
+    rest.remove_prefix(close + 1);
+  } else if (!rest.empty() && (rest.front() == '"' || rest.front() == '\'')) {
+    auto close = rest.find(rest.front(), 1);
+    if (close == std::string_view::npos) return {};
+    url = rest.substr(1, close - 1);
+    rest.remove_prefix(close + 1);
+  }
+  return trim(rest).empty() ? url : std::string_view();
+}
+
+void expand_imports(std::vector<CssRule>& rules, const CriticalStylesheet::Import& import, int depth) {
+  std::size_t i = 0;
+  while (i < rules.size()) {
+    auto url = at_rule_name(rules[i]) == "import" && depth < kMaxImportDepth ? import_url(rules[i].prelude)
+                                                                              : std::string_view();
+    auto css = url.empty() ? std::nullopt : import(url);
+    if (!css) {
+      ++i;
+      continue;
+    }
+    auto imported = parse_css(*css);
+    expand_imports(imported, import, depth + 1);
+    auto n = imported.size();
+    rules.erase(rules.begin() + static_cast<std::ptrdiff_t>(i));
+    rules.insert(rules.begin() + static_cast<std::ptrdiff_t>(i), std::make_move_iterator(imported.begin()),
+                 std::make_move_iterator(imported.end()));
+    i += n;
+  }
+}
+
+struct Link {
+  std::size_t start, end;  // of the tag in the page
+  const CriticalStylesheet* sheet;
+};
+
+// Source offset of the first rendered element at or below `fold`, or the
+// end of the page.
+std::size_t fold_offset(const Document& doc, std::uint32_t fold, std::size_t size) {
+  for (const auto& e : doc.elements) {
+    if (e.top != Document::kHidden && e.top >= fold) return e.offset;
+  }
+  return size;
+}
+
+std::string rewrite_links(std::string_view html, const std::vector<Link>& links, std::string_view css) {
+  std::string out;
+  out.reserve(html.size() + css.size() + 128 * links.size());
+  out.append(html.substr(0, links.front().start));
+  out += "<style>";
+  out += css;
+  out += "</style>";
+  std::size_t copied = links.front().start;
+  for (const auto& link : links) {
+    out.append(html.substr(copied, link.start - copied));
+    auto tag = html.substr(link.start, link.end - link.start);
+    auto attrs = trim(tag.substr(0, tag.size() - (tag.ends_with("/>") ? 2 : tag.ends_with(">") ? 1 : 0)));
+    out += attrs;
+    out += kDeferredMedia;
+    out += "><noscript>";
+    out += tag;
+    out += "</noscript>";
+    copied = link.end;
+  }
+  out.append(html.substr(copied));
+  return out;
+}
+
+}  // namespace
+
+CriticalStylesheet::CriticalStylesheet(std::string_view css, const Import& import) : rules_(parse_css(css)) {
+  if (import) expand_imports(rules_, import, 0);
+  collect_selectors(rules_, selectors_);
+}
+
+std::string CriticalStylesheet::rules_for(const Document& doc, std::uint32_t fold) const {
+  AboveFold above(doc, fold);
+  return Chooser(selectors_, doc, above).run(rules_);
+}
+
+CriticalCss inline_critical_css(std::string_view html, std::string_view rel,
+                                const std::function<const CriticalStylesheet*(std::string_view)>& find,
+                                std::uint32_t fold, std::size_t first_flight) {
+  CriticalCss result;
+  auto doc = parse_document(html);
+  std::vector<Link> links;
+  for (const auto& e : doc.elements) {
+    if (e.tag == "body") break;
+    if (e.tag != "link") continue;
+    std::string_view kind, href;
+    bool skip = false;
+    for (const auto& [name, value] : e.attributes) {
+      if (name == "rel") {
+        kind = value;
+      } else if (name == "href") {
+        href = value;
+      } else if (name == "media" || name == "onload" || name == "disabled") {
+        skip = true;
+      }
+    }
+    if (skip || !has_token(kind, "stylesheet") || has_token(kind, "alternate")) continue;
+    auto path = resolve_url(href, rel);
+    const auto* sheet = path.empty() ? nullptr : find(path);
+    if (sheet != nullptr) links.push_back({e.offset, tag_end(html, e.offset), sheet});
+  }
+  if (links.empty()) return result;
+
+  for (int step = 0; step < kFoldSteps; ++step, fold /= 2) {
+    std::string css;
+    for (const auto& link : links) css += link.sheet->rules_for(doc, fold);
+    // Nothing to inline, or CSS that would end the <style> element early.
+    if (css.empty() || find_ci(css, "</style") != std::string_view::npos) return result;
+    auto page = rewrite_links(html, links, css);
+    // The links are all in <head>, before any element the fold can fall on.
+    auto cut = fold_offset(doc, fold, html.size()) + (page.size() - html.size());
+    result.first_flight = compress(Encoding::gzip, std::string_view(page).substr(0, cut)).size();
+    if (result.first_flight <= first_flight) {
+      result.html = std::move(page);
+      result.css = css.size();
+      result.fold = fold;
+      return result;
+    }
+  }
+  return result;
+}
+
+}  // namespace mt::gen
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "gen/css.h"
+#include "gen/selector.h"
+
+namespace mt::gen {
+
+// A stylesheet parsed once for picking out the rules each page needs to
+// render its first screen.
+class CriticalStylesheet {
+ public:
+  // Returns the CSS of the stylesheet at a URL, or nullopt if it is not
+  // one of the site's.
+  using Import = std::function<std::optional<std::string>(std::string_view url)>;
+
+  // `css` must not depend on where it is inlined: its URLs must be
+  // root-relative (see rebase_css()). @import rules without media, layer
+  // or supports conditions are replaced by the rules `import` returns for
+  // them, to a depth of a few imports.
+  explicit CriticalStylesheet(std::string_view css, const Import& import = nullptr);
+
+  // The rules that may apply to an element of `doc` starting above `fold`
+  // (see Document::Element::top), as CSS, or empty if there are none.
+  // Rules inside @media print are left out; other @media and @supports
+  // blocks are kept around their chosen rules, since their conditions
+  // cannot be told at build time. @font-face and @keyframes rules are kept
+  // when the chosen rules name their font family or animation. Remaining
+  // @import rules and @charset are dropped: imports arrive with the
+  // deferred stylesheet.
+  std::string rules_for(const Document& doc, std::uint32_t fold) const;
+
+ private:
+  std::vector<CssRule> rules_;
+  // Selectors of each style rule in rules_, depth first; nullopt when they
+  // did not parse, and such rules are always chosen.
+  std::vector<std::optional<std::vector<Selector>>> selectors_;
+};
+
+struct CriticalCss {
+  std::string html;            // the rewritten page, or empty if it was left as it was
+  std::size_t css = 0;         // bytes of CSS inlined
+  std::size_t first_flight = 0;  // gzip size of the published page up to the fold
+  std::uint32_t fold = 0;      // the fold the rules were chosen for
+};
+
+// Inlines into the page at `rel` the rules of its stylesheets that its
+// first screen needs, and defers loading the stylesheets themselves.
+//
+// The stylesheets are the <link rel="stylesheet"> elements without a media
+// or onload attribute whose href `find` knows (by site path). The chosen
+// rules go into a <style> element in place of the first of those links.
+// Each link then loads with media="print" and switches to media="all"
+// once loaded, so it no longer blocks rendering; a copy of the original
+// link in <noscript> covers browsers without scripts.
+//
+// The page, up to the first element below the fold, should fit in
+// `first_flight` bytes when gzipped: what a server can send in its first
+// round trip (TCP's initial window of ten segments is about 14 KB). If it
+// does not, the fold is halved, down to a quarter of `fold`, and rules
+// chosen again. Pages that still do not fit, and pages with no stylesheet
+// to inline, are left as they were.
+CriticalCss inline_critical_css(std::string_view html, std::string_view rel,
+                                const std::function<const CriticalStylesheet*(std::string_view)>& find,
+                                std::uint32_t fold, std::size_t first_flight);
+
+}  // namespace mt::gen
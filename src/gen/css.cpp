@@ -0,0 +1,228 @@
+#include "gen/css.h"
+
+#include "gen/text.h"
+
+namespace mt::gen {
+
+namespace {
+
+// At-rules whose block holds rules rather than declarations.
+bool group_rule(std::string_view name) {
+  return name == "media" || name == "supports" || name == "layer" || name == "container" || name == "document" ||
+         name == "-moz-document" || name == "scope" || name == "starting-style";
+}
+
+class Parser {
+ public:
+  explicit Parser(std::string_view css) : css_(css) {}
+
+  // Rules up to the '}' closing the enclosing block (consumed), or the end.
+  std::vector<CssRule> rules(bool nested) {
+    std::vector<CssRule> out;
+    for (;;) {
+      skip_space();
+      if (i_ >= css_.size()) return out;
+      char c = css_[i_];
+      if (c == '}') {
+        ++i_;
+        if (nested) return out;
+        continue;
+      }
+      if (c == ';') {  // stray semicolon between rules
+        ++i_;
+        continue;
+      }
+      if (css_.substr(i_).starts_with("<!--")) {
+        i_ += 4;
+        continue;
+      }
+      if (css_.substr(i_).starts_with("-->")) {
+        i_ += 3;
+        continue;
+      }
+      CssRule rule;
+      char end = prelude(rule.prelude, c == '@');
+      if (c == '@') {
+        rule.kind = CssRule::Kind::at_rule;
+        rule.block = end == '{';
+        if (rule.block && group_rule(at_rule_name(rule))) {
+          rule.kind = CssRule::Kind::group;
+          rule.rules = rules(true);
+        } else if (rule.block) {
+          block(rule.body);
+        }
+      } else {
+        if (end != '{') continue;  // selectors without a block are dropped
+        block(rule.body);
+      }
+      out.push_back(std::move(rule));
+    }
+  }
+
+ private:
+  void skip_space() {
+    while (i_ < css_.size()) {
+      if (space(css_[i_])) {
+        ++i_;
+      } else if (comment()) {
+        continue;
+      } else {
+        break;
+      }
+    }
+  }
+
+  // Skips a comment starting at i_, if there is one.
+  bool comment() {
+    if (!css_.substr(i_).starts_with("/*")) return false;
+    auto end = css_.find("*/", i_ + 2);
+    i_ = end == std::string_view::npos ? css_.size() : end + 2;
+    return true;
+  }
+
+  // Appends the string starting at css_[i_] (a quote) to `out`, quotes included.
+  void string(std::string& out) {
+    char quote = css_[i_];
+    out += quote;
+    for (++i_; i_ < css_.size(); ++i_) {
+      char c = css_[i_];
+      out += c;
+      if (c == '\\' && i_ + 1 < css_.size()) {
+        out += css_[++i_];
+      } else if (c == quote || c == '\n') {
+        ++i_;
+        return;
+      }
+    }
+  }
+
+  // Reads up to a '{' or, for at-rules, a ';', consuming it, and returns
+  // which one ended the prelude (0 at the end of input). Whitespace runs
+  // and comments become single spaces; brackets and parentheses nest.
+  char prelude(std::string& out, bool at_rule) {
+    int depth = 0;
+    bool gap = false;
+    while (i_ < css_.size()) {
+      char c = css_[i_];
+      if (space(c) || comment()) {
+        if (space(c)) ++i_;
+        gap = true;
+        continue;
+      }
+      if (depth == 0 && (c == '{' || (at_rule && c == ';') || c == '}')) {
+        if (c != '}') ++i_;
+        return c == '}' ? 0 : c;
+      }
+      if (gap && !out.empty()) out += ' ';
+      gap = false;
+      if (c == '"' || c == '\'') {
+        string(out);
+        continue;
+      }
+      if (c == '(' || c == '[') ++depth;
+      if ((c == ')' || c == ']') && depth > 0) --depth;
+      if (c == '\\' && i_ + 1 < css_.size()) out += css_[i_++];
+      out += c;
+      ++i_;
+    }
+    return 0;
+  }
+
+  // Reads a block's contents up to its closing '}' (consumed), dropping
+  // comments, collapsing whitespace runs and trimming both ends.
+  void block(std::string& out) {
+    int depth = 0;
+    skip_space();
+    while (i_ < css_.size()) {
+      char c = css_[i_];
+      if (comment()) continue;
+      if (space(c)) {
+        if (!out.empty() && !space(out.back())) out += ' ';
+        ++i_;
+        continue;
+      }
+      if (c == '"' || c == '\'') {
+        string(out);
+        continue;
+      }
+      if (c == '{') ++depth;
+      if (c == '}' && depth-- == 0) {
+        ++i_;
+        break;
+      }
+      if (c == '\\' && i_ + 1 < css_.size()) out += css_[i_++];
+      out += c;
+      ++i_;
+    }
+    while (!out.empty() && space(out.back())) out.pop_back();
+  }
+
+  std::string_view css_;
+  std::size_t i_ = 0;
+};
+
+}  // namespace
+
+std::vector<CssRule> parse_css(std::string_view css) { return Parser(css).rules(false); }
+
+void write_css(const std::vector<CssRule>& rules, std::string& out) {
+  for (const auto& rule : rules) {
+    out += rule.prelude;
+    switch (rule.kind) {
+      case CssRule::Kind::style:
+        out += '{';
+        out += rule.body;
+        out += '}';
+        break;
+      case CssRule::Kind::group:
+        out += '{';
+        write_css(rule.rules, out);
+        out += '}';
+        break;
+      case CssRule::Kind::at_rule:
+        if (rule.block) {
+          out += '{';
+          out += rule.body;
+          out += '}';
+        } else {
+          out += ';';
+        }
+        break;
+    }
+  }
+}
+
+std::string at_rule_name(const CssRule& rule) {
+  std::string name;
+  if (rule.kind == CssRule::Kind::style) return name;
+  for (std::size_t i = 1; i < rule.prelude.size(); ++i) {
+    char c = rule.prelude[i];
+    if (space(c) || c == '(' || c == '{' || c == ';' || c == '"' || c == '\'') break;
+    name += lower(c);
+  }
+  return name;
+}
+
+std::string_view font_face_family(const CssRule& rule) {
+  if (at_rule_name(rule) != "font-face") return {};
+  std::string_view body = rule.body;
+  for (std::size_t i = 0; i + 11 <= body.size(); ++i) {
+    bool match = true;
+    for (std::size_t j = 0; j < 11 && match; ++j) match = lower(body[i + j]) == "font-family"[j];
+    if (!match) continue;
+    auto value = body.substr(i + 11);
+    value = value.substr(0, value.find(';'));
+    auto colon = value.find(':');
+    return colon == std::string_view::npos ? std::string_view() : unquote(value.substr(colon + 1));
+  }
+  return {};
+}
+
+std::string_view keyframes_name(const CssRule& rule) {
+  if (!at_rule_name(rule).ends_with("keyframes")) return {};
+  std::string_view prelude = rule.prelude;
+  auto gap = prelude.find(' ');
+  return gap == std::string_view::npos ? std::string_view() : unquote(prelude.substr(gap));
+}
+
+}  // namespace mt::gen
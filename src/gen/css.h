@@ -0,0 +1,42 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace mt::gen {
+
+// One rule of a stylesheet, as much as the build needs to pick rules out
+// and write them back.
+struct CssRule {
+  enum class Kind {
+    style,     // "selectors { declarations }"
+    group,     // @media, @supports, @layer or @container with nested rules
+    at_rule,   // any other at-rule (@font-face, @keyframes, @import ...), kept whole
+  };
+  Kind kind = Kind::style;
+  std::string prelude;  // selectors, or "@media screen and (...)"; whitespace collapsed
+  std::string body;     // declarations or an at-rule's block, without braces; empty for
+                        // statements such as @import
+  bool block = false;   // at-rules: whether the prelude was followed by a block
+  std::vector<CssRule> rules;  // groups: the nested rules
+};
+
+// Parses `css` into rules. Comments are dropped. The parser is forgiving
+// the way browsers are: an unterminated block ends at the end of input and
+// stray closing braces are skipped, so it never fails.
+std::vector<CssRule> parse_css(std::string_view css);
+
+// Appends `rules` as CSS, without comments or indentation.
+void write_css(const std::vector<CssRule>& rules, std::string& out);
+
+// The at-rule name of `rule`, lowercased and without the '@' ("media"),
+// or empty for a style rule.
+std::string at_rule_name(const CssRule& rule);
+
+// The family an @font-face rule defines and the name of an @keyframes
+// rule (vendor-prefixed or not), unquoted, or empty for other rules.
+std::string_view font_face_family(const CssRule& rule);
+std::string_view keyframes_name(const CssRule& rule);
+
+}  // namespace mt::gen
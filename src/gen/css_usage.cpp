@@ -0,0 +1,207 @@
+#include "gen/css_usage.h"
+
+#include <algorithm>
+
+#include "gen/css.h"
+#include "gen/text.h"
+#include "http.h"
+
+namespace mt::gen {
+
+namespace {
+
+// The selectors of a selector list, split at its top-level commas and trimmed.
+std::vector<std::string_view> split_list(std::string_view list) {
+  std::vector<std::string_view> out;
+  int depth = 0;
+  char quote = 0;
+  std::size_t start = 0;
+  auto push = [&](std::size_t end) {
+    out.push_back(trim(list.substr(start, end - start)));
+  };
+  for (std::size_t i = 0; i < list.size(); ++i) {
+    char c = list[i];
+    if (c == '\\') {
+      ++i;
+    } else if (quote != 0) {
+      if (c == quote) quote = 0;
+    } else if (c == '"' || c == '\'') {
+      quote = c;
+    } else if (c == '(' || c == '[') {
+      ++depth;
+    } else if ((c == ')' || c == ']') && depth > 0) {
+      --depth;
+    } else if (c == ',' && depth == 0) {
+      push(i);
+      start = i + 1;
+    }
+  }
+  push(list.size());
+  return out;
+}
+
+class Pruner {
+ public:
+  Pruner(const CssUsage& usage, PrunedCss& result) : usage_(usage), result_(result) {}
+
+  // Drops dead selectors and the style rules and groups they empty.
+  bool selectors(std::vector<CssRule>& rules) {
+    bool changed = false;
+    std::erase_if(rules, [&](CssRule& rule) {
+      if (rule.kind == CssRule::Kind::group) {
+        if (rule.rules.empty() || !selectors(rule.rules)) return false;
+        changed = true;
+        return rule.rules.empty();
+      }
+      if (rule.kind != CssRule::Kind::style) return false;
+      ++result_.rules;
+      auto list = split_list(rule.prelude);
+      std::string kept;
+      std::size_t live = 0;
+      for (auto selector : list) {
+        auto parsed = parse_selectors(selector);
+        if (parsed && std::none_of(parsed->begin(), parsed->end(),
+                                   [&](const Selector& s) { return usage_.may_match(s); })) {
+          continue;
+        }
+        if (live++ > 0) kept += ',';
+        kept += selector;
+      }
+      if (live == list.size()) {
+        kept_declarations_ += rule.body;
+        return false;
+      }
+      changed = true;
+      if (live == 0) {
+        dropped_declarations_ += rule.body;
+        ++result_.dropped;
+        return true;
+      }
+      rule.prelude = std::move(kept);
+      kept_declarations_ += rule.body;
+      return false;
+    });
+    return changed;
+  }
+
+  // Drops @font-face and @keyframes rules that only dropped rules used.
+  // Ones no rule in the stylesheet names are kept: inline styles or
+  // scripts may use them.
+  bool at_rules(std::vector<CssRule>& rules) {
+    bool changed = false;
+    std::erase_if(rules, [&](CssRule& rule) {
+      if (rule.kind == CssRule::Kind::group) {
+        if (rule.rules.empty() || !at_rules(rule.rules)) return false;
+        changed = true;
+        return rule.rules.empty();
+      }
+      auto name = font_face_family(rule);
+      if (name.empty()) name = keyframes_name(rule);
+      if (name.empty() || kept_declarations_.find(name) != std::string::npos ||
+          dropped_declarations_.find(name) == std::string::npos) {
+        return false;
+      }
+      changed = true;
+      return true;
+    });
+    return changed;
+  }
+
+ private:
+  const CssUsage& usage_;
+  PrunedCss& result_;
+  std::string kept_declarations_, dropped_declarations_;
+};
+
+}  // namespace
+
+void CssUsage::add_page(const std::vector<std::string>& names) {
+  auto page = pages_++;
+  for (const auto& name : names) {
+    auto& bits = pages_by_name_[name];
+    bits.resize(page / 64 + 1);
+    bits[page / 64] |= std::uint64_t{1} << (page % 64);
+  }
+}
+
+void CssUsage::add_everywhere(std::string_view name) { everywhere_.emplace(name); }
+
+bool CssUsage::may_match(const Selector& selector) const {
+  std::vector<const std::vector<std::uint64_t>*> sets;
+  std::string name;
+  auto require = [&](char prefix, std::string_view value) {
+    name.clear();
+    if (prefix != 0) name += prefix;
+    name += value;
+    if (everywhere_.contains(name)) return true;
+    auto found = pages_by_name_.find(name);
+    if (found == pages_by_name_.end()) return false;
+    sets.push_back(&found->second);
+    return true;
+  };
+  for (const auto& c : selector.compounds) {
+    if (!c.tag.empty() && !require(0, c.tag)) return false;
+    if (!c.id.empty() && !require('#', c.id)) return false;
+    for (const auto& cls : c.classes) {
+      if (!require('.', cls)) return false;
+    }
+  }
+  if (sets.empty()) return true;
+  std::size_t words = SIZE_MAX;
+  for (const auto* bits : sets) words = std::min(words, bits->size());
+  for (std::size_t w = 0; w < words; ++w) {
+    auto all = ~std::uint64_t{0};
+    for (const auto* bits : sets) all &= (*bits)[w];
+    if (all != 0) return true;
+  }
+  return false;
+}
+
+std::vector<std::string> page_names(std::string_view html) {
+  std::vector<std::string> names;
+  auto doc = parse_document(html);
+  for (const auto& e : doc.elements) {
+    names.push_back(e.tag);
+    if (!e.id.empty()) names.push_back(std::string("#").append(e.id));
+    for (const auto& c : e.classes) names.push_back(std::string(".").append(c));
+  }
+  for (auto i = find_ci(html, "<script", 0); i != std::string_view::npos; i = find_ci(html, "<script", i)) {
+    auto open_end = html.find('>', i);
+    if (open_end == std::string_view::npos) break;
+    auto close = find_ci(html, "</script", open_end);
+    if (close == std::string_view::npos) close = html.size();
+    script_names(html.substr(open_end + 1, close - open_end - 1), names);
+    i = close;
+  }
+  std::sort(names.begin(), names.end());
+  names.erase(std::unique(names.begin(), names.end()), names.end());
+  return names;
+}
+
+void script_names(std::string_view script, std::vector<std::string>& out) {
+  std::size_t i = 0;
+  while (i < script.size()) {
+    if (!ident(script[i])) {
+      ++i;
+      continue;
+    }
+    auto start = i;
+    while (i < script.size() && ident(script[i])) ++i;
+    if (script[start] >= '0' && script[start] <= '9') continue;
+    auto word = script.substr(start, i - start);
+    out.push_back(std::string(".").append(word));
+    out.push_back(std::string("#").append(word));
+  }
+}
+
+PrunedCss prune_css(std::string_view css, const CssUsage& usage) {
+  PrunedCss result;
+  auto rules = parse_css(css);
+  Pruner pruner(usage, result);
+  bool changed = pruner.selectors(rules);
+  changed = pruner.at_rules(rules) || changed;
+  if (changed) write_css(rules, result.css.emplace());
+  return result;
+}
+
+}  // namespace mt::gen
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "gen/selector.h"
+
+namespace mt::gen {
+
+// Which tag names, classes and ids appear on which pages of a site, as one
+// bitset over pages per name. A selector can only match on a page that has
+// every tag, class and id it names, and those pages are the AND of their
+// bitsets, so each selector costs a few word-wide ANDs whatever the number
+// of pages. Names are spelled as in selectors: "div", ".class", "#id".
+class CssUsage {
+ public:
+  // Adds the next page, with the names page_names() found on it.
+  void add_page(const std::vector<std::string>& names);
+
+  // Treats `name` as present on every page, such as a class a script may
+  // add at run time.
+  void add_everywhere(std::string_view name);
+
+  std::size_t pages() const { return pages_; }
+
+  // Whether some page has every tag, class and id `selector` names, in any
+  // of its compounds. Attributes, pseudo-classes, :not() and how elements
+  // nest are not considered, so this errs towards true.
+  bool may_match(const Selector& selector) const;
+
+ private:
+  std::unordered_map<std::string, std::vector<std::uint64_t>> pages_by_name_;
+  std::unordered_set<std::string> everywhere_;
+  std::size_t pages_ = 0;
+};
+
+// The tag names, classes and ids of the elements in `html`, sorted and
+// without duplicates. Identifier-like words inside its <script> elements
+// count as classes and ids too (see script_names()).
+std::vector<std::string> page_names(std::string_view html);
+
+// Appends each identifier-like word in `script` (letters, digits, '-' and
+// '_', not starting with a digit) as a class and as an id. Scripts that
+// build class names out of pieces are not covered.
+void script_names(std::string_view script, std::vector<std::string>& out);
+
+struct PrunedCss {
+  std::optional<std::string> css;  // nullopt if nothing was dropped
+  std::size_t rules = 0;           // style rules in the input
+  std::size_t dropped = 0;         // style rules dropped entirely
+};
+
+// Drops from `css` the selectors `usage` says no page can match, the style
+// rules left with none and the @media and other groups left empty. Then it
+// drops the @font-face and @keyframes rules that only dropped rules named;
+// ones no rule names are kept, since inline styles may use them. Selectors
+// that do not parse are kept. When something was dropped, the stylesheet
+// is written back without comments or indentation (see write_css()).
+PrunedCss prune_css(std::string_view css, const CssUsage& usage);
+
+}  // namespace mt::gen
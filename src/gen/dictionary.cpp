@@ -0,0 +1,116 @@
+#include "gen/dictionary.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <unordered_map>
+#include <vector>
+
+namespace mt::gen {
+
+namespace {
+
+constexpr std::size_t kDmer = 8;       // substring length that is scored
+constexpr std::size_t kSegment = 256;  // bytes kept per epoch
+
+struct DmerStats {
+  std::uint32_t samples = 0;      // number of samples containing the d-mer
+  std::uint32_t last_sample = 0;  // 1-based id of the last sample counted
+  bool covered = false;           // already part of a chosen segment
+};
+
+std::uint64_t dmer_at(const char* p) {
+  std::uint64_t v;
+  std::memcpy(&v, p, sizeof v);
+  return v;
+}
+
+struct Segment {
+  std::string_view bytes;
+  std::uint64_t score;
+};
+
+}  // namespace
+
+std::string train_dictionary(std::span<const std::string_view> samples, std::size_t max_size) {
+  std::unordered_map<std::uint64_t, DmerStats> stats;
+  std::size_t total = 0;
+  for (std::size_t s = 0; s < samples.size(); ++s) {
+    const auto& sample = samples[s];
+    total += sample.size();
+    for (std::size_t i = 0; i + kDmer <= sample.size(); ++i) {
+      auto& st = stats[dmer_at(sample.data() + i)];
+      if (st.last_sample != s + 1) {
+        st.last_sample = static_cast<std::uint32_t>(s + 1);
+        ++st.samples;
+      }
+    }
+  }
+  // With a single page, every d-mer "repeats" on the next visit to it.
+  std::uint32_t min_samples = samples.size() > 1 ? 2 : 1;
+
+  std::size_t segments = std::max<std::size_t>(1, max_size / kSegment);
+  std::size_t epoch = std::max(kSegment, total / segments);
+  std::vector<Segment> chosen;
+  std::vector<std::uint64_t> weight;
+
+  // Epochs are contiguous slices of each sample in turn; a segment never
+  // straddles two samples.
+  for (const auto& sample : samples) {
+    for (std::size_t begin = 0; begin < sample.size(); begin += epoch) {
+      auto slice = sample.substr(begin, epoch + kSegment - 1);
+      if (slice.size() < kDmer) continue;
+      auto positions = slice.size() - kDmer + 1;
+      weight.assign(positions, 0);
+      for (std::size_t i = 0; i < positions; ++i) {
+        const auto& st = stats[dmer_at(slice.data() + i)];
+        if (!st.covered && st.samples >= min_samples) weight[i] = st.samples;
+      }
+      // Sliding sum of the weights of the d-mers that fit in a segment.
+      auto window = std::min(positions, kSegment - kDmer + 1);
+      std::uint64_t sum = 0, best = 0;
+      std::size_t best_at = 0;
+      for (std::size_t i = 0; i < positions; ++i) {
+        sum += weight[i];
+        if (i >= window) sum -= weight[i - window];
+        if (i + 1 >= window && sum > best && i + 1 - window < std::min(epoch, slice.size())) {
+          best = sum;
+          best_at = i + 1 - window;
+        }
+      }
+      if (best == 0) continue;
+
+      // Keep only the runs of shared d-mers, so page-specific text inside
+      // the window does not take up dictionary space. Short gaps are kept
+      // to avoid splitting a match into two references.
+      for (std::size_t i = best_at, end = best_at + window; i < end;) {
+        if (weight[i] == 0) {
+          ++i;
+          continue;
+        }
+        auto run_end = i + 1;
+        for (std::size_t gap = 0; run_end < end && gap < 2 * kDmer; ++run_end) {
+          gap = weight[run_end] == 0 ? gap + 1 : 0;
+        }
+        while (weight[run_end - 1] == 0) --run_end;
+        auto bytes = slice.substr(i, run_end - 1 - i + kDmer);
+        std::uint64_t score = 0;
+        for (auto j = i; j < run_end; ++j) score += weight[j];
+        for (std::size_t j = 0; j + kDmer <= bytes.size(); ++j) stats[dmer_at(bytes.data() + j)].covered = true;
+        chosen.push_back(Segment{bytes, score});
+        i = run_end;
+      }
+    }
+  }
+
+  // Keep the highest-scoring segments, best last.
+  std::stable_sort(chosen.begin(), chosen.end(), [](const Segment& a, const Segment& b) { return a.score > b.score; });
+  std::size_t keep = 0, size = 0;
+  while (keep < chosen.size() && size + chosen[keep].bytes.size() <= max_size) size += chosen[keep++].bytes.size();
+  std::string dict;
+  dict.reserve(size);
+  for (std::size_t i = keep; i-- > 0;) dict.append(chosen[i].bytes);
+  return dict;
+}
+
+}  // namespace mt::gen
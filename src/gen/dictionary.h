@@ -0,0 +1,20 @@
+#pragma once
+
+#include <cstddef>
+#include <span>
+#include <string>
+#include <string_view>
+
+namespace mt::gen {
+
+// Trains a raw shared dictionary of at most `max_size` bytes from `samples`.
+//
+// COVER-style segment selection: the samples are split into one epoch per
+// dictionary segment, and from each epoch the k-byte segment whose 8-byte
+// substrings occur in the most samples is kept. Substrings already covered
+// stop scoring, so the segments are complementary. The best segments are
+// placed last, where matches are cheapest to reference. Returns an empty
+// string when nothing repeats across samples.
+std::string train_dictionary(std::span<const std::string_view> samples, std::size_t max_size);
+
+}  // namespace mt::gen
@@ -0,0 +1,21 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+
+namespace mt::gen {
+
+// UTF-8 expansion of the HTML named character reference `name` (without
+// the '&' and ';'), or an empty view if there is no such reference.
+std::string_view html_entity(std::string_view name);
+
+// Appends the UTF-8 encoding of `cp`. NUL, surrogates and values past
+// U+10FFFF become U+FFFD.
+void append_utf8(std::string& out, char32_t cp);
+
+// Length of the character reference (&name; &#10; &#x0a;) at s[i] == '&',
+// appending its expansion to `out`, or 0 if there is none.
+std::size_t decode_character_reference(std::string_view s, std::size_t i, std::string& out);
+
+}  // namespace mt::gen
@@ -0,0 +1,17 @@
+#pragma once
+
+#include <filesystem>
+#include <string>
+#include <string_view>
+
+namespace mt::gen {
+
+// Reads a whole file. Throws std::runtime_error.
+std::string read_file(const std::filesystem::path& path);
+
+// Writes `data` to a temporary sibling and renames it over `path`, creating
+// parent directories as needed. A running server holding the old file open
+// keeps serving the old bytes. Throws std::runtime_error.
+void write_file_atomic(const std::filesystem::path& path, std::string_view data);
+
+}  // namespace mt::gen
@@ -0,0 +1,261 @@
+#include "gen/fingerprint.h"
+
+#include <algorithm>
+#include <filesystem>
+
+#include "gen/text.h"
+#include "hash.h"
+#include "http.h"
+
+namespace mt::gen {
+
+namespace {
+
+bool starts_with_ci(std::string_view s, std::size_t at, std::string_view prefix) {
+  return s.size() - at >= prefix.size() && http::iequals(s.substr(at, prefix.size()), prefix);
+}
+
+// Trims HTML whitespace from [pos, pos + len) and reports what remains.
+template <class Visit>
+void visit_trimmed(std::string_view text, std::size_t pos, std::size_t len, Visit&& visit) {
+  while (len > 0 && space(text[pos])) ++pos, --len;
+  while (len > 0 && space(text[pos + len - 1])) --len;
+  if (len > 0) visit(pos, len);
+}
+
+// Calls visit(offset, length) for the URL of every url() and @import in
+// `css`. Offsets are relative to `base`, the start of `css` within the text
+// being rewritten.
+template <class Visit>
+void scan_css(std::string_view css, std::size_t base, Visit& visit) {
+  std::size_t i = 0;
+  while (i < css.size()) {
+    char c = css[i];
+    if (c == '/' && i + 1 < css.size() && css[i + 1] == '*') {
+      auto end = css.find("*/", i + 2);
+      if (end == std::string_view::npos) return;
+      i = end + 2;
+    } else if (c == '"' || c == '\'') {  // a string that is not a URL
+      for (++i; i < css.size() && css[i] != c; ++i) {
+        if (css[i] == '\\') ++i;
+      }
+      ++i;
+    } else if (starts_with_ci(css, i, "url(") && (i == 0 || !ident(css[i - 1]))) {
+      auto j = i + 4;
+      while (j < css.size() && space(css[j])) ++j;
+      char quote = j < css.size() && (css[j] == '"' || css[j] == '\'') ? css[j] : 0;
+      if (quote) ++j;
+      auto end = css.find(quote ? quote : ')', j);
+      if (end == std::string_view::npos) return;
+      visit_trimmed(css, j, end - j, [&](std::size_t pos, std::size_t len) { visit(base + pos, len); });
+      i = end + 1;
+    } else if (starts_with_ci(css, i, "@import")) {
+      auto j = i + 7;
+      while (j < css.size() && space(css[j])) ++j;
+      if (j < css.size() && (css[j] == '"' || css[j] == '\'')) {
+        auto end = css.find(css[j], j + 1);
+        if (end == std::string_view::npos) return;
+        if (end > j + 1) visit(base + j + 1, end - j - 1);
+        j = end + 1;
+      }
+      i = j;  // a url() form is picked up on the next iteration
+    } else {
+      ++i;
+    }
+  }
+}
+
+// Calls visit(offset, length) for every URL-bearing attribute value in
+// `html`, and for the URLs inside <style> blocks and style attributes.
+template <class Visit>
+void scan_html(std::string_view html, Visit& visit) {
+  std::size_t i = 0;
+  while ((i = html.find('<', i)) != std::string_view::npos) {
+    if (html.substr(i).starts_with("<!--")) {
+      auto end = html.find("-->", i + 4);
+      if (end == std::string_view::npos) return;
+      i = end + 3;
+      continue;
+    }
+    auto j = i + 1;
+    while (j < html.size() && ident(html[j])) ++j;
+    auto tag = html.substr(i + 1, j - i - 1);
+    if (tag.empty()) {  // end tag, <!DOCTYPE ...> or a stray '<'
+      i = j;
+      continue;
+    }
+
+    for (;;) {
+      while (j < html.size() && (space(html[j]) || html[j] == '/')) ++j;
+      if (j >= html.size()) return;
+      if (html[j] == '>') {
+        ++j;
+        break;
+      }
+      auto name_start = j;
+      while (j < html.size() && !space(html[j]) && html[j] != '=' && html[j] != '>' && html[j] != '/') ++j;
+      auto name = html.substr(name_start, j - name_start);
+      while (j < html.size() && space(html[j])) ++j;
+      if (j >= html.size() || html[j] != '=') continue;
+      ++j;
+      while (j < html.size() && space(html[j])) ++j;
+      std::size_t value_start, value_end;
+      if (j < html.size() && (html[j] == '"' || html[j] == '\'')) {
+        value_start = j + 1;
+        value_end = html.find(html[j], value_start);
+        if (value_end == std::string_view::npos) return;
+        j = value_end + 1;
+      } else {
+        value_start = j;
+        while (j < html.size() && !space(html[j]) && html[j] != '>') ++j;
+        value_end = j;
+      }
+      auto value = html.substr(value_start, value_end - value_start);
+
+      if (http::iequals(name, "href") || http::iequals(name, "src") || http::iequals(name, "poster")) {
+        visit_trimmed(html, value_start, value.size(), visit);
+      } else if (http::iequals(name, "srcset") || http::iequals(name, "imagesrcset")) {
+        // "url [descriptor], url [descriptor], ..."
+        std::size_t k = 0;
+        while (k < value.size()) {
+          while (k < value.size() && (space(value[k]) || value[k] == ',')) ++k;
+          auto url_start = k;
+          while (k < value.size() && !space(value[k])) ++k;
+          auto url_end = k;
+          if (url_end > url_start && value[url_end - 1] == ',') --url_end;
+          if (url_end > url_start) visit(value_start + url_start, url_end - url_start);
+          while (k < value.size() && value[k] != ',') ++k;
+        }
+      } else if (http::iequals(name, "style")) {
+        scan_css(value, value_start, visit);
+      }
+    }
+
+    if (http::iequals(tag, "style")) {
+      auto end = find_tag(html, "</style", j);
+      scan_css(html.substr(j, end - j), j, visit);
+      j = end;
+    } else if (http::iequals(tag, "script")) {
+      j = find_tag(html, "</script", j);
+    }
+    i = j;
+  }
+}
+
+// `url` with its last path segment replaced by the file name of `target`;
+// the directory part, query and fragment are kept as written.
+std::string renamed_url(std::string_view url, std::string_view target) {
+  auto path_end = std::min(url.find_first_of("?#"), url.size());
+  auto slash = url.substr(0, path_end).rfind('/');
+  auto name_start = slash == std::string_view::npos ? 0 : slash + 1;
+  auto target_slash = target.rfind('/');
+  auto name = target_slash == std::string_view::npos ? target : target.substr(target_slash + 1);
+  std::string out(url.substr(0, name_start));
+  out += name;
+  out += url.substr(path_end);
+  return out;
+}
+
+template <class Scan>
+std::string rewrite(std::string_view text, std::string_view rel, const Renames& renames, Scan scan) {
+  std::string out;
+  out.reserve(text.size() + 64);
+  std::size_t copied = 0;
+  auto visit = [&](std::size_t pos, std::size_t len) {
+    auto url = text.substr(pos, len);
+    auto found = renames.find(resolve_url(url, rel));
+    if (found == renames.end()) return;
+    out.append(text, copied, pos - copied);
+    out += renamed_url(url, found->second);
+    copied = pos + len;
+  };
+  scan(text, visit);
+  out.append(text, copied);
+  return out;
+}
+
+template <class Scan>
+std::vector<std::string> references(std::string_view text, std::string_view rel, Scan scan) {
+  std::vector<std::string> refs;
+  auto visit = [&](std::size_t pos, std::size_t len) {
+    if (auto target = resolve_url(text.substr(pos, len), rel); !target.empty()) refs.push_back(std::move(target));
+  };
+  scan(text, visit);
+  return refs;
+}
+
+}  // namespace
+
+bool fingerprinted_type(std::string_view content_type) {
+  if (content_type.starts_with("image/")) return content_type != "image/x-icon";
+  return content_type.starts_with("text/css") || content_type.starts_with("text/javascript") ||
+         content_type.starts_with("font/");
+}
+
+std::string fingerprint_name(std::string_view rel, std::uint64_t hash) {
+  auto slash = rel.rfind('/');
+  auto dot = rel.rfind('.');
+  if (dot == std::string_view::npos || (slash != std::string_view::npos && dot < slash)) dot = rel.size();
+  std::string out(rel.substr(0, dot));
+  out += '.';
+  out += hex64(hash).substr(0, 10);
+  out += rel.substr(dot);
+  return out;
+}
+
+std::string resolve_url(std::string_view url, std::string_view rel) {
+  auto path = url.substr(0, url.find_first_of("?#"));
+  if (path.empty() || path.starts_with("//")) return {};
+  auto colon = path.find(':');
+  if (colon != std::string_view::npos && colon < path.find('/')) return {};  // has a scheme
+
+  std::string joined;
+  if (path.front() == '/') {
+    joined = path.substr(1);
+  } else {
+    auto slash = rel.rfind('/');
+    if (slash != std::string_view::npos) joined = rel.substr(0, slash + 1);
+    joined += path;
+  }
+  auto normal = std::filesystem::path(joined).lexically_normal().generic_string();
+  if (normal.empty() || normal == "." || normal.starts_with("..")) return {};
+  return normal;
+}
+
+std::string rewrite_html(std::string_view html, std::string_view rel, const Renames& renames) {
+  return rewrite(html, rel, renames, [](std::string_view text, auto& visit) { scan_html(text, visit); });
+}
+
+std::string rewrite_css(std::string_view css, std::string_view rel, const Renames& renames) {
+  return rewrite(css, rel, renames, [](std::string_view text, auto& visit) { scan_css(text, 0, visit); });
+}
+
+std::string rebase_css(std::string_view css, std::string_view rel, const Renames& renames) {
+  std::string out;
+  out.reserve(css.size() + 64);
+  std::size_t copied = 0;
+  auto visit = [&](std::size_t pos, std::size_t len) {
+    auto url = css.substr(pos, len);
+    auto target = resolve_url(url, rel);
+    if (target.empty()) return;
+    auto found = renames.find(target);
+    out.append(css, copied, pos - copied);
+    out += '/';
+    out += found == renames.end() ? target : found->second;
+    out += url.substr(std::min(url.find_first_of("?#"), url.size()));
+    copied = pos + len;
+  };
+  scan_css(css, 0, visit);
+  out.append(css, copied);
+  return out;
+}
+
+std::vector<std::string> html_references(std::string_view html, std::string_view rel) {
+  return references(html, rel, [](std::string_view text, auto& visit) { scan_html(text, visit); });
+}
+
+std::vector<std::string> css_references(std::string_view css, std::string_view rel) {
+  return references(css, rel, [](std::string_view text, auto& visit) { scan_css(text, 0, visit); });
+}
+
+}  // namespace mt::gen
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace mt::gen {
+
+// Site-relative path of an asset -> its fingerprinted path, e.g.
+// "css/site.css" -> "css/site.3f9a0c41d2.css".
+using Renames = std::map<std::string, std::string, std::less<>>;
+
+// True for content types published under a content-hashed name: stylesheets,
+// scripts, fonts and images other than icons (browsers fetch /favicon.ico
+// by its fixed name).
+bool fingerprinted_type(std::string_view content_type);
+
+// "dir/name.ext" -> "dir/name.<10 hex digits of hash>.ext".
+std::string fingerprint_name(std::string_view rel, std::uint64_t hash);
+
+// Site-relative path that `url`, found in the file at `rel`, refers to.
+// Returns an empty string for URLs that leave the site (a scheme or "//"),
+// fragments and anything resolving above the root.
+std::string resolve_url(std::string_view url, std::string_view rel);
+
+// Rewrites every local URL in an HTML document that names a renamed asset:
+// href, src, srcset, imagesrcset and poster attributes, plus url() and
+// @import in <style> blocks and style attributes. This is a single forward
+// pass over the bytes, and everything else is copied through unchanged.
+// Script contents and comments are not touched.
+std::string rewrite_html(std::string_view html, std::string_view rel, const Renames& renames);
+
+// Same for url() and @import references in a stylesheet.
+std::string rewrite_css(std::string_view css, std::string_view rel, const Renames& renames);
+
+// Same as rewrite_css(), but every local URL also becomes root-relative
+// ("/img/a.png"), so the CSS means the same wherever it is inlined.
+std::string rebase_css(std::string_view css, std::string_view rel, const Renames& renames);
+
+// Site-relative paths a stylesheet references, so stylesheets can be
+// fingerprinted after the ones they import.
+std::vector<std::string> css_references(std::string_view css, std::string_view rel);
+
+// Site-relative paths an HTML document references wherever rewrite_html()
+// would rewrite them, so a build can tell which renames a page depends on
+// without rereading it.
+std::vector<std::string> html_references(std::string_view html, std::string_view rel);
+
+}  // namespace mt::gen
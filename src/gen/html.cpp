@@ -0,0 +1,606 @@
+#include "gen/html.h"
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstdint>
+#include <cstring>
+#include <iterator>
+#include <stdexcept>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+#include "gen/text.h"
+#include "http.h"
+#include "perfect_hash.h"
+
+namespace mt::gen {
+
+namespace {
+
+// Tag properties.
+enum : unsigned {
+  kVoid = 1u << 0,          // no content and no end tag
+  kBlock = 1u << 1,         // whitespace next to the tag does not render
+  kOptionalEnd = 1u << 2,   // end tag may be implied (see implied_by())
+  kClosesP = 1u << 3,       // start tag implies </p>
+  kRawText = 1u << 4,       // content is not markup; runs to the matching end tag
+  kPreformatted = 1u << 5,  // whitespace in the content is significant
+};
+
+struct TagInfo {
+  std::string_view name;
+  unsigned flags;
+};
+
+constexpr unsigned kSection = kBlock | kClosesP;  // block container that ends an open <p>
+
+constexpr TagInfo kTags[] = {
+    {"html", kBlock},
+    {"head", kBlock},
+    {"body", kBlock},
+    {"title", kBlock | kRawText},
+    {"meta", kVoid | kBlock},
+    {"link", kVoid | kBlock},
+    {"base", kVoid | kBlock},
+    {"style", kBlock | kRawText},
+    {"script", kRawText},
+    {"noscript", 0},
+    {"template", kBlock},
+    {"div", kSection},
+    {"p", kSection | kOptionalEnd},
+    {"ul", kSection},
+    {"ol", kSection},
+    {"menu", kSection},
+    {"li", kBlock | kOptionalEnd},
+    {"dl", kSection},
+    {"dt", kBlock | kOptionalEnd},
+    {"dd", kBlock | kOptionalEnd},
+    {"table", kSection},
+    {"caption", kBlock},
+    {"colgroup", kBlock},
+    {"col", kVoid | kBlock},
+    {"thead", kBlock | kOptionalEnd},
+    {"tbody", kBlock | kOptionalEnd},
+    {"tfoot", kBlock | kOptionalEnd},
+    {"tr", kBlock | kOptionalEnd},
+    {"td", kBlock | kOptionalEnd},
+    {"th", kBlock | kOptionalEnd},
+    {"section", kSection},
+    {"article", kSection},
+    {"aside", kSection},
+    {"header", kSection},
+    {"footer", kSection},
+    {"nav", kSection},
+    {"main", kSection},
+    {"address", kSection},
+    {"blockquote", kSection},
+    {"details", kSection},
+    {"summary", kBlock},
+    {"figure", kSection},
+    {"figcaption", kSection},
+    {"fieldset", kSection},
+    {"legend", kBlock},
+    {"form", kSection},
+    {"h1", kSection},
+    {"h2", kSection},
+    {"h3", kSection},
+    {"h4", kSection},
+    {"h5", kSection},
+    {"h6", kSection},
+    {"hgroup", kSection},
+    {"hr", kSection | kVoid},
+    {"pre", kSection | kPreformatted},
+    {"select", 0},
+    {"option", kBlock | kOptionalEnd},  // whitespace inside <select> is not rendered
+    {"optgroup", kBlock | kOptionalEnd},
+    {"rt", kOptionalEnd},
+    {"rp", kOptionalEnd},
+    {"textarea", kRawText | kPreformatted},
+    {"br", kVoid},
+    {"img", kVoid},
+    {"input", kVoid},
+    {"area", kVoid},
+    {"embed", kVoid},
+    {"source", kVoid},
+    {"track", kVoid},
+    {"wbr", kVoid},
+};
+
+constexpr auto kTagNames = [] {
+  std::array<std::string_view, std::size(kTags)> names{};
+  for (std::size_t i = 0; i < names.size(); ++i) names[i] = kTags[i].name;
+  return names;
+}();
+
+constexpr auto kTagTable = PerfectHash<std::size(kTagNames)>::build(kTagNames);
+
+// Index of a tag in kTagNames, for use in case labels.
+consteval int tag(std::string_view name) {
+  for (std::size_t i = 0; i < std::size(kTagNames); ++i) {
+    if (kTagNames[i] == name) return static_cast<int>(i);
+  }
+  throw std::logic_error("unknown tag");
+}
+
+struct TagName {
+  std::string_view raw;  // as written
+  int id = -1;           // index into kTagNames, or -1 for unknown tags
+  unsigned flags = 0;
+};
+
+TagName classify(std::string_view raw) {
+  TagName t{raw};
+  char lower[16];
+  if (raw.empty() || raw.size() > sizeof lower) return t;
+  for (std::size_t i = 0; i < raw.size(); ++i) {
+    char c = raw[i];
+    lower[i] = (c >= 'A' && c <= 'Z') ? static_cast<char>(c | 0x20) : c;
+  }
+  t.id = kTagTable.find(std::string_view(lower, raw.size()), kTagNames);
+  if (t.id >= 0) t.flags = kTags[t.id].flags;
+  return t;
+}
+
+// "<name>" or "</name>", for messages.
+std::string start_tag_text(std::string_view name) {
+  std::string s = "<";
+  s += name;
+  s += '>';
+  return s;
+}
+
+std::string end_tag_text(std::string_view name) {
+  std::string s = "</";
+  s += name;
+  s += '>';
+  return s;
+}
+
+bool same_tag(const TagName& a, const TagName& b) {
+  return (a.id >= 0 || b.id >= 0) ? a.id == b.id : http::iequals(a.raw, b.raw);
+}
+
+// True when an open `open` element is implicitly closed by a start tag `next`.
+bool implied_by(int open, const TagName& next) {
+  switch (open) {
+    case tag("li"):
+      return next.id == tag("li");
+    case tag("dt"):
+    case tag("dd"):
+      return next.id == tag("dt") || next.id == tag("dd");
+    case tag("p"):
+      return (next.flags & kClosesP) != 0;
+    case tag("option"):
+      return next.id == tag("option") || next.id == tag("optgroup");
+    case tag("optgroup"):
+      return next.id == tag("optgroup");
+    case tag("tr"):
+      return next.id == tag("tr") || next.id == tag("tbody") || next.id == tag("thead") || next.id == tag("tfoot");
+    case tag("td"):
+    case tag("th"):
+      return next.id == tag("td") || next.id == tag("th") || next.id == tag("tr") || next.id == tag("tbody") ||
+             next.id == tag("thead") || next.id == tag("tfoot");
+    case tag("thead"):
+    case tag("tbody"):
+    case tag("tfoot"):
+      return next.id == tag("tbody") || next.id == tag("tfoot");
+    case tag("rt"):
+    case tag("rp"):
+      return next.id == tag("rt") || next.id == tag("rp");
+    default:
+      return false;
+  }
+}
+
+// True when the end tag of `closed` may be left out because what follows
+// is the end tag of its parent (HTML's "no more content in the parent").
+bool omittable_before_parent_end(int closed, unsigned parent_flags) {
+  switch (closed) {
+    case tag("dt"):
+    case tag("thead"):
+      return false;
+    case tag("p"):  // not inside a, audio, video, ...; block parents are safe
+      return (parent_flags & kBlock) != 0;
+    default:
+      return true;
+  }
+}
+
+// --- scanning kernels ------------------------------------------------------
+
+// First byte that is whitespace (or another control byte), '<' or '&'.
+const char* scan_text_scalar(const char* p, const char* end) {
+  for (; p < end; ++p) {
+    auto c = static_cast<unsigned char>(*p);
+    if (c <= 0x20 || c == '<' || c == '&') return p;
+  }
+  return end;
+}
+
+// First '>', '"' or '\''.
+const char* scan_tag_scalar(const char* p, const char* end) {
+  for (; p < end; ++p) {
+    if (*p == '>' || *p == '"' || *p == '\'') return p;
+  }
+  return end;
+}
+
+#if defined(__x86_64__)
+
+[[gnu::target("avx2")]] const char* scan_text_avx2(const char* p, const char* end) {
+  const auto blank = _mm256_set1_epi8(0x20);
+  const auto lt = _mm256_set1_epi8('<');
+  const auto amp = _mm256_set1_epi8('&');
+  for (; end - p >= 32; p += 32) {
+    auto v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+    auto hit = _mm256_or_si256(_mm256_cmpeq_epi8(_mm256_max_epu8(v, blank), blank),  // v <= 0x20
+                               _mm256_or_si256(_mm256_cmpeq_epi8(v, lt), _mm256_cmpeq_epi8(v, amp)));
+    if (auto bits = static_cast<unsigned>(_mm256_movemask_epi8(hit))) return p + std::countr_zero(bits);
+  }
+  return scan_text_scalar(p, end);
+}
+
+[[gnu::target("avx2")]] const char* scan_tag_avx2(const char* p, const char* end) {
+  const auto gt = _mm256_set1_epi8('>');
+  const auto dq = _mm256_set1_epi8('"');
+  const auto sq = _mm256_set1_epi8('\'');
+  for (; end - p >= 32; p += 32) {
+    auto v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+    auto quote = _mm256_or_si256(_mm256_cmpeq_epi8(v, dq), _mm256_cmpeq_epi8(v, sq));
+    auto hit = _mm256_or_si256(_mm256_cmpeq_epi8(v, gt), quote);
+    if (auto bits = static_cast<unsigned>(_mm256_movemask_epi8(hit))) return p + std::countr_zero(bits);
+  }
+  return scan_tag_scalar(p, end);
+}
+
+// PCMPESTRI in ranges mode matches [0x00, 0x20], '<' and '&' in one step.
+[[gnu::target("sse4.2")]] const char* scan_text_sse42(const char* p, const char* end) {
+  const auto ranges = _mm_setr_epi8(0x00, 0x20, '<', '<', '&', '&', 0, 0, 0, 0, 0, 0, 0, 0, 0, 0);
+  for (; end - p >= 16; p += 16) {
+    auto v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+    int i = _mm_cmpestri(ranges, 6, v, 16, _SIDD_UBYTE_OPS | _SIDD_CMP_RANGES | _SIDD_LEAST_SIGNIFICANT);
+    if (i < 16) return p + i;
+  }
+  return scan_text_scalar(p, end);
+}
+
+[[gnu::target("sse4.2")]] const char* scan_tag_sse42(const char* p, const char* end) {
+  const auto set = _mm_setr_epi8('>', '"', '\'', 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0);
+  for (; end - p >= 16; p += 16) {
+    auto v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+    int i = _mm_cmpestri(set, 3, v, 16, _SIDD_UBYTE_OPS | _SIDD_CMP_EQUAL_ANY | _SIDD_LEAST_SIGNIFICANT);
+    if (i < 16) return p + i;
+  }
+  return scan_tag_scalar(p, end);
+}
+
+#endif
+
+struct Kernels {
+  const char* (*text)(const char*, const char*);
+  const char* (*tag)(const char*, const char*);
+  std::string_view name;
+};
+
+Kernels pick_kernels() {
+#if defined(__x86_64__)
+  if (__builtin_cpu_supports("avx2")) return {scan_text_avx2, scan_tag_avx2, "avx2"};
+  if (__builtin_cpu_supports("sse4.2")) return {scan_text_sse42, scan_tag_sse42, "sse4.2"};
+#endif
+  return {scan_text_scalar, scan_tag_scalar, "scalar"};
+}
+
+const Kernels& kernels() {
+  static const Kernels k = pick_kernels();
+  return k;
+}
+
+// --- the pass --------------------------------------------------------------
+
+struct Element {
+  Element* parent;
+  TagName name;
+  std::size_t offset;  // of its '<'
+};
+
+class Pass {
+ public:
+  Pass(std::string_view src, std::string* out, Arena& arena)
+      : src_(src), end_(src.data() + src.size()), out_(out), arena_(arena), k_(kernels()) {}
+
+  std::vector<HtmlError> run() {
+    if (out_ != nullptr) {
+      out_->clear();
+      out_->reserve(src_.size());
+    }
+    const char* p = src_.data();
+    while (p < end_) p = (*p == '<' && starts_markup(p)) ? markup(p) : text(p);
+
+    std::vector<Element*> unclosed;
+    for (auto* e = top_; e != nullptr; e = e->parent) {
+      if (!(e->name.flags & kOptionalEnd)) unclosed.push_back(e);
+    }
+    for (auto it = unclosed.rbegin(); it != unclosed.rend(); ++it) {
+      error((*it)->offset, start_tag_text((*it)->name.raw) + " is never closed");
+    }
+    std::stable_sort(errors_.begin(), errors_.end(), [](const HtmlError& a, const HtmlError& b) {
+      return a.line != b.line ? a.line < b.line : a.column < b.column;
+    });
+    return std::move(errors_);
+  }
+
+ private:
+  bool starts_markup(const char* p) const {
+    if (end_ - p < 2) return false;
+    char c = p[1];
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '/' || c == '!' || c == '?';
+  }
+
+  std::size_t offset(const char* p) const { return static_cast<std::size_t>(p - src_.data()); }
+
+  std::string where(std::size_t off) const {
+    auto e = location(off);
+    return std::to_string(e.line) + ":" + std::to_string(e.column);
+  }
+
+  HtmlError location(std::size_t off) const {
+    auto head = src_.substr(0, off);
+    HtmlError e;
+    e.line = 1 + static_cast<std::size_t>(std::count(head.begin(), head.end(), '\n'));
+    auto nl = head.rfind('\n');
+    e.column = off - (nl == std::string_view::npos ? 0 : nl + 1) + 1;
+    return e;
+  }
+
+  void error(std::size_t off, std::string message) {
+    auto e = location(off);
+    e.message = std::move(message);
+    errors_.push_back(std::move(e));
+  }
+
+  void emit(const char* p, const char* q) {
+    if (out_ != nullptr) out_->append(p, static_cast<std::size_t>(q - p));
+  }
+
+  std::string_view name_at(const char* p) const {
+    const char* q = p;
+    while (q < end_ && !space(*q) && *q != '/' && *q != '>') ++q;
+    return {p, static_cast<std::size_t>(q - p)};
+  }
+
+  // Text up to the next tag, comment or declaration.
+  const char* text(const char* p) {
+    std::size_t mark = out_ != nullptr ? out_->size() : 0;
+    bool preserve = preformatted_ > 0;
+    while (p < end_) {
+      const char* q = k_.text(p, end_);
+      emit(p, q);
+      p = q;
+      if (p == end_) break;
+      char c = *p;
+      if (c == '<') {
+        if (starts_markup(p)) break;
+        error(offset(p), "'<' in text must be written &lt;");
+        emit(p, p + 1);
+        ++p;
+      } else if (c == '&') {
+        check_reference(p);
+        emit(p, p + 1);
+        ++p;
+      } else if (preserve || !space(c)) {
+        emit(p, p + 1);
+        ++p;
+      } else {
+        while (p < end_ && space(*p)) ++p;
+        if (out_ != nullptr && (out_->empty() || out_->back() != ' ')) out_->push_back(' ');
+      }
+    }
+    if (out_ != nullptr && !preserve && out_->size() > mark) {
+      if (after_block_ && (*out_)[mark] == ' ') out_->erase(mark, 1);
+      if (out_->size() > mark && out_->back() == ' ' && (p == end_ || block_tag_at(p))) out_->pop_back();
+    }
+    return p;
+  }
+
+  // "&#...;" must name a valid code point; named references are not checked.
+  void check_reference(const char* p) {
+    const char* q = p + 1;
+    if (q == end_ || *q != '#') return;
+    ++q;
+    bool hex = q < end_ && (*q == 'x' || *q == 'X');
+    if (hex) ++q;
+    std::uint32_t value = 0;
+    const char* digits = q;
+    for (; q < end_; ++q) {
+      char c = *q;
+      unsigned d;
+      if (c >= '0' && c <= '9') {
+        d = static_cast<unsigned>(c - '0');
+      } else if (hex && (c | 0x20) >= 'a' && (c | 0x20) <= 'f') {
+        d = static_cast<unsigned>((c | 0x20) - 'a' + 10);
+      } else {
+        break;
+      }
+      value = std::min<std::uint32_t>(value * (hex ? 16 : 10) + d, 0x110000);
+    }
+    bool ok = q > digits && q < end_ && *q == ';' && value != 0 && value < 0x110000 &&
+              !(value >= 0xD800 && value <= 0xDFFF);
+    if (!ok) error(offset(p), "malformed character reference");
+  }
+
+  bool block_tag_at(const char* p) const {
+    if (!starts_markup(p) || p[1] == '!' || p[1] == '?') return false;
+    return (classify(name_at(p + (p[1] == '/' ? 2 : 1))).flags & kBlock) != 0;
+  }
+
+  const char* markup(const char* p) {
+    std::string_view rest(p, static_cast<std::size_t>(end_ - p));
+    if (rest.starts_with("<!--")) {
+      auto close = rest.find("-->", 4);
+      if (close == std::string_view::npos) {
+        error(offset(p), "unterminated comment");
+        return end_;
+      }
+      if (rest.substr(4).starts_with("[if")) emit(p, p + close + 3);  // conditional comment
+      return p + close + 3;
+    }
+    if (rest.starts_with("<![CDATA[")) {
+      auto close = rest.find("]]>");
+      if (close == std::string_view::npos) {
+        error(offset(p), "unterminated CDATA section");
+        return end_;
+      }
+      emit(p, p + close + 3);
+      return p + close + 3;
+    }
+    if (p[1] == '!' || p[1] == '?') {  // <!DOCTYPE ...>, <?xml ...?>
+      auto close = rest.find('>');
+      if (close == std::string_view::npos) {
+        error(offset(p), "unterminated declaration");
+        return end_;
+      }
+      emit(p, p + close + 1);
+      return p + close + 1;
+    }
+    return p[1] == '/' ? end_tag(p) : start_tag(p);
+  }
+
+  const char* start_tag(const char* p) {
+    auto name = classify(name_at(p + 1));
+    const char* q = p + 1 + name.raw.size();
+    for (;;) {
+      q = k_.tag(q, end_);
+      if (q == end_) {
+        error(offset(p), "unterminated " + start_tag_text(name.raw) + " tag");
+        return end_;
+      }
+      if (*q == '>') break;
+      const void* close = std::memchr(q + 1, *q, static_cast<std::size_t>(end_ - q - 1));
+      if (close == nullptr) {
+        error(offset(q), "unterminated attribute value");
+        return end_;
+      }
+      q = static_cast<const char*>(close) + 1;
+    }
+    bool self_closing = q[-1] == '/';
+    ++q;
+
+    while (top_ != nullptr && (top_->name.flags & kOptionalEnd) && implied_by(top_->name.id, name)) pop();
+    if (!(name.flags & kVoid) && !self_closing) {
+      top_ = arena_.make<Element>(top_, name, offset(p));
+      if (name.flags & kPreformatted) ++preformatted_;
+    }
+    emit(p, q);
+    after_block_ = (name.flags & kBlock) != 0;
+
+    if ((name.flags & kRawText) && !self_closing) {
+      // Copy everything up to the matching end tag, which the main loop
+      // then handles like any other.
+      const char* r = q;
+      for (;;) {
+        r = static_cast<const char*>(std::memchr(r, '<', static_cast<std::size_t>(end_ - r)));
+        if (r == nullptr) {
+          emit(q, end_);
+          return end_;  // reported as never closed
+        }
+        if (end_ - r > 2 && r[1] == '/' && same_tag(classify(name_at(r + 2)), name)) break;
+        ++r;
+      }
+      emit(q, r);
+      return r;
+    }
+    return q;
+  }
+
+  const char* end_tag(const char* p) {
+    auto name = classify(name_at(p + 2));
+    auto close = static_cast<const char*>(std::memchr(p, '>', static_cast<std::size_t>(end_ - p)));
+    if (close == nullptr) {
+      error(offset(p), "unterminated " + end_tag_text(name.raw) + " tag");
+      return end_;
+    }
+    const char* q = close + 1;
+    if (name.flags & kVoid) {
+      error(offset(p), end_tag_text(name.raw) + " is not allowed; " + start_tag_text(name.raw) + " has no end tag");
+      return q;
+    }
+
+    while (top_ != nullptr && !same_tag(top_->name, name) && (top_->name.flags & kOptionalEnd)) pop();
+    if (top_ != nullptr && same_tag(top_->name, name)) {
+      pop();
+    } else {
+      Element* open = top_;
+      while (open != nullptr && !same_tag(open->name, name)) open = open->parent;
+      if (open != nullptr) {
+        error(offset(p), end_tag_text(name.raw) + " while " + start_tag_text(top_->name.raw) + " opened at " +
+                             where(top_->offset) + " is still open");
+        while (top_ != open) pop();
+        pop();
+      } else {
+        error(offset(p), "stray </" + std::string(name.raw) + ">");
+        return q;
+      }
+    }
+
+    if (out_ == nullptr || !(name.flags & kOptionalEnd) || !omittable(name, q)) emit(p, q);
+    after_block_ = (name.flags & kBlock) != 0;
+    return q;
+  }
+
+  // Whether the end tag of `closed`, which ends at `q`, can be dropped from
+  // the minified output. Whitespace in between only counts as absent for
+  // block-level elements, whose neighbouring whitespace is dropped anyway.
+  bool omittable(const TagName& closed, const char* q) const {
+    const char* s = q;
+    if (closed.flags & kBlock) {
+      while (s < end_ && space(*s)) ++s;
+    }
+    if (s == end_) return closed.id != tag("dt") && closed.id != tag("thead");
+    if (!starts_markup(s) || s[1] == '!' || s[1] == '?') return false;
+    if (s[1] == '/') {
+      auto next = classify(name_at(s + 2));
+      return top_ != nullptr && same_tag(next, top_->name) && omittable_before_parent_end(closed.id, top_->name.flags);
+    }
+    auto next = classify(name_at(s + 1));
+    switch (closed.id) {
+      case tag("tr"):
+        return next.id == tag("tr");
+      case tag("td"):
+      case tag("th"):
+        return next.id == tag("td") || next.id == tag("th");
+      case tag("tfoot"):
+        return false;
+      default:
+        return implied_by(closed.id, next);
+    }
+  }
+
+  void pop() {
+    if (top_->name.flags & kPreformatted) --preformatted_;
+    top_ = top_->parent;
+  }
+
+  std::string_view src_;
+  const char* end_;
+  std::string* out_;
+  Arena& arena_;
+  const Kernels& k_;
+  std::vector<HtmlError> errors_;
+  Element* top_ = nullptr;
+  int preformatted_ = 0;      // open <pre>/<textarea> elements
+  bool after_block_ = true;   // the last tag was block-level (or none yet)
+};
+
+}  // namespace
+
+std::vector<HtmlError> HtmlChecker::run(std::string_view html, std::string* minified) {
+  arena_.reset();
+  return Pass(html, minified, arena_).run();
+}
+
+std::string_view html_scan_kernel() { return kernels().name; }
+
+}  // namespace mt::gen
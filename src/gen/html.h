@@ -0,0 +1,51 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "gen/arena.h"
+
+namespace mt::gen {
+
+struct HtmlError {
+  std::size_t line = 0;    // 1-based
+  std::size_t column = 0;  // 1-based, in bytes
+  std::string message;
+};
+
+// Streaming HTML tokenizer used as the build's HTML stage. One forward pass
+// over a document checks its element structure and, optionally, writes a
+// minified copy.
+//
+// Structure is checked more strictly than HTML5 parsing requires. Every
+// element must be closed explicitly, except void elements and those whose
+// end tag HTML lets you omit inside lists, tables and select (p, li, dt, dd,
+// tr, td, th, option, ...). html, head and body must be closed too.
+// Misnested and stray end tags, unterminated comments and tags, a bare '<'
+// in text and malformed character references are errors.
+//
+// Minification collapses whitespace runs in text to one space. It drops
+// whitespace next to block-level tags entirely, removes comments (except
+// conditional comments), and drops optional end tags where HTML permits it.
+// <pre>, <textarea>, <script> and <style> contents are copied verbatim.
+//
+// Text and tag bodies are scanned 32 or 16 bytes at a time (AVX2 or
+// SSE4.2, picked at runtime). Open elements are arena nodes, so a reused
+// checker allocates nothing per page beyond its output.
+class HtmlChecker {
+ public:
+  // Errors come back in document order. When `minified` is non-null it
+  // receives the minified document. Its content is unspecified if there
+  // were errors.
+  std::vector<HtmlError> run(std::string_view html, std::string* minified);
+
+ private:
+  Arena arena_;
+};
+
+// Name of the scanning kernel this CPU uses ("avx2", "sse4.2" or "scalar").
+std::string_view html_scan_kernel();
+
+}  // namespace mt::gen
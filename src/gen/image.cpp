@@ -0,0 +1,779 @@
+#include "gen/image.h"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <csetjmp>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <numbers>
+#include <stdexcept>
+
+#include <zlib.h>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+#if defined(MT_HAVE_JPEG)
+#include <jpeglib.h>
+#endif
+#if defined(MT_HAVE_PNG)
+#include <png.h>
+#endif
+#if defined(MT_HAVE_WEBP)
+#include <webp/encode.h>
+#endif
+#if defined(MT_HAVE_AVIF)
+#include <avif/avif.h>
+#endif
+
+namespace mt::gen {
+
+namespace {
+
+// Larger images are refused rather than decoded into gigabytes.
+constexpr std::uint64_t kMaxPixels = 64 * 1000 * 1000;
+
+constexpr double kLanczosRadius = 3;
+
+std::runtime_error image_error(std::string_view what, std::string_view detail) {
+  return std::runtime_error(std::string(what).append(": ").append(detail));
+}
+
+void check_size(std::uint64_t width, std::uint64_t height) {
+  if (width == 0 || height == 0) throw std::runtime_error("image has no pixels");
+  if (width * height > kMaxPixels) {
+    throw std::runtime_error("image too large: " + std::to_string(width) + "x" + std::to_string(height));
+  }
+}
+
+// Profiles larger than this are dropped rather than inflated.
+constexpr std::size_t kMaxIccSize = 4 << 20;
+
+std::uint32_t load_be16(const unsigned char* p) { return std::uint32_t{p[0]} << 8 | p[1]; }
+std::uint32_t load_be32(const unsigned char* p) { return load_be16(p) << 16 | load_be16(p + 2); }
+
+// The Orientation tag (1-8) of an EXIF block, after its "Exif\0\0"; 1,
+// upright, if it has none or cannot be read.
+int exif_orientation(const unsigned char* p, std::size_t size) {
+  if (size < 8) return 1;
+  bool le = p[0] == 'I' && p[1] == 'I';
+  if (!le && !(p[0] == 'M' && p[1] == 'M')) return 1;
+  auto u16 = [&](std::size_t at) {
+    return le ? std::uint32_t{p[at]} | std::uint32_t{p[at + 1]} << 8 : load_be16(p + at);
+  };
+  auto u32 = [&](std::size_t at) { return le ? u16(at) | u16(at + 2) << 16 : load_be32(p + at); };
+  std::size_t ifd = u32(4);
+  if (ifd > size - 2) return 1;
+  std::size_t entries = u16(ifd);
+  for (std::size_t i = 0; i < entries && ifd + 2 + 12 * (i + 1) <= size; ++i) {
+    std::size_t entry = ifd + 2 + 12 * i;
+    if (u16(entry) != 0x0112) continue;
+    auto value = u16(entry + 8);  // a SHORT, held in the value field
+    return u16(entry + 2) == 3 && value >= 1 && value <= 8 ? static_cast<int>(value) : 1;
+  }
+  return 1;
+}
+
+// `image` turned as EXIF orientation `orientation` says it is displayed.
+Image orient(Image image, int orientation) {
+  if (orientation <= 1 || orientation > 8) return image;
+  std::uint32_t w = image.width, h = image.height;
+  bool swap = orientation >= 5;
+  Image out;
+  out.width = swap ? h : w;
+  out.height = swap ? w : h;
+  out.icc = std::move(image.icc);
+  out.rgba.resize(image.rgba.size());
+  for (std::uint32_t y = 0; y < out.height; ++y) {
+    for (std::uint32_t x = 0; x < out.width; ++x) {
+      std::uint32_t sx = x, sy = y;
+      switch (orientation) {
+        case 2: sx = w - 1 - x; break;                      // mirrored
+        case 3: sx = w - 1 - x, sy = h - 1 - y; break;      // upside down
+        case 4: sy = h - 1 - y; break;                      // mirrored, upside down
+        case 5: sx = y, sy = x; break;                      // transposed
+        case 6: sx = y, sy = h - 1 - x; break;              // turned left
+        case 7: sx = w - 1 - y, sy = h - 1 - x; break;      // transversed
+        case 8: sx = w - 1 - y, sy = x; break;              // turned right
+      }
+      std::memcpy(&out.rgba[(std::size_t{y} * out.width + x) * 4], &image.rgba[(std::size_t{sy} * w + sx) * 4], 4);
+    }
+  }
+  return out;
+}
+
+bool has_alpha(const Image& image) {
+  for (std::size_t i = 3; i < image.rgba.size(); i += 4) {
+    if (image.rgba[i] != 255) return true;
+  }
+  return false;
+}
+
+// sRGB <-> linear light. Going back, linear values are quantized to 12
+// bits, which is under one 8-bit step everywhere on the curve.
+struct Gamma {
+  std::array<float, 256> to_linear{};
+  std::array<std::uint8_t, 4096> to_srgb{};
+  Gamma() {
+    for (int i = 0; i < 256; ++i) {
+      double s = i / 255.0;
+      to_linear[i] = static_cast<float>(s <= 0.04045 ? s / 12.92 : std::pow((s + 0.055) / 1.055, 2.4));
+    }
+    for (int i = 0; i < 4096; ++i) {
+      double l = i / 4095.0;
+      double s = l <= 0.0031308 ? l * 12.92 : 1.055 * std::pow(l, 1 / 2.4) - 0.055;
+      to_srgb[i] = static_cast<std::uint8_t>(std::lround(std::clamp(s, 0.0, 1.0) * 255));
+    }
+  }
+};
+const Gamma kGamma;
+
+// One axis of a resampling: output i is the sum over k < taps of
+// weights[i * taps + k] times input sample start[i] + k. Every output has
+// the same number of taps, the window shifted inward at the edges and
+// padded with zero weights, so the inner loops have a fixed trip count.
+struct Filter {
+  std::uint32_t taps = 0;
+  std::vector<std::uint32_t> start;
+  std::vector<float> weights;
+};
+
+double lanczos(double x) {
+  x = std::abs(x);
+  if (x < 1e-9) return 1;
+  if (x >= kLanczosRadius) return 0;
+  double px = std::numbers::pi * x;
+  return kLanczosRadius * std::sin(px) * std::sin(px / kLanczosRadius) / (px * px);
+}
+
+// Downscaling `in` samples to `out` (out <= in): the kernel is stretched
+// by the scale factor so it also low-passes what the output cannot hold.
+Filter make_filter(std::uint32_t in, std::uint32_t out) {
+  Filter f;
+  double scale = static_cast<double>(in) / out;
+  double support = kLanczosRadius * scale;
+  f.taps = std::min(in, static_cast<std::uint32_t>(std::ceil(support)) * 2 + 1);
+  f.start.resize(out);
+  f.weights.assign(std::size_t{out} * f.taps, 0.0f);
+  std::vector<double> w(f.taps);
+  for (std::uint32_t i = 0; i < out; ++i) {
+    double center = (i + 0.5) * scale;
+    auto lo = static_cast<std::int64_t>(std::max(0.0, std::floor(center - support)));
+    auto hi = static_cast<std::int64_t>(std::min<double>(in, std::ceil(center + support)));
+    auto start = std::min<std::int64_t>(lo, in - f.taps);
+    std::fill(w.begin(), w.end(), 0.0);
+    double total = 0;
+    for (auto j = lo; j < hi; ++j) {
+      double v = lanczos((static_cast<double>(j) + 0.5 - center) / scale);
+      w[static_cast<std::size_t>(j - start)] = v;
+      total += v;
+    }
+    f.start[i] = static_cast<std::uint32_t>(start);
+    for (std::uint32_t k = 0; k < f.taps; ++k) {
+      f.weights[std::size_t{i} * f.taps + k] = static_cast<float>(w[k] / total);
+    }
+  }
+  return f;
+}
+
+// 8-bit sRGB with straight alpha -> linear, premultiplied floats.
+void load_row(const std::uint8_t* in, std::uint32_t width, float* out) {
+  for (std::uint32_t x = 0; x < width; ++x, in += 4, out += 4) {
+    float a = in[3] / 255.0f;
+    out[0] = kGamma.to_linear[in[0]] * a;
+    out[1] = kGamma.to_linear[in[1]] * a;
+    out[2] = kGamma.to_linear[in[2]] * a;
+    out[3] = a;
+  }
+}
+
+void store_row(const float* in, std::uint32_t width, std::uint8_t* out) {
+  for (std::uint32_t x = 0; x < width; ++x, in += 4, out += 4) {
+    float a = std::clamp(in[3], 0.0f, 1.0f);
+    if (a <= 0) {
+      std::memset(out, 0, 4);
+      continue;
+    }
+    for (int c = 0; c < 3; ++c) {
+      float v = std::clamp(in[c] / a, 0.0f, 1.0f);
+      out[c] = kGamma.to_srgb[static_cast<std::size_t>(v * 4095 + 0.5f)];
+    }
+    out[3] = static_cast<std::uint8_t>(a * 255 + 0.5f);
+  }
+}
+
+void horizontal_scalar(const Filter& f, const float* in, float* out, std::uint32_t width) {
+  for (std::uint32_t x = 0; x < width; ++x) {
+    const float* w = &f.weights[std::size_t{x} * f.taps];
+    const float* p = in + std::size_t{f.start[x]} * 4;
+    float acc[4] = {};
+    for (std::uint32_t k = 0; k < f.taps; ++k) {
+      for (int c = 0; c < 4; ++c) acc[c] += w[k] * p[4 * k + c];
+    }
+    std::memcpy(out + std::size_t{x} * 4, acc, sizeof acc);
+  }
+}
+
+// out[i] = sum of w[k] * rows[k][i].
+void vertical_scalar(const float* w, std::uint32_t taps, const float* const* rows, std::size_t n, float* out) {
+  for (std::size_t i = 0; i < n; ++i) {
+    float acc = 0;
+    for (std::uint32_t k = 0; k < taps; ++k) acc += w[k] * rows[k][i];
+    out[i] = acc;
+  }
+}
+
+#if defined(__x86_64__)
+
+// A pixel is four floats, so a 256-bit register holds two adjacent taps'
+// pixels; each FMA applies two weights, and the halves are summed at the end.
+[[gnu::target("avx2,fma")]] void horizontal_avx2(const Filter& f, const float* in, float* out, std::uint32_t width) {
+  for (std::uint32_t x = 0; x < width; ++x) {
+    const float* w = &f.weights[std::size_t{x} * f.taps];
+    const float* p = in + std::size_t{f.start[x]} * 4;
+    __m256 acc = _mm256_setzero_ps();
+    std::uint32_t k = 0;
+    for (; k + 2 <= f.taps; k += 2) {
+      __m256 weights = _mm256_set_m128(_mm_set1_ps(w[k + 1]), _mm_set1_ps(w[k]));
+      acc = _mm256_fmadd_ps(_mm256_loadu_ps(p + 4 * k), weights, acc);
+    }
+    __m128 sum = _mm_add_ps(_mm256_castps256_ps128(acc), _mm256_extractf128_ps(acc, 1));
+    if (k < f.taps) sum = _mm_fmadd_ps(_mm_loadu_ps(p + 4 * k), _mm_set1_ps(w[k]), sum);
+    _mm_storeu_ps(out + std::size_t{x} * 4, sum);
+  }
+}
+
+[[gnu::target("avx2,fma")]] void vertical_avx2(const float* w, std::uint32_t taps, const float* const* rows,
+                                               std::size_t n, float* out) {
+  std::size_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    __m256 acc = _mm256_setzero_ps();
+    for (std::uint32_t k = 0; k < taps; ++k) {
+      acc = _mm256_fmadd_ps(_mm256_loadu_ps(rows[k] + i), _mm256_set1_ps(w[k]), acc);
+    }
+    _mm256_storeu_ps(out + i, acc);
+  }
+  for (; i < n; ++i) {
+    float acc = 0;
+    for (std::uint32_t k = 0; k < taps; ++k) acc += w[k] * rows[k][i];
+    out[i] = acc;
+  }
+}
+
+const bool kHaveAvx2 = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+
+#endif
+
+void horizontal(const Filter& f, const float* in, float* out, std::uint32_t width) {
+#if defined(__x86_64__)
+  if (kHaveAvx2) return horizontal_avx2(f, in, out, width);
+#endif
+  horizontal_scalar(f, in, out, width);
+}
+
+void vertical(const float* w, std::uint32_t taps, const float* const* rows, std::size_t n, float* out) {
+#if defined(__x86_64__)
+  if (kHaveAvx2) return vertical_avx2(w, taps, rows, n, out);
+#endif
+  vertical_scalar(w, taps, rows, n, out);
+}
+
+#if defined(MT_HAVE_JPEG)
+
+// libjpeg reports errors through a callback that must not return; it
+// jumps back to the setjmp in the caller, which frees and throws. Callers
+// construct every C++ object before the setjmp, so the jump skips no
+// destructors.
+struct JpegError {
+  jpeg_error_mgr mgr;
+  std::jmp_buf jump;
+  char message[JMSG_LENGTH_MAX];
+};
+
+[[noreturn]] void jpeg_fail(j_common_ptr cinfo) {
+  auto* err = reinterpret_cast<JpegError*>(cinfo->err);
+  (*cinfo->err->format_message)(cinfo, err->message);
+  std::longjmp(err->jump, 1);
+}
+
+void jpeg_quiet(j_common_ptr, int) {}
+
+// An ICC profile is split over APP2 markers of at most this much, each
+// after "ICC_PROFILE\0", its sequence number and the number of markers.
+constexpr std::size_t kIccChunk = 65519;
+constexpr std::string_view kIccMarker("ICC_PROFILE\0", 12);
+
+// The ICC profile in `markers`, if all of its chunks are there.
+std::string jpeg_icc(jpeg_saved_marker_ptr markers) {
+  std::vector<std::pair<unsigned, std::string_view>> chunks;
+  unsigned count = 0;
+  for (auto* m = markers; m != nullptr; m = m->next) {
+    if (m->marker != JPEG_APP0 + 2 || m->data_length < kIccMarker.size() + 2 ||
+        std::memcmp(m->data, kIccMarker.data(), kIccMarker.size()) != 0) {
+      continue;
+    }
+    auto header = kIccMarker.size() + 2;
+    count = m->data[header - 1];
+    chunks.emplace_back(m->data[header - 2],
+                        std::string_view(reinterpret_cast<const char*>(m->data) + header, m->data_length - header));
+  }
+  std::sort(chunks.begin(), chunks.end());
+  std::string icc;
+  for (unsigned i = 0; i < chunks.size(); ++i) {
+    if (chunks[i].first != i + 1 || chunks.size() != count) return {};
+    icc += chunks[i].second;
+  }
+  return icc;
+}
+
+int jpeg_orientation(jpeg_saved_marker_ptr markers) {
+  for (auto* m = markers; m != nullptr; m = m->next) {
+    if (m->marker == JPEG_APP0 + 1 && m->data_length > 6 && std::memcmp(m->data, "Exif\0\0", 6) == 0) {
+      return exif_orientation(m->data + 6, m->data_length - 6);
+    }
+  }
+  return 1;
+}
+
+jpeg_error_mgr* jpeg_errors(JpegError& err) {
+  auto* mgr = jpeg_std_error(&err.mgr);
+  mgr->error_exit = jpeg_fail;
+  mgr->emit_message = jpeg_quiet;
+  return mgr;
+}
+
+Image decode_jpeg(std::string_view bytes) {
+  Image image;
+  int orientation = 1;
+  std::vector<std::uint8_t> row;
+  jpeg_decompress_struct cinfo{};
+  JpegError err{};
+  cinfo.err = jpeg_errors(err);
+  if (setjmp(err.jump)) {
+    jpeg_destroy_decompress(&cinfo);
+    throw image_error("bad JPEG", err.message);
+  }
+  jpeg_create_decompress(&cinfo);
+  jpeg_mem_src(&cinfo, const_cast<unsigned char*>(reinterpret_cast<const unsigned char*>(bytes.data())),
+               static_cast<unsigned long>(bytes.size()));
+  jpeg_save_markers(&cinfo, JPEG_APP0 + 1, 0xffff);
+  jpeg_save_markers(&cinfo, JPEG_APP0 + 2, 0xffff);
+  jpeg_read_header(&cinfo, TRUE);
+  orientation = jpeg_orientation(cinfo.marker_list);
+  image.icc = jpeg_icc(cinfo.marker_list);
+  cinfo.out_color_space = JCS_RGB;
+  jpeg_calc_output_dimensions(&cinfo);
+  if (cinfo.output_width == 0 || cinfo.output_height == 0 ||
+      std::uint64_t{cinfo.output_width} * cinfo.output_height > kMaxPixels) {
+    jpeg_destroy_decompress(&cinfo);
+    check_size(cinfo.output_width, cinfo.output_height);
+  }
+  image.width = cinfo.output_width;
+  image.height = cinfo.output_height;
+  image.rgba.resize(std::size_t{image.width} * image.height * 4);
+  row.resize(std::size_t{image.width} * 3);
+  jpeg_start_decompress(&cinfo);
+  while (cinfo.output_scanline < cinfo.output_height) {
+    auto* out = image.rgba.data() + std::size_t{cinfo.output_scanline} * image.width * 4;
+    auto* p = row.data();
+    jpeg_read_scanlines(&cinfo, &p, 1);
+    for (std::uint32_t x = 0; x < image.width; ++x, p += 3, out += 4) {
+      out[0] = p[0];
+      out[1] = p[1];
+      out[2] = p[2];
+      out[3] = 255;
+    }
+  }
+  jpeg_finish_decompress(&cinfo);
+  jpeg_destroy_decompress(&cinfo);
+  return orient(std::move(image), orientation);
+}
+
+// Progressive with optimized Huffman tables, which is smaller for all but
+// the tiniest images.
+std::string encode_jpeg(const Image& image, int quality) {
+  std::string out;
+  std::vector<std::uint8_t> row(std::size_t{image.width} * 3);
+  unsigned char* buffer = nullptr;
+  unsigned long size = 0;
+  jpeg_compress_struct cinfo{};
+  JpegError err{};
+  cinfo.err = jpeg_errors(err);
+  if (setjmp(err.jump)) {
+    jpeg_destroy_compress(&cinfo);
+    std::free(buffer);
+    throw image_error("JPEG encoding failed", err.message);
+  }
+  jpeg_create_compress(&cinfo);
+  jpeg_mem_dest(&cinfo, &buffer, &size);
+  cinfo.image_width = image.width;
+  cinfo.image_height = image.height;
+  cinfo.input_components = 3;
+  cinfo.in_color_space = JCS_RGB;
+  jpeg_set_defaults(&cinfo);
+  jpeg_set_quality(&cinfo, quality, TRUE);
+  cinfo.optimize_coding = TRUE;
+  jpeg_simple_progression(&cinfo);
+  jpeg_start_compress(&cinfo, TRUE);
+  auto chunks = (image.icc.size() + kIccChunk - 1) / kIccChunk;
+  for (std::size_t i = 0; i < chunks && chunks <= 255; ++i) {
+    auto chunk = std::string_view(image.icc).substr(i * kIccChunk, kIccChunk);
+    jpeg_write_m_header(&cinfo, JPEG_APP0 + 2, static_cast<unsigned>(kIccMarker.size() + 2 + chunk.size()));
+    for (char ch : kIccMarker) jpeg_write_m_byte(&cinfo, ch);
+    jpeg_write_m_byte(&cinfo, static_cast<int>(i + 1));
+    jpeg_write_m_byte(&cinfo, static_cast<int>(chunks));
+    for (char ch : chunk) jpeg_write_m_byte(&cinfo, static_cast<unsigned char>(ch));
+  }
+  while (cinfo.next_scanline < cinfo.image_height) {
+    const auto* in = image.rgba.data() + std::size_t{cinfo.next_scanline} * image.width * 4;
+    for (std::uint32_t x = 0; x < image.width; ++x) std::memcpy(&row[std::size_t{x} * 3], in + std::size_t{x} * 4, 3);
+    auto* p = row.data();
+    jpeg_write_scanlines(&cinfo, &p, 1);
+  }
+  jpeg_finish_compress(&cinfo);
+  out.assign(reinterpret_cast<const char*>(buffer), size);
+  jpeg_destroy_compress(&cinfo);
+  std::free(buffer);
+  return out;
+}
+
+#endif
+
+#if defined(MT_HAVE_PNG)
+
+void append_be32(std::string& out, std::uint32_t v) {
+  for (int shift = 24; shift >= 0; shift -= 8) out += static_cast<char>(v >> shift);
+}
+
+// The profile in a PNG's iCCP chunk: a name, a compression method (0,
+// zlib) and the compressed profile. Empty if there is none or it does not
+// inflate.
+std::string png_icc(std::string_view bytes) {
+  const auto* p = reinterpret_cast<const unsigned char*>(bytes.data());
+  for (std::size_t at = 8; at + 12 <= bytes.size();) {
+    std::size_t length = load_be32(p + at);
+    auto type = bytes.substr(at + 4, 4);
+    if (type == "IDAT" || length > bytes.size() - at - 12) break;
+    if (type == "iCCP") {
+      auto data = bytes.substr(at + 8, length);
+      auto name_end = data.find('\0');
+      if (name_end == std::string_view::npos || name_end + 2 > data.size() || data[name_end + 1] != 0) break;
+      auto compressed = data.substr(name_end + 2);
+      z_stream zs{};
+      if (inflateInit(&zs) != Z_OK) break;
+      zs.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(compressed.data()));
+      zs.avail_in = static_cast<uInt>(compressed.size());
+      std::string icc;
+      int rc = Z_OK;
+      while (rc == Z_OK && icc.size() < kMaxIccSize) {
+        char buffer[16384];
+        zs.next_out = reinterpret_cast<Bytef*>(buffer);
+        zs.avail_out = sizeof buffer;
+        rc = inflate(&zs, Z_NO_FLUSH);
+        icc.append(buffer, sizeof buffer - zs.avail_out);
+      }
+      inflateEnd(&zs);
+      return rc == Z_STREAM_END ? icc : std::string();
+    }
+    at += length + 12;
+  }
+  return {};
+}
+
+// `png` with an iCCP chunk holding `icc` after its IHDR chunk, which is
+// always first and 13 bytes long.
+std::string add_png_icc(std::string png, std::string_view icc) {
+  std::string chunk = "iCCP";
+  chunk.append("icc\0\0", 5);  // the profile's name, then zlib
+  auto bound = compressBound(static_cast<uLong>(icc.size()));
+  auto header = chunk.size();
+  chunk.resize(header + bound);
+  if (compress2(reinterpret_cast<Bytef*>(chunk.data() + header), &bound, reinterpret_cast<const Bytef*>(icc.data()),
+                static_cast<uLong>(icc.size()), Z_BEST_COMPRESSION) != Z_OK) {
+    throw std::runtime_error("PNG encoding failed: cannot compress the ICC profile");
+  }
+  chunk.resize(header + bound);
+  std::string out;
+  append_be32(out, static_cast<std::uint32_t>(chunk.size() - 4));
+  out += chunk;
+  append_be32(out, static_cast<std::uint32_t>(
+                       crc32(0, reinterpret_cast<const Bytef*>(chunk.data()), static_cast<uInt>(chunk.size()))));
+  png.insert(8 + 25, out);
+  return png;
+}
+
+Image decode_png(std::string_view bytes) {
+  png_image png{};
+  png.version = PNG_IMAGE_VERSION;
+  if (!png_image_begin_read_from_memory(&png, bytes.data(), bytes.size())) throw image_error("bad PNG", png.message);
+  if (std::uint64_t{png.width} * png.height > kMaxPixels) {
+    png_image_free(&png);
+    check_size(png.width, png.height);
+  }
+  png.format = PNG_FORMAT_RGBA;
+  Image image;
+  image.width = png.width;
+  image.height = png.height;
+  image.rgba.resize(PNG_IMAGE_SIZE(png));
+  if (!png_image_finish_read(&png, nullptr, image.rgba.data(), 0, nullptr)) throw image_error("bad PNG", png.message);
+  image.icc = png_icc(bytes);
+  return image;
+}
+
+// RGB when every pixel is opaque, which saves a quarter of the raw data
+// before deflate.
+std::string encode_png(const Image& image) {
+  png_image png{};
+  png.version = PNG_IMAGE_VERSION;
+  png.width = image.width;
+  png.height = image.height;
+  png.format = image.alpha ? PNG_FORMAT_RGBA : PNG_FORMAT_RGB;
+  // Otherwise libpng marks the pixels sRGB, which the profile contradicts.
+  if (!image.icc.empty()) png.flags |= PNG_IMAGE_FLAG_COLORSPACE_NOT_sRGB;
+  std::vector<std::uint8_t> rgb;
+  const std::uint8_t* pixels = image.rgba.data();
+  if (!image.alpha) {
+    rgb.resize(std::size_t{image.width} * image.height * 3);
+    for (std::size_t i = 0, n = std::size_t{image.width} * image.height; i < n; ++i) {
+      std::memcpy(&rgb[i * 3], &image.rgba[i * 4], 3);
+    }
+    pixels = rgb.data();
+  }
+  png_alloc_size_t size = 0;
+  if (!png_image_write_to_memory(&png, nullptr, &size, 0, pixels, 0, nullptr)) {
+    throw image_error("PNG encoding failed", png.message);
+  }
+  std::string out(size, '\0');
+  if (!png_image_write_to_memory(&png, out.data(), &size, 0, pixels, 0, nullptr)) {
+    throw image_error("PNG encoding failed", png.message);
+  }
+  out.resize(size);
+  return image.icc.empty() ? out : add_png_icc(std::move(out), image.icc);
+}
+
+#endif
+
+#if defined(MT_HAVE_WEBP)
+
+void append_le(std::string& out, std::uint32_t v, int bytes) {
+  for (int i = 0; i < bytes; ++i) out += static_cast<char>(v >> (8 * i));
+}
+
+// `webp`, a simple-format file from WebPEncodeRGBA, in the extended
+// format with an ICCP chunk holding `image`'s profile. The VP8X chunk that
+// announces it comes first, and the ICCP chunk right after.
+std::string add_webp_icc(std::string_view webp, const Image& image) {
+  auto chunks = webp.substr(12);  // after "RIFF", the size and "WEBP"
+  std::string vp8x;
+  if (chunks.starts_with("VP8X") && chunks.size() >= 18) {
+    vp8x = chunks.substr(0, 18);
+    chunks.remove_prefix(18);
+  } else {
+    vp8x = "VP8X";
+    append_le(vp8x, 10, 4);
+    append_le(vp8x, chunks.starts_with("VP8L") && image.alpha ? 0x10 : 0, 4);  // alpha
+    append_le(vp8x, image.width - 1, 3);
+    append_le(vp8x, image.height - 1, 3);
+  }
+  vp8x[8] = static_cast<char>(vp8x[8] | 0x20);  // ICC profile
+  std::string iccp = "ICCP";
+  append_le(iccp, static_cast<std::uint32_t>(image.icc.size()), 4);
+  iccp += image.icc;
+  if (iccp.size() % 2 != 0) iccp += '\0';
+  std::string out = "RIFF";
+  append_le(out, static_cast<std::uint32_t>(4 + vp8x.size() + iccp.size() + chunks.size()), 4);
+  out += "WEBP";
+  out += vp8x;
+  out += iccp;
+  out += chunks;
+  return out;
+}
+
+std::string encode_webp(const Image& image, int quality) {
+  std::uint8_t* data = nullptr;
+  auto size = WebPEncodeRGBA(image.rgba.data(), static_cast<int>(image.width), static_cast<int>(image.height),
+                             static_cast<int>(image.width * 4), static_cast<float>(quality), &data);
+  if (size == 0) throw std::runtime_error("WebP encoding failed");
+  std::string out(reinterpret_cast<const char*>(data), size);
+  WebPFree(data);
+  return image.icc.empty() ? out : add_webp_icc(out, image);
+}
+
+#endif
+
+#if defined(MT_HAVE_AVIF)
+
+// One thread per encode: the build already runs one encode per core.
+std::string encode_avif(const Image& image, int quality) {
+  auto* avif = avifImageCreate(image.width, image.height, 8, AVIF_PIXEL_FORMAT_YUV420);
+  auto* encoder = avifEncoderCreate();
+  avifRWData output = AVIF_DATA_EMPTY;
+  avifRGBImage rgb;
+  avifRGBImageSetDefaults(&rgb, avif);
+  rgb.format = AVIF_RGB_FORMAT_RGBA;
+  rgb.ignoreAlpha = image.alpha ? AVIF_FALSE : AVIF_TRUE;
+  rgb.pixels = const_cast<std::uint8_t*>(image.rgba.data());
+  rgb.rowBytes = image.width * 4;
+  if (!image.icc.empty()) {
+    (void)avifImageSetProfileICC(avif, reinterpret_cast<const std::uint8_t*>(image.icc.data()), image.icc.size());
+  }
+  // Quantizers run from 0 (lossless) to 63.
+  int quantizer = std::clamp((100 - quality) * 63 / 100, 0, 63);
+  encoder->maxThreads = 1;
+  encoder->speed = 6;
+  encoder->minQuantizer = encoder->maxQuantizer = quantizer;
+  encoder->minQuantizerAlpha = encoder->maxQuantizerAlpha = quantizer;
+  auto result = avifImageRGBToYUV(avif, &rgb);
+  if (result == AVIF_RESULT_OK) result = avifEncoderWrite(encoder, avif, &output);
+  std::string out;
+  if (result == AVIF_RESULT_OK) out.assign(reinterpret_cast<const char*>(output.data), output.size);
+  avifRWDataFree(&output);
+  avifEncoderDestroy(encoder);
+  avifImageDestroy(avif);
+  if (result != AVIF_RESULT_OK) throw image_error("AVIF encoding failed", avifResultToString(result));
+  return out;
+}
+
+#endif
+
+}  // namespace
+
+std::string_view image_extension(ImageFormat f) {
+  switch (f) {
+    case ImageFormat::jpeg: return "jpg";
+    case ImageFormat::png: return "png";
+    case ImageFormat::webp: return "webp";
+    case ImageFormat::avif: return "avif";
+  }
+  return {};
+}
+
+std::string_view image_type(ImageFormat f) {
+  switch (f) {
+    case ImageFormat::jpeg: return "image/jpeg";
+    case ImageFormat::png: return "image/png";
+    case ImageFormat::webp: return "image/webp";
+    case ImageFormat::avif: return "image/avif";
+  }
+  return {};
+}
+
+bool image_decoder_available(ImageFormat f) {
+  switch (f) {
+#if defined(MT_HAVE_JPEG)
+    case ImageFormat::jpeg: return true;
+#endif
+#if defined(MT_HAVE_PNG)
+    case ImageFormat::png: return true;
+#endif
+    default: return false;
+  }
+}
+
+bool image_encoder_available(ImageFormat f) {
+  switch (f) {
+#if defined(MT_HAVE_JPEG)
+    case ImageFormat::jpeg: return true;
+#endif
+#if defined(MT_HAVE_PNG)
+    case ImageFormat::png: return true;
+#endif
+#if defined(MT_HAVE_WEBP)
+    case ImageFormat::webp: return true;
+#endif
+#if defined(MT_HAVE_AVIF)
+    case ImageFormat::avif: return true;
+#endif
+    default: return false;
+  }
+}
+
+std::optional<ImageFormat> sniff_image(std::string_view bytes) {
+  if (bytes.starts_with("\xff\xd8\xff")) return ImageFormat::jpeg;
+  if (bytes.starts_with("\x89PNG\r\n\x1a\n")) return ImageFormat::png;
+  return std::nullopt;
+}
+
+Image decode_image(std::string_view bytes) {
+  auto format = sniff_image(bytes);
+  if (!format) throw std::runtime_error("not a JPEG or PNG image");
+  if (!image_decoder_available(*format)) {
+    throw std::runtime_error(std::string("no ").append(image_extension(*format)).append(" decoder in this build"));
+  }
+  Image image;
+#if defined(MT_HAVE_JPEG)
+  if (*format == ImageFormat::jpeg) image = decode_jpeg(bytes);
+#endif
+#if defined(MT_HAVE_PNG)
+  if (*format == ImageFormat::png) image = decode_png(bytes);
+#endif
+  image.alpha = has_alpha(image);
+  return image;
+}
+
+Image resize_image(const Image& image, std::uint32_t width) {
+  if (width >= image.width) return image;
+  width = std::max<std::uint32_t>(width, 1);
+  auto height = static_cast<std::uint32_t>(
+      std::max<long>(1, std::lround(static_cast<double>(image.height) * width / image.width)));
+  auto fx = make_filter(image.width, width);
+  auto fy = make_filter(image.height, height);
+
+  Image out;
+  out.width = width;
+  out.height = height;
+  out.alpha = image.alpha;
+  out.icc = image.icc;
+  out.rgba.resize(std::size_t{width} * height * 4);
+  // Horizontally filtered input rows, in a ring of fy.taps: each output
+  // row needs the taps starting at fy.start[y], which never moves back.
+  std::size_t stride = std::size_t{width} * 4;
+  std::vector<float> line(std::size_t{image.width} * 4), ring(fy.taps * stride), result(stride);
+  std::vector<const float*> rows(fy.taps);
+  std::uint32_t next = 0;
+  for (std::uint32_t y = 0; y < height; ++y) {
+    auto start = fy.start[y];
+    for (; next < start + fy.taps; ++next) {
+      load_row(image.rgba.data() + std::size_t{next} * image.width * 4, image.width, line.data());
+      horizontal(fx, line.data(), ring.data() + (next % fy.taps) * stride, width);
+    }
+    for (std::uint32_t k = 0; k < fy.taps; ++k) rows[k] = ring.data() + ((start + k) % fy.taps) * stride;
+    vertical(&fy.weights[std::size_t{y} * fy.taps], fy.taps, rows.data(), stride, result.data());
+    store_row(result.data(), width, out.rgba.data() + std::size_t{y} * stride);
+  }
+  return out;
+}
+
+std::string_view image_resize_kernel() {
+#if defined(__x86_64__)
+  if (kHaveAvx2) return "avx2";
+#endif
+  return "scalar";
+}
+
+std::string encode_image(const Image& image, ImageFormat f, int quality) {
+  switch (f) {
+#if defined(MT_HAVE_JPEG)
+    case ImageFormat::jpeg: return encode_jpeg(image, quality);
+#endif
+#if defined(MT_HAVE_PNG)
+    case ImageFormat::png: return encode_png(image);
+#endif
+#if defined(MT_HAVE_WEBP)
+    case ImageFormat::webp: return encode_webp(image, quality);
+#endif
+#if defined(MT_HAVE_AVIF)
+    case ImageFormat::avif: return encode_avif(image, quality);
+#endif
+    default: break;
+  }
+  (void)image;
+  (void)quality;
+  throw std::runtime_error(std::string("no ").append(image_extension(f)).append(" encoder in this build"));
+}
+
+}  // namespace mt::gen
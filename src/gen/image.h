@@ -0,0 +1,61 @@
+#pragma once
+
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace mt::gen {
+
+// Raster formats the image stage of a build reads or writes.
+enum class ImageFormat { jpeg, png, webp, avif };
+
+std::string_view image_extension(ImageFormat f);  // "jpg", "png", "webp", "avif"
+std::string_view image_type(ImageFormat f);       // "image/jpeg", ...
+
+// Whether this build links a decoder or an encoder for `f`. JPEG and PNG
+// come from libjpeg and libpng, WebP and AVIF from libwebp and libavif,
+// each only if CMake found it. WebP and AVIF are written, never read.
+bool image_decoder_available(ImageFormat f);
+bool image_encoder_available(ImageFormat f);
+
+// The format of `bytes` by its signature, if it is JPEG or PNG.
+std::optional<ImageFormat> sniff_image(std::string_view bytes);
+
+// 8-bit pixels with straight (not premultiplied) alpha, four bytes a
+// pixel, rows top to bottom, upright. They are sRGB unless `icc` holds the
+// ICC profile they are in, which every encoding carries along.
+struct Image {
+  std::uint32_t width = 0;
+  std::uint32_t height = 0;
+  bool alpha = false;  // some pixel is not opaque
+  std::vector<std::uint8_t> rgba;
+  std::string icc;
+};
+
+// Decodes a JPEG or PNG file, turned as a JPEG's EXIF Orientation tag says
+// it is displayed, with its embedded ICC profile (APP2 or iCCP), if any.
+// Throws std::runtime_error if it is neither, if this build has no decoder
+// for it, or if it is corrupt.
+Image decode_image(std::string_view bytes);
+
+// `image` scaled down to `width` pixels wide, keeping its aspect ratio.
+// Uses a Lanczos-3 filter, applied in linear light to premultiplied
+// pixels, so edges do not darken or bleed color from transparent areas.
+// Linear light is taken by the sRGB curve even under another profile;
+// Display P3 shares it, and Adobe RGB's is close.
+// Rows are filtered horizontally as they are needed, so memory use does
+// not grow with the image's height. The inner loops use AVX2 and FMA
+// where the CPU has them. A width at or above the image's returns a copy.
+Image resize_image(const Image& image, std::uint32_t width);
+
+// Name of the resampling kernel this CPU uses ("avx2" or "scalar").
+std::string_view image_resize_kernel();
+
+// Encodes `image` as `f`. `quality` (1-100) applies to the lossy formats;
+// PNG ignores it, and JPEG drops the alpha channel. Throws
+// std::runtime_error if the encoder fails or is not available.
+std::string encode_image(const Image& image, ImageFormat f, int quality);
+
+}  // namespace mt::gen
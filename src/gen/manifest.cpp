@@ -0,0 +1,55 @@
+#include "gen/manifest.h"
+
+#include <charconv>
+#include <fstream>
+#include <string_view>
+
+#include "gen/files.h"
+#include "hash.h"
+
+namespace mt::gen {
+
+// One "<16 hex digits> <unix seconds> <relative path>" line per entry,
+// prefixed with "- " when its variants were not written. Lines in any other
+// shape (including older manifests) are ignored, so their files are rebuilt.
+Manifest Manifest::load(const std::filesystem::path& out_dir) {
+  Manifest m;
+  std::ifstream in(out_dir / kFileName);
+  std::string line;
+  while (std::getline(in, line)) {
+    Entry entry;
+    if (line.starts_with("- ")) {
+      line.erase(0, 2);
+      entry.variants = false;
+    }
+    if (line.size() < 18 || line[16] != ' ') continue;
+    auto r = std::from_chars(line.data(), line.data() + 16, entry.hash, 16);
+    if (r.ec != std::errc{}) continue;
+    const char* end = line.data() + line.size();
+    r = std::from_chars(line.data() + 17, end, entry.modified);
+    if (r.ec != std::errc{} || end - r.ptr < 2 || *r.ptr != ' ') continue;
+    m.entries_[std::string(r.ptr + 1, end)] = entry;
+  }
+  return m;
+}
+
+void Manifest::save(const std::filesystem::path& out_dir) const {
+  std::string text;
+  for (const auto& [rel, entry] : entries_) {
+    if (!entry.variants) text += "- ";
+    text += hex64(entry.hash);
+    text += ' ';
+    text += std::to_string(entry.modified);
+    text += ' ';
+    text += rel;
+    text += '\n';
+  }
+  write_file_atomic(out_dir / kFileName, text);
+}
+
+const Manifest::Entry* Manifest::find(const std::string& rel) const {
+  auto it = entries_.find(rel);
+  return it == entries_.end() ? nullptr : &it->second;
+}
+
+}  // namespace mt::gen
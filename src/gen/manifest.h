@@ -0,0 +1,37 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <map>
+#include <string>
+
+namespace mt::gen {
+
+// Content hash of every source the last build wrote, keyed by path relative
+// to the site root. Stored as ".mtsite-manifest" in the output directory;
+// the leading dot keeps it out of what mtserve serves.
+class Manifest {
+ public:
+  static constexpr const char* kFileName = ".mtsite-manifest";
+
+  struct Entry {
+    std::uint64_t hash = 0;     // xxh3_64 of the published bytes; also the ETag
+    std::int64_t modified = 0;  // Unix time of the build that first saw `hash`
+    bool variants = true;       // false if only the identity file was written
+
+    bool operator==(const Entry&) const = default;
+  };
+
+  // Missing or unreadable manifests load as empty, forcing a full build.
+  static Manifest load(const std::filesystem::path& out_dir);
+  void save(const std::filesystem::path& out_dir) const;
+
+  const Entry* find(const std::string& rel) const;
+  void set(const std::string& rel, Entry entry) { entries_[rel] = entry; }
+  const std::map<std::string, Entry>& entries() const { return entries_; }
+
+ private:
+  std::map<std::string, Entry> entries_;
+};
+
+}  // namespace mt::gen
@@ -0,0 +1,1830 @@
+#include "gen/markdown.h"
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "gen/byteset.h"
+#include "gen/entities.h"
+#include "hash.h"
+
+namespace mt::gen {
+
+namespace {
+
+constexpr int kTabStop = 4;
+constexpr int kCodeIndent = 4;
+constexpr std::size_t kMaxLabel = 999;
+constexpr std::uint32_t kNone = ~0u;
+
+constexpr ByteSet kLineEnds{"\n\r"};
+constexpr ByteSet kBlockStart{">#`~<=-*_+0123456789"};
+constexpr ByteSet kInlineSpecial{"\\`<*_[]!"};
+constexpr ByteSet kTextSpecial{"\\&<>\"\n"};
+constexpr ByteSet kHtmlSpecial{"&<>\""};
+
+constexpr bool is_space_or_tab(char c) { return c == ' ' || c == '\t'; }
+constexpr bool is_line_end(char c) { return c == '\n' || c == '\r'; }
+constexpr bool is_space(char c) { return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\f' || c == '\v'; }
+constexpr bool is_digit(char c) { return c >= '0' && c <= '9'; }
+constexpr bool is_alpha(char c) { return (c | 0x20) >= 'a' && (c | 0x20) <= 'z'; }
+constexpr bool is_alnum(char c) { return is_alpha(c) || is_digit(c); }
+constexpr bool is_punct(char c) {
+  return (c >= '!' && c <= '/') || (c >= ':' && c <= '@') || (c >= '[' && c <= '`') || (c >= '{' && c <= '~');
+}
+constexpr char lower(char c) { return c >= 'A' && c <= 'Z' ? static_cast<char>(c | 0x20) : c; }
+
+bool iequals_prefix(std::string_view s, std::size_t pos, std::string_view word) {
+  if (s.size() - std::min(pos, s.size()) < word.size()) return false;
+  for (std::size_t i = 0; i < word.size(); ++i) {
+    if (lower(s[pos + i]) != word[i]) return false;
+  }
+  return true;
+}
+
+bool icontains(std::string_view s, std::string_view word) {
+  for (std::size_t i = 0; i + word.size() <= s.size(); ++i) {
+    if (iequals_prefix(s, i, word)) return true;
+  }
+  return false;
+}
+
+// Code point starting at s[i]; invalid sequences decode as U+FFFD.
+char32_t decode_at(std::string_view s, std::size_t i, std::size_t* len = nullptr) {
+  auto c = static_cast<unsigned char>(s[i]);
+  int n = c < 0x80 ? 1 : c >= 0xf0 ? 4 : c >= 0xe0 ? 3 : c >= 0xc0 ? 2 : 0;
+  if (len) *len = n ? n : 1;
+  if (n == 1) return c;
+  if (n == 0 || i + n > s.size()) return 0xfffd;
+  char32_t cp = c & (0x7f >> n);
+  for (int k = 1; k < n; ++k) cp = (cp << 6) | (static_cast<unsigned char>(s[i + k]) & 0x3f);
+  return cp;
+}
+
+char32_t decode_before(std::string_view s, std::size_t i) {
+  std::size_t start = i - 1;
+  while (start > 0 && i - start < 4 && (static_cast<unsigned char>(s[start]) & 0xc0) == 0x80) --start;
+  return decode_at(s, start);
+}
+
+bool is_unicode_space(char32_t c) {
+  return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\f' || c == 0xa0 || c == 0x1680 ||
+         (c >= 0x2000 && c <= 0x200a) || c == 0x202f || c == 0x205f || c == 0x3000;
+}
+
+// Unicode punctuation and symbols (general categories P and S), to the
+// precision emphasis flanking needs: all of ASCII and Latin-1 plus the
+// blocks that are nothing but punctuation or symbols.
+bool is_unicode_punct(char32_t c) {
+  if (c < 0x80) return is_punct(static_cast<char>(c));
+  if (c < 0x100) {
+    return (c >= 0xa1 && c <= 0xa9) || c == 0xab || c == 0xac || (c >= 0xae && c <= 0xb1) || c == 0xb4 ||
+           (c >= 0xb6 && c <= 0xb8) || c == 0xbb || c == 0xbf || c == 0xd7 || c == 0xf7;
+  }
+  return (c >= 0x2010 && c <= 0x2027) || (c >= 0x2030 && c <= 0x205e) || (c >= 0x20a0 && c <= 0x20c0) ||
+         (c >= 0x2190 && c <= 0x23ff) || (c >= 0x2500 && c <= 0x2bff) || (c >= 0x2e00 && c <= 0x2e7f) ||
+         (c >= 0x3001 && c <= 0x3003) || (c >= 0x3008 && c <= 0x3011) || (c >= 0x3014 && c <= 0x301f) ||
+         (c >= 0xff01 && c <= 0xff0f) || (c >= 0xff1a && c <= 0xff20) || (c >= 0xff3b && c <= 0xff40) ||
+         (c >= 0xff5b && c <= 0xff65);
+}
+
+// Simple Unicode case folding for the scripts people write labels in:
+// Latin-1, Latin Extended-A, Greek and Cyrillic, plus the sharp s pair.
+void append_folded(std::string& out, char32_t c) {
+  if (c >= 'A' && c <= 'Z') {
+    c |= 0x20;
+  } else if (c == 0xdf || c == 0x1e9e) {
+    out += "ss";
+    return;
+  } else if ((c >= 0xc0 && c <= 0xde && c != 0xd7) || (c >= 0x391 && c <= 0x3ab && c != 0x3a2) ||
+             (c >= 0x410 && c <= 0x42f)) {
+    c += 0x20;
+  } else if (c >= 0x400 && c <= 0x40f) {
+    c += 0x50;
+  } else if (c >= 0x100 && c <= 0x17f && c != 0x130 && c != 0x138 && c != 0x149 && c != 0x178 && c != 0x17f) {
+    bool odd_upper = (c >= 0x139 && c <= 0x148) || (c >= 0x179 && c <= 0x17e);
+    if ((c % 2 == 1) == odd_upper) ++c;
+  } else if (c == 0x178) {
+    c = 0xff;
+  } else if (c == 0x3c2) {
+    c = 0x3c3;
+  }
+  append_utf8(out, c);
+}
+
+// Reference label matching key: case-folded, inner whitespace collapsed.
+void normalize_label(std::string_view label, std::string& key) {
+  key.clear();
+  bool space = false;
+  for (std::size_t i = 0; i < label.size();) {
+    if (is_space(label[i])) {
+      space = true;
+      ++i;
+      continue;
+    }
+    if (space && !key.empty()) key += ' ';
+    space = false;
+    std::size_t len;
+    append_folded(key, decode_at(label, i, &len));
+    i += len;
+  }
+}
+
+void escape_html(std::string& out, std::string_view s) {
+  const char* p = s.data();
+  const char* end = p + s.size();
+  while (p < end) {
+    const char* q = kHtmlSpecial.find(p, end);
+    out.append(p, q);
+    if (q == end) break;
+    switch (*q) {
+      case '&': out += "&amp;"; break;
+      case '<': out += "&lt;"; break;
+      case '>': out += "&gt;"; break;
+      default: out += "&quot;"; break;
+    }
+    p = q + 1;
+  }
+}
+
+// URLs keep the characters that are safe or meaningful in them (including
+// '%', so existing escapes survive) and percent-encode the rest.
+constexpr auto kHrefSafe = [] {
+  std::array<bool, 256> safe{};
+  for (int c = 0; c < 256; ++c) safe[c] = is_alnum(static_cast<char>(c));
+  for (char c : std::string_view("-_.+!*(),%#@?=;:/$~")) safe[static_cast<unsigned char>(c)] = true;
+  return safe;
+}();
+
+void escape_href(std::string& out, std::string_view s) {
+  static constexpr char kHex[] = "0123456789ABCDEF";
+  for (char c : s) {
+    auto u = static_cast<unsigned char>(c);
+    if (kHrefSafe[u]) {
+      out += c;
+    } else if (c == '&') {
+      out += "&amp;";
+    } else if (c == '\'') {
+      out += "&#x27;";
+    } else {
+      out += '%';
+      out += kHex[u >> 4];
+      out += kHex[u & 15];
+    }
+  }
+}
+
+// Backslash escapes and character references resolved, as for link
+// destinations, titles and info strings.
+void unescape(std::string& out, std::string_view s) {
+  for (std::size_t i = 0; i < s.size(); ++i) {
+    if (s[i] == '\\' && i + 1 < s.size() && is_punct(s[i + 1])) {
+      out += s[++i];
+    } else if (s[i] == '&') {
+      if (auto n = decode_character_reference(s, i, out)) {
+        i += n - 1;
+      } else {
+        out += '&';
+      }
+    } else {
+      out += s[i];
+    }
+  }
+}
+
+std::size_t skip_spaces(std::string_view s, std::size_t i) {
+  while (i < s.size() && is_space(s[i])) ++i;
+  return i;
+}
+
+// Spaces and tabs, then at most one line end and the spaces after it.
+std::size_t skip_spnl(std::string_view s, std::size_t i) {
+  while (i < s.size() && is_space_or_tab(s[i])) ++i;
+  if (i < s.size() && s[i] == '\n') ++i;
+  while (i < s.size() && is_space_or_tab(s[i])) ++i;
+  return i;
+}
+
+// [label] at s[i]; sets `end` past ']' and returns the label's contents.
+bool scan_label(std::string_view s, std::size_t i, std::string_view* label, std::size_t* end) {
+  if (i >= s.size() || s[i] != '[') return false;
+  std::size_t j = i + 1;
+  while (j < s.size() && s[j] != '[' && s[j] != ']') {
+    if (s[j] == '\\' && j + 1 < s.size() && is_punct(s[j + 1])) ++j;
+    ++j;
+    if (j - i - 1 > kMaxLabel) return false;
+  }
+  if (j >= s.size() || s[j] != ']') return false;
+  *label = s.substr(i + 1, j - i - 1);
+  *end = j + 1;
+  return true;
+}
+
+// Link destination at s[i]: <...> or a run without spaces or control
+// characters whose parentheses balance. Returns its end, or npos.
+std::size_t scan_destination(std::string_view s, std::size_t i) {
+  if (i < s.size() && s[i] == '<') {
+    for (std::size_t j = i + 1; j < s.size(); ++j) {
+      if (s[j] == '>') return j + 1;
+      if (s[j] == '<' || s[j] == '\n') return std::string_view::npos;
+      if (s[j] == '\\' && j + 1 < s.size() && is_punct(s[j + 1])) ++j;
+    }
+    return std::string_view::npos;
+  }
+  int depth = 0;
+  std::size_t j = i;
+  for (; j < s.size(); ++j) {
+    char c = s[j];
+    if (c == '\\' && j + 1 < s.size() && is_punct(s[j + 1])) {
+      ++j;
+    } else if (c == '(') {
+      if (++depth > 32) return std::string_view::npos;
+    } else if (c == ')') {
+      if (depth == 0) break;
+      --depth;
+    } else if (static_cast<unsigned char>(c) <= 0x20 || c == 0x7f) {
+      if (j == i) return std::string_view::npos;
+      break;
+    }
+  }
+  return depth == 0 ? j : std::string_view::npos;
+}
+
+// Link title at s[i] in "", '' or (); returns its end or 0.
+std::size_t scan_title(std::string_view s, std::size_t i) {
+  if (i >= s.size()) return 0;
+  char open = s[i];
+  char close = open == '(' ? ')' : open;
+  if (open != '"' && open != '\'' && open != '(') return 0;
+  for (std::size_t j = i + 1; j < s.size(); ++j) {
+    if (s[j] == '\\' && j + 1 < s.size() && is_punct(s[j + 1])) {
+      ++j;
+    } else if (s[j] == close) {
+      return j + 1;
+    } else if (open == '(' && s[j] == '(') {
+      return 0;
+    } else if (s[j] == '\n' && j + 1 < s.size()) {
+      // No blank line inside a title.
+      std::size_t k = j + 1;
+      while (k < s.size() && is_space_or_tab(s[k])) ++k;
+      if (k < s.size() && s[k] == '\n') return 0;
+    }
+  }
+  return 0;
+}
+
+std::size_t scan_tag_name(std::string_view s, std::size_t i) {
+  if (i >= s.size() || !is_alpha(s[i])) return 0;
+  std::size_t j = i + 1;
+  while (j < s.size() && (is_alnum(s[j]) || s[j] == '-')) ++j;
+  return j;
+}
+
+// Terminators known to be absent from the rest of a paragraph. Once a
+// search for "-->" fails, no later comment can close either, so a text full
+// of unclosed openers is still scanned in linear time.
+struct Unclosed {
+  bool comment = false, instruction = false, declaration = false, cdata = false;
+};
+
+// Everything after s[from] up to and including `terminator`, or 0.
+std::size_t find_end(std::string_view s, std::size_t from, std::string_view terminator, bool& absent) {
+  if (absent) return 0;
+  auto e = s.find(terminator, from);
+  if (e == std::string_view::npos) {
+    absent = true;
+    return 0;
+  }
+  return e + terminator.size();
+}
+
+// Raw inline HTML at s[i] == '<': open or closing tag, comment, processing
+// instruction, declaration or CDATA section. Returns its end or 0.
+std::size_t scan_html(std::string_view s, std::size_t i, Unclosed& unclosed) {
+  std::size_t n = s.size();
+  std::size_t j = i + 1;
+  if (j >= n) return 0;
+  if (s[j] == '/') {
+    j = scan_tag_name(s, j + 1);
+    if (!j) return 0;
+    j = skip_spaces(s, j);
+    return j < n && s[j] == '>' ? j + 1 : 0;
+  }
+  if (s[j] == '?') return find_end(s, j + 1, "?>", unclosed.instruction);
+  if (s[j] == '!') {
+    if (s.substr(j, 3) == "!--") {
+      if (s.substr(j + 3, 1) == ">") return j + 4;
+      if (s.substr(j + 3, 2) == "->") return j + 5;
+      return find_end(s, j + 3, "-->", unclosed.comment);
+    }
+    if (s.substr(j, 8) == "![CDATA[") return find_end(s, j + 8, "]]>", unclosed.cdata);
+    if (j + 1 < n && is_alpha(s[j + 1])) return find_end(s, j + 2, ">", unclosed.declaration);
+    return 0;
+  }
+  j = scan_tag_name(s, j);
+  if (!j) return 0;
+  for (;;) {
+    std::size_t k = skip_spaces(s, j);
+    if (k < n && s[k] == '>') return k + 1;
+    if (k + 1 < n && s[k] == '/' && s[k + 1] == '>') return k + 2;
+    if (k == j || k >= n) return 0;
+    // attribute name
+    char c = s[k];
+    if (!is_alpha(c) && c != '_' && c != ':') return 0;
+    ++k;
+    while (k < n && (is_alnum(s[k]) || s[k] == '_' || s[k] == '.' || s[k] == ':' || s[k] == '-')) ++k;
+    j = k;
+    k = skip_spaces(s, k);
+    if (k < n && s[k] == '=') {
+      k = skip_spaces(s, k + 1);
+      if (k >= n) return 0;
+      if (s[k] == '"' || s[k] == '\'') {
+        auto e = s.find(s[k], k + 1);
+        if (e == std::string_view::npos) return 0;
+        j = e + 1;
+      } else {
+        std::size_t v = k;
+        while (v < n && !is_space(s[v]) && !std::strchr("\"'=<>`", s[v])) ++v;
+        if (v == k) return 0;
+        j = v;
+      }
+    }
+  }
+}
+
+// <scheme:...> or <user@host>, at s[i] == '<'. Returns the end or 0.
+std::size_t scan_autolink(std::string_view s, std::size_t i, bool* email) {
+  std::size_t n = s.size();
+  std::size_t j = i + 1;
+  if (j < n && is_alpha(s[j])) {
+    std::size_t k = j + 1;
+    while (k < n && (is_alnum(s[k]) || s[k] == '+' || s[k] == '.' || s[k] == '-')) ++k;
+    if (k - j >= 2 && k - j <= 32 && k < n && s[k] == ':') {
+      for (++k; k < n; ++k) {
+        auto c = static_cast<unsigned char>(s[k]);
+        if (c == '>') {
+          *email = false;
+          return k + 1;
+        }
+        if (c <= 0x20 || c == '<') break;
+      }
+    }
+  }
+  std::size_t k = j;
+  while (k < n && (is_alnum(s[k]) || std::strchr(".!#$%&'*+/=?^_`{|}~-", s[k]))) ++k;
+  if (k == j || k >= n || s[k] != '@') return 0;
+  for (;;) {
+    std::size_t label = ++k;
+    while (k < n && (is_alnum(s[k]) || s[k] == '-') && k - label < 63) ++k;
+    if (k == label || s[label] == '-' || s[k - 1] == '-') return 0;
+    if (k < n && s[k] == '>') {
+      *email = true;
+      return k + 1;
+    }
+    if (k >= n || s[k] != '.') return 0;
+  }
+}
+
+constexpr std::string_view kHtmlBlockNames[] = {
+    "address",  "article",  "aside",    "base",     "basefont", "blockquote", "body",     "caption", "center",
+    "col",      "colgroup", "dd",       "details",  "dialog",   "dir",        "div",      "dl",      "dt",
+    "fieldset", "figcaption", "figure", "footer",   "form",     "frame",      "frameset", "h1",      "h2",
+    "h3",       "h4",       "h5",       "h6",       "head",     "header",     "hr",       "html",    "iframe",
+    "legend",   "li",       "link",     "main",     "menu",     "menuitem",   "nav",      "noframes", "ol",
+    "optgroup", "option",   "p",        "param",    "search",   "section",    "summary",  "table",   "tbody",
+    "td",       "tfoot",    "th",       "thead",    "title",    "tr",         "track",    "ul",
+};
+
+// Which of the seven HTML block kinds starts at line[i] == '<', or 0.
+int html_block_start(std::string_view line, std::size_t i, bool can_be_kind7) {
+  std::size_t n = line.size();
+  auto ends_word = [&](std::size_t k) { return k >= n || is_space(line[k]) || line[k] == '>'; };
+  for (std::string_view name : {"script", "pre", "style", "textarea"}) {
+    if (iequals_prefix(line, i + 1, name) && ends_word(i + 1 + name.size())) return 1;
+  }
+  if (line.substr(i, 4) == "<!--") return 2;
+  if (line.substr(i, 2) == "<?") return 3;
+  if (line.substr(i, 9) == "<![CDATA[") return 5;
+  if (line.substr(i, 2) == "<!" && i + 2 < n && is_alpha(line[i + 2])) return 4;
+  std::size_t j = i + 1 + (i + 1 < n && line[i + 1] == '/');
+  std::size_t end = j;
+  while (end < n && is_alnum(line[end])) ++end;
+  if (end > j) {
+    for (auto name : kHtmlBlockNames) {
+      if (name.size() == end - j && iequals_prefix(line, j, name)) {
+        if (ends_word(end) || line.substr(end, 2) == "/>") return 6;
+        break;
+      }
+    }
+  }
+  if (!can_be_kind7) return 0;
+  bool closing = line[j - 1] == '/';
+  Unclosed unclosed;
+  std::size_t tag_end = closing ? 0 : scan_html(line, i, unclosed);
+  if (closing) {
+    std::size_t k = scan_tag_name(line, j);
+    if (k) {
+      k = skip_spaces(line, k);
+      if (k < n && line[k] == '>') tag_end = k + 1;
+    }
+  }
+  if (!tag_end || line[i + 1] == '!' || line[i + 1] == '?') return 0;
+  for (std::string_view name : {"script", "style", "pre", "textarea"}) {
+    if (iequals_prefix(line, j, name) && !is_alnum(line[std::min(j + name.size(), n - 1)])) return 0;
+  }
+  while (tag_end < n && is_space_or_tab(line[tag_end])) ++tag_end;
+  return tag_end == n ? 7 : 0;
+}
+
+bool html_block_ends(int kind, std::string_view rest) {
+  switch (kind) {
+    case 1:
+      return icontains(rest, "</script>") || icontains(rest, "</pre>") || icontains(rest, "</style>") ||
+             icontains(rest, "</textarea>");
+    case 2: return rest.find("-->") != std::string_view::npos;
+    case 3: return rest.find("?>") != std::string_view::npos;
+    case 4: return rest.find('>') != std::string_view::npos;
+    case 5: return rest.find("]]>") != std::string_view::npos;
+    default: return false;
+  }
+}
+
+enum class BlockType : std::uint8_t {
+  kDocument,
+  kBlockQuote,
+  kList,
+  kItem,
+  kParagraph,
+  kHeading,
+  kThematicBreak,
+  kCodeBlock,
+  kHtmlBlock,
+};
+
+bool accepts_lines(BlockType t) {
+  return t == BlockType::kParagraph || t == BlockType::kHeading || t == BlockType::kCodeBlock;
+}
+
+bool can_contain(BlockType parent, BlockType child) {
+  switch (parent) {
+    case BlockType::kDocument:
+    case BlockType::kBlockQuote:
+    case BlockType::kItem: return child != BlockType::kItem;
+    case BlockType::kList: return child == BlockType::kItem;
+    default: return false;
+  }
+}
+
+enum class MarkKind : std::uint8_t {
+  kEmOpen,
+  kEmClose,
+  kStrongOpen,
+  kStrongClose,
+  kCode,       // a..b is the content
+  kHtml,
+  kAutolink,   // a..b is the address
+  kEmailLink,  // likewise
+  kLinkOpen,   // a indexes links
+  kLinkClose,
+  kImageOpen,
+  kImageClose,
+};
+
+}  // namespace
+
+struct MarkdownCompiler::State {
+  // One line of a leaf block: a source range, after `pad` spaces left over
+  // from a tab that the container prefixes only partly consumed.
+  struct Line {
+    std::uint32_t begin, end;
+    std::uint8_t pad;
+  };
+
+  struct Block {
+    BlockType type;
+    bool open = true;
+    bool last_line_blank = false;
+    std::int8_t ends_blank = -1;  // memoized ends_with_blank_line(), once closed
+    bool fenced = false;
+    bool info_pending = false;
+    bool setext = false;
+    bool tight = false;
+    bool ordered = false;
+    char marker = 0;  // list bullet or delimiter, or code fence character
+    int level = 0;    // heading level or HTML block kind
+    int fence_length = 0;
+    int fence_offset = 0;
+    int marker_offset = 0;
+    int padding = 0;
+    int start = 0;
+    std::uint32_t start_line = 0;
+    std::uint32_t parent = kNone, first_child = kNone, last_child = kNone, prev = kNone, next = kNone;
+    std::uint32_t lines_begin = 0, lines_end = 0;
+    std::uint32_t info_begin = 0, info_end = 0;
+  };
+
+  // A link reference definition. Its normalized label and its unescaped
+  // destination and title are ranges of `pool`.
+  struct Reference {
+    std::uint32_t key, key_size;
+    std::uint32_t destination, destination_size;
+    std::uint32_t title, title_size;
+    bool has_title;
+  };
+
+  struct Link {
+    std::string_view destination;
+    std::string_view title;
+    bool has_title;
+    bool raw;  // destination and title still need unescaping and delimiters stripped
+  };
+
+  struct Mark {
+    std::uint32_t begin, end;
+    MarkKind kind;
+    std::uint32_t a = 0, b = 0;
+  };
+
+  // An emphasis delimiter run; [begin, end) shrinks as it is matched.
+  struct Delim {
+    std::uint32_t begin, end;
+    std::uint32_t length;  // original, for the rule of three
+    std::uint32_t prev, next;
+    char ch;
+    bool can_open, can_close;
+  };
+
+  struct Bracket {
+    std::uint32_t pos;
+    std::uint32_t delim_bottom;  // first delimiter inside the brackets
+    bool image, active = true, bracket_after = false;
+  };
+
+  // Block parsing.
+  std::string_view src;
+  std::string_view line;
+  std::uint32_t line_start = 0;
+  std::uint32_t line_number = 0;
+  int offset = 0, column = 0;
+  int first_nonspace = 0, first_nonspace_column = 0, indent = 0;
+  int thematic_break_kill = 0;  // a thematic break cannot start before this
+  int nonspace_for = -1;        // offset and column the fields above were computed for
+  int nonspace_for_column = -1;
+  bool blank = false, partially_consumed_tab = false;
+  std::uint32_t tip = 0;
+
+  std::vector<Block> blocks;
+  std::vector<Line> lines;
+  std::string pool;
+  std::vector<Reference> references;
+  std::vector<std::uint32_t> reference_slots;  // open addressing: index + 1, or 0 when free
+  std::string key;
+
+  // Inline parsing and rendering.
+  std::string text;
+  std::string scratch;
+  std::vector<Mark> marks;
+  std::vector<Delim> delims;
+  std::vector<Bracket> brackets;
+  std::vector<Link> links;
+  std::uint32_t last_delim = kNone;
+  std::uint64_t no_backtick_closer = 0;  // run lengths known to have no closer
+  Unclosed unclosed;
+
+  std::string sanitized;
+  std::string* out = nullptr;
+  std::size_t out_start = 0;
+  std::string title;
+  int title_level = 0;
+
+  void compile(std::string_view markdown, std::string& html);
+
+  // Blocks.
+  char peek(int i) const { return i < static_cast<int>(line.size()) ? line[i] : '\n'; }
+  void find_first_nonspace();
+  void advance_offset(int count, bool columns);
+  std::uint32_t add_child(std::uint32_t parent, BlockType type);
+  std::uint32_t finalize(std::uint32_t b);
+  void unlink(std::uint32_t b);
+  void add_line(std::uint32_t b);
+  void process_line();
+  bool parse_list_marker(bool interrupts_paragraph, int* length, Block* data);
+  bool resolve_references(std::uint32_t b);
+  std::size_t parse_reference(std::string_view s, std::size_t pos);
+  bool ends_with_blank_line(std::uint32_t b);
+  void finalize_list(std::uint32_t b);
+
+  // Inlines.
+  void gather(const Block& b);
+  void parse_inlines();
+  std::size_t handle_backticks(std::size_t i);
+  void handle_delims(std::size_t i, std::size_t n);
+  std::size_t handle_close_bracket(std::size_t i);
+  void remove_delim(std::uint32_t d);
+  void process_emphasis(std::uint32_t bottom);
+  const Reference* lookup(std::string_view label);
+  std::string_view pooled(std::uint32_t at, std::uint32_t size) const {
+    return std::string_view(pool).substr(at, size);
+  }
+  const Reference* find_reference(std::string_view normalized) const;
+  void add_reference(std::string_view destination, std::string_view title, bool has_title);
+
+  // Rendering.
+  void cr();
+  void render();
+  void render_leaf(std::uint32_t b);
+  void render_inlines(std::string& to, bool plain);
+  void render_text(std::string& to, std::size_t begin, std::size_t end, bool plain);
+  void render_link_target(std::string& to, const Link& link, bool image);
+  void render_title(std::string& to, const Link& link);
+};
+
+// ---------------------------------------------------------------------------
+// Blocks
+
+void MarkdownCompiler::State::find_first_nonspace() {
+  if (nonspace_for == offset && nonspace_for_column == column) return;
+  nonspace_for = offset;
+  nonspace_for_column = column;
+  int chars_to_tab = kTabStop - column % kTabStop;
+  first_nonspace = offset;
+  first_nonspace_column = column;
+  while (first_nonspace < static_cast<int>(line.size())) {
+    char c = line[first_nonspace];
+    if (c == ' ') {
+      ++first_nonspace;
+      ++first_nonspace_column;
+      if (--chars_to_tab == 0) chars_to_tab = kTabStop;
+    } else if (c == '\t') {
+      ++first_nonspace;
+      first_nonspace_column += chars_to_tab;
+      chars_to_tab = kTabStop;
+    } else {
+      break;
+    }
+  }
+  indent = first_nonspace_column - column;
+  blank = first_nonspace >= static_cast<int>(line.size());
+}
+
+void MarkdownCompiler::State::advance_offset(int count, bool columns) {
+  while (count > 0 && offset < static_cast<int>(line.size())) {
+    if (line[offset] == '\t') {
+      int chars_to_tab = kTabStop - column % kTabStop;
+      if (columns) {
+        partially_consumed_tab = chars_to_tab > count;
+        int advance = std::min(count, chars_to_tab);
+        column += advance;
+        offset += partially_consumed_tab ? 0 : 1;
+        count -= advance;
+      } else {
+        partially_consumed_tab = false;
+        column += chars_to_tab;
+        ++offset;
+        --count;
+      }
+    } else {
+      partially_consumed_tab = false;
+      ++offset;
+      ++column;
+      --count;
+    }
+  }
+}
+
+std::uint32_t MarkdownCompiler::State::add_child(std::uint32_t parent, BlockType type) {
+  while (!can_contain(blocks[parent].type, type)) parent = finalize(parent);
+  auto b = static_cast<std::uint32_t>(blocks.size());
+  Block& child = blocks.emplace_back();
+  child.type = type;
+  child.parent = parent;
+  child.start_line = line_number;
+  child.lines_begin = child.lines_end = static_cast<std::uint32_t>(lines.size());
+  Block& p = blocks[parent];
+  if (p.last_child == kNone) {
+    p.first_child = b;
+  } else {
+    blocks[p.last_child].next = b;
+    child.prev = p.last_child;
+  }
+  p.last_child = b;
+  return b;
+}
+
+void MarkdownCompiler::State::unlink(std::uint32_t b) {
+  const Block& block = blocks[b];
+  Block& p = blocks[block.parent];
+  if (block.prev == kNone) {
+    p.first_child = block.next;
+  } else {
+    blocks[block.prev].next = block.next;
+  }
+  if (block.next == kNone) {
+    p.last_child = block.prev;
+  } else {
+    blocks[block.next].prev = block.prev;
+  }
+}
+
+void MarkdownCompiler::State::add_line(std::uint32_t b) {
+  std::uint8_t pad = 0;
+  if (partially_consumed_tab) {
+    ++offset;
+    pad = static_cast<std::uint8_t>(kTabStop - column % kTabStop);
+  }
+  Block& block = blocks[b];
+  if (block.lines_begin == block.lines_end) block.lines_begin = static_cast<std::uint32_t>(lines.size());
+  auto begin = line_start + std::min<std::uint32_t>(offset, line.size());
+  lines.push_back({begin, line_start + static_cast<std::uint32_t>(line.size()), pad});
+  block.lines_end = static_cast<std::uint32_t>(lines.size());
+}
+
+// Whether `b` or its last descendant through lists and items ended with a
+// blank line. Every block above the one that decides the answer has the
+// same answer, so each walk records it on them and deep nesting stays
+// linear.
+bool MarkdownCompiler::State::ends_with_blank_line(std::uint32_t b) {
+  bool result = false;
+  std::uint32_t n = b;
+  while (n != kNone) {
+    const Block& block = blocks[n];
+    if (block.ends_blank >= 0) {
+      result = block.ends_blank;
+      break;
+    }
+    if (block.last_line_blank || (block.type != BlockType::kList && block.type != BlockType::kItem)) {
+      result = block.last_line_blank;
+      break;
+    }
+    n = block.last_child;
+  }
+  for (std::uint32_t m = b; m != n; m = blocks[m].last_child) blocks[m].ends_blank = result;
+  return result;
+}
+
+void MarkdownCompiler::State::finalize_list(std::uint32_t b) {
+  blocks[b].tight = true;
+  for (std::uint32_t item = blocks[b].first_child; item != kNone; item = blocks[item].next) {
+    if (blocks[item].last_line_blank && blocks[item].next != kNone) {
+      blocks[b].tight = false;
+      return;
+    }
+    for (std::uint32_t sub = blocks[item].first_child; sub != kNone; sub = blocks[sub].next) {
+      if ((blocks[item].next != kNone || blocks[sub].next != kNone) && ends_with_blank_line(sub)) {
+        blocks[b].tight = false;
+        return;
+      }
+    }
+  }
+}
+
+std::uint32_t MarkdownCompiler::State::finalize(std::uint32_t b) {
+  Block& block = blocks[b];
+  std::uint32_t parent = block.parent;
+  block.open = false;
+  switch (block.type) {
+    case BlockType::kParagraph:
+      if (!resolve_references(b)) unlink(b);
+      break;
+    case BlockType::kCodeBlock:
+      if (!block.fenced) {
+        auto is_blank = [&](const Line& l) {
+          for (auto i = l.begin; i < l.end; ++i) {
+            if (!is_space_or_tab(src[i])) return false;
+          }
+          return true;
+        };
+        while (block.lines_end > block.lines_begin && is_blank(lines[block.lines_end - 1])) --block.lines_end;
+      }
+      break;
+    case BlockType::kList:
+      finalize_list(b);
+      break;
+    default:
+      break;
+  }
+  return parent;
+}
+
+// Link reference definitions at the start of paragraph `b` are recorded
+// and dropped from it. Returns whether any of the paragraph is left.
+bool MarkdownCompiler::State::resolve_references(std::uint32_t b) {
+  Block& block = blocks[b];
+  auto stripped = [&](const Line& l) {
+    auto begin = l.begin;
+    while (begin < l.end && is_space_or_tab(src[begin])) ++begin;
+    return src.substr(begin, l.end - begin);
+  };
+  if (block.lines_begin == block.lines_end || !stripped(lines[block.lines_begin]).starts_with('[')) {
+    return block.lines_begin != block.lines_end;
+  }
+  scratch.clear();
+  for (auto i = block.lines_begin; i < block.lines_end; ++i) {
+    scratch += stripped(lines[i]);
+    scratch += '\n';
+  }
+  std::string_view s = scratch;
+  std::size_t pos = 0;
+  while (auto n = parse_reference(s, pos)) pos += n;
+  block.lines_begin += static_cast<std::uint32_t>(std::count(s.begin(), s.begin() + pos, '\n'));
+  return block.lines_begin != block.lines_end;
+}
+
+std::size_t MarkdownCompiler::State::parse_reference(std::string_view s, std::size_t pos) {
+  std::size_t start = pos;
+  std::string_view label;
+  if (!scan_label(s, pos, &label, &pos)) return 0;
+  if (std::all_of(label.begin(), label.end(), is_space)) return 0;
+  if (pos >= s.size() || s[pos] != ':') return 0;
+  std::size_t dest_begin = skip_spnl(s, pos + 1);
+  std::size_t dest_end = scan_destination(s, dest_begin);
+  if (dest_end == std::string_view::npos) return 0;
+  if (dest_end == dest_begin) return 0;
+  std::size_t before_title = dest_end;
+  std::size_t title_begin = skip_spnl(s, before_title);
+  std::size_t title_end = title_begin == before_title ? 0 : scan_title(s, title_begin);
+  pos = title_end ? title_end : before_title;
+  while (pos < s.size() && is_space_or_tab(s[pos])) ++pos;
+  if (pos < s.size() && s[pos] != '\n') {
+    if (!title_end) return 0;
+    title_end = 0;
+    pos = before_title;
+    while (pos < s.size() && is_space_or_tab(s[pos])) ++pos;
+    if (pos < s.size() && s[pos] != '\n') return 0;
+  }
+  if (pos < s.size()) ++pos;
+
+  normalize_label(label, key);
+  if (!find_reference(key)) {
+    auto dest = s.substr(dest_begin, dest_end - dest_begin);
+    if (dest.starts_with('<')) dest = dest.substr(1, dest.size() - 2);
+    auto title = title_end ? s.substr(title_begin + 1, title_end - title_begin - 2) : std::string_view();
+    add_reference(dest, title, title_end != 0);
+  }
+  return pos - start;
+}
+
+const MarkdownCompiler::State::Reference* MarkdownCompiler::State::find_reference(std::string_view normalized) const {
+  if (reference_slots.empty()) return nullptr;
+  std::size_t mask = reference_slots.size() - 1;
+  for (std::size_t i = xxh3_64(normalized) & mask; reference_slots[i]; i = (i + 1) & mask) {
+    const Reference& ref = references[reference_slots[i] - 1];
+    if (pooled(ref.key, ref.key_size) == normalized) return &ref;
+  }
+  return nullptr;
+}
+
+// Adds a definition for the label in `key`, which must not be defined yet.
+void MarkdownCompiler::State::add_reference(std::string_view destination, std::string_view title, bool has_title) {
+  if ((references.size() + 1) * 2 > reference_slots.size()) {
+    reference_slots.assign(std::max<std::size_t>(16, reference_slots.size() * 2), 0);
+    std::size_t mask = reference_slots.size() - 1;
+    for (std::uint32_t r = 0; r < references.size(); ++r) {
+      std::size_t i = xxh3_64(pooled(references[r].key, references[r].key_size)) & mask;
+      while (reference_slots[i]) i = (i + 1) & mask;
+      reference_slots[i] = r + 1;
+    }
+  }
+  Reference ref{};
+  auto mark = [this] { return static_cast<std::uint32_t>(pool.size()); };
+  ref.key = mark();
+  pool += key;
+  ref.key_size = mark() - ref.key;
+  ref.destination = mark();
+  unescape(pool, destination);
+  ref.destination_size = mark() - ref.destination;
+  ref.title = mark();
+  unescape(pool, title);
+  ref.title_size = mark() - ref.title;
+  ref.has_title = has_title;
+
+  std::size_t mask = reference_slots.size() - 1;
+  std::size_t i = xxh3_64(key) & mask;
+  while (reference_slots[i]) i = (i + 1) & mask;
+  references.push_back(ref);
+  reference_slots[i] = static_cast<std::uint32_t>(references.size());
+}
+
+bool MarkdownCompiler::State::parse_list_marker(bool interrupts_paragraph, int* length, Block* data) {
+  int pos = first_nonspace;
+  char c = peek(pos);
+  auto content_follows = [&](int i) {
+    while (is_space_or_tab(peek(i))) ++i;
+    return !is_line_end(peek(i));
+  };
+  if (c == '*' || c == '-' || c == '+') {
+    ++pos;
+    if (!is_space(peek(pos))) return false;
+    if (interrupts_paragraph && !content_follows(pos)) return false;
+    data->ordered = false;
+    data->marker = c;
+    data->start = 0;
+  } else if (is_digit(c)) {
+    int start = 0, digits = 0;
+    do {
+      start = start * 10 + (peek(pos) - '0');
+      ++pos;
+      ++digits;
+    } while (digits < 9 && is_digit(peek(pos)));
+    c = peek(pos);
+    if (interrupts_paragraph && start != 1) return false;
+    if (c != '.' && c != ')') return false;
+    ++pos;
+    if (!is_space(peek(pos))) return false;
+    if (interrupts_paragraph && !content_follows(pos)) return false;
+    data->ordered = true;
+    data->marker = c;
+    data->start = start;
+  } else {
+    return false;
+  }
+  *length = pos - first_nonspace;
+  return true;
+}
+
+void MarkdownCompiler::State::process_line() {
+  offset = column = thematic_break_kill = 0;
+  nonspace_for = -1;
+  blank = partially_consumed_tab = false;
+  ++line_number;
+
+  // 1. Walk the open blocks, consuming each one's continuation prefix.
+  std::uint32_t container = 0;
+  bool all_matched = true;
+  while (blocks[container].last_child != kNone && blocks[blocks[container].last_child].open) {
+    container = blocks[container].last_child;
+    Block& b = blocks[container];
+    find_first_nonspace();
+    bool matched = true;
+    switch (b.type) {
+      case BlockType::kBlockQuote:
+        matched = indent <= 3 && peek(first_nonspace) == '>';
+        if (matched) {
+          advance_offset(indent + 1, true);
+          if (is_space_or_tab(peek(offset))) advance_offset(1, true);
+        }
+        break;
+      case BlockType::kItem:
+        if (indent >= b.marker_offset + b.padding) {
+          advance_offset(b.marker_offset + b.padding, true);
+        } else if (blank && b.first_child != kNone) {
+          advance_offset(first_nonspace - offset, false);
+        } else {
+          matched = false;
+        }
+        break;
+      case BlockType::kCodeBlock:
+        if (!b.fenced) {
+          if (indent >= kCodeIndent) {
+            advance_offset(kCodeIndent, true);
+          } else if (blank) {
+            advance_offset(first_nonspace - offset, false);
+          } else {
+            matched = false;
+          }
+        } else {
+          if (indent <= 3 && peek(first_nonspace) == b.marker) {
+            int i = first_nonspace;
+            while (peek(i) == b.marker) ++i;
+            int run = i - first_nonspace;
+            while (is_space_or_tab(peek(i))) ++i;
+            if (run >= b.fence_length && i >= static_cast<int>(line.size())) {
+              // Closing fence: nothing else on this line.
+              tip = finalize(container);
+              return;
+            }
+          }
+          for (int i = b.fence_offset; i > 0 && is_space_or_tab(peek(offset)); --i) advance_offset(1, true);
+        }
+        break;
+      case BlockType::kHeading:
+        matched = false;
+        break;
+      case BlockType::kHtmlBlock:
+        matched = !(blank && b.level >= 6);
+        break;
+      case BlockType::kParagraph:
+        matched = !blank;
+        break;
+      default:
+        break;
+    }
+    if (!matched) {
+      container = blocks[container].parent;
+      all_matched = false;
+      break;
+    }
+  }
+  std::uint32_t last_matched = container;
+
+  // 2. Open any new blocks the rest of the line starts.
+  bool maybe_lazy = blocks[tip].type == BlockType::kParagraph;
+  while (blocks[container].type != BlockType::kCodeBlock && blocks[container].type != BlockType::kHtmlBlock) {
+    find_first_nonspace();
+    bool indented = indent >= kCodeIndent;
+    BlockType type = blocks[container].type;
+    char c = peek(first_nonspace);
+    if (!indented && !kBlockStart.contains(c)) break;  // plain text, the common case
+    int kind = 0, length = 0;
+    Block data{};
+    if (!indented && c == '>') {
+      advance_offset(first_nonspace + 1 - offset, false);
+      if (is_space_or_tab(peek(offset))) advance_offset(1, true);
+      container = add_child(container, BlockType::kBlockQuote);
+    } else if (!indented && c == '#' && [&] {
+                 int i = first_nonspace;
+                 while (peek(i) == '#' && i - first_nonspace < 7) ++i;
+                 length = i - first_nonspace;
+                 return length <= 6 && (is_space_or_tab(peek(i)) || is_line_end(peek(i)));
+               }()) {
+      int i = first_nonspace + length;
+      while (is_space_or_tab(peek(i))) ++i;
+      advance_offset(i - offset, false);
+      container = add_child(container, BlockType::kHeading);
+      blocks[container].level = length;
+    } else if (!indented && (c == '`' || c == '~') && [&] {
+                 int i = first_nonspace;
+                 while (peek(i) == c) ++i;
+                 length = i - first_nonspace;
+                 if (length < 3) return false;
+                 return c == '~' || line.find('`', i) == std::string_view::npos;
+               }()) {
+      int fence_offset = first_nonspace - offset;
+      advance_offset(first_nonspace + length - offset, false);
+      container = add_child(container, BlockType::kCodeBlock);
+      Block& b = blocks[container];
+      b.fenced = true;
+      b.info_pending = true;
+      b.marker = c;
+      b.fence_length = length;
+      b.fence_offset = fence_offset;
+    } else if (!indented && c == '<' &&
+               (kind = html_block_start(line, first_nonspace, type != BlockType::kParagraph && !maybe_lazy))) {
+      container = add_child(container, BlockType::kHtmlBlock);
+      blocks[container].level = kind;
+    } else if (!indented && type == BlockType::kParagraph && (c == '=' || c == '-') && [&] {
+                 int i = first_nonspace;
+                 while (peek(i) == c) ++i;
+                 while (is_space_or_tab(peek(i))) ++i;
+                 return i >= static_cast<int>(line.size());
+               }()) {
+      if (resolve_references(container)) {
+        Block& b = blocks[container];
+        b.type = BlockType::kHeading;
+        b.level = c == '=' ? 1 : 2;
+        b.setext = true;
+        advance_offset(static_cast<int>(line.size()) - offset, false);
+      }
+    } else if (!indented && !(type == BlockType::kParagraph && !all_matched) && (c == '*' || c == '-' || c == '_') &&
+               first_nonspace >= thematic_break_kill && [&] {
+                 int count = 0;
+                 for (int i = first_nonspace; i < static_cast<int>(line.size()); ++i) {
+                   if (line[i] == c) {
+                     ++count;
+                   } else if (!is_space_or_tab(line[i])) {
+                     thematic_break_kill = i;
+                     return false;
+                   }
+                 }
+                 return count >= 3;
+               }()) {
+      container = add_child(container, BlockType::kThematicBreak);
+      advance_offset(static_cast<int>(line.size()) - offset, false);
+    } else if (indent < 4 && parse_list_marker(type == BlockType::kParagraph, &length, &data)) {
+      advance_offset(first_nonspace + length - offset, false);
+      bool saved_tab = partially_consumed_tab;
+      int saved_offset = offset, saved_column = column;
+      while (column - saved_column <= 5 && is_space_or_tab(peek(offset))) advance_offset(1, true);
+      int spaces = column - saved_column;
+      if (spaces >= 5 || spaces < 1 || is_line_end(peek(offset))) {
+        data.padding = length + 1;
+        offset = saved_offset;
+        column = saved_column;
+        partially_consumed_tab = saved_tab;
+        if (spaces > 0) advance_offset(1, true);
+      } else {
+        data.padding = length + spaces;
+      }
+      data.marker_offset = indent;
+      const Block& list = blocks[container];
+      if (type != BlockType::kList || list.ordered != data.ordered || list.marker != data.marker) {
+        container = add_child(container, BlockType::kList);
+        Block& b = blocks[container];
+        b.ordered = data.ordered;
+        b.marker = data.marker;
+        b.start = data.start;
+      }
+      container = add_child(container, BlockType::kItem);
+      Block& b = blocks[container];
+      b.ordered = data.ordered;
+      b.marker = data.marker;
+      b.marker_offset = data.marker_offset;
+      b.padding = data.padding;
+    } else if (indented && !maybe_lazy && !blank) {
+      advance_offset(kCodeIndent, true);
+      container = add_child(container, BlockType::kCodeBlock);
+    } else {
+      break;
+    }
+    if (accepts_lines(blocks[container].type)) break;
+    maybe_lazy = false;
+  }
+
+  // 3. What is left of the line is text for `container`, or for the open
+  // paragraph if it is a lazy continuation line.
+  find_first_nonspace();
+  if (blank && blocks[container].last_child != kNone) blocks[blocks[container].last_child].last_line_blank = true;
+  {
+    const Block& b = blocks[container];
+    bool last_line_blank = blank && b.type != BlockType::kBlockQuote && b.type != BlockType::kHeading &&
+                           b.type != BlockType::kThematicBreak && !(b.type == BlockType::kCodeBlock && b.fenced) &&
+                           !(b.type == BlockType::kItem && b.first_child == kNone && b.start_line == line_number);
+    blocks[container].last_line_blank = last_line_blank;
+    for (auto p = blocks[container].parent; p != kNone; p = blocks[p].parent) blocks[p].last_line_blank = false;
+  }
+
+  if (tip != last_matched && container == last_matched && !blank && blocks[tip].type == BlockType::kParagraph) {
+    add_line(tip);
+    return;
+  }
+  while (tip != last_matched) tip = finalize(tip);
+
+  Block& b = blocks[container];
+  if (b.type == BlockType::kCodeBlock) {
+    if (b.info_pending) {
+      b.info_pending = false;
+      b.info_begin = line_start + std::min<std::uint32_t>(offset, line.size());
+      b.info_end = line_start + static_cast<std::uint32_t>(line.size());
+    } else {
+      add_line(container);
+    }
+  } else if (b.type == BlockType::kHtmlBlock) {
+    add_line(container);
+    if (html_block_ends(blocks[container].level, line.substr(std::min<std::size_t>(first_nonspace, line.size())))) {
+      container = finalize(container);
+    }
+  } else if (blank) {
+    // nothing to add
+  } else if (accepts_lines(b.type)) {
+    if (b.type == BlockType::kHeading && !b.setext) {
+      // Drop an ATX heading's closing sequence and trailing spaces.
+      auto n = line.size();
+      while (n > 0 && is_space_or_tab(line[n - 1])) --n;
+      auto hashes = n;
+      while (hashes > 0 && line[hashes - 1] == '#') --hashes;
+      if (hashes < n && hashes > 0 && is_space_or_tab(line[hashes - 1])) {
+        n = hashes;
+        while (n > 0 && is_space_or_tab(line[n - 1])) --n;
+      }
+      line = line.substr(0, n);
+    }
+    advance_offset(first_nonspace - offset, false);
+    add_line(container);
+  } else {
+    container = add_child(container, BlockType::kParagraph);
+    advance_offset(first_nonspace - offset, false);
+    add_line(container);
+  }
+  tip = container;
+}
+
+// ---------------------------------------------------------------------------
+// Inlines
+
+// Paragraph or heading text: lines without their indentation, joined by
+// '\n', with trailing whitespace removed.
+void MarkdownCompiler::State::gather(const Block& b) {
+  text.clear();
+  for (auto i = b.lines_begin; i < b.lines_end; ++i) {
+    auto begin = lines[i].begin;
+    while (begin < lines[i].end && is_space_or_tab(src[begin])) ++begin;
+    if (i != b.lines_begin) text += '\n';
+    text.append(src.data() + begin, lines[i].end - begin);
+  }
+  while (!text.empty() && is_space(text.back())) text.pop_back();
+}
+
+std::size_t MarkdownCompiler::State::handle_backticks(std::size_t i) {
+  std::string_view s = text;
+  std::size_t n = 1;
+  while (i + n < s.size() && s[i + n] == '`') ++n;
+  std::uint64_t bit = n < 64 ? std::uint64_t{1} << n : 0;
+  if (!(no_backtick_closer & bit)) {
+    for (std::size_t j = i + n; (j = s.find('`', j)) != std::string_view::npos;) {
+      std::size_t m = 1;
+      while (j + m < s.size() && s[j + m] == '`') ++m;
+      if (m == n) {
+        marks.push_back({static_cast<std::uint32_t>(i), static_cast<std::uint32_t>(j + m), MarkKind::kCode,
+                         static_cast<std::uint32_t>(i + n), static_cast<std::uint32_t>(j)});
+        return j + m;
+      }
+      j += m;
+    }
+    no_backtick_closer |= bit;
+  }
+  return i + n;
+}
+
+void MarkdownCompiler::State::handle_delims(std::size_t i, std::size_t n) {
+  std::string_view s = text;
+  char c = s[i];
+  char32_t before = i == 0 ? U'\n' : decode_before(s, i);
+  char32_t after = i + n >= s.size() ? U'\n' : decode_at(s, i + n);
+  bool before_space = is_unicode_space(before), after_space = is_unicode_space(after);
+  bool before_punct = is_unicode_punct(before), after_punct = is_unicode_punct(after);
+  bool left = !after_space && (!after_punct || before_space || before_punct);
+  bool right = !before_space && (!before_punct || after_space || after_punct);
+  bool can_open = left, can_close = right;
+  if (c == '_') {
+    can_open = left && (!right || before_punct);
+    can_close = right && (!left || after_punct);
+  }
+  if (!can_open && !can_close) return;
+  auto d = static_cast<std::uint32_t>(delims.size());
+  delims.push_back({static_cast<std::uint32_t>(i), static_cast<std::uint32_t>(i + n), static_cast<std::uint32_t>(n),
+                    last_delim, kNone, c, can_open, can_close});
+  if (last_delim != kNone) delims[last_delim].next = d;
+  last_delim = d;
+}
+
+void MarkdownCompiler::State::remove_delim(std::uint32_t d) {
+  Delim& del = delims[d];
+  if (del.prev != kNone) delims[del.prev].next = del.next;
+  if (del.next != kNone) {
+    delims[del.next].prev = del.prev;
+  } else {
+    last_delim = del.prev;
+  }
+}
+
+// The CommonMark "process emphasis" procedure over delimiters numbered
+// `bottom` and up, after which they are all removed.
+void MarkdownCompiler::State::process_emphasis(std::uint32_t bottom) {
+  std::uint32_t openers_bottom[2][2][3];
+  for (auto& a : openers_bottom) {
+    for (auto& b : a) std::fill(std::begin(b), std::end(b), bottom);
+  }
+  std::uint32_t closer = last_delim;
+  std::uint32_t first = kNone;
+  while (closer != kNone && closer >= bottom) {
+    first = closer;
+    closer = delims[closer].prev;
+  }
+  closer = first;
+  while (closer != kNone) {
+    Delim& c = delims[closer];
+    if (!c.can_close) {
+      closer = c.next;
+      continue;
+    }
+    std::uint32_t& floor = openers_bottom[c.ch == '*'][c.can_open][c.length % 3];
+    std::uint32_t opener = c.prev;
+    bool found = false;
+    while (opener != kNone && opener >= floor && opener >= bottom) {
+      const Delim& o = delims[opener];
+      if (o.can_open && o.ch == c.ch &&
+          (!(c.can_open || o.can_close) || c.length % 3 == 0 || (o.length + c.length) % 3 != 0)) {
+        found = true;
+        break;
+      }
+      opener = o.prev;
+    }
+    std::uint32_t old_closer = closer;
+    if (found) {
+      Delim& o = delims[opener];
+      std::uint32_t use = (c.end - c.begin >= 2 && o.end - o.begin >= 2) ? 2 : 1;
+      o.end -= use;
+      marks.push_back({o.end, o.end + use, use == 2 ? MarkKind::kStrongOpen : MarkKind::kEmOpen});
+      marks.push_back({c.begin, c.begin + use, use == 2 ? MarkKind::kStrongClose : MarkKind::kEmClose});
+      c.begin += use;
+      for (std::uint32_t d = c.prev; d != opener; d = delims[d].prev) remove_delim(d);
+      if (o.begin == o.end) remove_delim(opener);
+      if (c.begin == c.end) {
+        closer = c.next;
+        remove_delim(old_closer);
+      }
+    } else {
+      closer = c.next;
+      floor = old_closer;
+      if (!delims[old_closer].can_open) remove_delim(old_closer);
+    }
+  }
+  while (last_delim != kNone && last_delim >= bottom) remove_delim(last_delim);
+}
+
+const MarkdownCompiler::State::Reference* MarkdownCompiler::State::lookup(std::string_view label) {
+  if (label.size() > kMaxLabel) return nullptr;
+  normalize_label(label, key);
+  if (key.empty()) return nullptr;
+  return find_reference(key);
+}
+
+// At ']': make a link or image of the innermost open bracket if a
+// destination follows or its label is defined. Returns where to resume.
+std::size_t MarkdownCompiler::State::handle_close_bracket(std::size_t i) {
+  if (brackets.empty()) return i + 1;
+  Bracket opener = brackets.back();
+  if (!opener.active) {
+    brackets.pop_back();
+    return i + 1;
+  }
+  std::string_view s = text;
+  std::size_t after = i + 1;
+  std::size_t end = std::string_view::npos;
+  Link link{};
+
+  if (after < s.size() && s[after] == '(') {
+    std::size_t dest_begin = skip_spaces(s, after + 1);
+    std::size_t dest_end = scan_destination(s, dest_begin);
+    if (dest_end != std::string_view::npos) {
+      std::size_t title_begin = skip_spaces(s, dest_end);
+      std::size_t title_end = title_begin == dest_end ? title_begin : scan_title(s, title_begin);
+      if (!title_end) title_end = title_begin;
+      std::size_t close = skip_spaces(s, title_end);
+      if (close < s.size() && s[close] == ')') {
+        link = {s.substr(dest_begin, dest_end - dest_begin), s.substr(title_begin, title_end - title_begin),
+                title_end > title_begin, true};
+        end = close + 1;
+      }
+    }
+  }
+  if (end == std::string_view::npos) {
+    std::string_view label;
+    std::size_t label_end = after;
+    bool found = scan_label(s, after, &label, &label_end);
+    if ((!found || label.empty()) && !opener.bracket_after) {
+      std::size_t text_begin = opener.pos + (opener.image ? 2 : 1);
+      label = s.substr(text_begin, i - text_begin);
+      found = true;
+    }
+    if (!found) label_end = after;
+    if (found) {
+      if (const Reference* ref = lookup(label)) {
+        link = {pooled(ref->destination, ref->destination_size), pooled(ref->title, ref->title_size),
+                ref->has_title, false};
+        end = label_end;
+      }
+    }
+  }
+  if (end == std::string_view::npos) {
+    brackets.pop_back();
+    return i + 1;
+  }
+
+  auto index = static_cast<std::uint32_t>(links.size());
+  links.push_back(link);
+  marks.push_back({opener.pos, opener.pos + (opener.image ? 2u : 1u),
+                   opener.image ? MarkKind::kImageOpen : MarkKind::kLinkOpen, index});
+  marks.push_back({static_cast<std::uint32_t>(i), static_cast<std::uint32_t>(end),
+                   opener.image ? MarkKind::kImageClose : MarkKind::kLinkClose, index});
+  process_emphasis(opener.delim_bottom);
+  brackets.pop_back();
+  if (!opener.image) {
+    for (auto& b : brackets) {
+      if (!b.image) b.active = false;
+    }
+  }
+  return end;
+}
+
+void MarkdownCompiler::State::parse_inlines() {
+  marks.clear();
+  delims.clear();
+  brackets.clear();
+  links.clear();
+  last_delim = kNone;
+  no_backtick_closer = 0;
+  unclosed = {};
+  std::string_view s = text;
+  const char* base = s.data();
+  const char* end = base + s.size();
+  std::size_t i = 0;
+  while (i < s.size()) {
+    i = kInlineSpecial.find(base + i, end) - base;
+    if (i >= s.size()) break;
+    switch (s[i]) {
+      case '\\':
+        i += i + 1 < s.size() && is_punct(s[i + 1]) ? 2 : 1;
+        break;
+      case '`':
+        i = handle_backticks(i);
+        break;
+      case '<': {
+        bool email = false;
+        if (auto e = scan_autolink(s, i, &email)) {
+          marks.push_back({static_cast<std::uint32_t>(i), static_cast<std::uint32_t>(e),
+                           email ? MarkKind::kEmailLink : MarkKind::kAutolink, static_cast<std::uint32_t>(i + 1),
+                           static_cast<std::uint32_t>(e - 1)});
+          i = e;
+        } else if (auto h = scan_html(s, i, unclosed)) {
+          marks.push_back({static_cast<std::uint32_t>(i), static_cast<std::uint32_t>(h), MarkKind::kHtml});
+          i = h;
+        } else {
+          ++i;
+        }
+        break;
+      }
+      case '*':
+      case '_': {
+        std::size_t n = 1;
+        while (i + n < s.size() && s[i + n] == s[i]) ++n;
+        handle_delims(i, n);
+        i += n;
+        break;
+      }
+      case '!':
+        if (i + 1 < s.size() && s[i + 1] == '[') {
+          if (!brackets.empty()) brackets.back().bracket_after = true;
+          brackets.push_back({static_cast<std::uint32_t>(i), static_cast<std::uint32_t>(delims.size()), true});
+          i += 2;
+        } else {
+          ++i;
+        }
+        break;
+      case '[':
+        if (!brackets.empty()) brackets.back().bracket_after = true;
+        brackets.push_back({static_cast<std::uint32_t>(i), static_cast<std::uint32_t>(delims.size()), false});
+        ++i;
+        break;
+      case ']':
+        i = handle_close_bracket(i);
+        break;
+    }
+  }
+  process_emphasis(0);
+  std::sort(marks.begin(), marks.end(), [](const Mark& a, const Mark& b) { return a.begin < b.begin; });
+}
+
+// ---------------------------------------------------------------------------
+// Rendering
+
+void MarkdownCompiler::State::cr() {
+  if (out->size() > out_start && out->back() != '\n') *out += '\n';
+}
+
+// Text between marks: escapes, character references and line breaks. In
+// plain mode (image descriptions, titles) breaks become spaces.
+void MarkdownCompiler::State::render_text(std::string& to, std::size_t begin, std::size_t end, bool plain) {
+  std::string_view s = text;
+  const char* base = s.data();
+  std::size_t i = begin;
+  while (i < end) {
+    std::size_t j = kTextSpecial.find(base + i, base + end) - base;
+    to.append(base + i, j - i);
+    if (j >= end) break;
+    i = j + 1;
+    switch (s[j]) {
+      case '\\':
+        if (i < end && s[i] == '\n') {
+          to += plain ? " " : "<br />\n";
+          ++i;
+        } else if (i < end && is_punct(s[i])) {
+          char c = s[i++];
+          if (c == '&' || c == '<' || c == '>' || c == '"') {
+            escape_html(to, {&c, 1});
+          } else {
+            to += c;
+          }
+        } else {
+          to += '\\';
+        }
+        break;
+      case '&': {
+        std::size_t mark = to.size();
+        if (auto n = decode_character_reference(s, j, to)) {
+          scratch.assign(to, mark);
+          to.resize(mark);
+          escape_html(to, scratch);
+          i = j + n;
+        } else {
+          to += "&amp;";
+        }
+        break;
+      }
+      case '<': to += "&lt;"; break;
+      case '>': to += "&gt;"; break;
+      case '"': to += "&quot;"; break;
+      case '\n': {
+        std::size_t spaces = 0;
+        while (to.size() > spaces && to[to.size() - 1 - spaces] == ' ') ++spaces;
+        to.resize(to.size() - spaces);
+        to += plain ? " " : spaces >= 2 ? "<br />\n" : "\n";
+        while (i < end && is_space_or_tab(s[i])) ++i;
+        break;
+      }
+    }
+  }
+}
+
+void MarkdownCompiler::State::render_link_target(std::string& to, const Link& link, bool image) {
+  to += image ? "<img src=\"" : "<a href=\"";
+  std::string_view dest = link.destination;
+  if (link.raw) {
+    if (dest.starts_with('<')) dest = dest.substr(1, dest.size() - 2);
+    scratch.clear();
+    unescape(scratch, dest);
+    escape_href(to, scratch);
+  } else {
+    escape_href(to, dest);
+  }
+  to += '"';
+}
+
+void MarkdownCompiler::State::render_title(std::string& to, const Link& link) {
+  if (!link.has_title) return;
+  to += " title=\"";
+  if (link.raw) {
+    scratch.clear();
+    unescape(scratch, link.title.substr(1, link.title.size() - 2));
+    escape_html(to, scratch);
+  } else {
+    escape_html(to, link.title);
+  }
+  to += '"';
+}
+
+void MarkdownCompiler::State::render_inlines(std::string& to, bool plain) {
+  std::string_view s = text;
+  int image_depth = plain ? 1 : 0;
+  std::size_t pos = 0;
+  for (const Mark& m : marks) {
+    render_text(to, pos, m.begin, image_depth > 0);
+    pos = m.end;
+    bool tags = image_depth == 0;
+    switch (m.kind) {
+      case MarkKind::kEmOpen:
+        if (tags) to += "<em>";
+        break;
+      case MarkKind::kEmClose:
+        if (tags) to += "</em>";
+        break;
+      case MarkKind::kStrongOpen:
+        if (tags) to += "<strong>";
+        break;
+      case MarkKind::kStrongClose:
+        if (tags) to += "</strong>";
+        break;
+      case MarkKind::kCode: {
+        auto code = s.substr(m.a, m.b - m.a);
+        if (code.size() >= 2 && (code.front() == ' ' || code.front() == '\n') &&
+            (code.back() == ' ' || code.back() == '\n') &&
+            code.find_first_not_of(" \n") != std::string_view::npos) {
+          code = code.substr(1, code.size() - 2);
+        }
+        if (tags) to += "<code>";
+        std::size_t start = to.size();
+        escape_html(to, code);
+        std::replace(to.begin() + static_cast<std::ptrdiff_t>(start), to.end(), '\n', ' ');
+        if (tags) to += "</code>";
+        break;
+      }
+      case MarkKind::kHtml:
+        if (tags) {
+          to.append(s.substr(m.begin, m.end - m.begin));
+        } else {
+          escape_html(to, s.substr(m.begin, m.end - m.begin));
+        }
+        break;
+      case MarkKind::kAutolink:
+      case MarkKind::kEmailLink: {
+        auto address = s.substr(m.a, m.b - m.a);
+        if (tags) {
+          to += "<a href=\"";
+          if (m.kind == MarkKind::kEmailLink) to += "mailto:";
+          escape_href(to, address);
+          to += "\">";
+        }
+        escape_html(to, address);
+        if (tags) to += "</a>";
+        break;
+      }
+      case MarkKind::kLinkOpen:
+        if (tags) {
+          render_link_target(to, links[m.a], false);
+          render_title(to, links[m.a]);
+          to += '>';
+        }
+        break;
+      case MarkKind::kLinkClose:
+        if (tags) to += "</a>";
+        break;
+      case MarkKind::kImageOpen:
+        if (tags) {
+          render_link_target(to, links[m.a], true);
+          to += " alt=\"";
+        }
+        ++image_depth;
+        break;
+      case MarkKind::kImageClose:
+        if (--image_depth == 0) {
+          to += '"';
+          render_title(to, links[m.a]);
+          to += " />";
+        }
+        break;
+    }
+  }
+  render_text(to, pos, s.size(), image_depth > 0);
+}
+
+void MarkdownCompiler::State::render_leaf(std::uint32_t n) {
+  const Block& b = blocks[n];
+  std::string& o = *out;
+  switch (b.type) {
+    case BlockType::kParagraph: {
+      bool tight = false;
+      if (b.parent != kNone && blocks[b.parent].type == BlockType::kItem) {
+        tight = blocks[blocks[b.parent].parent].tight;
+      }
+      gather(b);
+      parse_inlines();
+      if (!tight) {
+        cr();
+        o += "<p>";
+      }
+      render_inlines(o, false);
+      if (!tight) o += "</p>\n";
+      break;
+    }
+    case BlockType::kHeading: {
+      gather(b);
+      parse_inlines();
+      cr();
+      o += "<h";
+      o += static_cast<char>('0' + b.level);
+      o += '>';
+      render_inlines(o, false);
+      o += "</h";
+      o += static_cast<char>('0' + b.level);
+      o += ">\n";
+      if (title_level == 0 || (b.level == 1 && title_level > 1)) {
+        title.clear();
+        render_inlines(title, true);
+        title_level = b.level;
+      }
+      break;
+    }
+    case BlockType::kThematicBreak:
+      cr();
+      o += "<hr />\n";
+      break;
+    case BlockType::kCodeBlock: {
+      cr();
+      auto info = src.substr(b.info_begin, b.info_end - b.info_begin);
+      while (!info.empty() && is_space(info.front())) info.remove_prefix(1);
+      while (!info.empty() && is_space(info.back())) info.remove_suffix(1);
+      if (info.empty()) {
+        o += "<pre><code>";
+      } else {
+        scratch.clear();
+        unescape(scratch, info);
+        std::string_view word = scratch;
+        word = word.substr(0, std::find_if(word.begin(), word.end(), is_space) - word.begin());
+        o += "<pre><code class=\"language-";
+        escape_html(o, word);
+        o += "\">";
+      }
+      for (auto i = b.lines_begin; i < b.lines_end; ++i) {
+        o.append(lines[i].pad, ' ');
+        escape_html(o, src.substr(lines[i].begin, lines[i].end - lines[i].begin));
+        o += '\n';
+      }
+      o += "</code></pre>\n";
+      break;
+    }
+    case BlockType::kHtmlBlock:
+      cr();
+      for (auto i = b.lines_begin; i < b.lines_end; ++i) {
+        o.append(lines[i].pad, ' ');
+        o.append(src.substr(lines[i].begin, lines[i].end - lines[i].begin));
+        o += '\n';
+      }
+      cr();
+      break;
+    default:
+      break;
+  }
+}
+
+void MarkdownCompiler::State::render() {
+  std::string& o = *out;
+  auto enter = [&](std::uint32_t n) {
+    const Block& b = blocks[n];
+    switch (b.type) {
+      case BlockType::kBlockQuote:
+        cr();
+        o += "<blockquote>\n";
+        break;
+      case BlockType::kList:
+        cr();
+        if (!b.ordered) {
+          o += "<ul>\n";
+        } else if (b.start == 1) {
+          o += "<ol>\n";
+        } else {
+          o += "<ol start=\"";
+          o += std::to_string(b.start);
+          o += "\">\n";
+        }
+        break;
+      case BlockType::kItem:
+        cr();
+        o += "<li>";
+        break;
+      default:
+        render_leaf(n);
+        break;
+    }
+  };
+  auto leave = [&](std::uint32_t n) {
+    const Block& b = blocks[n];
+    switch (b.type) {
+      case BlockType::kBlockQuote:
+        cr();
+        o += "</blockquote>\n";
+        break;
+      case BlockType::kList:
+        o += b.ordered ? "</ol>\n" : "</ul>\n";
+        break;
+      case BlockType::kItem:
+        o += "</li>\n";
+        break;
+      default:
+        break;
+    }
+  };
+
+  std::uint32_t n = blocks[0].first_child;
+  while (n != kNone) {
+    enter(n);
+    if (blocks[n].first_child != kNone) {
+      n = blocks[n].first_child;
+      continue;
+    }
+    leave(n);
+    while (blocks[n].next == kNone) {
+      n = blocks[n].parent;
+      if (n == 0) return;
+      leave(n);
+    }
+    n = blocks[n].next;
+  }
+}
+
+void MarkdownCompiler::State::compile(std::string_view markdown, std::string& html) {
+  if (markdown.find('\0') != std::string_view::npos) {
+    sanitized.clear();
+    for (char c : markdown) {
+      if (c == '\0') {
+        sanitized += "\xef\xbf\xbd";
+      } else {
+        sanitized += c;
+      }
+    }
+    markdown = sanitized;
+  }
+  src = markdown;
+  blocks.clear();
+  lines.clear();
+  pool.clear();
+  references.clear();
+  std::fill(reference_slots.begin(), reference_slots.end(), 0);
+  title.clear();
+  title_level = 0;
+  blocks.emplace_back().type = BlockType::kDocument;
+  tip = 0;
+  line_number = 0;
+
+  const char* base = src.data();
+  const char* end = base + src.size();
+  const char* p = base;
+  while (p < end) {
+    const char* eol = kLineEnds.find(p, end);
+    line_start = static_cast<std::uint32_t>(p - base);
+    line = std::string_view(p, eol - p);
+    process_line();
+    p = eol;
+    if (p < end && *p == '\r') ++p;
+    if (p < end && *p == '\n') ++p;
+  }
+  while (tip != 0) tip = finalize(tip);
+  finalize(0);
+
+  out = &html;
+  out_start = html.size();
+  render();
+  out = nullptr;
+}
+
+MarkdownCompiler::MarkdownCompiler() : state_(std::make_unique<State>()) {}
+
+MarkdownCompiler::~MarkdownCompiler() = default;
+
+void MarkdownCompiler::compile(std::string_view markdown, std::string& out) { state_->compile(markdown, out); }
+
+std::string_view MarkdownCompiler::title() const { return state_->title; }
+
+}  // namespace mt::gen
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <string_view>
+
+namespace mt::gen {
+
+// CommonMark to HTML, rendered the way the reference implementation renders
+// it. The only extension is that documents are compiled whole, so reference
+// definitions may appear after their uses.
+//
+// There is no syntax tree. The block pass records each block as an index
+// into a pooled vector, with leaves holding line spans into the source.
+// Each paragraph's inlines become a sorted vector of marks. A mark is a
+// source range plus what to write in its place, and rendering interleaves
+// the marks with escaped text straight into the output. Link reference
+// definitions live in one string pool behind an open-addressed index. A
+// reused compiler therefore allocates only when a document is larger than
+// any before it.
+//
+// Inline special characters, HTML escaping and line ends are all found by
+// the same 32-byte nibble-table scan (see ByteSet).
+class MarkdownCompiler {
+ public:
+  MarkdownCompiler();
+  ~MarkdownCompiler();
+  MarkdownCompiler(const MarkdownCompiler&) = delete;
+  MarkdownCompiler& operator=(const MarkdownCompiler&) = delete;
+
+  // Appends the HTML for `markdown` to `out`.
+  void compile(std::string_view markdown, std::string& out);
+
+  // Text of the first heading of the last compiled document, HTML-escaped
+  // and stripped of markup, or empty if it had no heading. Level 1 is
+  // preferred when the document has one.
+  std::string_view title() const;
+
+ private:
+  struct State;
+  std::unique_ptr<State> state_;
+};
+
+}  // namespace mt::gen
@@ -0,0 +1,165 @@
+#include "gen/responsive.h"
+
+#include <algorithm>
+
+#include "gen/fingerprint.h"
+#include "gen/text.h"
+#include "http.h"
+
+namespace mt::gen {
+
+namespace {
+
+struct ImgAttributes {
+  std::string_view src;
+  bool srcset = false, width = false, height = false;
+};
+
+ImgAttributes img_attributes(std::string_view tag) {
+  ImgAttributes a;
+  std::size_t j = 0;
+  while (j < tag.size()) {
+    while (j < tag.size() && (space(tag[j]) || tag[j] == '/')) ++j;
+    auto name_start = j;
+    while (j < tag.size() && !space(tag[j]) && tag[j] != '=' && tag[j] != '/') ++j;
+    auto name = tag.substr(name_start, j - name_start);
+    std::string_view value;
+    while (j < tag.size() && space(tag[j])) ++j;
+    if (j < tag.size() && tag[j] == '=') {
+      ++j;
+      while (j < tag.size() && space(tag[j])) ++j;
+      if (j < tag.size() && (tag[j] == '"' || tag[j] == '\'')) {
+        auto close = tag.find(tag[j], j + 1);
+        if (close == std::string_view::npos) close = tag.size();
+        value = tag.substr(j + 1, close - j - 1);
+        j = close + 1;
+      } else {
+        auto value_start = j;
+        while (j < tag.size() && !space(tag[j])) ++j;
+        value = tag.substr(value_start, j - value_start);
+      }
+    }
+    if (http::iequals(name, "src")) {
+      a.src = value;
+    } else if (http::iequals(name, "srcset")) {
+      a.srcset = true;
+    } else if (http::iequals(name, "width")) {
+      a.width = true;
+    } else if (http::iequals(name, "height")) {
+      a.height = true;
+    }
+  }
+  return a;
+}
+
+// Attribute text inside double quotes.
+void append_attribute(std::string& out, std::string_view value) {
+  for (char c : value) {
+    if (c == '"') {
+      out += "&quot;";
+    } else {
+      out += c;
+    }
+  }
+}
+
+void append_srcset(std::string& out, const std::vector<ResponsiveImage::Candidate>& candidates) {
+  for (const auto& c : candidates) {
+    if (&c != &candidates.front()) out += ", ";
+    out += '/';
+    append_attribute(out, c.rel);
+    out += ' ';
+    out += std::to_string(c.width);
+    out += 'w';
+  }
+}
+
+// `img` is the whole tag and `attrs` the text between its name and its
+// closing "/>" or ">".
+void append_img(std::string& out, std::string_view img, std::string_view attrs, const ResponsiveImage& image,
+                std::string_view src, bool in_picture) {
+  std::string sizes = " sizes=\"(max-width: " + std::to_string(image.width) + "px) 100vw, " +
+                      std::to_string(image.width) + "px\"";
+  bool wrap = !in_picture && !image.sources.empty();
+  if (wrap) {
+    out += "<picture>";
+    for (const auto& source : image.sources) {
+      out += "<source type=\"";
+      out += source.type;
+      out += "\" srcset=\"";
+      append_srcset(out, source.candidates);
+      out += '"';
+      out += sizes;
+      out += '>';
+    }
+  }
+  auto attrs_end = static_cast<std::size_t>(attrs.data() - img.data()) + attrs.size();
+  out += img.substr(0, attrs_end);
+  auto a = img_attributes(attrs);
+  if (!a.width && !a.height) {
+    out += " width=\"" + std::to_string(image.width) + "\" height=\"" + std::to_string(image.height) + '"';
+  }
+  if (!image.fallback.empty()) {
+    out += " srcset=\"";
+    append_srcset(out, image.fallback);
+    out += ", ";
+    append_attribute(out, src);
+    out += ' ';
+    out += std::to_string(image.width);
+    out += "w\"";
+    out += sizes;
+  }
+  out += img.substr(attrs_end);
+  if (wrap) out += "</picture>";
+}
+
+}  // namespace
+
+std::string rewrite_images(std::string_view html, std::string_view rel, const ResponsiveImages& images) {
+  if (images.empty() || find_tag(html, "<img", 0) == html.size()) return std::string(html);
+  std::string out;
+  out.reserve(html.size() + 512);
+  std::size_t copied = 0, i = 0;
+  int pictures = 0;  // open <picture> elements
+  while ((i = html.find('<', i)) != std::string_view::npos) {
+    if (html.substr(i).starts_with("<!--")) {
+      auto end = html.find("-->", i + 4);
+      if (end == std::string_view::npos) break;
+      i = end + 3;
+      continue;
+    }
+    bool closing = i + 1 < html.size() && html[i + 1] == '/';
+    auto j = i + 1 + closing;
+    while (j < html.size() && ident(html[j])) ++j;
+    auto name = html.substr(i + 1 + closing, j - i - 1 - closing);
+    if (name.empty()) {
+      i = j;
+      continue;
+    }
+    auto end = tag_end(html, i);
+    if (!closing && (http::iequals(name, "script") || http::iequals(name, "style"))) {
+      i = find_tag(html, http::iequals(name, "script") ? "</script" : "</style", end);
+      continue;
+    }
+    if (http::iequals(name, "picture")) {
+      pictures = closing ? std::max(0, pictures - 1) : pictures + 1;
+    } else if (!closing && http::iequals(name, "img")) {
+      auto img = html.substr(i, end - i);
+      auto attrs_end = img.size() - (img.ends_with("/>") ? 2 : img.ends_with(">") ? 1 : 0);
+      while (attrs_end > j - i && space(img[attrs_end - 1])) --attrs_end;
+      auto attrs = img.substr(j - i, attrs_end - (j - i));
+      auto a = img_attributes(attrs);
+      auto found = a.srcset || a.src.empty() ? images.end() : images.find(resolve_url(a.src, rel));
+      if (found != images.end()) {
+        out.append(html, copied, i - copied);
+        append_img(out, img, attrs, found->second, a.src, pictures > 0);
+        copied = end;
+      }
+    }
+    i = end;
+  }
+  out.append(html, copied);
+  return out;
+}
+
+}  // namespace mt::gen
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace mt::gen {
+
+// What pages need to know about one image to offer its resized variants.
+struct ResponsiveImage {
+  std::uint32_t width = 0;   // of the original
+  std::uint32_t height = 0;  // of the original
+  struct Candidate {
+    std::string rel;  // published path of a variant
+    std::uint32_t width = 0;
+  };
+  // Variants in the original's format, narrowest first; the original
+  // itself is the widest candidate and is not listed.
+  std::vector<Candidate> fallback;
+  // Variants in newer formats, best first (AVIF, then WebP), each with its
+  // candidates narrowest first. These include the original's width.
+  struct Source {
+    std::string_view type;  // "image/avif", ...
+    std::vector<Candidate> candidates;
+  };
+  std::vector<Source> sources;
+  std::uint64_t key = 0;  // hash of all of the above, for the keys of pages showing it
+};
+
+// Site path of an original image -> its variants.
+using ResponsiveImages = std::map<std::string, ResponsiveImage, std::less<>>;
+
+// Rewrites every <img> in `html` (the page at `rel`) whose src names one of
+// `images` and that has no srcset of its own:
+//  - width and height attributes give the original's size when the tag has
+//    neither, so the browser reserves the box before the image arrives;
+//  - srcset lists the variants in the original's format and the original,
+//    with sizes capping the displayed width at the original's;
+//  - outside a <picture>, the tag is wrapped in one with a <source> per
+//    newer format, so browsers that decode AVIF or WebP pick those.
+// Other markup, comments, <script> and <style> are copied through.
+std::string rewrite_images(std::string_view html, std::string_view rel, const ResponsiveImages& images);
+
+}  // namespace mt::gen
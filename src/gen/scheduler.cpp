@@ -0,0 +1,195 @@
+#include "gen/scheduler.h"
+
+#include <algorithm>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+namespace mt::gen {
+
+namespace {
+
+constexpr std::int64_t kInitialRing = 256;
+constexpr int kIdleSpins = 64;  // steal rounds before a worker sleeps
+
+// The worker the current thread is, if it belongs to a scheduler.
+thread_local Scheduler* tls_scheduler = nullptr;
+thread_local unsigned tls_worker = 0;
+
+void cpu_relax() {
+#if defined(__x86_64__)
+  _mm_pause();
+#endif
+}
+
+std::uint64_t next_random(std::uint64_t& state) {  // xorshift64
+  state ^= state << 13;
+  state ^= state >> 7;
+  state ^= state << 17;
+  return state;
+}
+
+}  // namespace
+
+TaskDeque::TaskDeque() {
+  rings_.push_back(std::make_unique<Ring>(kInitialRing));
+  ring_.store(rings_.back().get(), std::memory_order_relaxed);
+}
+
+void TaskDeque::push(Task* task) {
+  auto b = bottom_.load(std::memory_order_relaxed);
+  auto t = top_.load(std::memory_order_acquire);
+  auto* ring = ring_.load(std::memory_order_relaxed);
+  if (b - t > ring->capacity - 1) {
+    auto bigger = std::make_unique<Ring>(ring->capacity * 2);
+    for (auto i = t; i < b; ++i) {
+      bigger->at(i).store(ring->at(i).load(std::memory_order_relaxed), std::memory_order_relaxed);
+    }
+    ring = bigger.get();
+    rings_.push_back(std::move(bigger));
+    ring_.store(ring, std::memory_order_release);
+  }
+  ring->at(b).store(task, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  bottom_.store(b + 1, std::memory_order_relaxed);
+}
+
+Task* TaskDeque::pop() {
+  auto b = bottom_.load(std::memory_order_relaxed) - 1;
+  auto* ring = ring_.load(std::memory_order_relaxed);
+  bottom_.store(b, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  auto t = top_.load(std::memory_order_relaxed);
+  if (t > b) {  // empty
+    bottom_.store(b + 1, std::memory_order_relaxed);
+    return nullptr;
+  }
+  Task* task = ring->at(b).load(std::memory_order_relaxed);
+  if (t == b) {  // the last one: race thieves for it
+    if (!top_.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) task = nullptr;
+    bottom_.store(b + 1, std::memory_order_relaxed);
+  }
+  return task;
+}
+
+Task* TaskDeque::steal() {
+  auto t = top_.load(std::memory_order_acquire);
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  auto b = bottom_.load(std::memory_order_acquire);
+  if (t >= b) return nullptr;
+  Task* task = ring_.load(std::memory_order_acquire)->at(t).load(std::memory_order_relaxed);
+  if (!top_.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) return nullptr;
+  return task;
+}
+
+Scheduler::Scheduler(unsigned threads) {
+  if (threads == 0) threads = std::max(1u, std::thread::hardware_concurrency());
+  for (unsigned i = 0; i < threads; ++i) {
+    workers_.push_back(std::make_unique<Worker>());
+    workers_.back()->rng = 0x9e3779b97f4a7c15ull * (i + 1);
+  }
+  tls_scheduler = this;
+  tls_worker = 0;
+  for (unsigned i = 1; i < threads; ++i) threads_.emplace_back([this, i] { worker_main(i); });
+}
+
+Scheduler::~Scheduler() {
+  stop_.store(true, std::memory_order_seq_cst);
+  epoch_.fetch_add(1, std::memory_order_release);
+  epoch_.notify_all();
+  for (auto& t : threads_) t.join();
+  if (tls_scheduler == this) tls_scheduler = nullptr;
+}
+
+Scheduler::Worker& Scheduler::self() { return *workers_[tls_scheduler == this ? tls_worker : 0]; }
+
+void Scheduler::push(Task* task) {
+  self().deque.push(task);
+  // Pairs with the fence in worker_main: either this sees the sleeper or
+  // the sleeper's last look finds the task.
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (sleepers_.load(std::memory_order_relaxed) > 0) {
+    epoch_.fetch_add(1, std::memory_order_release);
+    epoch_.notify_one();
+  }
+}
+
+Task* Scheduler::find_task(Worker& w) {
+  if (auto* task = w.deque.pop()) return task;
+  auto n = workers_.size();
+  if (n == 1) return nullptr;
+  auto start = next_random(w.rng) % n;
+  for (std::size_t i = 0; i < n; ++i) {
+    auto& victim = *workers_[(start + i) % n];
+    if (&victim == &w) continue;
+    if (auto* task = victim.deque.steal()) return task;
+  }
+  return nullptr;
+}
+
+void Scheduler::execute(Task* task) {
+  auto* group = task->group;
+  try {
+    task->run(task, !group->failed());
+  } catch (...) {
+    group->fail(std::current_exception());
+  }
+  group->pending_.fetch_sub(1, std::memory_order_acq_rel);  // the group may be gone after this
+}
+
+void Scheduler::worker_main(unsigned index) {
+  tls_scheduler = this;
+  tls_worker = index;
+  auto& w = *workers_[index];
+  while (!stop_.load(std::memory_order_relaxed)) {
+    Task* task = nullptr;
+    for (int spin = 0; spin < kIdleSpins && task == nullptr; ++spin) {
+      task = find_task(w);
+      if (task == nullptr) cpu_relax();
+    }
+    if (task != nullptr) {
+      execute(task);
+      continue;
+    }
+    auto epoch = epoch_.load(std::memory_order_acquire);
+    sleepers_.fetch_add(1, std::memory_order_seq_cst);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    task = find_task(w);
+    if (task == nullptr && !stop_.load(std::memory_order_relaxed)) epoch_.wait(epoch, std::memory_order_acquire);
+    sleepers_.fetch_sub(1, std::memory_order_relaxed);
+    if (task != nullptr) execute(task);
+  }
+}
+
+TaskGroup::~TaskGroup() { finish_waiting(); }
+
+void TaskGroup::finish_waiting() {
+  auto& w = scheduler_.self();
+  for (int idle = 0; pending_.load(std::memory_order_acquire) > 0;) {
+    if (auto* task = scheduler_.find_task(w)) {
+      scheduler_.execute(task);
+      idle = 0;
+    } else if (++idle < kIdleSpins) {
+      cpu_relax();
+    } else {
+      std::this_thread::yield();
+    }
+  }
+}
+
+void TaskGroup::wait() {
+  finish_waiting();
+  if (failed()) {
+    failed_.store(false, std::memory_order_relaxed);
+    std::rethrow_exception(std::exchange(error_, nullptr));
+  }
+}
+
+void TaskGroup::fail(std::exception_ptr e) {
+  std::lock_guard lock(error_mu_);
+  if (!error_) error_ = std::move(e);
+  failed_.store(true, std::memory_order_relaxed);
+}
+
+}  // namespace mt::gen
@@ -0,0 +1,169 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace mt::gen {
+
+class TaskGroup;
+
+// A heap-allocated unit of work. `run` executes it when `execute` is true,
+// and always frees it.
+struct Task {
+  using Run = void (*)(Task*, bool execute);
+  explicit Task(Run r) : run(r) {}
+  Run run;
+  TaskGroup* group = nullptr;
+};
+
+// Chase-Lev work-stealing deque (Le, Pop, Cohen and Zappa Nardelli, "Correct
+// and Efficient Work-Stealing for Weak Memory Models", PPoPP 2013). The
+// owning thread pushes and pops at the bottom without contention; other
+// threads steal from the top with one CAS. The ring doubles when full, and
+// old rings are kept until the deque dies because a thief may still be
+// reading one.
+class TaskDeque {
+ public:
+  TaskDeque();
+  TaskDeque(const TaskDeque&) = delete;
+  TaskDeque& operator=(const TaskDeque&) = delete;
+
+  void push(Task* task);  // owner only
+  Task* pop();            // owner only
+  Task* steal();          // any thread; nullptr if empty or lost a race
+
+ private:
+  struct Ring {
+    explicit Ring(std::int64_t cap) : capacity(cap), slots(new std::atomic<Task*>[static_cast<std::size_t>(cap)]) {}
+    std::int64_t capacity;
+    std::unique_ptr<std::atomic<Task*>[]> slots;
+    std::atomic<Task*>& at(std::int64_t i) { return slots[static_cast<std::size_t>(i & (capacity - 1))]; }
+  };
+
+  alignas(64) std::atomic<std::int64_t> top_{0};
+  alignas(64) std::atomic<std::int64_t> bottom_{0};
+  std::atomic<Ring*> ring_;
+  std::vector<std::unique_ptr<Ring>> rings_;  // every ring ever used, owner only
+};
+
+// A fixed pool of threads, each owning a TaskDeque. New tasks go to the
+// bottom of the spawning thread's deque; an idle thread steals from the top
+// of a random victim's, which holds the oldest and, under recursive
+// splitting, largest piece of work. There is no shared queue and no lock
+// on the task path. Idle threads spin briefly, then sleep on a futex that
+// spawns signal only while someone sleeps.
+//
+// The thread that constructs the scheduler is its worker 0 and takes part
+// whenever it waits on a TaskGroup, so `threads` counts it. Work may only be
+// spawned from that thread or from inside a task.
+class Scheduler {
+ public:
+  explicit Scheduler(unsigned threads = 0);  // 0 = one per CPU
+  ~Scheduler();
+  Scheduler(const Scheduler&) = delete;
+  Scheduler& operator=(const Scheduler&) = delete;
+
+  unsigned threads() const { return static_cast<unsigned>(workers_.size()); }
+
+  // Runs fn(i) for every i in [0, n) and returns once all have finished.
+  // The range is split in halves recursively, so thieves take big pieces
+  // and jobs of uneven size (a 35 KB brotli-11 next to an 83-byte file)
+  // still balance. fn may spawn and wait on its own TaskGroups. The first
+  // exception thrown by any job is rethrown here; jobs not yet started
+  // are skipped.
+  template <class Fn>
+  void parallel_for(std::size_t n, Fn&& fn);
+
+ private:
+  friend class TaskGroup;
+  struct alignas(64) Worker {
+    TaskDeque deque;
+    std::uint64_t rng = 0;
+  };
+
+  Worker& self();
+  void push(Task* task);
+  Task* find_task(Worker& w);
+  void execute(Task* task);
+  void worker_main(unsigned index);
+
+  std::vector<std::unique_ptr<Worker>> workers_;
+  std::vector<std::thread> threads_;
+  std::atomic<unsigned> sleepers_{0};
+  std::atomic<std::uint32_t> epoch_{0};
+  std::atomic<bool> stop_{false};
+};
+
+// Tasks spawned together and waited for together. wait() does not block:
+// the waiting thread keeps running tasks, newest from its own deque first,
+// until the group is done, so groups nest freely inside tasks.
+class TaskGroup {
+ public:
+  explicit TaskGroup(Scheduler& scheduler) : scheduler_(scheduler) {}
+  ~TaskGroup();  // waits, discarding any exception
+  TaskGroup(const TaskGroup&) = delete;
+  TaskGroup& operator=(const TaskGroup&) = delete;
+
+  template <class Fn>
+  void spawn(Fn&& fn);
+
+  // Returns once every spawned task has finished, rethrowing the first
+  // exception one of them threw. Tasks that had not started when it was
+  // thrown are skipped.
+  void wait();
+
+  bool failed() const { return failed_.load(std::memory_order_relaxed); }
+
+ private:
+  friend class Scheduler;
+  void fail(std::exception_ptr e);
+  void finish_waiting();
+
+  Scheduler& scheduler_;
+  std::atomic<std::size_t> pending_{0};
+  std::atomic<bool> failed_{false};
+  std::mutex error_mu_;  // taken only when a task throws
+  std::exception_ptr error_;
+};
+
+template <class Fn>
+void TaskGroup::spawn(Fn&& fn) {
+  struct FnTask : Task {
+    explicit FnTask(Fn&& f) : Task(&FnTask::invoke), fn(std::forward<Fn>(f)) {}
+    static void invoke(Task* t, bool execute) {
+      std::unique_ptr<FnTask> self(static_cast<FnTask*>(t));
+      if (execute) self->fn();
+    }
+    std::decay_t<Fn> fn;
+  };
+  auto* task = new FnTask(std::forward<Fn>(fn));
+  task->group = this;
+  pending_.fetch_add(1, std::memory_order_relaxed);
+  scheduler_.push(task);
+}
+
+template <class Fn>
+void Scheduler::parallel_for(std::size_t n, Fn&& fn) {
+  TaskGroup group(*this);
+  // Keeps the left half and spawns the right until one index is left.
+  auto split = [&](auto& self, std::size_t begin, std::size_t end) -> void {
+    while (end - begin > 1) {
+      auto mid = begin + (end - begin) / 2;
+      group.spawn([&self, mid, end] { self(self, mid, end); });
+      end = mid;
+    }
+    if (begin < end) fn(begin);
+  };
+  if (n > 0) group.spawn([&] { split(split, 0, n); });
+  group.wait();
+}
+
+}  // namespace mt::gen
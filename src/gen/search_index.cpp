@@ -0,0 +1,264 @@
+#include "gen/search_index.h"
+
+#include <algorithm>
+#include <charconv>
+#include <cstring>
+#include <stdexcept>
+#include <unordered_map>
+
+#include "gen/entities.h"
+#include "gen/text.h"
+#include "search.h"
+
+namespace mt::gen {
+
+namespace {
+
+// Elements whose contents are not text a reader sees.
+constexpr std::string_view kSkippedElements[] = {"script", "style", "template"};
+
+// Phrasing elements that can sit inside a word ("<em>re</em>build"); every
+// other tag separates words.
+constexpr std::string_view kInlineElements[] = {"a",   "abbr", "b",    "bdi", "bdo",  "cite", "code",
+                                                "data", "dfn", "em",   "i",   "kbd",  "mark", "q",
+                                                "s",   "samp", "small", "span", "strong", "sub", "sup",
+                                                "time", "u",   "var",  "wbr"};
+
+constexpr bool is_name_char(char c) {
+  return (c >= '0' && c <= '9') || ((c | 0x20) >= 'a' && (c | 0x20) <= 'z') || c == '-';
+}
+
+// Index of the "</name" closing a raw-text element, or the end.
+std::size_t find_end_tag(std::string_view html, std::size_t i, std::string_view name) {
+  while ((i = html.find("</", i)) != std::string_view::npos) {
+    auto candidate = html.substr(i + 2, name.size());
+    bool match = candidate.size() == name.size() &&
+                 std::equal(candidate.begin(), candidate.end(), name.begin(),
+                            [](char a, char b) { return static_cast<char>(a | 0x20) == b; });
+    if (match) return i;
+    i += 2;
+  }
+  return html.size();
+}
+
+// `s` with whitespace runs collapsed to one space and trimmed.
+std::string collapse_space(std::string_view s) {
+  std::string out;
+  for (char c : s) {
+    bool space = c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\f';
+    if (!space) {
+      out += c;
+    } else if (!out.empty() && out.back() != ' ') {
+      out += ' ';
+    }
+  }
+  if (!out.empty() && out.back() == ' ') out.pop_back();
+  return out;
+}
+
+struct Posting {
+  std::uint32_t doc = 0;
+  std::uint32_t count = 0;
+};
+
+// Appends one block of postings (see search.h), continuing the doc-id
+// gaps from `last`.
+void encode_block(const Posting* p, std::uint32_t n, std::uint32_t& last, std::string& out) {
+  std::uint32_t values[2 * kSearchBlock + 4] = {};
+  for (std::uint32_t i = 0; i < n; ++i) {
+    values[i] = p[i].doc - last;
+    last = p[i].doc;
+    values[n + i] = p[i].count;
+  }
+  auto count = (2 * n + 3) & ~3u;
+  auto control = out.size();
+  out.append(count / 4, '\0');
+  for (std::uint32_t k = 0; k < count; ++k) {
+    auto v = values[k];
+    unsigned bytes = v < (1u << 8) ? 1 : v < (1u << 16) ? 2 : v < (1u << 24) ? 3 : 4;
+    out[control + k / 4] = static_cast<char>(out[control + k / 4] | ((bytes - 1) << (2 * (k % 4))));
+    for (unsigned b = 0; b < bytes; ++b) out += static_cast<char>(v >> (8 * b));
+  }
+}
+
+void align8(std::string& out) { out.resize((out.size() + 7) & ~std::size_t{7}, '\0'); }
+
+template <class T>
+void append_raw(std::string& out, const std::vector<T>& items) {
+  out.append(reinterpret_cast<const char*>(items.data()), items.size() * sizeof(T));
+}
+
+}  // namespace
+
+SearchDocument search_document(std::string_view html) {
+  SearchDocument doc;
+  std::string text, title;
+  std::string* to = &text;
+  std::size_t i = 0;
+  while (i < html.size()) {
+    char c = html[i];
+    if (c == '&') {
+      if (auto n = decode_character_reference(html, i, *to)) {
+        i += n;
+        continue;
+      }
+    }
+    if (c != '<') {
+      *to += c;
+      ++i;
+      continue;
+    }
+    if (html.substr(i, 4) == "<!--") {
+      auto close = html.find("-->", i + 4);
+      i = close == std::string_view::npos ? html.size() : close + 3;
+      continue;
+    }
+    bool closing = i + 1 < html.size() && html[i + 1] == '/';
+    auto start = i + 1 + closing;
+    auto stop = start;
+    while (stop < html.size() && is_name_char(html[stop])) ++stop;
+    std::string name(html.substr(start, stop - start));
+    for (auto& ch : name) ch = static_cast<char>(ch | 0x20);
+    i = tag_end(html, i);
+    if (std::find(std::begin(kInlineElements), std::end(kInlineElements), name) == std::end(kInlineElements)) {
+      *to += ' ';
+    }
+    if (!closing && std::find(std::begin(kSkippedElements), std::end(kSkippedElements), name) !=
+                        std::end(kSkippedElements)) {
+      i = tag_end(html, find_end_tag(html, i, name));
+    } else if (name == "title") {
+      to = closing ? &text : &title;
+    }
+  }
+
+  doc.title = collapse_space(title);
+  std::unordered_map<std::string, std::uint32_t> counts;
+  std::string term;
+  for (std::string_view rest : {std::string_view(doc.title), std::string_view(text)}) {
+    while (next_search_term(rest, term)) {
+      ++counts[term];
+      ++doc.length;
+    }
+  }
+  doc.terms.assign(counts.begin(), counts.end());
+  std::sort(doc.terms.begin(), doc.terms.end());
+  return doc;
+}
+
+// The blob is "<length>\n<title>\n" and then "<term>\t<count>\n" per term.
+// Titles are collapsed and terms are word bytes, so neither holds a
+// newline or a tab.
+std::string serialize_search_document(const SearchDocument& doc) {
+  std::string out = std::to_string(doc.length);
+  out += '\n';
+  out += doc.title;
+  out += '\n';
+  for (const auto& [term, count] : doc.terms) {
+    out += term;
+    out += '\t';
+    out += std::to_string(count);
+    out += '\n';
+  }
+  return out;
+}
+
+bool parse_search_document(std::string_view blob, SearchDocument& doc) {
+  auto next_line = [&blob](std::string_view& line) {
+    auto nl = blob.find('\n');
+    if (nl == std::string_view::npos) return false;
+    line = blob.substr(0, nl);
+    blob.remove_prefix(nl + 1);
+    return true;
+  };
+  auto number = [](std::string_view s, std::uint32_t& v) {
+    auto r = std::from_chars(s.data(), s.data() + s.size(), v);
+    return r.ec == std::errc() && r.ptr == s.data() + s.size();
+  };
+  std::string_view line;
+  if (!next_line(line) || !number(line, doc.length) || !next_line(line)) return false;
+  doc.title = line;
+  doc.terms.clear();
+  while (next_line(line)) {
+    auto tab = line.find('\t');
+    std::uint32_t count = 0;
+    if (tab == std::string_view::npos || !number(line.substr(tab + 1), count)) return false;
+    doc.terms.emplace_back(line.substr(0, tab), count);
+  }
+  return blob.empty();
+}
+
+std::string search_index(const std::vector<SearchDocument>& docs) {
+  std::unordered_map<std::string_view, std::vector<Posting>> postings;
+  std::uint64_t total = 0;
+  for (std::size_t d = 0; d < docs.size(); ++d) {
+    for (const auto& [term, count] : docs[d].terms) {
+      postings[term].push_back({static_cast<std::uint32_t>(d), count});
+    }
+    total += docs[d].length;
+  }
+  std::vector<std::pair<std::string_view, const std::vector<Posting>*>> terms;
+  terms.reserve(postings.size());
+  for (const auto& [term, list] : postings) terms.emplace_back(term, &list);
+  std::sort(terms.begin(), terms.end());
+
+  std::string strings;
+  auto add_string = [&strings](std::string_view s) {
+    if (strings.size() + s.size() > UINT32_MAX) throw std::runtime_error("search index too large");
+    auto at = static_cast<std::uint32_t>(strings.size());
+    strings += s;
+    return at;
+  };
+  std::vector<SearchDoc> doc_table;
+  doc_table.reserve(docs.size());
+  for (const auto& d : docs) {
+    SearchDoc e{};
+    e.url = add_string(d.url);
+    e.url_size = static_cast<std::uint32_t>(d.url.size());
+    e.title = add_string(d.title);
+    e.title_size = static_cast<std::uint32_t>(d.title.size());
+    e.length = d.length;
+    doc_table.push_back(e);
+  }
+  std::vector<SearchTerm> term_table;
+  term_table.reserve(terms.size());
+  std::string blocks;
+  for (const auto& [term, list] : terms) {
+    SearchTerm e{};
+    e.text = add_string(term);
+    e.text_size = static_cast<std::uint32_t>(term.size());
+    e.docs = static_cast<std::uint32_t>(list->size());
+    e.postings = blocks.size();
+    std::uint32_t last = 0;
+    for (std::size_t at = 0; at < list->size(); at += kSearchBlock) {
+      auto n = static_cast<std::uint32_t>(std::min<std::size_t>(kSearchBlock, list->size() - at));
+      encode_block(list->data() + at, n, last, blocks);
+    }
+    term_table.push_back(e);
+  }
+
+  SearchHeader header{};
+  std::memcpy(header.magic, kSearchMagic, sizeof kSearchMagic);
+  header.doc_count = static_cast<std::uint32_t>(docs.size());
+  header.term_count = static_cast<std::uint32_t>(term_table.size());
+  header.average_length = docs.empty() ? 0.0f : static_cast<float>(static_cast<double>(total) / docs.size());
+
+  std::string out(sizeof header, '\0');
+  align8(out);
+  header.docs = out.size();
+  append_raw(out, doc_table);
+  align8(out);
+  header.terms = out.size();
+  append_raw(out, term_table);
+  align8(out);
+  header.strings = out.size();
+  out += strings;
+  align8(out);
+  header.postings = out.size();
+  out += blocks;
+  out.append(kSearchPadding, '\0');
+  header.size = out.size();
+  std::memcpy(out.data(), &header, sizeof header);
+  return out;
+}
+
+}  // namespace mt::gen
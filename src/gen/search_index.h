@@ -0,0 +1,35 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace mt::gen {
+
+// What the search index records about one page.
+struct SearchDocument {
+  std::string url;    // what a hit links to
+  std::string title;  // plain text
+  std::uint32_t length = 0;  // terms on the page
+  std::vector<std::pair<std::string, std::uint32_t>> terms;  // distinct terms with their counts, sorted
+};
+
+// The title (the <title> element) and the terms (see next_search_term()) of
+// the text a reader sees in `html`. Character references are decoded, and
+// tags, comments and the contents of <script>, <style> and <template> are
+// skipped. Leaves `url` empty.
+SearchDocument search_document(std::string_view html);
+
+// A document as a cache blob and back, without its url. parse returns
+// false for a malformed blob.
+std::string serialize_search_document(const SearchDocument& doc);
+bool parse_search_document(std::string_view blob, SearchDocument& doc);
+
+// The index file (see search.h) of `docs`, in the order given, which
+// should be by URL. Throws std::runtime_error if it would exceed the
+// format's 32-bit string offsets.
+std::string search_index(const std::vector<SearchDocument>& docs);
+
+}  // namespace mt::gen
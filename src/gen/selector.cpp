@@ -0,0 +1,652 @@
+#include "gen/selector.h"
+
+#include <algorithm>
+#include <array>
+#include <cstdlib>
+
+#include "gen/entities.h"
+#include "gen/text.h"
+#include "http.h"
+
+namespace mt::gen {
+
+namespace {
+
+std::string lowercase(std::string_view s) {
+  std::string out(s);
+  for (auto& c : out) c = lower(c);
+  return out;
+}
+
+bool one_of(std::string_view name, std::initializer_list<std::string_view> names) {
+  return std::find(names.begin(), names.end(), name) != names.end();
+}
+
+// --- element tree ------------------------------------------------------------
+
+bool void_element(std::string_view tag) {
+  return one_of(tag, {"area", "base", "br", "col", "embed", "hr", "img", "input", "link", "meta", "source", "track",
+                      "wbr"});
+}
+
+bool raw_text(std::string_view tag) { return one_of(tag, {"script", "style", "textarea", "title", "xmp"}); }
+
+// Start tags that end an open <p>.
+bool closes_p(std::string_view tag) {
+  return one_of(tag, {"address", "article", "aside", "blockquote", "details", "div", "dl", "fieldset", "figcaption",
+                      "figure", "footer", "form", "h1", "h2", "h3", "h4", "h5", "h6", "header", "hgroup", "hr",
+                      "main", "menu", "nav", "ol", "p", "pre", "section", "table", "ul"});
+}
+
+// Whether a start tag `next` implies the end of an open `open` element.
+bool implied_by(std::string_view open, std::string_view next) {
+  if (open == "p") return closes_p(next);
+  if (open == "li") return next == "li";
+  if (open == "dt" || open == "dd") return next == "dt" || next == "dd";
+  if (open == "option") return next == "option" || next == "optgroup";
+  if (open == "optgroup") return next == "optgroup";
+  if (open == "tr") return one_of(next, {"tr", "tbody", "thead", "tfoot"});
+  if (open == "td" || open == "th") return one_of(next, {"td", "th", "tr", "tbody", "thead", "tfoot"});
+  if (open == "thead" || open == "tbody" || open == "tfoot") return next == "tbody" || next == "tfoot";
+  if (open == "rt" || open == "rp") return next == "rt" || next == "rp";
+  return false;
+}
+
+// Elements that start on a new line in the flow model.
+bool block_element(std::string_view tag) {
+  return closes_p(tag) || one_of(tag, {"body", "li", "dt", "dd", "tr", "caption", "summary", "legend", "option",
+                                       "video", "iframe", "canvas", "picture", "svg"});
+}
+
+// Blocks that get a margin above them.
+bool spaced_element(std::string_view tag) {
+  return one_of(tag, {"p", "h1", "h2", "h3", "h4", "h5", "h6", "ul", "ol", "dl", "blockquote", "pre", "figure",
+                      "table", "hr", "form", "fieldset"});
+}
+
+// Content the flow model gives no height.
+bool hidden_element(std::string_view tag) {
+  return one_of(tag, {"head", "template", "noscript", "script", "style", "title", "datalist", "dialog"});
+}
+
+// The flow model (see parse_document()).
+constexpr std::uint32_t kColumn = 800;
+constexpr std::uint32_t kMargin = 16;
+constexpr std::uint32_t kReplacedHeight = 150;
+
+struct Font {
+  std::uint32_t chars;  // per line
+  std::uint32_t line;   // height
+};
+
+constexpr Font kBodyFont{90, 24};
+constexpr std::array<Font, 6> kHeadingFonts{{{45, 40}, {60, 32}, {77, 28}, {90, 24}, {108, 20}, {120, 18}}};
+
+class TreeBuilder {
+ public:
+  explicit TreeBuilder(std::string_view html) : html_(html) {}
+
+  Document run() {
+    std::size_t i = 0;
+    while (i < html_.size()) {
+      auto lt = html_.find('<', i);
+      if (lt == std::string_view::npos) lt = html_.size();
+      text(html_.substr(i, lt - i));
+      if (lt == html_.size()) break;
+      i = markup(lt);
+    }
+    flush();
+    return std::move(doc_);
+  }
+
+ private:
+  struct Open {
+    std::int32_t element;
+    std::int32_t last_child = -1;
+    bool hidden;
+    const Font* font;
+  };
+
+  // Parses the markup at html_[i] == '<' and returns the index past it.
+  std::size_t markup(std::size_t i) {
+    auto rest = html_.substr(i);
+    if (rest.starts_with("<!--")) {
+      auto end = html_.find("-->", i + 4);
+      return end == std::string_view::npos ? html_.size() : end + 3;
+    }
+    if (rest.starts_with("<!") || rest.starts_with("<?")) {
+      auto end = html_.find('>', i);
+      return end == std::string_view::npos ? html_.size() : end + 1;
+    }
+    bool closing = rest.size() > 1 && rest[1] == '/';
+    auto j = i + 1 + closing;
+    auto name_start = j;
+    while (j < html_.size() && !space(html_[j]) && html_[j] != '>' && html_[j] != '/') ++j;
+    if (j == name_start || !((html_[name_start] | 0x20) >= 'a' && (html_[name_start] | 0x20) <= 'z')) {
+      text("<");
+      return i + 1;
+    }
+    auto tag = lowercase(html_.substr(name_start, j - name_start));
+    if (closing) {
+      auto end = html_.find('>', j);
+      end_tag(tag);
+      return end == std::string_view::npos ? html_.size() : end + 1;
+    }
+    Document::Element e;
+    e.tag = std::move(tag);
+    e.offset = i;
+    j = attributes(j, e);
+    bool self_closing = j >= 2 && html_[j - 2] == '/';
+    bool skip = raw_text(e.tag);
+    std::string raw_end;
+    if (skip) raw_end = std::string("</").append(e.tag);
+    auto tag_name = e.tag;
+    start_tag(std::move(e), self_closing);
+    if (skip) {
+      auto k = j;
+      for (;;) {
+        k = html_.find("</", k);
+        if (k == std::string_view::npos || http::iequals(html_.substr(k, raw_end.size()), raw_end)) break;
+        k += 2;
+      }
+      auto content = html_.substr(j, (k == std::string_view::npos ? html_.size() : k) - j);
+      if (!content.empty()) doc_.elements.back().empty = false;
+      if (tag_name == "textarea") text(content);
+      if (k == std::string_view::npos) return html_.size();
+      end_tag(tag_name);
+      auto end = html_.find('>', k);
+      return end == std::string_view::npos ? html_.size() : end + 1;
+    }
+    return j;
+  }
+
+  // Reads attributes from html_[j] to the end of the tag; returns the
+  // index past its '>'.
+  std::size_t attributes(std::size_t j, Document::Element& e) {
+    while (j < html_.size()) {
+      while (j < html_.size() && (space(html_[j]) || html_[j] == '/')) ++j;
+      if (j >= html_.size()) break;
+      if (html_[j] == '>') return j + 1;
+      auto name_start = j;
+      while (j < html_.size() && !space(html_[j]) && html_[j] != '=' && html_[j] != '>' && html_[j] != '/') ++j;
+      auto name = lowercase(html_.substr(name_start, j - name_start));
+      std::string value;
+      auto k = j;
+      while (k < html_.size() && space(html_[k])) ++k;
+      if (k < html_.size() && html_[k] == '=') {
+        j = k + 1;
+        while (j < html_.size() && space(html_[j])) ++j;
+        std::string_view raw;
+        if (j < html_.size() && (html_[j] == '"' || html_[j] == '\'')) {
+          auto close = html_.find(html_[j], j + 1);
+          if (close == std::string_view::npos) close = html_.size();
+          raw = html_.substr(j + 1, close - j - 1);
+          j = std::min(close + 1, html_.size());
+        } else {
+          auto start = j;
+          while (j < html_.size() && !space(html_[j]) && html_[j] != '>') ++j;
+          raw = html_.substr(start, j - start);
+        }
+        value = decode(raw);
+      }
+      if (name == "id") {
+        e.id = value;
+      } else if (name == "class") {
+        std::size_t c = 0;
+        while (c < value.size()) {
+          while (c < value.size() && space(value[c])) ++c;
+          auto start = c;
+          while (c < value.size() && !space(value[c])) ++c;
+          if (c > start) e.classes.push_back(value.substr(start, c - start));
+        }
+      }
+      e.attributes.emplace_back(std::move(name), std::move(value));
+    }
+    return html_.size();
+  }
+
+  static std::string decode(std::string_view raw) {
+    std::string out;
+    out.reserve(raw.size());
+    for (std::size_t i = 0; i < raw.size();) {
+      if (raw[i] == '&') {
+        if (auto n = decode_character_reference(raw, i, out)) {
+          i += n;
+          continue;
+        }
+      }
+      out += raw[i++];
+    }
+    return out;
+  }
+
+  void start_tag(Document::Element e, bool self_closing) {
+    while (!open_.empty() && implied_by(doc_.elements[open_.back().element].tag, e.tag)) close_top();
+    bool block = block_element(e.tag);
+    bool hidden_attribute =
+        std::any_of(e.attributes.begin(), e.attributes.end(), [](const auto& a) { return a.first == "hidden"; });
+    bool hidden = (!open_.empty() && open_.back().hidden) || hidden_element(e.tag) || hidden_attribute;
+    if (block && !hidden) {
+      flush();
+      if (spaced_element(e.tag)) y_ += kMargin;
+    }
+    const Font* font = open_.empty() ? &kBodyFont : open_.back().font;
+    if (e.tag.size() == 2 && e.tag[0] == 'h' && e.tag[1] >= '1' && e.tag[1] <= '6') {
+      font = &kHeadingFonts[e.tag[1] - '1'];
+    }
+    e.top = hidden ? Document::kHidden : y_ + pending_ / font->chars * font->line;
+
+    auto index = static_cast<std::int32_t>(doc_.elements.size());
+    if (!open_.empty()) {
+      auto& parent = open_.back();
+      doc_.elements[parent.element].empty = false;
+      e.parent = parent.element;
+      e.previous = parent.last_child;
+      if (parent.last_child >= 0) doc_.elements[parent.last_child].last = false;
+      parent.last_child = index;
+    } else {
+      e.previous = last_root_;
+      if (last_root_ >= 0) doc_.elements[last_root_].last = false;
+      last_root_ = index;
+    }
+    if (!hidden) y_ += replaced_height(e);
+    bool is_void = void_element(e.tag) || (self_closing && !block);
+    if (!hidden && e.tag == "br") pending_ = (pending_ / font->chars + 1) * font->chars;
+    doc_.elements.push_back(std::move(e));
+    if (!is_void) open_.push_back({index, -1, hidden, font});
+  }
+
+  void end_tag(std::string_view tag) {
+    auto found = std::find_if(open_.rbegin(), open_.rend(),
+                              [&](const Open& o) { return doc_.elements[o.element].tag == tag; });
+    if (found == open_.rend()) return;
+    auto depth = static_cast<std::size_t>(open_.rend() - found) - 1;
+    while (open_.size() > depth) close_top();
+  }
+
+  void close_top() {
+    const auto& e = doc_.elements[open_.back().element];
+    if (!open_.back().hidden && block_element(e.tag)) flush();
+    open_.pop_back();
+  }
+
+  // Height of images, video and other replaced content.
+  static std::uint32_t replaced_height(const Document::Element& e) {
+    if (!one_of(e.tag, {"img", "video", "iframe", "canvas", "embed", "object", "svg"})) return 0;
+    double width = 0, height = 0;
+    for (const auto& [name, value] : e.attributes) {
+      if (name == "width") width = std::atof(value.c_str());
+      if (name == "height") height = std::atof(value.c_str());
+    }
+    if (height <= 0) return kReplacedHeight;
+    if (width > kColumn) height *= kColumn / width;
+    return static_cast<std::uint32_t>(height);
+  }
+
+  void text(std::string_view s) {
+    if (s.empty()) return;
+    std::uint32_t chars = 0;  // words and the single spaces between them
+    bool gap = gap_;
+    for (std::size_t i = 0; i < s.size(); ++i) {
+      char c = s[i];
+      if (space(c)) {
+        gap = true;
+        continue;
+      }
+      if ((c & 0xc0) == 0x80) continue;  // UTF-8 continuation byte
+      if (c == '&') {
+        auto semi = s.find(';', i);
+        if (semi != std::string_view::npos && semi - i < 32) i = semi;
+      }
+      if (gap && pending_ + chars > 0) ++chars;
+      gap = false;
+      ++chars;
+    }
+    gap_ = gap;
+    if (chars == 0) return;
+    if (!open_.empty()) {
+      doc_.elements[open_.back().element].empty = false;
+      if (open_.back().hidden) return;
+    }
+    pending_ += chars;
+  }
+
+  // Sets pending text as lines in the font of the innermost open element.
+  void flush() {
+    if (pending_ == 0) return;
+    const Font* font = open_.empty() ? &kBodyFont : open_.back().font;
+    y_ += (pending_ + font->chars - 1) / font->chars * font->line;
+    pending_ = 0;
+    gap_ = false;
+  }
+
+  std::string_view html_;
+  Document doc_;
+  std::vector<Open> open_;
+  std::int32_t last_root_ = -1;
+  std::uint32_t y_ = 0;
+  std::uint32_t pending_ = 0;  // characters of text not yet set in lines
+  bool gap_ = false;           // pending text ends in whitespace
+};
+
+// --- selectors ---------------------------------------------------------------
+
+bool name_char(char c) {
+  return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '-' || c == '_' ||
+         static_cast<unsigned char>(c) >= 0x80;
+}
+
+int hex_digit(char c) {
+  if (c >= '0' && c <= '9') return c - '0';
+  c = lower(c);
+  if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+  return -1;
+}
+
+class SelectorParser {
+ public:
+  explicit SelectorParser(std::string_view s) : s_(s) {}
+
+  std::optional<std::vector<Selector>> list() {
+    std::vector<Selector> out;
+    for (;;) {
+      auto selector = complex();
+      if (!selector) return std::nullopt;
+      out.push_back(std::move(*selector));
+      skip_space();
+      if (i_ >= s_.size() || s_[i_] == ')') return out;
+      if (s_[i_] != ',') return std::nullopt;
+      ++i_;
+    }
+  }
+
+  std::size_t position() const { return i_; }
+
+ private:
+  void skip_space() {
+    while (i_ < s_.size() && space(s_[i_])) ++i_;
+  }
+
+  bool at_end() const { return i_ >= s_.size() || s_[i_] == ',' || s_[i_] == ')'; }
+
+  std::optional<Selector> complex() {
+    Selector sel;
+    skip_space();
+    for (;;) {
+      auto compound = this->compound();
+      if (!compound) return std::nullopt;
+      sel.compounds.push_back(std::move(*compound));
+      bool gap = i_ < s_.size() && space(s_[i_]);
+      skip_space();
+      if (at_end()) return sel;
+      char c = s_[i_];
+      if (c == '>' || c == '+' || c == '~') {
+        ++i_;
+        skip_space();
+        sel.combinators += c;
+      } else if (gap) {
+        sel.combinators += ' ';
+      } else {
+        return std::nullopt;
+      }
+    }
+  }
+
+  std::optional<Selector::Compound> compound() {
+    Selector::Compound c;
+    bool any = false;
+    if (i_ < s_.size() && s_[i_] == '*') {
+      ++i_;
+      any = true;
+    } else if (i_ < s_.size() && (name_char(s_[i_]) || s_[i_] == '\\')) {
+      c.tag = lowercase(name());
+      any = true;
+    }
+    while (i_ < s_.size()) {
+      char ch = s_[i_];
+      if (ch == '.' || ch == '#') {
+        ++i_;
+        auto n = name();
+        if (n.empty()) return std::nullopt;
+        if (ch == '.') {
+          c.classes.push_back(std::move(n));
+        } else {
+          c.id = std::move(n);
+        }
+      } else if (ch == '[') {
+        ++i_;
+        auto a = attribute();
+        if (!a) return std::nullopt;
+        c.attributes.push_back(std::move(*a));
+      } else if (ch == ':') {
+        if (!pseudo(c)) return std::nullopt;
+      } else {
+        break;
+      }
+      any = true;
+    }
+    if (!any) return std::nullopt;
+    return c;
+  }
+
+  // An identifier, with escapes resolved.
+  std::string name() {
+    std::string out;
+    while (i_ < s_.size()) {
+      char c = s_[i_];
+      if (c == '\\' && i_ + 1 < s_.size()) {
+        ++i_;
+        char32_t cp = 0;
+        int digits = 0;
+        while (digits < 6 && i_ < s_.size() && hex_digit(s_[i_]) >= 0) {
+          cp = cp * 16 + static_cast<char32_t>(hex_digit(s_[i_++]));
+          ++digits;
+        }
+        if (digits > 0) {
+          if (i_ < s_.size() && space(s_[i_])) ++i_;
+          append_utf8(out, cp);
+        } else {
+          out += s_[i_++];
+        }
+      } else if (name_char(c)) {
+        out += c;
+        ++i_;
+      } else {
+        break;
+      }
+    }
+    return out;
+  }
+
+  // After '[': name, optional operator and value, optional flag, ']'.
+  std::optional<Selector::Attribute> attribute() {
+    Selector::Attribute a;
+    skip_space();
+    a.name = lowercase(name());
+    if (a.name.empty()) return std::nullopt;
+    skip_space();
+    if (i_ < s_.size() && s_[i_] == ']') {
+      ++i_;
+      return a;
+    }
+    if (i_ < s_.size() && one_of(std::string_view(&s_[i_], 1), {"~", "|", "^", "$", "*"})) {
+      a.op = s_[i_++];
+    } else {
+      a.op = '=';
+    }
+    if (i_ >= s_.size() || s_[i_] != '=') return std::nullopt;
+    ++i_;
+    skip_space();
+    if (i_ < s_.size() && (s_[i_] == '"' || s_[i_] == '\'')) {
+      char quote = s_[i_++];
+      while (i_ < s_.size() && s_[i_] != quote) {
+        if (s_[i_] == '\\' && i_ + 1 < s_.size()) ++i_;
+        a.value += s_[i_++];
+      }
+      if (i_ >= s_.size()) return std::nullopt;
+      ++i_;
+    } else {
+      a.value = name();
+    }
+    skip_space();
+    if (i_ < s_.size() && (s_[i_] == 'i' || s_[i_] == 'I' || s_[i_] == 's' || s_[i_] == 'S')) {
+      a.ignore_case = lower(s_[i_]) == 'i';
+      ++i_;
+      skip_space();
+    }
+    if (i_ >= s_.size() || s_[i_] != ']') return std::nullopt;
+    ++i_;
+    return a;
+  }
+
+  // A pseudo-class or pseudo-element at s_[i_] == ':'.
+  bool pseudo(Selector::Compound& c) {
+    ++i_;
+    if (i_ < s_.size() && s_[i_] == ':') ++i_;
+    auto n = lowercase(name());
+    if (n.empty()) return false;
+    if (i_ < s_.size() && s_[i_] == '(') {
+      auto open = ++i_;
+      if (n == "not") {
+        SelectorParser inner(s_.substr(open));
+        auto args = inner.list();
+        i_ = open + inner.position();
+        if (args && i_ < s_.size() && s_[i_] == ')' &&
+            std::all_of(args->begin(), args->end(), [](const Selector& s) { return s.compounds.size() == 1; })) {
+          for (auto& s : *args) c.negations.push_back(std::move(s.compounds.front()));
+        }
+      }
+      // Skip to the matching ')'; the arguments of other functions are not
+      // used, which leaves those pseudo-classes assumed to hold.
+      int depth = 1;
+      i_ = open;
+      while (i_ < s_.size() && depth > 0) {
+        char ch = s_[i_++];
+        if (ch == '\\' && i_ < s_.size()) {
+          ++i_;
+        } else if (ch == '"' || ch == '\'') {
+          while (i_ < s_.size() && s_[i_] != ch) i_ += s_[i_] == '\\' ? 2 : 1;
+          ++i_;
+        } else if (ch == '(') {
+          ++depth;
+        } else if (ch == ')') {
+          --depth;
+        }
+      }
+      return depth == 0;
+    }
+    if (n == "first-child") {
+      c.structure |= Selector::kFirstChild;
+    } else if (n == "last-child") {
+      c.structure |= Selector::kLastChild;
+    } else if (n == "only-child") {
+      c.structure |= Selector::kFirstChild | Selector::kLastChild;
+    } else if (n == "root") {
+      c.structure |= Selector::kRoot;
+    } else if (n == "empty") {
+      c.structure |= Selector::kEmpty;
+    }
+    return true;
+  }
+
+  std::string_view s_;
+  std::size_t i_ = 0;
+};
+
+bool attribute_matches(const Selector::Attribute& a, std::string_view value) {
+  std::string folded_value, folded_want;
+  std::string_view want = a.value;
+  if (a.ignore_case) {
+    folded_value = lowercase(value);
+    folded_want = lowercase(want);
+    value = folded_value;
+    want = folded_want;
+  }
+  switch (a.op) {
+    case 0:
+      return true;
+    case '=':
+      return value == want;
+    case '~': {
+      std::size_t i = 0;
+      while (i < value.size()) {
+        while (i < value.size() && space(value[i])) ++i;
+        auto start = i;
+        while (i < value.size() && !space(value[i])) ++i;
+        if (i > start && value.substr(start, i - start) == want) return true;
+      }
+      return false;
+    }
+    case '|':
+      return value == want || (value.starts_with(want) && value.size() > want.size() && value[want.size()] == '-');
+    case '^':
+      return !want.empty() && value.starts_with(want);
+    case '$':
+      return !want.empty() && value.ends_with(want);
+    case '*':
+      return !want.empty() && value.find(want) != std::string_view::npos;
+  }
+  return false;
+}
+
+bool match_from(const Selector& sel, const Document& doc, std::int32_t element, std::size_t k) {
+  if (!matches(sel.compounds[k], doc, static_cast<std::size_t>(element))) return false;
+  if (k == 0) return true;
+  const auto& e = doc.elements[element];
+  switch (sel.combinators[k - 1]) {
+    case '>':
+      return e.parent >= 0 && match_from(sel, doc, e.parent, k - 1);
+    case '+':
+      return e.previous >= 0 && match_from(sel, doc, e.previous, k - 1);
+    case '~':
+      for (auto s = e.previous; s >= 0; s = doc.elements[s].previous) {
+        if (match_from(sel, doc, s, k - 1)) return true;
+      }
+      return false;
+    default:
+      for (auto p = e.parent; p >= 0; p = doc.elements[p].parent) {
+        if (match_from(sel, doc, p, k - 1)) return true;
+      }
+      return false;
+  }
+}
+
+}  // namespace
+
+Document parse_document(std::string_view html) { return TreeBuilder(html).run(); }
+
+std::optional<std::vector<Selector>> parse_selectors(std::string_view text) {
+  SelectorParser parser(text);
+  auto list = parser.list();
+  if (!list || parser.position() < text.size()) return std::nullopt;
+  return list;
+}
+
+bool matches(const Selector& selector, const Document& doc, std::size_t element) {
+  return !selector.compounds.empty() &&
+         match_from(selector, doc, static_cast<std::int32_t>(element), selector.compounds.size() - 1);
+}
+
+bool matches(const Selector::Compound& c, const Document& doc, std::size_t element) {
+  const auto& e = doc.elements[element];
+  if (!c.tag.empty() && c.tag != e.tag) return false;
+  if (!c.id.empty() && c.id != e.id) return false;
+  for (const auto& name : c.classes) {
+    if (std::find(e.classes.begin(), e.classes.end(), name) == e.classes.end()) return false;
+  }
+  for (const auto& a : c.attributes) {
+    auto found = std::find_if(e.attributes.begin(), e.attributes.end(),
+                              [&](const auto& attribute) { return attribute.first == a.name; });
+    if (found == e.attributes.end() || !attribute_matches(a, found->second)) return false;
+  }
+  if ((c.structure & Selector::kFirstChild) && e.previous >= 0) return false;
+  if ((c.structure & Selector::kLastChild) && !e.last) return false;
+  if ((c.structure & Selector::kRoot) && e.parent >= 0) return false;
+  if ((c.structure & Selector::kEmpty) && !e.empty) return false;
+  for (const auto& n : c.negations) {
+    if (matches(n, doc, element)) return false;
+  }
+  return true;
+}
+
+}  // namespace mt::gen
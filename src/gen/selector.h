@@ -0,0 +1,97 @@
+#pragma once
+
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace mt::gen {
+
+// The elements of an HTML document as a tree, enough to match CSS
+// selectors against it. Built by parse_document(); elements are in
+// document order, so an element's ancestors and earlier siblings come
+// before it.
+struct Document {
+  struct Element {
+    std::string tag;  // lowercase
+    std::string id;
+    std::vector<std::string> classes;
+    std::vector<std::pair<std::string, std::string>> attributes;  // names lowercase, values decoded
+    std::size_t offset = 0;      // of the start tag's '<' in the source
+    std::int32_t parent = -1;    // index, or -1 for the root
+    std::int32_t previous = -1;  // previous element sibling, or -1
+    bool last = true;            // no element siblings follow
+    bool empty = true;           // no child elements or text
+    // Estimated distance from the top of the page to where the element
+    // starts, in CSS pixels, or kHidden if it is not rendered (see
+    // parse_document()).
+    std::uint32_t top = 0;
+  };
+  static constexpr std::uint32_t kHidden = UINT32_MAX;
+  std::vector<Element> elements;
+};
+
+// Builds the element tree of `html`. End tags HTML lets pages leave out
+// (p, li, td, ...) are implied as a browser would, so minified pages parse
+// the same as their sources; stray end tags are ignored. Comments, and the
+// contents of <script>, <style>, <textarea> and <title>, are skipped.
+//
+// Element::top comes from a rough block-flow model of a desktop window
+// with an 800px text column: body text sets 90 characters to a 24px line,
+// headings fewer and taller; block elements such as p, ul and h1-h6 add a
+// 16px margin; images, video and iframes take their height attribute,
+// scaled to fit the column, or 150px. Elements inside <head>, <template>,
+// <noscript> or with a hidden attribute are not rendered. There is no
+// styling, so it only approximates what a browser shows, but it is good
+// enough to tell the first screenful of a page from the rest.
+Document parse_document(std::string_view html);
+
+// A complex selector such as "nav > ul li.active a:hover", as compound
+// selectors joined by combinators.
+struct Selector {
+  struct Attribute {
+    std::string name;  // lowercase
+    char op = 0;       // 0 for [name], else one of = ~ | ^ $ *
+    std::string value;
+    bool ignore_case = false;
+  };
+  enum : unsigned {
+    kFirstChild = 1u << 0,
+    kLastChild = 1u << 1,
+    kRoot = 1u << 2,
+    kEmpty = 1u << 3,
+  };
+  struct Compound {
+    std::string tag;  // lowercase; empty for any
+    std::string id;
+    std::vector<std::string> classes;
+    std::vector<Attribute> attributes;
+    unsigned structure = 0;  // k* flags above
+    // :not() arguments; the compound fails to match an element that any
+    // of these match.
+    std::vector<Compound> negations;
+  };
+  std::vector<Compound> compounds;  // left to right
+  std::string combinators;          // combinators[i] (' ', '>', '+' or '~') joins compounds i and i + 1
+};
+
+// Parses a selector list ("h1, .title > a"). Returns nullopt for syntax
+// this does not understand (namespaces, nesting), which callers should
+// treat as matching anything.
+//
+// Matching errs towards "may match": pseudo-classes that depend on state
+// (:hover, :checked ...) or on things not modelled here (:nth-child(),
+// :is(), :has() ...) are assumed to hold, and pseudo-elements match the
+// element they belong to.
+std::optional<std::vector<Selector>> parse_selectors(std::string_view text);
+
+// Whether `selector` matches doc.elements[element].
+bool matches(const Selector& selector, const Document& doc, std::size_t element);
+
+// Whether `compound` alone matches doc.elements[element], ignoring what
+// the rest of its selector asks of the element's ancestors and siblings.
+bool matches(const Selector::Compound& compound, const Document& doc, std::size_t element);
+
+}  // namespace mt::gen
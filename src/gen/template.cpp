@@ -0,0 +1,94 @@
+#include "gen/template.h"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+#include "gen/text.h"
+
+namespace mt::gen {
+
+namespace {
+
+// Deeper nesting than this can only be a cycle.
+constexpr int kMaxPartialDepth = 16;
+
+}  // namespace
+
+struct Template::Compiler {
+  Template& out;
+  std::span<const std::string_view> fields;
+  const Loader& load;
+  std::uint32_t pending = 0;  // literal bytes not yet closed by a segment
+
+  void literal(std::string_view text) {
+    out.literals_ += text;
+    pending += static_cast<std::uint32_t>(text.size());
+  }
+
+  void field(std::uint32_t index) {
+    out.segments_.push_back({pending, index});
+    pending = 0;
+  }
+
+  void run(std::string_view name, std::string_view text, int depth) {
+    std::size_t line = 1;
+    auto fail = [&](const std::string& what) -> std::runtime_error {
+      return std::runtime_error(std::string(name).append(":").append(std::to_string(line)).append(": ").append(what));
+    };
+    while (!text.empty()) {
+      auto open = text.find("{{");
+      auto before = text.substr(0, open);
+      literal(before);
+      line += static_cast<std::size_t>(std::count(before.begin(), before.end(), '\n'));
+      if (open == std::string_view::npos) break;
+      text.remove_prefix(open + 2);
+      auto close = text.find("}}");
+      if (close == std::string_view::npos) throw fail("unterminated {{");
+      auto tag = text.substr(0, close);
+      text.remove_prefix(close + 2);
+      if (tag.starts_with('>')) {
+        auto partial = trim(tag.substr(1));
+        if (depth == kMaxPartialDepth) throw fail(std::string("partial ").append(partial).append(" includes itself"));
+        auto loaded = load(partial);
+        run(loaded.file, loaded.text, depth + 1);
+      } else {
+        auto key = trim(tag);
+        auto found = std::find(fields.begin(), fields.end(), key);
+        if (found == fields.end()) throw fail(std::string("unknown field {{").append(key).append("}}"));
+        field(static_cast<std::uint32_t>(found - fields.begin()));
+      }
+      line += static_cast<std::size_t>(std::count(tag.begin(), tag.end(), '\n'));
+    }
+  }
+};
+
+Template Template::compile(std::string_view name, std::string_view text, std::span<const std::string_view> fields,
+                           const Loader& load) {
+  Template t;
+  Compiler c{t, fields, load};
+  c.run(name, text, 0);
+  if (c.pending > 0 || t.segments_.empty()) t.segments_.push_back({c.pending, kNoField});
+  return t;
+}
+
+void Template::render(std::span<const std::string_view> values, std::string& out) const {
+  auto size = literals_.size();
+  for (const auto& s : segments_) {
+    if (s.field != kNoField) size += values[s.field].size();
+  }
+  auto at = out.size();
+  out.resize(at + size);
+  char* p = out.data() + at;
+  const char* lit = literals_.data();
+  for (const auto& s : segments_) {
+    std::memcpy(p, lit, s.literal);
+    p += s.literal;
+    lit += s.literal;
+    if (s.field == kNoField) continue;
+    auto value = values[s.field];
+    p = std::copy_n(value.data(), value.size(), p);
+  }
+}
+
+}  // namespace mt::gen
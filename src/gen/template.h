@@ -0,0 +1,53 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace mt::gen {
+
+// Page layouts. `{{name}}` inserts a field and `{{> name}}` inlines another
+// template, a partial. Compiling resolves every field name to an index and
+// inlines every partial, so a compiled template is one string of literal
+// text plus a list of (literal length, field index) segments. Rendering sums
+// the sizes, grows the output once and copies the pieces in order: no
+// parsing, no lookups and no branches beyond the segment loop.
+//
+// Field values are inserted as given; callers pass HTML.
+class Template {
+ public:
+  // The partial {{> name}} refers to: where it came from, for error
+  // messages, and its text.
+  struct Partial {
+    std::string file;
+    std::string text;
+  };
+  // Throws std::runtime_error if there is no such partial.
+  using Loader = std::function<Partial(std::string_view name)>;
+
+  // Compiles `text`, which error messages call `name`. `fields` lists the
+  // names {{...}} may use, in the order render() takes their values.
+  // Throws std::runtime_error for an unknown field, an unterminated tag or
+  // a partial that includes itself.
+  static Template compile(std::string_view name, std::string_view text, std::span<const std::string_view> fields,
+                          const Loader& load);
+
+  // Appends the template to `out` with values[i] in place of field i.
+  void render(std::span<const std::string_view> values, std::string& out) const;
+
+ private:
+  static constexpr std::uint32_t kNoField = UINT32_MAX;
+  struct Segment {
+    std::uint32_t literal = 0;      // bytes of literal text before the field
+    std::uint32_t field = kNoField;  // kNoField for the trailing literal
+  };
+  struct Compiler;
+
+  std::string literals_;  // every literal, in order
+  std::vector<Segment> segments_;
+};
+
+}  // namespace mt::gen
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <cstddef>
+#include <string_view>
+
+#include "http.h"
+
+// Scanning helpers the HTML, CSS and template stages share. None of them parse; they
+// find things in text that is known to be well-formed enough.
+namespace mt::gen {
+
+// HTML and CSS whitespace.
+inline bool space(char c) { return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\f'; }
+
+// ASCII lowercase; HTML and CSS names fold case no further.
+constexpr char lower(char c) { return c >= 'A' && c <= 'Z' ? static_cast<char>(c - 'A' + 'a') : c; }
+
+// A character of an HTML name or a CSS identifier, ASCII only.
+inline bool ident(char c) {
+  return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '-' || c == '_';
+}
+
+inline std::string_view trim(std::string_view s) {
+  while (!s.empty() && space(s.front())) s.remove_prefix(1);
+  while (!s.empty() && space(s.back())) s.remove_suffix(1);
+  return s;
+}
+
+// `s` trimmed, without the quotes around it if it has matching ones.
+inline std::string_view unquote(std::string_view s) {
+  s = trim(s);
+  if (s.size() >= 2 && (s.front() == '"' || s.front() == '\'') && s.back() == s.front()) s = s.substr(1, s.size() - 2);
+  return s;
+}
+
+// Index of the first `needle` at or after `from` (case-insensitive), or npos.
+inline std::size_t find_ci(std::string_view s, std::string_view needle, std::size_t from = 0) {
+  for (auto i = from; i + needle.size() <= s.size(); ++i) {
+    if (http::iequals(s.substr(i, needle.size()), needle)) return i;
+  }
+  return std::string_view::npos;
+}
+
+// Index of the first "<name" at or after `from` (case-insensitive), or the
+// end. `name` includes the '<'.
+inline std::size_t find_tag(std::string_view html, std::string_view name, std::size_t from = 0) {
+  for (auto i = html.find('<', from); i != std::string_view::npos; i = html.find('<', i + 1)) {
+    if (html.size() - i >= name.size() && http::iequals(html.substr(i, name.size()), name)) return i;
+  }
+  return html.size();
+}
+
+// Index just past the '>' closing the tag at html[i] == '<', skipping
+// quoted attribute values.
+inline std::size_t tag_end(std::string_view html, std::size_t i) {
+  char quote = 0;
+  for (++i; i < html.size(); ++i) {
+    char c = html[i];
+    if (quote != 0) {
+      if (c == quote) quote = 0;
+    } else if (c == '"' || c == '\'') {
+      quote = c;
+    } else if (c == '>') {
+      return i + 1;
+    }
+  }
+  return html.size();
+}
+
+}  // namespace mt::gen
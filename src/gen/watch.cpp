@@ -0,0 +1,156 @@
+#include "gen/watch.h"
+
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <string_view>
+#include <utility>
+
+#include "mime.h"
+
+namespace mt::gen {
+
+namespace fs = std::filesystem;
+
+namespace {
+
+constexpr std::uint32_t kMask = IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_CREATE | IN_DELETE | IN_ONLYDIR;
+
+// The events of one editor save arrive well within kQuietMs of each other.
+// A tree that never goes quiet is reported every kMaxDelay regardless.
+constexpr int kQuietMs = 2;
+constexpr auto kMaxDelay = std::chrono::milliseconds(100);
+
+std::runtime_error sys_error(const std::string& what) {
+  return std::runtime_error(what + ": " + std::strerror(errno));
+}
+
+bool skipped_name(std::string_view name) { return name.empty() || name[0] == '.' || name[0] == '_'; }
+
+// Absolute, without symlinks or a trailing separator, for comparison.
+fs::path canonical_dir(const fs::path& dir) {
+  auto p = fs::weakly_canonical(dir);
+  return p.has_filename() ? p : p.parent_path();
+}
+
+}  // namespace
+
+Watcher::Watcher(const fs::path& root, const std::vector<fs::path>& ignore, std::vector<std::string> include)
+    : root_(root), include_(std::move(include)) {
+  if (!fs::is_directory(root_)) throw std::runtime_error("site root is not a directory: " + root_.string());
+  for (const auto& dir : ignore) ignore_.push_back(canonical_dir(dir));
+  fd_ = ::inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (fd_ < 0) throw sys_error("inotify_init1");
+  add_tree("", nullptr);
+}
+
+Watcher::~Watcher() { ::close(fd_); }
+
+bool Watcher::skipped(const std::string& dir, std::string_view name) const {
+  if (!skipped_name(name)) return false;
+  return !dir.empty() || std::find(include_.begin(), include_.end(), name) == include_.end();
+}
+
+void Watcher::add_tree(const std::string& dir, std::vector<std::string>* changed) {
+  auto path = root_ / dir;
+  if (std::find(ignore_.begin(), ignore_.end(), canonical_dir(path)) != ignore_.end()) return;
+  int wd = ::inotify_add_watch(fd_, path.c_str(), kMask);
+  if (wd < 0) {
+    if (!dir.empty() && (errno == ENOENT || errno == ENOTDIR)) return;  // already gone again
+    // ENOSPC here means fs.inotify.max_user_watches is too low for the tree.
+    throw sys_error("cannot watch " + path.string());
+  }
+  dirs_[wd] = dir;
+  std::error_code ec;
+  for (const auto& entry : fs::directory_iterator(path, ec)) {
+    auto name = entry.path().filename().string();
+    if (skipped(dir, name)) continue;
+    if (entry.is_directory(ec)) {
+      add_tree(dir + name + "/", changed);
+    } else if (changed != nullptr) {
+      changed->push_back(dir + name);
+    }
+  }
+}
+
+// A directory moved away keeps its watches, which would report its files
+// under their old paths.
+void Watcher::forget_tree(const std::string& dir) {
+  for (auto it = dirs_.begin(); it != dirs_.end();) {
+    if (it->second.starts_with(dir)) {
+      ::inotify_rm_watch(fd_, it->first);
+      it = dirs_.erase(it);
+    } else {
+      ++it;
+    }
+  }
+}
+
+void Watcher::read_events(std::vector<std::string>& changed) {
+  alignas(inotify_event) std::array<char, 64 * 1024> buf;
+  for (;;) {
+    ssize_t n = ::read(fd_, buf.data(), buf.size());
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      if (errno == EAGAIN) return;
+      throw sys_error("inotify");
+    }
+    for (const char* p = buf.data(); p < buf.data() + n;) {
+      const auto* ev = reinterpret_cast<const inotify_event*>(p);
+      p += sizeof(inotify_event) + ev->len;
+      if (ev->mask & IN_Q_OVERFLOW) {  // events were lost: watch and report everything
+        add_tree("", &changed);
+        continue;
+      }
+      auto it = dirs_.find(ev->wd);
+      if (it == dirs_.end()) continue;
+      if (ev->mask & IN_IGNORED) {  // the directory is gone
+        dirs_.erase(it);
+        continue;
+      }
+      std::string_view name = ev->len > 0 ? std::string_view(ev->name) : std::string_view();
+      if (skipped(it->second, name)) continue;
+      auto rel = it->second;
+      rel += name;
+      if (ev->mask & IN_ISDIR) {
+        if (ev->mask & IN_MOVED_FROM) forget_tree(rel + "/");
+        if (ev->mask & (IN_CREATE | IN_MOVED_TO)) add_tree(rel + "/", &changed);
+        changed.push_back(std::move(rel));
+      } else if (!(ev->mask & IN_CREATE) && !content_type_for(name).empty()) {
+        // A created file is reported when it is closed or moved into place.
+        changed.push_back(std::move(rel));
+      }
+    }
+  }
+}
+
+std::optional<Watcher::Changes> Watcher::wait(int stop_fd) {
+  using Clock = std::chrono::steady_clock;
+  Changes changes;
+  std::array<pollfd, 2> fds{{{fd_, POLLIN, 0}, {stop_fd, POLLIN, 0}}};
+  for (;;) {
+    bool started = !changes.paths.empty();
+    if (started && Clock::now() - changes.first >= kMaxDelay) break;
+    int n = ::poll(fds.data(), fds.size(), started ? kQuietMs : -1);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      throw sys_error("poll");
+    }
+    if (fds[1].revents != 0) return std::nullopt;
+    if (n == 0) break;  // quiet
+    auto now = Clock::now();
+    read_events(changes.paths);
+    if (!started && !changes.paths.empty()) changes.first = now;
+  }
+  std::sort(changes.paths.begin(), changes.paths.end());
+  changes.paths.erase(std::unique(changes.paths.begin(), changes.paths.end()), changes.paths.end());
+  return changes;
+}
+
+}  // namespace mt::gen
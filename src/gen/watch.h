@@ -0,0 +1,55 @@
+#pragma once
+
+#include <chrono>
+#include <filesystem>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace mt::gen {
+
+// Watches a source tree with inotify(7) for the edits a build cares about:
+// files written, renamed or deleted, and directories appearing or going
+// away. Hidden and '_' entries are ignored, as list_site() skips them,
+// except for the top-level directories named in `include` (the layouts).
+// Anything under an `ignore` directory (the output and cache, when they
+// sit inside the tree) is ignored too.
+class Watcher {
+ public:
+  struct Changes {
+    std::vector<std::string> paths;               // relative to the root, sorted, unique
+    std::chrono::steady_clock::time_point first;  // when the first of them was read
+  };
+
+  // Throws std::runtime_error.
+  Watcher(const std::filesystem::path& root, const std::vector<std::filesystem::path>& ignore,
+          std::vector<std::string> include = {});
+  ~Watcher();
+  Watcher(const Watcher&) = delete;
+  Watcher& operator=(const Watcher&) = delete;
+
+  // Blocks until something changes, then keeps reading until the tree has
+  // been quiet for a moment, so the writes, renames and deletes of one
+  // editor save come back as one set of changes. Returns nullopt once
+  // `stop_fd` becomes readable. Throws std::runtime_error.
+  std::optional<Changes> wait(int stop_fd);
+
+ private:
+  bool skipped(const std::string& dir, std::string_view name) const;
+  // Watches `dir` (relative, "" for the root) and every directory below it,
+  // adding the files found there to `changed` if non-null.
+  void add_tree(const std::string& dir, std::vector<std::string>* changed);
+  void forget_tree(const std::string& dir);
+  // Reads every queued event into `changed`.
+  void read_events(std::vector<std::string>& changed);
+
+  std::filesystem::path root_;
+  std::vector<std::filesystem::path> ignore_;  // absolute
+  std::vector<std::string> include_;
+  int fd_ = -1;
+  std::unordered_map<int, std::string> dirs_;  // watch descriptor -> directory, "" or ending in '/'
+};
+
+}  // namespace mt::gen
@@ -0,0 +1,292 @@
+#include "hash.h"
+
+#include <bit>
+#include <cstring>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+namespace mt {
+
+namespace {
+
+constexpr std::uint64_t kP1 = 0x9E3779B185EBCA87ull;
+constexpr std::uint64_t kP2 = 0xC2B2AE3D27D4EB4Full;
+constexpr std::uint64_t kP3 = 0x165667B19E3779F9ull;
+constexpr std::uint64_t kP4 = 0x85EBCA77C2B2AE63ull;
+constexpr std::uint64_t kP5 = 0x27D4EB2F165667C5ull;
+
+std::uint64_t read64(const char* p) {
+  std::uint64_t v;
+  std::memcpy(&v, p, sizeof v);
+  return v;
+}
+
+std::uint32_t read32(const char* p) {
+  std::uint32_t v;
+  std::memcpy(&v, p, sizeof v);
+  return v;
+}
+
+std::uint64_t round(std::uint64_t acc, std::uint64_t input) {
+  acc += input * kP2;
+  return std::rotl(acc, 31) * kP1;
+}
+
+std::uint64_t merge(std::uint64_t acc, std::uint64_t v) {
+  acc ^= round(0, v);
+  return acc * kP1 + kP4;
+}
+
+// XXH3 pieces. Names follow the reference implementation.
+
+constexpr std::uint32_t kP32_1 = 0x9E3779B1u;
+constexpr std::uint32_t kP32_2 = 0x85EBCA77u;
+constexpr std::uint32_t kP32_3 = 0xC2B2AE3Du;
+
+constexpr std::size_t kStripeLen = 64;
+constexpr std::size_t kSecretConsumeRate = 8;
+constexpr std::size_t kSecretSize = 192;
+constexpr std::size_t kStripesPerBlock = (kSecretSize - kStripeLen) / kSecretConsumeRate;
+constexpr std::size_t kBlockLen = kStripeLen * kStripesPerBlock;
+
+alignas(64) constexpr unsigned char kSecret[kSecretSize] = {
+    0xb8, 0xfe, 0x6c, 0x39, 0x23, 0xa4, 0x4b, 0xbe, 0x7c, 0x01, 0x81, 0x2c, 0xf7, 0x21, 0xad, 0x1c,
+    0xde, 0xd4, 0x6d, 0xe9, 0x83, 0x90, 0x97, 0xdb, 0x72, 0x40, 0xa4, 0xa4, 0xb7, 0xb3, 0x67, 0x1f,
+    0xcb, 0x79, 0xe6, 0x4e, 0xcc, 0xc0, 0xe5, 0x78, 0x82, 0x5a, 0xd0, 0x7d, 0xcc, 0xff, 0x72, 0x21,
+    0xb8, 0x08, 0x46, 0x74, 0xf7, 0x43, 0x24, 0x8e, 0xe0, 0x35, 0x90, 0xe6, 0x81, 0x3a, 0x26, 0x4c,
+    0x3c, 0x28, 0x52, 0xbb, 0x91, 0xc3, 0x00, 0xcb, 0x88, 0xd0, 0x65, 0x8b, 0x1b, 0x53, 0x2e, 0xa3,
+    0x71, 0x64, 0x48, 0x97, 0xa2, 0x0d, 0xf9, 0x4e, 0x38, 0x19, 0xef, 0x46, 0xa9, 0xde, 0xac, 0xd8,
+    0xa8, 0xfa, 0x76, 0x3f, 0xe3, 0x9c, 0x34, 0x3f, 0xf9, 0xdc, 0xbb, 0xc7, 0xc7, 0x0b, 0x4f, 0x1d,
+    0x8a, 0x51, 0xe0, 0x4b, 0xcd, 0xb4, 0x59, 0x31, 0xc8, 0x9f, 0x7e, 0xc9, 0xd9, 0x78, 0x73, 0x64,
+    0xea, 0xc5, 0xac, 0x83, 0x34, 0xd3, 0xeb, 0xc3, 0xc5, 0x81, 0xa0, 0xff, 0xfa, 0x13, 0x63, 0xeb,
+    0x17, 0x0d, 0xdd, 0x51, 0xb7, 0xf0, 0xda, 0x49, 0xd3, 0x16, 0x55, 0x26, 0x29, 0xd4, 0x68, 0x9e,
+    0x2b, 0x16, 0xbe, 0x58, 0x7d, 0x47, 0xa1, 0xfc, 0x8f, 0xf8, 0xb8, 0xd1, 0x7a, 0xd0, 0x31, 0xce,
+    0x45, 0xcb, 0x3a, 0x8f, 0x95, 0x16, 0x04, 0x28, 0xaf, 0xd7, 0xfb, 0xca, 0xbb, 0x4b, 0x40, 0x7e,
+};
+
+std::uint64_t secret64(std::size_t off) { return read64(reinterpret_cast<const char*>(kSecret) + off); }
+std::uint32_t secret32(std::size_t off) { return read32(reinterpret_cast<const char*>(kSecret) + off); }
+
+std::uint64_t mul128_fold64(std::uint64_t a, std::uint64_t b) {
+  auto product = static_cast<unsigned __int128>(a) * b;
+  return static_cast<std::uint64_t>(product) ^ static_cast<std::uint64_t>(product >> 64);
+}
+
+std::uint64_t xxh64_avalanche(std::uint64_t h) {
+  h ^= h >> 33;
+  h *= kP2;
+  h ^= h >> 29;
+  h *= kP3;
+  return h ^ (h >> 32);
+}
+
+std::uint64_t xxh3_avalanche(std::uint64_t h) {
+  h ^= h >> 37;
+  h *= 0x165667919E3779F9ull;
+  return h ^ (h >> 32);
+}
+
+std::uint64_t rrmxmx(std::uint64_t h, std::uint64_t len) {
+  h ^= std::rotl(h, 49) ^ std::rotl(h, 24);
+  h *= 0x9FB21C651E98DF25ull;
+  h ^= (h >> 35) + len;
+  h *= 0x9FB21C651E98DF25ull;
+  return h ^ (h >> 28);
+}
+
+std::uint64_t mix16(const char* p, std::size_t secret_off) {
+  return mul128_fold64(read64(p) ^ secret64(secret_off), read64(p + 8) ^ secret64(secret_off + 8));
+}
+
+std::uint64_t xxh3_0to16(const char* p, std::size_t len) {
+  if (len > 8) {
+    auto lo = read64(p) ^ (secret64(24) ^ secret64(32));
+    auto hi = read64(p + len - 8) ^ (secret64(40) ^ secret64(48));
+    return xxh3_avalanche(len + __builtin_bswap64(lo) + hi + mul128_fold64(lo, hi));
+  }
+  if (len >= 4) {
+    auto in = std::uint64_t{read32(p + len - 4)} + (std::uint64_t{read32(p)} << 32);
+    return rrmxmx(in ^ (secret64(8) ^ secret64(16)), len);
+  }
+  if (len > 0) {
+    auto c1 = static_cast<unsigned char>(p[0]);
+    auto c2 = static_cast<unsigned char>(p[len >> 1]);
+    auto c3 = static_cast<unsigned char>(p[len - 1]);
+    std::uint32_t combo =
+        (std::uint32_t{c1} << 16) | (std::uint32_t{c2} << 24) | c3 | static_cast<std::uint32_t>(len << 8);
+    return xxh64_avalanche(combo ^ std::uint64_t{secret32(0) ^ secret32(4)});
+  }
+  return xxh64_avalanche(secret64(56) ^ secret64(64));
+}
+
+std::uint64_t xxh3_17to128(const char* p, std::size_t len) {
+  std::uint64_t acc = len * kP1;
+  if (len > 32) {
+    if (len > 64) {
+      if (len > 96) {
+        acc += mix16(p + 48, 96);
+        acc += mix16(p + len - 64, 112);
+      }
+      acc += mix16(p + 32, 64);
+      acc += mix16(p + len - 48, 80);
+    }
+    acc += mix16(p + 16, 32);
+    acc += mix16(p + len - 32, 48);
+  }
+  acc += mix16(p, 0);
+  acc += mix16(p + len - 16, 16);
+  return xxh3_avalanche(acc);
+}
+
+std::uint64_t xxh3_129to240(const char* p, std::size_t len) {
+  std::uint64_t acc = len * kP1;
+  std::size_t rounds = len / 16;
+  for (std::size_t i = 0; i < 8; ++i) acc += mix16(p + 16 * i, 16 * i);
+  acc = xxh3_avalanche(acc);
+  for (std::size_t i = 8; i < rounds; ++i) acc += mix16(p + 16 * i, 16 * (i - 8) + 3);
+  acc += mix16(p + len - 16, 136 - 17);
+  return xxh3_avalanche(acc);
+}
+
+// The long-input kernels: `stripes` 64-byte stripes into the eight lane
+// accumulators, and the per-block scramble.
+using AccumulateFn = void (*)(std::uint64_t* acc, const char* p, const unsigned char* secret, std::size_t stripes);
+using ScrambleFn = void (*)(std::uint64_t* acc, const unsigned char* secret);
+
+void accumulate_scalar(std::uint64_t* acc, const char* p, const unsigned char* secret, std::size_t stripes) {
+  for (std::size_t s = 0; s < stripes; ++s, p += kStripeLen, secret += kSecretConsumeRate) {
+    for (std::size_t i = 0; i < 8; ++i) {
+      auto data = read64(p + 8 * i);
+      auto key = data ^ read64(reinterpret_cast<const char*>(secret) + 8 * i);
+      acc[i ^ 1] += data;
+      acc[i] += (key & 0xFFFFFFFFu) * (key >> 32);
+    }
+  }
+}
+
+void scramble_scalar(std::uint64_t* acc, const unsigned char* secret) {
+  for (std::size_t i = 0; i < 8; ++i) {
+    auto a = acc[i] ^ (acc[i] >> 47) ^ read64(reinterpret_cast<const char*>(secret) + 8 * i);
+    acc[i] = a * kP32_1;
+  }
+}
+
+#if defined(__x86_64__)
+
+[[gnu::target("avx2")]] void accumulate_avx2(std::uint64_t* acc, const char* p, const unsigned char* secret,
+                                             std::size_t stripes) {
+  auto* a = reinterpret_cast<__m256i*>(acc);
+  __m256i a0 = _mm256_loadu_si256(a), a1 = _mm256_loadu_si256(a + 1);
+  for (std::size_t s = 0; s < stripes; ++s, p += kStripeLen, secret += kSecretConsumeRate) {
+    auto d0 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+    auto d1 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + 32));
+    auto k0 = _mm256_xor_si256(d0, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(secret)));
+    auto k1 = _mm256_xor_si256(d1, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(secret + 32)));
+    // lo32(key) * hi32(key) per lane, plus the neighbouring lane's input.
+    auto m0 = _mm256_mul_epu32(k0, _mm256_shuffle_epi32(k0, _MM_SHUFFLE(0, 3, 0, 1)));
+    auto m1 = _mm256_mul_epu32(k1, _mm256_shuffle_epi32(k1, _MM_SHUFFLE(0, 3, 0, 1)));
+    a0 = _mm256_add_epi64(a0, _mm256_add_epi64(m0, _mm256_shuffle_epi32(d0, _MM_SHUFFLE(1, 0, 3, 2))));
+    a1 = _mm256_add_epi64(a1, _mm256_add_epi64(m1, _mm256_shuffle_epi32(d1, _MM_SHUFFLE(1, 0, 3, 2))));
+  }
+  _mm256_storeu_si256(a, a0);
+  _mm256_storeu_si256(a + 1, a1);
+}
+
+[[gnu::target("avx2")]] void scramble_avx2(std::uint64_t* acc, const unsigned char* secret) {
+  auto* a = reinterpret_cast<__m256i*>(acc);
+  const auto prime = _mm256_set1_epi32(static_cast<int>(kP32_1));
+  for (int i = 0; i < 2; ++i) {
+    auto v = _mm256_loadu_si256(a + i);
+    v = _mm256_xor_si256(v, _mm256_srli_epi64(v, 47));
+    v = _mm256_xor_si256(v, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(secret) + i));
+    auto lo = _mm256_mul_epu32(v, prime);
+    auto hi = _mm256_mul_epu32(_mm256_srli_epi64(v, 32), prime);
+    _mm256_storeu_si256(a + i, _mm256_add_epi64(lo, _mm256_slli_epi64(hi, 32)));
+  }
+}
+
+#endif
+
+struct Kernels {
+  AccumulateFn accumulate;
+  ScrambleFn scramble;
+};
+
+Kernels pick_kernels() {
+#if defined(__x86_64__)
+  if (__builtin_cpu_supports("avx2")) return {accumulate_avx2, scramble_avx2};
+#endif
+  return {accumulate_scalar, scramble_scalar};
+}
+
+std::uint64_t xxh3_long(const char* p, std::size_t len) {
+  static const Kernels k = pick_kernels();
+  alignas(32) std::uint64_t acc[8] = {kP32_3, kP1, kP2, kP3, kP4, kP32_2, kP5, kP32_1};
+
+  std::size_t blocks = (len - 1) / kBlockLen;
+  for (std::size_t b = 0; b < blocks; ++b) {
+    k.accumulate(acc, p + b * kBlockLen, kSecret, kStripesPerBlock);
+    k.scramble(acc, kSecret + kSecretSize - kStripeLen);
+  }
+  std::size_t stripes = ((len - 1) - blocks * kBlockLen) / kStripeLen;
+  k.accumulate(acc, p + blocks * kBlockLen, kSecret, stripes);
+  k.accumulate(acc, p + len - kStripeLen, kSecret + kSecretSize - kStripeLen - 7, 1);
+
+  std::uint64_t h = len * kP1;
+  for (std::size_t i = 0; i < 4; ++i) {
+    h += mul128_fold64(acc[2 * i] ^ secret64(11 + 16 * i), acc[2 * i + 1] ^ secret64(11 + 16 * i + 8));
+  }
+  return xxh3_avalanche(h);
+}
+
+}  // namespace
+
+std::uint64_t xxh64(std::string_view data, std::uint64_t seed) {
+  const char* p = data.data();
+  const char* end = p + data.size();
+  std::uint64_t h;
+
+  if (data.size() >= 32) {
+    std::uint64_t v1 = seed + kP1 + kP2, v2 = seed + kP2, v3 = seed, v4 = seed - kP1;
+    for (; end - p >= 32; p += 32) {
+      v1 = round(v1, read64(p));
+      v2 = round(v2, read64(p + 8));
+      v3 = round(v3, read64(p + 16));
+      v4 = round(v4, read64(p + 24));
+    }
+    h = std::rotl(v1, 1) + std::rotl(v2, 7) + std::rotl(v3, 12) + std::rotl(v4, 18);
+    h = merge(merge(merge(merge(h, v1), v2), v3), v4);
+  } else {
+    h = seed + kP5;
+  }
+  h += data.size();
+
+  for (; end - p >= 8; p += 8) h = std::rotl(h ^ round(0, read64(p)), 27) * kP1 + kP4;
+  if (end - p >= 4) {
+    h = std::rotl(h ^ (std::uint64_t{read32(p)} * kP1), 23) * kP2 + kP3;
+    p += 4;
+  }
+  for (; p < end; ++p) h = std::rotl(h ^ (static_cast<unsigned char>(*p) * kP5), 11) * kP1;
+
+  return xxh64_avalanche(h);
+}
+
+std::uint64_t xxh3_64(std::string_view data) {
+  const char* p = data.data();
+  std::size_t len = data.size();
+  if (len <= 16) return xxh3_0to16(p, len);
+  if (len <= 128) return xxh3_17to128(p, len);
+  if (len <= 240) return xxh3_129to240(p, len);
+  return xxh3_long(p, len);
+}
+
+std::string hex64(std::uint64_t v) {
+  static constexpr char kDigits[] = "0123456789abcdef";
+  std::string out(16, '0');
+  for (int i = 15; i >= 0; --i, v >>= 4) out[static_cast<std::size_t>(i)] = kDigits[v & 0xf];
+  return out;
+}
+
+}  // namespace mt
@@ -0,0 +1,20 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+namespace mt {
+
+// XXH64 of `data`. Neither hash here is a cryptographic digest.
+std::uint64_t xxh64(std::string_view data, std::uint64_t seed = 0);
+
+// XXH3-64 of `data` (seed 0, default secret). Inputs over 240 bytes use an
+// AVX2 kernel when the CPU has one, which runs at roughly twice the speed
+// of xxh64. The build uses it for content hashes and ETags.
+std::uint64_t xxh3_64(std::string_view data);
+
+// 16 lowercase hex digits.
+std::string hex64(std::uint64_t v);
+
+}  // namespace mt
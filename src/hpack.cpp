@@ -0,0 +1,373 @@
+#include "hpack.h"
+
+#include <array>
+
+namespace mt::hpack {
+
+namespace {
+
+struct StaticEntry {
+  std::string_view name;
+  std::string_view value;
+};
+
+// RFC 7541 Appendix A. Index i + 1 is kStaticTable[i].
+constexpr StaticEntry kStaticTable[] = {
+    {":authority", ""},
+    {":method", "GET"},
+    {":method", "POST"},
+    {":path", "/"},
+    {":path", "/index.html"},
+    {":scheme", "http"},
+    {":scheme", "https"},
+    {":status", "200"},
+    {":status", "204"},
+    {":status", "206"},
+    {":status", "304"},
+    {":status", "400"},
+    {":status", "404"},
+    {":status", "500"},
+    {"accept-charset", ""},
+    {"accept-encoding", "gzip, deflate"},
+    {"accept-language", ""},
+    {"accept-ranges", ""},
+    {"accept", ""},
+    {"access-control-allow-origin", ""},
+    {"age", ""},
+    {"allow", ""},
+    {"authorization", ""},
+    {"cache-control", ""},
+    {"content-disposition", ""},
+    {"content-encoding", ""},
+    {"content-language", ""},
+    {"content-length", ""},
+    {"content-location", ""},
+    {"content-range", ""},
+    {"content-type", ""},
+    {"cookie", ""},
+    {"date", ""},
+    {"etag", ""},
+    {"expect", ""},
+    {"expires", ""},
+    {"from", ""},
+    {"host", ""},
+    {"if-match", ""},
+    {"if-modified-since", ""},
+    {"if-none-match", ""},
+    {"if-range", ""},
+    {"if-unmodified-since", ""},
+    {"last-modified", ""},
+    {"link", ""},
+    {"location", ""},
+    {"max-forwards", ""},
+    {"proxy-authenticate", ""},
+    {"proxy-authorization", ""},
+    {"range", ""},
+    {"referer", ""},
+    {"refresh", ""},
+    {"retry-after", ""},
+    {"server", ""},
+    {"set-cookie", ""},
+    {"strict-transport-security", ""},
+    {"transfer-encoding", ""},
+    {"user-agent", ""},
+    {"vary", ""},
+    {"via", ""},
+    {"www-authenticate", ""},
+};
+constexpr std::size_t kStaticSize = std::size(kStaticTable);
+
+// Code lengths of RFC 7541 Appendix B, by symbol; 256 is EOS. The code is
+// canonical, so the codes themselves follow from the lengths.
+constexpr std::uint8_t kCodeLengths[257] = {
+    13, 23, 28, 28, 28, 28, 28, 28, 28, 24, 30, 28, 28, 30, 28, 28,
+    28, 28, 28, 28, 28, 28, 30, 28, 28, 28, 28, 28, 28, 28, 28, 28,
+    6, 10, 10, 12, 13, 6, 8, 11, 10, 10, 8, 11, 8, 6, 6, 6,
+    5, 5, 5, 6, 6, 6, 6, 6, 6, 6, 7, 8, 15, 6, 12, 10,
+    13, 6, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7,
+    7, 7, 7, 7, 7, 7, 7, 7, 8, 7, 8, 13, 19, 13, 14, 6,
+    15, 5, 6, 5, 6, 5, 6, 6, 6, 5, 7, 7, 6, 6, 6, 5,
+    6, 7, 6, 5, 5, 6, 7, 7, 7, 7, 7, 15, 11, 14, 13, 28,
+    20, 22, 20, 20, 22, 22, 22, 23, 22, 23, 23, 23, 23, 23, 24, 23,
+    24, 24, 22, 23, 24, 23, 23, 23, 23, 21, 22, 23, 22, 23, 23, 24,
+    22, 21, 20, 22, 22, 23, 23, 21, 23, 22, 22, 24, 21, 22, 23, 23,
+    21, 21, 22, 21, 23, 22, 23, 23, 20, 22, 22, 22, 23, 22, 22, 23,
+    26, 26, 20, 19, 22, 23, 22, 25, 26, 26, 26, 27, 27, 26, 24, 25,
+    19, 21, 26, 27, 27, 26, 27, 24, 21, 21, 26, 26, 28, 27, 27, 27,
+    20, 24, 20, 21, 22, 21, 21, 23, 22, 22, 25, 25, 24, 24, 26, 23,
+    26, 27, 26, 26, 27, 27, 27, 27, 27, 28, 27, 27, 27, 27, 27, 26,
+    30,
+};
+constexpr unsigned kMaxCodeLength = 30;
+constexpr unsigned kEos = 256;
+
+struct Huffman {
+  std::array<std::uint32_t, 257> codes{};
+  // Canonical decoding: the codes of length n are first[n] onwards, for
+  // count[n] symbols, which are sorted[index[n]] onwards.
+  std::array<std::uint32_t, kMaxCodeLength + 1> first{};
+  std::array<std::uint32_t, kMaxCodeLength + 1> count{};
+  std::array<std::uint32_t, kMaxCodeLength + 1> index{};
+  std::array<std::uint16_t, 257> sorted{};
+};
+
+constexpr Huffman make_huffman() {
+  Huffman h;
+  std::uint32_t code = 0;
+  std::uint32_t n = 0;
+  for (unsigned length = 1; length <= kMaxCodeLength; ++length) {
+    h.first[length] = code;
+    h.index[length] = n;
+    for (unsigned sym = 0; sym < 257; ++sym) {
+      if (kCodeLengths[sym] != length) continue;
+      h.codes[sym] = code++;
+      h.sorted[n++] = static_cast<std::uint16_t>(sym);
+    }
+    h.count[length] = n - h.index[length];
+    code <<= 1;
+  }
+  return h;
+}
+
+constexpr Huffman kHuffman = make_huffman();
+static_assert(kHuffman.codes['0'] == 0x0 && kHuffman.codes['a'] == 0x3 && kHuffman.codes[kEos] == 0x3fffffff);
+
+// Header fields HTTP/2 and HTTP/3 do not allow (RFC 9113 section 8.2.2).
+bool connection_specific(std::string_view name) {
+  return name == "connection" || name == "keep-alive" || name == "proxy-connection" || name == "transfer-encoding" ||
+         name == "upgrade";
+}
+
+}  // namespace
+
+std::size_t huffman_size(std::string_view s) {
+  std::size_t bits = 0;
+  for (unsigned char c : s) bits += kCodeLengths[c];
+  return (bits + 7) / 8;
+}
+
+void huffman_encode(std::string& out, std::string_view s) {
+  std::uint64_t acc = 0;
+  unsigned bits = 0;
+  for (unsigned char c : s) {
+    acc = (acc << kCodeLengths[c]) | kHuffman.codes[c];
+    bits += kCodeLengths[c];
+    while (bits >= 8) {
+      bits -= 8;
+      out += static_cast<char>(acc >> bits);
+    }
+  }
+  // Pad with the most significant bits of EOS, all ones.
+  if (bits > 0) out += static_cast<char>((acc << (8 - bits)) | (0xffu >> bits));
+}
+
+bool huffman_decode(std::string_view in, std::string& out) {
+  std::uint32_t code = 0;
+  unsigned length = 0;
+  for (unsigned char byte : in) {
+    for (int bit = 7; bit >= 0; --bit) {
+      code = (code << 1) | ((byte >> bit) & 1);
+      ++length;
+      auto i = code - kHuffman.first[length];
+      if (code >= kHuffman.first[length] && i < kHuffman.count[length]) {
+        auto sym = kHuffman.sorted[kHuffman.index[length] + i];
+        if (sym == kEos) return false;
+        out += static_cast<char>(sym);
+        code = 0;
+        length = 0;
+      } else if (length == kMaxCodeLength) {
+        return false;
+      }
+    }
+  }
+  // At most 7 bits of padding, all ones.
+  return length < 8 && code == (1u << length) - 1;
+}
+
+bool decode_integer(const char*& p, const char* end, unsigned prefix_bits, std::uint64_t& value) {
+  if (p == end) return false;
+  std::uint64_t max_prefix = (1u << prefix_bits) - 1;
+  value = static_cast<unsigned char>(*p++) & max_prefix;
+  if (value < max_prefix) return true;
+  for (unsigned shift = 0; shift <= 28; shift += 7) {
+    if (p == end) return false;
+    auto b = static_cast<unsigned char>(*p++);
+    value += static_cast<std::uint64_t>(b & 0x7f) << shift;
+    if ((b & 0x80) == 0) return true;
+  }
+  return false;  // longer than any sane length or index
+}
+
+bool decode_string(const char*& p, const char* end, unsigned prefix_bits, std::string& out) {
+  if (p == end) return false;
+  bool huffman = (static_cast<unsigned char>(*p) >> prefix_bits) & 1;
+  std::uint64_t size = 0;
+  if (!decode_integer(p, end, prefix_bits, size) || size > static_cast<std::uint64_t>(end - p)) return false;
+  std::string_view raw(p, size);
+  p += size;
+  if (!huffman) {
+    out += raw;
+    return true;
+  }
+  return huffman_decode(raw, out);
+}
+
+void encode_integer(std::string& out, std::uint8_t first, unsigned prefix_bits, std::uint64_t value) {
+  std::uint64_t max_prefix = (1u << prefix_bits) - 1;
+  if (value < max_prefix) {
+    out += static_cast<char>(first | value);
+    return;
+  }
+  out += static_cast<char>(first | max_prefix);
+  value -= max_prefix;
+  while (value >= 0x80) {
+    out += static_cast<char>((value & 0x7f) | 0x80);
+    value >>= 7;
+  }
+  out += static_cast<char>(value);
+}
+
+void encode_string(std::string& out, std::string_view s, std::uint8_t first, unsigned prefix_bits) {
+  auto huffman = huffman_size(s);
+  if (huffman < s.size()) {
+    encode_integer(out, static_cast<std::uint8_t>(first | 1u << prefix_bits), prefix_bits, huffman);
+    huffman_encode(out, s);
+  } else {
+    encode_integer(out, first, prefix_bits, s.size());
+    out += s;
+  }
+}
+
+void encode_field(std::string& out, std::string_view name, std::string_view value) {
+  std::size_t name_index = 0;
+  for (std::size_t i = 0; i < kStaticSize; ++i) {
+    if (kStaticTable[i].name != name) continue;
+    if (kStaticTable[i].value == value) return encode_integer(out, 0x80, 7, i + 1);
+    if (name_index == 0) name_index = i + 1;
+  }
+  // Literal without indexing: the dynamic table is left alone.
+  encode_integer(out, 0, 4, name_index);
+  if (name_index == 0) encode_string(out, name);
+  encode_string(out, value);
+}
+
+void encode_status(std::string& out, int status) {
+  char digits[3] = {static_cast<char>('0' + status / 100 % 10), static_cast<char>('0' + status / 10 % 10),
+                    static_cast<char>('0' + status % 10)};
+  encode_field(out, ":status", std::string_view(digits, 3));
+}
+
+void for_each_header_line(std::string_view lines,
+                          const std::function<void(std::string_view name, std::string_view value)>& fn) {
+  std::string name;
+  while (!lines.empty()) {
+    auto eol = lines.find("\r\n");
+    auto line = lines.substr(0, eol);
+    lines.remove_prefix(eol == std::string_view::npos ? lines.size() : eol + 2);
+    auto colon = line.find(':');
+    if (colon == std::string_view::npos) continue;
+    name.clear();
+    for (char c : line.substr(0, colon)) name += (c >= 'A' && c <= 'Z') ? static_cast<char>(c | 0x20) : c;
+    auto value = line.substr(colon + 1);
+    while (!value.empty() && (value.front() == ' ' || value.front() == '\t')) value.remove_prefix(1);
+    while (!value.empty() && (value.back() == ' ' || value.back() == '\t')) value.remove_suffix(1);
+    if (name.empty() || connection_specific(name)) continue;
+    fn(name, value);
+  }
+}
+
+void encode_header_lines(std::string& out, std::string_view lines) {
+  for_each_header_line(lines, [&](std::string_view name, std::string_view value) { encode_field(out, name, value); });
+}
+
+bool Decoder::lookup(std::uint64_t index, std::string_view& name, std::string_view& value) const {
+  if (index == 0) return false;
+  if (index <= kStaticSize) {
+    name = kStaticTable[index - 1].name;
+    value = kStaticTable[index - 1].value;
+    return true;
+  }
+  index -= kStaticSize + 1;
+  if (index >= table_.size()) return false;
+  name = table_[index].name;
+  value = table_[index].value;
+  return true;
+}
+
+// Each entry counts its name and value plus 32 bytes (RFC 7541 section 4.1).
+void Decoder::insert(std::string_view name, std::string_view value) {
+  auto size = name.size() + value.size() + 32;
+  if (size > table_limit_) {
+    // Too large for the table: inserting it empties the table instead.
+    evict(0);
+    return;
+  }
+  evict(table_limit_ - size);
+  table_.push_front({std::string(name), std::string(value)});
+  table_size_ += size;
+}
+
+void Decoder::evict(std::size_t limit) {
+  while (table_size_ > limit) {
+    table_size_ -= table_.back().name.size() + table_.back().value.size() + 32;
+    table_.pop_back();
+  }
+}
+
+bool Decoder::decode(std::string_view block, std::vector<Field>& fields) {
+  text_.clear();
+  spans_.clear();
+  fields.clear();
+  std::size_t list_size = 0;
+  const char* p = block.data();
+  const char* end = p + block.size();
+
+  auto read_string = [&]() { return decode_string(p, end, 7, text_); };
+
+  while (p < end) {
+    auto b = static_cast<unsigned char>(*p);
+    std::uint64_t index = 0;
+    if (b & 0x80) {  // indexed field
+      std::string_view name, value;
+      if (!decode_integer(p, end, 7, index) || !lookup(index, name, value)) return false;
+      spans_.push_back({text_.size(), name.size(), value.size()});
+      text_ += name;
+      text_ += value;
+    } else if ((b & 0xe0) == 0x20) {  // dynamic table size update
+      if (!spans_.empty() || !decode_integer(p, end, 5, index) || index > max_table_size_) return false;
+      table_limit_ = index;
+      evict(table_limit_);
+      continue;
+    } else {  // a literal: with incremental indexing, without, or never indexed
+      bool indexing = (b & 0xc0) == 0x40;
+      if (!decode_integer(p, end, indexing ? 6 : 4, index)) return false;
+      Span span{text_.size(), 0, 0};
+      if (index == 0) {
+        if (!read_string()) return false;
+      } else {
+        std::string_view name, value;
+        if (!lookup(index, name, value)) return false;
+        text_ += name;
+      }
+      span.name_size = text_.size() - span.offset;
+      if (!read_string()) return false;
+      span.value_size = text_.size() - span.offset - span.name_size;
+      spans_.push_back(span);
+      if (indexing) {
+        std::string_view t = text_;
+        insert(t.substr(span.offset, span.name_size), t.substr(span.offset + span.name_size, span.value_size));
+      }
+    }
+    const auto& last = spans_.back();
+    list_size += last.name_size + last.value_size + 32;
+    if (list_size > max_list_size_) return false;
+  }
+
+  std::string_view text = text_;
+  for (const auto& s : spans_) {
+    fields.push_back({text.substr(s.offset, s.name_size), text.substr(s.offset + s.name_size, s.value_size)});
+  }
+  return true;
+}
+
+}  // namespace mt::hpack
@@ -0,0 +1,105 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// HPACK (RFC 7541), the header compression of HTTP/2.
+namespace mt::hpack {
+
+// A decoded header field. Both views point into the Decoder and are valid
+// until its next decode().
+struct Field {
+  std::string_view name;
+  std::string_view value;
+};
+
+// Decodes the header blocks of one connection's peer, keeping the dynamic
+// table the peer's encoder builds.
+class Decoder {
+ public:
+  // `max_table_size` is the SETTINGS_HEADER_TABLE_SIZE we advertised.
+  // `max_list_size` bounds the decoded fields of one block, counted as
+  // SETTINGS_MAX_HEADER_LIST_SIZE counts them.
+  explicit Decoder(std::size_t max_table_size = 4096, std::size_t max_list_size = 16384)
+      : max_table_size_(max_table_size), table_limit_(max_table_size), max_list_size_(max_list_size) {}
+
+  // Decodes a complete header block into `fields`. Returns false on a
+  // malformed block or one over the list size; the connection must then be
+  // closed, as its table can no longer be trusted.
+  bool decode(std::string_view block, std::vector<Field>& fields);
+
+ private:
+  struct Entry {
+    std::string name;
+    std::string value;
+  };
+  // Where a decoded field's name and value are in text_.
+  struct Span {
+    std::size_t offset;
+    std::size_t name_size;
+    std::size_t value_size;
+  };
+
+  bool lookup(std::uint64_t index, std::string_view& name, std::string_view& value) const;
+  void insert(std::string_view name, std::string_view value);
+  void evict(std::size_t limit);
+
+  std::deque<Entry> table_;  // newest first
+  std::size_t table_size_ = 0;
+  std::size_t max_table_size_;
+  std::size_t table_limit_;  // the encoder's current maximum, at most max_table_size_
+  std::size_t max_list_size_;
+  std::string text_;  // decoded names and values
+  std::vector<Span> spans_;
+};
+
+// The encoder side never inserts into the dynamic table. Every field is an
+// index into the static table, or a literal with a static name index where
+// it has one, so an encoded block means the same on any connection and a
+// server can encode a file's response headers once and reuse them.
+
+// Appends `value` as a field of `name`, which must be lowercase.
+void encode_field(std::string& out, std::string_view name, std::string_view value);
+
+// Appends a :status field, a single byte for the statuses the static table
+// holds.
+void encode_status(std::string& out, int status);
+
+// Appends every "Name: value\r\n" line of `lines` as a field, lowercasing
+// the names. Fields HTTP/2 forbids (Connection and the like) are dropped.
+void encode_header_lines(std::string& out, std::string_view lines);
+
+// Calls `fn` for every "Name: value\r\n" line of `lines`, with the name
+// lowercased, skipping the fields HTTP/2 and HTTP/3 forbid.
+void for_each_header_line(std::string_view lines,
+                          const std::function<void(std::string_view name, std::string_view value)>& fn);
+
+// Appends an HPACK integer with an `prefix_bits`-bit prefix. `first` holds
+// the bits above the prefix.
+void encode_integer(std::string& out, std::uint8_t first, unsigned prefix_bits, std::uint64_t value);
+
+// Appends `s` as a string literal, Huffman-coded when that is shorter. The
+// length has a `prefix_bits`-bit prefix, the Huffman flag is the bit above
+// it and `first` holds any bits above that: HPACK uses 7-bit prefixes, QPACK
+// 3-bit ones for literal names too.
+void encode_string(std::string& out, std::string_view s, std::uint8_t first = 0, unsigned prefix_bits = 7);
+
+// Reads an integer with a `prefix_bits`-bit prefix at `p`, advancing it.
+// Returns false if it is truncated or too long.
+bool decode_integer(const char*& p, const char* end, unsigned prefix_bits, std::uint64_t& value);
+// Reads a string literal laid out as encode_string() writes it and appends
+// it to `out`, decoded.
+bool decode_string(const char*& p, const char* end, unsigned prefix_bits, std::string& out);
+
+// Size of the Huffman coding of `s`, in bytes.
+std::size_t huffman_size(std::string_view s);
+void huffman_encode(std::string& out, std::string_view s);
+// Returns false on invalid padding or an EOS symbol.
+bool huffman_decode(std::string_view in, std::string& out);
+
+}  // namespace mt::hpack
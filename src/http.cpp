@@ -0,0 +1,268 @@
+#include "http.h"
+
+#include <bit>
+#include <cstring>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+namespace mt::http {
+
+namespace {
+
+char lower(char c) { return (c >= 'A' && c <= 'Z') ? static_cast<char>(c | 0x20) : c; }
+
+std::string_view trim(std::string_view s) {
+  while (!s.empty() && (s.front() == ' ' || s.front() == '\t')) s.remove_prefix(1);
+  while (!s.empty() && (s.back() == ' ' || s.back() == '\t')) s.remove_suffix(1);
+  return s;
+}
+
+// True when the comma-separated token list `value` contains `token`.
+bool has_token(std::string_view value, std::string_view token) {
+  while (!value.empty()) {
+    auto comma = value.find(',');
+    if (iequals(trim(value.substr(0, comma)), token)) return true;
+    if (comma == std::string_view::npos) break;
+    value.remove_prefix(comma + 1);
+  }
+  return false;
+}
+
+// Flags, by byte, the bytes that end a line or may not appear in one: the
+// control characters other than HT, and DEL.
+bool line_stop(unsigned char c) { return (c < 0x20 && c != '\t') || c == 0x7f; }
+
+const char* scan_scalar(const char* p, const char* end) {
+  while (p < end && !line_stop(static_cast<unsigned char>(*p))) ++p;
+  return p;
+}
+
+#if defined(__x86_64__)
+
+// The same as scan_scalar, 16 bytes per PCMPESTRI over the ranges
+// 00-08, 0A-1F and 7F.
+[[gnu::target("sse4.2")]] const char* scan_sse42(const char* p, const char* end) {
+  alignas(16) static constexpr char kRanges[16] = {'\x00', '\x08', '\x0a', '\x1f', '\x7f', '\x7f'};
+  auto ranges = _mm_load_si128(reinterpret_cast<const __m128i*>(kRanges));
+  for (; end - p >= 16; p += 16) {
+    auto v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+    int i = _mm_cmpestri(ranges, 6, v, 16, _SIDD_UBYTE_OPS | _SIDD_CMP_RANGES | _SIDD_LEAST_SIGNIFICANT);
+    if (i != 16) return p + i;
+  }
+  return scan_scalar(p, end);
+}
+
+// 32 bytes per compare: a byte stops the scan when it is at most 1F and not
+// HT, or is 7F.
+[[gnu::target("avx2")]] const char* scan_avx2(const char* p, const char* end) {
+  auto max_control = _mm256_set1_epi8(0x1f);
+  auto tab = _mm256_set1_epi8('\t');
+  auto del = _mm256_set1_epi8(0x7f);
+  for (; end - p >= 32; p += 32) {
+    auto v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+    auto control = _mm256_cmpeq_epi8(_mm256_min_epu8(v, max_control), v);
+    auto stop = _mm256_or_si256(_mm256_andnot_si256(_mm256_cmpeq_epi8(v, tab), control), _mm256_cmpeq_epi8(v, del));
+    auto mask = static_cast<unsigned>(_mm256_movemask_epi8(stop));
+    if (mask != 0) return p + std::countr_zero(mask);
+  }
+  return scan_sse42(p, end);
+}
+
+// scan_avx2 finishes its tail with scan_sse42, so it needs both.
+const bool kHaveSse42 = __builtin_cpu_supports("sse4.2");
+const Scanner kBestScanner = kHaveSse42 && __builtin_cpu_supports("avx2") ? Scanner::avx2
+                             : kHaveSse42                                 ? Scanner::sse42
+                                                                          : Scanner::scalar;
+
+#else
+
+const Scanner kBestScanner = Scanner::scalar;
+
+#endif
+
+// Takes the line at `p`, without its CRLF, and moves `p` past it.
+ParseStatus next_line(const char*& p, const char* end, Scanner scanner, std::string_view& line) {
+  const char* stop;
+  switch (scanner) {
+#if defined(__x86_64__)
+    case Scanner::avx2:
+      stop = scan_avx2(p, end);
+      break;
+    case Scanner::sse42:
+      stop = scan_sse42(p, end);
+      break;
+#endif
+    default:
+      stop = scan_scalar(p, end);
+      break;
+  }
+  if (stop == end || (*stop == '\r' && stop + 1 == end)) return ParseStatus::incomplete;
+  if (*stop != '\r' || stop[1] != '\n') return ParseStatus::invalid;
+  line = std::string_view(p, static_cast<std::size_t>(stop - p));
+  p = stop + 2;
+  return ParseStatus::complete;
+}
+
+int hex_value(char c) {
+  if (c >= '0' && c <= '9') return c - '0';
+  c = lower(c);
+  if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+  return -1;
+}
+
+// Records the header `name: value` in `req` if it is one the server uses.
+// Names are told apart by length before they are compared.
+void apply_header(Request& req, std::string_view name, std::string_view value) {
+  switch (name.size()) {
+    case 10:
+      if (iequals(name, "connection")) {
+        if (has_token(value, "close")) req.keep_alive = false;
+        if (has_token(value, "keep-alive")) req.keep_alive = true;
+      }
+      break;
+    case 13:
+      if (iequals(name, "if-none-match")) req.if_none_match = value;
+      break;
+    case 14:
+      if (iequals(name, "content-length") && value != "0") req.has_body = true;
+      break;
+    case 15:
+      if (iequals(name, "accept-encoding")) req.accept_encoding = parse_accept_encoding(value);
+      break;
+    case 17:
+      if (iequals(name, "transfer-encoding")) req.has_body = true;
+      break;
+    case 20:
+      if (iequals(name, "available-dictionary")) req.available_dictionary = value;
+      break;
+  }
+}
+
+}  // namespace
+
+bool iequals(std::string_view a, std::string_view b) {
+  if (a.size() != b.size()) return false;
+  for (std::size_t i = 0; i < a.size(); ++i) {
+    if (lower(a[i]) != lower(b[i])) return false;
+  }
+  return true;
+}
+
+bool etag_matches(std::string_view if_none_match, std::string_view etag) {
+  if (etag.starts_with("W/")) etag.remove_prefix(2);
+  while (!if_none_match.empty()) {
+    auto comma = if_none_match.find(',');
+    auto tag = trim(if_none_match.substr(0, comma));
+    if (tag.starts_with("W/")) tag.remove_prefix(2);
+    if (tag == etag || tag == "*") return true;
+    if (comma == std::string_view::npos) break;
+    if_none_match.remove_prefix(comma + 1);
+  }
+  return false;
+}
+
+Scanner best_scanner() { return kBestScanner; }
+
+ParseStatus parse_request(std::span<char> buf, Request& req, std::size_t& consumed) {
+  return parse_request(buf, req, consumed, kBestScanner);
+}
+
+ParseStatus parse_request(std::span<char> buf, Request& req, std::size_t& consumed, Scanner scanner) {
+  const char* begin = buf.data();
+  const char* end = begin + buf.size();
+  const char* p = begin;
+  std::string_view line;
+  if (auto status = next_line(p, end, scanner, line); status != ParseStatus::complete) return status;
+
+  auto sp1 = line.find(' ');
+  auto sp2 = line.rfind(' ');
+  if (sp1 == std::string_view::npos || sp1 == sp2) return ParseStatus::invalid;
+  auto method = line.substr(0, sp1);
+  auto target = line.substr(sp1 + 1, sp2 - sp1 - 1);
+  auto version = line.substr(sp2 + 1);
+  if (target.empty() || target.front() != '/' || target.find(' ') != std::string_view::npos) {
+    return ParseStatus::invalid;
+  }
+  if (version.size() != 8 || !version.starts_with("HTTP/1.")) return ParseStatus::invalid;
+  if (version[7] != '0' && version[7] != '1') return ParseStatus::invalid;
+  req = Request{};
+  req.minor_version = version[7] - '0';
+  req.keep_alive = req.minor_version == 1;
+  if (method == "GET") {
+    req.method = Method::get;
+  } else if (method == "HEAD") {
+    req.method = Method::head;
+  }
+  auto question = target.find('?');
+  auto path = target.substr(0, question);
+  if (question != std::string_view::npos) req.query = target.substr(question + 1);
+
+  for (;;) {
+    if (auto status = next_line(p, end, scanner, line); status != ParseStatus::complete) return status;
+    if (line.empty()) break;
+    auto colon = line.find(':');
+    if (colon == std::string_view::npos || colon == 0) return ParseStatus::invalid;
+    auto name = line.substr(0, colon);
+    // A folded continuation line, or whitespace before the colon, which
+    // proxies disagree about: both are rejected, as RFC 9112 allows.
+    if (name.front() == ' ' || name.front() == '\t' || name.back() == ' ' || name.back() == '\t') {
+      return ParseStatus::invalid;
+    }
+    apply_header(req, name, trim(line.substr(colon + 1)));
+  }
+  consumed = static_cast<std::size_t>(p - begin);
+
+  // Only now that the head is complete: normalizing is not idempotent, and
+  // an incomplete head is parsed again once more has arrived.
+  auto* path_data = buf.data() + (path.data() - begin);
+  auto size = normalize_path(path_data, path.size());
+  if (size == kInvalidPath) return ParseStatus::invalid;
+  req.path = std::string_view(path_data, size);
+  return ParseStatus::complete;
+}
+
+std::size_t normalize_path(char* path, std::size_t size) {
+  if (size == 0 || path[0] != '/') return kInvalidPath;
+  bool plain = true;
+  for (std::size_t i = 0; i < size && plain; ++i) {
+    plain = path[i] != '%' && !(path[i] == '/' && i + 1 < size && (path[i + 1] == '/' || path[i + 1] == '.'));
+  }
+  if (plain) return size;
+
+  std::size_t w = 0;
+  for (std::size_t r = 0; r < size; ++r, ++w) {
+    if (path[r] != '%') {
+      path[w] = path[r];
+      continue;
+    }
+    int hi = r + 2 < size ? hex_value(path[r + 1]) : -1;
+    int lo = hi >= 0 ? hex_value(path[r + 2]) : -1;
+    if (lo < 0 || (hi | lo) == 0) return kInvalidPath;
+    path[w] = static_cast<char>(hi << 4 | lo);
+    r += 2;
+  }
+  size = w;
+
+  // Segments are copied down behind w, which always ends in '/'.
+  w = 1;
+  for (std::size_t r = 1; r <= size;) {
+    auto e = r;
+    while (e < size && path[e] != '/') ++e;
+    std::string_view segment(path + r, e - r);
+    if (segment == "..") {
+      if (w == 1) return kInvalidPath;
+      do --w;
+      while (path[w - 1] != '/');
+    } else if (!segment.empty() && segment != ".") {
+      std::memmove(path + w, segment.data(), segment.size());
+      w += segment.size();
+      if (e < size) path[w++] = '/';
+    }
+    r = e + 1;
+  }
+  return w;
+}
+
+}  // namespace mt::http
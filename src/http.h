@@ -0,0 +1,64 @@
+#pragma once
+
+#include <cstddef>
+#include <span>
+#include <string_view>
+
+#include "encoding.h"
+
+namespace mt::http {
+
+enum class Method { get, head, other };
+
+// A parsed request head. All views point into the caller's receive buffer and
+// are only valid until that buffer is compacted.
+struct Request {
+  Method method = Method::other;
+  std::string_view path;   // the request-target's path, as normalize_path() leaves it
+  std::string_view query;  // after the '?', still encoded; empty when there is none
+  int minor_version = 1;
+  bool keep_alive = true;
+  bool has_body = false;  // Content-Length > 0 or any Transfer-Encoding
+  unsigned accept_encoding = encoding_bit(Encoding::identity);  // parse_accept_encoding() mask
+  std::string_view available_dictionary;                        // raw Available-Dictionary value
+  std::string_view if_none_match;                               // raw If-None-Match value
+};
+
+enum class ParseStatus { complete, incomplete, invalid };
+
+// How parse_request() finds the end of each line: 32 or 16 bytes at a time
+// with AVX2 or SSE4.2 where the CPU has them, else a byte at a time.
+enum class Scanner { scalar, sse42, avx2 };
+
+// The widest scanner this CPU supports.
+Scanner best_scanner();
+
+// Parses one request head from the front of `buf`. On `complete`, `consumed`
+// is set to the length of the head including the terminating blank line,
+// and the path has been normalized in place, so `buf` is modified. Heads
+// with control characters, bare LFs, folded or malformed header lines, a
+// target not starting with '/' or a path normalize_path() rejects are
+// invalid. Nothing is allocated, so a buffer of pipelined requests is
+// parsed by calling this again at `consumed`.
+ParseStatus parse_request(std::span<char> buf, Request& req, std::size_t& consumed);
+// The same with a given scanner, for benchmarks and fuzzing. The result
+// does not depend on which.
+ParseStatus parse_request(std::span<char> buf, Request& req, std::size_t& consumed, Scanner scanner);
+
+// Normalizes the absolute path `path[0, size)` in place: decodes %XX
+// escapes, then drops empty and "." segments and resolves ".." ones, so the
+// result is a plain "/a/b" or "/a/" with no way back above the root.
+// Returns the new size, or kInvalidPath if an escape is malformed or
+// decodes to NUL, or a ".." would climb above the root.
+std::size_t normalize_path(char* path, std::size_t size);
+inline constexpr std::size_t kInvalidPath = static_cast<std::size_t>(-1);
+
+// True when an If-None-Match value matches `etag`, using the weak comparison
+// RFC 9110 prescribes for it: "*" matches anything, and W/ prefixes are
+// ignored.
+bool etag_matches(std::string_view if_none_match, std::string_view etag);
+
+// ASCII case-insensitive comparison for header names and tokens.
+bool iequals(std::string_view a, std::string_view b);
+
+}  // namespace mt::http
@@ -0,0 +1,622 @@
+#include "http2.h"
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <tuple>
+
+namespace mt::http2 {
+
+namespace {
+
+enum FrameType : std::uint8_t {
+  kData = 0x0,
+  kHeaders = 0x1,
+  kPriority = 0x2,
+  kRstStream = 0x3,
+  kSettings = 0x4,
+  kPushPromise = 0x5,
+  kPing = 0x6,
+  kGoaway = 0x7,
+  kWindowUpdate = 0x8,
+  kContinuation = 0x9,
+  kPriorityUpdate = 0x10,  // RFC 9218
+};
+
+enum Flag : std::uint8_t {
+  kEndStream = 0x1,
+  kAck = 0x1,
+  kEndHeaders = 0x4,
+  kPadded = 0x8,
+  kPriorityFlag = 0x20,
+};
+
+enum ErrorCode : std::uint32_t {
+  kNoError = 0x0,
+  kProtocolError = 0x1,
+  kInternalError = 0x2,
+  kFlowControlError = 0x3,
+  kFrameSizeError = 0x6,
+  kRefusedStream = 0x7,
+  kCompressionError = 0x9,
+  kEnhanceYourCalm = 0xb,
+};
+
+enum Setting : std::uint16_t {
+  kSettingHeaderTableSize = 0x1,
+  kSettingEnablePush = 0x2,
+  kSettingMaxConcurrentStreams = 0x3,
+  kSettingInitialWindowSize = 0x4,
+  kSettingMaxFrameSize = 0x5,
+  kSettingMaxHeaderListSize = 0x6,
+  kSettingNoRfc7540Priorities = 0x9,  // RFC 9218
+};
+
+constexpr std::size_t kFrameHeaderSize = 9;
+// SETTINGS_MAX_FRAME_SIZE is left at its default, so no frame we receive is
+// larger.
+constexpr std::size_t kMaxReceiveFrame = 16384;
+constexpr std::size_t kMaxSendFrame = 64 * 1024;
+constexpr std::size_t kMaxHeaderList = 16384;
+// Header blocks over this, across CONTINUATION frames, end the connection.
+constexpr std::size_t kMaxHeaderBlock = 64 * 1024;
+constexpr std::int64_t kMaxWindow = 0x7fffffff;
+constexpr std::size_t kDefaultWindow = 65535;
+// Output produced per pending() call, at most: enough to fill a socket
+// buffer, little enough that new requests are not stuck behind it.
+constexpr std::size_t kWriteBudget = 256 * 1024;
+constexpr std::size_t kMaxChunks = 512;
+
+std::uint32_t read24(const char* p) {
+  auto b = reinterpret_cast<const unsigned char*>(p);
+  return static_cast<std::uint32_t>(b[0]) << 16 | static_cast<std::uint32_t>(b[1]) << 8 | b[2];
+}
+
+std::uint32_t read32(const char* p) {
+  auto b = reinterpret_cast<const unsigned char*>(p);
+  return static_cast<std::uint32_t>(b[0]) << 24 | static_cast<std::uint32_t>(b[1]) << 16 |
+         static_cast<std::uint32_t>(b[2]) << 8 | b[3];
+}
+
+void put32(std::string& out, std::uint32_t v) {
+  out += static_cast<char>(v >> 24);
+  out += static_cast<char>(v >> 16);
+  out += static_cast<char>(v >> 8);
+  out += static_cast<char>(v);
+}
+
+void frame_header(std::string& out, std::size_t length, FrameType type, std::uint8_t flags, std::uint32_t stream) {
+  out += static_cast<char>(length >> 16);
+  out += static_cast<char>(length >> 8);
+  out += static_cast<char>(length);
+  out += static_cast<char>(type);
+  out += static_cast<char>(flags);
+  put32(out, stream);
+}
+
+void setting(std::string& out, Setting id, std::uint32_t value) {
+  out += static_cast<char>(id >> 8);
+  out += static_cast<char>(id);
+  put32(out, value);
+}
+
+void rst_stream(std::string& out, std::uint32_t stream, std::uint32_t code) {
+  frame_header(out, 4, kRstStream, 0, stream);
+  put32(out, code);
+}
+
+// Strips the padding of a PADDED frame. Returns false if it is malformed.
+bool unpad(std::uint8_t flags, std::string_view& payload) {
+  if ((flags & kPadded) == 0) return true;
+  if (payload.empty()) return false;
+  auto pad = static_cast<unsigned char>(payload[0]);
+  if (pad >= payload.size()) return false;
+  payload = payload.substr(1, payload.size() - 1 - pad);
+  return true;
+}
+
+std::string_view trim(std::string_view s) {
+  while (!s.empty() && (s.front() == ' ' || s.front() == '\t')) s.remove_prefix(1);
+  while (!s.empty() && (s.back() == ' ' || s.back() == '\t')) s.remove_suffix(1);
+  return s;
+}
+
+// RFC 9113 8.2.1: a name holds no uppercase, controls, spaces or non-ASCII
+// (past a pseudo-header's colon), and a value no NUL, CR or LF.
+bool valid_field(std::string_view name, std::string_view value) {
+  if (name.starts_with(':')) name.remove_prefix(1);
+  if (name.empty()) return false;
+  for (unsigned char c : name) {
+    if (c <= 0x20 || c >= 0x7f || (c >= 'A' && c <= 'Z') || c == ':') return false;
+  }
+  return value.find_first_of(std::string_view("\0\r\n", 3)) == std::string_view::npos;
+}
+
+bool connection_specific(std::string_view name, std::string_view value) {
+  if (name == "te") return value != "trailers";
+  return name == "connection" || name == "keep-alive" || name == "proxy-connection" || name == "transfer-encoding" ||
+         name == "upgrade";
+}
+
+}  // namespace
+
+Priority parse_priority(std::string_view value, Priority base) {
+  while (!value.empty()) {
+    auto comma = value.find(',');
+    auto member = trim(value.substr(0, comma));
+    value.remove_prefix(comma == std::string_view::npos ? value.size() : comma + 1);
+    if (auto semi = member.find(';'); semi != std::string_view::npos) member = member.substr(0, semi);
+    if (member.size() == 3 && member.starts_with("u=") && member[2] >= '0' && member[2] <= '7') {
+      base.urgency = static_cast<std::uint8_t>(member[2] - '0');
+    } else if (member == "i" || member == "i=?1") {
+      base.incremental = true;
+    } else if (member == "i=?0") {
+      base.incremental = false;
+    }
+  }
+  return base;
+}
+
+bool parse_request(const std::vector<hpack::Field>& fields, std::string& path_buffer, http::Request& req,
+                   Priority& priority) {
+  req.accept_encoding = 0;
+  std::string_view method, scheme, path;
+  bool regular = false;
+  for (const auto& f : fields) {
+    if (!valid_field(f.name, f.value)) return false;
+    if (f.name.starts_with(':')) {
+      auto* slot = f.name == ":method" ? &method
+                   : f.name == ":scheme" ? &scheme
+                   : f.name == ":path"   ? &path
+                                         : nullptr;
+      // Pseudo-header fields come first, once each; :authority is not used.
+      if (regular || (slot == nullptr && f.name != ":authority") || (slot != nullptr && !slot->empty())) {
+        return false;
+      }
+      if (slot != nullptr) *slot = f.value;
+      continue;
+    }
+    regular = true;
+    if (connection_specific(f.name, f.value)) {
+      return false;
+    } else if (f.name == "accept-encoding") {
+      req.accept_encoding |= parse_accept_encoding(f.value);
+    } else if (f.name == "if-none-match") {
+      req.if_none_match = f.value;
+    } else if (f.name == "available-dictionary") {
+      req.available_dictionary = f.value;
+    } else if (f.name == "priority") {
+      priority = parse_priority(f.value, priority);
+    }
+  }
+  // As in HTTP/1.1, a request-target has no spaces or controls.
+  if (std::any_of(path.begin(), path.end(), [](unsigned char c) { return c <= 0x20 || c == 0x7f; })) return false;
+  if (method.empty() || scheme.empty() || path.empty()) return false;
+  if (req.accept_encoding == 0) req.accept_encoding = encoding_bit(Encoding::identity);
+  req.method = method == "GET" ? http::Method::get : method == "HEAD" ? http::Method::head : http::Method::other;
+
+  path_buffer.assign(path);
+  auto query = path_buffer.find('?');
+  std::size_t size = query == std::string::npos ? path_buffer.size() : query;
+  if (query != std::string::npos) req.query = std::string_view(path_buffer).substr(query + 1);
+  if (path_buffer[0] == '/') size = http::normalize_path(path_buffer.data(), size);
+  if (path_buffer[0] == '/' && size != http::kInvalidPath) req.path = std::string_view(path_buffer.data(), size);
+  return true;
+}
+
+Session::Session(Handler handler) : handler_(std::move(handler)), decoder_(4096, kMaxHeaderList) {
+  // Our SETTINGS, the server's half of the connection preface.
+  frame_header(control_, 3 * 6, kSettings, 0, 0);
+  setting(control_, kSettingMaxConcurrentStreams, kMaxConcurrentStreams);
+  setting(control_, kSettingMaxHeaderListSize, kMaxHeaderList);
+  setting(control_, kSettingNoRfc7540Priorities, 1);
+}
+
+bool Session::receive(std::string_view data) {
+  if (goaway_sent_) return false;
+  for (;;) {
+    std::string_view frame;
+    if (!partial_.empty()) {
+      auto want = [&](std::size_t size) {
+        auto take = std::min(size - std::min(size, partial_.size()), data.size());
+        partial_.append(data.substr(0, take));
+        data.remove_prefix(take);
+        return partial_.size() >= size;
+      };
+      if (!want(kFrameHeaderSize)) return true;
+      auto length = read24(partial_.data());
+      if (length > kMaxReceiveFrame) return fail(kFrameSizeError);
+      if (!want(kFrameHeaderSize + length)) return true;
+      std::string whole = std::move(partial_);
+      partial_.clear();
+      if (!on_frame(whole)) return false;
+      continue;
+    }
+    if (data.empty()) return true;
+    if (data.size() >= kFrameHeaderSize && read24(data.data()) > kMaxReceiveFrame) return fail(kFrameSizeError);
+    if (data.size() < kFrameHeaderSize || data.size() < kFrameHeaderSize + read24(data.data())) {
+      partial_.assign(data);
+      return true;
+    }
+    frame = data.substr(0, kFrameHeaderSize + read24(data.data()));
+    data.remove_prefix(frame.size());
+    if (!on_frame(frame)) return false;
+  }
+}
+
+bool Session::on_frame(std::string_view frame) {
+  auto type = static_cast<std::uint8_t>(frame[3]);
+  auto flags = static_cast<std::uint8_t>(frame[4]);
+  auto id = read32(frame.data() + 5) & 0x7fffffff;
+  auto payload = frame.substr(kFrameHeaderSize);
+
+  // A header block's CONTINUATION frames must follow it directly.
+  if (block_stream_ != 0 && (type != kContinuation || id != block_stream_)) return fail(kProtocolError);
+  if (!settings_seen_ && type != kSettings) return fail(kProtocolError);
+
+  switch (type) {
+    case kData:
+      if (id == 0 || id > last_stream_) return fail(kProtocolError);
+      if (!unpad(flags, payload)) return fail(kProtocolError);
+      if (flags & kEndStream) {
+        if (auto* s = find(id)) s->reset_after = false;  // nothing left to stop
+      }
+      // Request bodies are not read, but their flow-controlled bytes are
+      // handed back so the connection is never starved.
+      received_ += frame.size() - kFrameHeaderSize;
+      if (received_ >= kDefaultWindow / 2) {
+        frame_header(control_, 4, kWindowUpdate, 0, 0);
+        put32(control_, static_cast<std::uint32_t>(received_));
+        received_ = 0;
+      }
+      return true;
+    case kHeaders:
+      if (id == 0 || id % 2 == 0) return fail(kProtocolError);
+      if (!unpad(flags, payload)) return fail(kProtocolError);
+      if (flags & kPriorityFlag) {
+        // RFC 7540 priorities, which we told the client we ignore.
+        if (payload.size() < 5) return fail(kProtocolError);
+        payload.remove_prefix(5);
+      }
+      block_.assign(payload);
+      block_stream_ = id;
+      block_flags_ = flags;
+      return (flags & kEndHeaders) ? end_headers() : true;
+    case kContinuation:
+      if (block_stream_ == 0) return fail(kProtocolError);
+      if (block_.size() + payload.size() > kMaxHeaderBlock) return fail(kEnhanceYourCalm);
+      block_.append(payload);
+      return (flags & kEndHeaders) ? end_headers() : true;
+    case kPriority:
+      if (id == 0) return fail(kProtocolError);
+      if (payload.size() != 5) reset(id, kFrameSizeError);
+      return true;
+    case kRstStream:
+      if (payload.size() != 4) return fail(kFrameSizeError);
+      if (id == 0 || id > last_stream_) return fail(kProtocolError);
+      std::erase_if(streams_, [id](const Stream& s) { return s.id == id; });
+      return true;
+    case kSettings:
+      if (id != 0) return fail(kProtocolError);
+      return on_settings(flags, payload);
+    case kPushPromise:
+      return fail(kProtocolError);  // clients cannot push
+    case kPing:
+      if (payload.size() != 8) return fail(kFrameSizeError);
+      if (id != 0) return fail(kProtocolError);
+      if ((flags & kAck) == 0) {
+        frame_header(control_, 8, kPing, kAck, 0);
+        control_.append(payload);
+      }
+      return true;
+    case kGoaway:
+      if (id != 0) return fail(kProtocolError);
+      if (payload.size() < 8) return fail(kFrameSizeError);
+      goaway_received_ = true;
+      return true;
+    case kWindowUpdate:
+      if (payload.size() != 4) return fail(kFrameSizeError);
+      return on_window_update(id, payload);
+    case kPriorityUpdate:
+      if (id != 0) return fail(kProtocolError);
+      if (payload.size() < 4) return fail(kFrameSizeError);
+      if (auto* s = find(read32(payload.data()) & 0x7fffffff)) {
+        s->priority = parse_priority(payload.substr(4), s->priority);
+      }
+      return true;
+    default:
+      return true;  // unknown types are ignored
+  }
+}
+
+bool Session::on_settings(std::uint8_t flags, std::string_view payload) {
+  if (flags & kAck) return payload.empty() ? true : fail(kFrameSizeError);
+  if (payload.size() % 6 != 0) return fail(kFrameSizeError);
+  for (; !payload.empty(); payload.remove_prefix(6)) {
+    auto id = static_cast<std::uint16_t>(static_cast<unsigned char>(payload[0]) << 8 |
+                                         static_cast<unsigned char>(payload[1]));
+    auto value = read32(payload.data() + 2);
+    switch (id) {
+      case kSettingEnablePush:
+        if (value > 1) return fail(kProtocolError);
+        break;
+      case kSettingInitialWindowSize: {
+        if (value > kMaxWindow) return fail(kFlowControlError);
+        auto delta = static_cast<std::int64_t>(value) - initial_window_;
+        initial_window_ = value;
+        for (auto& s : streams_) {
+          s.window += delta;
+          if (s.window > kMaxWindow) return fail(kFlowControlError);
+        }
+        break;
+      }
+      case kSettingMaxFrameSize:
+        if (value < 16384 || value > 0xffffff) return fail(kProtocolError);
+        max_frame_ = std::min<std::size_t>(value, kMaxSendFrame);
+        break;
+      default:
+        break;  // the encoder never uses the dynamic table, and nothing is pushed
+    }
+  }
+  settings_seen_ = true;
+  frame_header(control_, 0, kSettings, kAck, 0);
+  return true;
+}
+
+bool Session::on_window_update(std::uint32_t id, std::string_view payload) {
+  auto increment = read32(payload.data()) & 0x7fffffff;
+  if (id == 0) {
+    if (increment == 0) return fail(kProtocolError);
+    send_window_ += increment;
+    return send_window_ <= kMaxWindow ? true : fail(kFlowControlError);
+  }
+  auto* s = find(id);
+  if (s == nullptr) return true;  // finished, or reset
+  if (increment == 0) {
+    reset(id, kProtocolError);
+  } else if ((s->window += increment) > kMaxWindow) {
+    reset(id, kFlowControlError);
+  }
+  return true;
+}
+
+bool Session::end_headers() {
+  auto id = block_stream_;
+  block_stream_ = 0;
+  // Decoded even when the stream is refused, to keep the table in step.
+  if (!decoder_.decode(block_, fields_)) return fail(kCompressionError);
+  if (id <= last_stream_) return true;  // trailers of a request already answered
+  last_stream_ = id;
+  if (streams_.size() >= kMaxConcurrentStreams) {
+    reset(id, kRefusedStream);
+    return true;
+  }
+
+  http::Request req;
+  Priority priority;
+  if (!parse_request(fields_, path_, req, priority)) {
+    reset(id, kProtocolError);
+    return true;
+  }
+  req.has_body = (block_flags_ & kEndStream) == 0;
+  open_stream(id, req.has_body, priority, req.path.empty() ? nullptr : &req);
+  return true;
+}
+
+void Session::open_stream(std::uint32_t id, bool has_body, Priority priority, const http::Request* req) {
+  Stream s;
+  s.id = id;
+  s.priority = priority;
+  s.window = initial_window_;
+  // Once answered, the client is asked to stop sending the body.
+  s.reset_after = has_body;
+  streams_.push_back(std::move(s));
+  handler_(id, req);
+}
+
+void Session::respond(std::uint32_t stream, std::string head, Body body, std::uint64_t started) {
+  auto* s = find(stream);
+  if (s == nullptr) return;
+  s->responded = true;
+  s->head = std::move(head);
+  s->body = std::move(body);
+  s->started = started;
+}
+
+bool Session::push(std::uint32_t stream, std::string_view data) {
+  auto* s = find(stream);
+  if (s == nullptr || !s->body.open) return false;
+  s->body.generated.append(data);
+  return true;
+}
+
+bool Session::fail(std::uint32_t code) {
+  frame_header(control_, 8, kGoaway, 0, 0);
+  put32(control_, last_stream_);
+  put32(control_, code);
+  goaway_sent_ = true;
+  streams_.clear();
+  return false;
+}
+
+void Session::reset(std::uint32_t id, std::uint32_t code) {
+  rst_stream(control_, id, code);
+  std::erase_if(streams_, [id](const Stream& s) { return s.id == id; });
+}
+
+Session::Stream* Session::find(std::uint32_t id) {
+  for (auto& s : streams_) {
+    if (s.id == id) return &s;
+  }
+  return nullptr;
+}
+
+std::span<const iovec> Session::pending() {
+  if (iov_off_ == iov_.size()) produce();
+  return std::span<const iovec>(iov_).subspan(iov_off_);
+}
+
+void Session::sent(std::size_t n) {
+  while (n > 0) {
+    auto& span = iov_[iov_off_];
+    if (n < span.iov_len) {
+      span.iov_base = static_cast<char*>(span.iov_base) + n;
+      span.iov_len -= n;
+      return;
+    }
+    n -= span.iov_len;
+    ++iov_off_;
+  }
+  if (iov_off_ == iov_.size()) {
+    finished_.insert(finished_.end(), finishing_.begin(), finishing_.end());
+    finishing_.clear();
+  }
+}
+
+// Fills the output: control frames first, then stream frames in priority
+// order while the budget and flow control allow.
+void Session::produce() {
+  out_.clear();
+  produced_ = 0;
+  chunks_.clear();
+  iov_.clear();
+  iov_off_ = 0;
+  append(control_);
+  control_.clear();
+
+  while (produced_ < kWriteBudget && chunks_.size() + 2 < kMaxChunks) {
+    Stream* s = next_stream();
+    if (s == nullptr) break;
+    if (write_frame(*s)) continue;
+    if (s->reset_after) {
+      std::string rst;
+      rst_stream(rst, s->id, kNoError);
+      append(rst);
+    }
+    if (s->started != 0) finishing_.push_back({s->started, s->bytes});
+    auto id = s->id;
+    std::erase_if(streams_, [id](const Stream& st) { return st.id == id; });
+  }
+
+  for (const auto& c : chunks_) {
+    const char* base = c.data != nullptr ? c.data : out_.data() + c.offset;
+    iov_.push_back({const_cast<char*>(base), c.size});
+  }
+}
+
+// The stream to send a frame of next: the most urgent that can send, and
+// of those the first opened, or the incremental one that waited longest.
+Session::Stream* Session::next_stream() {
+  Stream* best = nullptr;
+  auto key = [](const Stream& s) {
+    return std::tuple(s.priority.urgency, s.priority.incremental, s.priority.incremental ? s.turn : s.id);
+  };
+  for (auto& s : streams_) {
+    if (!s.responded) continue;
+    bool ready = !s.head_sent || (s.left() > 0 && s.window > 0 && send_window_ > 0);
+    if (ready && (best == nullptr || key(s) < key(*best))) best = &s;
+  }
+  return best;
+}
+
+bool Session::write_frame(Stream& s) {
+  if (!s.head_sent) {
+    bool end = s.left() == 0 && !s.body.open;
+    std::string_view block = s.head;
+    auto type = kHeaders;
+    do {
+      auto size = std::min(block.size(), max_frame_);
+      std::uint8_t flags = size == block.size() ? kEndHeaders : 0;
+      if (type == kHeaders && end) flags |= kEndStream;
+      std::string header;
+      frame_header(header, size, type, flags, s.id);
+      append(header);
+      append(block.substr(0, size));
+      block.remove_prefix(size);
+      type = kContinuation;
+    } while (!block.empty());
+    s.head_sent = true;
+    s.bytes += s.head.size();
+    s.head = std::string();
+    return !end;
+  }
+
+  // One frame from one part of the body.
+  const auto& b = s.body;
+  std::size_t offset = s.sent;
+  std::size_t part_left = 0;
+  int part = 0;
+  for (std::size_t size : {b.memory.size(), b.file_size, b.trailer.size(), b.generated.size()}) {
+    if (offset < size) {
+      part_left = size - offset;
+      break;
+    }
+    offset -= size;
+    ++part;
+  }
+  auto n = std::min({part_left, max_frame_, static_cast<std::size_t>(std::min(s.window, send_window_)),
+                     std::max<std::size_t>(kWriteBudget - std::min(kWriteBudget, produced_), 1)});
+  bool end = n == s.left() && !b.open;
+  std::string header;
+  frame_header(header, n, kData, end ? kEndStream : 0, s.id);
+  append(header);
+  switch (part) {
+    case 0:
+      append_ref(b.memory.data() + offset, n);
+      break;
+    case 1: {
+      auto at = out_.size();
+      out_.resize(at + n);
+      auto got = ::pread(b.fd, out_.data() + at, n, static_cast<off_t>(offset));
+      if (got != static_cast<ssize_t>(n)) {
+        // The file shrank or failed under us: the stream cannot be finished.
+        out_.resize(at - kFrameHeaderSize);
+        produced_ -= kFrameHeaderSize;
+        chunks_.back().size -= kFrameHeaderSize;
+        if (chunks_.back().size == 0) chunks_.pop_back();
+        rst_stream(control_, s.id, kInternalError);
+        s.started = 0;
+        s.reset_after = false;
+        return false;
+      }
+      chunks_.back().size += n;
+      produced_ += n;
+      break;
+    }
+    case 2:
+      append_ref(b.trailer.data() + offset, n);
+      break;
+    default:
+      append(std::string_view(b.generated).substr(offset, n));
+      break;
+  }
+  s.sent += n;
+  s.bytes += n;
+  s.window -= static_cast<std::int64_t>(n);
+  send_window_ -= static_cast<std::int64_t>(n);
+  if (s.priority.incremental) s.turn = ++turns_;
+  if (b.open && s.left() == 0) {
+    // Pushed data is dropped once sent; an event stream runs for hours.
+    s.sent -= s.body.generated.size();
+    s.body.generated.clear();
+  }
+  return !end;
+}
+
+void Session::append(std::string_view bytes) {
+  if (bytes.empty()) return;
+  if (!chunks_.empty() && chunks_.back().data == nullptr) {
+    chunks_.back().size += bytes.size();
+  } else {
+    chunks_.push_back({nullptr, out_.size(), bytes.size()});
+  }
+  out_.append(bytes);
+  produced_ += bytes.size();
+}
+
+void Session::append_ref(const char* data, std::size_t size) {
+  chunks_.push_back({data, 0, size});
+  produced_ += size;
+}
+
+}  // namespace mt::http2
@@ -0,0 +1,183 @@
+#pragma once
+
+#include <sys/uio.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "hpack.h"
+#include "http.h"
+
+// HTTP/2 (RFC 9113), server side, over a connection that opened with the
+// client preface ("prior knowledge").
+namespace mt::http2 {
+
+// What a client sends first. The caller consumes it; Session starts after.
+inline constexpr std::string_view kPreface = "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n";
+
+// Concurrent streams a client may open. Further ones are refused until
+// earlier ones finish.
+inline constexpr std::uint32_t kMaxConcurrentStreams = 128;
+
+// The body of a response, sent in DATA frames in this order: `memory`, then
+// the first `file_size` bytes of `fd`, then `trailer`, then `generated`.
+// `memory`, `fd` and `trailer` must stay valid until the stream ends.
+struct Body {
+  std::string_view memory;
+  int fd = -1;
+  std::size_t file_size = 0;
+  std::string_view trailer;
+  std::string generated;
+  // The stream stays open after the body, for push() to add to it, until
+  // the client resets it or the connection ends.
+  bool open = false;
+};
+
+// An RFC 9218 priority: lower urgencies go first; streams of one urgency
+// are sent one after another in the order they were opened, except
+// incremental ones, which share the connection a frame at a time.
+struct Priority {
+  std::uint8_t urgency = 3;
+  bool incremental = false;
+};
+
+// Applies a Priority header or PRIORITY_UPDATE value (e.g. "u=1, i") to
+// `base`. Unknown and malformed members are ignored.
+Priority parse_priority(std::string_view value, Priority base = {});
+
+// Reads a request from its decoded fields, checked as HTTP/2 and HTTP/3
+// both require (RFC 9113 section 8.3, RFC 9114 section 4.3). Returns false
+// if it is malformed. Otherwise `req` views `fields` and `path_buffer`,
+// which holds the :path normalized in place; req.path is empty when the
+// path is not valid (400 territory). req.has_body is left to the caller.
+bool parse_request(const std::vector<hpack::Field>& fields, std::string& path_buffer, http::Request& req,
+                   Priority& priority);
+
+// One connection's protocol state. It does no I/O: the caller feeds it what
+// it reads and sends what pending() returns, so it runs over any transport.
+class Session {
+ public:
+  // Called once per request. `req` is null when the request is well-formed
+  // HTTP/2 but its path is not (400 territory). Views in `req` are only
+  // valid during the call. The handler must respond() to `stream` before
+  // returning.
+  using Handler = std::function<void(std::uint32_t stream, const http::Request* req)>;
+
+  explicit Session(Handler handler);
+
+  // Processes received bytes, of any size; a frame split across calls is
+  // kept until the rest arrives. Returns false after a connection error:
+  // a GOAWAY is queued, and the connection should close once pending()
+  // is empty. Later input is ignored.
+  bool receive(std::string_view data);
+
+  // Queues the response on `stream`: the header block `head`, encoded with
+  // hpack's stateless encoder, then `body`. `started`, if not 0, is
+  // returned in finished() once the stream's last byte is sent.
+  void respond(std::uint32_t stream, std::string head, Body body, std::uint64_t started = 0);
+
+  // Appends `data` to the body of an open stream. Returns false when the
+  // stream has gone, so the caller can forget it.
+  bool push(std::uint32_t stream, std::string_view data);
+
+  // Frames ready to send, as spans for one sendmsg. Empty when nothing can
+  // go out: no stream has data, or flow control holds it back. The spans
+  // are valid until the next call to any other member.
+  std::span<const iovec> pending();
+  // Drops the first `n` bytes of pending() once they are sent.
+  void sent(std::size_t n);
+
+  // A response whose last byte was sent.
+  struct Finished {
+    std::uint64_t started;  // as given to respond()
+    std::size_t bytes;      // of its header block and body
+  };
+  // Responses finished since the caller last cleared this.
+  std::vector<Finished>& finished() { return finished_; }
+
+  // True while a stream is still being answered.
+  bool active() const { return !streams_.empty(); }
+  // True when the client said goodbye and every stream is done.
+  bool done() const { return goaway_received_ && streams_.empty() && control_.empty(); }
+
+ private:
+  struct Stream {
+    std::uint32_t id = 0;
+    Priority priority;
+    std::uint64_t turn = 0;  // incremental streams: when it last sent
+    std::int64_t window = 0;
+    bool responded = false;
+    bool head_sent = false;
+    bool reset_after = false;  // the request had a body we did not read
+    std::string head;
+    Body body;
+    std::size_t sent = 0;  // body bytes sent
+    std::uint64_t started = 0;
+    std::size_t bytes = 0;
+
+    std::size_t body_size() const {
+      return body.memory.size() + body.file_size + body.trailer.size() + body.generated.size();
+    }
+    std::size_t left() const { return body_size() - sent; }
+  };
+  // A span of output: out_[offset, offset + size) when `data` is null.
+  struct Chunk {
+    const char* data;
+    std::size_t offset;
+    std::size_t size;
+  };
+
+  bool on_frame(std::string_view frame);
+  bool on_settings(std::uint8_t flags, std::string_view payload);
+  bool on_window_update(std::uint32_t id, std::string_view payload);
+  bool end_headers();
+  void open_stream(std::uint32_t id, bool has_body, Priority priority, const http::Request* req);
+  bool fail(std::uint32_t code);
+  void reset(std::uint32_t id, std::uint32_t code);
+  Stream* find(std::uint32_t id);
+
+  void produce();
+  Stream* next_stream();
+  // Writes the header block or one DATA frame of `s`; returns false when
+  // the stream is over.
+  bool write_frame(Stream& s);
+  void append(std::string_view bytes);
+  void append_ref(const char* data, std::size_t size);
+
+  Handler handler_;
+  hpack::Decoder decoder_;
+  std::vector<hpack::Field> fields_;
+  std::string path_;  // the current request's :path, normalized in place
+
+  std::string partial_;  // a frame not yet wholly received
+  bool settings_seen_ = false;
+  std::string block_;  // header block fragments of block_stream_
+  std::uint32_t block_stream_ = 0;
+  std::uint8_t block_flags_ = 0;
+  std::uint32_t last_stream_ = 0;
+  bool goaway_sent_ = false;
+  bool goaway_received_ = false;
+
+  std::vector<Stream> streams_;
+  std::uint64_t turns_ = 0;
+  std::int64_t send_window_ = 65535;
+  std::int64_t initial_window_ = 65535;
+  std::size_t max_frame_ = 16384;
+  std::size_t received_ = 0;  // DATA bytes not yet returned in a WINDOW_UPDATE
+
+  std::string control_;  // frames to send before any stream's
+  std::string out_;
+  std::size_t produced_ = 0;  // bytes in chunks_, in out_ or not
+  std::vector<Chunk> chunks_;
+  std::vector<iovec> iov_;
+  std::size_t iov_off_ = 0;
+  std::vector<Finished> finishing_;  // in the output being sent
+  std::vector<Finished> finished_;
+};
+
+}  // namespace mt::http2
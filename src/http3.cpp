@@ -0,0 +1,283 @@
+#include "http3.h"
+
+namespace mt::http3 {
+
+namespace {
+
+enum FrameType : std::uint64_t {
+  kData = 0x0,
+  kHeaders = 0x1,
+  kCancelPush = 0x3,
+  kSettings = 0x4,
+  kPushPromise = 0x5,
+  kGoaway = 0x7,
+  kMaxPushId = 0xd,
+  kPriorityUpdate = 0xf0700,  // RFC 9218, for a request stream
+};
+
+enum StreamType : std::uint64_t {
+  kControlStream = 0x0,
+  kPushStream = 0x1,
+  kEncoderStream = 0x2,  // QPACK
+  kDecoderStream = 0x3,
+};
+
+enum Setting : std::uint64_t {
+  kSettingMaxFieldSectionSize = 0x6,
+};
+
+// HTTP/2 frame types HTTP/3 reserves (RFC 9114 section 11.2.1).
+bool http2_frame(std::uint64_t type) { return type == 0x2 || type == 0x6 || type == 0x8 || type == 0x9; }
+
+struct Frame {
+  std::uint64_t type;
+  std::uint64_t length;  // of the payload
+  std::size_t header;
+};
+
+const std::uint8_t* bytes(std::string_view s) { return reinterpret_cast<const std::uint8_t*>(s.data()); }
+
+// Reads the frame header at the start of `in`. Returns false until it is
+// whole.
+bool read_frame_header(std::string_view in, Frame& f) {
+  const std::uint8_t* p = bytes(in);
+  if (!quic::get_varint(p, bytes(in) + in.size(), f.type) || !quic::get_varint(p, bytes(in) + in.size(), f.length)) {
+    return false;
+  }
+  f.header = static_cast<std::size_t>(p - bytes(in));
+  return true;
+}
+
+}  // namespace
+
+void frame_header(std::string& out, std::uint64_t type, std::uint64_t length) {
+  quic::put_varint(out, type);
+  quic::put_varint(out, length);
+}
+
+Session::Session(Handler handler, std::shared_ptr<const tls13::Credentials> credentials, const quic::Header& h,
+                 std::string cid, const quic::Limits& limits, std::uint64_t now)
+    : handler_(std::move(handler)),
+      connection_(*this, std::move(credentials), h, std::move(cid), std::string(kAlpn), limits, now) {
+  // Our control stream, opening with SETTINGS. QPACK's dynamic table
+  // capacity is left at its default of 0.
+  std::string settings;
+  quic::put_varint(settings, kSettingMaxFieldSectionSize);
+  quic::put_varint(settings, kMaxFieldSection);
+  std::string control;
+  quic::put_varint(control, kControlStream);
+  frame_header(control, kSettings, settings.size());
+  control += settings;
+  auto id = connection_.open_uni();
+  connection_.set_priority(id, 0, false);
+  connection_.write(id, std::move(control));
+}
+
+void Session::respond(std::uint64_t stream, std::string head, http2::Body body, std::uint64_t started) {
+  auto it = requests_.find(stream);
+  if (it == requests_.end()) return;
+  Request& r = it->second;
+  std::size_t size = body.memory.size() + body.file_size + body.trailer.size() + body.generated.size();
+  std::string frames;
+  frames.reserve(head.size() + 2 * 9);
+  frame_header(frames, kHeaders, head.size());
+  frames += head;
+  // An open stream's pushes each get a DATA frame of their own.
+  if (size) frame_header(frames, kData, size);
+  r.open = body.open;
+  r.started = started;
+  r.bytes = head.size() + size;
+  connection_.write(stream, std::move(frames));
+  if (!body.memory.empty()) connection_.write_ref(stream, body.memory);
+  if (body.file_size) connection_.write_file(stream, body.fd, body.file_size);
+  if (!body.trailer.empty()) connection_.write_ref(stream, body.trailer);
+  if (!body.generated.empty()) connection_.write(stream, std::move(body.generated));
+  if (!body.open) connection_.finish(stream);
+}
+
+bool Session::push(std::uint64_t stream, std::string_view data) {
+  auto it = requests_.find(stream);
+  if (it == requests_.end() || !it->second.open) return false;
+  std::string frame;
+  frame.reserve(9 + data.size());
+  frame_header(frame, kData, data.size());
+  frame += data;
+  connection_.write(stream, std::move(frame));
+  return true;
+}
+
+void Session::on_stream_data(std::uint64_t stream, std::string_view data, bool fin) {
+  if (failed_) return;
+  // Clients open only bidirectional request streams and unidirectional
+  // ones.
+  if (stream & 2) return on_incoming(stream, incoming_[stream], data, fin);
+  on_request(stream, requests_[stream], data, fin);
+}
+
+void Session::on_stream_reset(std::uint64_t stream) {
+  if (stream & 2) {
+    auto it = incoming_.find(stream);
+    if (it == incoming_.end()) return;
+    if (it->second.type != UINT64_MAX && it->second.type != kPushStream) return fail(kClosedCriticalStream);
+    incoming_.erase(it);
+    return;
+  }
+  auto it = requests_.find(stream);
+  if (it == requests_.end()) return;
+  // Once dispatched, a request is reset only by the client asking us to
+  // stop sending; before, by its abandoning the request.
+  if (!it->second.dispatched) connection_.reset_stream(stream, kRequestCancelled);
+  requests_.erase(it);
+}
+
+void Session::on_stream_acked(std::uint64_t stream) {
+  auto it = requests_.find(stream);
+  if (it == requests_.end()) return;
+  if (it->second.started != 0) finished_.push_back({it->second.started, it->second.bytes});
+  requests_.erase(it);
+}
+
+void Session::on_request(std::uint64_t id, Request& r, std::string_view data, bool fin) {
+  if (r.dispatched) return;  // a body, which the client has been asked to stop sending
+  r.input += data;
+  std::string_view in = r.input;
+  Frame f;
+  while (read_frame_header(in, f)) {
+    if (f.length > kMaxFieldSection) return reject(id, kExcessiveLoad);
+    std::size_t size = f.header + f.length;
+    if (in.size() < size) break;
+    if (f.type == kHeaders) {
+      if (in.size() == size && !fin) break;  // until we know whether a body follows
+      return dispatch(id, r, in.substr(f.header, f.length), in.size() > size);
+    }
+    if (f.type == kData || f.type == kCancelPush || f.type == kSettings || f.type == kPushPromise ||
+        f.type == kGoaway || f.type == kMaxPushId || http2_frame(f.type)) {
+      return fail(kFrameUnexpected);
+    }
+    in.remove_prefix(size);  // unknown frame types are ignored
+  }
+  r.input.erase(0, r.input.size() - in.size());
+  if (fin) reject(id, kRequestIncomplete);
+}
+
+void Session::dispatch(std::uint64_t id, Request& r, std::string_view section, bool has_body) {
+  r.dispatched = true;
+  if (!decoder_.decode(section, fields_)) return fail(kDecompressionFailed);
+  r.input = {};
+  http::Request req;
+  if (!http2::parse_request(fields_, path_, req, r.priority)) return reject(id, kMessageError);
+  req.has_body = has_body;
+  connection_.set_priority(id, r.priority.urgency, r.priority.incremental);
+  // We answer without reading bodies.
+  if (has_body) connection_.stop_sending(id, kNoError);
+  handler_(id, req.path.empty() ? nullptr : &req);
+}
+
+void Session::on_incoming(std::uint64_t id, Incoming& u, std::string_view data, bool fin) {
+  if (u.type == UINT64_MAX) {
+    u.input += data;
+    data = {};
+    const std::uint8_t* p = bytes(u.input);
+    std::uint64_t type = 0;
+    if (!quic::get_varint(p, bytes(u.input) + u.input.size(), type)) {
+      if (fin) incoming_.erase(id);
+      return;
+    }
+    u.input.erase(0, static_cast<std::size_t>(p - bytes(u.input)));
+    switch (type) {
+      case kControlStream:
+        if (control_seen_) return fail(kStreamCreationError);
+        control_seen_ = true;
+        break;
+      case kPushStream:
+        return fail(kStreamCreationError);  // only servers push
+      case kEncoderStream:
+      case kDecoderStream:
+        u.input.clear();
+        break;
+      default:
+        connection_.stop_sending(id, kStreamCreationError);
+        incoming_.erase(id);
+        return;
+    }
+    u.type = type;
+  }
+  // With no dynamic table, QPACK's streams carry nothing we need. They and
+  // the control stream must stay open.
+  if (u.type != kControlStream) {
+    if (fin) fail(kClosedCriticalStream);
+    return;
+  }
+  u.input += data;
+  std::string_view in = u.input;
+  Frame f;
+  while (read_frame_header(in, f)) {
+    if (f.length > kMaxFieldSection) return fail(kExcessiveLoad);
+    std::size_t size = f.header + f.length;
+    if (in.size() < size) break;
+    if (!on_control_frame(f.type, in.substr(f.header, f.length))) return;
+    in.remove_prefix(size);
+  }
+  u.input.erase(0, u.input.size() - in.size());
+  if (fin) fail(kClosedCriticalStream);
+}
+
+bool Session::on_control_frame(std::uint64_t type, std::string_view payload) {
+  if (!settings_seen_ && type != kSettings) {
+    fail(kMissingSettings);
+    return false;
+  }
+  const std::uint8_t* p = bytes(payload);
+  const std::uint8_t* end = p + payload.size();
+  switch (type) {
+    case kSettings:
+      if (settings_seen_) break;
+      settings_seen_ = true;
+      // Nothing a client may set changes what we send, but it must parse.
+      while (p != end) {
+        std::uint64_t setting = 0;
+        std::uint64_t value = 0;
+        if (!quic::get_varint(p, end, setting) || !quic::get_varint(p, end, value)) {
+          fail(kFrameError);
+          return false;
+        }
+      }
+      return true;
+    case kPriorityUpdate: {
+      std::uint64_t stream = 0;
+      if (!quic::get_varint(p, end, stream)) {
+        fail(kFrameError);
+        return false;
+      }
+      // Updates for streams not yet open, or already answered, are dropped.
+      auto it = requests_.find(stream);
+      if (it == requests_.end()) return true;
+      auto value = payload.substr(static_cast<std::size_t>(p - bytes(payload)));
+      it->second.priority = http2::parse_priority(value);
+      connection_.set_priority(stream, it->second.priority.urgency, it->second.priority.incremental);
+      return true;
+    }
+    case kData:
+    case kHeaders:
+    case kPushPromise:
+      break;
+    default:
+      if (http2_frame(type)) break;
+      return true;  // GOAWAY, MAX_PUSH_ID and CANCEL_PUSH concern pushes and shutdown, which we leave be
+  }
+  fail(kFrameUnexpected);
+  return false;
+}
+
+void Session::reject(std::uint64_t id, std::uint64_t code) {
+  connection_.stop_sending(id, code);
+  connection_.reset_stream(id, code);
+  requests_.erase(id);
+}
+
+void Session::fail(std::uint64_t code) {
+  failed_ = true;
+  connection_.close(code);
+}
+
+}  // namespace mt::http3
@@ -0,0 +1,116 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "http.h"
+#include "http2.h"
+#include "qpack.h"
+#include "quic.h"
+
+// HTTP/3 (RFC 9114), server side. A Session is the HTTP layer of one QUIC
+// connection, which it owns; like http2::Session it does no I/O, so the
+// worker batches the datagrams of all its connections.
+namespace mt::http3 {
+
+inline constexpr std::string_view kAlpn = "h3";
+
+// SETTINGS_MAX_FIELD_SECTION_SIZE we advertise and enforce.
+inline constexpr std::size_t kMaxFieldSection = 16384;
+
+// Error codes (RFC 9114 section 8.1), sent as application errors.
+enum Error : std::uint64_t {
+  kNoError = 0x100,
+  kGeneralProtocolError = 0x101,
+  kInternalError = 0x102,
+  kStreamCreationError = 0x103,
+  kClosedCriticalStream = 0x104,
+  kFrameUnexpected = 0x105,
+  kFrameError = 0x106,
+  kExcessiveLoad = 0x107,
+  kMissingSettings = 0x10a,
+  kRequestCancelled = 0x10c,
+  kRequestIncomplete = 0x10d,
+  kMessageError = 0x10e,
+  kDecompressionFailed = 0x200,  // QPACK
+};
+
+// Appends a frame header: type and payload length.
+void frame_header(std::string& out, std::uint64_t type, std::uint64_t length);
+
+class Session : quic::Application {
+ public:
+  // Called once per request, as http2::Session::Handler is.
+  using Handler = std::function<void(std::uint64_t stream, const http::Request* req)>;
+  using Finished = http2::Session::Finished;
+
+  // A session for the client whose first Initial packet had header `h`;
+  // `cid` is the connection ID we give ourselves.
+  Session(Handler handler, std::shared_ptr<const tls13::Credentials> credentials, const quic::Header& h,
+          std::string cid, const quic::Limits& limits, std::uint64_t now);
+  Session(const Session&) = delete;
+  Session& operator=(const Session&) = delete;
+
+  // The transport, which the caller feeds datagrams and sends from.
+  quic::Connection& connection() { return connection_; }
+
+  // Queues the response on `stream`: the field section `head`, encoded
+  // with qpack, then `body` in one DATA frame. `started`, if not 0, is
+  // returned in finished() once the client has acknowledged it all.
+  void respond(std::uint64_t stream, std::string head, http2::Body body, std::uint64_t started = 0);
+
+  // Appends `data` to the body of an open stream. Returns false when the
+  // stream has gone, so the caller can forget it.
+  bool push(std::uint64_t stream, std::string_view data);
+
+  // Responses finished since the caller last cleared this.
+  std::vector<Finished>& finished() { return finished_; }
+
+  // True while a stream is still being answered.
+  bool active() const { return !requests_.empty(); }
+
+ private:
+  struct Request {
+    std::string input;  // until the HEADERS frame is whole
+    bool dispatched = false;
+    bool open = false;  // respond() left it open for push()
+    http2::Priority priority;
+    std::uint64_t started = 0;
+    std::size_t bytes = 0;
+  };
+  // A unidirectional stream the client opened.
+  struct Incoming {
+    std::uint64_t type = UINT64_MAX;  // until its first bytes arrive
+    std::string input;  // a frame not yet wholly received
+  };
+
+  void on_stream_data(std::uint64_t stream, std::string_view data, bool fin) override;
+  void on_stream_reset(std::uint64_t stream) override;
+  void on_stream_acked(std::uint64_t stream) override;
+
+  void on_request(std::uint64_t id, Request& r, std::string_view data, bool fin);
+  void dispatch(std::uint64_t id, Request& r, std::string_view section, bool has_body);
+  void on_incoming(std::uint64_t id, Incoming& u, std::string_view data, bool fin);
+  bool on_control_frame(std::uint64_t type, std::string_view payload);
+  void reject(std::uint64_t id, std::uint64_t code);
+  void fail(std::uint64_t code);
+
+  Handler handler_;
+  quic::Connection connection_;
+  qpack::Decoder decoder_{kMaxFieldSection};
+  std::vector<hpack::Field> fields_;
+  std::string path_;  // the current request's :path, normalized in place
+  std::unordered_map<std::uint64_t, Request> requests_;
+  std::unordered_map<std::uint64_t, Incoming> incoming_;
+  bool control_seen_ = false;
+  bool settings_seen_ = false;
+  bool failed_ = false;
+  std::vector<Finished> finished_;
+};
+
+}  // namespace mt::http3
@@ -0,0 +1,243 @@
+#include "metrics.h"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <string_view>
+
+#include "http.h"
+
+namespace mt {
+
+namespace {
+
+std::runtime_error sys_error(std::string_view what) {
+  return std::runtime_error(std::string(what) + ": " + std::strerror(errno));
+}
+
+constexpr std::string_view kMetricsPath = "/metrics";
+constexpr std::size_t kRequestLimit = 4096;
+// A scraper that stalls for this long is dropped, so it cannot hold up
+// the next one.
+constexpr timeval kSocketTimeout = {1, 0};
+
+// Quantiles reported for each histogram.
+constexpr std::array<double, 6> kQuantiles = {0.5, 0.9, 0.99, 0.999, 0.9999, 1.0};
+
+void append_header(std::string& out, std::string_view name, std::string_view type, std::string_view help) {
+  out.append("# HELP ").append(name).append(" ").append(help).append("\n");
+  out.append("# TYPE ").append(name).append(" ").append(type).append("\n");
+}
+
+void append_number(std::string& out, double value) {
+  char buf[32];
+  if (value == std::floor(value) && value < 1e15) {
+    auto n = std::snprintf(buf, sizeof buf, "%.0f", value);
+    out.append(buf, static_cast<std::size_t>(n));
+    return;
+  }
+  auto n = std::snprintf(buf, sizeof buf, "%.9g", value);
+  out.append(buf, static_cast<std::size_t>(n));
+}
+
+void append_counter(std::string& out, std::string_view name, std::string_view help, std::uint64_t value) {
+  append_header(out, name, "counter", help);
+  out.append(name).append(" ").append(std::to_string(value)).append("\n");
+}
+
+// A summary of `h`, whose values are multiplied by `scale` to get the
+// exported unit.
+void append_summary(std::string& out, std::string_view name, std::string_view help, const HistogramSnapshot& h,
+                    double scale) {
+  append_header(out, name, "summary", help);
+  for (double q : kQuantiles) {
+    out.append(name).append("{quantile=\"");
+    append_number(out, q);
+    out.append("\"} ");
+    append_number(out, static_cast<double>(h.quantile(q)) * scale);
+    out.append("\n");
+  }
+  out.append(name).append("_sum ");
+  append_number(out, static_cast<double>(h.sum) * scale);
+  out.append("\n").append(name).append("_count ").append(std::to_string(h.total)).append("\n");
+}
+
+bool send_all(int fd, std::string_view data) {
+  while (!data.empty()) {
+    auto n = ::send(fd, data.data(), data.size(), MSG_NOSIGNAL);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) return false;
+    data.remove_prefix(static_cast<std::size_t>(n));
+  }
+  return true;
+}
+
+}  // namespace
+
+std::uint64_t Histogram::highest(std::size_t i) {
+  if (i < 2 * kSubBuckets) return i;
+  auto shift = i / kSubBuckets - 1;
+  std::uint64_t top = i % kSubBuckets + kSubBuckets;
+  // Wraps to the maximum for the last bucket.
+  return ((top + 1) << shift) - 1;
+}
+
+void HistogramSnapshot::merge(const Histogram& h) {
+  for (std::size_t i = 0; i < counts.size(); ++i) {
+    auto n = h.count(i);
+    counts[i] += n;
+    total += n;
+  }
+  sum += h.sum();
+}
+
+std::uint64_t HistogramSnapshot::quantile(double q) const {
+  if (total == 0) return 0;
+  auto rank = std::max<std::uint64_t>(1, static_cast<std::uint64_t>(std::ceil(q * static_cast<double>(total))));
+  std::uint64_t seen = 0;
+  for (std::size_t i = 0; i < counts.size(); ++i) {
+    seen += counts[i];
+    if (seen >= rank) return Histogram::highest(i);
+  }
+  // Buckets read after `total` was summed can only have grown.
+  return Histogram::highest(counts.size() - 1);
+}
+
+WorkerMetrics& Metrics::add_worker() {
+  std::lock_guard lock(mu_);
+  workers_.push_back(std::make_unique<WorkerMetrics>());
+  return *workers_.back();
+}
+
+std::string Metrics::render() const {
+  std::lock_guard lock(mu_);
+  std::uint64_t requests = 0, not_modified = 0, cache_hits = 0, client_errors = 0;
+  HistogramSnapshot latency, response_bytes;
+  for (const auto& w : workers_) {
+    requests += w->requests.value();
+    not_modified += w->not_modified.value();
+    cache_hits += w->cache_hits.value();
+    client_errors += w->client_errors.value();
+    latency.merge(w->latency);
+    response_bytes.merge(w->response_bytes);
+  }
+
+  std::string out;
+  append_counter(out, "mtserve_requests_total", "Requests answered.", requests);
+  append_header(out, "mtserve_worker_requests_total", "counter", "Requests answered, by worker.");
+  for (std::size_t i = 0; i < workers_.size(); ++i) {
+    out.append("mtserve_worker_requests_total{worker=\"").append(std::to_string(i)).append("\"} ");
+    out.append(std::to_string(workers_[i]->requests.value())).append("\n");
+  }
+  append_counter(out, "mtserve_not_modified_total", "Requests answered 304 Not Modified.", not_modified);
+  append_counter(out, "mtserve_response_cache_hits_total",
+                 "Responses sent from the build's pre-serialized response heads.", cache_hits);
+  append_counter(out, "mtserve_client_errors_total", "Requests answered with a 4xx status.", client_errors);
+  append_counter(out, "mtserve_sent_bytes_total", "Bytes of responses sent in full.", response_bytes.sum);
+  append_summary(out, "mtserve_request_duration_seconds",
+                 "Time from the worker waking to read a request to its response's last byte being sent.", latency,
+                 1e-9);
+  append_summary(out, "mtserve_response_size_bytes", "Response sizes, head and body.", response_bytes, 1);
+  return out;
+}
+
+MetricsServer::MetricsServer(const Metrics& metrics, const std::string& host, std::uint16_t port)
+    : metrics_(metrics) {
+  listen_fd_ = ::socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (listen_fd_ < 0) throw sys_error("socket");
+  int one = 1;
+  ::setsockopt(listen_fd_, SOL_SOCKET, SO_REUSEADDR, &one, sizeof one);
+  sockaddr_in addr{};
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  if (::inet_pton(AF_INET, host.c_str(), &addr.sin_addr) != 1 ||
+      ::bind(listen_fd_, reinterpret_cast<sockaddr*>(&addr), sizeof addr) != 0 || ::listen(listen_fd_, 16) != 0) {
+    auto error = sys_error("metrics listener");
+    ::close(listen_fd_);
+    throw error;
+  }
+  wake_fd_ = ::eventfd(0, EFD_CLOEXEC);
+  if (wake_fd_ < 0) {
+    auto error = sys_error("eventfd");
+    ::close(listen_fd_);
+    throw error;
+  }
+  thread_ = std::thread([this] { run(); });
+}
+
+MetricsServer::~MetricsServer() {
+  std::uint64_t one = 1;
+  [[maybe_unused]] auto n = ::write(wake_fd_, &one, sizeof one);
+  thread_.join();
+  ::close(listen_fd_);
+  ::close(wake_fd_);
+}
+
+void MetricsServer::run() {
+  for (;;) {
+    pollfd fds[2] = {{listen_fd_, POLLIN, 0}, {wake_fd_, POLLIN, 0}};
+    if (::poll(fds, 2, -1) < 0) {
+      if (errno == EINTR) continue;
+      return;
+    }
+    if (fds[1].revents != 0) return;
+    int fd = ::accept4(listen_fd_, nullptr, nullptr, SOCK_CLOEXEC);
+    if (fd < 0) continue;
+    ::setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &kSocketTimeout, sizeof kSocketTimeout);
+    ::setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &kSocketTimeout, sizeof kSocketTimeout);
+    serve(fd);
+    ::close(fd);
+  }
+}
+
+// Answers one request on `fd`, then lets the caller close it.
+void MetricsServer::serve(int fd) {
+  std::array<char, kRequestLimit> in;
+  std::size_t len = 0;
+  http::Request req;
+  std::size_t consumed = 0;
+  auto status = http::ParseStatus::incomplete;
+  while (status == http::ParseStatus::incomplete && len < in.size()) {
+    auto n = ::recv(fd, in.data() + len, in.size() - len, 0);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) return;
+    len += static_cast<std::size_t>(n);
+    status = http::parse_request(std::span<char>(in.data(), len), req, consumed);
+  }
+
+  std::string body;
+  std::string_view head;
+  if (status != http::ParseStatus::complete) {
+    head = "HTTP/1.1 400 Bad Request\r\nContent-Type: text/plain; charset=utf-8\r\n";
+    body = "Bad Request\n";
+  } else if (req.path != kMetricsPath) {
+    head = "HTTP/1.1 404 Not Found\r\nContent-Type: text/plain; charset=utf-8\r\n";
+    body = "Not Found\n";
+  } else if (req.method == http::Method::other) {
+    head = "HTTP/1.1 405 Method Not Allowed\r\nAllow: GET, HEAD\r\nContent-Type: text/plain; charset=utf-8\r\n";
+    body = "Method Not Allowed\n";
+  } else {
+    head = "HTTP/1.1 200 OK\r\nContent-Type: text/plain; version=0.0.4; charset=utf-8\r\nCache-Control: no-store\r\n";
+    body = metrics_.render();
+  }
+  std::string out(head);
+  out.append("Server: mtserve\r\nConnection: close\r\nContent-Length: ")
+      .append(std::to_string(body.size()))
+      .append("\r\n\r\n");
+  if (req.method != http::Method::head) out += body;
+  send_all(fd, out);
+}
+
+}  // namespace mt
@@ -0,0 +1,115 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace mt {
+
+// A counter with a single writer. Adding is a relaxed load and store, not
+// a locked read-modify-write; readers on other threads see some recent
+// value.
+class Counter {
+ public:
+  void add(std::uint64_t n) { value_.store(value_.load(std::memory_order_relaxed) + n, std::memory_order_relaxed); }
+  std::uint64_t value() const { return value_.load(std::memory_order_relaxed); }
+
+ private:
+  std::atomic<std::uint64_t> value_{0};
+};
+
+// An HDR histogram of unsigned values with a single writer: exact below
+// 32, then 16 buckets per power of two, so a value is known to within
+// 1/16 of itself. Recording one is two Counter adds.
+class Histogram {
+ public:
+  static constexpr std::size_t kSubBuckets = 16;
+  static constexpr std::size_t kBuckets = 61 * kSubBuckets;
+
+  void record(std::uint64_t value) {
+    counts_[bucket(value)].add(1);
+    sum_.add(value);
+  }
+
+  static std::size_t bucket(std::uint64_t value) {
+    if (value < 2 * kSubBuckets) return static_cast<std::size_t>(value);
+    auto shift = static_cast<std::size_t>(std::bit_width(value)) - 5;
+    return (shift + 1) * kSubBuckets + static_cast<std::size_t>(value >> shift) - kSubBuckets;
+  }
+  // The largest value bucket `i` holds.
+  static std::uint64_t highest(std::size_t i);
+
+  std::uint64_t count(std::size_t i) const { return counts_[i].value(); }
+  std::uint64_t sum() const { return sum_.value(); }
+
+ private:
+  std::array<Counter, kBuckets> counts_;
+  Counter sum_;
+};
+
+// Histograms merged from several writers, as of one scrape.
+struct HistogramSnapshot {
+  std::array<std::uint64_t, Histogram::kBuckets> counts{};
+  std::uint64_t total = 0;
+  std::uint64_t sum = 0;
+
+  void merge(const Histogram& h);
+  // The value at quantile `q` in [0, 1], rounded up to the top of its
+  // bucket. 0 when empty.
+  std::uint64_t quantile(double q) const;
+};
+
+// What one worker records. Only that worker writes it.
+struct alignas(64) WorkerMetrics {
+  Counter requests;
+  Counter not_modified;   // 304s
+  Counter cache_hits;     // responses sent from a pre-serialized head
+  Counter client_errors;  // 4xx
+  // Both recorded once a response has been sent in full: nanoseconds since
+  // the wakeup that read its request, and its size, head included.
+  Histogram latency;
+  Histogram response_bytes;
+};
+
+// Per-worker metrics for mtserve, merged only when scraped.
+class Metrics {
+ public:
+  // A new, zeroed set for one worker, owned by this object.
+  WorkerMetrics& add_worker();
+
+  // Every metric in the Prometheus text exposition format.
+  std::string render() const;
+
+ private:
+  mutable std::mutex mu_;  // guards workers_; never taken by workers
+  std::vector<std::unique_ptr<WorkerMetrics>> workers_;
+};
+
+// Serves GET /metrics from `metrics` on its own port and thread, one
+// connection at a time, so scrapes never touch a worker's loop.
+class MetricsServer {
+ public:
+  // Binds host:port and starts the thread. Throws std::runtime_error.
+  MetricsServer(const Metrics& metrics, const std::string& host, std::uint16_t port);
+  ~MetricsServer();
+  MetricsServer(const MetricsServer&) = delete;
+  MetricsServer& operator=(const MetricsServer&) = delete;
+
+ private:
+  void run();
+  void serve(int fd);
+
+  const Metrics& metrics_;
+  int listen_fd_ = -1;
+  int wake_fd_ = -1;
+  std::thread thread_;
+};
+
+}  // namespace mt
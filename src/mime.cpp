@@ -0,0 +1,51 @@
+#include "mime.h"
+
+#include <array>
+#include <utility>
+
+namespace mt {
+
+namespace {
+
+constexpr std::array<std::pair<std::string_view, std::string_view>, 24> kTypes{{
+    {"html", "text/html; charset=utf-8"},
+    {"htm", "text/html; charset=utf-8"},
+    {"css", "text/css; charset=utf-8"},
+    {"js", "text/javascript; charset=utf-8"},
+    {"mjs", "text/javascript; charset=utf-8"},
+    {"json", "application/json"},
+    {"txt", "text/plain; charset=utf-8"},
+    {"md", "text/markdown; charset=utf-8"},
+    {"xml", "application/xml"},
+    {"svg", "image/svg+xml"},
+    {"png", "image/png"},
+    {"jpg", "image/jpeg"},
+    {"jpeg", "image/jpeg"},
+    {"gif", "image/gif"},
+    {"webp", "image/webp"},
+    {"avif", "image/avif"},
+    {"ico", "image/x-icon"},
+    {"woff", "font/woff"},
+    {"woff2", "font/woff2"},
+    {"wasm", "application/wasm"},
+    {"pdf", "application/pdf"},
+    {"webmanifest", "application/manifest+json"},
+    {"dict", "application/octet-stream"},  // shared compression dictionaries
+    {"fst", "application/octet-stream"},   // client search indexes
+}};
+
+}  // namespace
+
+std::string_view content_type_for(std::string_view filename) {
+  auto slash = filename.rfind('/');
+  if (slash != std::string_view::npos) filename.remove_prefix(slash + 1);
+  auto dot = filename.rfind('.');
+  if (dot == std::string_view::npos || dot == 0) return "text/plain; charset=utf-8";
+  auto ext = filename.substr(dot + 1);
+  for (const auto& [e, type] : kTypes) {
+    if (e == ext) return type;
+  }
+  return {};
+}
+
+}  // namespace mt
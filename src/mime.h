@@ -0,0 +1,12 @@
+#pragma once
+
+#include <string_view>
+
+namespace mt {
+
+// Returns the Content-Type for a file name, or an empty view when the
+// extension is not one the site serves. Files without an extension (LICENSE)
+// are served as plain text.
+std::string_view content_type_for(std::string_view filename);
+
+}  // namespace mt
@@ -0,0 +1,101 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <stdexcept>
+#include <string_view>
+
+namespace mt {
+
+// FNV-1a over the key; cheap enough for URL paths and usable in constant
+// expressions.
+constexpr std::uint64_t fnv1a(std::string_view s) {
+  std::uint64_t h = 0xcbf29ce484222325ull;
+  for (char c : s) {
+    h ^= static_cast<unsigned char>(c);
+    h *= 0x100000001b3ull;
+  }
+  return h;
+}
+
+// splitmix64 finalizer, used to derive a slot from a key hash and a
+// per-bucket displacement.
+constexpr std::uint64_t mix64(std::uint64_t x) {
+  x ^= x >> 30;
+  x *= 0xbf58476d1ce4e5b9ull;
+  x ^= x >> 27;
+  x *= 0x94d049bb133111ebull;
+  return x ^ (x >> 31);
+}
+
+// Minimal-probe perfect hash over N string keys, built entirely at compile
+// time with hash-and-displace: keys are grouped into buckets by the high hash
+// bits, and each bucket, largest first, gets the smallest displacement that
+// sends all of its keys to free slots. A lookup is one hash of the key, one
+// bucket read, one slot read and one string compare.
+template <std::size_t N>
+class PerfectHash {
+ public:
+  static constexpr std::size_t kBuckets = N / 4 + 1;
+  static constexpr std::size_t kSlots = std::bit_ceil(N + N / 4 + 1);
+
+  static consteval PerfectHash build(std::span<const std::string_view, N> keys) {
+    PerfectHash ph;
+    std::array<std::uint64_t, N> hashes{};
+    std::array<std::size_t, kBuckets> sizes{};
+    std::array<std::size_t, N> order{};
+    for (std::size_t i = 0; i < N; ++i) {
+      hashes[i] = fnv1a(keys[i]);
+      ++sizes[bucket_of(hashes[i])];
+      order[i] = i;
+    }
+    std::sort(order.begin(), order.end(), [&](std::size_t a, std::size_t b) {
+      auto ba = bucket_of(hashes[a]), bb = bucket_of(hashes[b]);
+      return sizes[ba] != sizes[bb] ? sizes[ba] > sizes[bb] : ba < bb;
+    });
+
+    for (std::size_t begin = 0; begin < N;) {
+      auto bucket = bucket_of(hashes[order[begin]]);
+      auto end = begin + sizes[bucket];
+      for (std::uint32_t d = 0;; ++d) {
+        if (d == 1u << 20) throw std::logic_error("perfect hash: duplicate keys");
+        bool ok = true;
+        for (auto i = begin; ok && i < end; ++i) {
+          auto slot = slot_of(hashes[order[i]], d);
+          if (ph.slots_[slot] != 0) ok = false;
+          for (auto j = begin; ok && j < i; ++j) ok = slot != slot_of(hashes[order[j]], d);
+        }
+        if (!ok) continue;
+        ph.disp_[bucket] = d;
+        for (auto i = begin; i < end; ++i) {
+          ph.slots_[slot_of(hashes[order[i]], d)] = static_cast<std::uint32_t>(order[i] + 1);
+        }
+        break;
+      }
+      begin = end;
+    }
+    return ph;
+  }
+
+  // Returns the index of `key` in the array the table was built from, or -1.
+  constexpr int find(std::string_view key, std::span<const std::string_view, N> keys) const {
+    auto h = fnv1a(key);
+    auto i = slots_[slot_of(h, disp_[bucket_of(h)])];
+    return (i != 0 && keys[i - 1] == key) ? static_cast<int>(i - 1) : -1;
+  }
+
+ private:
+  static constexpr std::size_t bucket_of(std::uint64_t h) { return (h >> 32) % kBuckets; }
+  static constexpr std::size_t slot_of(std::uint64_t h, std::uint32_t d) {
+    return mix64(h + d * 0x9e3779b97f4a7c15ull) & (kSlots - 1);
+  }
+
+  std::array<std::uint32_t, kBuckets> disp_{};
+  std::array<std::uint32_t, kSlots> slots_{};
+};
+
+}  // namespace mt
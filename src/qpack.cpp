@@ -0,0 +1,199 @@
+#include "qpack.h"
+
+namespace mt::qpack {
+
+namespace {
+
+struct StaticEntry {
+  std::string_view name;
+  std::string_view value;
+};
+
+// RFC 9204 Appendix A. Unlike HPACK's, it is indexed from 0.
+constexpr StaticEntry kStaticTable[] = {
+    {":authority", ""},
+    {":path", "/"},
+    {"age", "0"},
+    {"content-disposition", ""},
+    {"content-length", "0"},
+    {"cookie", ""},
+    {"date", ""},
+    {"etag", ""},
+    {"if-modified-since", ""},
+    {"if-none-match", ""},
+    {"last-modified", ""},
+    {"link", ""},
+    {"location", ""},
+    {"referer", ""},
+    {"set-cookie", ""},
+    {":method", "CONNECT"},
+    {":method", "DELETE"},
+    {":method", "GET"},
+    {":method", "HEAD"},
+    {":method", "OPTIONS"},
+    {":method", "POST"},
+    {":method", "PUT"},
+    {":scheme", "http"},
+    {":scheme", "https"},
+    {":status", "103"},
+    {":status", "200"},
+    {":status", "304"},
+    {":status", "404"},
+    {":status", "503"},
+    {"accept", "*/*"},
+    {"accept", "application/dns-message"},
+    {"accept-encoding", "gzip, deflate, br"},
+    {"accept-ranges", "bytes"},
+    {"access-control-allow-headers", "cache-control"},
+    {"access-control-allow-headers", "content-type"},
+    {"access-control-allow-origin", "*"},
+    {"cache-control", "max-age=0"},
+    {"cache-control", "max-age=2592000"},
+    {"cache-control", "max-age=604800"},
+    {"cache-control", "no-cache"},
+    {"cache-control", "no-store"},
+    {"cache-control", "public, max-age=31536000"},
+    {"content-encoding", "br"},
+    {"content-encoding", "gzip"},
+    {"content-type", "application/dns-message"},
+    {"content-type", "application/javascript"},
+    {"content-type", "application/json"},
+    {"content-type", "application/x-www-form-urlencoded"},
+    {"content-type", "image/gif"},
+    {"content-type", "image/jpeg"},
+    {"content-type", "image/png"},
+    {"content-type", "text/css"},
+    {"content-type", "text/html; charset=utf-8"},
+    {"content-type", "text/plain"},
+    {"content-type", "text/plain;charset=utf-8"},
+    {"range", "bytes=0-"},
+    {"strict-transport-security", "max-age=31536000"},
+    {"strict-transport-security", "max-age=31536000; includesubdomains"},
+    {"strict-transport-security", "max-age=31536000; includesubdomains; preload"},
+    {"vary", "accept-encoding"},
+    {"vary", "origin"},
+    {"x-content-type-options", "nosniff"},
+    {"x-xss-protection", "1; mode=block"},
+    {":status", "100"},
+    {":status", "204"},
+    {":status", "206"},
+    {":status", "302"},
+    {":status", "400"},
+    {":status", "403"},
+    {":status", "421"},
+    {":status", "425"},
+    {":status", "500"},
+    {"accept-language", ""},
+    {"access-control-allow-credentials", "FALSE"},
+    {"access-control-allow-credentials", "TRUE"},
+    {"access-control-allow-headers", "*"},
+    {"access-control-allow-methods", "get"},
+    {"access-control-allow-methods", "get, post, options"},
+    {"access-control-allow-methods", "options"},
+    {"access-control-expose-headers", "content-length"},
+    {"access-control-request-headers", "content-type"},
+    {"access-control-request-method", "get"},
+    {"access-control-request-method", "post"},
+    {"alt-svc", "clear"},
+    {"authorization", ""},
+    {"content-security-policy", "script-src 'none'; object-src 'none'; base-uri 'none'"},
+    {"early-data", "1"},
+    {"expect-ct", ""},
+    {"forwarded", ""},
+    {"if-range", ""},
+    {"origin", ""},
+    {"purpose", "prefetch"},
+    {"server", ""},
+    {"timing-allow-origin", "*"},
+    {"upgrade-insecure-requests", "1"},
+    {"user-agent", ""},
+    {"x-forwarded-for", ""},
+    {"x-frame-options", "deny"},
+    {"x-frame-options", "sameorigin"},
+};
+constexpr std::size_t kStaticSize = std::size(kStaticTable);
+static_assert(kStaticSize == 99);
+
+}  // namespace
+
+void begin_section(std::string& out) { out.append(2, '\0'); }
+
+void encode_field(std::string& out, std::string_view name, std::string_view value) {
+  constexpr std::size_t kNone = kStaticSize;
+  std::size_t name_index = kNone;
+  for (std::size_t i = 0; i < kStaticSize; ++i) {
+    if (kStaticTable[i].name != name) continue;
+    // Indexed field line, static (0b11xxxxxx).
+    if (kStaticTable[i].value == value) return hpack::encode_integer(out, 0xc0, 6, i);
+    if (name_index == kNone) name_index = i;
+  }
+  if (name_index != kNone) {
+    // Literal with a static name reference, which intermediaries may index
+    // (0b0101xxxx).
+    hpack::encode_integer(out, 0x50, 4, name_index);
+  } else {
+    // Literal with a literal name (0b0010Hxxx).
+    hpack::encode_string(out, name, 0x20, 3);
+  }
+  hpack::encode_string(out, value);
+}
+
+void encode_status(std::string& out, int status) {
+  char digits[3] = {static_cast<char>('0' + status / 100 % 10), static_cast<char>('0' + status / 10 % 10),
+                    static_cast<char>('0' + status % 10)};
+  encode_field(out, ":status", std::string_view(digits, 3));
+}
+
+void encode_header_lines(std::string& out, std::string_view lines) {
+  hpack::for_each_header_line(lines,
+                              [&](std::string_view name, std::string_view value) { encode_field(out, name, value); });
+}
+
+bool Decoder::decode(std::string_view section, std::vector<hpack::Field>& fields) {
+  text_.clear();
+  spans_.clear();
+  fields.clear();
+  const char* p = section.data();
+  const char* end = p + section.size();
+
+  // The prefix: a Required Insert Count other than 0 needs a dynamic table.
+  std::uint64_t value = 0;
+  if (!hpack::decode_integer(p, end, 8, value) || value != 0) return false;
+  if (!hpack::decode_integer(p, end, 7, value)) return false;
+
+  std::size_t list_size = 0;
+  while (p < end) {
+    auto b = static_cast<unsigned char>(*p);
+    Span span{text_.size(), 0, 0};
+    std::uint64_t index = 0;
+    if (b & 0x80) {  // indexed field line
+      if ((b & 0x40) == 0 || !hpack::decode_integer(p, end, 6, index) || index >= kStaticSize) return false;
+      text_ += kStaticTable[index].name;
+      span.name_size = text_.size() - span.offset;
+      text_ += kStaticTable[index].value;
+    } else if (b & 0x40) {  // literal with a name reference
+      if ((b & 0x10) == 0 || !hpack::decode_integer(p, end, 4, index) || index >= kStaticSize) return false;
+      text_ += kStaticTable[index].name;
+      span.name_size = text_.size() - span.offset;
+      if (!hpack::decode_string(p, end, 7, text_)) return false;
+    } else if (b & 0x20) {  // literal with a literal name
+      if (!hpack::decode_string(p, end, 3, text_)) return false;
+      span.name_size = text_.size() - span.offset;
+      if (!hpack::decode_string(p, end, 7, text_)) return false;
+    } else {
+      return false;  // post-base forms, which only refer to a dynamic table
+    }
+    span.value_size = text_.size() - span.offset - span.name_size;
+    spans_.push_back(span);
+    list_size += span.name_size + span.value_size + 32;
+    if (list_size > max_list_size_) return false;
+  }
+
+  std::string_view text = text_;
+  for (const auto& s : spans_) {
+    fields.push_back({text.substr(s.offset, s.name_size), text.substr(s.offset + s.name_size, s.value_size)});
+  }
+  return true;
+}
+
+}  // namespace mt::qpack
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "hpack.h"
+
+// QPACK (RFC 9204), the header compression of HTTP/3, restricted to its
+// static table. We advertise a dynamic table capacity of 0, so a peer's
+// field sections never refer to one, and ours never do either: like the
+// HPACK encoder, every section is stateless and can be encoded once.
+namespace mt::qpack {
+
+// Appends the section prefix, which must come first: Required Insert Count
+// 0 and Base 0.
+void begin_section(std::string& out);
+
+// Appends `value` as a field of `name`, which must be lowercase.
+void encode_field(std::string& out, std::string_view name, std::string_view value);
+
+// Appends a :status field, a single byte for the statuses the static table
+// holds.
+void encode_status(std::string& out, int status);
+
+// Appends every "Name: value\r\n" line of `lines` as a field, as
+// hpack::encode_header_lines() does.
+void encode_header_lines(std::string& out, std::string_view lines);
+
+// Decodes field sections.
+class Decoder {
+ public:
+  // `max_list_size` bounds the decoded fields of one section, counted as
+  // SETTINGS_MAX_FIELD_SECTION_SIZE counts them.
+  explicit Decoder(std::size_t max_list_size = 16384) : max_list_size_(max_list_size) {}
+
+  // Decodes a complete field section into `fields`, whose views are valid
+  // until the next decode(). Returns false on a malformed section, one
+  // over the list size or one that refers to a dynamic table.
+  bool decode(std::string_view section, std::vector<hpack::Field>& fields);
+
+ private:
+  struct Span {
+    std::size_t offset;
+    std::size_t name_size;
+    std::size_t value_size;
+  };
+
+  std::size_t max_list_size_;
+  std::string text_;
+  std::vector<Span> spans_;
+};
+
+}  // namespace mt::qpack
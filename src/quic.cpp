@@ -0,0 +1,1827 @@
+#include "quic.h"
+
+#include <openssl/evp.h>
+#include <openssl/rand.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+namespace mt::quic {
+
+namespace {
+
+using tls13::hkdf_expand_label;
+
+// RFC 9001 section 5.2.
+constexpr std::uint8_t kInitialSalt[] = {0x38, 0x76, 0x2c, 0xf7, 0xf5, 0x59, 0x34, 0xb3, 0x4d, 0x17,
+                                         0x9a, 0xe6, 0xa4, 0xc8, 0x0c, 0xad, 0xcc, 0xbb, 0x7f, 0x0a};
+
+// Long header packet types.
+constexpr std::uint8_t kInitial = 0;
+constexpr std::uint8_t kHandshake = 2;
+
+// Frame types.
+constexpr std::uint8_t kPadding = 0x00;
+constexpr std::uint8_t kPing = 0x01;
+constexpr std::uint8_t kAck = 0x02;
+constexpr std::uint8_t kAckEcn = 0x03;
+constexpr std::uint8_t kResetStream = 0x04;
+constexpr std::uint8_t kStopSending = 0x05;
+constexpr std::uint8_t kCrypto = 0x06;
+constexpr std::uint8_t kNewToken = 0x07;
+constexpr std::uint8_t kStream = 0x08;  // to 0x0f: OFF, LEN and FIN bits
+constexpr std::uint8_t kMaxData = 0x10;
+constexpr std::uint8_t kMaxStreamData = 0x11;
+constexpr std::uint8_t kMaxStreamsBidi = 0x12;
+constexpr std::uint8_t kMaxStreamsUni = 0x13;
+constexpr std::uint8_t kDataBlocked = 0x14;
+constexpr std::uint8_t kStreamDataBlocked = 0x15;
+constexpr std::uint8_t kStreamsBlockedBidi = 0x16;
+constexpr std::uint8_t kStreamsBlockedUni = 0x17;
+constexpr std::uint8_t kNewConnectionId = 0x18;
+constexpr std::uint8_t kRetireConnectionId = 0x19;
+constexpr std::uint8_t kPathChallenge = 0x1a;
+constexpr std::uint8_t kPathResponse = 0x1b;
+constexpr std::uint8_t kConnectionClose = 0x1c;
+constexpr std::uint8_t kConnectionCloseApp = 0x1d;
+constexpr std::uint8_t kHandshakeDone = 0x1e;
+
+// Transport parameters.
+constexpr std::uint64_t kOriginalDestinationConnectionId = 0x00;
+constexpr std::uint64_t kMaxIdleTimeout = 0x01;
+constexpr std::uint64_t kStatelessResetToken = 0x02;
+constexpr std::uint64_t kMaxUdpPayloadSize = 0x03;
+constexpr std::uint64_t kInitialMaxData = 0x04;
+constexpr std::uint64_t kInitialMaxStreamDataBidiLocal = 0x05;
+constexpr std::uint64_t kInitialMaxStreamDataBidiRemote = 0x06;
+constexpr std::uint64_t kInitialMaxStreamDataUni = 0x07;
+constexpr std::uint64_t kInitialMaxStreamsBidi = 0x08;
+constexpr std::uint64_t kInitialMaxStreamsUni = 0x09;
+constexpr std::uint64_t kAckDelayExponent = 0x0a;
+constexpr std::uint64_t kMaxAckDelay = 0x0b;
+constexpr std::uint64_t kDisableActiveMigration = 0x0c;
+constexpr std::uint64_t kPreferredAddress = 0x0d;
+constexpr std::uint64_t kActiveConnectionIdLimit = 0x0e;
+constexpr std::uint64_t kInitialSourceConnectionId = 0x0f;
+constexpr std::uint64_t kRetrySourceConnectionId = 0x10;
+
+constexpr std::uint64_t kMaxStreams = std::uint64_t{1} << 60;
+
+// Recovery (RFC 9002), in ns.
+constexpr std::uint64_t kPacketThreshold = 3;
+constexpr std::uint64_t kGranularity = 1000000;
+constexpr std::uint64_t kAckDelay = 25000000;  // our max_ack_delay, the default
+constexpr std::uint64_t kAckDelayShift = 3;     // our ack_delay_exponent, the default
+
+// The most ACK ranges we track and send.
+constexpr std::size_t kAckRanges = 32;
+// How much out-of-order CRYPTO data we hold.
+constexpr std::uint64_t kCryptoBuffer = 1 << 16;
+// How much of a file a stream reads at a time.
+constexpr std::size_t kFileWindow = 1 << 16;
+// RESET_STREAM code for a stream we cannot go on sending: H3_INTERNAL_ERROR,
+// HTTP/3 being the only application.
+constexpr std::uint64_t kStreamInternalError = 0x102;
+
+std::uint64_t read_number(const std::uint8_t* p, std::size_t n) {
+  std::uint64_t v = 0;
+  for (std::size_t i = 0; i < n; ++i) v = v << 8 | p[i];
+  return v;
+}
+
+std::string random_bytes(std::size_t n) {
+  std::string out(n, '\0');
+  RAND_bytes(reinterpret_cast<unsigned char*>(out.data()), static_cast<int>(n));
+  return out;
+}
+
+// The full packet number closest to the one expected (RFC 9000 A.3).
+std::uint64_t decode_packet_number(std::uint64_t largest, std::uint64_t truncated, std::size_t bytes) {
+  std::uint64_t expected = largest == UINT64_MAX ? 0 : largest + 1;
+  std::uint64_t window = std::uint64_t{1} << (8 * bytes);
+  std::uint64_t candidate = (expected & ~(window - 1)) | truncated;
+  if (candidate + window / 2 <= expected && candidate < (std::uint64_t{1} << 62) - window) return candidate + window;
+  if (candidate > expected + window / 2 && candidate >= window) return candidate - window;
+  return candidate;
+}
+
+void put_parameter(std::string& out, std::uint64_t id, std::uint64_t value) {
+  put_varint(out, id);
+  put_varint(out, varint_size(value));
+  put_varint(out, value);
+}
+
+void put_parameter_bytes(std::string& out, std::uint64_t id, std::string_view value) {
+  put_varint(out, id);
+  put_varint(out, value.size());
+  out += value;
+}
+
+// A 2-byte varint, for lengths patched in or sized before they are known.
+std::uint8_t* put_varint2(std::uint8_t* p, std::uint64_t v) {
+  p[0] = static_cast<std::uint8_t>(0x40 | v >> 8);
+  p[1] = static_cast<std::uint8_t>(v);
+  return p + 2;
+}
+
+}  // namespace
+
+std::size_t varint_size(std::uint64_t v) {
+  if (v < 64) return 1;
+  if (v < 16384) return 2;
+  if (v < (std::uint64_t{1} << 30)) return 4;
+  return 8;
+}
+
+std::uint8_t* put_varint(std::uint8_t* p, std::uint64_t v) {
+  std::size_t n = varint_size(v);
+  static constexpr std::uint8_t kPrefix[] = {0, 0x00, 0x40, 0, 0x80, 0, 0, 0, 0xc0};
+  for (std::size_t i = n; i-- > 0;) p[n - 1 - i] = static_cast<std::uint8_t>(v >> (8 * i));
+  p[0] |= kPrefix[n];
+  return p + n;
+}
+
+void put_varint(std::string& out, std::uint64_t v) {
+  std::uint8_t buf[8];
+  out.append(reinterpret_cast<const char*>(buf), put_varint(buf, v) - buf);
+}
+
+bool get_varint(const std::uint8_t*& p, const std::uint8_t* end, std::uint64_t& v) {
+  if (p == end) return false;
+  std::size_t n = std::size_t{1} << (*p >> 6);
+  if (static_cast<std::size_t>(end - p) < n) return false;
+  v = *p++ & 0x3f;
+  for (std::size_t i = 1; i < n; ++i) v = v << 8 | *p++;
+  return true;
+}
+
+bool parse_header(std::span<const std::uint8_t> datagram, std::size_t short_cid_size, Header& h) {
+  const std::uint8_t* p = datagram.data();
+  const std::uint8_t* end = p + datagram.size();
+  if (p == end) return false;
+  std::uint8_t first = *p++;
+  h = {};
+  h.long_header = first & 0x80;
+  auto view = [](const std::uint8_t* at, std::size_t n) {
+    return std::string_view(reinterpret_cast<const char*>(at), n);
+  };
+  if (!h.long_header) {
+    if (static_cast<std::size_t>(end - p) < short_cid_size) return false;
+    h.dcid = view(p, short_cid_size);
+    return true;
+  }
+  if (end - p < 5) return false;
+  h.version = static_cast<std::uint32_t>(read_number(p, 4));
+  h.type = (first >> 4) & 3;
+  p += 4;
+  std::size_t n = *p++;
+  if (static_cast<std::size_t>(end - p) < n + 1) return false;
+  h.dcid = view(p, n);
+  p += n;
+  n = *p++;
+  if (static_cast<std::size_t>(end - p) < n) return false;
+  h.scid = view(p, n);
+  return true;
+}
+
+std::string new_connection_id() { return random_bytes(kConnectionIdSize); }
+
+std::string version_negotiation(const Header& h) {
+  std::string out = random_bytes(1);
+  out[0] = static_cast<char>(out[0] | 0x80);
+  out.append(4, '\0');
+  out += static_cast<char>(h.scid.size());
+  out += h.scid;
+  out += static_cast<char>(h.dcid.size());
+  out += h.dcid;
+  out += std::string_view("\0\0\0\1", 4);
+  return out;
+}
+
+PacketKeys::~PacketKeys() { clear(); }
+
+void PacketKeys::clear() {
+  EVP_CIPHER_CTX_free(aead_);
+  EVP_CIPHER_CTX_free(hp_);
+  aead_ = hp_ = nullptr;
+  secret_.clear();
+}
+
+void PacketKeys::set(std::string_view secret) {
+  secret_ = secret;
+  set_keys(hkdf_expand_label(secret_, "quic key", {}, 16), hkdf_expand_label(secret_, "quic iv", {}, 12));
+  auto hp = hkdf_expand_label(secret_, "quic hp", {}, 16);
+  if (!hp_) hp_ = EVP_CIPHER_CTX_new();
+  EVP_EncryptInit_ex(hp_, EVP_aes_128_ecb(), nullptr, reinterpret_cast<const unsigned char*>(hp.data()), nullptr);
+  EVP_CIPHER_CTX_set_padding(hp_, 0);
+}
+
+void PacketKeys::update_from(const PacketKeys& current) {
+  std::string secret = hkdf_expand_label(current.secret_, "quic ku", {}, tls13::kHashSize);
+  if (this != &current) {
+    if (!hp_) hp_ = EVP_CIPHER_CTX_new();
+    EVP_CIPHER_CTX_copy(hp_, current.hp_);
+  }
+  secret_ = std::move(secret);
+  set_keys(hkdf_expand_label(secret_, "quic key", {}, 16), hkdf_expand_label(secret_, "quic iv", {}, 12));
+}
+
+void PacketKeys::set_keys(std::string_view key, std::string_view iv) {
+  if (!aead_) aead_ = EVP_CIPHER_CTX_new();
+  // The key is set once; each packet then sets only its nonce.
+  EVP_CipherInit_ex(aead_, EVP_aes_128_gcm(), nullptr, reinterpret_cast<const unsigned char*>(key.data()), nullptr,
+                    1);
+  std::memcpy(iv_.data(), iv.data(), iv_.size());
+}
+
+void PacketKeys::seal(std::uint64_t pn, std::span<const std::uint8_t> header, std::uint8_t* payload,
+                      std::size_t size) const {
+  auto nonce = iv_;
+  for (std::size_t i = 0; i < 8; ++i) nonce[11 - i] ^= static_cast<std::uint8_t>(pn >> (8 * i));
+  int n = 0;
+  EVP_EncryptInit_ex(aead_, nullptr, nullptr, nullptr, nonce.data());
+  EVP_EncryptUpdate(aead_, nullptr, &n, header.data(), static_cast<int>(header.size()));
+  EVP_EncryptUpdate(aead_, payload, &n, payload, static_cast<int>(size));
+  EVP_EncryptFinal_ex(aead_, payload + n, &n);
+  EVP_CIPHER_CTX_ctrl(aead_, EVP_CTRL_AEAD_GET_TAG, kTagSize, payload + size);
+}
+
+bool PacketKeys::open(std::uint64_t pn, std::span<const std::uint8_t> header, std::uint8_t* payload,
+                      std::size_t size) const {
+  if (size < kTagSize) return false;
+  size -= kTagSize;
+  auto nonce = iv_;
+  for (std::size_t i = 0; i < 8; ++i) nonce[11 - i] ^= static_cast<std::uint8_t>(pn >> (8 * i));
+  int n = 0;
+  EVP_DecryptInit_ex(aead_, nullptr, nullptr, nullptr, nonce.data());
+  EVP_DecryptUpdate(aead_, nullptr, &n, header.data(), static_cast<int>(header.size()));
+  EVP_DecryptUpdate(aead_, payload, &n, payload, static_cast<int>(size));
+  EVP_CIPHER_CTX_ctrl(aead_, EVP_CTRL_AEAD_SET_TAG, kTagSize, payload + size);
+  return EVP_DecryptFinal_ex(aead_, payload + n, &n) == 1;
+}
+
+void PacketKeys::mask(const std::uint8_t* sample, std::uint8_t* out) const {
+  std::uint8_t block[16];
+  int n = 0;
+  EVP_EncryptUpdate(hp_, block, &n, sample, 16);
+  std::memcpy(out, block, 5);
+}
+
+void initial_keys(std::string_view dcid, bool server, PacketKeys& read, PacketKeys& write) {
+  auto initial =
+      tls13::hkdf_extract(std::string_view(reinterpret_cast<const char*>(kInitialSalt), sizeof kInitialSalt), dcid);
+  auto client = hkdf_expand_label(initial, "client in", {}, tls13::kHashSize);
+  auto ours = hkdf_expand_label(initial, "server in", {}, tls13::kHashSize);
+  read.set(server ? client : ours);
+  write.set(server ? ours : client);
+}
+
+// RangeSet
+
+void Connection::RangeSet::add(std::uint64_t begin, std::uint64_t end) {
+  if (begin >= end) return;
+  if (ranges_.empty() || ranges_.back().second < begin) {
+    ranges_.emplace_back(begin, end);
+    return;
+  }
+  if (ranges_.back().second == begin) {  // the usual case: in order
+    ranges_.back().second = end;
+    return;
+  }
+  auto it = std::lower_bound(ranges_.begin(), ranges_.end(), begin,
+                             [](const auto& r, std::uint64_t v) { return r.second < v; });
+  auto last = it;
+  for (; last != ranges_.end() && last->first <= end; ++last) {
+    begin = std::min(begin, last->first);
+    end = std::max(end, last->second);
+  }
+  it = ranges_.erase(it, last);
+  ranges_.insert(it, {begin, end});
+}
+
+void Connection::RangeSet::remove(std::uint64_t begin, std::uint64_t end) {
+  if (begin >= end) return;
+  auto it = std::lower_bound(ranges_.begin(), ranges_.end(), begin,
+                             [](const auto& r, std::uint64_t v) { return r.second <= v; });
+  while (it != ranges_.end() && it->first < end) {
+    if (it->first < begin && it->second > end) {
+      auto right = std::pair(end, it->second);
+      it->second = begin;
+      ranges_.insert(it + 1, right);
+      return;
+    }
+    if (it->first < begin) {
+      it->second = begin;
+      ++it;
+    } else if (it->second > end) {
+      it->first = end;
+      return;
+    } else {
+      it = ranges_.erase(it);
+    }
+  }
+}
+
+bool Connection::RangeSet::contains(std::uint64_t v) const {
+  auto it = std::upper_bound(ranges_.begin(), ranges_.end(), v,
+                             [](std::uint64_t v, const auto& r) { return v < r.first; });
+  return it != ranges_.begin() && v < std::prev(it)->second;
+}
+
+void Connection::RangeSet::trim(std::size_t n) {
+  if (ranges_.size() > n) ranges_.erase(ranges_.begin(), ranges_.end() - n);
+}
+
+bool Connection::SendState::done() const {
+  if (!fin || !fin_acked) return false;
+  const auto& r = acked.ranges();
+  return written == 0 || (r.size() == 1 && r[0].first == 0 && r[0].second == written);
+}
+
+// Connection
+
+Connection::Connection(Application& app, bool server, const Limits& limits, std::uint64_t now)
+    : app_(app), server_(server), limits_(limits) {
+  max_read_ = limits.max_data;
+  max_streams_bidi_ = limits.max_streams_bidi;
+  max_streams_uni_ = limits.max_streams_uni;
+  cwnd_ = 10 * kMaxDatagramSize;
+  now_ = now;
+  idle_deadline_ = now + limits.idle_timeout_ms * 1000000;
+  next_bidi_ = server ? 1 : 0;
+  next_uni_ = server ? 3 : 2;
+  peer_next_bidi_ = server ? 0 : 1;
+  peer_next_uni_ = server ? 2 : 3;
+}
+
+Connection::Connection(Application& app, std::shared_ptr<const tls13::Credentials> credentials, const Header& h,
+                       std::string cid, std::string alpn, const Limits& limits, std::uint64_t now)
+    : Connection(app, true, limits, now) {
+  scid_ = std::move(cid);
+  dcid_ = h.scid;
+  odcid_ = h.dcid;
+  initial_keys(odcid_, true, space(Level::initial).read, space(Level::initial).write);
+  tls_ = std::make_unique<tls13::Handshake>(std::move(credentials), std::vector<std::string>{std::move(alpn)},
+                                           local_parameters());
+}
+
+Connection::Connection(Application& app, std::string server_name, std::string alpn, const Limits& limits,
+                       std::uint64_t now)
+    : Connection(app, false, limits, now) {
+  scid_ = random_bytes(kConnectionIdSize);
+  odcid_ = dcid_ = random_bytes(kConnectionIdSize);
+  initial_keys(odcid_, false, space(Level::initial).read, space(Level::initial).write);
+  tls_ = std::make_unique<tls13::Handshake>(std::move(server_name), std::move(alpn), local_parameters());
+  drive_handshake();
+}
+
+Connection::~Connection() = default;
+
+std::string Connection::local_parameters() const {
+  std::string out;
+  if (server_) {
+    put_parameter_bytes(out, kOriginalDestinationConnectionId, odcid_);
+    put_parameter_bytes(out, kDisableActiveMigration, {});
+  }
+  put_parameter_bytes(out, kInitialSourceConnectionId, scid_);
+  put_parameter(out, kMaxIdleTimeout, limits_.idle_timeout_ms);
+  put_parameter(out, kMaxUdpPayloadSize, kMaxDatagramSize);
+  put_parameter(out, kInitialMaxData, limits_.max_data);
+  put_parameter(out, kInitialMaxStreamDataBidiLocal, limits_.max_stream_data);
+  put_parameter(out, kInitialMaxStreamDataBidiRemote, limits_.max_stream_data);
+  put_parameter(out, kInitialMaxStreamDataUni, limits_.max_stream_data);
+  put_parameter(out, kInitialMaxStreamsBidi, limits_.max_streams_bidi);
+  put_parameter(out, kInitialMaxStreamsUni, limits_.max_streams_uni);
+  return out;
+}
+
+bool Connection::apply_peer_parameters(std::string_view params) {
+  auto p = reinterpret_cast<const std::uint8_t*>(params.data());
+  auto end = p + params.size();
+  bool have_scid = false;
+  bool have_odcid = false;
+  while (p < end) {
+    std::uint64_t id = 0;
+    std::uint64_t size = 0;
+    if (!get_varint(p, end, id) || !get_varint(p, end, size) || size > static_cast<std::uint64_t>(end - p)) {
+      return false;
+    }
+    std::string_view value(reinterpret_cast<const char*>(p), size);
+    const std::uint8_t* v = p;
+    p += size;
+    std::uint64_t n = 0;
+    bool integer = get_varint(v, p, n) && v == p;
+    switch (id) {
+      case kOriginalDestinationConnectionId:
+        if (server_ || value != odcid_) return false;
+        have_odcid = true;
+        break;
+      case kInitialSourceConnectionId:
+        if (value != dcid_) return false;
+        have_scid = true;
+        break;
+      case kStatelessResetToken:
+        if (server_ || size != 16) return false;
+        break;
+      case kPreferredAddress:
+        if (server_) return false;
+        break;
+      case kRetrySourceConnectionId:
+        return false;  // we never send Retry
+      case kDisableActiveMigration:
+        break;
+      case kMaxIdleTimeout:
+      case kMaxUdpPayloadSize:
+      case kInitialMaxData:
+      case kInitialMaxStreamDataBidiLocal:
+      case kInitialMaxStreamDataBidiRemote:
+      case kInitialMaxStreamDataUni:
+      case kInitialMaxStreamsBidi:
+      case kInitialMaxStreamsUni:
+      case kAckDelayExponent:
+      case kMaxAckDelay:
+      case kActiveConnectionIdLimit:
+        if (!integer) return false;
+        break;
+      default:
+        continue;  // unknown parameters are ignored
+    }
+    switch (id) {
+      case kMaxIdleTimeout: peer_idle_timeout_ms_ = n; break;
+      case kMaxUdpPayloadSize:
+        if (n < kMinInitialSize) return false;
+        datagram_size_ = std::min<std::uint64_t>(n, kMaxDatagramSize);
+        break;
+      case kInitialMaxData: max_data_ = n; break;
+      case kInitialMaxStreamDataBidiLocal: peer_stream_data_bidi_local_ = n; break;
+      case kInitialMaxStreamDataBidiRemote: peer_stream_data_bidi_remote_ = n; break;
+      case kInitialMaxStreamDataUni: peer_stream_data_uni_ = n; break;
+      case kInitialMaxStreamsBidi:
+        if (n > kMaxStreams) return false;
+        peer_max_streams_bidi_ = n;
+        break;
+      case kInitialMaxStreamsUni:
+        if (n > kMaxStreams) return false;
+        peer_max_streams_uni_ = n;
+        break;
+      case kAckDelayExponent:
+        if (n > 20) return false;
+        peer_ack_delay_exponent_ = n;
+        break;
+      case kMaxAckDelay:
+        if (n >= (1 << 14)) return false;
+        peer_max_ack_delay_ms_ = n;
+        break;
+      case kActiveConnectionIdLimit:
+        if (n < 2) return false;
+        break;
+      default: break;
+    }
+  }
+  if (!have_scid || (!server_ && !have_odcid)) return false;
+  for (auto& [id, s] : streams_) s.send.max = std::max(s.send.max, initial_send_max(id));
+  return true;
+}
+
+std::uint64_t Connection::idle_timeout() const {
+  std::uint64_t ms = limits_.idle_timeout_ms;
+  if (peer_idle_timeout_ms_ && peer_idle_timeout_ms_ < ms) ms = peer_idle_timeout_ms_;
+  return ms * 1000000;
+}
+
+void Connection::set_error(std::uint64_t code, bool app) {
+  if (state_ != State::open) return;
+  error_code_ = code;
+  error_app_ = app;
+  state_ = State::closing;
+}
+
+void Connection::close(std::uint64_t app_error) { set_error(app_error, true); }
+
+// Receiving
+
+void Connection::receive(std::span<std::uint8_t> datagram, std::uint64_t now) {
+  if (state_ != State::open) return;
+  now_ = now;
+  bytes_received_ += datagram.size();
+  std::size_t offset = 0;
+  while (offset < datagram.size() && state_ == State::open) {
+    std::size_t n = receive_packet(datagram.data() + offset, datagram.size() - offset, now);
+    if (n == 0) break;
+    offset += n;
+  }
+  collect();
+}
+
+std::size_t Connection::receive_packet(std::uint8_t* p, std::size_t size, std::uint64_t now) {
+  const std::uint8_t* q = p + 1;
+  const std::uint8_t* end = p + size;
+  bool long_header = p[0] & 0x80;
+  Level level = Level::application;
+  std::string_view scid;
+  const std::uint8_t* packet_end = end;
+  if (long_header) {
+    Header h;
+    if (!parse_header({p, size}, 0, h) || h.version != kVersion) return 0;
+    scid = h.scid;
+    q = reinterpret_cast<const std::uint8_t*>(h.scid.data() + h.scid.size());
+    std::uint64_t n = 0;
+    if (h.type == kInitial) {
+      if (!get_varint(q, end, n) || n > static_cast<std::uint64_t>(end - q)) return 0;
+      q += n;  // a token, which we never issue
+    }
+    if (!get_varint(q, end, n) || n > static_cast<std::uint64_t>(end - q)) return 0;
+    packet_end = q + n;
+    if (h.type == kInitial) {
+      level = Level::initial;
+    } else if (h.type == kHandshake) {
+      level = Level::handshake;
+    } else {
+      return packet_end - p;  // 0-RTT, which we do not accept, or Retry, which servers never send us
+    }
+  } else {
+    q += scid_.size();
+  }
+  std::size_t pn_offset = q - p;
+  std::size_t packet_size = packet_end - p;
+
+  Space& sp = space(level);
+  if (sp.discarded || !sp.read.ready()) return packet_size;
+  // RFC 9001 section 5.7: no 1-RTT data before the handshake is complete.
+  if (level == Level::application && server_ && !tls_->complete()) return packet_size;
+  if (packet_size < pn_offset + 4 + PacketKeys::kTagSize) return 0;
+
+  // Remove header protection.
+  std::uint8_t mask[5];
+  sp.read.mask(p + pn_offset + 4, mask);
+  std::uint8_t first = p[0] ^ (mask[0] & (long_header ? 0x0f : 0x1f));
+  std::size_t pn_size = (first & 3) + 1;
+  std::uint8_t header[64];
+  std::size_t header_size = pn_offset + pn_size;
+  if (header_size > sizeof header) return 0;
+  std::memcpy(header, p, header_size);
+  header[0] = first;
+  for (std::size_t i = 0; i < pn_size; ++i) header[pn_offset + i] ^= mask[1 + i];
+  std::uint64_t pn = decode_packet_number(sp.largest_received, read_number(header + pn_offset, pn_size), pn_size);
+
+  // A flipped key phase bit is the peer's key update (RFC 9001 section 6).
+  const PacketKeys* keys = &sp.read;
+  bool key_update = false;
+  if (!long_header && static_cast<bool>(first & 0x04) != key_phase_) {
+    if (!next_read_.ready()) next_read_.update_from(sp.read);
+    keys = &next_read_;
+    key_update = true;
+  }
+  std::uint8_t* payload = p + header_size;
+  std::size_t payload_size = packet_size - header_size;
+  if (!keys->open(pn, {header, header_size}, payload, payload_size)) return packet_size;
+  if (key_update) {
+    sp.read.update_from(sp.read);
+    sp.write.update_from(sp.write);
+    next_read_.clear();
+    key_phase_ = !key_phase_;
+  }
+  if (first & (long_header ? 0x0c : 0x18)) {  // reserved bits
+    set_error(kProtocolViolation, false);
+    return 0;
+  }
+  ++packets_received_;
+  idle_deadline_ = now + idle_timeout();
+  if (!server_ && level == Level::initial && !dcid_confirmed_) {
+    dcid_ = scid;  // the server's choice, from now on
+    dcid_confirmed_ = true;
+  }
+  if (server_ && level == Level::handshake) {
+    // Only the client could have sent this: its address is validated and
+    // Initial packets are done with.
+    address_validated_ = true;
+    discard(Level::initial);
+  }
+  if (sp.received.contains(pn)) return packet_size;
+
+  bool ack_eliciting = false;
+  if (!on_frames(level, payload, payload + payload_size - PacketKeys::kTagSize, ack_eliciting, now)) return 0;
+  if (sp.discarded) return packet_size;  // the frames completed the handshake
+  sp.received.add(pn, pn + 1);
+  sp.received.trim(kAckRanges);
+  sp.ack_pending = true;
+  // Out of order, or after a gap: tell the peer at once, so it can
+  // recover the loss.
+  if (ack_eliciting && sp.largest_received != UINT64_MAX && pn != sp.largest_received + 1) sp.ack_now = true;
+  if (sp.largest_received == UINT64_MAX || pn > sp.largest_received) {
+    sp.largest_received = pn;
+    sp.largest_received_time = now;
+  }
+  if (ack_eliciting) {
+    // Acknowledge the handshake at once; 1-RTT packets every second one
+    // at first, then every tenth or after a quarter of the RTT, so a small
+    // congestion window is not held up for long.
+    if (level != Level::application || ++sp.unacked_eliciting >= (packets_received_ < 100 ? 2u : 10u)) {
+      sp.ack_now = true;
+    } else if (sp.ack_deadline == UINT64_MAX) {
+      sp.ack_deadline = now + std::clamp(smoothed_rtt_ / 4, kGranularity, kAckDelay);
+    }
+  }
+  return packet_size;
+}
+
+bool Connection::on_frames(Level level, const std::uint8_t* p, const std::uint8_t* end, bool& ack_eliciting,
+                           std::uint64_t now) {
+  auto fail = [&](std::uint64_t code) {
+    set_error(code, false);
+    return false;
+  };
+  auto view = [](const std::uint8_t* at, std::uint64_t n) {
+    return std::string_view(reinterpret_cast<const char*>(at), n);
+  };
+  while (p < end && state_ == State::open) {
+    std::uint64_t type = 0;
+    if (!get_varint(p, end, type)) return fail(kFrameEncodingError);
+    if (type != kPadding && type != kAck && type != kAckEcn && type != kConnectionClose &&
+        type != kConnectionCloseApp) {
+      ack_eliciting = true;
+    }
+    // Initial and Handshake packets carry only these.
+    if (level != Level::application && type != kPadding && type != kPing && type != kAck && type != kAckEcn &&
+        type != kCrypto && type != kConnectionClose) {
+      return fail(kProtocolViolation);
+    }
+    std::uint64_t a = 0;
+    std::uint64_t b = 0;
+    std::uint64_t c = 0;
+    if (type >= kStream && type <= kStream + 7) {
+      if (!get_varint(p, end, a)) return fail(kFrameEncodingError);
+      if ((type & 0x04) && !get_varint(p, end, b)) return fail(kFrameEncodingError);
+      c = end - p;
+      if ((type & 0x02) && (!get_varint(p, end, c) || c > static_cast<std::uint64_t>(end - p))) {
+        return fail(kFrameEncodingError);
+      }
+      if (b + c > kMaxVarint) return fail(kFrameEncodingError);
+      if (!on_stream(a, b, view(p, c), type & 0x01)) return false;
+      p += c;
+      continue;
+    }
+    switch (type) {
+      case kPadding:
+        while (p < end && *p == 0) ++p;
+        break;
+      case kPing:
+        break;
+      case kAck:
+      case kAckEcn:
+        if (!on_ack(level, p, end, type == kAckEcn, now)) return false;
+        break;
+      case kResetStream:
+        if (!get_varint(p, end, a) || !get_varint(p, end, b) || !get_varint(p, end, c)) {
+          return fail(kFrameEncodingError);
+        }
+        if (!on_reset_stream(a, c)) return false;
+        break;
+      case kStopSending:
+        if (!get_varint(p, end, a) || !get_varint(p, end, b)) return fail(kFrameEncodingError);
+        if (!on_stop_sending(a, b)) return false;
+        break;
+      case kCrypto:
+        if (!get_varint(p, end, a) || !get_varint(p, end, b) || b > static_cast<std::uint64_t>(end - p)) {
+          return fail(kFrameEncodingError);
+        }
+        if (!on_crypto(level, a, view(p, b))) return false;
+        p += b;
+        break;
+      case kNewToken:
+        if (server_) return fail(kProtocolViolation);
+        if (!get_varint(p, end, a) || a == 0 || a > static_cast<std::uint64_t>(end - p)) {
+          return fail(kFrameEncodingError);
+        }
+        p += a;
+        break;
+      case kMaxData:
+        if (!get_varint(p, end, a)) return fail(kFrameEncodingError);
+        max_data_ = std::max(max_data_, a);
+        break;
+      case kMaxStreamData: {
+        if (!get_varint(p, end, a) || !get_varint(p, end, b)) return fail(kFrameEncodingError);
+        std::uint64_t error = 0;
+        Stream* s = stream_for_peer(a, true, error);
+        if (error) return fail(error);
+        if (s) s->send.max = std::max(s->send.max, b);
+        break;
+      }
+      case kMaxStreamsBidi:
+      case kMaxStreamsUni:
+        if (!get_varint(p, end, a)) return fail(kFrameEncodingError);
+        if (a > kMaxStreams) return fail(kFrameEncodingError);
+        if (type == kMaxStreamsBidi) {
+          peer_max_streams_bidi_ = std::max(peer_max_streams_bidi_, a);
+        } else {
+          peer_max_streams_uni_ = std::max(peer_max_streams_uni_, a);
+        }
+        break;
+      case kDataBlocked:
+      case kStreamsBlockedBidi:
+      case kStreamsBlockedUni:
+      case kRetireConnectionId:
+        if (!get_varint(p, end, a)) return fail(kFrameEncodingError);
+        break;
+      case kStreamDataBlocked:
+        if (!get_varint(p, end, a) || !get_varint(p, end, b)) return fail(kFrameEncodingError);
+        break;
+      case kNewConnectionId:
+        // We keep to the IDs of the handshake.
+        if (!get_varint(p, end, a) || !get_varint(p, end, b) || p == end) return fail(kFrameEncodingError);
+        c = *p++;
+        if (c < 1 || c > 20 || static_cast<std::uint64_t>(end - p) < c + 16) return fail(kFrameEncodingError);
+        p += c + 16;
+        break;
+      case kPathChallenge:
+        if (end - p < 8) return fail(kFrameEncodingError);
+        path_response_.assign(reinterpret_cast<const char*>(p), 8);
+        p += 8;
+        break;
+      case kPathResponse:
+        if (end - p < 8) return fail(kFrameEncodingError);
+        p += 8;
+        break;
+      case kConnectionClose:
+      case kConnectionCloseApp:
+        // The peer is done; we go quietly (draining, RFC 9000 section 10.2.2).
+        state_ = State::closed;
+        return false;
+      case kHandshakeDone:
+        if (server_) return fail(kProtocolViolation);
+        discard(Level::handshake);  // confirmed
+        break;
+      default:
+        return fail(kFrameEncodingError);
+    }
+  }
+  return state_ == State::open;
+}
+
+bool Connection::on_ack(Level level, const std::uint8_t*& p, const std::uint8_t* end, bool ecn, std::uint64_t now) {
+  Space& sp = space(level);
+  std::uint64_t largest = 0;
+  std::uint64_t delay = 0;
+  std::uint64_t count = 0;
+  std::uint64_t range = 0;
+  auto fail = [&](std::uint64_t code) {
+    set_error(code, false);
+    return false;
+  };
+  if (!get_varint(p, end, largest) || !get_varint(p, end, delay) || !get_varint(p, end, count) ||
+      !get_varint(p, end, range) || range > largest) {
+    return fail(kFrameEncodingError);
+  }
+  if (largest >= sp.next_pn) return fail(kProtocolViolation);
+
+  bool newly_acked_eliciting = false;
+  std::uint64_t largest_sent_time = 0;
+  auto acknowledge = [&](std::uint64_t low, std::uint64_t high) {
+    if (sp.sent.empty()) return;
+    std::uint64_t base = sp.sent.front().pn;
+    for (std::uint64_t pn = std::max(low, base); pn <= high && pn - base < sp.sent.size(); ++pn) {
+      SentPacket& packet = sp.sent[pn - base];
+      if (packet.done) continue;
+      if (pn == largest) largest_sent_time = packet.time;
+      newly_acked_eliciting |= packet.ack_eliciting;
+      on_packet_acked(level, packet);
+    }
+  };
+  std::uint64_t high = largest;
+  std::uint64_t low = largest - range;
+  acknowledge(low, high);
+  for (std::uint64_t i = 0; i < count; ++i) {
+    std::uint64_t gap = 0;
+    if (!get_varint(p, end, gap) || !get_varint(p, end, range)) return fail(kFrameEncodingError);
+    if (gap + 2 > low) return fail(kFrameEncodingError);
+    high = low - gap - 2;
+    if (range > high) return fail(kFrameEncodingError);
+    low = high - range;
+    acknowledge(low, high);
+  }
+  if (ecn) {
+    for (int i = 0; i < 3; ++i) {
+      if (!get_varint(p, end, range)) return fail(kFrameEncodingError);
+    }
+  }
+  if (sp.discarded) return true;  // an acknowledged stream finished and closed things
+
+  if (sp.largest_acked == UINT64_MAX || largest > sp.largest_acked) sp.largest_acked = largest;
+  if (largest_sent_time && newly_acked_eliciting) {
+    // An RTT sample (RFC 9002 section 5).
+    std::uint64_t latest = now - largest_sent_time;
+    latest_rtt_ = latest;
+    if (!rtt_sampled_) {
+      rtt_sampled_ = true;
+      min_rtt_ = smoothed_rtt_ = latest;
+      rttvar_ = latest / 2;
+    } else {
+      min_rtt_ = std::min(min_rtt_, latest);
+      std::uint64_t ack_delay = 0;
+      if (level == Level::application) {
+        ack_delay = std::min((delay << peer_ack_delay_exponent_) * 1000, peer_max_ack_delay_ms_ * 1000000);
+      }
+      std::uint64_t adjusted = latest >= min_rtt_ + ack_delay ? latest - ack_delay : latest;
+      std::uint64_t deviation = smoothed_rtt_ > adjusted ? smoothed_rtt_ - adjusted : adjusted - smoothed_rtt_;
+      rttvar_ = (3 * rttvar_ + deviation) / 4;
+      smoothed_rtt_ = (7 * smoothed_rtt_ + adjusted) / 8;
+    }
+  }
+  pto_count_ = 0;
+  detect_lost(level, now);
+  return true;
+}
+
+bool Connection::on_crypto(Level level, std::uint64_t offset, std::string_view data) {
+  Space& sp = space(level);
+  if (sp.discarded) return true;
+  std::uint64_t end = offset + data.size();
+  if (end > sp.crypto_read + kCryptoBuffer) {
+    set_error(kCryptoBufferExceeded, false);
+    return false;
+  }
+  if (end <= sp.crypto_read) return true;
+  if (offset > sp.crypto_read) {
+    auto& slot = sp.crypto_pending[offset];
+    if (data.size() > slot.size()) slot.assign(data);
+    return true;
+  }
+  auto feed = [&](std::string_view chunk) {
+    sp.crypto_read += chunk.size();
+    if (tls_->receive(level, chunk)) return true;
+    set_error(kCryptoError + tls_->alert(), false);
+    return false;
+  };
+  if (!feed(data.substr(sp.crypto_read - offset))) return false;
+  while (!sp.crypto_pending.empty() && sp.crypto_pending.begin()->first <= sp.crypto_read) {
+    auto node = sp.crypto_pending.extract(sp.crypto_pending.begin());
+    std::uint64_t at = node.key();
+    const std::string& chunk = node.mapped();
+    if (at + chunk.size() > sp.crypto_read &&
+        !feed(std::string_view(chunk).substr(sp.crypto_read - at))) {
+      return false;
+    }
+  }
+  drive_handshake();
+  return state_ == State::open;
+}
+
+void Connection::drive_handshake() {
+  for (std::size_t i = 0; i < tls13::kLevels; ++i) {
+    auto level = static_cast<Level>(i);
+    Space& sp = spaces_[i];
+    auto& out = tls_->output(level);
+    if (!out.empty()) {
+      if (!sp.discarded) {
+        sp.crypto_out += out;
+        sp.crypto.written += out.size();
+      }
+      out.clear();
+    }
+    if (level == Level::initial || sp.discarded) continue;
+    if (!sp.read.ready() && !tls_->read_secret(level).empty()) sp.read.set(tls_->read_secret(level));
+    if (!sp.write.ready() && !tls_->write_secret(level).empty()) sp.write.set(tls_->write_secret(level));
+  }
+  if (!peer_parameters_seen_ && !tls_->peer_transport_parameters().empty()) {
+    peer_parameters_seen_ = true;
+    if (!apply_peer_parameters(tls_->peer_transport_parameters())) return set_error(kTransportParameterError, false);
+  }
+  if (tls_->complete() && !handshake_done_) {
+    handshake_done_ = true;
+    if (server_) {
+      // For the server, complete is confirmed (RFC 9001 section 4.1.2).
+      handshake_done_pending_ = true;
+      discard(Level::handshake);
+    }
+  }
+}
+
+void Connection::discard(Level level) {
+  Space& sp = space(level);
+  if (sp.discarded) return;
+  for (const auto& packet : sp.sent) {
+    if (!packet.done && packet.in_flight) bytes_in_flight_ -= packet.size;
+  }
+  sp.sent.clear();
+  sp.eliciting_in_flight = 0;
+  sp.loss_time = 0;
+  sp.probe = false;
+  sp.read.clear();
+  sp.write.clear();
+  sp.crypto = {};
+  sp.crypto_out = {};
+  sp.crypto_pending.clear();
+  sp.ack_pending = sp.ack_now = false;
+  sp.ack_deadline = UINT64_MAX;
+  sp.discarded = true;
+  pto_count_ = 0;
+}
+
+bool Connection::local(std::uint64_t id) const { return (id & 1) == (server_ ? 1 : 0); }
+
+std::uint64_t Connection::initial_send_max(std::uint64_t id) const {
+  if (id & 2) return peer_stream_data_uni_;
+  return local(id) ? peer_stream_data_bidi_remote_ : peer_stream_data_bidi_local_;
+}
+
+Connection::Stream& Connection::new_stream(std::uint64_t id) {
+  Stream& s = streams_[id];
+  s.id = id;
+  s.max_read = limits_.max_stream_data;
+  s.send.max = initial_send_max(id);
+  if (id & 2) {
+    if (local(id)) {
+      s.recv_done = true;
+    } else {
+      s.send_done = true;
+    }
+  }
+  return s;
+}
+
+Connection::Stream* Connection::stream_for_peer(std::uint64_t id, bool sending, std::uint64_t& error) {
+  bool uni = id & 2;
+  // A peer may only send on its unidirectional streams, and only we on ours.
+  if (uni && local(id) != sending) {
+    error = kStreamStateError;
+    return nullptr;
+  }
+  if (auto it = streams_.find(id); it != streams_.end()) return &it->second;
+  if (local(id)) {
+    if (id >= (uni ? next_uni_ : next_bidi_)) error = kStreamStateError;  // never opened
+    return nullptr;
+  }
+  std::uint64_t& next = uni ? peer_next_uni_ : peer_next_bidi_;
+  if (id < next) return nullptr;  // closed since
+  if (id / 4 >= (uni ? max_streams_uni_ : max_streams_bidi_)) {
+    error = kStreamLimitError;
+    return nullptr;
+  }
+  // Opening a stream opens the lower ones of its type too.
+  for (; next <= id; next += 4) new_stream(next);
+  return &streams_[id];
+}
+
+bool Connection::on_stream(std::uint64_t id, std::uint64_t offset, std::string_view data, bool fin) {
+  std::uint64_t error = 0;
+  Stream* s = stream_for_peer(id, false, error);
+  if (!s) {
+    if (error) set_error(error, false);
+    return !error;
+  }
+  std::uint64_t end = offset + data.size();
+  if ((s->fin_offset != UINT64_MAX && end > s->fin_offset) ||
+      (fin && ((s->fin_offset != UINT64_MAX && s->fin_offset != end) || end < s->highest))) {
+    set_error(kFinalSizeError, false);
+    return false;
+  }
+  if (end > s->max_read) {
+    set_error(kFlowControlError, false);
+    return false;
+  }
+  if (fin) s->fin_offset = end;
+  if (end > s->highest) {
+    read_data_ += end - s->highest;
+    if (s->recv_done) consumed_data_ += end - s->highest;  // discarded unread
+    s->highest = end;
+    if (read_data_ > max_read_) {
+      set_error(kFlowControlError, false);
+      return false;
+    }
+  }
+  if (!s->recv_done) {
+    if (offset > s->read) {
+      auto& slot = s->pending[offset];
+      if (data.size() > slot.size()) slot.assign(data);
+    } else if (end > s->read || s->fin_offset == s->read) {
+      deliver(*s, data.substr(s->read - offset));
+    }
+  }
+  credit(*s);
+  maybe_close_stream(*s);
+  return state_ == State::open;
+}
+
+void Connection::deliver(Stream& s, std::string_view data) {
+  std::string chunk;
+  for (;;) {
+    s.read += data.size();
+    consumed_data_ += data.size();
+    bool fin = s.read == s.fin_offset;
+    if (fin) s.recv_done = true;
+    app_.on_stream_data(s.id, data, fin);
+    // Then whatever arrived early and is now in order.
+    for (;;) {
+      if (s.recv_done || s.pending.empty() || s.pending.begin()->first > s.read) return;
+      auto node = s.pending.extract(s.pending.begin());
+      std::uint64_t at = node.key();
+      if (at + node.mapped().size() > s.read || (at + node.mapped().size() == s.read && s.fin_offset == s.read)) {
+        chunk = std::move(node.mapped());
+        data = std::string_view(chunk).substr(s.read - at);
+        break;
+      }
+    }
+  }
+}
+
+void Connection::credit(Stream& s) {
+  // Offer more once half the window is used.
+  if (max_read_ - consumed_data_ < limits_.max_data / 2) {
+    max_read_ = consumed_data_ + limits_.max_data;
+    max_data_pending_ = true;
+  }
+  if (!s.recv_done && s.fin_offset == UINT64_MAX && s.max_read - s.read < limits_.max_stream_data / 2) {
+    s.max_read = s.read + limits_.max_stream_data;
+    s.max_stream_data_pending = true;
+    stream_control_.push_back(s.id);
+  }
+}
+
+bool Connection::on_reset_stream(std::uint64_t id, std::uint64_t final_size) {
+  std::uint64_t error = 0;
+  Stream* s = stream_for_peer(id, false, error);
+  if (!s) {
+    if (error) set_error(error, false);
+    return !error;
+  }
+  if (final_size < s->highest || (s->fin_offset != UINT64_MAX && s->fin_offset != final_size)) {
+    set_error(kFinalSizeError, false);
+    return false;
+  }
+  if (final_size > s->max_read || read_data_ + (final_size - s->highest) > max_read_) {
+    set_error(kFlowControlError, false);
+    return false;
+  }
+  read_data_ += final_size - s->highest;
+  consumed_data_ += final_size - (s->recv_done ? s->highest : s->read);
+  s->highest = s->read = s->fin_offset = final_size;
+  if (!s->recv_done) {
+    s->recv_done = true;
+    s->pending.clear();
+    app_.on_stream_reset(id);
+  }
+  credit(*s);
+  maybe_close_stream(*s);
+  return true;
+}
+
+bool Connection::on_stop_sending(std::uint64_t id, std::uint64_t code) {
+  std::uint64_t error = 0;
+  Stream* s = stream_for_peer(id, true, error);
+  if (!s) {
+    if (error) set_error(error, false);
+    return !error;
+  }
+  if (s->send_done) return true;
+  reset(*s, code);
+  app_.on_stream_reset(id);
+  maybe_close_stream(*s);
+  return true;
+}
+
+void Connection::reset(Stream& s, std::uint64_t code) {
+  s.send_done = true;
+  s.reset_pending = true;
+  s.reset_code = code;
+  s.segments.clear();
+  s.file_cache = {};
+  s.send.lost = {};
+  stream_control_.push_back(s.id);
+}
+
+void Connection::maybe_close_stream(Stream& s) {
+  if (s.closed || !s.send_done || !s.recv_done || s.reset_pending || s.stop_pending) return;
+  s.closed = true;
+  closed_streams_.push_back(s.id);
+  if (local(s.id)) return;
+  // Let the peer open another in its place.
+  if (s.id & 2) {
+    ++closed_uni_;
+    if (closed_uni_ + limits_.max_streams_uni >= max_streams_uni_ + limits_.max_streams_uni / 2) {
+      max_streams_uni_ = closed_uni_ + limits_.max_streams_uni;
+      max_streams_uni_pending_ = true;
+    }
+  } else {
+    ++closed_bidi_;
+    if (closed_bidi_ + limits_.max_streams_bidi >= max_streams_bidi_ + limits_.max_streams_bidi / 2) {
+      max_streams_bidi_ = closed_bidi_ + limits_.max_streams_bidi;
+      max_streams_bidi_pending_ = true;
+    }
+  }
+}
+
+void Connection::collect() {
+  for (auto id : closed_streams_) streams_.erase(id);
+  closed_streams_.clear();
+}
+
+// Streams
+
+std::uint64_t Connection::open_bidi() {
+  if (peer_parameters_seen_ && next_bidi_ / 4 >= peer_max_streams_bidi_) return UINT64_MAX;
+  std::uint64_t id = next_bidi_;
+  next_bidi_ += 4;
+  new_stream(id);
+  return id;
+}
+
+std::uint64_t Connection::open_uni() {
+  // A server opens its streams before it has the client's limits; those
+  // arrive with the ClientHello it is about to read.
+  if (peer_parameters_seen_ && next_uni_ / 4 >= peer_max_streams_uni_) return UINT64_MAX;
+  std::uint64_t id = next_uni_;
+  next_uni_ += 4;
+  new_stream(id);
+  return id;
+}
+
+Connection::Stream* Connection::writable(std::uint64_t id) {
+  auto it = streams_.find(id);
+  if (it == streams_.end() || it->second.send_done || it->second.send.fin) return nullptr;
+  return &it->second;
+}
+
+void Connection::write(std::uint64_t stream, std::string data) {
+  Stream* s = writable(stream);
+  if (!s || data.empty()) return;
+  Segment segment{s->send.written, data.size(), std::move(data)};
+  s->send.written += segment.size;
+  s->segments.push_back(std::move(segment));
+}
+
+void Connection::write_ref(std::uint64_t stream, std::string_view data) {
+  Stream* s = writable(stream);
+  if (!s || data.empty()) return;
+  Segment segment{s->send.written, data.size(), {}, data.data()};
+  s->send.written += segment.size;
+  s->segments.push_back(std::move(segment));
+}
+
+void Connection::write_file(std::uint64_t stream, int fd, std::uint64_t size) {
+  Stream* s = writable(stream);
+  if (!s || size == 0) return;
+  Segment segment{s->send.written, size, {}, nullptr, fd};
+  s->send.written += size;
+  s->segments.push_back(std::move(segment));
+}
+
+void Connection::finish(std::uint64_t stream) {
+  if (Stream* s = writable(stream)) s->send.fin = true;
+}
+
+void Connection::stop_sending(std::uint64_t stream, std::uint64_t app_error) {
+  auto it = streams_.find(stream);
+  if (it == streams_.end() || it->second.recv_done) return;
+  Stream& s = it->second;
+  s.recv_done = true;
+  s.stop_pending = true;
+  s.stop_code = app_error;
+  s.pending.clear();
+  consumed_data_ += s.highest - s.read;
+  s.read = s.highest;
+  stream_control_.push_back(stream);
+}
+
+void Connection::reset_stream(std::uint64_t stream, std::uint64_t app_error) {
+  auto it = streams_.find(stream);
+  if (it == streams_.end() || it->second.send_done) return;
+  reset(it->second, app_error);
+  maybe_close_stream(it->second);
+}
+
+void Connection::set_priority(std::uint64_t stream, std::uint8_t urgency, bool incremental) {
+  auto it = streams_.find(stream);
+  if (it == streams_.end()) return;
+  it->second.urgency = urgency;
+  it->second.incremental = incremental;
+}
+
+// Sending
+
+std::size_t Connection::send(std::uint8_t* out, std::uint64_t now) {
+  now_ = now;
+  if (state_ == State::closed) return 0;
+  std::size_t n = 0;
+  if (state_ == State::closing) {
+    // Before the handshake completes the peer may lack 1-RTT keys; after
+    // it, the others may be gone.
+    for (std::size_t i = 0; i < tls13::kLevels; ++i) {
+      auto level = static_cast<Level>(i);
+      const Space& sp = space(level);
+      if ((level == Level::application) != handshake_done_ || sp.discarded || !sp.write.ready()) continue;
+      n += write_close(level, out + n, datagram_size_ - n);
+    }
+    state_ = State::closed;
+    return n;
+  }
+
+  std::size_t room = datagram_size_;
+  if (server_ && !address_validated_) {
+    // At most three times what the client sent until it proves its
+    // address (RFC 9000 section 8.1).
+    if (bytes_sent_ + room > 3 * bytes_received_) return 0;
+  }
+  for (std::size_t i = 0; i < tls13::kLevels; ++i) {
+    auto level = static_cast<Level>(i);
+    if (!has_data(level)) continue;
+    // Datagrams with a client's Initial, or a server's ack-eliciting one,
+    // are padded. Padding the Initial packet itself is simplest.
+    std::size_t min_size = 0;
+    if (level == Level::initial && (!server_ || space(level).probe || !space(level).crypto.lost.empty() ||
+                                    space(level).crypto.next < space(level).crypto.written)) {
+      min_size = kMinInitialSize;
+    }
+    n += write_packet(level, out + n, room - n, min_size, now);
+  }
+  bytes_sent_ += n;
+  collect();
+  return n;
+}
+
+bool Connection::has_data(Level level) {
+  const Space& sp = space(level);
+  if (sp.discarded || !sp.write.ready()) return false;
+  if (sp.ack_pending && (sp.ack_now || sp.ack_deadline <= now_)) return true;
+  if (probes_ == 0 && bytes_in_flight_ + datagram_size_ > cwnd_) return false;
+  if (sp.probe || !sp.crypto.lost.empty() || sp.crypto.next < sp.crypto.written) return true;
+  if (level != Level::application) return false;
+  if (handshake_done_pending_ || max_data_pending_ || max_streams_bidi_pending_ || max_streams_uni_pending_ ||
+      !path_response_.empty() || !stream_control_.empty()) {
+    return true;
+  }
+  return next_stream() != nullptr;
+}
+
+bool Connection::begin_packet(Level level, std::uint8_t* out, std::size_t room, Builder& b) {
+  Space& sp = space(level);
+  b.out = out;
+  b.pn = sp.next_pn;
+  // Enough of the packet number for the peer to recover it: twice the
+  // distance from the largest it acknowledged.
+  std::uint64_t distance = sp.largest_acked == UINT64_MAX ? b.pn + 1 : b.pn - sp.largest_acked;
+  b.pn_size = distance < 0x80 ? 1 : distance < 0x8000 ? 2 : distance < 0x800000 ? 3 : 4;
+  b.long_header = level != Level::application;
+  std::size_t header = b.long_header ? 7 + dcid_.size() + 1 + scid_.size() + (level == Level::initial) + 2
+                                     : 1 + dcid_.size();
+  header += b.pn_size;
+  if (room < header + 32 + PacketKeys::kTagSize) return false;
+
+  std::uint8_t* p = out;
+  if (b.long_header) {
+    std::uint8_t type = level == Level::initial ? kInitial : kHandshake;
+    *p++ = static_cast<std::uint8_t>(0xc0 | type << 4 | (b.pn_size - 1));
+    for (int i = 3; i >= 0; --i) *p++ = static_cast<std::uint8_t>(kVersion >> (8 * i));
+    *p++ = static_cast<std::uint8_t>(dcid_.size());
+    p = std::copy(dcid_.begin(), dcid_.end(), p);
+    *p++ = static_cast<std::uint8_t>(scid_.size());
+    p = std::copy(scid_.begin(), scid_.end(), p);
+    if (level == Level::initial) *p++ = 0;  // no token
+    b.length = p;
+    p += 2;
+  } else {
+    *p++ = static_cast<std::uint8_t>(0x40 | (key_phase_ ? 0x04 : 0) | (b.pn_size - 1));
+    p = std::copy(dcid_.begin(), dcid_.end(), p);
+    b.length = nullptr;
+  }
+  b.pn_at = p;
+  for (std::size_t i = b.pn_size; i-- > 0;) *p++ = static_cast<std::uint8_t>(b.pn >> (8 * i));
+  b.payload = b.p = p;
+  b.limit = out + room - PacketKeys::kTagSize;
+  return true;
+}
+
+std::size_t Connection::finish_packet(Level level, Builder& b, std::size_t min_size) {
+  Space& sp = space(level);
+  std::size_t header_size = b.payload - b.out;
+  // Header protection samples 16 bytes from 4 past the packet number.
+  std::size_t min_payload = 4 - b.pn_size;
+  if (min_size > header_size + PacketKeys::kTagSize) {
+    min_payload = std::max(min_payload, std::min<std::size_t>(min_size - header_size - PacketKeys::kTagSize,
+                                                              b.limit - b.payload));
+  }
+  if (static_cast<std::size_t>(b.p - b.payload) < min_payload) {
+    std::memset(b.p, kPadding, b.payload + min_payload - b.p);
+    b.p = b.payload + min_payload;
+  }
+  std::size_t payload_size = b.p - b.payload;
+  if (b.length) put_varint2(b.length, b.pn_size + payload_size + PacketKeys::kTagSize);
+  sp.write.seal(b.pn, {b.out, header_size}, b.payload, payload_size);
+  std::uint8_t mask[5];
+  sp.write.mask(b.pn_at + 4, mask);
+  b.out[0] ^= mask[0] & (b.long_header ? 0x0f : 0x1f);
+  for (std::size_t i = 0; i < b.pn_size; ++i) b.pn_at[i] ^= mask[1 + i];
+  ++sp.next_pn;
+  return header_size + payload_size + PacketKeys::kTagSize;
+}
+
+std::size_t Connection::write_packet(Level level, std::uint8_t* out, std::size_t room, std::size_t min_size,
+                                     std::uint64_t now) {
+  Space& sp = space(level);
+  Builder b;
+  if (!begin_packet(level, out, room, b)) return 0;
+  SentPacket packet;
+  packet.pn = b.pn;
+  packet.time = now;
+  auto left = [&] { return static_cast<std::size_t>(b.limit - b.p); };
+  auto slots = [&] { return packet.frame_count < packet.frames.size(); };
+
+  if (sp.ack_pending) b.p += write_ack(sp, b.p, left(), now);
+  std::uint8_t* eliciting = b.p;
+  if (probes_ > 0 || bytes_in_flight_ + room <= cwnd_) {
+    if (level == Level::application) b.p += write_control_frames(b.p, left(), packet);
+    while (slots() && (!sp.crypto.lost.empty() || sp.crypto.next < sp.crypto.written)) {
+      std::size_t n = write_crypto_frame(sp, b.p, left(), packet.frames[packet.frame_count]);
+      if (n == 0) break;
+      b.p += n;
+      ++packet.frame_count;
+    }
+    if (level == Level::application) {
+      while (slots()) {
+        Stream* s = next_stream();
+        if (!s) break;
+        std::size_t n = write_stream_frame(*s, b.p, left(), packet.frames[packet.frame_count]);
+        if (n == 0) break;
+        b.p += n;
+        ++packet.frame_count;
+      }
+    }
+    if (sp.probe && b.p == eliciting) *b.p++ = kPing;
+  }
+  if (b.p == b.payload) return 0;
+  packet.ack_eliciting = b.p != eliciting;
+  std::size_t size = finish_packet(level, b, min_size);
+
+  packet.size = static_cast<std::uint32_t>(size);
+  if (packet.ack_eliciting) {
+    packet.in_flight = true;
+    bytes_in_flight_ += size;
+    ++sp.eliciting_in_flight;
+    sp.last_ack_eliciting = now;
+    sp.probe = false;
+    if (probes_ > 0) --probes_;
+  } else {
+    packet.done = true;
+  }
+  if (!sp.sent.empty() || !packet.done) sp.sent.push_back(packet);
+  if (!server_ && level == Level::handshake) discard(Level::initial);  // RFC 9001 section 4.9.1
+  return size;
+}
+
+std::size_t Connection::write_close(Level level, std::uint8_t* out, std::size_t room) {
+  Builder b;
+  if (!begin_packet(level, out, room, b)) return 0;
+  bool app = error_app_ && level == Level::application;
+  *b.p++ = app ? kConnectionCloseApp : kConnectionClose;
+  // An application's error goes as a transport one before 1-RTT.
+  b.p = put_varint(b.p, error_app_ && !app ? kApplicationError : error_code_);
+  if (!app) b.p = put_varint(b.p, 0);  // frame type
+  b.p = put_varint(b.p, 0);            // no reason phrase
+  return finish_packet(level, b, level == Level::initial && !server_ ? kMinInitialSize : 0);
+}
+
+std::size_t Connection::write_ack(Space& sp, std::uint8_t* p, std::size_t room, std::uint64_t now) {
+  const auto& ranges = sp.received.ranges();
+  if (ranges.empty() || room < 16) return 0;
+  std::uint8_t* start = p;
+  std::size_t last = ranges.size() - 1;
+  std::uint64_t largest = ranges[last].second - 1;
+  // Each further range takes at most 16 bytes.
+  std::size_t count = std::min(last, (room - 16 - 8 - 8) / 16);
+  *p++ = kAck;
+  p = put_varint(p, largest);
+  p = put_varint(p, std::min<std::uint64_t>((now - sp.largest_received_time) / 1000 >> kAckDelayShift, kMaxVarint));
+  p = put_varint(p, count);
+  p = put_varint(p, largest - ranges[last].first);
+  for (std::size_t i = last; i > last - count; --i) {
+    const auto& above = ranges[i];
+    const auto& below = ranges[i - 1];
+    p = put_varint(p, above.first - below.second - 1);
+    p = put_varint(p, below.second - 1 - below.first);
+  }
+  sp.ack_pending = sp.ack_now = false;
+  sp.ack_deadline = UINT64_MAX;
+  sp.unacked_eliciting = 0;
+  return p - start;
+}
+
+std::size_t Connection::write_control_frames(std::uint8_t* p, std::size_t room, SentPacket& packet) {
+  std::uint8_t* start = p;
+  std::uint8_t* end = p + room;
+  auto fits = [&](std::size_t n) {
+    return static_cast<std::size_t>(end - p) >= n && packet.frame_count < packet.frames.size();
+  };
+  auto record = [&](SentFrame::Type type, std::uint64_t stream = 0) {
+    packet.frames[packet.frame_count++] = {type, false, stream};
+  };
+  if (handshake_done_pending_ && fits(1)) {
+    *p++ = kHandshakeDone;
+    record(SentFrame::Type::handshake_done);
+    handshake_done_pending_ = false;
+  }
+  if (max_data_pending_ && fits(9)) {
+    *p++ = kMaxData;
+    p = put_varint(p, max_read_);
+    record(SentFrame::Type::max_data);
+    max_data_pending_ = false;
+  }
+  if (max_streams_bidi_pending_ && fits(9)) {
+    *p++ = kMaxStreamsBidi;
+    p = put_varint(p, max_streams_bidi_);
+    record(SentFrame::Type::max_streams_bidi);
+    max_streams_bidi_pending_ = false;
+  }
+  if (max_streams_uni_pending_ && fits(9)) {
+    *p++ = kMaxStreamsUni;
+    p = put_varint(p, max_streams_uni_);
+    record(SentFrame::Type::max_streams_uni);
+    max_streams_uni_pending_ = false;
+  }
+  if (!path_response_.empty() && end - p >= 9) {
+    *p++ = kPathResponse;
+    p = std::copy(path_response_.begin(), path_response_.end(), p);
+    path_response_.clear();
+  }
+  while (!stream_control_.empty()) {
+    auto it = streams_.find(stream_control_.back());
+    if (it != streams_.end()) {
+      Stream& s = it->second;
+      if (s.reset_pending && fits(25)) {
+        *p++ = kResetStream;
+        p = put_varint(p, s.id);
+        p = put_varint(p, s.reset_code);
+        p = put_varint(p, s.send.next);
+        record(SentFrame::Type::reset_stream, s.id);
+        s.reset_pending = false;
+      }
+      if (s.stop_pending && fits(17)) {
+        *p++ = kStopSending;
+        p = put_varint(p, s.id);
+        p = put_varint(p, s.stop_code);
+        record(SentFrame::Type::stop_sending, s.id);
+        s.stop_pending = false;
+      }
+      if (s.max_stream_data_pending && fits(17)) {
+        *p++ = kMaxStreamData;
+        p = put_varint(p, s.id);
+        p = put_varint(p, s.max_read);
+        record(SentFrame::Type::max_stream_data, s.id);
+        s.max_stream_data_pending = false;
+      }
+      if (s.reset_pending || s.stop_pending || s.max_stream_data_pending) break;  // no room left
+      maybe_close_stream(s);
+    }
+    stream_control_.pop_back();
+  }
+  return p - start;
+}
+
+std::size_t Connection::write_crypto_frame(Space& sp, std::uint8_t* p, std::size_t room, SentFrame& record) {
+  bool lost = !sp.crypto.lost.empty();
+  std::uint64_t offset = lost ? sp.crypto.lost.ranges()[0].first : sp.crypto.next;
+  std::uint64_t size = lost ? sp.crypto.lost.ranges()[0].second - offset : sp.crypto.written - offset;
+  std::size_t header = 1 + varint_size(offset) + 2;
+  if (room <= header) return 0;
+  size = std::min<std::uint64_t>(size, room - header);
+  *p++ = kCrypto;
+  p = put_varint(p, offset);
+  p = put_varint2(p, size);
+  std::memcpy(p, sp.crypto_out.data() + offset, size);
+  if (lost) {
+    sp.crypto.lost.remove(offset, offset + size);
+  } else {
+    sp.crypto.next += size;
+  }
+  record = {SentFrame::Type::crypto, false, 0, offset, size};
+  return header + size;
+}
+
+Connection::Stream* Connection::next_stream() {
+  // Lost data first, then by urgency; within one, streams in order, but
+  // incremental ones by when they were last served.
+  Stream* best = nullptr;
+  auto key = [](const Stream& s, bool lost) {
+    return std::tuple(!lost, s.urgency, s.incremental ? s.turn : 0, s.id);
+  };
+  bool best_lost = false;
+  for (auto& [id, s] : streams_) {
+    if (s.send_done) continue;
+    bool lost = !s.send.lost.empty() || s.send.fin_lost;
+    bool fresh = (s.send.next < s.send.written && s.send.next < s.send.max && sent_data_ < max_data_) ||
+                 (s.send.fin && !s.send.fin_sent && s.send.next == s.send.written);
+    if (!lost && !fresh) continue;
+    if (!best || key(s, lost) < key(*best, best_lost)) {
+      best = &s;
+      best_lost = lost;
+    }
+  }
+  return best;
+}
+
+std::size_t Connection::write_stream_frame(Stream& s, std::uint8_t* p, std::size_t room, SentFrame& record) {
+  enum { kLost, kLostFin, kFresh } kind;
+  std::uint64_t offset = 0;
+  std::uint64_t size = 0;
+  if (!s.send.lost.empty()) {
+    kind = kLost;
+    offset = s.send.lost.ranges()[0].first;
+    size = s.send.lost.ranges()[0].second - offset;
+  } else if (s.send.fin_lost) {
+    kind = kLostFin;
+    offset = s.send.written;
+  } else {
+    kind = kFresh;
+    offset = s.send.next;
+    size = std::min({s.send.written - offset, s.send.max - offset, max_data_ - sent_data_});
+  }
+  std::size_t header = 1 + varint_size(s.id) + (offset ? varint_size(offset) : 0) + 2;
+  if (room < header + (size ? 1 : 0)) return 0;
+  size = std::min<std::uint64_t>(size, room - header);
+  bool fin = s.send.fin && offset + size == s.send.written && (kind == kFresh ? !s.send.fin_sent : s.send.fin_lost);
+  if (size == 0 && !fin) return 0;
+
+  std::uint8_t* start = p;
+  *p++ = static_cast<std::uint8_t>(kStream | (offset ? 0x04 : 0) | 0x02 | (fin ? 0x01 : 0));
+  p = put_varint(p, s.id);
+  if (offset) p = put_varint(p, offset);
+  p = put_varint2(p, size);
+  if (!copy_stream_data(s, offset, p, size)) {
+    // The file could not be read: give the stream up.
+    reset(s, kStreamInternalError);
+    app_.on_stream_reset(s.id);
+    maybe_close_stream(s);
+    return 0;
+  }
+  p += size;
+  switch (kind) {
+    case kLost: s.send.lost.remove(offset, offset + size); break;
+    case kLostFin: break;
+    case kFresh:
+      s.send.next += size;
+      sent_data_ += size;
+      break;
+  }
+  if (fin) {
+    s.send.fin_sent = true;
+    s.send.fin_lost = false;
+  }
+  if (s.incremental) s.turn = ++turns_;
+  record = {SentFrame::Type::stream, fin, s.id, offset, size};
+  return p - start;
+}
+
+bool Connection::copy_stream_data(Stream& s, std::uint64_t offset, std::uint8_t* out, std::size_t size) {
+  auto it = std::upper_bound(s.segments.begin(), s.segments.end(), offset,
+                             [](std::uint64_t v, const Segment& segment) { return v < segment.offset; });
+  --it;
+  while (size > 0) {
+    const Segment& segment = *it++;
+    std::uint64_t at = offset - segment.offset;
+    std::size_t n = std::min<std::uint64_t>(size, segment.size - at);
+    if (!segment.owned.empty()) {
+      std::memcpy(out, segment.owned.data() + at, n);
+    } else if (segment.data) {
+      std::memcpy(out, segment.data + at, n);
+    } else {
+      if (s.cache_fd != segment.fd || at < s.cache_offset || at + n > s.cache_offset + s.file_cache.size()) {
+        s.cache_fd = -1;
+        s.file_cache.resize(std::min<std::uint64_t>(kFileWindow, segment.size - at));
+        std::size_t got = 0;
+        while (got < s.file_cache.size()) {
+          ssize_t r = pread(segment.fd, s.file_cache.data() + got, s.file_cache.size() - got,
+                            static_cast<off_t>(at + got));
+          if (r < 0 && errno == EINTR) continue;
+          if (r <= 0) return false;
+          got += r;
+        }
+        s.cache_fd = segment.fd;
+        s.cache_offset = at;
+      }
+      std::memcpy(out, s.file_cache.data() + (at - s.cache_offset), n);
+    }
+    out += n;
+    offset += n;
+    size -= n;
+  }
+  return true;
+}
+
+// Loss recovery and congestion control
+
+void Connection::on_packet_acked(Level level, SentPacket& packet) {
+  Space& sp = space(level);
+  packet.done = true;
+  if (packet.in_flight) {
+    bytes_in_flight_ -= packet.size;
+    if (packet.ack_eliciting) --sp.eliciting_in_flight;
+    // NewReno: slow start, then a datagram per window; nothing while
+    // recovering from a loss.
+    if (packet.time > recovery_start_) {
+      cwnd_ += cwnd_ < ssthresh_ ? packet.size : datagram_size_ * packet.size / cwnd_;
+    }
+  }
+  for (std::size_t i = 0; i < packet.frame_count; ++i) {
+    const SentFrame& f = packet.frames[i];
+    if (f.type == SentFrame::Type::crypto) {
+      sp.crypto.lost.remove(f.offset, f.offset + f.length);
+      continue;
+    }
+    if (f.type != SentFrame::Type::stream) continue;
+    auto it = streams_.find(f.stream);
+    if (it == streams_.end() || it->second.send_done) continue;
+    Stream& s = it->second;
+    s.send.acked.add(f.offset, f.offset + f.length);
+    s.send.lost.remove(f.offset, f.offset + f.length);
+    if (f.fin) {
+      s.send.fin_acked = true;
+      s.send.fin_lost = false;
+    }
+    // Drop what is acknowledged from the start.
+    const auto& acked = s.send.acked.ranges();
+    if (!acked.empty() && acked[0].first == 0) {
+      while (!s.segments.empty() && s.segments.front().offset + s.segments.front().size <= acked[0].second) {
+        s.segments.pop_front();
+      }
+    }
+    if (s.send.done()) {
+      s.send_done = true;
+      s.file_cache = {};
+      app_.on_stream_acked(s.id);
+      maybe_close_stream(s);
+    }
+  }
+}
+
+void Connection::on_packet_lost(Level level, SentPacket& packet) {
+  Space& sp = space(level);
+  packet.done = true;
+  if (packet.in_flight) {
+    bytes_in_flight_ -= packet.size;
+    if (packet.ack_eliciting) --sp.eliciting_in_flight;
+  }
+  retransmit(level, packet);
+}
+
+void Connection::retransmit(Level level, const SentPacket& packet) {
+  Space& sp = space(level);
+  for (std::size_t i = 0; i < packet.frame_count; ++i) {
+    const SentFrame& f = packet.frames[i];
+    auto it = streams_.find(f.stream);
+    Stream* s = it == streams_.end() ? nullptr : &it->second;
+    switch (f.type) {
+      case SentFrame::Type::crypto:
+        sp.crypto.lost.add(f.offset, f.offset + f.length);
+        break;
+      case SentFrame::Type::stream: {
+        if (!s || s->send_done) break;
+        s->send.lost.add(f.offset, f.offset + f.length);
+        // Not what was acknowledged in the meantime and let go.
+        const auto& acked = s->send.acked.ranges();
+        if (!acked.empty() && acked[0].first == 0) s->send.lost.remove(0, acked[0].second);
+        if (f.fin && !s->send.fin_acked) s->send.fin_lost = true;
+        break;
+      }
+      case SentFrame::Type::handshake_done: handshake_done_pending_ = true; break;
+      case SentFrame::Type::max_data: max_data_pending_ = true; break;
+      case SentFrame::Type::max_streams_bidi: max_streams_bidi_pending_ = true; break;
+      case SentFrame::Type::max_streams_uni: max_streams_uni_pending_ = true; break;
+      case SentFrame::Type::max_stream_data:
+        if (s && !s->recv_done) {
+          s->max_stream_data_pending = true;
+          stream_control_.push_back(s->id);
+        }
+        break;
+      case SentFrame::Type::reset_stream:
+        if (s) {
+          s->reset_pending = true;
+          stream_control_.push_back(s->id);
+        }
+        break;
+      case SentFrame::Type::stop_sending:
+        if (s) {
+          s->stop_pending = true;
+          stream_control_.push_back(s->id);
+        }
+        break;
+    }
+  }
+}
+
+void Connection::detect_lost(Level level, std::uint64_t now) {
+  Space& sp = space(level);
+  sp.loss_time = 0;
+  if (sp.largest_acked == UINT64_MAX) return;
+  // Lost: three packets older than one acknowledged, or sent 9/8 RTT
+  // before it (RFC 9002 section 6.1).
+  std::uint64_t delay = std::max(std::max(latest_rtt_, smoothed_rtt_) * 9 / 8, kGranularity);
+  std::uint64_t lost_before = now > delay ? now - delay : 0;
+  std::uint64_t newest_lost = 0;
+  for (auto& packet : sp.sent) {
+    if (packet.pn > sp.largest_acked) break;
+    if (packet.done) continue;
+    if (packet.time <= lost_before || sp.largest_acked >= packet.pn + kPacketThreshold) {
+      if (packet.in_flight) newest_lost = std::max(newest_lost, packet.time);
+      on_packet_lost(level, packet);
+    } else {
+      std::uint64_t t = packet.time + delay;
+      sp.loss_time = sp.loss_time ? std::min(sp.loss_time, t) : t;
+    }
+  }
+  // One congestion event per round trip.
+  if (newest_lost > recovery_start_) {
+    recovery_start_ = now;
+    cwnd_ = ssthresh_ = std::max<std::uint64_t>(cwnd_ / 2, 2 * datagram_size_);
+  }
+  while (!sp.sent.empty() && sp.sent.front().done) sp.sent.pop_front();
+}
+
+std::uint64_t Connection::pto_duration(Level level) const {
+  std::uint64_t d = smoothed_rtt_ + std::max(4 * rttvar_, kGranularity);
+  if (level == Level::application) d += peer_max_ack_delay_ms_ * 1000000;
+  return d << std::min(pto_count_, 16u);
+}
+
+std::uint64_t Connection::pto_time(Level& level) const {
+  std::uint64_t t = UINT64_MAX;
+  for (std::size_t i = 0; i < tls13::kLevels; ++i) {
+    auto l = static_cast<Level>(i);
+    const Space& sp = spaces_[i];
+    if (sp.discarded || sp.eliciting_in_flight == 0) continue;
+    if (l == Level::application && !handshake_done_) continue;
+    std::uint64_t at = sp.last_ack_eliciting + pto_duration(l);
+    if (at < t) {
+      t = at;
+      level = l;
+    }
+  }
+  if (t == UINT64_MAX && !server_ && !handshake_done_) {
+    // A client with nothing in flight probes anyway, in case the server
+    // waits on the amplification limit (RFC 9002 section 6.2.2.1).
+    level = space(Level::handshake).write.ready() ? Level::handshake : Level::initial;
+    std::uint64_t last = std::max(space(Level::initial).last_ack_eliciting,
+                                  space(Level::handshake).last_ack_eliciting);
+    t = last + pto_duration(level);
+  }
+  return t;
+}
+
+std::uint64_t Connection::next_timeout() const {
+  if (state_ != State::open) return UINT64_MAX;
+  std::uint64_t t = idle_deadline_;
+  const Space& app = space(Level::application);
+  if (app.ack_pending) t = std::min(t, app.ack_deadline);
+  bool loss = false;
+  for (const auto& sp : spaces_) {
+    if (sp.loss_time) {
+      t = std::min(t, sp.loss_time);
+      loss = true;
+    }
+  }
+  if (!loss) {
+    Level level;
+    t = std::min(t, pto_time(level));
+  }
+  return t;
+}
+
+void Connection::on_timeout(std::uint64_t now) {
+  now_ = now;
+  if (state_ != State::open) return;
+  if (now >= idle_deadline_) {
+    state_ = State::closed;  // silently (RFC 9000 section 10.1)
+    return;
+  }
+  Space& app = space(Level::application);
+  if (app.ack_deadline <= now) {
+    app.ack_now = true;
+    app.ack_deadline = UINT64_MAX;
+  }
+  bool loss = false;
+  for (std::size_t i = 0; i < tls13::kLevels; ++i) {
+    if (spaces_[i].loss_time && spaces_[i].loss_time <= now) {
+      detect_lost(static_cast<Level>(i), now);
+      loss = true;
+    } else if (spaces_[i].loss_time) {
+      loss = true;
+    }
+  }
+  Level level;
+  if (!loss && pto_time(level) <= now) {
+    // A probe timeout: two packets past the window, carrying the oldest
+    // unacknowledged data again in case that is what was lost.
+    ++pto_count_;
+    probes_ = 2;
+    Space& sp = space(level);
+    sp.probe = true;
+    for (const auto& packet : sp.sent) {
+      if (!packet.done && packet.ack_eliciting) {
+        retransmit(level, packet);
+        break;
+      }
+    }
+  }
+  collect();
+}
+
+}  // namespace mt::quic
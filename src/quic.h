@@ -0,0 +1,456 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <memory>
+#include <span>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "tls13.h"
+
+struct evp_cipher_ctx_st;
+
+// QUIC version 1 (RFC 9000, 9001 and 9002), for HTTP/3. Like
+// http2::Session, a Connection does no I/O: the caller hands it datagrams
+// and sends the ones it produces, so one socket can serve many connections
+// and batch their datagrams.
+//
+// Left out: 0-RTT, Retry, connection migration (we disable it), stateless
+// reset, new connection IDs and pacing.
+namespace mt::quic {
+
+inline constexpr std::uint32_t kVersion = 1;
+// Our connection IDs. Short headers carry no length, so the worker routes
+// by this many bytes after the first.
+inline constexpr std::size_t kConnectionIdSize = 8;
+// The datagrams we send, which fit a 1400-byte path with room to spare.
+inline constexpr std::size_t kMaxDatagramSize = 1350;
+// Datagrams carrying a client's Initial packet are at least this large.
+inline constexpr std::size_t kMinInitialSize = 1200;
+
+// Variable-length integers (RFC 9000 section 16).
+inline constexpr std::uint64_t kMaxVarint = (std::uint64_t{1} << 62) - 1;
+std::size_t varint_size(std::uint64_t v);
+std::uint8_t* put_varint(std::uint8_t* p, std::uint64_t v);
+void put_varint(std::string& out, std::uint64_t v);
+// Reads a varint at `p`, advancing it. Returns false if it is truncated.
+bool get_varint(const std::uint8_t*& p, const std::uint8_t* end, std::uint64_t& v);
+
+// Transport error codes (RFC 9000 section 20.1). A TLS alert is sent as
+// kCryptoError + the alert.
+enum Error : std::uint64_t {
+  kNoError = 0x0,
+  kInternalError = 0x1,
+  kFlowControlError = 0x3,
+  kStreamLimitError = 0x4,
+  kStreamStateError = 0x5,
+  kFinalSizeError = 0x6,
+  kFrameEncodingError = 0x7,
+  kTransportParameterError = 0x8,
+  kProtocolViolation = 0xa,
+  kApplicationError = 0xc,
+  kCryptoBufferExceeded = 0xd,
+  kKeyUpdateError = 0xe,
+  kCryptoError = 0x100,
+};
+
+// What a worker needs to route a datagram before any connection state:
+// the invariant header fields (RFC 8999).
+struct Header {
+  bool long_header = false;
+  std::uint32_t version = 0;
+  std::uint8_t type = 0;  // long header packet type; 0 is Initial
+  std::string_view dcid;
+  std::string_view scid;
+};
+// Parses the first packet of `datagram`. Short headers are taken to carry
+// a `short_cid_size`-byte destination ID.
+bool parse_header(std::span<const std::uint8_t> datagram, std::size_t short_cid_size, Header& h);
+// A Version Negotiation packet answering `h`, which had a version we do
+// not speak (RFC 9000 section 17.2.1).
+std::string version_negotiation(const Header& h);
+// A random connection ID of kConnectionIdSize bytes.
+std::string new_connection_id();
+
+// Packet protection for one direction at one encryption level: AES-128-GCM
+// for the payload and AES-128-ECB for the header mask (RFC 9001 section 5).
+class PacketKeys {
+ public:
+  PacketKeys() = default;
+  ~PacketKeys();
+  PacketKeys(const PacketKeys&) = delete;
+  PacketKeys& operator=(const PacketKeys&) = delete;
+
+  // Derives the keys from a traffic secret.
+  void set(std::string_view secret);
+  // The same header protection, with the payload keys of the next key
+  // phase (RFC 9001 section 6).
+  void update_from(const PacketKeys& current);
+  bool ready() const { return aead_ != nullptr; }
+  void clear();
+
+  // Encrypts the `size` bytes at `payload` in place and writes the 16-byte
+  // tag after them. `header` is the associated data.
+  void seal(std::uint64_t pn, std::span<const std::uint8_t> header, std::uint8_t* payload, std::size_t size) const;
+  // Decrypts `size` bytes at `payload`, tag included, in place. Returns
+  // false if the tag does not match.
+  bool open(std::uint64_t pn, std::span<const std::uint8_t> header, std::uint8_t* payload, std::size_t size) const;
+  // The 5-byte header protection mask for a 16-byte sample.
+  void mask(const std::uint8_t* sample, std::uint8_t* out) const;
+
+  static constexpr std::size_t kTagSize = 16;
+
+ private:
+  void set_keys(std::string_view key, std::string_view iv);
+
+  std::string secret_;
+  evp_cipher_ctx_st* aead_ = nullptr;
+  evp_cipher_ctx_st* hp_ = nullptr;
+  std::array<std::uint8_t, 12> iv_{};
+};
+
+// The Initial keys of a connection, from the client's first destination
+// connection ID (RFC 9001 section 5.2).
+void initial_keys(std::string_view dcid, bool server, PacketKeys& read, PacketKeys& write);
+
+// The layer above: HTTP/3. Streams are delivered in order; a stream's data
+// may arrive in many calls.
+class Application {
+ public:
+  virtual ~Application() = default;
+  virtual void on_stream_data(std::uint64_t stream, std::string_view data, bool fin) = 0;
+  // The peer abandoned sending on `stream` (RESET_STREAM) or asked us to
+  // stop (STOP_SENDING, after which the stream is reset).
+  virtual void on_stream_reset(std::uint64_t stream) = 0;
+  // Every byte we wrote on `stream`, and its end, has been acknowledged.
+  virtual void on_stream_acked(std::uint64_t stream) = 0;
+};
+
+// Limits a connection offers its peer.
+struct Limits {
+  std::uint64_t max_data = 1 << 20;
+  std::uint64_t max_stream_data = 1 << 16;  // on every stream the peer sends on
+  std::uint64_t max_streams_bidi = 128;
+  std::uint64_t max_streams_uni = 8;
+  std::uint64_t idle_timeout_ms = 30000;
+};
+
+class Connection {
+ public:
+  // A server connection, for a client whose first Initial packet had
+  // header `h`. `cid` is the ID we choose for ourselves.
+  Connection(Application& app, std::shared_ptr<const tls13::Credentials> credentials, const Header& h,
+             std::string cid, std::string alpn, const Limits& limits, std::uint64_t now);
+  // A client connection to `server_name`.
+  Connection(Application& app, std::string server_name, std::string alpn, const Limits& limits, std::uint64_t now);
+  ~Connection();
+  Connection(const Connection&) = delete;
+  Connection& operator=(const Connection&) = delete;
+
+  // Processes a received datagram, decrypting it in place. Undecryptable
+  // packets are dropped, as QUIC requires; protocol errors close the
+  // connection.
+  void receive(std::span<std::uint8_t> datagram, std::uint64_t now);
+
+  // Writes the next datagram to `out`, which has room for
+  // kMaxDatagramSize bytes, and returns its size: 0 when flow control,
+  // congestion control or the amplification limit hold everything back,
+  // or there is nothing to send.
+  std::size_t send(std::uint8_t* out, std::uint64_t now);
+
+  // When on_timeout() is next due, on the clock `now` is given in (ns);
+  // UINT64_MAX when no timer is set.
+  std::uint64_t next_timeout() const;
+  void on_timeout(std::uint64_t now);
+
+  // Closes the connection with an application error, sending it once.
+  void close(std::uint64_t app_error);
+  // True once the connection is over and its last datagram sent.
+  bool closed() const { return state_ == State::closed; }
+  bool established() const { return handshake_done_; }
+
+  std::string_view cid() const { return scid_; }
+  // The destination ID of the client's first Initial, which routes its
+  // Initial packets until it learns ours.
+  std::string_view original_cid() const { return odcid_; }
+
+  // Streams. Written data is sent by send() in stream order; `ref` and
+  // `file` data must stay valid until on_stream_acked() or a reset.
+  std::uint64_t open_bidi();  // client; UINT64_MAX when the peer's limit is reached
+  std::uint64_t open_uni();
+  void write(std::uint64_t stream, std::string data);
+  void write_ref(std::uint64_t stream, std::string_view data);
+  void write_file(std::uint64_t stream, int fd, std::uint64_t size);
+  void finish(std::uint64_t stream);
+  // Abandons receiving on a stream, asking the peer to stop sending.
+  void stop_sending(std::uint64_t stream, std::uint64_t app_error);
+  // Abandons sending on a stream (RESET_STREAM).
+  void reset_stream(std::uint64_t stream, std::uint64_t app_error);
+  // RFC 9218 priority: lower urgency first; within one, streams go in
+  // order, incremental ones a packet at a time in turn.
+  void set_priority(std::uint64_t stream, std::uint8_t urgency, bool incremental);
+
+ private:
+  enum class State : std::uint8_t { open, closing, closed };
+  using Level = tls13::Level;
+
+  // Half-open intervals [first, second), sorted and disjoint.
+  class RangeSet {
+   public:
+    void add(std::uint64_t begin, std::uint64_t end);
+    void remove(std::uint64_t begin, std::uint64_t end);
+    bool contains(std::uint64_t v) const;
+    bool empty() const { return ranges_.empty(); }
+    const std::vector<std::pair<std::uint64_t, std::uint64_t>>& ranges() const { return ranges_; }
+    // Drops ranges until at most `n` remain, lowest first.
+    void trim(std::size_t n);
+
+   private:
+    std::vector<std::pair<std::uint64_t, std::uint64_t>> ranges_;
+  };
+
+  // A stream's outgoing bytes, kept until acknowledged so losses can be
+  // sent again.
+  struct Segment {
+    std::uint64_t offset;  // in the stream
+    std::uint64_t size;
+    std::string owned;
+    const char* data = nullptr;  // when not owned or a file
+    int fd = -1;
+  };
+  struct SendState {
+    std::uint64_t written = 0;  // stream offset after the last byte written
+    std::uint64_t next = 0;     // first byte never sent
+    std::uint64_t max = 0;      // peer's flow control limit
+    RangeSet lost;              // sent, presumed lost, to send again
+    RangeSet acked;
+    bool fin = false;           // written ends at the stream's end
+    bool fin_sent = false;
+    bool fin_lost = false;
+    bool fin_acked = false;
+    bool done() const;
+  };
+  struct Stream {
+    std::uint64_t id = 0;
+    // Sending.
+    SendState send;
+    std::deque<Segment> segments;
+    std::string file_cache;  // a window of a file segment
+    int cache_fd = -1;
+    std::uint64_t cache_offset = 0;  // in the file
+    std::uint8_t urgency = 3;
+    bool incremental = false;
+    std::uint64_t turn = 0;
+    bool send_done = false;  // acknowledged, or reset
+    bool reset_pending = false;  // RESET_STREAM to send
+    std::uint64_t reset_code = 0;
+    // Receiving.
+    std::uint64_t read = 0;  // bytes delivered
+    std::uint64_t max_read = 0;  // our flow control limit
+    std::uint64_t highest = 0;  // end of the data received so far
+    std::uint64_t fin_offset = UINT64_MAX;
+    std::map<std::uint64_t, std::string> pending;  // out of order
+    bool recv_done = false;
+    bool stop_pending = false;  // STOP_SENDING to send
+    std::uint64_t stop_code = 0;
+    bool max_stream_data_pending = false;
+    bool closed = false;
+  };
+
+  // A frame that may need sending again if its packet is lost.
+  struct SentFrame {
+    enum class Type : std::uint8_t { stream, crypto, handshake_done, max_data, max_streams_bidi, max_streams_uni,
+                                     max_stream_data, reset_stream, stop_sending };
+    Type type;
+    bool fin = false;
+    std::uint64_t stream = 0;
+    std::uint64_t offset = 0;
+    std::uint64_t length = 0;
+  };
+  struct SentPacket {
+    std::uint64_t pn = 0;
+    std::uint64_t time = 0;
+    std::uint32_t size = 0;
+    bool ack_eliciting = false;
+    bool in_flight = false;
+    bool done = false;  // acknowledged or declared lost
+    std::uint8_t frame_count = 0;
+    std::array<SentFrame, 6> frames;
+  };
+  // A packet number space, with the keys of its level.
+  struct Space {
+    PacketKeys read;
+    PacketKeys write;
+    std::uint64_t next_pn = 0;
+    std::uint64_t largest_acked = UINT64_MAX;
+    std::deque<SentPacket> sent;  // consecutive packet numbers, oldest first
+    std::uint64_t loss_time = 0;
+    std::uint64_t last_ack_eliciting = 0;  // when we last sent one
+    unsigned eliciting_in_flight = 0;
+    bool probe = false;  // a PTO fired: send something ack-eliciting
+    // Receiving.
+    RangeSet received;
+    std::uint64_t largest_received = UINT64_MAX;
+    std::uint64_t largest_received_time = 0;
+    unsigned unacked_eliciting = 0;  // ack-eliciting packets since our last ACK
+    std::uint64_t ack_deadline = UINT64_MAX;
+    bool ack_now = false;
+    bool ack_pending = false;  // received packets not yet acknowledged
+    // CRYPTO, for the handshake's levels.
+    std::string crypto_out;  // every byte written, kept until acknowledged
+    SendState crypto;
+    std::uint64_t crypto_read = 0;
+    std::map<std::uint64_t, std::string> crypto_pending;
+    bool discarded = false;
+  };
+
+  // A packet being written.
+  struct Builder {
+    std::uint8_t* out;
+    std::uint8_t* length;  // long headers: the Length field, patched last
+    std::uint8_t* pn_at;
+    std::uint8_t* payload;
+    std::uint8_t* p;
+    std::uint8_t* limit;  // where the AEAD tag goes
+    std::uint64_t pn;
+    std::size_t pn_size;
+    bool long_header;
+  };
+
+  Connection(Application& app, bool server, const Limits& limits, std::uint64_t now);
+  std::string local_parameters() const;
+  bool apply_peer_parameters(std::string_view params);
+  std::uint64_t idle_timeout() const;
+  Space& space(Level level) { return spaces_[static_cast<std::size_t>(level)]; }
+  const Space& space(Level level) const { return spaces_[static_cast<std::size_t>(level)]; }
+  void set_error(std::uint64_t code, bool app);
+
+  // Receiving.
+  std::size_t receive_packet(std::uint8_t* p, std::size_t size, std::uint64_t now);
+  bool on_frames(Level level, const std::uint8_t* p, const std::uint8_t* end, bool& ack_eliciting,
+                 std::uint64_t now);
+  bool on_ack(Level level, const std::uint8_t*& p, const std::uint8_t* end, bool ecn, std::uint64_t now);
+  bool on_crypto(Level level, std::uint64_t offset, std::string_view data);
+  bool on_stream(std::uint64_t id, std::uint64_t offset, std::string_view data, bool fin);
+  bool on_reset_stream(std::uint64_t id, std::uint64_t final_size);
+  bool on_stop_sending(std::uint64_t id, std::uint64_t code);
+  void drive_handshake();
+  void discard(Level level);
+  void deliver(Stream& s, std::string_view data);
+  void credit(Stream& s);
+
+  // Streams.
+  bool local(std::uint64_t id) const;
+  std::uint64_t initial_send_max(std::uint64_t id) const;
+  Stream& new_stream(std::uint64_t id);
+  Stream* stream_for_peer(std::uint64_t id, bool sending, std::uint64_t& error);
+  Stream* writable(std::uint64_t id);
+  void reset(Stream& s, std::uint64_t code);
+  void maybe_close_stream(Stream& s);
+  void collect();
+
+  // Sending.
+  bool has_data(Level level);
+  bool begin_packet(Level level, std::uint8_t* out, std::size_t room, Builder& b);
+  std::size_t finish_packet(Level level, Builder& b, std::size_t min_size);
+  std::size_t write_packet(Level level, std::uint8_t* out, std::size_t room, std::size_t min_size,
+                           std::uint64_t now);
+  std::size_t write_close(Level level, std::uint8_t* out, std::size_t room);
+  std::size_t write_ack(Space& sp, std::uint8_t* p, std::size_t room, std::uint64_t now);
+  std::size_t write_control_frames(std::uint8_t* p, std::size_t room, SentPacket& packet);
+  std::size_t write_crypto_frame(Space& sp, std::uint8_t* p, std::size_t room, SentFrame& record);
+  Stream* next_stream();
+  std::size_t write_stream_frame(Stream& s, std::uint8_t* p, std::size_t room, SentFrame& record);
+  bool copy_stream_data(Stream& s, std::uint64_t offset, std::uint8_t* out, std::size_t size);
+
+  // Loss recovery and congestion control (RFC 9002).
+  void on_packet_acked(Level level, SentPacket& packet);
+  void on_packet_lost(Level level, SentPacket& packet);
+  void retransmit(Level level, const SentPacket& packet);
+  void detect_lost(Level level, std::uint64_t now);
+  std::uint64_t pto_duration(Level level) const;
+  std::uint64_t pto_time(Level& level) const;
+
+  Application& app_;
+  bool server_;
+  Limits limits_;
+  State state_ = State::open;
+  std::unique_ptr<tls13::Handshake> tls_;
+  std::array<Space, tls13::kLevels> spaces_;
+  bool handshake_done_ = false;
+  bool handshake_done_pending_ = false;
+  bool address_validated_ = false;
+  bool peer_parameters_seen_ = false;
+  std::string scid_;   // ours
+  std::string dcid_;   // the peer's
+  std::string odcid_;  // client's first destination ID
+  bool dcid_confirmed_ = false;  // client: took the server's ID
+
+  // 1-RTT key updates: the phase in use, and the next keys once derived.
+  bool key_phase_ = false;
+  PacketKeys next_read_;
+
+  // Flow control. The peer's limits on what we send, and ours on it.
+  std::uint64_t max_data_ = 0;
+  std::uint64_t sent_data_ = 0;
+  std::uint64_t peer_stream_data_bidi_local_ = 0;   // their streams
+  std::uint64_t peer_stream_data_bidi_remote_ = 0;  // our streams
+  std::uint64_t peer_stream_data_uni_ = 0;
+  std::uint64_t peer_max_streams_bidi_ = 0;
+  std::uint64_t peer_max_streams_uni_ = 0;
+  std::uint64_t peer_idle_timeout_ms_ = 0;
+  std::uint64_t peer_ack_delay_exponent_ = 3;
+  std::uint64_t peer_max_ack_delay_ms_ = 25;
+  std::size_t datagram_size_ = kMaxDatagramSize;
+  std::uint64_t max_read_ = 0;  // ours on their data
+  std::uint64_t read_data_ = 0;  // highest offsets received, summed
+  std::uint64_t consumed_data_ = 0;
+  bool max_data_pending_ = false;
+  std::uint64_t max_streams_bidi_ = 0;  // ours
+  std::uint64_t max_streams_uni_ = 0;
+  std::uint64_t closed_bidi_ = 0;
+  std::uint64_t closed_uni_ = 0;
+  bool max_streams_bidi_pending_ = false;
+  bool max_streams_uni_pending_ = false;
+
+  std::unordered_map<std::uint64_t, Stream> streams_;
+  std::uint64_t next_bidi_ = 0;  // our next stream IDs
+  std::uint64_t next_uni_ = 0;
+  std::uint64_t peer_next_bidi_ = 0;  // the peer's lowest never opened
+  std::uint64_t peer_next_uni_ = 0;
+  std::vector<std::uint64_t> stream_control_;  // streams with control frames to send
+  std::string path_response_;  // PATH_CHALLENGE data to echo
+  std::uint64_t turns_ = 0;
+  std::vector<std::uint64_t> closed_streams_;  // to erase once out of callbacks
+
+  // Recovery state, in ns.
+  std::uint64_t smoothed_rtt_ = 333000000;
+  std::uint64_t rttvar_ = 166500000;
+  std::uint64_t min_rtt_ = UINT64_MAX;
+  std::uint64_t latest_rtt_ = 0;
+  bool rtt_sampled_ = false;
+  unsigned pto_count_ = 0;
+  unsigned probes_ = 0;  // PTO probes owed, sent regardless of the window
+  std::uint64_t bytes_in_flight_ = 0;
+  std::uint64_t cwnd_ = 0;
+  std::uint64_t ssthresh_ = UINT64_MAX;
+  std::uint64_t recovery_start_ = 0;
+  std::uint64_t bytes_received_ = 0;  // for the amplification limit
+  std::uint64_t bytes_sent_ = 0;
+  std::uint64_t idle_deadline_ = 0;
+  std::uint64_t packets_received_ = 0;
+
+  // A connection error to report with CONNECTION_CLOSE.
+  std::uint64_t error_code_ = 0;
+  bool error_app_ = false;
+  std::uint64_t now_ = 0;
+};
+
+}  // namespace mt::quic
@@ -0,0 +1,207 @@
+#include "responses.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+#include "hpack.h"
+#include "qpack.h"
+#include "site.h"
+
+namespace mt {
+
+namespace {
+
+template <typename T>
+void append_raw(std::string& out, const T& value) {
+  out.append(reinterpret_cast<const char*>(&value), sizeof value);
+}
+
+// Appends `rep`'s body, which belongs to `r`.
+void append_body(std::string& out, const Resource& r, const Representation& rep) {
+  if (rep.data != nullptr) {
+    out.append(rep.data, rep.size);
+    return;
+  }
+  auto at = out.size();
+  out.resize(at + rep.size);
+  std::size_t done = 0;
+  while (done < rep.size) {
+    auto n = ::pread(rep.fd, out.data() + at + done, rep.size - done, static_cast<off_t>(done));
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) {
+      throw std::runtime_error("cannot read " + r.path + ": " + (n < 0 ? std::strerror(errno) : "short file"));
+    }
+    done += static_cast<std::size_t>(n);
+  }
+}
+
+}  // namespace
+
+std::string response_head(const Resource& r, Encoding e) {
+  const auto& rep = r.reps[static_cast<std::size_t>(e)];
+  const auto& etag = r.etags[static_cast<std::size_t>(e)];
+  std::string head = "HTTP/1.1 200 OK\r\nServer: mtserve\r\nContent-Type: ";
+  head += r.content_type;
+  head += "\r\nContent-Length: ";
+  head += std::to_string(rep.size);
+  head += "\r\n";
+  if (e != Encoding::identity) {
+    head += "Content-Encoding: ";
+    head += encoding_token(e);
+    head += "\r\n";
+  }
+  if (!etag.empty()) {
+    head += "ETag: ";
+    head += etag;
+    head += "\r\n";
+  }
+  if (!r.dictionary_id.empty()) {
+    head += "Vary: Accept-Encoding, Available-Dictionary\r\n";
+  } else if (r.has_variants()) {
+    head += "Vary: Accept-Encoding\r\n";
+  }
+  head += r.headers;
+  return head;
+}
+
+const FieldCodec kHpackCodec{[](std::string&) {}, hpack::encode_status, hpack::encode_field,
+                             hpack::encode_header_lines};
+const FieldCodec kQpackCodec{qpack::begin_section, qpack::encode_status, qpack::encode_field,
+                             qpack::encode_header_lines};
+
+std::string encoded_response_head(const Resource& r, Encoding e, const FieldCodec& codec) {
+  const auto& rep = r.reps[static_cast<std::size_t>(e)];
+  const auto& etag = r.etags[static_cast<std::size_t>(e)];
+  std::string block;
+  codec.begin(block);
+  codec.status(block, 200);
+  codec.field(block, "server", "mtserve");
+  codec.field(block, "content-type", r.content_type);
+  codec.field(block, "content-length", std::to_string(rep.size));
+  if (e != Encoding::identity) codec.field(block, "content-encoding", encoding_token(e));
+  if (!etag.empty()) codec.field(block, "etag", etag);
+  if (!r.dictionary_id.empty()) {
+    codec.field(block, "vary", "accept-encoding, available-dictionary");
+  } else if (r.has_variants()) {
+    codec.field(block, "vary", "accept-encoding");
+  }
+  codec.lines(block, r.headers);
+  return block;
+}
+
+std::string serialize_responses(const Site& site) {
+  std::vector<ResponseEntry> entries;
+  std::string strings, blobs;
+  for (const auto& r : site.resources()) {
+    for (std::size_t e = 0; e < kEncodingCount; ++e) {
+      const auto& rep = r.reps[e];
+      if (e > 0 && rep.size == 0) continue;
+      auto head = response_head(r, static_cast<Encoding>(e));
+      ResponseEntry entry{};
+      entry.path = static_cast<std::uint32_t>(strings.size());
+      entry.path_size = static_cast<std::uint32_t>(r.path.size());
+      strings += r.path;
+      entry.etag = static_cast<std::uint32_t>(strings.size());
+      entry.etag_size = static_cast<std::uint32_t>(r.etags[e].size());
+      strings += r.etags[e];
+      entry.encoding = static_cast<std::uint8_t>(e);
+      entry.inline_body = rep.size <= kInlineBodyLimit;
+      entry.head_size = static_cast<std::uint32_t>(head.size());
+      entry.blob = blobs.size();
+      entry.body_size = rep.size;
+      blobs += head;
+      if (entry.inline_body) append_body(blobs, r, rep);
+      entries.push_back(entry);
+    }
+  }
+  if (strings.size() > UINT32_MAX) throw std::runtime_error("too many paths for " + std::string(kResponsesName));
+
+  ResponsesHeader h{};
+  std::memcpy(h.magic, kResponsesMagic, sizeof kResponsesMagic);
+  h.entry_count = static_cast<std::uint32_t>(entries.size());
+  h.entries = sizeof h;
+  h.strings = h.entries + entries.size() * sizeof(ResponseEntry);
+  h.blobs = h.strings + strings.size();
+  h.size = h.blobs + blobs.size();
+  std::string out;
+  out.reserve(h.size);
+  append_raw(out, h);
+  for (const auto& entry : entries) append_raw(out, entry);
+  out += strings;
+  out += blobs;
+  return out;
+}
+
+ResponsePack::ResponsePack(ResponsePack&& other) noexcept
+    : data_(std::exchange(other.data_, nullptr)),
+      size_(std::exchange(other.size_, 0)),
+      header_(std::exchange(other.header_, nullptr)),
+      entries_(std::exchange(other.entries_, nullptr)) {}
+
+ResponsePack& ResponsePack::operator=(ResponsePack&& other) noexcept {
+  if (this != &other) {
+    if (data_ != nullptr) ::munmap(const_cast<char*>(data_), size_);
+    data_ = std::exchange(other.data_, nullptr);
+    size_ = std::exchange(other.size_, 0);
+    header_ = std::exchange(other.header_, nullptr);
+    entries_ = std::exchange(other.entries_, nullptr);
+  }
+  return *this;
+}
+
+ResponsePack::~ResponsePack() {
+  if (data_ != nullptr) ::munmap(const_cast<char*>(data_), size_);
+}
+
+ResponsePack ResponsePack::open(const std::filesystem::path& path) {
+  ResponsePack pack;
+  int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    if (errno == ENOENT) return pack;
+    throw std::runtime_error("cannot open " + path.string() + ": " + std::strerror(errno));
+  }
+  struct stat st {};
+  void* map = MAP_FAILED;
+  if (::fstat(fd, &st) == 0 && st.st_size > 0) {
+    map = ::mmap(nullptr, static_cast<std::size_t>(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+  }
+  int err = errno;
+  ::close(fd);
+  if (map == MAP_FAILED) throw std::runtime_error("cannot map " + path.string() + ": " + std::strerror(err));
+  pack.data_ = static_cast<const char*>(map);
+  pack.size_ = static_cast<std::size_t>(st.st_size);
+
+  auto invalid = [&] { return std::runtime_error("not a valid responses file: " + path.string()); };
+  if (pack.size_ < sizeof(ResponsesHeader)) throw invalid();
+  const auto* h = reinterpret_cast<const ResponsesHeader*>(pack.data_);
+  bool ordered = h->entries == sizeof(ResponsesHeader) &&
+                 h->entries + std::uint64_t{h->entry_count} * sizeof(ResponseEntry) <= h->strings &&
+                 h->strings <= h->blobs && h->blobs <= h->size;
+  if (std::memcmp(h->magic, kResponsesMagic, sizeof kResponsesMagic) != 0 || h->size != pack.size_ || !ordered) {
+    throw invalid();
+  }
+  // Every entry is checked once here, so the accessors need not be.
+  const auto* entries = reinterpret_cast<const ResponseEntry*>(pack.data_ + h->entries);
+  auto strings = h->blobs - h->strings;
+  auto blobs = h->size - h->blobs;
+  for (std::uint32_t i = 0; i < h->entry_count; ++i) {
+    const auto& e = entries[i];
+    bool valid = std::uint64_t{e.path} + e.path_size <= strings && std::uint64_t{e.etag} + e.etag_size <= strings &&
+                 e.encoding < kEncodingCount && e.blob <= blobs && e.head_size <= blobs - e.blob &&
+                 (!e.inline_body || e.body_size <= blobs - e.blob - e.head_size);
+    if (!valid) throw invalid();
+  }
+  pack.header_ = h;
+  pack.entries_ = entries;
+  return pack;
+}
+
+}  // namespace mt
@@ -0,0 +1,114 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <string_view>
+
+#include "encoding.h"
+
+namespace mt {
+
+class Site;
+struct Resource;
+
+// The pre-serialized responses `mtsite build` writes to ".mtsite-responses"
+// in the site root, and mtserve maps so that answering a GET formats
+// nothing but the Date line.
+//
+// Every representation of every file has an entry holding its 200 response
+// head: the status line and every header except Date and Connection,
+// without the blank line that ends it. Bodies of at most kInlineBodyLimit
+// bytes follow their head directly, so such a response is one write from
+// the mapping; larger ones are still sent from their own file.
+//
+// Layout, little-endian:
+//   ResponsesHeader
+//   ResponseEntry[entry_count]  sorted by path, then encoding
+//   strings                     path and ETag bytes, unterminated
+//   blobs                       each head, then its body if inlined
+inline constexpr std::string_view kResponsesName = ".mtsite-responses";
+inline constexpr std::size_t kInlineBodyLimit = 16 * 1024;
+inline constexpr char kResponsesMagic[8] = {'M', 'T', 'R', 'E', 'S', 'P', '\0', '\1'};
+
+struct ResponsesHeader {
+  char magic[8];
+  std::uint32_t entry_count;
+  std::uint32_t reserved;
+  std::uint64_t entries;  // offsets from the start of the file
+  std::uint64_t strings;
+  std::uint64_t blobs;
+  std::uint64_t size;  // of the whole file
+};
+
+struct ResponseEntry {
+  std::uint32_t path, path_size;  // offsets into strings
+  std::uint32_t etag, etag_size;  // the representation's ETag, quoted
+  std::uint8_t encoding;          // an Encoding
+  std::uint8_t inline_body;       // 1 if the body follows the head
+  std::uint16_t reserved;
+  std::uint32_t head_size;
+  std::uint64_t blob;       // offset into blobs
+  std::uint64_t body_size;  // of the representation, inlined or not
+};
+
+// The 200 response head of `r` in encoding `e`, laid out as described
+// above. Worker::respond writes the same fields when a site has no entry.
+std::string response_head(const Resource& r, Encoding e);
+
+// The field encoders of HTTP/2 (hpack) and HTTP/3 (qpack), whose heads
+// carry the same fields in different formats.
+struct FieldCodec {
+  void (*begin)(std::string& out);  // the start of every head
+  void (*status)(std::string& out, int status);
+  void (*field)(std::string& out, std::string_view name, std::string_view value);
+  void (*lines)(std::string& out, std::string_view lines);  // "Name: value\r\n" lines
+};
+extern const FieldCodec kHpackCodec;
+extern const FieldCodec kQpackCodec;
+
+// The same head as an HTTP/2 header block or HTTP/3 field section, encoded
+// statelessly so that it can be sent on any connection as is.
+std::string encoded_response_head(const Resource& r, Encoding e, const FieldCodec& codec);
+
+// Every representation of `site` in the layout above, bodies read from
+// the site's files. Throws std::runtime_error.
+std::string serialize_responses(const Site& site);
+
+// A read-only mapping of a responses file. An unopened one has no entries.
+class ResponsePack {
+ public:
+  ResponsePack() = default;
+  ResponsePack(ResponsePack&& other) noexcept;
+  ResponsePack& operator=(ResponsePack&& other) noexcept;
+  ResponsePack(const ResponsePack&) = delete;
+  ResponsePack& operator=(const ResponsePack&) = delete;
+  ~ResponsePack();
+
+  // Maps `path`. A missing file opens as empty. Throws std::runtime_error
+  // if it cannot be read or is not a valid responses file.
+  static ResponsePack open(const std::filesystem::path& path);
+
+  std::size_t size() const { return header_ == nullptr ? 0 : header_->entry_count; }
+  const ResponseEntry& entry(std::size_t i) const { return entries_[i]; }
+  std::string_view path(const ResponseEntry& e) const { return string(e.path, e.path_size); }
+  std::string_view etag(const ResponseEntry& e) const { return string(e.etag, e.etag_size); }
+  std::string_view head(const ResponseEntry& e) const { return {data_ + header_->blobs + e.blob, e.head_size}; }
+  // The inlined body; null if it was not inlined.
+  const char* body(const ResponseEntry& e) const {
+    return e.inline_body ? data_ + header_->blobs + e.blob + e.head_size : nullptr;
+  }
+
+ private:
+  std::string_view string(std::uint32_t offset, std::uint32_t size) const {
+    return {data_ + header_->strings + offset, size};
+  }
+
+  const char* data_ = nullptr;
+  std::size_t size_ = 0;
+  const ResponsesHeader* header_ = nullptr;
+  const ResponseEntry* entries_ = nullptr;
+};
+
+}  // namespace mt
@@ -0,0 +1,408 @@
+#include "search.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <charconv>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+#include <utility>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+namespace mt {
+
+namespace {
+
+// BM25 term-frequency saturation and length normalization.
+constexpr float kK1 = 1.2f;
+constexpr float kB = 0.75f;
+
+bool word_byte(unsigned char c) {
+  return c >= 0x80 || static_cast<unsigned char>((c | 0x20) - 'a') < 26 || static_cast<unsigned char>(c - '0') < 10;
+}
+
+// Stream VByte tables, by control byte: the total data length of its four
+// values, and the PSHUFB mask that spreads those bytes into four u32 lanes.
+struct VByteTables {
+  std::array<std::uint8_t, 256> length{};
+  std::array<std::array<std::uint8_t, 16>, 256> shuffle{};
+};
+
+constexpr VByteTables make_vbyte_tables() {
+  VByteTables t;
+  for (unsigned c = 0; c < 256; ++c) {
+    unsigned at = 0;
+    for (unsigned i = 0; i < 4; ++i) {
+      unsigned bytes = ((c >> (2 * i)) & 3) + 1;
+      for (unsigned k = 0; k < 4; ++k) {
+        t.shuffle[c][4 * i + k] = static_cast<std::uint8_t>(k < bytes ? at + k : 0x80);
+      }
+      at += bytes;
+    }
+    t.length[c] = static_cast<std::uint8_t>(at);
+  }
+  return t;
+}
+
+constexpr VByteTables kVByte = make_vbyte_tables();
+
+void decode_scalar(const std::uint8_t* control, std::size_t groups, const std::uint8_t* data, std::uint32_t* out) {
+  for (std::size_t g = 0; g < groups; ++g) {
+    for (unsigned i = 0; i < 4; ++i) {
+      unsigned bytes = ((control[g] >> (2 * i)) & 3) + 1;
+      std::uint32_t v = 0;
+      for (unsigned k = 0; k < bytes; ++k) v |= static_cast<std::uint32_t>(data[k]) << (8 * k);
+      *out++ = v;
+      data += bytes;
+    }
+  }
+}
+
+#if defined(__x86_64__)
+
+// Reads up to 15 bytes past the last group's data; the index ends in
+// kSearchPadding zero bytes for this.
+[[gnu::target("ssse3")]] void decode_ssse3(const std::uint8_t* control, std::size_t groups, const std::uint8_t* data,
+                                           std::uint32_t* out) {
+  for (std::size_t g = 0; g < groups; ++g) {
+    auto c = control[g];
+    auto v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data));
+    auto mask = _mm_loadu_si128(reinterpret_cast<const __m128i*>(kVByte.shuffle[c].data()));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out + 4 * g), _mm_shuffle_epi8(v, mask));
+    data += kVByte.length[c];
+  }
+}
+
+const bool kHaveSsse3 = __builtin_cpu_supports("ssse3");
+
+#endif
+
+// Decodes the block of `count` values (a multiple of four) at `p` into
+// `out`. Returns the end of the block, or nullptr if it would run past
+// `end`, the start of the padding.
+const std::uint8_t* decode_block(const std::uint8_t* p, std::size_t count, const std::uint8_t* end,
+                                 std::uint32_t* out) {
+  auto groups = count / 4;
+  if (static_cast<std::size_t>(end - p) < groups) return nullptr;
+  const auto* data = p + groups;
+  std::size_t length = 0;
+  for (std::size_t g = 0; g < groups; ++g) length += kVByte.length[p[g]];
+  if (static_cast<std::size_t>(end - data) < length) return nullptr;
+#if defined(__x86_64__)
+  if (kHaveSsse3) {
+    decode_ssse3(p, groups, data, out);
+    return data + length;
+  }
+#endif
+  decode_scalar(p, groups, data, out);
+  return data + length;
+}
+
+bool better(const SearchHit& a, const SearchHit& b) {
+  return a.score > b.score || (a.score == b.score && a.url < b.url);
+}
+
+int hex_digit(char c) {
+  if (c >= '0' && c <= '9') return c - '0';
+  c = static_cast<char>(c | 0x20);
+  if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+  return -1;
+}
+
+void append_json_string(std::string_view s, std::string& out) {
+  static constexpr char kHex[] = "0123456789abcdef";
+  out += '"';
+  for (char ch : s) {
+    auto c = static_cast<unsigned char>(ch);
+    if (c == '"' || c == '\\') {
+      out += '\\';
+      out += ch;
+    } else if (c < 0x20) {
+      out += "\\u00";
+      out += kHex[c >> 4];
+      out += kHex[c & 15];
+    } else {
+      out += ch;
+    }
+  }
+  out += '"';
+}
+
+}  // namespace
+
+std::string_view next_search_term(std::string_view& text, std::array<char, kMaxSearchTerm>& buffer) {
+  std::size_t i = 0;
+  while (i < text.size() && !word_byte(static_cast<unsigned char>(text[i]))) ++i;
+  if (i == text.size()) {
+    text = {};
+    return {};
+  }
+  auto j = i;
+  while (j < text.size() && word_byte(static_cast<unsigned char>(text[j]))) ++j;
+  auto size = std::min(j - i, kMaxSearchTerm);
+  for (std::size_t k = 0; k < size; ++k) {
+    char c = text[i + k];
+    buffer[k] = c >= 'A' && c <= 'Z' ? static_cast<char>(c | 0x20) : c;
+  }
+  text.remove_prefix(j);
+  return {buffer.data(), size};
+}
+
+bool next_search_term(std::string_view& text, std::string& term) {
+  std::array<char, kMaxSearchTerm> buffer;
+  auto found = next_search_term(text, buffer);
+  if (found.empty()) return false;
+  term.assign(found);
+  return true;
+}
+
+// Walks one term's postings a block at a time.
+class SearchIndex::Cursor {
+ public:
+  void start(const SearchIndex& index, const SearchTerm& term) {
+    left_ = term.docs;
+    last_ = 0;
+    const auto* base = reinterpret_cast<const std::uint8_t*>(index.data_);
+    end_ = base + index.size_ - kSearchPadding;
+    auto postings = index.header_->postings;
+    p_ = postings + term.postings < index.size_ - kSearchPadding ? base + postings + term.postings : end_;
+    doc_count_ = index.header_->doc_count;
+    auto n = static_cast<double>(doc_count_);
+    auto df = static_cast<double>(term.docs);
+    idf_ = static_cast<float>(std::log(1 + (n - df + 0.5) / (df + 0.5)));
+    next_block();
+  }
+
+  bool done() const { return at_ == count_; }
+  std::uint32_t doc() const { return values_[at_]; }
+  std::uint32_t frequency() const { return values_[count_ + at_]; }
+  float idf() const { return idf_; }
+
+  void advance() {
+    if (++at_ == count_) next_block();
+  }
+
+ private:
+  void next_block() {
+    at_ = count_ = 0;
+    if (left_ == 0) return;
+    auto n = std::min(left_, kSearchBlock);
+    p_ = decode_block(p_, (2 * n + 3) & ~3u, end_, values_.data());
+    if (p_ == nullptr) {  // corrupt: treat the list as ending here
+      left_ = 0;
+      return;
+    }
+    for (std::uint32_t i = 0; i < n; ++i) {
+      last_ += values_[i];
+      values_[i] = last_;
+      if (last_ >= doc_count_) {
+        left_ = 0;
+        return;
+      }
+    }
+    left_ -= n;
+    count_ = n;
+  }
+
+  const std::uint8_t* p_ = nullptr;
+  const std::uint8_t* end_ = nullptr;
+  std::uint32_t left_ = 0;  // postings in blocks not yet decoded
+  std::uint32_t doc_count_ = 0;
+  std::uint32_t last_ = 0;
+  std::uint32_t at_ = 0, count_ = 0;
+  float idf_ = 0;
+  std::array<std::uint32_t, 2 * kSearchBlock + 4> values_;  // doc ids, then frequencies
+};
+
+SearchIndex::SearchIndex(SearchIndex&& other) noexcept
+    : data_(std::exchange(other.data_, nullptr)),
+      size_(std::exchange(other.size_, 0)),
+      header_(std::exchange(other.header_, nullptr)),
+      docs_(std::exchange(other.docs_, nullptr)),
+      terms_(std::exchange(other.terms_, nullptr)),
+      mapped_(std::exchange(other.mapped_, false)) {}
+
+SearchIndex& SearchIndex::operator=(SearchIndex&& other) noexcept {
+  if (this != &other) {
+    if (mapped_) ::munmap(const_cast<char*>(data_), size_);
+    data_ = std::exchange(other.data_, nullptr);
+    size_ = std::exchange(other.size_, 0);
+    header_ = std::exchange(other.header_, nullptr);
+    docs_ = std::exchange(other.docs_, nullptr);
+    terms_ = std::exchange(other.terms_, nullptr);
+    mapped_ = std::exchange(other.mapped_, false);
+  }
+  return *this;
+}
+
+SearchIndex::~SearchIndex() {
+  if (mapped_) ::munmap(const_cast<char*>(data_), size_);
+}
+
+SearchIndex SearchIndex::open(const std::filesystem::path& path) {
+  SearchIndex index;
+  int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    if (errno == ENOENT) return index;
+    throw std::runtime_error("cannot open " + path.string() + ": " + std::strerror(errno));
+  }
+  struct stat st {};
+  void* map = MAP_FAILED;
+  if (::fstat(fd, &st) == 0 && st.st_size > 0) {
+    map = ::mmap(nullptr, static_cast<std::size_t>(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+  }
+  int err = errno;
+  ::close(fd);
+  if (map == MAP_FAILED) throw std::runtime_error("cannot map " + path.string() + ": " + std::strerror(err));
+  index.data_ = static_cast<const char*>(map);
+  index.size_ = static_cast<std::size_t>(st.st_size);
+  index.mapped_ = true;
+  index.attach(path.string());
+  // Term lookups and postings land anywhere in the file.
+  ::madvise(map, index.size_, MADV_RANDOM);
+  return index;
+}
+
+SearchIndex SearchIndex::view(std::string_view bytes) {
+  SearchIndex index;
+  if (bytes.empty()) return index;
+  index.data_ = bytes.data();
+  index.size_ = bytes.size();
+  index.attach("the embedded index");
+  return index;
+}
+
+void SearchIndex::attach(const std::string& name) {
+  auto invalid = [&] { return std::runtime_error("not a valid search index: " + name); };
+  if (size_ < sizeof(SearchHeader) || reinterpret_cast<std::uintptr_t>(data_) % 8 != 0) throw invalid();
+  const auto* h = reinterpret_cast<const SearchHeader*>(data_);
+  bool aligned = (h->docs | h->terms | h->strings | h->postings) % 8 == 0;
+  bool ordered = sizeof(SearchHeader) <= h->docs &&
+                 h->docs + std::uint64_t{h->doc_count} * sizeof(SearchDoc) <= h->terms &&
+                 h->terms + std::uint64_t{h->term_count} * sizeof(SearchTerm) <= h->strings &&
+                 h->strings <= h->postings && h->postings + kSearchPadding <= h->size;
+  if (std::memcmp(h->magic, kSearchMagic, sizeof kSearchMagic) != 0 || h->size != size_ || !aligned || !ordered) {
+    throw invalid();
+  }
+  header_ = h;
+  docs_ = reinterpret_cast<const SearchDoc*>(data_ + h->docs);
+  terms_ = reinterpret_cast<const SearchTerm*>(data_ + h->terms);
+}
+
+std::string_view SearchIndex::string(std::uint32_t offset, std::uint32_t size) const {
+  auto strings = header_->strings;
+  if (std::uint64_t{offset} + size > header_->postings - strings) return {};
+  return {data_ + strings + offset, size};
+}
+
+const SearchTerm* SearchIndex::find(std::string_view term) const {
+  const auto* end = terms_ + header_->term_count;
+  const auto* found = std::lower_bound(terms_, end, term, [this](const SearchTerm& t, std::string_view key) {
+    return string(t.text, t.text_size) < key;
+  });
+  return found != end && string(found->text, found->text_size) == term ? found : nullptr;
+}
+
+std::vector<SearchHit> SearchIndex::search(std::string_view query, std::size_t limit) const {
+  std::vector<SearchHit> hits;
+  if (empty() || limit == 0) return hits;
+
+  std::array<Cursor, kMaxQueryTerms> cursors;  // each holds one decoded block
+  const SearchTerm* seen[kMaxQueryTerms];
+  std::size_t n = 0;
+  std::array<char, kMaxSearchTerm> buffer;
+  std::string_view term;
+  while (n < kMaxQueryTerms && !(term = next_search_term(query, buffer)).empty()) {
+    const auto* t = find(term);
+    if (t == nullptr || std::find(seen, seen + n, t) != seen + n) continue;
+    seen[n] = t;
+    cursors[n++].start(*this, *t);
+  }
+
+  // Document at a time: score the lowest doc any cursor is on, then move
+  // those cursors past it. `hits` is a heap with the worst hit on top.
+  hits.reserve(limit);
+  auto average = std::max(header_->average_length, 1.0f);
+  for (;;) {
+    auto doc = UINT32_MAX;
+    for (std::size_t i = 0; i < n; ++i) {
+      if (!cursors[i].done()) doc = std::min(doc, cursors[i].doc());
+    }
+    if (doc == UINT32_MAX) break;
+    const auto& d = docs_[doc];
+    auto norm = kK1 * (1 - kB + kB * static_cast<float>(d.length) / average);
+    float score = 0;
+    for (std::size_t i = 0; i < n; ++i) {
+      auto& c = cursors[i];
+      if (c.done() || c.doc() != doc) continue;
+      auto tf = static_cast<float>(c.frequency());
+      score += c.idf() * tf * (kK1 + 1) / (tf + norm);
+      c.advance();
+    }
+    SearchHit hit{string(d.url, d.url_size), string(d.title, d.title_size), score};
+    if (hits.size() < limit) {
+      hits.push_back(hit);
+      std::push_heap(hits.begin(), hits.end(), better);
+    } else if (better(hit, hits.front())) {
+      std::pop_heap(hits.begin(), hits.end(), better);
+      hits.back() = hit;
+      std::push_heap(hits.begin(), hits.end(), better);
+    }
+  }
+  std::sort_heap(hits.begin(), hits.end(), better);
+  return hits;
+}
+
+void search_json(const std::vector<SearchHit>& hits, std::string& out) {
+  out += "{\"results\":[";
+  for (std::size_t i = 0; i < hits.size(); ++i) {
+    if (i > 0) out += ',';
+    out += "{\"url\":";
+    append_json_string(hits[i].url, out);
+    out += ",\"title\":";
+    append_json_string(hits[i].title, out);
+    char score[32];
+    auto r = std::to_chars(score, score + sizeof score, hits[i].score, std::chars_format::fixed, 4);
+    out += ",\"score\":";
+    out.append(score, r.ptr);
+    out += '}';
+  }
+  out += "]}\n";
+}
+
+std::string query_parameter(std::string_view query, std::string_view name) {
+  while (!query.empty()) {
+    auto amp = query.find('&');
+    auto pair = query.substr(0, amp);
+    query = amp == std::string_view::npos ? std::string_view() : query.substr(amp + 1);
+    auto eq = pair.find('=');
+    if (pair.substr(0, eq) != name) continue;
+    auto value = eq == std::string_view::npos ? std::string_view() : pair.substr(eq + 1);
+    std::string out;
+    for (std::size_t i = 0; i < value.size(); ++i) {
+      int hi = 0, lo = 0;
+      if (value[i] == '+') {
+        out += ' ';
+      } else if (value[i] == '%' && i + 2 < value.size() && (hi = hex_digit(value[i + 1])) >= 0 &&
+                 (lo = hex_digit(value[i + 2])) >= 0) {
+        out += static_cast<char>(hi << 4 | lo);
+        i += 2;
+      } else {
+        out += value[i];
+      }
+    }
+    return out;
+  }
+  return {};
+}
+
+}  // namespace mt
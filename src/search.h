@@ -0,0 +1,137 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace mt {
+
+// The full-text index `mtsite build` writes to ".mtsite-search" in the site
+// root, and the reader mtserve answers /search?q= from.
+//
+// The file is used exactly as mapped: opening it checks the header and the
+// table bounds, and a query binary-searches the sorted term table and
+// decodes the postings in place. There is nothing to parse or load, so the
+// first query pays only for the pages it touches.
+//
+// Layout, little-endian, each section 8-byte aligned:
+//   SearchHeader
+//   SearchDoc[doc_count]      URL, title and length of each document
+//   SearchTerm[term_count]    sorted by term bytes
+//   strings                   URL, title and term bytes, unterminated
+//   postings                  per term, blocks of up to kSearchBlock postings
+//   16 zero bytes             so a vector decode may read past the last block
+//
+// A block of n postings holds 2n values, the n doc-id gaps (from the previous
+// doc id; the first from 0) and then the n term frequencies, padded with
+// zeros to a multiple of four. They are Stream VByte coded: one control
+// byte per four values, each 2-bit field one less than that value's byte
+// length, followed by every value's bytes. One PSHUFB decodes four values.
+inline constexpr std::string_view kSearchIndexName = ".mtsite-search";
+inline constexpr std::uint32_t kSearchBlock = 128;
+inline constexpr std::size_t kSearchPadding = 16;
+inline constexpr char kSearchMagic[8] = {'M', 'T', 'S', 'R', 'C', 'H', '\0', '\1'};
+
+struct SearchHeader {
+  char magic[8];
+  std::uint32_t doc_count;
+  std::uint32_t term_count;
+  float average_length;  // terms per document
+  std::uint32_t reserved;
+  std::uint64_t docs;      // offsets from the start of the file
+  std::uint64_t terms;
+  std::uint64_t strings;
+  std::uint64_t postings;
+  std::uint64_t size;  // of the whole file
+};
+
+struct SearchDoc {
+  std::uint32_t url, url_size;  // offsets into strings
+  std::uint32_t title, title_size;
+  std::uint32_t length;  // terms in the document
+};
+
+struct SearchTerm {
+  std::uint32_t text;  // offset into strings
+  std::uint32_t text_size;
+  std::uint32_t docs;      // documents containing it
+  std::uint32_t reserved;
+  std::uint64_t postings;  // offset into postings
+};
+
+// Splits text into search terms: runs of ASCII letters and digits and of
+// non-ASCII bytes, ASCII-lowercased, at most kMaxSearchTerm bytes (longer
+// runs are cut). Advances `text` past the term written to `term`; returns
+// false when no terms are left. The build and the query side share it, so
+// they agree on what a term is.
+inline constexpr std::size_t kMaxSearchTerm = 64;
+bool next_search_term(std::string_view& text, std::string& term);
+// The same, lowercasing into `buffer` instead, for callers that must not
+// allocate. Returns the term, in `buffer`, or an empty view when no terms
+// are left.
+std::string_view next_search_term(std::string_view& text, std::array<char, kMaxSearchTerm>& buffer);
+
+struct SearchHit {
+  std::string_view url;    // point into the index
+  std::string_view title;  // plain text
+  float score = 0;
+};
+
+// A read-only mapping of a search index. An unopened index has no documents.
+class SearchIndex {
+ public:
+  SearchIndex() = default;
+  SearchIndex(SearchIndex&& other) noexcept;
+  SearchIndex& operator=(SearchIndex&& other) noexcept;
+  SearchIndex(const SearchIndex&) = delete;
+  SearchIndex& operator=(const SearchIndex&) = delete;
+  ~SearchIndex();
+
+  // Maps `path`. A missing file opens as empty. Throws std::runtime_error
+  // if it cannot be read or is not a valid index.
+  static SearchIndex open(const std::filesystem::path& path);
+  // An index over `bytes`, which must be 8-byte aligned and outlive it, as
+  // mtembed's copy of a site's index is. Empty `bytes` is an empty index.
+  // Throws std::runtime_error if they are not a valid index.
+  static SearchIndex view(std::string_view bytes);
+
+  // The whole index, as open() or view() found it.
+  std::string_view bytes() const { return {data_, size_}; }
+
+  bool empty() const { return header_ == nullptr || header_->doc_count == 0; }
+
+  // Ranks the documents containing any term of `query` by BM25 and returns
+  // the best `limit`, best first. Only the first kMaxQueryTerms distinct
+  // terms count. Allocates nothing but the result.
+  static constexpr std::size_t kMaxQueryTerms = 8;
+  std::vector<SearchHit> search(std::string_view query, std::size_t limit) const;
+
+ private:
+  class Cursor;
+
+  // Checks the header at data_ and points the tables into it.
+  void attach(const std::string& name);
+  std::string_view string(std::uint32_t offset, std::uint32_t size) const;
+  const SearchTerm* find(std::string_view term) const;
+
+  const char* data_ = nullptr;
+  std::size_t size_ = 0;
+  const SearchHeader* header_ = nullptr;
+  const SearchDoc* docs_ = nullptr;
+  const SearchTerm* terms_ = nullptr;
+  bool mapped_ = false;  // data_ is ours to unmap
+};
+
+// `hits` as the /search response body:
+// {"results":[{"url":"/a.html","title":"A","score":1.5},...]}
+void search_json(const std::vector<SearchHit>& hits, std::string& out);
+
+// The value of `name` in a query string ("a=1&q=x"), with %XX and '+'
+// decoded; empty if absent.
+std::string query_parameter(std::string_view query, std::string_view name);
+
+}  // namespace mt
@@ -0,0 +1,2115 @@
+#include "server.h"
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <linux/filter.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <netinet/udp.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/resource.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <charconv>
+#include <cstring>
+#include <ctime>
+#include <mutex>
+#include <set>
+#include <span>
+#include <stdexcept>
+#include <string_view>
+#include <unordered_map>
+
+#include "hpack.h"
+#include "http.h"
+#include "http2.h"
+#include "qpack.h"
+#include "responses.h"
+#include "search.h"
+#ifdef MT_HAVE_OPENSSL
+#include "http3.h"
+#include "tls.h"
+#endif
+#ifdef MT_HAVE_IO_URING
+#include "uring.h"
+#endif
+
+namespace mt {
+
+namespace {
+
+constexpr std::size_t kRecvBufSize = 8192;
+constexpr std::size_t kHeadBufSize = 512 + kMaxExtraHeaders;
+// Responses to pipelined requests are queued, up to this many, and sent
+// together with one sendmsg.
+constexpr std::size_t kMaxBatch = 16;
+constexpr std::size_t kOutBufSize = 4 * kHeadBufSize;
+constexpr int kMaxEvents = 256;
+
+#ifdef MT_HAVE_IO_URING
+// io_uring (ServerOptions::io_uring). Receives take kRecvBufSize buffers
+// from a ring of kRecvBuffers that a worker's connections share. One that
+// holds kMaxHeld of them it has no room for yet stops receiving until it
+// has served them. Files are read kFileChunk at a time, into one of
+// kFileBuffers registered buffers or, when all are taken, one of the
+// connection's own.
+constexpr unsigned kRingEntries = 1024;
+constexpr std::uint16_t kRecvGroup = 0;
+constexpr unsigned kRecvBuffers = 256;
+constexpr std::size_t kMaxHeld = 4;
+constexpr std::size_t kFileChunk = 128 * 1024;
+constexpr std::size_t kFileBuffers = 8;
+
+// A completion's user_data: the Connection it is for, or null for the
+// worker's own operations, with the operation in the low bits. kOpSend
+// also marks the read before a send; kOpSendLast ends a step.
+enum Op : std::uint64_t { kOpRecv, kOpSend, kOpSendLast, kOpClose, kOpCancel, kOpAccept, kOpEpoll };
+constexpr std::uint64_t kOpMask = 7;
+#endif
+
+// Live reload (ServerOptions::live_reload). Paths starting with '_' are
+// never site files, so the stream cannot shadow one.
+constexpr std::string_view kReloadPath = "/_reload";
+constexpr std::string_view kReloadScript =
+    "<script>new EventSource(\"/_reload\").onmessage=()=>location.reload()</script>\n";
+constexpr std::string_view kReloadEvent = "data: reload\n\n";
+
+// Full-text search over the site's index, when it has one.
+constexpr std::string_view kSearchPath = "/search";
+constexpr std::size_t kSearchResults = 10;
+
+std::runtime_error sys_error(std::string_view what) {
+  return std::runtime_error(std::string(what) + ": " + std::strerror(errno));
+}
+
+std::uint64_t monotonic_ns() {
+  timespec ts{};
+  ::clock_gettime(CLOCK_MONOTONIC, &ts);
+  return static_cast<std::uint64_t>(ts.tv_sec) * 1000000000 + static_cast<std::uint64_t>(ts.tv_nsec);
+}
+
+struct Connection {
+  int fd = -1;
+  std::uint32_t peer = 0;  // IPv4 address, network byte order
+  bool close_after = false;
+
+  std::size_t in_off = 0;
+  std::size_t in_len = 0;
+  std::array<char, kRecvBufSize> in;
+
+  // Pending output: the queued responses, as spans for one sendmsg. Each
+  // is an optional pre-serialized head, a head written into `out` (just
+  // the lines that change per request, after a pre-serialized one) and an
+  // in-memory body: embedded, inlined in the responses file, or generated.
+  // Only the last may go on with a file range and the live-reload script.
+  // io_uring sends a file chunk and the script in the two spare spans.
+  std::array<iovec, 3 * kMaxBatch + 2> iov;
+  std::size_t iov_off = 0;
+  std::size_t iov_len = 0;
+  std::size_t responses = 0;
+  std::size_t out_len = 0;
+  std::array<char, kOutBufSize> out;
+  int file_fd = -1;
+  off_t file_off = 0;
+  std::size_t file_left = 0;
+  const Site* site = nullptr;  // owner of the queued spans and file_fd
+  const char* trailer = nullptr;
+  std::size_t trailer_left = 0;
+
+  // Generated response bodies (search results) a span points into.
+  std::string generated;
+
+  // A /_reload subscriber. It sends no further requests; its input is
+  // discarded and reloads are written to it until it hangs up.
+  bool event_stream = false;
+
+  // True until the first request: a connection that opens with the HTTP/2
+  // preface becomes an HTTP/2 one, served by `h2` from then on.
+  bool first = true;
+  std::unique_ptr<http2::Session> h2;
+  std::vector<std::uint32_t> h2_event_streams;  // its /_reload streams
+
+#ifdef MT_HAVE_OPENSSL
+  // HTTPS: the TLS session, and application data it has decrypted that
+  // `in` had no room for yet.
+  std::unique_ptr<tls::Session> tls;
+  std::string tls_input;
+  bool ktls_tried = false;
+#endif
+
+#ifdef MT_HAVE_IO_URING
+  // Served from the worker's io_uring ring. Received buffers wait in
+  // `held` (ids in the ring of provided buffers, and sizes; `held_off`
+  // bytes of the first are taken) until `in` has room. Output goes a step
+  // at a time, each one sendmsg of `msg` (see Worker::send_uring), and
+  // nothing it sends from changes until the step completes.
+  bool uring = false;
+  bool recv_armed = false;
+  bool recv_cancelled = false;
+  bool starved = false;  // its receive stopped for want of buffers
+  bool eof = false;
+  bool sending = false;
+  bool failed = false;    // an operation of the step failed
+  bool detached = false;  // closing: in Worker::closing_, not conns_
+  bool close_queued = false;
+  unsigned inflight = 0;  // operations not yet completed
+  std::vector<std::pair<std::uint16_t, std::size_t>> held;
+  std::size_t held_off = 0;
+  msghdr msg{};
+  std::size_t step_file = 0;   // file bytes in the step
+  bool step_trailer = false;   // and whether the trailer is
+  std::size_t step_bytes = 0;  // HTTP/2: bytes of pending() in it
+  char* file_buffer = nullptr;
+  std::unique_ptr<char[]> own_buffer;
+#endif
+
+  // For metrics: when the worker woke to read the first queued request,
+  // and each queued response's size. 0 when not timing.
+  std::uint64_t started = 0;
+  std::array<std::size_t, kMaxBatch> response_sizes;
+
+  bool pending() const { return iov_off < iov_len || file_left > 0 || trailer_left > 0 || tls_pending(); }
+
+  // True while the io_uring ring sends from `out`, `iov`, `generated` or
+  // the HTTP/2 session, which must not change until it is done.
+  bool uring_sending() const {
+#ifdef MT_HAVE_IO_URING
+    return sending;
+#else
+    return false;
+#endif
+  }
+
+  // True while TLS records sealed in userspace wait for the socket.
+  bool tls_pending() const {
+#ifdef MT_HAVE_OPENSSL
+    return tls && !tls->pending().empty();
+#else
+    return false;
+#endif
+  }
+
+  // True when another response can join the queue: it has room for a
+  // full head, and nothing queued must come last.
+  bool can_queue() const {
+    return responses < kMaxBatch && out.size() - out_len >= kHeadBufSize && file_left == 0 && trailer_left == 0 &&
+           generated.empty() && !close_after && !event_stream;
+  }
+
+  void queue(const char* data, std::size_t size) {
+    if (size > 0) iov[iov_len++] = {const_cast<char*>(data), size};
+  }
+  // Queues the `size` bytes just written at the end of `out`.
+  void queue_out(std::size_t size) {
+    queue(out.data() + out_len, size);
+    out_len += size;
+  }
+};
+
+// Appender for response heads, writing after what `c.out` already holds.
+// Connection::can_queue() leaves kHeadBufSize free, which bounds every head
+// we emit.
+class HeadWriter {
+ public:
+  explicit HeadWriter(Connection& c) : at_(c.out.data() + c.out_len), end_(c.out.data() + c.out.size()) {}
+  HeadWriter& operator<<(std::string_view s) {
+    std::memcpy(at_ + len_, s.data(), s.size());
+    len_ += s.size();
+    return *this;
+  }
+  HeadWriter& operator<<(std::size_t n) {
+    auto r = std::to_chars(at_ + len_, end_, n);
+    len_ = static_cast<std::size_t>(r.ptr - at_);
+    return *this;
+  }
+  std::size_t size() const { return len_; }
+
+ private:
+  char* at_;
+  char* end_;
+  std::size_t len_ = 0;
+};
+
+// The Connection header a response to `req` needs, if any, and the blank
+// line ending the head.
+void end_head(HeadWriter& w, const http::Request& req) {
+  if (!req.keep_alive) {
+    w << "Connection: close\r\n";
+  } else if (req.minor_version == 0) {
+    w << "Connection: keep-alive\r\n";
+  }
+  w << "\r\n";
+}
+
+// The fields of a file's response head after Date, for responses the
+// build did not pre-serialize. response_head() writes the same for a 200.
+void write_fields(HeadWriter& w, const Resource& r, Encoding encoding, const std::string& etag, bool not_modified,
+                  bool live_page) {
+  const auto& rep = r.reps[static_cast<std::size_t>(encoding)];
+  if (!not_modified) {
+    auto length = rep.size + (live_page ? kReloadScript.size() : 0);
+    w << "Content-Type: " << r.content_type << "\r\nContent-Length: " << length << "\r\n";
+    if (encoding != Encoding::identity) w << "Content-Encoding: " << encoding_token(encoding) << "\r\n";
+  }
+  if (live_page) w << "Cache-Control: no-store\r\n";
+  if (!etag.empty()) w << "ETag: " << etag << "\r\n";
+  if (!r.dictionary_id.empty()) {
+    w << "Vary: Accept-Encoding, Available-Dictionary\r\n";
+  } else if (r.has_variants()) {
+    w << "Vary: Accept-Encoding\r\n";
+  }
+  w << r.headers;
+}
+
+// write_fields() for HTTP/2 and HTTP/3: the fields after :status, server
+// and date.
+void stream_fields(const FieldCodec& codec, std::string& out, const Resource& r, Encoding encoding,
+                   const std::string& etag, bool not_modified, bool live_page) {
+  const auto& rep = r.reps[static_cast<std::size_t>(encoding)];
+  if (!not_modified) {
+    auto length = rep.size + (live_page ? kReloadScript.size() : 0);
+    codec.field(out, "content-type", r.content_type);
+    codec.field(out, "content-length", std::to_string(length));
+    if (encoding != Encoding::identity) codec.field(out, "content-encoding", encoding_token(encoding));
+  }
+  if (live_page) codec.field(out, "cache-control", "no-store");
+  if (!etag.empty()) codec.field(out, "etag", etag);
+  if (!r.dictionary_id.empty()) {
+    codec.field(out, "vary", "accept-encoding, available-dictionary");
+  } else if (r.has_variants()) {
+    codec.field(out, "vary", "accept-encoding");
+  }
+  codec.lines(out, r.headers);
+}
+
+// How to answer a request, decided the same way for HTTP/1.1 and HTTP/2.
+struct Answer {
+  enum class Kind { file, search, event_stream, error } kind = Kind::error;
+  int status = 200;
+  std::string_view reason;  // of an error
+  bool keep_alive = true;   // false when an HTTP/1.1 error ends the connection
+  const Resource* resource = nullptr;
+  Encoding encoding = Encoding::identity;
+  const std::string* etag = nullptr;
+  bool not_modified = false;
+  bool live_page = false;
+};
+
+// A response on an HTTP/2 or HTTP/3 stream.
+struct StreamResponse {
+  int status = 200;
+  Encoding encoding = Encoding::identity;
+  std::string head;
+  http2::Body body;
+  bool event_stream = false;  // a /_reload subscription, which stays open
+};
+
+std::size_t body_size(const http2::Body& body) {
+  return body.memory.size() + body.file_size + body.trailer.size() + body.generated.size();
+}
+
+#ifdef MT_HAVE_OPENSSL
+// HTTP/3. Datagrams are read and sent kUdpBatch messages at a time; with
+// GRO a message received may hold up to 64KB of datagrams, and with GSO
+// one sent holds up to kGsoSegments, for one client.
+constexpr std::size_t kUdpBatch = 16;
+constexpr std::size_t kUdpRecvSize = 64 * 1024;
+constexpr std::size_t kGsoSegments = 44;  // of kMaxDatagramSize, under 64KB
+constexpr std::size_t kUdpSendBatch = 64;
+constexpr std::size_t kUdpOutSize = 4 * kGsoSegments * quic::kMaxDatagramSize;
+constexpr int kUdpBufferSize = 4 << 20;
+
+// HTTPS. Protocols offered by ALPN, and how much a connection reads, or
+// encrypts, at a time while TLS is in userspace: four full records.
+const std::vector<std::string> kTlsAlpn = {"h2", "http/1.1"};
+constexpr std::size_t kTlsChunk = 4 * tls::kMaxRecord;
+
+// An HTTP/3 connection and where its client is.
+struct QuicConnection {
+  sockaddr_in peer{};
+  std::unique_ptr<http3::Session> session;
+  std::vector<std::uint64_t> event_streams;  // its /_reload streams
+  std::size_t index = 0;  // in Worker::quic_
+  std::uint64_t deadline = UINT64_MAX;  // its entry in Worker::quic_timers_
+  bool ready = false;  // in Worker::quic_ready_
+};
+
+// Ancillary data for a UDP_SEGMENT or UDP_GRO segment size.
+struct SegmentControl {
+  alignas(cmsghdr) char data[CMSG_SPACE(sizeof(int))];
+};
+#endif
+
+// A worker's SO_REUSEPORT listener on `port`. `fd` is set before anything
+// can throw, so its owner closes it.
+void listen_tcp(int& fd, const std::string& host, std::uint16_t port) {
+  fd = ::socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (fd < 0) throw sys_error("socket");
+  int one = 1;
+  ::setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof one);
+  if (::setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof one) != 0) {
+    throw sys_error("SO_REUSEPORT");
+  }
+  sockaddr_in addr{};
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  if (::inet_pton(AF_INET, host.c_str(), &addr.sin_addr) != 1) {
+    throw std::runtime_error("invalid listen address: " + host);
+  }
+  if (::bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof addr) != 0) throw sys_error("bind");
+  if (::listen(fd, SOMAXCONN) != 0) throw sys_error("listen");
+}
+
+}  // namespace
+
+class Worker {
+ public:
+  Worker(const Site& site, int cpu, bool live_reload, AccessRing* access_log, WorkerMetrics* metrics,
+         std::uint16_t index)
+      : site_(&site),
+        cpu_(cpu),
+        live_reload_(live_reload),
+        access_log_(access_log),
+        metrics_(metrics),
+        index_(index) {}
+  ~Worker();
+
+  void listen(const ServerOptions& options);
+#ifdef MT_HAVE_OPENSSL
+  void listen_tls(const ServerOptions& options, std::shared_ptr<const tls13::Credentials> credentials);
+  void listen_udp(const ServerOptions& options, std::shared_ptr<const tls13::Credentials> credentials);
+#endif
+#ifdef MT_HAVE_IO_URING
+  void listen_uring();
+#endif
+  int listen_fd() const { return listen_fd_; }
+  int tls_listen_fd() const { return tls_listen_fd_; }
+  void run();
+  // Called from other threads; the worker acts on them in its own loop.
+  void stop();
+  void reload(std::shared_ptr<const Site> site);
+
+ private:
+  void wake();
+  void take_control();
+  void switch_site(std::shared_ptr<const Site> site);
+  void dispatch(void* tag);
+  void accept_all(int listen_fd);
+  void resume(Connection& c);
+  void drive(Connection& c);
+  void discard_input(Connection& c);
+  bool handle_one(Connection& c);
+  bool flush(Connection& c);
+  void finish_output(Connection& c);
+  ssize_t read_some(Connection& c, char* buf, std::size_t size);
+  ssize_t write_some(Connection& c, const iovec* iov, std::size_t count, int flags);
+  ssize_t write_file(Connection& c, int fd, off_t* offset, std::size_t count);
+#ifdef MT_HAVE_OPENSSL
+  bool flush_tls(Connection& c);
+#endif
+  Answer decide(const http::Request& req) const;
+  void respond(Connection& c, const http::Request& req);
+  void respond_error(Connection& c, int status, std::string_view reason, bool keep_alive,
+                     const http::Request* req = nullptr);
+  void open_event_stream(Connection& c);
+  void respond_search(Connection& c, const http::Request& req);
+  void start_h2(Connection& c);
+  void drive_h2(Connection& c);
+  bool flush_h2(Connection& c, bool& blocked);
+  void finish_h2(Connection& c);
+  StreamResponse stream_response(const http::Request* req, bool h3) const;
+  void respond_h2(Connection& c, std::uint32_t stream, const http::Request* req);
+#ifdef MT_HAVE_OPENSSL
+  void receive_udp();
+  void on_datagram(std::span<std::uint8_t> datagram, const sockaddr_in& from, std::uint64_t now);
+  QuicConnection& accept_quic(const quic::Header& h, const sockaddr_in& from, std::uint64_t now);
+  void respond_h3(QuicConnection& q, std::uint64_t stream, const http::Request* req);
+  void mark_ready(QuicConnection& q);
+  void flush_udp();
+  void send_udp();
+  void run_quic_timers();
+  int quic_timeout() const;
+  void close_quic(QuicConnection& q);
+#endif
+#ifdef MT_HAVE_IO_URING
+  void run_uring();
+  void register_files(const Site& site);
+  void on_completion(const io_uring_cqe& cqe);
+  void arm_accept();
+  void arm_epoll();
+  void arm_recv(Connection& c);
+  void accept_uring(int fd);
+  void on_recv(Connection& c, int res, std::uint32_t flags);
+  void take_input(Connection& c);
+  void drop_held(Connection& c);
+  void serve_uring(Connection& c);
+  void serve_uring_h2(Connection& c);
+  void send_uring(Connection& c);
+  io_uring_sqe& queue_send(Connection& c, iovec* iov, std::size_t count, int flags);
+  void on_sent(Connection& c);
+  void close_uring(Connection& c);
+  void detach_uring(Connection& c);
+  void cancel_recv(Connection& c);
+  void queue_close(Connection& c);
+  void release_file_buffer(Connection& c);
+#endif
+  void close_conn(Connection& c);
+  void refresh_date();
+  void record_response(Connection& c, const http::Request* req, int status, Encoding encoding, std::size_t head_bytes,
+                       std::size_t body_bytes, bool prebuilt = false);
+  void count_response(std::uint32_t peer, const http::Request* req, int status, Encoding encoding,
+                      std::size_t body_bytes, bool prebuilt);
+
+  const Site* site_;
+  std::shared_ptr<const Site> owned_site_;  // site_, once reload() replaced the initial one
+  std::vector<std::shared_ptr<const Site>> retired_;  // replaced sites responses may still be sent from
+  int cpu_;
+  bool live_reload_;
+  AccessRing* access_log_;  // null when not logging
+  WorkerMetrics* metrics_;  // null when not serving metrics
+  std::uint16_t index_;
+  int listen_fd_ = -1;
+  int tls_listen_fd_ = -1;  // HTTPS (ServerOptions::tls_port)
+  int epoll_fd_ = -1;
+  int wake_fd_ = -1;
+  bool stopping_ = false;
+  std::vector<std::unique_ptr<Connection>> conns_;  // indexed by fd
+  // Connections closed during the current batch of events, freed after it:
+  // a later event in the batch may still point at one.
+  std::vector<std::unique_ptr<Connection>> closed_;
+  std::time_t date_sec_ = 0;
+  std::uint64_t now_ns_ = 0;   // at the last wakeup, for access log records
+  std::uint64_t wake_ns_ = 0;  // monotonic, at the last wakeup, for metrics
+  std::array<char, 40> date_{};
+  std::size_t date_len_ = 0;
+  std::string h2_date_;  // date_ as an HTTP/2 date field
+  std::string h3_date_;  // and as an HTTP/3 one
+
+#ifdef MT_HAVE_OPENSSL
+  bool ktls_ = false;
+  std::vector<char> tls_buf_;  // records read, or file data to encrypt
+
+  // HTTP/3 (ServerOptions::h3_port). Connections are found by the IDs
+  // their packets are sent to: ours, and the one the client first chose.
+  int udp_fd_ = -1;
+  bool gso_ = false;
+  bool gro_ = false;
+  std::shared_ptr<const tls13::Credentials> credentials_;
+  std::vector<std::unique_ptr<QuicConnection>> quic_;
+  std::unordered_map<std::string_view, QuicConnection*> quic_routes_;
+  std::set<std::pair<std::uint64_t, QuicConnection*>> quic_timers_;
+  std::vector<QuicConnection*> quic_ready_;  // have datagrams to send
+  std::vector<char> udp_in_;
+  std::vector<char> udp_out_;
+  std::size_t udp_out_len_ = 0;
+  std::array<mmsghdr, kUdpSendBatch> udp_msgs_{};
+  std::array<iovec, kUdpSendBatch> udp_iov_{};
+  std::array<SegmentControl, kUdpSendBatch> udp_control_{};
+  std::size_t udp_msg_count_ = 0;
+  std::array<std::size_t, kUdpSendBatch> udp_sizes_{};  // segment size of each message
+  std::size_t udp_segments_ = 0;  // in the last message
+  const QuicConnection* udp_last_ = nullptr;  // its connection, while it may grow
+#endif
+
+#ifdef MT_HAVE_IO_URING
+  // io_uring (ServerOptions::io_uring). The site's files are in the ring's
+  // file table, at file_slots_[fd]. Connections that are closing wait in
+  // closing_ for their operations to complete.
+  std::unique_ptr<uring::Ring> ring_;
+  unsigned file_table_ = 0;
+  std::vector<int> file_slots_;
+  unsigned recv_buffers_free_ = 0;
+  std::vector<Connection*> starved_;  // receives to arm once buffers return
+  std::vector<char> file_buffers_;
+  std::vector<char*> free_file_buffers_;
+  bool fixed_buffers_ = false;  // file_buffers_ is registered
+  bool epoll_ready_ = false;
+  std::vector<std::unique_ptr<Connection>> closing_;
+#endif
+
+  // Requests from other threads, taken by the worker when woken.
+  std::mutex control_mu_;
+  bool stop_requested_ = false;
+  std::shared_ptr<const Site> next_site_;
+};
+
+Worker::~Worker() {
+#ifdef MT_HAVE_IO_URING
+  ring_.reset();  // before the memory its operations use
+  for (auto& c : closing_) {
+    if (!c->close_queued) ::close(c->fd);
+  }
+#endif
+  for (auto& c : conns_) {
+    if (c) ::close(c->fd);
+  }
+  if (listen_fd_ >= 0) ::close(listen_fd_);
+  if (tls_listen_fd_ >= 0) ::close(tls_listen_fd_);
+#ifdef MT_HAVE_OPENSSL
+  if (udp_fd_ >= 0) ::close(udp_fd_);
+#endif
+  if (epoll_fd_ >= 0) ::close(epoll_fd_);
+  if (wake_fd_ >= 0) ::close(wake_fd_);
+}
+
+void Worker::listen(const ServerOptions& options) {
+  listen_tcp(listen_fd_, options.host, options.port);
+
+  epoll_fd_ = ::epoll_create1(EPOLL_CLOEXEC);
+  if (epoll_fd_ < 0) throw sys_error("epoll_create1");
+  wake_fd_ = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (wake_fd_ < 0) throw sys_error("eventfd");
+
+  epoll_event ev{};
+  ev.events = EPOLLIN;
+  ev.data.ptr = nullptr;
+  if (::epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, listen_fd_, &ev) != 0) throw sys_error("epoll_ctl");
+  ev.data.ptr = &wake_fd_;
+  if (::epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, wake_fd_, &ev) != 0) throw sys_error("epoll_ctl");
+}
+
+#ifdef MT_HAVE_OPENSSL
+void Worker::listen_tls(const ServerOptions& options, std::shared_ptr<const tls13::Credentials> credentials) {
+  credentials_ = std::move(credentials);
+  ktls_ = options.ktls;
+  tls_buf_.resize(kTlsChunk);
+  listen_tcp(tls_listen_fd_, options.host, options.tls_port);
+  epoll_event ev{};
+  ev.events = EPOLLIN;
+  ev.data.ptr = &tls_listen_fd_;
+  if (::epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, tls_listen_fd_, &ev) != 0) throw sys_error("epoll_ctl");
+}
+
+void Worker::listen_udp(const ServerOptions& options, std::shared_ptr<const tls13::Credentials> credentials) {
+  credentials_ = std::move(credentials);
+  udp_fd_ = ::socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (udp_fd_ < 0) throw sys_error("socket");
+  // The kernel hashes each client's address and port to one socket of the
+  // group, so a connection stays with its worker. (The listeners' CPU
+  // steering would not: a client's datagrams may come from any CPU.)
+  int one = 1;
+  if (::setsockopt(udp_fd_, SOL_SOCKET, SO_REUSEPORT, &one, sizeof one) != 0) throw sys_error("SO_REUSEPORT");
+  ::setsockopt(udp_fd_, SOL_SOCKET, SO_RCVBUF, &kUdpBufferSize, sizeof kUdpBufferSize);
+  ::setsockopt(udp_fd_, SOL_SOCKET, SO_SNDBUF, &kUdpBufferSize, sizeof kUdpBufferSize);
+  sockaddr_in addr{};
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(options.h3_port);
+  if (::inet_pton(AF_INET, options.host.c_str(), &addr.sin_addr) != 1) {
+    throw std::runtime_error("invalid listen address: " + options.host);
+  }
+  if (::bind(udp_fd_, reinterpret_cast<sockaddr*>(&addr), sizeof addr) != 0) throw sys_error("bind");
+  if (options.udp_offload) {
+    // Kernels before 4.18 (GSO) and 5.0 (GRO) refuse these.
+    int zero = 0;
+    gso_ = ::setsockopt(udp_fd_, SOL_UDP, UDP_SEGMENT, &zero, sizeof zero) == 0;
+    gro_ = ::setsockopt(udp_fd_, SOL_UDP, UDP_GRO, &one, sizeof one) == 0;
+  }
+  udp_in_.resize(kUdpBatch * kUdpRecvSize);
+  udp_out_.resize(kUdpOutSize);
+
+  epoll_event ev{};
+  ev.events = EPOLLIN;
+  ev.data.ptr = &udp_fd_;
+  if (::epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, udp_fd_, &ev) != 0) throw sys_error("epoll_ctl");
+}
+#endif
+
+#ifdef MT_HAVE_IO_URING
+// Moves the plain HTTP listener from epoll to a ring, which run() enables
+// on the worker's thread.
+void Worker::listen_uring() {
+  if (::epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, listen_fd_, nullptr) != 0) throw sys_error("epoll_ctl");
+  // Accepted sockets inherit TCP_NODELAY, which saves a setsockopt each.
+  int one = 1;
+  ::setsockopt(listen_fd_, IPPROTO_TCP, TCP_NODELAY, &one, sizeof one);
+  ring_ = std::make_unique<uring::Ring>(kRingEntries);
+  ring_->provide_buffers(kRecvGroup, kRecvBuffers, kRecvBufSize);
+  recv_buffers_free_ = kRecvBuffers;
+  file_buffers_.resize(kFileBuffers * kFileChunk);
+  for (std::size_t i = 0; i < kFileBuffers; ++i) free_file_buffers_.push_back(file_buffers_.data() + i * kFileChunk);
+  // Unregistered, they are read into with plain READs instead.
+  fixed_buffers_ = ring_->register_buffer({file_buffers_.data(), file_buffers_.size()});
+  register_files(*site_);
+}
+
+// Puts the descriptors of `site`'s files in the ring's file table, where
+// reads find them without a descriptor lookup, replacing the last site's.
+// Files past the table's end, and those of replaced sites still being
+// sent, are read by descriptor.
+void Worker::register_files(const Site& site) {
+  std::vector<int> fds;
+  for (const auto& r : site.resources()) {
+    for (const auto& rep : r.reps) {
+      if (rep.fd >= 0) fds.push_back(rep.fd);
+    }
+  }
+  if (file_table_ == 0) {
+    rlimit files{};
+    ::getrlimit(RLIMIT_NOFILE, &files);
+    file_table_ = static_cast<unsigned>(std::min<rlim_t>(2 * fds.size() + 64, files.rlim_cur));
+    ring_->register_files(file_table_);
+  }
+  fds.resize(file_table_, -1);
+  file_slots_.clear();
+  for (unsigned i = 0; i < file_table_ && fds[i] >= 0; ++i) {
+    if (static_cast<std::size_t>(fds[i]) >= file_slots_.size()) file_slots_.resize(fds[i] + 1, -1);
+    file_slots_[fds[i]] = static_cast<int>(i);
+  }
+  // A queued read finds its slot when submitted, so those go first.
+  ring_->submit();
+  ring_->update_files(0, fds);
+}
+#endif
+
+void Worker::wake() {
+  std::uint64_t one = 1;
+  [[maybe_unused]] auto n = ::write(wake_fd_, &one, sizeof one);
+}
+
+void Worker::stop() {
+  {
+    std::lock_guard lock(control_mu_);
+    stop_requested_ = true;
+  }
+  wake();
+}
+
+void Worker::reload(std::shared_ptr<const Site> site) {
+  {
+    std::lock_guard lock(control_mu_);
+    next_site_ = std::move(site);
+  }
+  wake();
+}
+
+void Worker::take_control() {
+  std::uint64_t count = 0;
+  [[maybe_unused]] auto n = ::read(wake_fd_, &count, sizeof count);
+  std::shared_ptr<const Site> site;
+  {
+    std::lock_guard lock(control_mu_);
+    stopping_ = stop_requested_;
+    site = std::move(next_site_);
+  }
+  if (site && !stopping_) switch_site(std::move(site));
+}
+
+void Worker::switch_site(std::shared_ptr<const Site> site) {
+  if (owned_site_) retired_.push_back(std::move(owned_site_));
+  owned_site_ = std::move(site);
+  site_ = owned_site_.get();
+#ifdef MT_HAVE_IO_URING
+  if (ring_) register_files(*site_);
+#endif
+  // A replaced site closes its files and unmaps its responses when
+  // dropped, so it is kept while a response is still sending from them.
+  bool h3_active = false;
+#ifdef MT_HAVE_OPENSSL
+  h3_active = std::any_of(quic_.begin(), quic_.end(), [](const auto& q) { return q->session->active(); });
+#endif
+  std::erase_if(retired_, [&](const std::shared_ptr<const Site>& old) {
+    // HTTP/2 and HTTP/3 streams may each be from a different site.
+    return !h3_active && std::none_of(conns_.begin(), conns_.end(), [&](const std::unique_ptr<Connection>& c) {
+      if (c && c->h2) return c->h2->active();
+      return c && c->pending() && c->site == old.get();
+    });
+  });
+  for (auto& c : conns_) {
+    // Still sending earlier events: this one is dropped, as a reload
+    // already queued has the same effect.
+    if (!c || c->uring_sending()) continue;
+    if (!c->h2_event_streams.empty()) {
+      std::erase_if(c->h2_event_streams, [&](std::uint32_t id) { return !c->h2->push(id, kReloadEvent); });
+      resume(*c);
+      continue;
+    }
+    if (!c->event_stream) continue;
+    if (c->out_len + kReloadEvent.size() > c->out.size() || c->iov_len == c->iov.size()) continue;
+    std::memcpy(c->out.data() + c->out_len, kReloadEvent.data(), kReloadEvent.size());
+    c->queue_out(kReloadEvent.size());
+    resume(*c);
+  }
+#ifdef MT_HAVE_OPENSSL
+  for (auto& q : quic_) {
+    if (q->event_streams.empty()) continue;
+    std::erase_if(q->event_streams, [&](std::uint64_t id) { return !q->session->push(id, kReloadEvent); });
+    mark_ready(*q);
+  }
+  flush_udp();
+#endif
+}
+
+void Worker::run() {
+  if (cpu_ >= 0) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu_, &set);
+    ::pthread_setaffinity_np(::pthread_self(), sizeof set, &set);
+  }
+#ifdef MT_HAVE_IO_URING
+  if (ring_) return run_uring();
+#endif
+
+  std::array<epoll_event, kMaxEvents> events;
+  while (!stopping_) {
+    int timeout = -1;
+#ifdef MT_HAVE_OPENSSL
+    timeout = quic_timeout();
+#endif
+    int n = ::epoll_wait(epoll_fd_, events.data(), kMaxEvents, timeout);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      break;
+    }
+    refresh_date();
+    if (metrics_ != nullptr) wake_ns_ = monotonic_ns();
+    for (int i = 0; i < n; ++i) dispatch(events[i].data.ptr);
+    closed_.clear();
+#ifdef MT_HAVE_OPENSSL
+    run_quic_timers();
+#endif
+  }
+}
+
+// Acts on an epoll event, by the tag it was registered with.
+void Worker::dispatch(void* tag) {
+  if (tag == nullptr) {
+    accept_all(listen_fd_);
+  } else if (tag == &tls_listen_fd_) {
+    accept_all(tls_listen_fd_);
+  } else if (tag == &wake_fd_) {
+    take_control();
+#ifdef MT_HAVE_OPENSSL
+  } else if (tag == &udp_fd_) {
+    receive_udp();
+#endif
+  } else {
+    auto& c = *static_cast<Connection*>(tag);
+    if (c.fd >= 0) drive(c);  // else closed earlier in the batch
+  }
+}
+
+void Worker::accept_all(int listen_fd) {
+  for (;;) {
+    sockaddr_in peer{};
+    socklen_t peer_size = sizeof peer;
+    int fd = ::accept4(listen_fd, reinterpret_cast<sockaddr*>(&peer), &peer_size, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (fd < 0) {
+      if (errno == EINTR) continue;
+      return;  // EAGAIN, or a transient error such as EMFILE
+    }
+    int one = 1;
+    ::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof one);
+
+    if (static_cast<std::size_t>(fd) >= conns_.size()) conns_.resize(fd + 1);
+    conns_[fd] = std::make_unique<Connection>();
+    auto& c = *conns_[fd];
+    c.fd = fd;
+    c.peer = peer.sin_addr.s_addr;
+#ifdef MT_HAVE_OPENSSL
+    if (listen_fd == tls_listen_fd_) c.tls = std::make_unique<tls::Session>(credentials_, kTlsAlpn);
+#endif
+
+    epoll_event ev{};
+    ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+    ev.data.ptr = &c;
+    if (::epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, fd, &ev) != 0) {
+      close_conn(c);
+      continue;
+    }
+    drive(c);
+  }
+}
+
+// Sends what was just queued on `c`, from whichever loop serves it.
+void Worker::resume(Connection& c) {
+#ifdef MT_HAVE_IO_URING
+  if (c.uring) return serve_uring(c);
+#endif
+  drive(c);
+}
+
+// Runs a connection until it blocks: queue responses to every buffered
+// request, send them together, then read more. Reading continues to EAGAIN,
+// as edge-triggered epoll requires.
+void Worker::drive(Connection& c) {
+  if (c.h2) return drive_h2(c);
+  for (;;) {
+    bool answered = false;
+    while (c.can_queue() && handle_one(c)) answered = true;
+    if (c.h2) return drive_h2(c);
+    if (!flush(c)) return close_conn(c);
+    if (c.pending()) return;
+    if (c.close_after) return close_conn(c);
+    if (c.event_stream) return discard_input(c);
+    if (answered) continue;  // the batch was full; more may be buffered
+
+    if (c.in_off > 0) {
+      std::memmove(c.in.data(), c.in.data() + c.in_off, c.in_len - c.in_off);
+      c.in_len -= c.in_off;
+      c.in_off = 0;
+    }
+    if (c.in_len == c.in.size()) {
+      respond_error(c, 431, "Request Header Fields Too Large", false);
+      continue;
+    }
+    ssize_t n = read_some(c, c.in.data() + c.in_len, c.in.size() - c.in_len);
+    if (n > 0) {
+      c.in_len += static_cast<std::size_t>(n);
+    } else if (n == 0) {
+      return close_conn(c);
+    } else if (errno == EAGAIN) {
+      return;
+    } else if (errno != EINTR) {
+      return close_conn(c);
+    }
+  }
+}
+
+void Worker::discard_input(Connection& c) {
+  for (;;) {
+    ssize_t n = read_some(c, c.in.data(), c.in.size());
+    if (n > 0) continue;
+    if (n < 0 && errno == EINTR) continue;
+    if (n < 0 && errno == EAGAIN) return;
+    return close_conn(c);
+  }
+}
+
+// Queues the response for one buffered request. Returns false when the
+// buffer does not yet hold a complete request head.
+bool Worker::handle_one(Connection& c) {
+  std::span<char> buf(c.in.data() + c.in_off, c.in_len - c.in_off);
+  if (c.first) {
+    auto n = std::min(buf.size(), http2::kPreface.size());
+    if (std::string_view(buf.data(), n) == http2::kPreface.substr(0, n)) {
+      if (n == http2::kPreface.size()) start_h2(c);
+      return false;
+    }
+    c.first = false;
+  }
+  http::Request req;
+  std::size_t consumed = 0;
+  switch (http::parse_request(buf, req, consumed)) {
+    case http::ParseStatus::incomplete:
+      return false;
+    case http::ParseStatus::invalid:
+      respond_error(c, 400, "Bad Request", false);
+      return true;
+    case http::ParseStatus::complete:
+      break;
+  }
+  c.in_off += consumed;
+  respond(c, req);
+  return true;
+}
+
+Answer Worker::decide(const http::Request& req) const {
+  Answer a;
+  auto error = [&](int status, std::string_view reason, bool keep_alive) {
+    a.status = status;
+    a.reason = reason;
+    a.keep_alive = keep_alive;
+    return a;
+  };
+  if (req.has_body) return error(400, "Bad Request", false);
+  if (req.method == http::Method::other) return error(405, "Method Not Allowed", req.keep_alive);
+  if (live_reload_ && req.path == kReloadPath) {
+    a.kind = Answer::Kind::event_stream;
+    return a;
+  }
+  if (req.path == kSearchPath && !site_->search().empty()) {
+    a.kind = Answer::Kind::search;
+    return a;
+  }
+  const Resource* r = site_->find(req.path);
+  if (r == nullptr) return error(404, "Not Found", req.keep_alive);
+
+  // A live-reload page is its file plus the script, so it has no stored
+  // variant or tag.
+  a.kind = Answer::Kind::file;
+  a.resource = r;
+  a.live_page = live_reload_ && r->content_type.starts_with("text/html");
+  a.encoding = a.live_page ? Encoding::identity : r->select(req.accept_encoding, req.available_dictionary);
+  static const std::string kNoTag;
+  a.etag = a.live_page ? &kNoTag : &r->etags[static_cast<std::size_t>(a.encoding)];
+  // The tag is precomputed, so revalidation is a string compare: no body
+  // and no file access.
+  a.not_modified = !a.etag->empty() && !req.if_none_match.empty() && http::etag_matches(req.if_none_match, *a.etag);
+  a.status = a.not_modified ? 304 : 200;
+  return a;
+}
+
+void Worker::respond(Connection& c, const http::Request& req) {
+  auto a = decide(req);
+  switch (a.kind) {
+    case Answer::Kind::error:
+      return respond_error(c, a.status, a.reason, a.keep_alive, &req);
+    case Answer::Kind::event_stream:
+      return open_event_stream(c);
+    case Answer::Kind::search:
+      return respond_search(c, req);
+    case Answer::Kind::file:
+      break;
+  }
+  const Resource* r = a.resource;
+  auto encoding = a.encoding;
+  bool live_page = a.live_page;
+  bool not_modified = a.not_modified;
+  const auto& rep = r->reps[static_cast<std::size_t>(encoding)];
+  const auto& etag = *a.etag;
+
+  HeadWriter w(c);
+  c.site = site_;
+  bool prebuilt = !not_modified && !live_page && !rep.head.empty();
+  if (prebuilt) {
+    // Everything but Date and Connection was written by the build.
+    c.queue(rep.head.data(), rep.head.size());
+    w << "Date: " << std::string_view(date_.data(), date_len_) << "\r\n";
+  } else {
+    w << (not_modified ? "HTTP/1.1 304 Not Modified" : "HTTP/1.1 200 OK") << "\r\nServer: mtserve\r\nDate: "
+      << std::string_view(date_.data(), date_len_) << "\r\n";
+    write_fields(w, *r, encoding, etag, not_modified, live_page);
+  }
+  end_head(w, req);
+  c.queue_out(w.size());
+  c.close_after = !req.keep_alive;
+  bool body = !not_modified && req.method == http::Method::get;
+  record_response(c, &req, not_modified ? 304 : 200, encoding, (prebuilt ? rep.head.size() : 0) + w.size(),
+                  body ? rep.size + (live_page ? kReloadScript.size() : 0) : 0, prebuilt);
+  if (!body) return;
+  if (live_page) {
+    c.trailer = kReloadScript.data();
+    c.trailer_left = kReloadScript.size();
+  }
+  if (rep.size == 0) return;
+  if (rep.data != nullptr) {
+    c.queue(rep.data, rep.size);
+  } else {
+    c.file_fd = rep.fd;
+    c.file_off = 0;
+    c.file_left = rep.size;
+  }
+}
+
+void Worker::open_event_stream(Connection& c) {
+  HeadWriter w(c);
+  w << "HTTP/1.1 200 OK\r\nServer: mtserve\r\nDate: " << std::string_view(date_.data(), date_len_)
+    << "\r\nContent-Type: text/event-stream\r\nCache-Control: no-store\r\n\r\n";
+  c.queue_out(w.size());
+  c.close_after = false;
+  c.event_stream = true;
+}
+
+// Answers /search?q=... with the best hits as JSON, straight from the
+// mapped index.
+void Worker::respond_search(Connection& c, const http::Request& req) {
+  auto hits = site_->search().search(query_parameter(req.query, "q"), kSearchResults);
+  search_json(hits, c.generated);
+
+  HeadWriter w(c);
+  w << "HTTP/1.1 200 OK\r\nServer: mtserve\r\nDate: " << std::string_view(date_.data(), date_len_)
+    << "\r\nContent-Type: application/json\r\nContent-Length: " << c.generated.size()
+    << "\r\nCache-Control: no-cache\r\n";
+  end_head(w, req);
+  c.queue_out(w.size());
+  c.close_after = !req.keep_alive;
+  bool body = req.method == http::Method::get;
+  record_response(c, &req, 200, Encoding::identity, w.size(), body ? c.generated.size() : 0);
+  if (body) c.queue(c.generated.data(), c.generated.size());
+}
+
+void Worker::respond_error(Connection& c, int status, std::string_view reason, bool keep_alive,
+                           const http::Request* req) {
+  HeadWriter w(c);
+  w << "HTTP/1.1 " << static_cast<std::size_t>(status) << " " << reason
+    << "\r\nServer: mtserve\r\nDate: " << std::string_view(date_.data(), date_len_)
+    << "\r\nContent-Type: text/plain; charset=utf-8\r\nContent-Length: " << reason.size() + 1 << "\r\n"
+    << (keep_alive ? "" : "Connection: close\r\n") << "\r\n";
+  auto head_bytes = w.size();
+  // A HEAD response has the length of the body it leaves out.
+  if (req == nullptr || req->method != http::Method::head) w << reason << "\n";
+  c.queue_out(w.size());
+  c.close_after = !keep_alive;
+  record_response(c, req, status, Encoding::identity, head_bytes, w.size() - head_bytes);
+}
+
+// Counts the response just queued for `req` (null when it did not parse),
+// and queues an access log record of it. `prebuilt` responses were sent
+// from a pre-serialized head. A full ring drops the record rather than
+// wait: logging never slows a request.
+void Worker::record_response(Connection& c, const http::Request* req, int status, Encoding encoding,
+                             std::size_t head_bytes, std::size_t body_bytes, bool prebuilt) {
+  // HTTP/2 responses are timed per stream, by their session.
+  if (!c.h2) {
+    if (metrics_ != nullptr) {
+      if (c.started == 0) c.started = wake_ns_;
+      c.response_sizes[c.responses] = head_bytes + body_bytes;
+    }
+    ++c.responses;
+  }
+  count_response(c.peer, req, status, encoding, body_bytes, prebuilt);
+}
+
+// record_response() for any protocol: counts the response and logs it.
+void Worker::count_response(std::uint32_t peer, const http::Request* req, int status, Encoding encoding,
+                            std::size_t body_bytes, bool prebuilt) {
+  if (metrics_ != nullptr) {
+    metrics_->requests.add(1);
+    if (status == 304) {
+      metrics_->not_modified.add(1);
+    } else if (status >= 400 && status < 500) {
+      metrics_->client_errors.add(1);
+    } else if (prebuilt) {
+      metrics_->cache_hits.add(1);
+    }
+  }
+  if (access_log_ == nullptr) return;
+  auto method = req != nullptr ? req->method : http::Method::other;
+  auto path = req != nullptr ? req->path : std::string_view();
+  AccessRecord record;
+  record.time = now_ns_;
+  record.bytes = body_bytes;
+  record.peer = peer;
+  record.status = static_cast<std::uint16_t>(status);
+  record.method = static_cast<std::uint8_t>(method);
+  record.encoding = static_cast<std::uint8_t>(encoding);
+  record.path_size = static_cast<std::uint16_t>(std::min<std::size_t>(path.size(), UINT16_MAX));
+  record.worker = index_;
+  std::memcpy(record.path, path.data(), std::min(path.size(), kAccessPathBytes));
+  access_log_->push(record);
+}
+
+// Writes as much pending output as the socket accepts: every queued span
+// in one sendmsg, then any file range and trailer. Returns false on a
+// connection error; a short write simply leaves the rest pending.
+bool Worker::flush(Connection& c) {
+  while (c.iov_off < c.iov_len) {
+    ssize_t n = write_some(c, c.iov.data() + c.iov_off, c.iov_len - c.iov_off,
+                           MSG_NOSIGNAL | (c.file_left > 0 || c.trailer_left > 0 ? MSG_MORE : 0));
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      return errno == EAGAIN;
+    }
+    for (auto sent = static_cast<std::size_t>(n); sent > 0;) {
+      auto& span = c.iov[c.iov_off];
+      if (sent < span.iov_len) {
+        span.iov_base = static_cast<char*>(span.iov_base) + sent;
+        span.iov_len -= sent;
+        break;
+      }
+      sent -= span.iov_len;
+      ++c.iov_off;
+    }
+  }
+  while (c.file_left > 0) {
+    ssize_t n = write_file(c, c.file_fd, &c.file_off, c.file_left);
+    if (n <= 0) {
+      if (n < 0 && errno == EINTR) continue;
+      return n < 0 && errno == EAGAIN;
+    }
+    c.file_left -= static_cast<std::size_t>(n);
+  }
+  while (c.trailer_left > 0) {
+    iovec trailer{const_cast<char*>(c.trailer), c.trailer_left};
+    ssize_t n = write_some(c, &trailer, 1, MSG_NOSIGNAL);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      return errno == EAGAIN;
+    }
+    c.trailer += n;
+    c.trailer_left -= static_cast<std::size_t>(n);
+  }
+#ifdef MT_HAVE_OPENSSL
+  if (c.tls && !flush_tls(c)) return errno == EAGAIN;
+#endif
+  finish_output(c);
+  return true;
+}
+
+// Records the queued responses, all sent, in the metrics and empties the
+// queue.
+void Worker::finish_output(Connection& c) {
+  if (c.started != 0) {
+    auto latency = monotonic_ns() - c.started;
+    for (std::size_t i = 0; i < c.responses; ++i) {
+      metrics_->latency.record(latency);
+      metrics_->response_bytes.record(c.response_sizes[i]);
+    }
+    c.started = 0;
+  }
+  c.iov_off = c.iov_len = 0;
+  c.out_len = 0;
+  c.responses = 0;
+  c.generated.clear();
+}
+
+// Socket I/O for a connection, as recv, sendmsg and sendfile behave. An
+// HTTPS connection's go through its TLS session, except that once the
+// kernel encrypts for it (kTLS) writes go straight to the socket as plain
+// HTTP's do, files included.
+ssize_t Worker::read_some(Connection& c, char* buf, std::size_t size) {
+#ifdef MT_HAVE_OPENSSL
+  if (c.tls) {
+    while (c.tls_input.empty()) {
+      ssize_t n = ::recv(c.fd, tls_buf_.data(), tls_buf_.size(), 0);
+      if (n <= 0) return n;
+      bool open = c.tls->receive(std::string_view(tls_buf_.data(), static_cast<std::size_t>(n)), c.tls_input);
+      // Handshake messages and alerts in reply go at once.
+      if (!flush_tls(c) && errno != EAGAIN) return -1;
+      if (!open) return 0;
+    }
+    auto n = std::min(size, c.tls_input.size());
+    std::memcpy(buf, c.tls_input.data(), n);
+    c.tls_input.erase(0, n);
+    return static_cast<ssize_t>(n);
+  }
+#endif
+  return ::recv(c.fd, buf, size, 0);
+}
+
+ssize_t Worker::write_some(Connection& c, const iovec* iov, std::size_t count, int flags) {
+#ifdef MT_HAVE_OPENSSL
+  if (c.tls && !c.tls->offloaded()) {
+    // Records are sealed only once those before them have gone, so at
+    // most kTlsChunk waits in the session.
+    if (!flush_tls(c)) return -1;
+    auto n = c.tls->write(iov, count, kTlsChunk);
+    if (!flush_tls(c) && errno != EAGAIN) return -1;
+    return static_cast<ssize_t>(n);
+  }
+#endif
+  msghdr msg{};
+  msg.msg_iov = const_cast<iovec*>(iov);
+  msg.msg_iovlen = count;
+  return ::sendmsg(c.fd, &msg, flags);
+}
+
+ssize_t Worker::write_file(Connection& c, int fd, off_t* offset, std::size_t count) {
+#ifdef MT_HAVE_OPENSSL
+  if (c.tls && !c.tls->offloaded()) {
+    if (!flush_tls(c)) return -1;
+    ssize_t n = ::pread(fd, tls_buf_.data(), std::min(count, tls_buf_.size()), *offset);
+    if (n <= 0) return n;
+    iovec data{tls_buf_.data(), static_cast<std::size_t>(n)};
+    c.tls->write(&data, 1, data.iov_len);
+    *offset += n;
+    if (!flush_tls(c) && errno != EAGAIN) return -1;
+    return n;
+  }
+#endif
+  return ::sendfile(c.fd, fd, offset, count);
+}
+
+#ifdef MT_HAVE_OPENSSL
+// Sends the records `c`'s session has queued. Returns true once none are
+// left, or false with errno set (EAGAIN while the socket is full). When
+// the handshake's last ones are out, hands the keys to the kernel if it
+// takes them.
+bool Worker::flush_tls(Connection& c) {
+  for (;;) {
+    auto out = c.tls->pending();
+    if (out.empty()) break;
+    ssize_t n = ::send(c.fd, out.data(), out.size(), MSG_NOSIGNAL);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      return false;
+    }
+    c.tls->sent(static_cast<std::size_t>(n));
+  }
+  if (ktls_ && !c.ktls_tried && c.tls->established()) {
+    c.ktls_tried = true;
+    c.tls->offload(c.fd);
+  }
+  return true;
+}
+#endif
+
+// Switches a connection that sent the HTTP/2 preface over to a session,
+// which takes whatever followed the preface.
+void Worker::start_h2(Connection& c) {
+  c.first = false;
+  c.h2 = std::make_unique<http2::Session>(
+      [this, &c](std::uint32_t stream, const http::Request* req) { respond_h2(c, stream, req); });
+  auto skip = c.in_off + http2::kPreface.size();
+  if (!c.h2->receive(std::string_view(c.in.data() + skip, c.in_len - skip))) c.close_after = true;
+  c.in_off = c.in_len = 0;
+}
+
+// drive() for HTTP/2: send what the session has, then read, answering
+// requests as they arrive. Streams are multiplexed, so reading goes on
+// while responses wait on flow control; only a full socket stops it.
+void Worker::drive_h2(Connection& c) {
+  for (;;) {
+    bool blocked = false;
+    if (!flush_h2(c, blocked)) return close_conn(c);
+    if (blocked) return;  // EPOLLOUT resumes
+    if (c.close_after || c.h2->done()) return close_conn(c);
+    ssize_t n = read_some(c, c.in.data(), c.in.size());
+    if (n > 0) {
+      if (!c.h2->receive(std::string_view(c.in.data(), static_cast<std::size_t>(n)))) c.close_after = true;
+    } else if (n == 0) {
+      return close_conn(c);
+    } else if (errno == EAGAIN) {
+      return;
+    } else if (errno != EINTR) {
+      return close_conn(c);
+    }
+  }
+}
+
+// Sends the session's output until it has none or the socket is full
+// (`blocked`). Returns false on a connection error.
+bool Worker::flush_h2(Connection& c, bool& blocked) {
+  for (;;) {
+    auto iov = c.h2->pending();
+    if (iov.empty()) break;
+    ssize_t n = write_some(c, iov.data(), iov.size(), MSG_NOSIGNAL);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      if (errno != EAGAIN) return false;
+      blocked = true;
+      break;
+    }
+    c.h2->sent(static_cast<std::size_t>(n));
+  }
+#ifdef MT_HAVE_OPENSSL
+  if (!blocked && c.tls && !flush_tls(c)) {
+    if (errno != EAGAIN) return false;
+    blocked = true;
+  }
+#endif
+  finish_h2(c);
+  return true;
+}
+
+// Records the HTTP/2 responses the session has finished sending.
+void Worker::finish_h2(Connection& c) {
+  auto& finished = c.h2->finished();
+  if (finished.empty()) return;
+  auto now = monotonic_ns();
+  for (const auto& f : finished) {
+    metrics_->latency.record(now - f.started);
+    metrics_->response_bytes.record(f.bytes);
+  }
+  finished.clear();
+}
+
+// The response to a request on an HTTP/2 or HTTP/3 stream (`h3`), its head
+// encoded for that protocol. `req` is null when the request's path was not
+// valid. File responses send the head the site encoded when it loaded,
+// plus the date.
+StreamResponse Worker::stream_response(const http::Request* req, bool h3) const {
+  const FieldCodec& codec = h3 ? kQpackCodec : kHpackCodec;
+  StreamResponse s;
+  auto start = [&](int status) {
+    s.status = status;
+    codec.begin(s.head);
+    codec.status(s.head, status);
+    codec.field(s.head, "server", "mtserve");
+    s.head += h3 ? h3_date_ : h2_date_;
+  };
+  auto error = [&](int status, std::string_view reason) {
+    start(status);
+    codec.field(s.head, "content-type", "text/plain; charset=utf-8");
+    codec.field(s.head, "content-length", std::to_string(reason.size() + 1));
+    if (req == nullptr || req->method != http::Method::head) {
+      s.body.generated = reason;
+      s.body.generated += '\n';
+    }
+  };
+  if (req == nullptr) {
+    error(400, "Bad Request");
+    return s;
+  }
+  auto a = decide(*req);
+  switch (a.kind) {
+    case Answer::Kind::error:
+      error(a.status, a.reason);
+      return s;
+    case Answer::Kind::event_stream:
+      start(200);
+      codec.field(s.head, "content-type", "text/event-stream");
+      codec.field(s.head, "cache-control", "no-store");
+      s.body.open = true;
+      s.event_stream = true;
+      return s;
+    case Answer::Kind::search: {
+      auto hits = site_->search().search(query_parameter(req->query, "q"), kSearchResults);
+      search_json(hits, s.body.generated);
+      start(200);
+      codec.field(s.head, "content-type", "application/json");
+      codec.field(s.head, "content-length", std::to_string(s.body.generated.size()));
+      codec.field(s.head, "cache-control", "no-cache");
+      if (req->method != http::Method::get) s.body.generated.clear();
+      return s;
+    }
+    case Answer::Kind::file:
+      break;
+  }
+
+  const auto& r = *a.resource;
+  const auto& rep = r.reps[static_cast<std::size_t>(a.encoding)];
+  s.encoding = a.encoding;
+  if (!a.not_modified && !a.live_page) {
+    const auto& encoded = h3 ? rep.h3_head : rep.h2_head;
+    const auto& date = h3 ? h3_date_ : h2_date_;
+    s.head.reserve(encoded.size() + date.size());
+    s.head = encoded;
+    s.head += date;
+  } else {
+    start(a.status);
+    stream_fields(codec, s.head, r, a.encoding, *a.etag, a.not_modified, a.live_page);
+  }
+  s.status = a.status;
+  if (!a.not_modified && req->method == http::Method::get) {
+    if (rep.data != nullptr) {
+      s.body.memory = std::string_view(rep.data, rep.size);
+    } else {
+      s.body.fd = rep.fd;
+      s.body.file_size = rep.size;
+    }
+    if (a.live_page) s.body.trailer = kReloadScript;
+  }
+  return s;
+}
+
+// respond() for a request on an HTTP/2 stream.
+void Worker::respond_h2(Connection& c, std::uint32_t stream, const http::Request* req) {
+  auto s = stream_response(req, false);
+  c.site = site_;
+  if (s.event_stream) {
+    c.h2_event_streams.push_back(stream);
+    return c.h2->respond(stream, std::move(s.head), std::move(s.body));
+  }
+  record_response(c, req, s.status, s.encoding, s.head.size(), body_size(s.body));
+  c.h2->respond(stream, std::move(s.head), std::move(s.body), metrics_ != nullptr ? wake_ns_ : 0);
+}
+
+#ifdef MT_HAVE_OPENSSL
+// Reads a batch of datagrams with one recvmmsg and sends what the
+// connections they were for have to send. The socket is level-triggered,
+// so a batch at a time keeps TCP connections served meanwhile.
+void Worker::receive_udp() {
+  std::array<mmsghdr, kUdpBatch> msgs{};
+  std::array<iovec, kUdpBatch> iov{};
+  std::array<sockaddr_in, kUdpBatch> from{};
+  std::array<SegmentControl, kUdpBatch> control{};
+  for (std::size_t i = 0; i < kUdpBatch; ++i) {
+    iov[i] = {udp_in_.data() + i * kUdpRecvSize, kUdpRecvSize};
+    auto& h = msgs[i].msg_hdr;
+    h.msg_name = &from[i];
+    h.msg_namelen = sizeof from[i];
+    h.msg_iov = &iov[i];
+    h.msg_iovlen = 1;
+    h.msg_control = control[i].data;
+    h.msg_controllen = sizeof control[i].data;
+  }
+  int n = ::recvmmsg(udp_fd_, msgs.data(), kUdpBatch, 0, nullptr);
+  if (n <= 0) return;
+  auto now = monotonic_ns();
+  for (int i = 0; i < n; ++i) {
+    auto size = static_cast<std::size_t>(msgs[i].msg_len);
+    // GRO merges datagrams from one sender: all of `segment` bytes but the
+    // last.
+    std::size_t segment = size;
+    for (auto* cm = CMSG_FIRSTHDR(&msgs[i].msg_hdr); cm != nullptr; cm = CMSG_NXTHDR(&msgs[i].msg_hdr, cm)) {
+      if (cm->cmsg_level != SOL_UDP || cm->cmsg_type != UDP_GRO) continue;
+      int gso_size = 0;
+      std::memcpy(&gso_size, CMSG_DATA(cm), sizeof gso_size);
+      if (gso_size > 0) segment = static_cast<std::size_t>(gso_size);
+    }
+    auto* data = static_cast<std::uint8_t*>(iov[i].iov_base);
+    for (std::size_t off = 0; off < size; off += segment) {
+      on_datagram({data + off, std::min(segment, size - off)}, from[i], now);
+    }
+  }
+  flush_udp();
+}
+
+// Hands a datagram to its connection, or starts one for a client's first
+// Initial packet.
+void Worker::on_datagram(std::span<std::uint8_t> datagram, const sockaddr_in& from, std::uint64_t now) {
+  quic::Header h;
+  if (!quic::parse_header(datagram, quic::kConnectionIdSize, h)) return;
+  QuicConnection* q = nullptr;
+  if (auto it = quic_routes_.find(h.dcid); it != quic_routes_.end()) {
+    q = it->second;
+  } else if (!h.long_header) {
+    return;  // for a connection that is gone
+  } else if (h.version != quic::kVersion) {
+    // Only full-sized datagrams are answered, so a spoofed one cannot be
+    // amplified.
+    if (datagram.size() < quic::kMinInitialSize) return;
+    auto packet = quic::version_negotiation(h);
+    ::sendto(udp_fd_, packet.data(), packet.size(), 0, reinterpret_cast<const sockaddr*>(&from), sizeof from);
+    return;
+  } else if (h.type == 0 && datagram.size() >= quic::kMinInitialSize && h.dcid.size() >= 8) {
+    q = &accept_quic(h, from, now);
+  } else {
+    return;
+  }
+  q->session->connection().receive(datagram, now);
+  mark_ready(*q);
+}
+
+QuicConnection& Worker::accept_quic(const quic::Header& h, const sockaddr_in& from, std::uint64_t now) {
+  auto owned = std::make_unique<QuicConnection>();
+  auto& q = *owned;
+  q.peer = from;
+  q.index = quic_.size();
+  q.session = std::make_unique<http3::Session>(
+      [this, &q](std::uint64_t stream, const http::Request* req) { respond_h3(q, stream, req); }, credentials_, h,
+      quic::new_connection_id(), quic::Limits{}, now);
+  const auto& connection = q.session->connection();
+  quic_routes_[connection.cid()] = &q;
+  quic_routes_[connection.original_cid()] = &q;
+  quic_.push_back(std::move(owned));
+  return q;
+}
+
+// respond() for a request on an HTTP/3 stream.
+void Worker::respond_h3(QuicConnection& q, std::uint64_t stream, const http::Request* req) {
+  auto s = stream_response(req, true);
+  if (s.event_stream) {
+    q.event_streams.push_back(stream);
+    return q.session->respond(stream, std::move(s.head), std::move(s.body));
+  }
+  count_response(q.peer.sin_addr.s_addr, req, s.status, s.encoding, body_size(s.body), false);
+  q.session->respond(stream, std::move(s.head), std::move(s.body), metrics_ != nullptr ? wake_ns_ : 0);
+}
+
+void Worker::mark_ready(QuicConnection& q) {
+  if (q.ready) return;
+  q.ready = true;
+  quic_ready_.push_back(&q);
+}
+
+// Sends the datagrams of every ready connection and resets its timer.
+// With GSO, consecutive datagrams to one client go in one message, which
+// the kernel splits; messages go out kUdpSendBatch at a time.
+void Worker::flush_udp() {
+  if (quic_ready_.empty()) return;
+  auto now = monotonic_ns();
+  for (auto* q : quic_ready_) {
+    auto& connection = q->session->connection();
+    for (;;) {
+      if (udp_out_.size() - udp_out_len_ < quic::kMaxDatagramSize) send_udp();
+      auto* at = udp_out_.data() + udp_out_len_;
+      auto size = connection.send(reinterpret_cast<std::uint8_t*>(at), now);
+      if (size == 0) break;
+      // A message's segments are all the size of its first, but the last,
+      // which may be shorter.
+      if (udp_last_ == q && udp_segments_ < kGsoSegments && size <= udp_sizes_[udp_msg_count_ - 1]) {
+        udp_iov_[udp_msg_count_ - 1].iov_len += size;
+        ++udp_segments_;
+        if (size < udp_sizes_[udp_msg_count_ - 1]) udp_last_ = nullptr;
+      } else {
+        if (udp_msg_count_ == kUdpSendBatch) {
+          send_udp();
+          std::memmove(udp_out_.data(), at, size);
+          at = udp_out_.data();
+        }
+        auto i = udp_msg_count_++;
+        udp_iov_[i] = {at, size};
+        udp_sizes_[i] = size;
+        auto& m = udp_msgs_[i].msg_hdr;
+        m.msg_name = &q->peer;
+        m.msg_namelen = sizeof q->peer;
+        m.msg_iov = &udp_iov_[i];
+        m.msg_iovlen = 1;
+        udp_last_ = gso_ ? q : nullptr;
+        udp_segments_ = 1;
+      }
+      udp_out_len_ += size;
+    }
+    q->ready = false;
+    auto deadline = connection.closed() ? UINT64_MAX : connection.next_timeout();
+    if (deadline != q->deadline) {
+      if (q->deadline != UINT64_MAX) quic_timers_.erase({q->deadline, q});
+      if (deadline != UINT64_MAX) quic_timers_.insert({deadline, q});
+      q->deadline = deadline;
+    }
+    auto& finished = q->session->finished();
+    for (const auto& f : finished) {
+      metrics_->latency.record(now - f.started);
+      metrics_->response_bytes.record(f.bytes);
+    }
+    finished.clear();
+  }
+  send_udp();
+  for (auto* q : quic_ready_) {
+    if (q->session->connection().closed()) close_quic(*q);
+  }
+  quic_ready_.clear();
+}
+
+// Sends the queued messages with sendmmsg. Datagrams the socket refuses
+// are dropped: QUIC's loss recovery sends their data again.
+void Worker::send_udp() {
+  for (std::size_t i = 0; i < udp_msg_count_; ++i) {
+    auto& m = udp_msgs_[i].msg_hdr;
+    if (udp_iov_[i].iov_len == udp_sizes_[i]) {
+      m.msg_control = nullptr;
+      m.msg_controllen = 0;
+      continue;
+    }
+    m.msg_control = udp_control_[i].data;
+    m.msg_controllen = CMSG_SPACE(sizeof(std::uint16_t));
+    auto* cm = CMSG_FIRSTHDR(&m);
+    cm->cmsg_level = SOL_UDP;
+    cm->cmsg_type = UDP_SEGMENT;
+    cm->cmsg_len = CMSG_LEN(sizeof(std::uint16_t));
+    auto segment = static_cast<std::uint16_t>(udp_sizes_[i]);
+    std::memcpy(CMSG_DATA(cm), &segment, sizeof segment);
+  }
+  for (std::size_t sent = 0; sent < udp_msg_count_;) {
+    int n = ::sendmmsg(udp_fd_, udp_msgs_.data() + sent, static_cast<unsigned>(udp_msg_count_ - sent), 0);
+    if (n > 0) {
+      sent += static_cast<std::size_t>(n);
+      continue;
+    }
+    if (errno == EINTR) continue;
+    if (errno == EAGAIN) break;
+    // EIO: the device cannot segment; go on without GSO.
+    if (errno == EIO) gso_ = false;
+    ++sent;
+  }
+  udp_msg_count_ = 0;
+  udp_out_len_ = 0;
+  udp_last_ = nullptr;
+}
+
+// Fires the QUIC timers that are due and sends what they produced.
+void Worker::run_quic_timers() {
+  if (quic_timers_.empty()) return;
+  auto now = monotonic_ns();
+  while (!quic_timers_.empty() && quic_timers_.begin()->first <= now) {
+    auto* q = quic_timers_.begin()->second;
+    quic_timers_.erase(quic_timers_.begin());
+    q->deadline = UINT64_MAX;
+    q->session->connection().on_timeout(now);
+    mark_ready(*q);
+  }
+  flush_udp();
+}
+
+// epoll_wait()'s timeout: until the next QUIC timer, in ms rounded up.
+int Worker::quic_timeout() const {
+  if (quic_timers_.empty()) return -1;
+  auto now = monotonic_ns();
+  auto deadline = quic_timers_.begin()->first;
+  if (deadline <= now) return 0;
+  return static_cast<int>(std::min<std::uint64_t>((deadline - now + 999999) / 1000000, INT32_MAX));
+}
+
+void Worker::close_quic(QuicConnection& q) {
+  const auto& connection = q.session->connection();
+  quic_routes_.erase(connection.cid());
+  quic_routes_.erase(connection.original_cid());
+  if (q.deadline != UINT64_MAX) quic_timers_.erase({q.deadline, &q});
+  auto index = q.index;
+  std::swap(quic_[index], quic_.back());
+  quic_[index]->index = index;
+  quic_.pop_back();
+}
+#endif
+
+#ifdef MT_HAVE_IO_URING
+// run() on io_uring. The ring accepts and receives plain HTTP; whatever
+// epoll still watches (the control eventfd, HTTPS, HTTP/3) wakes it
+// through a multishot poll of the epoll descriptor. Each turn is one
+// io_uring_enter, which submits what the last turn queued and waits.
+void Worker::run_uring() {
+  ring_->enable();
+  arm_accept();
+  arm_epoll();
+  std::array<epoll_event, kMaxEvents> events;
+  while (!stopping_) {
+    int timeout = epoll_ready_ ? 0 : -1;
+#ifdef MT_HAVE_OPENSSL
+    if (!epoll_ready_) timeout = quic_timeout();
+#endif
+    ring_->wait(timeout);
+    refresh_date();
+    if (metrics_ != nullptr) wake_ns_ = monotonic_ns();
+    ring_->drain([this](const io_uring_cqe& cqe) { on_completion(cqe); });
+    if (epoll_ready_) {
+      // Level-triggered sockets still ready do not wake the poll again, so
+      // epoll is asked until it has nothing.
+      int n = ::epoll_wait(epoll_fd_, events.data(), kMaxEvents, 0);
+      epoll_ready_ = n > 0;
+      for (int i = 0; i < n; ++i) dispatch(events[i].data.ptr);
+    }
+    closed_.clear();
+    if (!starved_.empty() && recv_buffers_free_ > 0) {
+      for (auto* c : starved_) {
+        c->starved = false;
+        if (!c->recv_armed && !c->eof) arm_recv(*c);
+      }
+      starved_.clear();
+    }
+#ifdef MT_HAVE_OPENSSL
+    run_quic_timers();
+#endif
+  }
+}
+
+void Worker::on_completion(const io_uring_cqe& cqe) {
+  auto op = cqe.user_data & kOpMask;
+  auto* c = reinterpret_cast<Connection*>(cqe.user_data & ~kOpMask);
+  bool more = (cqe.flags & IORING_CQE_F_MORE) != 0;
+  if (c == nullptr) {
+    if (op == kOpAccept) {
+      if (!more) arm_accept();
+      if (cqe.res >= 0) accept_uring(cqe.res);
+    } else {
+      epoll_ready_ = true;
+      if (!more) arm_epoll();
+    }
+    return;
+  }
+  if (!more) --c->inflight;
+  switch (op) {
+    case kOpRecv:
+      on_recv(*c, cqe.res, cqe.flags);
+      break;
+    case kOpSend:
+      if (cqe.res < 0) c->failed = true;
+      break;
+    case kOpSendLast:
+      if (cqe.res < 0) c->failed = true;
+      on_sent(*c);
+      break;
+    case kOpClose:
+      // Cancelled with the send it was linked to.
+      if (cqe.res == -ECANCELED) queue_close(*c);
+      break;
+    default:
+      break;
+  }
+  if (c->detached && c->inflight == 0) {
+    release_file_buffer(*c);
+    std::erase_if(closing_, [c](const std::unique_ptr<Connection>& p) { return p.get() == c; });
+  }
+}
+
+void Worker::arm_accept() {
+  auto& sqe = ring_->get();
+  sqe.opcode = IORING_OP_ACCEPT;
+  sqe.fd = listen_fd_;
+  sqe.ioprio = IORING_ACCEPT_MULTISHOT;
+  sqe.accept_flags = SOCK_CLOEXEC;
+  sqe.user_data = kOpAccept;
+}
+
+void Worker::arm_epoll() {
+  auto& sqe = ring_->get();
+  sqe.opcode = IORING_OP_POLL_ADD;
+  sqe.fd = epoll_fd_;
+  sqe.len = IORING_POLL_ADD_MULTI;
+  sqe.poll32_events = POLLIN;
+  sqe.user_data = kOpEpoll;
+}
+
+// A receive that goes on until it fails, each completion with a buffer
+// from the ring.
+void Worker::arm_recv(Connection& c) {
+  auto& sqe = ring_->get();
+  sqe.opcode = IORING_OP_RECV;
+  sqe.fd = c.fd;
+  sqe.ioprio = IORING_RECV_MULTISHOT;
+  sqe.flags = IOSQE_BUFFER_SELECT;
+  sqe.buf_group = kRecvGroup;
+  sqe.user_data = reinterpret_cast<std::uintptr_t>(&c) | kOpRecv;
+  c.recv_armed = true;
+  ++c.inflight;
+}
+
+void Worker::accept_uring(int fd) {
+  if (static_cast<std::size_t>(fd) >= conns_.size()) conns_.resize(fd + 1);
+  conns_[fd] = std::make_unique<Connection>();
+  auto& c = *conns_[fd];
+  c.fd = fd;
+  c.uring = true;
+  if (access_log_ != nullptr) {
+    sockaddr_in peer{};
+    socklen_t peer_size = sizeof peer;
+    if (::getpeername(fd, reinterpret_cast<sockaddr*>(&peer), &peer_size) == 0) c.peer = peer.sin_addr.s_addr;
+  }
+  arm_recv(c);
+}
+
+void Worker::on_recv(Connection& c, int res, std::uint32_t flags) {
+  if ((flags & IORING_CQE_F_MORE) == 0) {
+    c.recv_armed = false;
+    c.recv_cancelled = false;
+  }
+  if (flags & IORING_CQE_F_BUFFER) {
+    auto id = static_cast<std::uint16_t>(flags >> IORING_CQE_BUFFER_SHIFT);
+    --recv_buffers_free_;
+    if (res > 0 && !c.detached && !c.event_stream) {
+      c.held.emplace_back(id, static_cast<std::size_t>(res));
+    } else {
+      ring_->recycle(id);
+      ++recv_buffers_free_;
+    }
+  }
+  if (c.detached) return;
+  if (res == -ENOBUFS) {
+    c.starved = true;
+    starved_.push_back(&c);
+  } else if (res == 0 || (res < 0 && res != -ECANCELED)) {
+    c.eof = true;  // what was received is still answered
+  }
+  if (c.held.size() >= kMaxHeld) cancel_recv(c);
+  serve_uring(c);
+}
+
+// Copies what `c` holds into `in`, as much as fits, returning emptied
+// buffers to the ring.
+void Worker::take_input(Connection& c) {
+  if (c.in_off > 0) {
+    std::memmove(c.in.data(), c.in.data() + c.in_off, c.in_len - c.in_off);
+    c.in_len -= c.in_off;
+    c.in_off = 0;
+  }
+  while (!c.held.empty() && c.in_len < c.in.size()) {
+    auto [id, size] = c.held.front();
+    auto n = std::min(size - c.held_off, c.in.size() - c.in_len);
+    std::memcpy(c.in.data() + c.in_len, ring_->buffer(id) + c.held_off, n);
+    c.in_len += n;
+    c.held_off += n;
+    if (c.held_off < size) break;
+    ring_->recycle(id);
+    ++recv_buffers_free_;
+    c.held.erase(c.held.begin());
+    c.held_off = 0;
+  }
+}
+
+void Worker::drop_held(Connection& c) {
+  for (auto [id, size] : c.held) ring_->recycle(id);
+  recv_buffers_free_ += static_cast<unsigned>(c.held.size());
+  c.held.clear();
+  c.held_off = 0;
+}
+
+// drive() for io_uring: answers what was received and submits the
+// responses. Input is only taken while no step is in flight, so nothing
+// a send reads from changes under it.
+void Worker::serve_uring(Connection& c) {
+  if (c.sending || c.detached) return;
+  if (c.h2) return serve_uring_h2(c);
+  for (;;) {
+    take_input(c);
+    bool answered = false;
+    while (c.can_queue() && handle_one(c)) answered = true;
+    if (c.h2) return serve_uring_h2(c);
+    if (c.pending()) return send_uring(c);
+    if (c.close_after) return close_uring(c);
+    if (c.event_stream) {
+      drop_held(c);
+      break;
+    }
+    if (answered) continue;  // the batch was full; more may be buffered
+    if (c.in_len == c.in.size()) {
+      respond_error(c, 431, "Request Header Fields Too Large", false);
+      continue;
+    }
+    if (c.held.empty()) break;
+  }
+  if (c.eof) return close_uring(c);
+  if (!c.recv_armed && !c.starved) arm_recv(c);
+}
+
+// serve_uring() for HTTP/2: sends what the session has and, between
+// sends, feeds it what was received.
+void Worker::serve_uring_h2(Connection& c) {
+  while (!c.sending && !c.detached) {
+    auto iov = c.h2->pending();
+    if (!iov.empty()) {
+      c.step_bytes = 0;
+      for (const auto& span : iov) c.step_bytes += span.iov_len;
+      queue_send(c, const_cast<iovec*>(iov.data()), iov.size(), MSG_NOSIGNAL);
+      return;
+    }
+    if (c.close_after || c.h2->done()) return close_uring(c);
+    if (c.held.empty()) {
+      if (c.eof) return close_uring(c);
+      if (!c.recv_armed && !c.starved) arm_recv(c);
+      return;
+    }
+    auto [id, size] = c.held.front();
+    bool open = c.h2->receive(std::string_view(ring_->buffer(id) + c.held_off, size - c.held_off));
+    ring_->recycle(id);
+    ++recv_buffers_free_;
+    c.held.erase(c.held.begin());
+    c.held_off = 0;
+    if (!open) c.close_after = true;
+  }
+}
+
+// Submits the next step of `c`'s output as one linked chain: the read of
+// a file chunk, if a file is being sent, then a sendmsg of the queued
+// spans, the chunk and, after the last chunk, the trailer. A response
+// that ends the connection links its close too. Sends wait for all their
+// bytes (MSG_WAITALL), and a short read fails the chain, so the step is
+// done, or failed, when its sendmsg completes.
+void Worker::send_uring(Connection& c) {
+  // The chain and a cancel go in one submission.
+  ring_->reserve(4);
+  std::size_t extra = 0;
+  c.step_file = std::min(c.file_left, kFileChunk);
+  c.step_trailer = false;
+  bool last = c.step_file == c.file_left;
+  bool closing = last && c.close_after;
+  if (closing) detach_uring(c);
+  if (c.step_file > 0) {
+    if (c.file_buffer == nullptr) {
+      if (!free_file_buffers_.empty()) {
+        c.file_buffer = free_file_buffers_.back();
+        free_file_buffers_.pop_back();
+      } else {
+        if (!c.own_buffer) c.own_buffer = std::make_unique_for_overwrite<char[]>(kFileChunk);
+        c.file_buffer = c.own_buffer.get();
+      }
+    }
+    auto& read = ring_->get();
+    bool fixed_buffer = fixed_buffers_ && c.file_buffer != c.own_buffer.get();
+    read.opcode = fixed_buffer ? IORING_OP_READ_FIXED : IORING_OP_READ;
+    auto fd = static_cast<std::size_t>(c.file_fd);
+    if (fd < file_slots_.size() && file_slots_[fd] >= 0) {
+      read.fd = file_slots_[fd];
+      read.flags = IOSQE_FIXED_FILE;
+    } else {
+      read.fd = c.file_fd;
+    }
+    read.flags |= IOSQE_IO_LINK;
+    read.addr = reinterpret_cast<std::uintptr_t>(c.file_buffer);
+    read.len = static_cast<std::uint32_t>(c.step_file);
+    read.off = static_cast<std::uint64_t>(c.file_off);
+    read.user_data = reinterpret_cast<std::uintptr_t>(&c) | kOpSend;
+    ++c.inflight;
+    c.iov[c.iov_len + extra++] = {c.file_buffer, c.step_file};
+  }
+  if (last && c.trailer_left > 0) {
+    c.iov[c.iov_len + extra++] = {const_cast<char*>(c.trailer), c.trailer_left};
+    c.step_trailer = true;
+  }
+  auto& send = queue_send(c, c.iov.data() + c.iov_off, c.iov_len - c.iov_off + extra,
+                          MSG_NOSIGNAL | (last ? 0 : MSG_MORE));
+  if (closing) {
+    send.flags |= IOSQE_IO_LINK;
+    queue_close(c);
+  }
+}
+
+// Queues a sendmsg of `iov` that ends a step.
+io_uring_sqe& Worker::queue_send(Connection& c, iovec* iov, std::size_t count, int flags) {
+  c.msg = {};
+  c.msg.msg_iov = iov;
+  c.msg.msg_iovlen = count;
+  auto& sqe = ring_->get();
+  sqe.opcode = IORING_OP_SENDMSG;
+  sqe.fd = c.fd;
+  sqe.addr = reinterpret_cast<std::uintptr_t>(&c.msg);
+  sqe.len = 1;
+  sqe.msg_flags = static_cast<std::uint32_t>(flags | MSG_WAITALL);
+  sqe.user_data = reinterpret_cast<std::uintptr_t>(&c) | kOpSendLast;
+  ++c.inflight;
+  c.sending = true;
+  c.failed = false;
+  return sqe;
+}
+
+// The step in flight on `c` has completed.
+void Worker::on_sent(Connection& c) {
+  c.sending = false;
+  if (!c.failed && c.h2) {
+    c.h2->sent(c.step_bytes);
+    finish_h2(c);
+  } else if (!c.failed) {
+    c.iov_off = c.iov_len;
+    c.file_off += static_cast<off_t>(c.step_file);
+    c.file_left -= c.step_file;
+    if (c.step_trailer) c.trailer_left = 0;
+    if (c.file_left == 0) release_file_buffer(c);
+    if (!c.pending()) finish_output(c);
+  }
+  if (c.detached) {
+    if (!c.close_queued) queue_close(c);
+    return;
+  }
+  if (c.failed) return close_uring(c);
+  if (c.pending()) return send_uring(c);
+  serve_uring(c);
+}
+
+void Worker::close_uring(Connection& c) {
+  detach_uring(c);
+  if (!c.sending && !c.close_queued) queue_close(c);
+}
+
+// Takes `c` out of conns_, as its descriptor may be reused once closed,
+// and stops its receive. It waits in closing_ until nothing is in flight.
+// A step in flight still completes; its close follows.
+void Worker::detach_uring(Connection& c) {
+  if (c.detached) return;
+  c.detached = true;
+  closing_.push_back(std::move(conns_[c.fd]));
+  std::erase(starved_, &c);
+  drop_held(c);
+  cancel_recv(c);
+}
+
+// Stops `c`'s receive. It completes with ECANCELED, and serve_uring()
+// arms another once `c` wants more.
+void Worker::cancel_recv(Connection& c) {
+  if (!c.recv_armed || c.recv_cancelled) return;
+  auto& sqe = ring_->get();
+  sqe.opcode = IORING_OP_ASYNC_CANCEL;
+  sqe.fd = -1;
+  sqe.addr = reinterpret_cast<std::uintptr_t>(&c) | kOpRecv;
+  sqe.user_data = reinterpret_cast<std::uintptr_t>(&c) | kOpCancel;
+  c.recv_cancelled = true;
+  ++c.inflight;
+}
+
+// Closes the socket, after the operations linked before it. Operations
+// name it by number, which the next accept may reuse, so none may follow.
+void Worker::queue_close(Connection& c) {
+  auto& sqe = ring_->get();
+  sqe.opcode = IORING_OP_CLOSE;
+  sqe.fd = c.fd;
+  sqe.user_data = reinterpret_cast<std::uintptr_t>(&c) | kOpClose;
+  c.close_queued = true;
+  ++c.inflight;
+}
+
+void Worker::release_file_buffer(Connection& c) {
+  if (c.file_buffer != nullptr && c.file_buffer != c.own_buffer.get()) free_file_buffers_.push_back(c.file_buffer);
+  c.file_buffer = nullptr;
+  c.own_buffer.reset();
+}
+#endif
+
+void Worker::close_conn(Connection& c) {
+  int fd = c.fd;
+  ::close(fd);  // also removes it from the epoll set
+  c.fd = -1;
+  closed_.push_back(std::move(conns_[fd]));
+}
+
+void Worker::refresh_date() {
+  timespec ts{};
+  ::clock_gettime(CLOCK_REALTIME_COARSE, &ts);
+  now_ns_ = static_cast<std::uint64_t>(ts.tv_sec) * 1000000000 + static_cast<std::uint64_t>(ts.tv_nsec);
+  if (ts.tv_sec == date_sec_) return;
+  date_sec_ = ts.tv_sec;
+  std::tm tm{};
+  ::gmtime_r(&date_sec_, &tm);
+  date_len_ = std::strftime(date_.data(), date_.size(), "%a, %d %b %Y %H:%M:%S GMT", &tm);
+  h2_date_.clear();
+  hpack::encode_field(h2_date_, "date", std::string_view(date_.data(), date_len_));
+  h3_date_.clear();
+  qpack::encode_field(h3_date_, "date", std::string_view(date_.data(), date_len_));
+}
+
+Server::Server(const Site& site, ServerOptions options) : site_(site), options_(std::move(options)) {}
+
+Server::~Server() { stop(); }
+
+void Server::start() {
+  std::vector<int> cpus;
+  cpu_set_t allowed;
+  CPU_ZERO(&allowed);
+  if (::sched_getaffinity(0, sizeof allowed, &allowed) == 0) {
+    for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+      if (CPU_ISSET(cpu, &allowed)) cpus.push_back(cpu);
+    }
+  }
+  if (cpus.empty()) cpus.push_back(0);
+  unsigned n = options_.threads ? options_.threads : static_cast<unsigned>(cpus.size());
+  // Access records name their worker in 16 bits.
+  if (n > 65536) throw std::runtime_error("at most 65536 threads");
+#ifdef MT_HAVE_OPENSSL
+  std::shared_ptr<const tls13::Credentials> credentials;
+  if (options_.tls_port != 0 || options_.h3_port != 0) {
+    credentials = tls13::Credentials::load(options_.tls_cert, options_.tls_key);
+  }
+#else
+  if (options_.tls_port != 0) throw std::runtime_error("HTTPS needs a build with OpenSSL");
+  if (options_.h3_port != 0) throw std::runtime_error("HTTP/3 needs a build with OpenSSL");
+#endif
+#ifdef MT_HAVE_IO_URING
+  io_uring_ = options_.io_uring && uring::available();
+#endif
+
+  for (unsigned i = 0; i < n; ++i) {
+    int cpu = options_.pin ? cpus[i % cpus.size()] : -1;
+    auto* ring = options_.access_log != nullptr ? &options_.access_log->add_ring() : nullptr;
+    auto* metrics = options_.metrics_port != 0 ? &metrics_.add_worker() : nullptr;
+    workers_.push_back(
+        std::make_unique<Worker>(site_, cpu, options_.live_reload, ring, metrics, static_cast<std::uint16_t>(i)));
+    workers_.back()->listen(options_);
+#ifdef MT_HAVE_IO_URING
+    if (io_uring_) workers_.back()->listen_uring();
+#endif
+#ifdef MT_HAVE_OPENSSL
+    if (options_.tls_port != 0) workers_.back()->listen_tls(options_, credentials);
+    if (options_.h3_port != 0) workers_.back()->listen_udp(options_, credentials);
+#endif
+  }
+
+  // When worker i runs on CPU i, steer each new connection to the listener
+  // of the CPU that took the SYN so the whole connection stays core-local.
+  // The reuseport group indexes sockets in bind order, which matches i.
+  bool identity = options_.pin && n == cpus.size() && cpus.back() == static_cast<int>(n) - 1;
+  if (identity && n > 1) {
+    sock_filter code[] = {
+        {BPF_LD | BPF_W | BPF_ABS, 0, 0, static_cast<std::uint32_t>(SKF_AD_OFF + SKF_AD_CPU)},
+        {BPF_ALU | BPF_MOD | BPF_K, 0, 0, n},
+        {BPF_RET | BPF_A, 0, 0, 0},
+    };
+    sock_fprog prog{static_cast<unsigned short>(std::size(code)), code};
+    // Best effort: without it the kernel's flow hash still spreads load.
+    ::setsockopt(workers_.front()->listen_fd(), SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &prog, sizeof prog);
+    if (options_.tls_port != 0) {
+      ::setsockopt(workers_.front()->tls_listen_fd(), SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &prog, sizeof prog);
+    }
+  }
+
+  if (options_.metrics_port != 0) {
+    metrics_server_ = std::make_unique<MetricsServer>(metrics_, options_.host, options_.metrics_port);
+  }
+  for (auto& w : workers_) {
+    threads_.emplace_back([worker = w.get()] { worker->run(); });
+  }
+}
+
+void Server::stop() {
+  for (auto& w : workers_) w->stop();
+  for (auto& t : threads_) {
+    if (t.joinable()) t.join();
+  }
+  threads_.clear();
+  workers_.clear();
+  metrics_server_.reset();
+}
+
+void Server::reload(std::shared_ptr<const Site> site) {
+  for (auto& w : workers_) w->reload(site);
+}
+
+}  // namespace mt
@@ -0,0 +1,97 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "access_log.h"
+#include "metrics.h"
+#include "site.h"
+
+namespace mt {
+
+struct ServerOptions {
+  std::string host = "0.0.0.0";
+  std::uint16_t port = 8080;
+  unsigned threads = 0;  // 0 = one per CPU in the affinity mask
+  bool pin = true;       // pin worker i to the i-th allowed CPU
+  // Development mode, for `mtsite watch`. GET /_reload opens a server-sent
+  // event stream that receives a message on every reload(). HTML pages are
+  // sent uncompressed, uncached and with a script appended that listens to
+  // it and reloads the page.
+  bool live_reload = false;
+  // Each worker queues a record of every response here, if set. The log
+  // must outlive the server.
+  AccessLog* access_log = nullptr;
+  // When not 0, Prometheus metrics are served at /metrics on this port of
+  // `host`, from a thread of their own.
+  std::uint16_t metrics_port = 0;
+  // When not 0, HTTPS (HTTP/1.1 and HTTP/2 over TLS 1.3) is served on this
+  // TCP port of `host` too, and HTTP/3 on this UDP one, both with the PEM
+  // certificate chain and key in `tls_cert` and `tls_key`. Need a build
+  // with OpenSSL.
+  std::uint16_t tls_port = 0;
+  std::uint16_t h3_port = 0;
+  std::string tls_cert;
+  std::string tls_key;
+  // Hand each HTTPS connection's keys to the kernel after its handshake
+  // (kTLS), so responses, files included, are encrypted there as they are
+  // sent. Where the kernel has no kTLS, TLS stays in userspace.
+  bool ktls = true;
+  // Let the kernel split and merge HTTP/3's datagrams (UDP GSO and GRO)
+  // where it can, so a batch of them costs one trip through the stack.
+  bool udp_offload = true;
+  // Serve plain HTTP from an io_uring ring per worker instead of epoll:
+  // connections are accepted and read by multishot operations, into
+  // buffers the ring provides, and each batch of responses is submitted as
+  // one linked chain, so a keep-alive request costs two io_uring_enter
+  // calls, one submitting the response and one waiting for the next.
+  // Where the kernel lacks what this needs (see uring::available()), epoll
+  // serves instead. HTTPS and HTTP/3 stay on epoll, which the ring polls.
+  bool io_uring = false;
+};
+
+class Worker;
+
+// Thread-per-core HTTP/1.1 server. Each worker owns a SO_REUSEPORT listener
+// and an edge-triggered epoll loop, or an io_uring one; connections never
+// migrate between workers, so there is no shared mutable state on the
+// request path. HTTPS and HTTP/3 are sharded the same way, with a second
+// SO_REUSEPORT listener and a UDP socket per worker.
+class Server {
+ public:
+  Server(const Site& site, ServerOptions options);
+  ~Server();
+  Server(const Server&) = delete;
+  Server& operator=(const Server&) = delete;
+
+  // Binds every shard and starts the worker threads. Throws
+  // std::runtime_error when a listener cannot be created.
+  void start();
+
+  // Wakes every worker, closes its connections and joins the threads.
+  void stop();
+
+  // Switches every worker to `site`, then notifies /_reload subscribers.
+  // Responses already sending a file finish from the site they started on.
+  // The site passed to the constructor must still outlive the server.
+  void reload(std::shared_ptr<const Site> site);
+
+  unsigned threads() const { return static_cast<unsigned>(workers_.size()); }
+  // True once start() has the workers on io_uring: it was asked for and
+  // the kernel has it.
+  bool io_uring() const { return io_uring_; }
+
+ private:
+  const Site& site_;
+  ServerOptions options_;
+  bool io_uring_ = false;
+  Metrics metrics_;  // outlives the workers recording into it
+  std::unique_ptr<MetricsServer> metrics_server_;
+  std::vector<std::unique_ptr<Worker>> workers_;
+  std::vector<std::thread> threads_;
+};
+
+}  // namespace mt
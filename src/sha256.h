@@ -0,0 +1,14 @@
+#pragma once
+
+#include <array>
+#include <string_view>
+
+namespace mt {
+
+using Sha256Digest = std::array<unsigned char, 32>;
+
+// FIPS 180-4 SHA-256. Identifies shared compression dictionaries (RFC 9842
+// names them by their SHA-256).
+Sha256Digest sha256(std::string_view data);
+
+}  // namespace mt
@@ -0,0 +1,306 @@
+#include "site.h"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <utility>
+
+#include "base64.h"
+#include "http.h"
+#include "mime.h"
+
+namespace mt {
+
+namespace fs = std::filesystem;
+
+namespace {
+
+// Build files a source tree keeps next to its pages, which the MIME table
+// would otherwise serve as text.
+constexpr std::array<std::string_view, 8> kBuildFiles{
+    "CMakeLists.txt", "CMakeCache.txt", "CMakeFiles", "Makefile",
+    "GNUmakefile", "makefile", "Dockerfile", "Containerfile",
+};
+
+bool skipped_name(const fs::path& p) {
+  auto name = p.filename().native();
+  if (name.empty() || name[0] == '.' || name[0] == '_') return true;
+  return std::find(kBuildFiles.begin(), kBuildFiles.end(), name) != kBuildFiles.end();
+}
+
+// A CMake build tree, whose programs have no extension and would be served
+// as text.
+bool build_tree(const fs::directory_entry& e) {
+  std::error_code ec;
+  return e.is_directory(ec) && fs::exists(e.path() / "CMakeCache.txt", ec);
+}
+
+Representation open_file(const fs::path& path) {
+  int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) throw std::runtime_error("cannot open " + path.string() + ": " + std::strerror(errno));
+  struct stat st {};
+  if (::fstat(fd, &st) != 0) {
+    int err = errno;
+    ::close(fd);
+    throw std::runtime_error("cannot stat " + path.string() + ": " + std::strerror(err));
+  }
+  return Representation{fd, nullptr, static_cast<std::size_t>(st.st_size), {}, {}, {}};
+}
+
+// Splits "a/b.html.br" into ("a/b.html", Encoding::br); identity otherwise.
+std::pair<std::string_view, Encoding> variant_of(std::string_view rel) {
+  for (auto e : {Encoding::gzip, Encoding::br, Encoding::zstd, Encoding::dcb, Encoding::dcz}) {
+    auto suffix = encoding_suffix(e);
+    if (rel.size() > suffix.size() && rel.ends_with(suffix)) {
+      return {rel.substr(0, rel.size() - suffix.size()), e};
+    }
+  }
+  return {rel, Encoding::identity};
+}
+
+}  // namespace
+
+bool Resource::has_variants() const {
+  for (std::size_t e = 1; e < kEncodingCount; ++e) {
+    if (reps[e].size > 0) return true;
+  }
+  return false;
+}
+
+Encoding Resource::select(unsigned accepted, std::string_view available_dictionary) const {
+  if (dictionary_id.empty() || available_dictionary != dictionary_id) accepted &= ~kDictionaryEncodings;
+  std::size_t best = 0;
+  for (std::size_t e = 1; e < kEncodingCount; ++e) {
+    if ((accepted & (1u << e)) && reps[e].size > 0 && reps[e].size < reps[best].size) best = e;
+  }
+  return static_cast<Encoding>(best);
+}
+
+std::string_view index_alias(std::string_view path) {
+  constexpr std::string_view kIndex = "/index.html";
+  if (!path.ends_with(kIndex)) return {};
+  return path.substr(0, path.size() - kIndex.size() + 1);
+}
+
+Site::Site(Site&& other) noexcept
+    : resources_(std::move(other.resources_)),
+      lookup_(other.lookup_),
+      index_(std::move(other.index_)),
+      search_(std::move(other.search_)),
+      responses_(std::move(other.responses_)) {
+  other.resources_.clear();
+  other.index_.clear();
+}
+
+Site& Site::operator=(Site&& other) noexcept {
+  if (this != &other) {
+    close_all();
+    resources_ = std::move(other.resources_);
+    lookup_ = other.lookup_;
+    index_ = std::move(other.index_);
+    search_ = std::move(other.search_);
+    responses_ = std::move(other.responses_);
+    other.resources_.clear();
+    other.index_.clear();
+  }
+  return *this;
+}
+
+Site::~Site() { close_all(); }
+
+void Site::close_all() {
+  for (auto& r : resources_) {
+    for (auto& rep : r.reps) {
+      if (rep.fd >= 0) ::close(rep.fd);
+      rep.fd = -1;
+    }
+  }
+}
+
+std::vector<SiteFile> list_site(const fs::path& root, std::vector<std::string>* variants) {
+  std::error_code ec;
+  if (!fs::is_directory(root, ec)) {
+    throw std::runtime_error("site root is not a directory: " + root.string());
+  }
+  auto it = fs::recursive_directory_iterator(root, fs::directory_options::none, ec);
+  if (ec) throw std::runtime_error("cannot read " + root.string() + ": " + ec.message());
+
+  // The iterator yields root / rel, so rel is a suffix of the native path.
+  auto prefix = (root / "").native().size();
+  std::vector<SiteFile> files;
+  for (auto end = fs::recursive_directory_iterator(); it != end; it.increment(ec)) {
+    if (ec) throw std::runtime_error("cannot read " + root.string() + ": " + ec.message());
+    if (skipped_name(it->path()) || build_tree(*it)) {
+      if (it->is_directory()) it.disable_recursion_pending();
+      continue;
+    }
+    if (!it->is_regular_file()) continue;
+
+    auto rel = it->path().native().substr(prefix);
+    if (variant_of(rel).second != Encoding::identity) {
+      if (variants != nullptr) variants->push_back(std::move(rel));
+      continue;
+    }
+    auto type = content_type_for(rel);
+    if (!type.empty()) files.push_back({std::move(rel), type});
+  }
+  return files;
+}
+
+Site Site::load(const fs::path& root) {
+  Site site;
+  std::vector<std::string> variants;
+  for (auto& file : list_site(root, &variants)) {
+    Resource r;
+    r.path = "/";
+    r.path += file.rel;
+    r.content_type = file.content_type;
+    r.reps[0] = open_file(root / file.rel);
+    site.resources_.push_back(std::move(r));
+  }
+
+  std::sort(site.resources_.begin(), site.resources_.end(),
+            [](const Resource& a, const Resource& b) { return a.path < b.path; });
+
+  for (std::size_t i = 0; i < site.resources_.size(); ++i) {
+    const auto& path = site.resources_[i].path;
+    site.index_.emplace(path, i);
+    if (auto alias = index_alias(path); !alias.empty()) site.index_.emplace(alias, i);
+  }
+
+  for (const auto& rel : variants) {
+    auto [base, encoding] = variant_of(rel);
+    std::string key = "/";
+    key += base;
+    auto found = site.index_.find(key);
+    if (found == site.index_.end()) continue;  // e.g. a downloadable archive
+    auto& rep = site.resources_[found->second].reps[static_cast<std::size_t>(encoding)];
+    rep = open_file(root / rel);
+    if (rep.size == 0) {  // an empty variant would be mistaken for "absent"
+      ::close(rep.fd);
+      rep = {};
+    }
+  }
+  for (auto& r : site.resources_) read_dictionary_id(r);
+
+  std::ifstream headers(root / ".mtsite-headers");
+  std::string line;
+  while (std::getline(headers, line)) {
+    if (line.empty() || line[0] == '#') continue;
+    auto space = line.find(' ');
+    bool valid = space != std::string::npos && line.find(':', space) != std::string::npos;
+    if (!valid || line.find('\r') != std::string::npos) {
+      throw std::runtime_error("malformed .mtsite-headers line: " + line);
+    }
+    auto found = site.index_.find(std::string_view(line).substr(0, space));
+    if (found == site.index_.end()) continue;
+    auto& r = site.resources_[found->second];
+    auto field = std::string_view(line).substr(space + 1);
+    if (auto colon = field.find(':'); http::iequals(field.substr(0, colon), "etag")) {
+      auto value = field.substr(colon + 1);
+      while (value.starts_with(' ')) value.remove_prefix(1);
+      r.etags[0] = value;
+      continue;
+    }
+    r.headers.append(field);
+    r.headers += "\r\n";
+    if (r.headers.size() > kMaxExtraHeaders) throw std::runtime_error("too many extra headers for " + r.path);
+  }
+  for (auto& r : site.resources_) {
+    derive_etags(r);
+    encode_stream_heads(r);
+  }
+  site.search_ = SearchIndex::open(root / kSearchIndexName);
+  site.responses_ = ResponsePack::open(root / kResponsesName);
+  site.attach_responses();
+  return site;
+}
+
+void Site::attach_responses() {
+  for (std::size_t i = 0; i < responses_.size(); ++i) {
+    const auto& entry = responses_.entry(i);
+    auto found = index_.find(responses_.path(entry));
+    if (found == index_.end()) continue;
+    auto& r = resources_[found->second];
+    auto& rep = r.reps[entry.encoding];
+    // A file rebuilt since the responses were written has a new tag.
+    if (rep.size != entry.body_size || r.etags[entry.encoding].empty() ||
+        r.etags[entry.encoding] != responses_.etag(entry)) {
+      continue;
+    }
+    rep.head = responses_.head(entry);
+    if (const char* body = responses_.body(entry); body != nullptr && rep.data == nullptr) rep.data = body;
+  }
+}
+
+void Site::read_dictionary_id(Resource& r) {
+  for (auto e : {Encoding::dcb, Encoding::dcz}) {
+    auto& rep = r.reps[static_cast<std::size_t>(e)];
+    if (rep.size == 0) continue;
+    auto magic = dictionary_magic(e);
+    std::string head(magic.size() + 32, '\0');
+    bool ok = rep.size > head.size();
+    if (ok && rep.data != nullptr) {
+      head.assign(rep.data, head.size());
+    } else if (ok) {
+      ok = ::pread(rep.fd, head.data(), head.size(), 0) == static_cast<ssize_t>(head.size());
+    }
+    std::string id = ":";
+    id += base64_encode(std::string_view(head).substr(magic.size()));
+    id += ':';
+    ok = ok && head.starts_with(magic) && (r.dictionary_id.empty() || r.dictionary_id == id);
+    if (!ok) {  // corrupt, or built against a different dictionary than its sibling
+      if (rep.fd >= 0) ::close(rep.fd);
+      rep = {};
+      continue;
+    }
+    r.dictionary_id = std::move(id);
+  }
+}
+
+void Site::derive_etags(Resource& r) {
+  const auto& base = r.etags[0];
+  if (base.size() < 2 || base.back() != '"') return;
+  for (std::size_t e = 1; e < kEncodingCount; ++e) {
+    auto& tag = r.etags[e];
+    tag.clear();
+    if (r.reps[e].size == 0) continue;
+    auto encoding = static_cast<Encoding>(e);
+    tag.append(base, 0, base.size() - 1);
+    tag += '-';
+    tag += encoding_token(encoding);
+    if (encoding_bit(encoding) & kDictionaryEncodings) {
+      // The dcb/dcz bytes also depend on the dictionary. Take 8 characters
+      // of its id. Base64 is all etagc, so they can go straight in.
+      tag += '-';
+      tag.append(r.dictionary_id, 1, 8);
+    }
+    tag += '"';
+  }
+}
+
+void Site::encode_stream_heads(Resource& r) {
+  for (std::size_t e = 0; e < kEncodingCount; ++e) {
+    if (e > 0 && r.reps[e].size == 0) continue;
+    r.reps[e].h2_head = encoded_response_head(r, static_cast<Encoding>(e), kHpackCodec);
+    r.reps[e].h3_head = encoded_response_head(r, static_cast<Encoding>(e), kQpackCodec);
+  }
+}
+
+const Resource* Site::find(std::string_view path) const {
+  if (lookup_ != nullptr) {
+    int i = lookup_(path);
+    return i < 0 ? nullptr : &resources_[static_cast<std::size_t>(i)];
+  }
+  auto it = index_.find(path);
+  return it == index_.end() ? nullptr : &resources_[it->second];
+}
+
+}  // namespace mt
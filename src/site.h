@@ -0,0 +1,145 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <filesystem>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "encoding.h"
+#include "responses.h"
+#include "search.h"
+
+namespace mt {
+
+// One stored encoding of a file: an open descriptor when read from disk, or
+// a pointer into .rodata when compiled into the binary. A small file's body
+// may also be in the site's mapped responses file (see responses.h).
+struct Representation {
+  int fd = -1;
+  const char* data = nullptr;
+  std::size_t size = 0;
+  // Its pre-serialized 200 response head from the responses file, without
+  // Date, Connection or the final blank line; empty if there is none.
+  std::string_view head;
+  // The same head as an HPACK header block for HTTP/2 and a QPACK field
+  // section for HTTP/3, without date. Every representation has them (see
+  // encoded_response_head()).
+  std::string h2_head;
+  std::string h3_head;
+};
+
+// One servable file. Descriptors stay open for the life of the Site so the
+// hot path is a table lookup followed by sendfile(2).
+struct Resource {
+  std::string path;               // URL path, e.g. "/index.html"
+  std::string_view content_type;  // points into the static MIME table
+  // Indexed by Encoding. Identity is always present; a precompressed variant
+  // is present when its size is non-zero.
+  std::array<Representation, kEncodingCount> reps{};
+  // Extra response header lines from the build, each ending in CRLF.
+  std::string headers;
+  // Available-Dictionary value (":<base64 SHA-256>:") the dcb/dcz variants
+  // were compressed against; empty when there are none.
+  std::string dictionary_id;
+  // Strong ETag of each present representation, quoted. They come from the
+  // content hash the build recorded for the file. Empty when the site was
+  // not built by mtsite.
+  std::array<std::string, kEncodingCount> etags{};
+
+  const Representation& identity() const { return reps[0]; }
+  bool has_variants() const;
+
+  // The smallest representation whose encoding is set in `accepted`, a mask
+  // from parse_accept_encoding(). Dictionary encodings are only considered
+  // when `available_dictionary` names this resource's dictionary.
+  Encoding select(unsigned accepted, std::string_view available_dictionary) const;
+};
+
+// Upper bound on Resource::headers, so response heads fit a fixed buffer.
+inline constexpr std::size_t kMaxExtraHeaders = 512;
+
+// "/dir/index.html" -> "/dir/", the alias a directory URL resolves through;
+// empty for any other path.
+std::string_view index_alias(std::string_view path);
+
+// A file under a site root that Site::load() serves.
+struct SiteFile {
+  std::string rel;                // path relative to the root, e.g. "dir/index.html"
+  std::string_view content_type;  // points into the static MIME table
+};
+
+// Every servable file under `root`, unsorted, by the rules Site::load()
+// documents, without opening any of them. Precompressed variants are not
+// listed; their relative paths go to `variants` if non-null. Throws
+// std::runtime_error.
+std::vector<SiteFile> list_site(const std::filesystem::path& root, std::vector<std::string>* variants = nullptr);
+
+// Immutable snapshot of the site root, shared read-only by every worker.
+class Site {
+ public:
+  Site() = default;
+  Site(Site&& other) noexcept;
+  Site& operator=(Site&& other) noexcept;
+  Site(const Site&) = delete;
+  Site& operator=(const Site&) = delete;
+  ~Site();
+
+  // Opens every servable file under `root`. Hidden entries and entries
+  // starting with '_' (build directories) are skipped, as are build files
+  // (CMakeLists.txt, Makefile, ...), directories holding a CMakeCache.txt,
+  // and files whose extension has no known Content-Type. "<file>.gz", ".br" and ".zst" next
+  // to a servable file are attached to it as precompressed variants rather
+  // than served on their own, as are ".dcb"/".dcz" shared-dictionary variants.
+  // Extra headers for any file come from a ".mtsite-headers" file in `root`
+  // ("<url path> <Name>: <value>" per line). An ETag line there sets the
+  // identity representation's tag; the variants' tags derive from it.
+  // A ".mtsite-search" index there is mapped for search(). A
+  // ".mtsite-responses" file there is mapped too, and each of its entries
+  // whose body size and ETag still match the file's gives that
+  // representation its head and, when inlined, its body.
+  // Throws std::runtime_error.
+  static Site load(const std::filesystem::path& root);
+
+  // Builds the site from the files mtembed compiled into the binary, and
+  // the search index with them if the site directory had one. Only defined
+  // in MT_EMBED_SITE builds; touches no filesystem state.
+  static Site embedded();
+
+  // Looks up a decoded URL path. "/" and "/dir/" resolve to their
+  // index.html. Returns nullptr when nothing matches.
+  const Resource* find(std::string_view path) const;
+
+  const std::vector<Resource>& resources() const { return resources_; }
+
+  // The site's full-text index; empty if it has none.
+  const SearchIndex& search() const { return search_; }
+
+ private:
+  struct StringHash {
+    using is_transparent = void;
+    std::size_t operator()(std::string_view s) const { return std::hash<std::string_view>{}(s); }
+  };
+
+  void close_all();
+  // Fills dictionary_id from the header of the first dcb/dcz variant.
+  static void read_dictionary_id(Resource& r);
+  // Fills etags[1..] from etags[0]: each variant gets its coding appended,
+  // plus a dictionary tag for dcb/dcz, so no two representations share an
+  // ETag.
+  static void derive_etags(Resource& r);
+  // Fills each present representation's h2_head and h3_head.
+  static void encode_stream_heads(Resource& r);
+  // Points representations into responses_ (see load()).
+  void attach_responses();
+
+  std::vector<Resource> resources_;
+  int (*lookup_)(std::string_view) = nullptr;  // compile-time route table, if embedded
+  std::unordered_map<std::string, std::size_t, StringHash, std::equal_to<>> index_;
+  SearchIndex search_;
+  ResponsePack responses_;
+};
+
+}  // namespace mt
@@ -0,0 +1,320 @@
+#include "tls.h"
+
+#include <linux/tls.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <openssl/crypto.h>
+#include <openssl/evp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+namespace mt::tls {
+
+namespace {
+
+// Record content types.
+constexpr std::uint8_t kChangeCipherSpec = 20;
+constexpr std::uint8_t kAlert = 21;
+constexpr std::uint8_t kHandshake = 22;
+constexpr std::uint8_t kApplicationData = 23;
+
+constexpr std::size_t kHeaderSize = 5;
+constexpr std::size_t kTagSize = 16;
+// A protected record's payload: the plaintext, its type, up to 255 bytes
+// of padding and the tag (section 5.2).
+constexpr std::size_t kMaxCiphertext = kMaxRecord + 256;
+
+void put_header(std::string& out, std::uint8_t type, std::size_t length) {
+  out += static_cast<char>(type);
+  out += "\x03\x03";  // legacy_record_version
+  out += static_cast<char>(length >> 8);
+  out += static_cast<char>(length);
+}
+
+}  // namespace
+
+bool kernel_tls_available() {
+  int fd = ::socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd < 0) return false;
+  // The kernel looks the protocol up, loading its module if it may, before
+  // refusing a socket that is not connected.
+  bool ok = ::setsockopt(fd, SOL_TCP, TCP_ULP, "tls", sizeof "tls") == 0 || errno == ENOTCONN;
+  ::close(fd);
+  return ok;
+}
+
+Session::Keys::~Keys() {
+  EVP_CIPHER_CTX_free(aead);
+  OPENSSL_cleanse(key.data(), key.size());
+}
+
+void Session::Keys::set(const std::string& traffic_secret) {
+  secret = traffic_secret;
+  auto k = tls13::hkdf_expand_label(secret, "key", {}, key.size());
+  auto i = tls13::hkdf_expand_label(secret, "iv", {}, iv.size());
+  std::memcpy(key.data(), k.data(), key.size());
+  std::memcpy(iv.data(), i.data(), iv.size());
+  OPENSSL_cleanse(k.data(), k.size());
+  sequence = 0;
+  if (aead == nullptr) aead = EVP_CIPHER_CTX_new();
+  // The key is set once; each record then sets only its nonce.
+  EVP_CipherInit_ex(aead, EVP_aes_128_gcm(), nullptr, key.data(), nullptr, 1);
+}
+
+std::array<std::uint8_t, 12> Session::Keys::nonce() const {
+  auto n = iv;
+  for (std::size_t i = 0; i < 8; ++i) n[11 - i] ^= static_cast<std::uint8_t>(sequence >> (8 * i));
+  return n;
+}
+
+Session::Session(std::shared_ptr<const tls13::Credentials> credentials, std::vector<std::string> alpn)
+    : handshake_(std::move(credentials), std::move(alpn), {}), server_(true) {}
+
+Session::Session(std::string server_name, std::string alpn)
+    : handshake_(std::move(server_name), std::move(alpn), {}), server_(false) {
+  flush_handshake();
+}
+
+Session::~Session() = default;
+
+bool Session::receive(std::string_view data, std::string& plaintext) {
+  if (closed_) return false;
+  input_ += data;
+  std::string_view in = input_;
+  while (in.size() >= kHeaderSize) {
+    auto* p = reinterpret_cast<const unsigned char*>(in.data());
+    std::size_t length = static_cast<std::size_t>(p[3]) << 8 | p[4];
+    if (length > kMaxCiphertext) {
+      alert(tls13::kRecordOverflow);
+      closed_ = true;
+      break;
+    }
+    if (in.size() < kHeaderSize + length) break;
+    if (!on_record(p[0], in.substr(0, kHeaderSize), in.substr(kHeaderSize, length), plaintext)) {
+      closed_ = true;
+      break;
+    }
+    in.remove_prefix(kHeaderSize + length);
+  }
+  if (closed_) {
+    input_.clear();
+    return false;
+  }
+  input_.erase(0, input_.size() - in.size());
+  return true;
+}
+
+bool Session::on_record(std::uint8_t type, std::string_view header, std::string_view body, std::string& plaintext) {
+  if (type == kChangeCipherSpec) {
+    // Sent for middleboxes' sake (appendix D.4) during the handshake, and
+    // otherwise meaningless.
+    if (!established() && body == "\x01") return true;
+    alert(tls13::kUnexpectedMessage);
+    return false;
+  }
+  std::string_view content = body;
+  std::size_t start = plaintext.size();
+  if (read_level_ != tls13::Level::initial) {
+    if (type != kApplicationData) {
+      alert(tls13::kUnexpectedMessage);
+      return false;
+    }
+    if (body.size() < kTagSize + 1) {
+      alert(tls13::kBadRecordMac);
+      return false;
+    }
+    // Decrypted straight into `plaintext`; anything but application data
+    // is taken back out.
+    std::size_t size = body.size() - kTagSize;
+    plaintext.resize(start + size);
+    auto* out = reinterpret_cast<unsigned char*>(plaintext.data() + start);
+    auto* in = reinterpret_cast<const unsigned char*>(body.data());
+    auto nonce = read_.nonce();
+    int n = 0;
+    EVP_DecryptInit_ex(read_.aead, nullptr, nullptr, nullptr, nonce.data());
+    EVP_DecryptUpdate(read_.aead, nullptr, &n, reinterpret_cast<const unsigned char*>(header.data()),
+                      static_cast<int>(header.size()));
+    EVP_DecryptUpdate(read_.aead, out, &n, in, static_cast<int>(size));
+    EVP_CIPHER_CTX_ctrl(read_.aead, EVP_CTRL_AEAD_SET_TAG, kTagSize, const_cast<unsigned char*>(in + size));
+    bool authentic = EVP_DecryptFinal_ex(read_.aead, out + n, &n) == 1;
+    ++read_.sequence;
+    // The content type is the last byte that is not padding.
+    while (size > 0 && out[size - 1] == 0) --size;
+    if (!authentic || size == 0) {
+      plaintext.resize(start);
+      alert(authentic ? tls13::kUnexpectedMessage : tls13::kBadRecordMac);
+      return false;
+    }
+    type = out[--size];
+    plaintext.resize(start + size);
+    if (size > kMaxRecord) {
+      plaintext.resize(start);
+      alert(tls13::kRecordOverflow);
+      return false;
+    }
+    content = std::string_view(plaintext).substr(start);
+  }
+
+  switch (type) {
+    case kApplicationData:
+      if (established() && read_level_ == tls13::Level::application) return true;
+      break;
+    case kAlert:
+      // close_notify or an error: either way the peer is done.
+      plaintext.resize(start);
+      return false;
+    case kHandshake: {
+      bool ok = handshake_.receive(read_level_, content);
+      plaintext.resize(start);
+      if (!ok) {
+        alert(handshake_.alert());
+        return false;
+      }
+      step_keys();
+      // What we owe in reply goes out under the keys it was written for.
+      flush_handshake();
+      return !closed_;
+    }
+    default:
+      break;
+  }
+  plaintext.resize(start);
+  alert(tls13::kUnexpectedMessage);
+  return false;
+}
+
+// Moves reading on to the keys the handshake has just made current: the
+// handshake ones after the ServerHello, the application ones after the
+// Finished, and the next ones after a KeyUpdate.
+void Session::step_keys() {
+  using tls13::Level;
+  if (read_level_ == Level::initial && !handshake_.read_secret(Level::handshake).empty()) {
+    read_level_ = Level::handshake;
+  } else if (read_level_ == Level::handshake && established()) {
+    read_level_ = Level::application;
+  } else if (read_level_ != Level::application || read_.secret == handshake_.read_secret(Level::application)) {
+    return;
+  }
+  read_.set(handshake_.read_secret(read_level_));
+}
+
+void Session::flush_handshake() {
+  using tls13::Level;
+  for (std::size_t i = 0; i < tls13::kLevels; ++i) {
+    auto level = static_cast<Level>(i);
+    auto& out = handshake_.output(level);
+    if (out.empty()) continue;
+    if (offloaded_) {
+      // Our KeyUpdate: the kernel would have to change keys with it.
+      closed_ = true;
+      return;
+    }
+    if (level != write_level_) {
+      write_level_ = level;
+      write_.set(handshake_.write_secret(level));
+    }
+    record(kHandshake, out);
+    out.clear();
+    if (server_ && level == Level::initial) {
+      put_header(output_, kChangeCipherSpec, 1);
+      output_ += '\x01';
+    }
+  }
+  auto& secret = handshake_.write_secret(Level::application);
+  if (established() && write_.secret != secret) {
+    write_level_ = Level::application;
+    write_.set(secret);
+  }
+}
+
+std::size_t Session::write(const iovec* iov, std::size_t count, std::size_t limit) {
+  std::size_t size = 0;
+  for (std::size_t i = 0; i < count && size < limit; ++i) size += iov[i].iov_len;
+  size = std::min(size, limit);
+  if (size > 0) seal(kApplicationData, iov, count, size);
+  return size;
+}
+
+void Session::sent(std::size_t n) {
+  sent_ += n;
+  if (sent_ == output_.size()) {
+    output_.clear();
+    sent_ = 0;
+  }
+}
+
+void Session::record(std::uint8_t type, std::string_view data) {
+  if (write_level_ != tls13::Level::initial) {
+    iovec iov{const_cast<char*>(data.data()), data.size()};
+    return seal(type, &iov, 1, data.size());
+  }
+  for (std::size_t at = 0; at < data.size(); at += kMaxRecord) {
+    auto fragment = data.substr(at, kMaxRecord);
+    put_header(output_, type, fragment.size());
+    output_ += fragment;
+  }
+}
+
+// Protects `size` bytes from `iov` as records of `type`, each copied to
+// the end of output_ and encrypted there.
+void Session::seal(std::uint8_t type, const iovec* iov, std::size_t count, std::size_t size) {
+  std::size_t piece = 0;
+  std::size_t piece_off = 0;
+  do {
+    std::size_t length = std::min(size, kMaxRecord);
+    size -= length;
+    std::size_t at = output_.size();
+    put_header(output_, kApplicationData, length + 1 + kTagSize);
+    for (std::size_t left = length; left > 0;) {
+      auto take = std::min(left, iov[piece].iov_len - piece_off);
+      output_.append(static_cast<const char*>(iov[piece].iov_base) + piece_off, take);
+      left -= take;
+      piece_off += take;
+      if (piece_off == iov[piece].iov_len && piece + 1 < count) ++piece, piece_off = 0;
+    }
+    output_ += static_cast<char>(type);
+    output_.resize(output_.size() + kTagSize);
+
+    auto* header = reinterpret_cast<unsigned char*>(output_.data() + at);
+    auto* payload = header + kHeaderSize;
+    auto nonce = write_.nonce();
+    int n = 0;
+    EVP_EncryptInit_ex(write_.aead, nullptr, nullptr, nullptr, nonce.data());
+    EVP_EncryptUpdate(write_.aead, nullptr, &n, header, kHeaderSize);
+    EVP_EncryptUpdate(write_.aead, payload, &n, payload, static_cast<int>(length + 1));
+    EVP_EncryptFinal_ex(write_.aead, payload + n, &n);
+    EVP_CIPHER_CTX_ctrl(write_.aead, EVP_CTRL_AEAD_GET_TAG, kTagSize, payload + length + 1);
+    ++write_.sequence;
+  } while (size > 0);
+}
+
+void Session::alert(std::uint8_t description) {
+  // Once the kernel holds the keys, the connection just closes.
+  if (offloaded_) return;
+  const char body[] = {2, static_cast<char>(description)};  // fatal
+  record(kAlert, std::string_view(body, sizeof body));
+}
+
+bool Session::offload(int fd) {
+  if (!established() || sent_ != output_.size() || write_level_ != tls13::Level::application) return false;
+  if (::setsockopt(fd, SOL_TCP, TCP_ULP, "tls", sizeof "tls") != 0) return false;
+  tls12_crypto_info_aes_gcm_128 info{};
+  info.info.version = TLS_1_3_VERSION;
+  info.info.cipher_type = TLS_CIPHER_AES_GCM_128;
+  std::memcpy(info.key, write_.key.data(), sizeof info.key);
+  // The kernel's nonce is salt and iv together, XORed with the sequence.
+  std::memcpy(info.salt, write_.iv.data(), sizeof info.salt);
+  std::memcpy(info.iv, write_.iv.data() + sizeof info.salt, sizeof info.iv);
+  for (std::size_t i = 0; i < sizeof info.rec_seq; ++i) {
+    info.rec_seq[i] = static_cast<unsigned char>(write_.sequence >> (56 - 8 * i));
+  }
+  offloaded_ = ::setsockopt(fd, SOL_TLS, TLS_TX, &info, sizeof info) == 0;
+  OPENSSL_cleanse(&info, sizeof info);
+  return offloaded_;
+}
+
+}  // namespace mt::tls
@@ -0,0 +1,106 @@
+#pragma once
+
+#include <sys/uio.h>
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "tls13.h"
+
+struct evp_cipher_ctx_st;
+
+// TLS 1.3 over TCP: the record layer (RFC 8446 section 5) around a
+// tls13::Handshake. Like http2::Session it does no I/O; the caller feeds it
+// what it reads and sends what it queues. Once the handshake is done it
+// either encrypts application data itself or hands its keys to the kernel
+// (kTLS), after which plain writes and sendfile(2) on the socket are
+// encrypted there, without a copy through userspace.
+namespace mt::tls {
+
+// The largest plaintext a record carries.
+inline constexpr std::size_t kMaxRecord = 16384;
+
+// True if this kernel has kTLS: the "tls" TCP upper-layer protocol.
+bool kernel_tls_available();
+
+class Session {
+ public:
+  // A server, choosing the first of `alpn` the client offers.
+  Session(std::shared_ptr<const tls13::Credentials> credentials, std::vector<std::string> alpn);
+  // A client, which queues its ClientHello at once. See tls13::Handshake:
+  // the server is not authenticated.
+  Session(std::string server_name, std::string alpn);
+  ~Session();
+  Session(const Session&) = delete;
+  Session& operator=(const Session&) = delete;
+
+  // Takes bytes read from the socket and appends the application data in
+  // them to `plaintext`. Returns false once the connection should close:
+  // on an error, after queuing the alert, or when the peer has sent one
+  // (close_notify included).
+  bool receive(std::string_view data, std::string& plaintext);
+
+  // Encrypts up to `limit` bytes from `iov` as application data and queues
+  // the records. Returns how many it took. Only once established() and
+  // not offloaded().
+  std::size_t write(const iovec* iov, std::size_t count, std::size_t limit);
+
+  // Bytes queued to send, and how many of them went.
+  std::string_view pending() const { return std::string_view(output_).substr(sent_); }
+  void sent(std::size_t n);
+
+  bool established() const { return handshake_.complete(); }
+  // The protocol ALPN chose; empty if none.
+  const std::string& alpn() const { return handshake_.alpn(); }
+
+  // Installs our application keys and sequence number on socket `fd` as
+  // its kTLS transmit state, so the socket encrypts what is written to it.
+  // Call once established() with nothing pending(). Returns false, and
+  // leaves the socket usable as before, when the kernel refuses; writes
+  // then stay with write().
+  bool offload(int fd);
+  bool offloaded() const { return offloaded_; }
+
+ private:
+  // AES-128-GCM record protection for one direction (section 5.3).
+  struct Keys {
+    Keys() = default;
+    ~Keys();
+    Keys(const Keys&) = delete;
+    Keys& operator=(const Keys&) = delete;
+    void set(const std::string& traffic_secret);
+    std::array<std::uint8_t, 12> nonce() const;
+
+    std::string secret;  // empty until set
+    std::array<std::uint8_t, 16> key{};
+    std::array<std::uint8_t, 12> iv{};
+    std::uint64_t sequence = 0;
+    evp_cipher_ctx_st* aead = nullptr;
+  };
+
+  bool on_record(std::uint8_t type, std::string_view header, std::string_view body, std::string& plaintext);
+  void flush_handshake();
+  void seal(std::uint8_t type, const iovec* iov, std::size_t count, std::size_t size);
+  void record(std::uint8_t type, std::string_view data);
+  void alert(std::uint8_t description);
+  void step_keys();
+
+  tls13::Handshake handshake_;
+  bool server_;
+  tls13::Level read_level_ = tls13::Level::initial;
+  tls13::Level write_level_ = tls13::Level::initial;
+  Keys read_;
+  Keys write_;
+  std::string input_;  // a record not yet wholly received
+  std::string output_;
+  std::size_t sent_ = 0;
+  bool offloaded_ = false;
+  bool closed_ = false;
+};
+
+}  // namespace mt::tls
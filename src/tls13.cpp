@@ -0,0 +1,689 @@
+#include "tls13.h"
+
+#include <openssl/bio.h>
+#include <openssl/evp.h>
+#include <openssl/hmac.h>
+#include <openssl/pem.h>
+#include <openssl/rand.h>
+#include <openssl/rsa.h>
+#include <openssl/x509.h>
+
+#include <cstring>
+#include <stdexcept>
+
+namespace mt::tls13 {
+
+namespace {
+
+// Handshake message types.
+constexpr std::uint8_t kClientHello = 1;
+constexpr std::uint8_t kServerHello = 2;
+constexpr std::uint8_t kEncryptedExtensions = 8;
+constexpr std::uint8_t kCertificate = 11;
+constexpr std::uint8_t kCertificateVerify = 15;
+constexpr std::uint8_t kFinished = 20;
+constexpr std::uint8_t kKeyUpdate = 24;
+
+// Extensions.
+constexpr std::uint16_t kServerName = 0;
+constexpr std::uint16_t kSupportedGroups = 10;
+constexpr std::uint16_t kSignatureAlgorithms = 13;
+constexpr std::uint16_t kAlpn = 16;
+constexpr std::uint16_t kSupportedVersions = 43;
+constexpr std::uint16_t kKeyShare = 51;
+constexpr std::uint16_t kQuicTransportParameters = 0x39;
+
+constexpr std::uint16_t kTls13 = 0x0304;
+constexpr std::uint16_t kAes128GcmSha256 = 0x1301;
+constexpr std::uint16_t kX25519 = 0x001d;
+constexpr std::size_t kX25519Size = 32;
+constexpr std::uint16_t kEcdsaP256Sha256 = 0x0403;
+constexpr std::uint16_t kRsaPssSha256 = 0x0804;
+constexpr std::uint16_t kEd25519 = 0x0807;
+
+// A bounds-checked reader of the big-endian, length-prefixed fields TLS
+// messages are made of. Every read fails once one has.
+class Reader {
+ public:
+  explicit Reader(std::string_view data) : data_(data) {}
+
+  bool ok() const { return ok_; }
+  bool empty() const { return data_.empty(); }
+
+  std::uint32_t number(std::size_t bytes) {
+    if (!ok_ || data_.size() < bytes) return fail(), 0;
+    std::uint32_t v = 0;
+    for (std::size_t i = 0; i < bytes; ++i) v = v << 8 | static_cast<unsigned char>(data_[i]);
+    data_.remove_prefix(bytes);
+    return v;
+  }
+  std::string_view bytes(std::size_t n) {
+    if (!ok_ || data_.size() < n) return fail(), std::string_view();
+    auto out = data_.substr(0, n);
+    data_.remove_prefix(n);
+    return out;
+  }
+  // A vector with a `length_bytes`-byte length prefix.
+  std::string_view vector(std::size_t length_bytes) { return bytes(number(length_bytes)); }
+
+ private:
+  void fail() {
+    ok_ = false;
+    data_ = {};
+  }
+  std::string_view data_;
+  bool ok_ = true;
+};
+
+void put(std::string& out, std::uint32_t v, std::size_t bytes) {
+  for (std::size_t i = bytes; i-- > 0;) out += static_cast<char>(v >> (8 * i));
+}
+
+void put_vector(std::string& out, std::string_view v, std::size_t length_bytes) {
+  put(out, static_cast<std::uint32_t>(v.size()), length_bytes);
+  out += v;
+}
+
+void put_extension(std::string& out, std::uint16_t type, std::string_view body) {
+  put(out, type, 2);
+  put_vector(out, body, 2);
+}
+
+const unsigned char* bytes_of(std::string_view s) { return reinterpret_cast<const unsigned char*>(s.data()); }
+
+std::string hmac(std::string_view key, std::string_view data) {
+  std::string out(EVP_MAX_MD_SIZE, '\0');
+  unsigned size = 0;
+  HMAC(EVP_sha256(), key.data(), static_cast<int>(key.size()), bytes_of(data), data.size(),
+       reinterpret_cast<unsigned char*>(out.data()), &size);
+  out.resize(size);
+  return out;
+}
+
+std::string random_bytes(std::size_t n) {
+  std::string out(n, '\0');
+  if (RAND_bytes(reinterpret_cast<unsigned char*>(out.data()), static_cast<int>(n)) != 1) {
+    throw std::runtime_error("RAND_bytes failed");
+  }
+  return out;
+}
+
+EVP_PKEY* generate_x25519() {
+  EVP_PKEY* key = nullptr;
+  EVP_PKEY_CTX* ctx = EVP_PKEY_CTX_new_id(EVP_PKEY_X25519, nullptr);
+  if (ctx == nullptr || EVP_PKEY_keygen_init(ctx) != 1 || EVP_PKEY_keygen(ctx, &key) != 1) key = nullptr;
+  EVP_PKEY_CTX_free(ctx);
+  if (key == nullptr) throw std::runtime_error("X25519 key generation failed");
+  return key;
+}
+
+std::string public_share(EVP_PKEY* key) {
+  std::string out(kX25519Size, '\0');
+  std::size_t size = out.size();
+  EVP_PKEY_get_raw_public_key(key, reinterpret_cast<unsigned char*>(out.data()), &size);
+  return out;
+}
+
+// The X25519 shared secret, or empty if the peer's share is invalid.
+std::string shared_secret(EVP_PKEY* key, std::string_view peer_share) {
+  std::string out;
+  EVP_PKEY* peer = EVP_PKEY_new_raw_public_key(EVP_PKEY_X25519, nullptr, bytes_of(peer_share), peer_share.size());
+  EVP_PKEY_CTX* ctx = peer != nullptr ? EVP_PKEY_CTX_new(key, nullptr) : nullptr;
+  std::size_t size = kX25519Size;
+  out.resize(size);
+  if (ctx == nullptr || EVP_PKEY_derive_init(ctx) != 1 || EVP_PKEY_derive_set_peer(ctx, peer) != 1 ||
+      EVP_PKEY_derive(ctx, reinterpret_cast<unsigned char*>(out.data()), &size) != 1 || size != kX25519Size) {
+    out.clear();
+  }
+  EVP_PKEY_CTX_free(ctx);
+  EVP_PKEY_free(peer);
+  return out;
+}
+
+// The signature scheme we sign with using `key`, or 0 for key types we do
+// not support.
+std::uint16_t scheme_for(EVP_PKEY* key) {
+  switch (EVP_PKEY_get_base_id(key)) {
+    case EVP_PKEY_EC: {
+      char group[32] = {};
+      std::size_t size = 0;
+      if (EVP_PKEY_get_group_name(key, group, sizeof group, &size) != 1) return 0;
+      return std::string_view(group) == "prime256v1" ? kEcdsaP256Sha256 : 0;
+    }
+    case EVP_PKEY_ED25519:
+      return kEd25519;
+    case EVP_PKEY_RSA:
+      return kRsaPssSha256;
+    default:
+      return 0;
+  }
+}
+
+// What CertificateVerify signs (RFC 8446 section 4.4.3).
+std::string signed_content(std::string_view transcript_hash) {
+  std::string out(64, ' ');
+  out += "TLS 1.3, server CertificateVerify";
+  out += '\0';
+  out += transcript_hash;
+  return out;
+}
+
+// Sets up `md` to sign or verify with `scheme`.
+bool init_signature(EVP_MD_CTX* md, EVP_PKEY* key, std::uint16_t scheme, bool sign) {
+  EVP_PKEY_CTX* pctx = nullptr;
+  const EVP_MD* digest = scheme == kEd25519 ? nullptr : EVP_sha256();
+  int ok = sign ? EVP_DigestSignInit(md, &pctx, digest, nullptr, key)
+                : EVP_DigestVerifyInit(md, &pctx, digest, nullptr, key);
+  if (ok != 1) return false;
+  if (scheme == kRsaPssSha256) {
+    return EVP_PKEY_CTX_set_rsa_padding(pctx, RSA_PKCS1_PSS_PADDING) == 1 &&
+           EVP_PKEY_CTX_set_rsa_pss_saltlen(pctx, RSA_PSS_SALTLEN_DIGEST) == 1;
+  }
+  return true;
+}
+
+std::string sign(EVP_PKEY* key, std::uint16_t scheme, std::string_view content) {
+  std::string out;
+  EVP_MD_CTX* md = EVP_MD_CTX_new();
+  std::size_t size = 0;
+  if (md != nullptr && init_signature(md, key, scheme, true) &&
+      EVP_DigestSign(md, nullptr, &size, bytes_of(content), content.size()) == 1) {
+    out.resize(size);
+    if (EVP_DigestSign(md, reinterpret_cast<unsigned char*>(out.data()), &size, bytes_of(content),
+                       content.size()) == 1) {
+      out.resize(size);
+    } else {
+      out.clear();
+    }
+  }
+  EVP_MD_CTX_free(md);
+  return out;
+}
+
+bool verify(EVP_PKEY* key, std::uint16_t scheme, std::string_view content, std::string_view signature) {
+  if (scheme_for(key) != scheme) return false;
+  EVP_MD_CTX* md = EVP_MD_CTX_new();
+  bool ok = md != nullptr && init_signature(md, key, scheme, false) &&
+            EVP_DigestVerify(md, bytes_of(signature), signature.size(), bytes_of(content), content.size()) == 1;
+  EVP_MD_CTX_free(md);
+  return ok;
+}
+
+// True if `list`, a vector of 2-byte values, holds `value`.
+bool list_has(std::string_view list, std::uint16_t value) {
+  Reader r(list);
+  while (r.ok() && !r.empty()) {
+    if (r.number(2) == value) return true;
+  }
+  return false;
+}
+
+std::string alpn_extension(std::string_view alpn) {
+  std::string names;
+  put_vector(names, alpn, 1);
+  std::string body;
+  put_vector(body, names, 2);
+  return body;
+}
+
+}  // namespace
+
+std::string sha256(std::string_view data) {
+  std::string out(kHashSize, '\0');
+  EVP_Digest(data.data(), data.size(), reinterpret_cast<unsigned char*>(out.data()), nullptr, EVP_sha256(), nullptr);
+  return out;
+}
+
+std::string hkdf_extract(std::string_view salt, std::string_view ikm) {
+  return hmac(salt.empty() ? std::string(kHashSize, '\0') : std::string(salt), ikm);
+}
+
+std::string hkdf_expand_label(std::string_view secret, std::string_view label, std::string_view context,
+                              std::size_t length) {
+  std::string info;
+  put(info, static_cast<std::uint32_t>(length), 2);
+  put_vector(info, std::string("tls13 ").append(label), 1);
+  put_vector(info, context, 1);
+
+  // HKDF-Expand: T(i) = HMAC(secret, T(i - 1) | info | i).
+  std::string out;
+  std::string t;
+  for (std::uint8_t i = 1; out.size() < length; ++i) {
+    t = hmac(secret, t + info + static_cast<char>(i));
+    out += t;
+  }
+  out.resize(length);
+  return out;
+}
+
+std::shared_ptr<const Credentials> Credentials::load(const std::string& cert_path, const std::string& key_path) {
+  std::shared_ptr<Credentials> c(new Credentials());
+  BIO* bio = BIO_new_file(cert_path.c_str(), "r");
+  if (bio == nullptr) throw std::runtime_error("cannot open certificate " + cert_path);
+  X509* leaf = nullptr;
+  while (X509* cert = PEM_read_bio_X509(bio, nullptr, nullptr, nullptr)) {
+    unsigned char* der = nullptr;
+    int size = i2d_X509(cert, &der);
+    if (size > 0) c->chain_.emplace_back(reinterpret_cast<char*>(der), static_cast<std::size_t>(size));
+    OPENSSL_free(der);
+    if (leaf == nullptr) {
+      leaf = cert;
+    } else {
+      X509_free(cert);
+    }
+  }
+  BIO_free(bio);
+  if (leaf == nullptr) throw std::runtime_error("no certificate in " + cert_path);
+
+  bio = BIO_new_file(key_path.c_str(), "r");
+  c->key_ = bio != nullptr ? PEM_read_bio_PrivateKey(bio, nullptr, nullptr, nullptr) : nullptr;
+  BIO_free(bio);
+  bool matches = c->key_ != nullptr && X509_check_private_key(leaf, c->key_) == 1;
+  X509_free(leaf);
+  if (c->key_ == nullptr) throw std::runtime_error("cannot read private key " + key_path);
+  if (!matches) throw std::runtime_error(key_path + " is not the key of " + cert_path);
+  if (scheme_for(c->key_) == 0) throw std::runtime_error(key_path + ": use a P-256, Ed25519 or RSA key");
+  return c;
+}
+
+Credentials::~Credentials() { EVP_PKEY_free(key_); }
+
+Handshake::Handshake(std::shared_ptr<const Credentials> credentials, std::vector<std::string> alpn,
+                     std::string transport_parameters)
+    : server_(true),
+      credentials_(std::move(credentials)),
+      offered_(std::move(alpn)),
+      parameters_(std::move(transport_parameters)),
+      state_(State::client_hello) {}
+
+Handshake::Handshake(std::string server_name, std::string alpn, std::string transport_parameters)
+    : server_(false),
+      alpn_(std::move(alpn)),
+      parameters_(std::move(transport_parameters)),
+      state_(State::server_hello) {
+  share_ = generate_x25519();
+
+  std::string ext;
+  if (!server_name.empty()) {
+    std::string name;
+    name += '\0';  // host_name
+    put_vector(name, server_name, 2);
+    std::string list;
+    put_vector(list, name, 2);
+    put_extension(ext, kServerName, list);
+  }
+  std::string v;
+  put(v, 2, 2);
+  put(v, kX25519, 2);
+  put_extension(ext, kSupportedGroups, v);
+  v.clear();
+  put(v, 6, 2);
+  for (auto scheme : {kEcdsaP256Sha256, kRsaPssSha256, kEd25519}) put(v, scheme, 2);
+  put_extension(ext, kSignatureAlgorithms, v);
+  v.clear();
+  put(v, 2, 1);
+  put(v, kTls13, 2);
+  put_extension(ext, kSupportedVersions, v);
+  std::string share;
+  put(share, kX25519, 2);
+  put_vector(share, public_share(share_), 2);
+  v.clear();
+  put_vector(v, share, 2);
+  put_extension(ext, kKeyShare, v);
+  if (!alpn_.empty()) put_extension(ext, kAlpn, alpn_extension(alpn_));
+  if (quic()) put_extension(ext, kQuicTransportParameters, parameters_);
+
+  std::string hello;
+  put(hello, 0x0303, 2);  // legacy_version
+  hello += random_bytes(32);
+  hello += '\0';  // legacy_session_id: empty, as QUIC requires
+  put(hello, 2, 2);
+  put(hello, kAes128GcmSha256, 2);
+  hello += '\x01';
+  hello += '\0';  // legacy_compression_methods: null
+  put_vector(hello, ext, 2);
+  write_message(Level::initial, kClientHello, hello);
+}
+
+Handshake::~Handshake() {
+  EVP_PKEY_free(share_);
+  EVP_PKEY_free(peer_key_);
+}
+
+bool Handshake::fail(std::uint8_t alert) {
+  if (alert_ == 0) alert_ = alert;
+  return false;
+}
+
+bool Handshake::receive(Level level, std::string_view data) {
+  if (alert_ != 0) return false;
+  // A message may not straddle a change of keys.
+  if (level != input_level_ && !input_.empty()) return fail(kUnexpectedMessage);
+  input_level_ = level;
+  input_ += data;
+  std::size_t used = 0;
+  while (input_.size() - used >= 4) {
+    auto* p = reinterpret_cast<const unsigned char*>(input_.data() + used);
+    std::size_t length = static_cast<std::size_t>(p[1]) << 16 | static_cast<std::size_t>(p[2]) << 8 | p[3];
+    if (length > 1 << 16) return fail(kDecodeError);
+    if (input_.size() - used < 4 + length) break;
+    std::string_view message(input_.data() + used, 4 + length);
+    used += message.size();
+    // Each message arrives at the level the handshake expects it.
+    Level expected = state_ == State::client_hello || state_ == State::server_hello ? Level::initial
+                     : state_ == State::done                                       ? Level::application
+                                                                                   : Level::handshake;
+    if (level != expected) return fail(kUnexpectedMessage);
+    if (!on_message(p[0], message.substr(4), message)) return false;
+  }
+  input_.erase(0, used);
+  return true;
+}
+
+bool Handshake::on_message(std::uint8_t type, std::string_view body, std::string_view message) {
+  // The transcript covers each message up to itself, except for the two
+  // that sign or MAC the transcript before them. It ends with the
+  // handshake.
+  if (type != kCertificateVerify && type != kFinished && state_ != State::done) transcript_ += message;
+  switch (state_) {
+    case State::client_hello:
+      if (type != kClientHello) break;
+      return on_client_hello(body);
+    case State::server_hello:
+      if (type != kServerHello) break;
+      return on_server_hello(body);
+    case State::encrypted_extensions:
+      if (type != kEncryptedExtensions) break;
+      return on_encrypted_extensions(body);
+    case State::certificate:
+      if (type != kCertificate) break;
+      return on_certificate(body);
+    case State::certificate_verify:
+      if (type != kCertificateVerify) break;
+      return on_certificate_verify(body, message);
+    case State::finished:
+      if (type != kFinished) break;
+      return on_finished(body, message);
+    case State::done:
+      // QUIC updates keys itself, and forbids KeyUpdate.
+      if (type == kKeyUpdate) return quic() ? fail(kUnexpectedMessage) : on_key_update(body);
+      // New session tickets and the like: we resume nothing, so they are
+      // dropped.
+      return true;
+  }
+  return fail(kUnexpectedMessage);
+}
+
+bool Handshake::on_client_hello(std::string_view body) {
+  Reader r(body);
+  r.number(2);  // legacy_version
+  r.bytes(32);  // random
+  auto session_id = r.vector(1);
+  auto suites = r.vector(2);
+  r.vector(1);  // legacy_compression_methods
+  auto extensions = r.vector(2);
+  if (!r.ok()) return fail(kDecodeError);
+  if (!list_has(suites, kAes128GcmSha256)) return fail(kHandshakeFailure);
+
+  bool tls13 = false;
+  std::string_view alpn;
+  bool have_parameters = false;
+  std::string_view peer_share;
+  std::string_view schemes;
+  Reader e(extensions);
+  while (e.ok() && !e.empty()) {
+    auto type = e.number(2);
+    auto data = e.vector(2);
+    Reader x(data);
+    switch (type) {
+      case kSupportedVersions: {
+        Reader versions(x.vector(1));
+        while (versions.ok() && !versions.empty()) tls13 |= versions.number(2) == kTls13;
+        break;
+      }
+      case kKeyShare: {
+        Reader shares(x.vector(2));
+        while (shares.ok() && !shares.empty()) {
+          auto group = shares.number(2);
+          auto key = shares.vector(2);
+          if (group == kX25519) peer_share = key;
+        }
+        break;
+      }
+      case kSignatureAlgorithms:
+        schemes = x.vector(2);
+        break;
+      case kAlpn:
+        alpn = x.vector(2);
+        if (alpn.empty()) return fail(kDecodeError);
+        break;
+      case kQuicTransportParameters:
+        peer_parameters_ = data;
+        have_parameters = true;
+        break;
+      default:
+        break;
+    }
+  }
+  if (!e.ok()) return fail(kDecodeError);
+  if (!tls13) return fail(kProtocolVersion);
+  // Our preference decides among the protocols the client offers.
+  for (const auto& name : offered_) {
+    Reader names(alpn);
+    while (alpn_.empty() && names.ok() && !names.empty()) {
+      if (names.vector(1) == name) alpn_ = name;
+    }
+  }
+  if (alpn_.empty() && (quic() || !alpn.empty())) return fail(kNoApplicationProtocol);
+  if (quic() && !have_parameters) return fail(kMissingExtension);
+  // A client that sent no X25519 share would need a HelloRetryRequest,
+  // which we do not implement; clients send one in practice.
+  if (peer_share.size() != kX25519Size) return fail(kHandshakeFailure);
+  auto scheme = scheme_for(credentials_->key());
+  if (!list_has(schemes, scheme)) return fail(kHandshakeFailure);
+
+  share_ = generate_x25519();
+  std::string ext;
+  std::string v;
+  put(v, kTls13, 2);
+  put_extension(ext, kSupportedVersions, v);
+  v.clear();
+  put(v, kX25519, 2);
+  put_vector(v, public_share(share_), 2);
+  put_extension(ext, kKeyShare, v);
+  std::string hello;
+  put(hello, 0x0303, 2);
+  hello += random_bytes(32);
+  put_vector(hello, session_id, 1);
+  put(hello, kAes128GcmSha256, 2);
+  hello += '\0';
+  put_vector(hello, ext, 2);
+  write_message(Level::initial, kServerHello, hello);
+  if (!derive_handshake_secrets(peer_share)) return fail(kIllegalParameter);
+
+  ext.clear();
+  if (!alpn_.empty()) put_extension(ext, kAlpn, alpn_extension(alpn_));
+  if (quic()) put_extension(ext, kQuicTransportParameters, parameters_);
+  std::string encrypted;
+  put_vector(encrypted, ext, 2);
+  write_message(Level::handshake, kEncryptedExtensions, encrypted);
+
+  std::string list;
+  for (const auto& der : credentials_->chain()) {
+    put_vector(list, der, 3);
+    put(list, 0, 2);  // no extensions
+  }
+  std::string certificate;
+  certificate += '\0';  // certificate_request_context
+  put_vector(certificate, list, 3);
+  write_message(Level::handshake, kCertificate, certificate);
+
+  auto signature = sign(credentials_->key(), scheme, signed_content(transcript_hash()));
+  if (signature.empty()) return fail(kInternalError);
+  std::string verify;
+  put(verify, scheme, 2);
+  put_vector(verify, signature, 2);
+  write_message(Level::handshake, kCertificateVerify, verify);
+
+  write_message(Level::handshake, kFinished, finished_mac(write_secret(Level::handshake)));
+  derive_application_secrets();
+  state_ = State::finished;
+  return true;
+}
+
+bool Handshake::on_server_hello(std::string_view body) {
+  Reader r(body);
+  r.number(2);
+  auto random = r.bytes(32);
+  r.vector(1);
+  auto suite = r.number(2);
+  r.number(1);
+  auto extensions = r.vector(2);
+  if (!r.ok()) return fail(kDecodeError);
+  // A HelloRetryRequest is a ServerHello with this random. We offered only
+  // X25519, so there is no other group to retry with.
+  static constexpr unsigned char kRetry[] = {0xcf, 0x21, 0xad, 0x74, 0xe5, 0x9a, 0x61, 0x11, 0xbe, 0x1d, 0x8c,
+                                             0x02, 0x1e, 0x65, 0xb8, 0x91, 0xc2, 0xa2, 0x11, 0x16, 0x7a, 0xbb,
+                                             0x8c, 0x5e, 0x07, 0x9e, 0x09, 0xe2, 0xc8, 0xa8, 0x33, 0x9c};
+  if (std::memcmp(random.data(), kRetry, sizeof kRetry) == 0) return fail(kHandshakeFailure);
+  if (suite != kAes128GcmSha256) return fail(kIllegalParameter);
+
+  bool tls13 = false;
+  std::string_view peer_share;
+  Reader e(extensions);
+  while (e.ok() && !e.empty()) {
+    auto type = e.number(2);
+    Reader x(e.vector(2));
+    if (type == kSupportedVersions) tls13 = x.number(2) == kTls13;
+    if (type == kKeyShare && x.number(2) == kX25519) peer_share = x.vector(2);
+  }
+  if (!e.ok()) return fail(kDecodeError);
+  if (!tls13) return fail(kProtocolVersion);
+  if (peer_share.size() != kX25519Size || !derive_handshake_secrets(peer_share)) return fail(kIllegalParameter);
+  state_ = State::encrypted_extensions;
+  return true;
+}
+
+bool Handshake::on_encrypted_extensions(std::string_view body) {
+  Reader r(body);
+  Reader e(r.vector(2));
+  bool alpn = false;
+  bool have_parameters = false;
+  while (e.ok() && !e.empty()) {
+    auto type = e.number(2);
+    auto data = e.vector(2);
+    if (type == kAlpn) {
+      Reader names(Reader(data).vector(2));
+      alpn = names.vector(1) == alpn_ && names.empty();
+      if (!alpn) return fail(kIllegalParameter);
+    } else if (type == kQuicTransportParameters) {
+      peer_parameters_ = data;
+      have_parameters = true;
+    }
+  }
+  if (!e.ok()) return fail(kDecodeError);
+  // Over TCP a server may choose no protocol; over QUIC it must.
+  if (!alpn && quic()) return fail(kNoApplicationProtocol);
+  if (!alpn) alpn_.clear();
+  if (quic() && !have_parameters) return fail(kMissingExtension);
+  state_ = State::certificate;
+  return true;
+}
+
+bool Handshake::on_certificate(std::string_view body) {
+  Reader r(body);
+  r.vector(1);
+  Reader list(r.vector(3));
+  auto leaf = list.vector(3);
+  if (!r.ok() || !list.ok() || leaf.empty()) return fail(kDecodeError);
+  const unsigned char* p = bytes_of(leaf);
+  X509* cert = d2i_X509(nullptr, &p, static_cast<long>(leaf.size()));
+  if (cert == nullptr) return fail(kBadCertificate);
+  peer_key_ = X509_get_pubkey(cert);
+  X509_free(cert);
+  if (peer_key_ == nullptr) return fail(kBadCertificate);
+  state_ = State::certificate_verify;
+  return true;
+}
+
+bool Handshake::on_certificate_verify(std::string_view body, std::string_view message) {
+  Reader r(body);
+  auto scheme = static_cast<std::uint16_t>(r.number(2));
+  auto signature = r.vector(2);
+  if (!r.ok() || !r.empty()) return fail(kDecodeError);
+  if (!verify(peer_key_, scheme, signed_content(transcript_hash()), signature)) return fail(kDecryptError);
+  transcript_ += message;
+  state_ = State::finished;
+  return true;
+}
+
+bool Handshake::on_finished(std::string_view body, std::string_view message) {
+  if (body != finished_mac(read_secret(Level::handshake))) return fail(kDecryptError);
+  transcript_ += message;
+  if (server_) {
+    state_ = State::done;
+    return true;
+  }
+  // The client's secrets cover the transcript through the server's
+  // Finished, so they are derived before its own Finished joins it.
+  derive_application_secrets();
+  write_message(Level::handshake, kFinished, finished_mac(write_secret(Level::handshake)));
+  state_ = State::done;
+  return true;
+}
+
+// RFC 8446 section 4.6.3: the peer's next record is under a new key. If it
+// asks, ours are too, from after the KeyUpdate we answer with.
+bool Handshake::on_key_update(std::string_view body) {
+  if (body.size() != 1 || static_cast<unsigned char>(body[0]) > 1) return fail(kIllegalParameter);
+  auto level = static_cast<std::size_t>(Level::application);
+  read_secret_[level] = hkdf_expand_label(read_secret_[level], "traffic upd", {}, kHashSize);
+  if (body[0] == 1) {
+    output(Level::application) += std::string_view("\x18\x00\x00\x01\x00", 5);  // update_not_requested
+    write_secret_[level] = hkdf_expand_label(write_secret_[level], "traffic upd", {}, kHashSize);
+  }
+  return true;
+}
+
+// RFC 8446 section 7.1, from the start up to the handshake traffic secrets.
+bool Handshake::derive_handshake_secrets(std::string_view peer_share) {
+  auto shared = shared_secret(share_, peer_share);
+  if (shared.empty()) return false;
+  auto early = hkdf_extract({}, std::string(kHashSize, '\0'));
+  auto derived = hkdf_expand_label(early, "derived", sha256({}), kHashSize);
+  handshake_secret_ = hkdf_extract(derived, shared);
+  auto hash = transcript_hash();
+  auto client = hkdf_expand_label(handshake_secret_, "c hs traffic", hash, kHashSize);
+  auto server = hkdf_expand_label(handshake_secret_, "s hs traffic", hash, kHashSize);
+  auto level = static_cast<std::size_t>(Level::handshake);
+  read_secret_[level] = server_ ? client : server;
+  write_secret_[level] = server_ ? server : client;
+  return true;
+}
+
+// The rest of section 7.1, over the transcript through the server's
+// Finished.
+void Handshake::derive_application_secrets() {
+  auto derived = hkdf_expand_label(handshake_secret_, "derived", sha256({}), kHashSize);
+  auto master = hkdf_extract(derived, std::string(kHashSize, '\0'));
+  auto hash = transcript_hash();
+  auto client = hkdf_expand_label(master, "c ap traffic", hash, kHashSize);
+  auto server = hkdf_expand_label(master, "s ap traffic", hash, kHashSize);
+  auto level = static_cast<std::size_t>(Level::application);
+  read_secret_[level] = server_ ? client : server;
+  write_secret_[level] = server_ ? server : client;
+}
+
+void Handshake::write_message(Level level, std::uint8_t type, std::string_view body) {
+  std::string message;
+  message += static_cast<char>(type);
+  put_vector(message, body, 3);
+  transcript_ += message;
+  output(level) += message;
+}
+
+std::string Handshake::finished_mac(const std::string& traffic_secret) const {
+  return hmac(hkdf_expand_label(traffic_secret, "finished", {}, kHashSize), transcript_hash());
+}
+
+}  // namespace mt::tls13
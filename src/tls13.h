@@ -0,0 +1,153 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+struct evp_pkey_st;
+
+// The TLS 1.3 handshake (RFC 8446): handshake messages only, with no
+// record layer. QUIC carries them in CRYPTO frames (RFC 9001), tls::Session
+// in TLS records over TCP; either protects them with the secrets each step
+// yields. Built on libcrypto; it offers TLS_AES_128_GCM_SHA256 with X25519
+// and no resumption or 0-RTT.
+namespace mt::tls13 {
+
+// Encryption levels, each with its own keys and packet number space.
+enum class Level : std::uint8_t { initial, handshake, application };
+inline constexpr std::size_t kLevels = 3;
+
+// SHA-256 and HKDF-SHA256 (RFC 5869), and TLS 1.3's HKDF-Expand-Label.
+inline constexpr std::size_t kHashSize = 32;
+std::string sha256(std::string_view data);
+std::string hkdf_extract(std::string_view salt, std::string_view ikm);
+std::string hkdf_expand_label(std::string_view secret, std::string_view label, std::string_view context,
+                              std::size_t length);
+
+// A certificate chain and its private key. P-256 ECDSA, Ed25519 and RSA
+// (signing with PSS) keys are supported.
+class Credentials {
+ public:
+  // Loads PEM files: the leaf certificate first, then any intermediates.
+  // Throws std::runtime_error when a file is missing or malformed.
+  static std::shared_ptr<const Credentials> load(const std::string& cert_path, const std::string& key_path);
+  ~Credentials();
+
+  const std::vector<std::string>& chain() const { return chain_; }  // DER
+  evp_pkey_st* key() const { return key_; }
+
+ private:
+  Credentials() = default;
+  std::vector<std::string> chain_;
+  evp_pkey_st* key_ = nullptr;
+};
+
+// TLS alerts, sent in QUIC as CONNECTION_CLOSE with 0x100 + the alert.
+enum Alert : std::uint8_t {
+  kCloseNotify = 0,
+  kUnexpectedMessage = 10,
+  kBadRecordMac = 20,
+  kRecordOverflow = 22,
+  kHandshakeFailure = 40,
+  kBadCertificate = 42,
+  kIllegalParameter = 47,
+  kDecodeError = 50,
+  kDecryptError = 51,
+  kProtocolVersion = 70,
+  kInternalError = 80,
+  kMissingExtension = 109,
+  kNoApplicationProtocol = 120,
+};
+
+// One side of a handshake. For QUIC, `transport_parameters` is the
+// quic_transport_parameters extension, which the peer must send too, and
+// ALPN is required. Over TCP it is empty: a client that offers no ALPN is
+// served, and the peer's KeyUpdate messages are answered.
+class Handshake {
+ public:
+  // A server, choosing the first of `alpn` the client offers.
+  // `transport_parameters` goes in EncryptedExtensions.
+  Handshake(std::shared_ptr<const Credentials> credentials, std::vector<std::string> alpn,
+            std::string transport_parameters);
+  // A client, which sends its ClientHello at once, offering `alpn` unless
+  // it is empty. It checks the server's signature over the handshake but
+  // not its certificate chain, so it is for load generation, not for
+  // talking to servers one cannot trust.
+  Handshake(std::string server_name, std::string alpn, std::string transport_parameters);
+  ~Handshake();
+  Handshake(const Handshake&) = delete;
+  Handshake& operator=(const Handshake&) = delete;
+
+  // Takes CRYPTO data received at `level`, in order. Returns false on a
+  // handshake failure; alert() says which.
+  bool receive(Level level, std::string_view data);
+
+  // Handshake bytes to send at `level`. The caller moves them out.
+  std::string& output(Level level) { return output_[static_cast<std::size_t>(level)]; }
+
+  // Traffic secrets, empty until the handshake reaches `level`. Initial
+  // secrets come from the connection ID, not from here. A KeyUpdate
+  // replaces the application ones.
+  const std::string& read_secret(Level level) const { return read_secret_[static_cast<std::size_t>(level)]; }
+  const std::string& write_secret(Level level) const { return write_secret_[static_cast<std::size_t>(level)]; }
+
+  // True once the peer's Finished has been verified (server) or ours has
+  // been written (client).
+  bool complete() const { return state_ == State::done; }
+  std::uint8_t alert() const { return alert_; }
+  // The protocol ALPN chose, once known; empty if the client offered none.
+  const std::string& alpn() const { return alpn_; }
+  // The peer's quic_transport_parameters extension, once received.
+  const std::string& peer_transport_parameters() const { return peer_parameters_; }
+
+ private:
+  enum class State : std::uint8_t {
+    client_hello,         // server: waiting for it
+    server_hello,         // client: waiting for it, and the rest in turn
+    encrypted_extensions,
+    certificate,
+    certificate_verify,
+    finished,
+    done,
+  };
+
+  bool fail(std::uint8_t alert);
+  bool on_message(std::uint8_t type, std::string_view body, std::string_view message);
+  bool on_client_hello(std::string_view body);
+  bool on_server_hello(std::string_view body);
+  bool on_encrypted_extensions(std::string_view body);
+  bool on_certificate(std::string_view body);
+  bool on_certificate_verify(std::string_view body, std::string_view message);
+  bool on_finished(std::string_view body, std::string_view message);
+  bool on_key_update(std::string_view body);
+  bool derive_handshake_secrets(std::string_view peer_share);
+  void derive_application_secrets();
+  void write_message(Level level, std::uint8_t type, std::string_view body);
+  std::string finished_mac(const std::string& traffic_secret) const;
+  std::string transcript_hash() const { return sha256(transcript_); }
+  bool quic() const { return !parameters_.empty(); }
+
+  bool server_;
+  std::shared_ptr<const Credentials> credentials_;
+  std::vector<std::string> offered_;  // server: what it speaks, by preference
+  std::string alpn_;
+  std::string parameters_;
+  std::string peer_parameters_;
+  State state_;
+  std::uint8_t alert_ = 0;
+  evp_pkey_st* share_ = nullptr;  // our X25519 key
+  evp_pkey_st* peer_key_ = nullptr;  // client: from the server's certificate
+  std::string transcript_;  // every handshake message so far
+  std::string handshake_secret_;
+  std::string input_;  // a message not yet wholly received
+  Level input_level_ = Level::initial;
+  std::array<std::string, kLevels> output_;
+  std::array<std::string, kLevels> read_secret_;
+  std::array<std::string, kLevels> write_secret_;
+};
+
+}  // namespace mt::tls13
@@ -0,0 +1,218 @@
+#include "uring.h"
+
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace mt::uring {
+
+namespace {
+
+std::runtime_error sys_error(std::string_view what) {
+  return std::runtime_error(std::string(what) + ": " + std::strerror(errno));
+}
+
+int setup(unsigned entries, io_uring_params& params) {
+  return static_cast<int>(::syscall(__NR_io_uring_setup, entries, &params));
+}
+
+int register_op(int fd, unsigned op, const void* arg, unsigned count) {
+  return static_cast<int>(::syscall(__NR_io_uring_register, fd, op, arg, count));
+}
+
+void* map(int fd, std::size_t size, off_t offset) {
+  void* p = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, offset);
+  if (p == MAP_FAILED) throw sys_error("io_uring mmap");
+  return p;
+}
+
+}  // namespace
+
+bool available() {
+  io_uring_params params{};
+  int fd = setup(2, params);
+  if (fd < 0) return false;
+  // Zero-copy send came in the same release as multishot receive, and the
+  // probe lists it where the kernel has both.
+  std::vector<char> storage(sizeof(io_uring_probe) + 256 * sizeof(io_uring_probe_op));
+  auto* probe = reinterpret_cast<io_uring_probe*>(storage.data());
+  bool ok = register_op(fd, IORING_REGISTER_PROBE, probe, 256) == 0 && probe->last_op >= IORING_OP_SEND_ZC &&
+            (probe->ops[IORING_OP_SEND_ZC].flags & IO_URING_OP_SUPPORTED) != 0;
+  ::close(fd);
+  return ok;
+}
+
+Ring::Ring(unsigned entries) {
+  // Task work, completions included, runs only when we wait, in batches,
+  // on the one thread that submits.
+  io_uring_params params{};
+  params.flags = IORING_SETUP_CQSIZE | IORING_SETUP_SUBMIT_ALL | IORING_SETUP_R_DISABLED |
+                 IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_DEFER_TASKRUN;
+  params.cq_entries = 4 * entries;
+  fd_ = setup(entries, params);
+  if (fd_ < 0 && errno == EINVAL) {
+    // Before 6.1.
+    params = {};
+    params.flags = IORING_SETUP_CQSIZE | IORING_SETUP_SUBMIT_ALL | IORING_SETUP_COOP_TASKRUN;
+    params.cq_entries = 4 * entries;
+    fd_ = setup(entries, params);
+  }
+  if (fd_ < 0) throw sys_error("io_uring_setup");
+
+  try {
+    sq_map_size_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cq_map_size_ = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP) sq_map_size_ = cq_map_size_ = std::max(sq_map_size_, cq_map_size_);
+    sq_map_ = map(fd_, sq_map_size_, IORING_OFF_SQ_RING);
+    cq_map_ = params.features & IORING_FEAT_SINGLE_MMAP ? sq_map_ : map(fd_, cq_map_size_, IORING_OFF_CQ_RING);
+    sqes_size_ = params.sq_entries * sizeof(io_uring_sqe);
+    sqes_ = static_cast<io_uring_sqe*>(map(fd_, sqes_size_, IORING_OFF_SQES));
+  } catch (...) {
+    release();
+    throw;
+  }
+
+  auto* sq = static_cast<char*>(sq_map_);
+  sq_head_ptr_ = reinterpret_cast<const unsigned*>(sq + params.sq_off.head);
+  sq_tail_ptr_ = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+  sq_mask_ = *reinterpret_cast<const unsigned*>(sq + params.sq_off.ring_mask);
+  sq_entries_ = params.sq_entries;
+  sq_tail_ = *sq_tail_ptr_;
+  // Slot i of the queue always holds entry i.
+  auto* array = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+  for (unsigned i = 0; i < sq_entries_; ++i) array[i] = i;
+
+  auto* cq = static_cast<char*>(cq_map_);
+  cq_head_ptr_ = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+  cq_tail_ = reinterpret_cast<const unsigned*>(cq + params.cq_off.tail);
+  cq_mask_ = *reinterpret_cast<const unsigned*>(cq + params.cq_off.ring_mask);
+  cq_head_ = *cq_head_ptr_;
+  cqes_ = reinterpret_cast<const io_uring_cqe*>(cq + params.cq_off.cqes);
+}
+
+Ring::~Ring() { release(); }
+
+void Ring::release() {
+  // Closing the ring cancels what is in flight before the memory goes.
+  if (fd_ >= 0) ::close(fd_);
+  if (sqes_ != nullptr) ::munmap(sqes_, sqes_size_);
+  if (cq_map_ != nullptr && cq_map_ != sq_map_) ::munmap(cq_map_, cq_map_size_);
+  if (sq_map_ != nullptr) ::munmap(sq_map_, sq_map_size_);
+  if (buf_ring_ != nullptr) ::munmap(buf_ring_, buf_ring_size_);
+  if (buffers_ != nullptr) ::munmap(buffers_, buffers_size_);
+}
+
+void Ring::enable() {
+  // EBADFD: the ring was not started disabled.
+  if (register_op(fd_, IORING_REGISTER_ENABLE_RINGS, nullptr, 0) != 0 && errno != EBADFD) {
+    throw sys_error("io_uring enable");
+  }
+}
+
+io_uring_sqe& Ring::get() {
+  reserve(1);
+  auto& sqe = sqes_[sq_tail_ & sq_mask_];
+  std::memset(&sqe, 0, sizeof sqe);
+  ++sq_tail_;
+  ++queued_;
+  return sqe;
+}
+
+void Ring::reserve(unsigned n) {
+  if (sq_tail_ - __atomic_load_n(sq_head_ptr_, __ATOMIC_ACQUIRE) + n > sq_entries_) submit();
+}
+
+void Ring::submit() {
+  while (queued_ > 0) {
+    int n = enter(queued_, 0, 0, nullptr, 0);
+    if (n < 0) {
+      if (errno == EINTR || errno == EAGAIN || errno == EBUSY) continue;
+      throw sys_error("io_uring_enter");
+    }
+    queued_ -= static_cast<unsigned>(n);
+  }
+}
+
+void Ring::wait(int timeout_ms) {
+  __kernel_timespec ts{};
+  io_uring_getevents_arg arg{};
+  arg.sigmask_sz = _NSIG / 8;
+  if (timeout_ms > 0) {
+    ts.tv_sec = timeout_ms / 1000;
+    ts.tv_nsec = static_cast<long long>(timeout_ms % 1000) * 1000000;
+    arg.ts = reinterpret_cast<std::uintptr_t>(&ts);
+  }
+  // With nothing to wait for, this still runs the task work that posts
+  // completions.
+  bool ready = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE) != cq_head_;
+  unsigned wait = timeout_ms == 0 || ready ? 0 : 1;
+  int n = enter(queued_, wait, IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG, &arg, sizeof arg);
+  // ETIME and EINTR end a wait early; a full completion queue (EBUSY)
+  // drains before the next one.
+  if (n > 0) queued_ -= std::min(queued_, static_cast<unsigned>(n));
+}
+
+int Ring::enter(unsigned submit, unsigned wait, unsigned flags, const void* arg, std::size_t arg_size) {
+  __atomic_store_n(sq_tail_ptr_, sq_tail_, __ATOMIC_RELEASE);
+  return static_cast<int>(::syscall(__NR_io_uring_enter, fd_, submit, wait, flags, arg, arg_size));
+}
+
+void Ring::register_files(unsigned capacity) {
+  io_uring_rsrc_register reg{};
+  reg.nr = capacity;
+  reg.flags = IORING_RSRC_REGISTER_SPARSE;
+  if (register_op(fd_, IORING_REGISTER_FILES2, &reg, sizeof reg) != 0) throw sys_error("io_uring register files");
+}
+
+void Ring::update_files(unsigned offset, std::span<const int> fds) {
+  io_uring_files_update update{};
+  update.offset = offset;
+  update.fds = reinterpret_cast<std::uintptr_t>(fds.data());
+  if (register_op(fd_, IORING_REGISTER_FILES_UPDATE, &update, static_cast<unsigned>(fds.size())) < 0) {
+    throw sys_error("io_uring update files");
+  }
+}
+
+bool Ring::register_buffer(iovec buffer) { return register_op(fd_, IORING_REGISTER_BUFFERS, &buffer, 1) == 0; }
+
+void Ring::provide_buffers(std::uint16_t group, unsigned count, std::size_t size) {
+  buf_ring_size_ = count * sizeof(io_uring_buf);
+  void* ring = ::mmap(nullptr, buf_ring_size_, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (ring == MAP_FAILED) throw sys_error("mmap");
+  buf_ring_ = static_cast<io_uring_buf_ring*>(ring);
+  buffers_size_ = count * size;
+  void* buffers = ::mmap(nullptr, buffers_size_, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (buffers == MAP_FAILED) throw sys_error("mmap");
+  buffers_ = static_cast<char*>(buffers);
+  buffer_size_ = size;
+  buf_mask_ = count - 1;
+
+  io_uring_buf_reg reg{};
+  reg.ring_addr = reinterpret_cast<std::uintptr_t>(buf_ring_);
+  reg.ring_entries = count;
+  reg.bgid = group;
+  if (register_op(fd_, IORING_REGISTER_PBUF_RING, &reg, 1) != 0) throw sys_error("io_uring register buffer ring");
+  for (unsigned i = 0; i < count; ++i) recycle(static_cast<std::uint16_t>(i));
+}
+
+void Ring::recycle(std::uint16_t id) {
+  // Not buf_ring_->bufs: in C++ the empty member before it takes a byte,
+  // which moves the array.
+  auto& buf = reinterpret_cast<io_uring_buf*>(buf_ring_)[buf_tail_ & buf_mask_];
+  buf.addr = reinterpret_cast<std::uintptr_t>(buffer(id));
+  buf.len = static_cast<std::uint32_t>(buffer_size_);
+  buf.bid = id;
+  // The tail shares the first entry's reserved field.
+  __atomic_store_n(&buf_ring_->tail, ++buf_tail_, __ATOMIC_RELEASE);
+}
+
+}  // namespace mt::uring
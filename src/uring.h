@@ -0,0 +1,109 @@
+#pragma once
+
+#include <linux/io_uring.h>
+#include <sys/uio.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+
+// io_uring(7) on its raw system calls: the submission and completion
+// rings, registered files and buffers, and a ring of provided buffers for
+// multishot receives. liburing does the same and more; this is the part
+// the server uses.
+namespace mt::uring {
+
+// True if the kernel has what Ring's users need: rings of provided buffers
+// and multishot accept and receive, which is 6.0 and later. False too when
+// io_uring is turned off (the io_uring_disabled sysctl, a seccomp filter).
+bool available();
+
+class Ring {
+ public:
+  // A ring of `entries` submissions, started disabled where the kernel
+  // allows it so that the thread calling enable() can be its only
+  // submitter. Throws std::runtime_error.
+  explicit Ring(unsigned entries);
+  ~Ring();
+  Ring(const Ring&) = delete;
+  Ring& operator=(const Ring&) = delete;
+
+  // Makes the calling thread the ring's submitter. Call once, before get().
+  void enable();
+
+  // A zeroed submission entry, queued. A full queue is submitted first.
+  io_uring_sqe& get();
+  // Makes room for `n` entries in a row, so a chain of linked ones is
+  // submitted whole.
+  void reserve(unsigned n);
+
+  // Submits what is queued. wait() also waits, for a completion or until
+  // `timeout_ms` passes (-1: no limit, 0: not at all).
+  void submit();
+  void wait(int timeout_ms);
+
+  // Calls `f` with each completion that is ready, oldest first. `f` may
+  // queue submissions, and completions they cause at once are seen too.
+  template <typename F>
+  void drain(F&& f) {
+    for (;;) {
+      auto tail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+      if (cq_head_ == tail) return;
+      auto cqe = cqes_[cq_head_ & cq_mask_];
+      __atomic_store_n(cq_head_ptr_, ++cq_head_, __ATOMIC_RELEASE);
+      f(cqe);
+    }
+  }
+
+  // Registers a table of `capacity` files, all empty, and sets `fds` at
+  // `offset` in it (-1 empties a slot). A slot is used with
+  // IOSQE_FIXED_FILE. Throws std::runtime_error.
+  void register_files(unsigned capacity);
+  void update_files(unsigned offset, std::span<const int> fds);
+  // Registers `buffer` as buffer 0 for READ_FIXED. Returns false when the
+  // kernel refuses, usually for RLIMIT_MEMLOCK.
+  bool register_buffer(iovec buffer);
+
+  // A ring of `count` buffers of `size` bytes each, a power of two of them,
+  // that receives with IOSQE_BUFFER_SELECT in `group` take from. A
+  // completion's buffer goes back with recycle(). Throws
+  // std::runtime_error.
+  void provide_buffers(std::uint16_t group, unsigned count, std::size_t size);
+  char* buffer(std::uint16_t id) const { return buffers_ + static_cast<std::size_t>(id) * buffer_size_; }
+  void recycle(std::uint16_t id);
+
+ private:
+  void release();
+  int enter(unsigned submit, unsigned wait, unsigned flags, const void* arg, std::size_t arg_size);
+
+  int fd_ = -1;
+  void* sq_map_ = nullptr;
+  std::size_t sq_map_size_ = 0;
+  void* cq_map_ = nullptr;  // sq_map_ where the kernel maps both at once
+  std::size_t cq_map_size_ = 0;
+  io_uring_sqe* sqes_ = nullptr;
+  std::size_t sqes_size_ = 0;
+
+  unsigned* sq_tail_ptr_ = nullptr;
+  const unsigned* sq_head_ptr_ = nullptr;
+  unsigned sq_mask_ = 0;
+  unsigned sq_entries_ = 0;
+  unsigned sq_tail_ = 0;
+  unsigned queued_ = 0;  // not yet submitted
+
+  unsigned* cq_head_ptr_ = nullptr;
+  const unsigned* cq_tail_ = nullptr;
+  unsigned cq_mask_ = 0;
+  unsigned cq_head_ = 0;
+  const io_uring_cqe* cqes_ = nullptr;
+
+  io_uring_buf_ring* buf_ring_ = nullptr;
+  std::size_t buf_ring_size_ = 0;
+  unsigned buf_mask_ = 0;
+  std::uint16_t buf_tail_ = 0;
+  char* buffers_ = nullptr;
+  std::size_t buffer_size_ = 0;
+  std::size_t buffers_size_ = 0;
+};
+
+}  // namespace mt::uring